@@ -65,6 +65,7 @@ import java.io.UnsupportedEncodingException;
 import java.net.URLDecoder;
 import java.net.URLEncoder;
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.nio.CharBuffer;
 import java.nio.charset.CharacterCodingException;
 import java.nio.charset.CharsetDecoder;
@@ -97,6 +98,7 @@ public class WifiNative {
 
     // Must match wifi_hal.h
     public static final int WIFI_SUCCESS = 0;
+    public static final int WIFI_ERROR_NOT_SUPPORTED = -3;
 
     /**
      * Hold this lock before calling supplicant or HAL methods
@@ -920,10 +922,20 @@ public class WifiNative {
     }
 
     public boolean setCountryCode(String countryCode) {
+        boolean success;
         if (countryCode != null)
-            return doBooleanCommand("DRIVER COUNTRY " + countryCode.toUpperCase(Locale.ROOT));
+            success = doBooleanCommand("DRIVER COUNTRY " + countryCode.toUpperCase(Locale.ROOT));
         else
-            return doBooleanCommand("DRIVER COUNTRY");
+            success = doBooleanCommand("DRIVER COUNTRY");
+        if (success) {
+            /* the HAL's valid channel lists were for the old regulatory domain */
+            synchronized (sLock) {
+                if (isHalStarted()) {
+                    invalidateValidChannelsNative();
+                }
+            }
+        }
+        return success;
     }
 
     /**
@@ -1566,6 +1578,156 @@ public class WifiNative {
         }
     }
 
+    /*
+     * Event ring: when enabled, the native side writes full scan results, RSSI threshold breaches
+     * and logger ring data into a ring that EventRingThread reads, instead of calling back into
+     * Java for each event. Scan status events go through it too, so that they stay behind the
+     * full results of their scan. The record layout is described with the native side.
+     */
+    private static final String EVENT_RING_PROPERTY = "persist.wifi.hal.event_ring";
+    private static final int EVENT_RING_SIZE = 256 * 1024;
+    private static final int EVENT_HEADER_SIZE = 8;
+    private static final int EVENT_PAD = 0;
+    private static final int EVENT_FULL_SCAN_RESULT = 1;
+    private static final int EVENT_RSSI_THRESHOLD_BREACHED = 2;
+    private static final int EVENT_RING_BUFFER_DATA = 3;
+    private static final int EVENT_SCAN_STATUS = 4;
+    private static final int EVENT_RING_TYPES = (1 << EVENT_FULL_SCAN_RESULT)
+            | (1 << EVENT_RSSI_THRESHOLD_BREACHED) | (1 << EVENT_RING_BUFFER_DATA)
+            | (1 << EVENT_SCAN_STATUS);
+
+    private static native ByteBuffer enableEventRingNative(int size, int types);
+    private static native long waitEventRingNative(long consumed);
+    private static native void disableEventRingNative();
+
+    private static EventRingThread sEventRingThread;
+
+    private static class EventRingThread extends Thread {
+        private final ByteBuffer mRing;
+
+        EventRingThread(ByteBuffer ring) {
+            super("WifiEventRing");
+            mRing = ring.order(ByteOrder.nativeOrder());
+        }
+
+        public void run() {
+            int mask = mRing.capacity() - 1;
+            long consumed = 0;
+            long head;
+            while ((head = waitEventRingNative(consumed)) >= 0) {
+                while (consumed < head) {
+                    int offset = (int) consumed & mask;
+                    int length = mRing.getInt(offset);
+                    int type = mRing.getInt(offset + 4);
+                    try {
+                        dispatchEvent(mRing, type, offset + EVENT_HEADER_SIZE);
+                    } catch (RuntimeException e) {
+                        Log.e(TAG, "Error handling event of type " + type, e);
+                    }
+                    consumed += (length + 7) & ~7;
+                }
+            }
+            Log.d(TAG, "Event ring disabled");
+        }
+    }
+
+    private static void startEventRing() {
+        ByteBuffer ring = enableEventRingNative(EVENT_RING_SIZE, EVENT_RING_TYPES);
+        if (ring == null) {
+            Log.e(TAG, "Could not enable the event ring; events are delivered by callbacks");
+            return;
+        }
+        sEventRingThread = new EventRingThread(ring);
+        sEventRingThread.start();
+    }
+
+    private static void stopEventRing() {
+        if (sEventRingThread != null) {
+            disableEventRingNative();
+            try {
+                sEventRingThread.join(STOP_HAL_TIMEOUT_MS);
+            } catch (InterruptedException e) {
+                Log.e(TAG, "Could not stop the event ring thread cleanly");
+            }
+            if (sEventRingThread.isAlive()) {
+                // The native side refuses to enable the ring again until it has exited.
+                Log.e(TAG, "Event ring thread still running; events are delivered by callbacks");
+            }
+            sEventRingThread = null;
+        }
+    }
+
+    /* reads a record the way the callback it replaces would have received it */
+    private static void dispatchEvent(ByteBuffer ring, int type, int offset) {
+        switch (type) {
+            case EVENT_FULL_SCAN_RESULT: {
+                ScanResult result = new ScanResult();
+                int ssidLength = ring.get(offset + 38) & 0xff;
+                if (ssidLength > 0) {
+                    byte[] ssid = new byte[ssidLength];
+                    ring.position(offset + 40);
+                    ring.get(ssid);
+                    setSsid(ssid, result);
+                }
+                result.BSSID = macAddressToString(ring, offset + 32);
+                result.level = ring.getInt(offset + 20);
+                result.frequency = ring.getInt(offset + 24);
+                result.timestamp = ring.getLong(offset);
+                result.bytes = new byte[ring.getInt(offset + 28)];
+                ring.position(offset + 72);
+                ring.get(result.bytes);
+                onFullScanResult(ring.getInt(offset + 8), result, ring.getInt(offset + 12),
+                        ring.getInt(offset + 16));
+                break;
+            }
+            case EVENT_RSSI_THRESHOLD_BREACHED:
+                onRssiThresholdBreached(ring.getInt(offset), (byte) ring.getInt(offset + 4));
+                break;
+            case EVENT_RING_BUFFER_DATA: {
+                RingBufferStatus status = new RingBufferStatus();
+                status.flag = ring.getInt(offset);
+                status.ringBufferId = ring.getInt(offset + 4);
+                status.ringBufferByteSize = ring.getInt(offset + 8);
+                status.verboseLevel = ring.getInt(offset + 12);
+                status.writtenBytes = ring.getInt(offset + 16);
+                status.readBytes = ring.getInt(offset + 20);
+                status.writtenRecords = ring.getInt(offset + 24);
+                byte[] name = new byte[32];
+                ring.position(offset + 32);
+                ring.get(name);
+                int nameLength = 0;
+                while (nameLength < name.length && name[nameLength] != 0) nameLength++;
+                status.name = new String(name, 0, nameLength, StandardCharsets.UTF_8);
+                byte[] data = new byte[ring.getInt(offset + 28)];
+                ring.position(offset + 64);
+                ring.get(data);
+                onRingBufferData(status, data);
+                break;
+            }
+            case EVENT_SCAN_STATUS:
+                onScanStatus(ring.getInt(offset), ring.getInt(offset + 4));
+                break;
+            case EVENT_PAD:
+                break;
+            default:
+                Log.e(TAG, "Unknown event type " + type);
+                break;
+        }
+    }
+
+    private static final char[] HEX_DIGITS = "0123456789abcdef".toCharArray();
+
+    private static String macAddressToString(ByteBuffer buffer, int offset) {
+        char[] chars = new char[17];
+        for (int i = 0; i < 6; i++) {
+            int b = buffer.get(offset + i) & 0xff;
+            chars[i * 3] = HEX_DIGITS[b >> 4];
+            chars[i * 3 + 1] = HEX_DIGITS[b & 0xf];
+            if (i < 5) chars[i * 3 + 2] = ':';
+        }
+        return new String(chars);
+    }
+
     public boolean startHal() {
         String debugLog = "startHal stack: ";
         java.lang.StackTraceElement[] elements = Thread.currentThread().getStackTrace();
@@ -1585,6 +1747,23 @@ public class WifiNative {
                 sWlan0Index = wlan0Index;
                 sThread = new MonitorThread();
                 sThread.start();
+                if (SystemProperties.getBoolean(EVENT_RING_PROPERTY, false)) {
+                    startEventRing();
+                }
+                if (!SystemProperties.getBoolean(SCAN_HISTORY_PROPERTY, false)) {
+                    disableScanHistoryNative(SCAN_HISTORY_DIR);
+                } else if (!enableScanHistoryNative(SCAN_HISTORY_DIR, SCAN_HISTORY_SEGMENT_BYTES,
+                        SCAN_HISTORY_SEGMENTS)) {
+                    Log.e(TAG, "Could not enable the scan history");
+                }
+                if (!SystemProperties.getBoolean(LINK_STATS_HISTORY_PROPERTY, false)) {
+                    disableLinkStatsHistoryNative(LINK_STATS_DIR);
+                } else if (!enableLinkStatsHistoryNative(LINK_STATS_DIR)) {
+                    Log.e(TAG, "Could not enable the link stats history");
+                }
+                setScanPeriodControlNative(
+                        SystemProperties.getInt(SCAN_PERIOD_CONTROL_PROPERTY, 0),
+                        SCAN_PERIOD_CONTROL_HOLD_MS);
                 return true;
             } else {
                 if (DBG) sLocalLog.log("Could not start hal");
@@ -1605,6 +1784,8 @@ public class WifiNative {
                     Log.e(TAG, "Could not stop HAL cleanly");
                 }
                 sThread = null;
+                stopEventRing();
+                disableLinkStatsHistoryNative(null);
                 sWifiHalHandle = 0;
                 sWifiIfaceHandles = null;
                 sWlan0Index = -1;
@@ -1667,6 +1848,8 @@ public class WifiNative {
     private static native boolean stopScanNative(int iface, int id);
     private static native WifiScanner.ScanData[] getScanResultsNative(int iface, boolean flush);
     private static native WifiLinkLayerStats getWifiLinkLayerStatsNative(int iface);
+    private static native boolean fillWifiLinkLayerStatsNative(int iface,
+            WifiLinkLayerStats stats);
     private static native void setWifiLinkLayerStatsNative(int iface, int enable);
 
     public static class ChannelSettings {
@@ -1994,6 +2177,8 @@ public class WifiNative {
             WifiScanner.ScanData[] sd = null;
             if (isHalStarted()) {
                 sd = getScanResultsNative(sWlan0Index, flush);
+                // The scans just read may have changed the period the controller wants.
+                applyScanPeriodNative();
             }
 
             if (sd != null) {
@@ -2144,6 +2329,22 @@ public class WifiNative {
         }
     }
 
+    /**
+     * Like {@link #getWifiLinkLayerStats(String)}, but overwrites |reuse| instead of allocating a
+     * new object, so that a caller polling the stats periodically allocates nothing.
+     * @return |reuse|, or null if the stats could not be read.
+     */
+    public WifiLinkLayerStats getWifiLinkLayerStats(String iface, WifiLinkLayerStats reuse) {
+        if (iface == null || reuse == null) return null;
+        synchronized (sLock) {
+            if (isHalStarted() && fillWifiLinkLayerStatsNative(sWlan0Index, reuse)) {
+                return reuse;
+            } else {
+                return null;
+            }
+        }
+    }
+
     public void setWifiLinkLayerStats(String iface, int enable) {
         if (iface == null) return;
         synchronized (sLock) {
@@ -2154,10 +2355,16 @@ public class WifiNative {
     }
 
     public static native int getSupportedFeatureSetNative(int iface);
+    /* asks the HAL if it did not answer when the interfaces were enumerated */
+    private static native int querySupportedFeatureSetNative(int iface);
     public int getSupportedFeatureSet() {
         synchronized (sLock) {
             if (isHalStarted()) {
-                return getSupportedFeatureSetNative(sWlan0Index);
+                int features = getSupportedFeatureSetNative(sWlan0Index);
+                if (features == 0) {
+                    features = querySupportedFeatureSetNative(sWlan0Index);
+                }
+                return features;
             } else {
                 Log.d(TAG, "Failing getSupportedFeatureset because HAL isn't started");
                 return 0;
@@ -2298,6 +2505,22 @@ public class WifiNative {
         }
     }
 
+    private static native int[][] getChannelsForBandsNative(int iface, int[] bands);
+
+    /**
+     * Returns the valid channels of each band in one call, with a null list for a band that could
+     * not be listed; null if the HAL is not started.
+     */
+    public int[][] getChannelsForBands(int[] bands) {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return getChannelsForBandsNative(sWlan0Index, bands);
+            } else {
+                return null;
+            }
+        }
+    }
+
     private static native boolean isGetChannelsForBandSupportedNative();
     public boolean isGetChannelsForBandSupported(){
         synchronized (sLock) {
@@ -2309,6 +2532,8 @@ public class WifiNative {
         }
     }
 
+    private static native void invalidateValidChannelsNative();
+
     private static native boolean setDfsFlagNative(int iface, boolean dfsOn);
     public boolean setDfsFlag(boolean dfsOn) {
         synchronized (sLock) {
@@ -2364,6 +2589,22 @@ public class WifiNative {
         }
     }
 
+    private static native String getPacketFilterStatsNative(int iface);
+
+    /**
+     * Returns the counters of the native APF program cache: installs, installs skipped because
+     * the program was unchanged, failures, and install latency.
+     */
+    public String getPacketFilterStats() {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return getPacketFilterStatsNative(sWlan0Index);
+            } else {
+                return null;
+            }
+        }
+    }
+
     private static native boolean setCountryCodeHalNative(int iface, String CountryCode);
     public boolean setCountryCodeHal(String CountryCode) {
         synchronized (sLock) {
@@ -2394,10 +2635,16 @@ public class WifiNative {
     // Once TDLS per mac and event feature is implemented, this class definition should be
     // moved to the right place, like WifiManager etc
     public static class TdlsStatus {
+        String macAddress;
         int channel;
         int global_operating_class;
         int state;
         int reason;
+
+        @Override
+        public String toString() {
+            return macAddress + " state=" + state + " reason=" + reason + " channel=" + channel;
+        }
     }
     private static native TdlsStatus getTdlsStatusNative(int iface, String macAddr);
     public TdlsStatus getTdlsStatus(String macAdd) {
@@ -2410,6 +2657,22 @@ public class WifiNative {
         }
     }
 
+    private static native TdlsStatus[] getTdlsPeersNative(int iface);
+
+    /**
+     * Returns the last known status of every TDLS peer, as reported by the firmware's TDLS
+     * events; null if the HAL is not started.
+     */
+    public TdlsStatus[] getTdlsPeers() {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return getTdlsPeersNative(sWlan0Index);
+            } else {
+                return null;
+            }
+        }
+    }
+
     //ToFix: Once TDLS per mac and event feature is implemented, this class definition should be
     // moved to the right place, like WifiStateMachine etc
     public static class TdlsCapabilities {
@@ -2433,13 +2696,11 @@ public class WifiNative {
         }
     }
 
-    private static boolean onTdlsStatus(String macAddr, int status, int reason) {
+    // Callback from native
+    private static void onTdlsStatus(String macAddr, int status, int reason) {
         TdlsEventHandler handler = sTdlsEventHandler;
-        if (handler == null) {
-            return false;
-        } else {
+        if (handler != null) {
             handler.onTdlsStatus(macAddr, status, reason);
-            return true;
         }
     }
 
@@ -3035,6 +3296,35 @@ public class WifiNative {
         }
     }
 
+    private native static int stopSendingAllOffloadedPacketsNative(int iface);
+
+    /**
+     * Stops every packet offloaded on the interface, as when the network they keep alive is lost.
+     * Returns how many were being sent.
+     */
+    public int stopSendingAllOffloadedPackets() {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return stopSendingAllOffloadedPacketsNative(sWlan0Index);
+            } else {
+                return -1;
+            }
+        }
+    }
+
+    private native static String getOffloadedPacketsNative(int iface);
+
+    /** Returns the packets being offloaded, with their slot, kind, period and age. */
+    public String getOffloadedPackets() {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return getOffloadedPacketsNative(sWlan0Index);
+            } else {
+                return null;
+            }
+        }
+    }
+
     public static interface WifiRssiEventHandler {
         void onRssiThresholdBreached(byte curRssi);
     }
@@ -3113,6 +3403,284 @@ public class WifiNative {
         }
     }
 
+    /** How often the wake reason counters are polled into the history while the HAL runs. */
+    public static final int WAKE_REASON_POLL_PERIOD_MS = 5 * 60 * 1000;
+
+    /**
+     * Layout of the arrays returned by {@link #getTopWakeReasons(long, int)}: a header, then one
+     * entry per reason, the reasons that woke the host most first.
+     */
+    public static final int WAKE_TOP_TOTAL = 0; // wakes of every reason in the window
+    public static final int WAKE_TOP_COVERED_MS = 1; // part of the window the history covers
+    public static final int WAKE_TOP_HEADER_SIZE = 2;
+    public static final int WAKE_TOP_CATEGORY = 0; // WAKE_CATEGORY_*
+    public static final int WAKE_TOP_INDEX = 1; // reason code, or WAKE_RX_* for RX wakes
+    public static final int WAKE_TOP_COUNT = 2;
+    public static final int WAKE_TOP_ENTRY_SIZE = 3;
+
+    public static final int WAKE_CATEGORY_CMD_EVENT = 0;
+    public static final int WAKE_CATEGORY_DRIVER_FW_LOCAL = 1;
+    public static final int WAKE_CATEGORY_RX = 2;
+
+    private static final String[] WAKE_RX_CLASS_NAMES = { "unicast", "multicast", "broadcast",
+            "icmp", "icmp6", "icmp6Ra", "icmp6Na", "icmp6Ns", "ipv4RxMulticast", "ipv6Multicast",
+            "otherRxMulticast" };
+
+    private static native int pollWakeReasonsNative(int iface);
+
+    /**
+     * Adds the wakes since the previous poll to the wake reason history; the first poll after
+     * the HAL starts is the baseline. Returns false if the HAL is not running or the driver does
+     * not report wake reasons, in which case there is no point in polling again.
+     */
+    public boolean pollWakeReasons() {
+        synchronized (sLock) {
+            if (!isHalStarted()) {
+                return false;
+            }
+            return pollWakeReasonsNative(sWlan0Index) != WIFI_ERROR_NOT_SUPPORTED;
+        }
+    }
+
+    private static native int[] getTopWakeReasonsNative(long windowMs, int n);
+
+    /**
+     * Returns the n reasons that woke the host most in the last windowMs (elapsed realtime), from
+     * the wake reason history, packed as described by the WAKE_TOP_* constants.
+     */
+    public int[] getTopWakeReasons(long windowMs, int n) {
+        synchronized (sLock) {
+            return getTopWakeReasonsNative(windowMs, n);
+        }
+    }
+
+    /** Formats the result of {@link #getTopWakeReasons(long, int)} for dumps. */
+    public static String wakeReasonsToString(int[] top) {
+        if (top == null || top.length < WAKE_TOP_HEADER_SIZE) {
+            return "none";
+        }
+        StringBuilder sb = new StringBuilder();
+        sb.append(top[WAKE_TOP_TOTAL]).append(" wakes in ")
+                .append(top[WAKE_TOP_COVERED_MS] / 1000).append("s");
+        for (int i = WAKE_TOP_HEADER_SIZE; i + WAKE_TOP_ENTRY_SIZE <= top.length;
+                i += WAKE_TOP_ENTRY_SIZE) {
+            int index = top[i + WAKE_TOP_INDEX];
+            sb.append(", ");
+            switch (top[i + WAKE_TOP_CATEGORY]) {
+                case WAKE_CATEGORY_CMD_EVENT:
+                    sb.append("cmdEvent ").append(index);
+                    break;
+                case WAKE_CATEGORY_DRIVER_FW_LOCAL:
+                    sb.append("driverFwLocal ").append(index);
+                    break;
+                default:
+                    sb.append("rx ").append(index < WAKE_RX_CLASS_NAMES.length
+                            ? WAKE_RX_CLASS_NAMES[index] : Integer.toString(index));
+                    break;
+            }
+            sb.append("=").append(top[i + WAKE_TOP_COUNT]);
+        }
+        return sb.toString();
+    }
+
+    /**
+     * Scan history: every batch of cached scan results flushed from the HAL is appended to a log
+     * of memory-mapped segment files, which keeps the last SCAN_HISTORY_SEGMENTS segments. It is
+     * a location history, so it is only kept when SCAN_HISTORY_PROPERTY is set; otherwise any
+     * history left from when it was set is deleted.
+     */
+    private static final String SCAN_HISTORY_PROPERTY = "persist.wifi.scan_history";
+    private static final String SCAN_HISTORY_DIR = "/data/misc/wifi/scan_history";
+    private static final int SCAN_HISTORY_SEGMENT_BYTES = 256 * 1024;
+    private static final int SCAN_HISTORY_SEGMENTS = 8;
+
+    /** A BSSID seen by a scan, as recorded in the scan history. */
+    public static class ScanSighting {
+        public long timeMillis; // wall clock
+        public String bssid;
+        public byte[] rawSsid;
+        public int rssi;
+        public int frequency;
+
+        @Override
+        public String toString() {
+            return timeMillis + " " + bssid + " "
+                    + WifiSsid.createFromByteArray(rawSsid) + " rssi=" + rssi
+                    + " freq=" + frequency;
+        }
+    }
+
+    private static native boolean enableScanHistoryNative(String dir, int segmentBytes,
+            int maxSegments);
+
+    private static native void disableScanHistoryNative(String dir);
+
+    private static native ScanSighting[] queryScanHistoryNative(long fromMillis, long toMillis,
+            String bssid, int max);
+
+    private static native String getScanHistoryStatsNative();
+
+    /**
+     * Returns the sightings recorded between fromMillis and toMillis (wall clock, inclusive),
+     * oldest first: of the given BSSID, or of every BSSID if it is null. If there are more than
+     * max, the most recent max are returned. None are if the history is not kept (see
+     * SCAN_HISTORY_PROPERTY), and null is returned if the HAL is not started.
+     */
+    public ScanSighting[] getScanHistory(long fromMillis, long toMillis, String bssid, int max) {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return queryScanHistoryNative(fromMillis, toMillis, bssid, max);
+            } else {
+                return null;
+            }
+        }
+    }
+
+    /** Describes the scan history, for dumps. */
+    public String getScanHistoryStats() {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                return getScanHistoryStatsNative();
+            } else {
+                return "HAL not started";
+            }
+        }
+    }
+
+    /**
+     * Link stats history: every set of link layer stats read from the HAL is recorded natively,
+     * at full resolution and rolled up per minute and per hour, in files under LINK_STATS_DIR.
+     * It is only recorded while the HAL runs, and only kept when LINK_STATS_HISTORY_PROPERTY is
+     * set; otherwise the files left from when it was set are deleted.
+     */
+    private static final String LINK_STATS_HISTORY_PROPERTY = "persist.wifi.link_stats_history";
+    private static final String LINK_STATS_DIR = "/data/misc/wifi/link_stats";
+
+    public static final int LINK_TIER_RAW = 0; // each sample
+    public static final int LINK_TIER_MINUTE = 1;
+    public static final int LINK_TIER_HOUR = 2;
+
+    /** The RSSI is sampled; every other metric is the increase of a counter since the last poll. */
+    public static final int LINK_METRIC_RSSI = 0;
+    public static final int LINK_METRIC_BEACON_RX = 1;
+    public static final int LINK_METRIC_RX_MPDU = 2;
+    public static final int LINK_METRIC_TX_MPDU = 3;
+    public static final int LINK_METRIC_MPDU_LOST = 4;
+    public static final int LINK_METRIC_RETRIES = 5;
+    public static final int LINK_METRIC_ON_TIME = 6;
+    public static final int LINK_METRIC_TX_TIME = 7;
+    public static final int LINK_METRIC_RX_TIME = 8;
+    public static final int LINK_METRIC_ON_TIME_SCAN = 9;
+
+    /** Layout of the arrays returned by {@link #getLinkStatsSeries}: one entry per period. */
+    public static final int LINK_SERIES_TIME = 0; // start of the period, wall clock
+    public static final int LINK_SERIES_COUNT = 1; // samples in the period
+    public static final int LINK_SERIES_MIN = 2;
+    public static final int LINK_SERIES_MAX = 3;
+    public static final int LINK_SERIES_MEAN = 4;
+    public static final int LINK_SERIES_ENTRY_SIZE = 5;
+
+    private static native boolean enableLinkStatsHistoryNative(String dir);
+
+    /** Stops recording; with a dir, also deletes the history recorded there. */
+    private static native void disableLinkStatsHistoryNative(String dir);
+
+    private static native long[] getLinkStatsSeriesNative(int tier, int metric, long fromMillis,
+            long toMillis);
+
+    /**
+     * Returns a LINK_METRIC_* metric over the periods of a LINK_TIER_* tier that start between
+     * fromMillis and toMillis (wall clock, inclusive), oldest first, packed as described by the
+     * LINK_SERIES_* constants. Returns null if the history is not enabled.
+     */
+    public long[] getLinkStatsSeries(int tier, int metric, long fromMillis, long toMillis) {
+        return getLinkStatsSeriesNative(tier, metric, fromMillis, toMillis);
+    }
+
+    /** Formats the result of {@link #getLinkStatsSeries} for dumps, one period a line. */
+    public static String linkStatsSeriesToString(long[] series) {
+        if (series == null || series.length == 0) {
+            return "none";
+        }
+        SimpleDateFormat format = new SimpleDateFormat("MM-dd HH:mm", Locale.US);
+        StringBuilder sb = new StringBuilder();
+        for (int i = 0; i + LINK_SERIES_ENTRY_SIZE <= series.length;
+                i += LINK_SERIES_ENTRY_SIZE) {
+            sb.append("\n  ").append(format.format(new Date(series[i + LINK_SERIES_TIME])))
+                    .append(" n=").append(series[i + LINK_SERIES_COUNT])
+                    .append(" min=").append(series[i + LINK_SERIES_MIN])
+                    .append(" max=").append(series[i + LINK_SERIES_MAX])
+                    .append(" mean=").append(series[i + LINK_SERIES_MEAN]);
+        }
+        return sb.toString();
+    }
+
+    private static native int[] getScanSimilarityNative(int n);
+
+    /**
+     * Returns how similar the latest scan is to each of the n scans before it, in thousandths,
+     * the most recent first: the estimated overlap of their BSSIDs and coarse RSSIs. Fewer are
+     * returned if fewer scans were fingerprinted, and null if none was.
+     */
+    public int[] getScanSimilarity(int n) {
+        return getScanSimilarityNative(n);
+    }
+
+    /**
+     * Returns whether the latest scan is at least minSimilarity (in thousandths) similar to each
+     * of the n scans before it, so that the device can be taken to be in the same environment:
+     * scans can be spaced out and network selection skipped.
+     */
+    public boolean isScanEnvironmentUnchanged(int n, int minSimilarity) {
+        int[] similarity = getScanSimilarityNative(n);
+        if (similarity == null || similarity.length < n) {
+            return false;
+        }
+        for (int s : similarity) {
+            if (s < minSimilarity) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Longest period, in ms, the scan period controller may stretch the gscan buckets to while
+     * the environment does not change; 0, the default, leaves the schedule as requested.
+     */
+    private static final String SCAN_PERIOD_CONTROL_PROPERTY =
+            "persist.wifi.scan_period_control_max_ms";
+
+    /** Least time, in ms, between a restart of the gscan and the next stretch of its periods. */
+    private static final int SCAN_PERIOD_CONTROL_HOLD_MS = 60 * 1000;
+
+    private static native boolean setScanPeriodControlNative(int maxPeriodMs, int holdMs);
+
+    private static native void setScanMotionHintNative(boolean moving);
+
+    /** Restarts the gscan if the controller wants another period than the one running. */
+    private static native void applyScanPeriodNative();
+
+    private static native String getScanPeriodControlLogNative();
+
+    /**
+     * Tells the scan period controller whether the device is moving. While it is, the gscan
+     * runs with the schedule the framework asked for.
+     */
+    public void setScanMotionHint(boolean moving) {
+        synchronized (sLock) {
+            if (isHalStarted()) {
+                setScanMotionHintNative(moving);
+                applyScanPeriodNative();
+            }
+        }
+    }
+
+    /** Returns the state of the scan period controller and its recent decisions, for dumps. */
+    public String getScanPeriodControlLog() {
+        return getScanPeriodControlLogNative();
+    }
+
     private static native int configureNeighborDiscoveryOffload(int iface, boolean enabled);
 
     public boolean configureNeighborDiscoveryOffload(boolean enabled) {
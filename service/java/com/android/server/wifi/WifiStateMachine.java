@@ -818,6 +818,9 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
     /* Enable/disable Neighbor Discovery offload functionality. */
     static final int CMD_CONFIG_ND_OFFLOAD                              = BASE + 204;
 
+    /* Poll the driver's wake reason counters into the wake reason history */
+    static final int CMD_POLL_WAKE_REASONS                              = BASE + 205;
+
     // For message logging.
     private static final Class[] sMessageClasses = {
             AsyncChannel.class, WifiStateMachine.class, DhcpClient.class };
@@ -1558,11 +1561,23 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
         return sb.toString();
     }
 
+    // Refreshed in place by the periodic polls, which only read it on this thread
+    private final WifiLinkLayerStats mPolledLinkLayerStats = new WifiLinkLayerStats();
+
     WifiLinkLayerStats getWifiLinkLayerStats(boolean dbg) {
+        return getWifiLinkLayerStats(dbg, mPolledLinkLayerStats);
+    }
+
+    /**
+     * Updates the link layer counters; |reuse| is overwritten with the stats, or a new object is
+     * returned if it is null, as needed when the stats are handed to another thread.
+     */
+    WifiLinkLayerStats getWifiLinkLayerStats(boolean dbg, WifiLinkLayerStats reuse) {
         WifiLinkLayerStats stats = null;
         if (mWifiLinkLayerStatsSupported > 0) {
             String name = "wlan0";
-            stats = mWifiNative.getWifiLinkLayerStats(name);
+            stats = reuse != null ? mWifiNative.getWifiLinkLayerStats(name, reuse)
+                    : mWifiNative.getWifiLinkLayerStats(name);
             if (name != null && stats == null && mWifiLinkLayerStatsSupported > 0) {
                 mWifiLinkLayerStatsSupported -= 1;
             } else if (stats != null) {
@@ -2357,6 +2372,19 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
             pw.println("mUntrustedNetworkFactory is not initialized");
         }
         pw.println("Wlan Wake Reasons:" + mWifiNative.getWlanWakeReasonCount());
+        pw.println("Top wake reasons in the last hour: " + WifiNative.wakeReasonsToString(
+                mWifiNative.getTopWakeReasons(60 * 60 * 1000, 5)));
+        pw.println("APF program installs: " + mWifiNative.getPacketFilterStats());
+        pw.println("Offloaded packets: " + mWifiNative.getOffloadedPackets());
+        pw.println("TDLS peers: " + Arrays.toString(mWifiNative.getTdlsPeers()));
+        pw.println("Scan history: " + mWifiNative.getScanHistoryStats());
+        pw.println("Similarity of the last scan to the ones before: "
+                + Arrays.toString(mWifiNative.getScanSimilarity(8)));
+        pw.println("Scan period control: " + mWifiNative.getScanPeriodControlLog());
+        long now = System.currentTimeMillis();
+        pw.println("RSSI per minute, last 10 minutes: " + WifiNative.linkStatsSeriesToString(
+                mWifiNative.getLinkStatsSeries(WifiNative.LINK_TIER_MINUTE,
+                        WifiNative.LINK_METRIC_RSSI, now - 10 * 60 * 1000, now)));
         pw.println();
         updateWifiMetrics();
         mWifiMetrics.dump(fd, pw, args);
@@ -3563,6 +3591,7 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
                 + " - " + Thread.currentThread().getStackTrace()[5].getMethodName());
 
         stopRssiMonitoringOffload();
+        mWifiNative.stopSendingAllOffloadedPackets();
 
         clearCurrentConfigBSSID("handleNetworkDisconnect");
 
@@ -3858,10 +3887,18 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
         if (!mWifiNative.startHal()) {
             /* starting HAL is optional */
             Log.e(TAG, "Failed to start HAL");
+        } else {
+            startWakeReasonPolling();
         }
         return true;
     }
 
+    /* the first poll is the baseline of the wake reason history */
+    private void startWakeReasonPolling() {
+        removeMessages(CMD_POLL_WAKE_REASONS);
+        sendMessage(CMD_POLL_WAKE_REASONS);
+    }
+
     private byte[] macAddressFromString(String macString) {
         String[] macBytes = macString.split(":");
         if (macBytes.length != 6) {
@@ -4279,6 +4316,13 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
                         mWifiNative.stopFilteringMulticastV4Packets();
                     }
                     break;
+                case CMD_POLL_WAKE_REASONS:
+                    /* stops once the HAL is stopped or the driver has no wake reason stats */
+                    if (mWifiNative.pollWakeReasons()) {
+                        sendMessageDelayed(CMD_POLL_WAKE_REASONS,
+                                WifiNative.WAKE_REASON_POLL_PERIOD_MS);
+                    }
+                    break;
                 default:
                     loge("Error! unhandled message" + message);
                     break;
@@ -4291,6 +4335,7 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
         @Override
         public void enter() {
             mWifiNative.stopHal();
+            removeMessages(CMD_POLL_WAKE_REASONS);
             mWifiNative.unloadDriver();
             if (mWifiP2pChannel == null) {
                 mWifiP2pChannel = new AsyncChannel();
@@ -4349,6 +4394,8 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
                         if (mWifiNative.startHal() == false) {
                             /* starting HAL is optional */
                             loge("Failed to start HAL");
+                        } else {
+                            startWakeReasonPolling();
                         }
 
                         if (mWifiNative.startSupplicant(mP2pSupported)) {
@@ -4572,7 +4619,7 @@ public class WifiStateMachine extends StateMachine implements WifiNative.WifiRss
                     }
                     break;
                 case CMD_GET_LINK_LAYER_STATS:
-                    WifiLinkLayerStats stats = getWifiLinkLayerStats(DBG);
+                    WifiLinkLayerStats stats = getWifiLinkLayerStats(DBG, null);
                     replyToMessage(message, message.what, stats);
                     break;
                 case CMD_RESET_SIM_NETWORKS:
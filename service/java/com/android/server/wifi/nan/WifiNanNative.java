@@ -22,12 +22,19 @@ import android.net.wifi.nan.PublishSettings;
 import android.net.wifi.nan.SubscribeData;
 import android.net.wifi.nan.SubscribeSettings;
 import android.net.wifi.nan.WifiNanSessionListener;
+import android.os.SystemClock;
 import android.util.Log;
 
 import com.android.server.wifi.WifiNative;
 
 import libcore.util.HexEncoding;
 
+import java.io.FileDescriptor;
+import java.io.PrintWriter;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Arrays;
+
 /**
  * Native calls to access the Wi-Fi NAN HAL.
  *
@@ -41,6 +48,10 @@ public class WifiNanNative {
     private static final boolean VDBG = false; // STOPSHIP if true
 
     private static final int WIFI_SUCCESS = 0;
+    private static final int WIFI_ERROR_BUSY = -10;
+
+    /* how long the native bridge holds new matches to deliver them as a batch */
+    private static final int MATCH_BATCH_WINDOW_MS = 20;
 
     private static boolean sNanNativeInit = false;
 
@@ -93,7 +104,13 @@ public class WifiNanNative {
         }
     }
 
-    /* package */ static native int initNanHandlersNative(Object cls, int iface);
+    /**
+     * Registers the NAN callbacks of the native bridge. New matches are held for
+     * matchBatchWindowMs to be delivered as a batch; 0 delivers each one as the HAL
+     * reports it.
+     */
+    /* package */ static native int initNanHandlersNative(Object cls, int iface,
+            int matchBatchWindowMs);
 
     private static native int getCapabilitiesNative(short transactionId, Object cls, int iface);
 
@@ -109,7 +126,8 @@ public class WifiNanNative {
                 halStarted = WifiNative.getWlanNativeInterface().startHal();
             }
             if (halStarted) {
-                int ret = initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index);
+                int ret = initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index,
+                        MATCH_BATCH_WINDOW_MS);
                 if (DBG) Log.d(TAG, "initNanHandlersNative: res=" + ret);
                 sNanNativeInit = ret == WIFI_SUCCESS;
 
@@ -258,12 +276,37 @@ public class WifiNanNative {
             }
             if (DBG) Log.d(TAG, "sendMessageNative: ret=" + ret);
             success = ret == WIFI_SUCCESS;
+            if (ret == WIFI_ERROR_BUSY) {
+                // the native follow-up queue is full
+                WifiNanStateManager.getInstance().onMessageSendFail(transactionId,
+                        WifiNanSessionListener.FAIL_REASON_NO_RESOURCES);
+                return;
+            }
         } else {
             Log.w(TAG, "sendMessage: cannot initialize NAN");
             success = false;
         }
 
-        // TODO: do something on !success - send failure message back
+        if (!success) {
+            WifiNanStateManager.getInstance().onMessageSendFail(transactionId,
+                    WifiNanSessionListener.FAIL_REASON_OTHER);
+        }
+    }
+
+    private static native void transmitQueuedMessagesNative();
+
+    /**
+     * Submits the follow-up messages queued in the native bridge that the HAL has
+     * room for; called on {@link WifiNanStateManager#onFollowupsReady()}.
+     */
+    public void transmitQueuedMessages() {
+        if (VDBG) Log.d(TAG, "transmitQueuedMessages");
+
+        if (isNanInit(false)) {
+            synchronized (WifiNative.sLock) {
+                transmitQueuedMessagesNative();
+            }
+        }
     }
 
     private static native int stopPublishNative(short transactionId, Object cls, int iface,
@@ -318,6 +361,155 @@ public class WifiNanNative {
         // TODO: do something on !success - send failure message back
     }
 
+    // NanStatsType: direct copy from wifi_nan.h: need to keep in sync
+    public static final int NAN_STATS_ID_DE_PUBLISH = 0;
+    public static final int NAN_STATS_ID_DE_SUBSCRIBE = 1;
+    public static final int NAN_STATS_ID_DE_MAC = 2;
+    public static final int NAN_STATS_ID_DE_TIMING_SYNC = 3;
+    public static final int NAN_STATS_ID_DE_DW = 4;
+
+    /**
+     * Layout of the samples returned by {@link #getStatsSamples(long)}: each
+     * sample is a header followed by its values, in the order of the fields of
+     * the HAL's stats struct for its type.
+     */
+    public static final int STATS_SAMPLE_TIMESTAMP_MS = 0; // elapsed realtime
+    public static final int STATS_SAMPLE_TYPE = 1; // NAN_STATS_ID_*
+    public static final int STATS_SAMPLE_NUM_VALUES = 2;
+    public static final int STATS_SAMPLE_HEADER_SIZE = 3;
+
+    private static native int requestStatsNative(Object cls, int iface, int statsTypes);
+
+    private static native long[] getStatsSamplesNative(long sinceMs);
+
+    /**
+     * Requests one sample of each selected discovery engine statistic; the
+     * responses are kept by the native bridge and read with
+     * {@link #getStatsSamples(long)}. Called periodically by
+     * {@link WifiNanStateManager} while NAN is enabled.
+     *
+     * @param statsTypes bit mask of (1 << NAN_STATS_ID_*)
+     * @return false if the HAL is not running or the request was rejected
+     */
+    public boolean requestStats(int statsTypes) {
+        if (VDBG) Log.d(TAG, "requestStats: statsTypes=" + statsTypes);
+
+        if (!isNanInit(false)) {
+            Log.w(TAG, "requestStats: NAN not initialized");
+            return false;
+        }
+
+        int ret;
+        synchronized (WifiNative.sLock) {
+            if (!WifiNative.getWlanNativeInterface().isHalStarted()) {
+                Log.w(TAG, "requestStats: HAL not started");
+                return false;
+            }
+            ret = requestStatsNative(WifiNative.class, WifiNative.sWlan0Index, statsTypes);
+        }
+        if (DBG) Log.d(TAG, "requestStatsNative: ret=" + ret);
+        return ret == WIFI_SUCCESS;
+    }
+
+    /**
+     * Returns the samples taken after sinceMs (elapsed realtime), oldest first,
+     * packed as described by the STATS_SAMPLE_* constants.
+     */
+    public long[] getStatsSamples(long sinceMs) {
+        if (!isNanInit(false)) {
+            return new long[0];
+        }
+
+        synchronized (WifiNative.sLock) {
+            return getStatsSamplesNative(sinceMs);
+        }
+    }
+
+    private static native int setClusterSizeAlertNative(Object cls, int iface, int threshold);
+
+    /**
+     * Sets the cluster size whose crossing (in either direction) is reported
+     * through {@link WifiNanStateManager#onClusterSizeChange(boolean, int)}; 0
+     * turns the alerts off. The alert stays armed across NAN enables. The
+     * native bridge also uses the reported size to lengthen the discovery
+     * period of new publishes and subscribes in dense clusters.
+     */
+    public boolean setClusterSizeAlert(int threshold) {
+        if (VDBG) Log.d(TAG, "setClusterSizeAlert: threshold=" + threshold);
+
+        if (!isNanInit(true)) {
+            Log.w(TAG, "setClusterSizeAlert: cannot initialize NAN");
+            return false;
+        }
+
+        int ret;
+        synchronized (WifiNative.sLock) {
+            ret = setClusterSizeAlertNative(WifiNative.class, WifiNative.sWlan0Index, threshold);
+        }
+        if (DBG) Log.d(TAG, "setClusterSizeAlertNative: ret=" + ret);
+        return ret == WIFI_SUCCESS;
+    }
+
+    private static native int rearmClusterSizeAlertNative(Object cls, int iface);
+
+    /**
+     * Sends the cluster size alert to the firmware again if an enable has
+     * completed since it was last sent (the firmware forgets it on disable).
+     * Called by {@link WifiNanStateManager} once a configuration completes.
+     */
+    public void rearmClusterSizeAlert() {
+        if (VDBG) Log.d(TAG, "rearmClusterSizeAlert");
+
+        if (!isNanInit(false)) {
+            return;
+        }
+
+        int ret;
+        synchronized (WifiNative.sLock) {
+            ret = rearmClusterSizeAlertNative(WifiNative.class, WifiNative.sWlan0Index);
+        }
+        if (DBG) Log.d(TAG, "rearmClusterSizeAlertNative: ret=" + ret);
+    }
+
+    /* package */ static native String dumpSessionsNative();
+
+    /**
+     * Dumps the publish/subscribe sessions tracked by the native bridge, with
+     * their configuration, peers and counters.
+     */
+    public void dump(FileDescriptor fd, PrintWriter pw, String[] args) {
+        pw.println("WifiNanNative:");
+        if (!isNanInit(false)) {
+            pw.println("  not initialized");
+            return;
+        }
+
+        String sessions;
+        long[] samples;
+        synchronized (WifiNative.sLock) {
+            sessions = dumpSessionsNative();
+            samples = getStatsSamplesNative(0);
+        }
+        for (String line : sessions.split("\n")) {
+            pw.println("  " + line);
+        }
+
+        pw.println("  stats samples:");
+        long now = SystemClock.elapsedRealtime();
+        for (int i = 0; samples != null && i + STATS_SAMPLE_HEADER_SIZE <= samples.length;) {
+            int numValues = (int) samples[i + STATS_SAMPLE_NUM_VALUES];
+            StringBuilder sb = new StringBuilder();
+            sb.append("    -").append((now - samples[i + STATS_SAMPLE_TIMESTAMP_MS]) / 1000)
+                    .append("s type=").append(samples[i + STATS_SAMPLE_TYPE]).append(":");
+            for (int j = 0; j < numValues && i + STATS_SAMPLE_HEADER_SIZE + j < samples.length;
+                    ++j) {
+                sb.append(" ").append(samples[i + STATS_SAMPLE_HEADER_SIZE + j]);
+            }
+            pw.println(sb.toString());
+            i += STATS_SAMPLE_HEADER_SIZE + numValues;
+        }
+    }
+
     // EVENTS
 
     // NanResponseType for API responses: will add values as needed
@@ -327,6 +519,9 @@ public class WifiNanNative {
     public static final int NAN_RESPONSE_TRANSMIT_FOLLOWUP = 4;
     public static final int NAN_RESPONSE_SUBSCRIBE = 5;
     public static final int NAN_RESPONSE_SUBSCRIBE_CANCEL = 6;
+    public static final int NAN_RESPONSE_STATS = 7;
+    public static final int NAN_RESPONSE_CONFIG = 8;
+    public static final int NAN_RESPONSE_TCA = 9;
     public static final int NAN_RESPONSE_GET_CAPABILITIES = 12;
 
     // direct copy from wifi_nan.h: need to keep in sync
@@ -466,6 +661,7 @@ public class WifiNanNative {
 
         switch (responseType) {
             case NAN_RESPONSE_ENABLED:
+            case NAN_RESPONSE_CONFIG:
                 if (status == NAN_STATUS_SUCCESS) {
                     WifiNanStateManager.getInstance().onConfigCompleted(transactionId);
                 } else {
@@ -480,12 +676,7 @@ public class WifiNanNative {
                 }
                 break;
             case NAN_RESPONSE_TRANSMIT_FOLLOWUP:
-                if (status == NAN_STATUS_SUCCESS) {
-                    WifiNanStateManager.getInstance().onMessageSendSuccess(transactionId);
-                } else {
-                    WifiNanStateManager.getInstance().onMessageSendFail(transactionId,
-                            translateHalStatusToPublicStatus(status));
-                }
+                onMessageSendResult(transactionId, status);
                 break;
             case NAN_RESPONSE_SUBSCRIBE_CANCEL:
                 if (status != NAN_STATUS_SUCCESS) {
@@ -500,6 +691,31 @@ public class WifiNanNative {
         }
     }
 
+    // callback from native: (transactionId, status) pairs of follow-ups completed together
+    private static void onMessageSendResults(int[] results) {
+        if (VDBG) Log.v(TAG, "onMessageSendResults: numResults=" + results.length / 2);
+
+        for (int i = 0; i < results.length; i += 2) {
+            onMessageSendResult((short) results[i], results[i + 1]);
+        }
+    }
+
+    // callback from native: a queued follow-up can be submitted
+    private static void onFollowupsReady() {
+        if (VDBG) Log.v(TAG, "onFollowupsReady");
+
+        WifiNanStateManager.getInstance().onFollowupsReady();
+    }
+
+    private static void onMessageSendResult(short transactionId, int status) {
+        if (status == NAN_STATUS_SUCCESS) {
+            WifiNanStateManager.getInstance().onMessageSendSuccess(transactionId);
+        } else {
+            WifiNanStateManager.getInstance().onMessageSendFail(transactionId,
+                    translateHalStatusToPublicStatus(status));
+        }
+    }
+
     private static void onNanNotifyResponsePublishSubscribe(short transactionId, int responseType,
             int status, int value, int pubSubId) {
         if (VDBG) {
@@ -572,19 +788,124 @@ public class WifiNanNative {
         }
     }
 
+    /* per match in the onMatchEvents() info array; must match the native table */
+    private static final int MATCH_INFO_PUB_SUB_ID = 0;
+    private static final int MATCH_INFO_REQUESTOR_INSTANCE_ID = 1;
+    private static final int MATCH_INFO_SSI_LENGTH = 2;
+    private static final int MATCH_INFO_FILTER_LENGTH = 3;
+    private static final int MATCH_INFO_FIELDS = 4;
+
+    private static final int MAC_ADDRESS_LENGTH = 6;
+
     // callback from native
-    private static void onMatchEvent(int pubSubId, int requestorInstanceId, byte[] mac,
-            byte[] serviceSpecificInfo, int serviceSpecificInfoLength, byte[] matchFilter,
-            int matchFilterLength) {
+    private static void onMatchEvents(int[] info, byte[] data) {
+        int numMatches = info.length / MATCH_INFO_FIELDS;
+        if (VDBG) Log.v(TAG, "onMatchEvents: numMatches=" + numMatches);
+
+        /* data holds the MAC address, SSI and match filter of each match back to back */
+        int offset = 0;
+        for (int i = 0; i < numMatches; i++) {
+            int base = i * MATCH_INFO_FIELDS;
+            int pubSubId = info[base + MATCH_INFO_PUB_SUB_ID];
+            int requestorInstanceId = info[base + MATCH_INFO_REQUESTOR_INSTANCE_ID];
+            int serviceSpecificInfoLength = info[base + MATCH_INFO_SSI_LENGTH];
+            int matchFilterLength = info[base + MATCH_INFO_FILTER_LENGTH];
+
+            byte[] mac = Arrays.copyOfRange(data, offset, offset + MAC_ADDRESS_LENGTH);
+            offset += MAC_ADDRESS_LENGTH;
+            byte[] serviceSpecificInfo = Arrays.copyOfRange(data, offset,
+                    offset + serviceSpecificInfoLength);
+            offset += serviceSpecificInfoLength;
+            byte[] matchFilter = Arrays.copyOfRange(data, offset, offset + matchFilterLength);
+            offset += matchFilterLength;
+
+            if (VDBG) {
+                Log.v(TAG, "onMatchEvents: pubSubId=" + pubSubId + ", requestorInstanceId="
+                        + requestorInstanceId + ", mac=" + String.valueOf(HexEncoding.encode(mac))
+                        + ", serviceSpecificInfoLength=" + serviceSpecificInfoLength
+                        + ", matchFilterLength=" + matchFilterLength);
+            }
+
+            WifiNanStateManager.getInstance().onMatch(pubSubId, requestorInstanceId, mac,
+                    serviceSpecificInfo, serviceSpecificInfoLength, matchFilter,
+                    matchFilterLength);
+        }
+    }
+
+    // callback from native
+    private static void onClusterSizeAlert(boolean rising, int clusterSize) {
         if (VDBG) {
-            Log.v(TAG, "onMatchEvent: pubSubId=" + pubSubId + ", requestorInstanceId="
-                    + requestorInstanceId + ", mac=" + String.valueOf(HexEncoding.encode(mac))
-                    + ", serviceSpecificInfo=" + serviceSpecificInfo + ", matchFilterLength="
-                    + matchFilterLength + ", matchFilter=" + matchFilter);
+            Log.v(TAG, "onClusterSizeAlert: rising=" + rising + ", clusterSize=" + clusterSize);
+        }
+
+        WifiNanStateManager.getInstance().onClusterSizeChange(rising, clusterSize);
+    }
+
+    /* flags of a onBeaconSdfPayloads() record; must match the native packing */
+    private static final int BEACON_SDF_HAS_VSA = 0x01;
+    private static final int BEACON_SDF_HAS_FRAME = 0x02;
+    /* peer MAC, flags, received on, vendor OUI and VSA length */
+    private static final int BEACON_SDF_HEADER_LENGTH = MAC_ADDRESS_LENGTH + 1 + 1 + 4 + 2;
+
+    // callback from native
+    private static void onBeaconSdfPayloads(byte[] stream) {
+        if (VDBG) Log.v(TAG, "onBeaconSdfPayloads: length=" + stream.length);
+
+        /*
+         * records back to back: peer MAC, flags (u8), received on (u8), vendor OUI
+         * (u32), VSA length (u16), VSA, frame length (u16), frame - little endian
+         */
+        ByteBuffer buffer = ByteBuffer.wrap(stream).order(ByteOrder.LITTLE_ENDIAN);
+        while (buffer.remaining() > 0) {
+            if (buffer.remaining() < BEACON_SDF_HEADER_LENGTH) {
+                Log.e(TAG, "onBeaconSdfPayloads: short record header, " + buffer.remaining()
+                        + " bytes left");
+                return;
+            }
+            byte[] mac = new byte[MAC_ADDRESS_LENGTH];
+            buffer.get(mac);
+            int flags = buffer.get() & 0xff;
+            int receivedOn = buffer.get() & 0xff;
+            int vendorOui = buffer.getInt();
+            int vsaLength = buffer.getShort() & 0xffff;
+            if (buffer.remaining() < vsaLength + 2) {
+                Log.e(TAG, "onBeaconSdfPayloads: short VSA, length=" + vsaLength + ", "
+                        + buffer.remaining() + " bytes left");
+                return;
+            }
+            byte[] vsa = new byte[vsaLength];
+            buffer.get(vsa);
+            int frameLength = buffer.getShort() & 0xffff;
+            if (buffer.remaining() < frameLength) {
+                Log.e(TAG, "onBeaconSdfPayloads: short frame, length=" + frameLength + ", "
+                        + buffer.remaining() + " bytes left");
+                return;
+            }
+            byte[] frame = new byte[frameLength];
+            buffer.get(frame);
+
+            if (VDBG) {
+                Log.v(TAG, "onBeaconSdfPayloads: mac=" + String.valueOf(HexEncoding.encode(mac))
+                        + ", flags=" + flags + ", receivedOn=" + receivedOn + ", vendorOui="
+                        + vendorOui + ", vsaLength=" + vsa.length + ", frameLength="
+                        + frame.length);
+            }
+
+            WifiNanStateManager.getInstance().onBeaconSdfPayload(mac,
+                    (flags & BEACON_SDF_HAS_VSA) != 0 ? vendorOui : 0,
+                    (flags & BEACON_SDF_HAS_VSA) != 0 ? vsa : null,
+                    (flags & BEACON_SDF_HAS_FRAME) != 0 ? frame : null);
+        }
+    }
+
+    // callback from native
+    private static void onMatchExpired(int pubSubId, int requestorInstanceId) {
+        if (VDBG) {
+            Log.v(TAG, "onMatchExpired: pubSubId=" + pubSubId + ", requestorInstanceId="
+                    + requestorInstanceId);
         }
 
-        WifiNanStateManager.getInstance().onMatch(pubSubId, requestorInstanceId, mac,
-                serviceSpecificInfo, serviceSpecificInfoLength, matchFilter, matchFilterLength);
+        WifiNanStateManager.getInstance().onMatchExpired(pubSubId, requestorInstanceId);
     }
 
     // callback from native
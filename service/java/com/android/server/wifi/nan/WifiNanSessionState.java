@@ -225,6 +225,17 @@ public class WifiNanSessionState {
         }
     }
 
+    /**
+     * The HAL no longer sees the peer: forget its address so that messages to
+     * it fail instead of being sent to a stale peer.
+     */
+    public void onMatchExpired(int requestorInstanceId) {
+        String prevMac = mMacByRequestorInstanceId.get(requestorInstanceId);
+        mMacByRequestorInstanceId.delete(requestorInstanceId);
+
+        if (DBG) Log.d(TAG, "onMatchExpired: peer MAC removed - " + prevMac);
+    }
+
     public void onMessageReceived(int requestorInstanceId, byte[] peerMac, byte[] message,
             int messageLength) {
         String prevMac = mMacByRequestorInstanceId.get(requestorInstanceId);
@@ -27,6 +27,7 @@ import android.os.Bundle;
 import android.os.Handler;
 import android.os.Looper;
 import android.os.Message;
+import android.os.SystemProperties;
 import android.util.Log;
 import android.util.SparseArray;
 
@@ -70,6 +71,24 @@ public class WifiNanStateManager {
     private static final int MESSAGE_ON_MATCH = 25;
     private static final int MESSAGE_ON_MESSAGE_RECEIVED = 26;
     private static final int MESSAGE_ON_CAPABILITIES_UPDATED = 27;
+    private static final int MESSAGE_ON_MATCH_EXPIRED = 28;
+    private static final int MESSAGE_ON_CLUSTER_SIZE_CHANGE = 29;
+    private static final int MESSAGE_ON_BEACON_SDF_PAYLOAD = 30;
+    private static final int MESSAGE_ON_FOLLOWUPS_READY = 31;
+    private static final int MESSAGE_SAMPLE_STATS = 32;
+
+    /*
+     * The discovery engine statistics are sampled while NAN is enabled, every
+     * STATS_PERIOD_PROPERTY ms (0 turns the sampling off); the samples are
+     * kept by the native bridge and printed in the dump.
+     */
+    private static final String STATS_PERIOD_PROPERTY = "persist.wifi.nan.stats_period_ms";
+    /* package */ static final int STATS_DEFAULT_PERIOD_MS = 5 * 60 * 1000;
+    /* package */ static final int STATS_TYPES = (1 << WifiNanNative.NAN_STATS_ID_DE_PUBLISH)
+            | (1 << WifiNanNative.NAN_STATS_ID_DE_SUBSCRIBE)
+            | (1 << WifiNanNative.NAN_STATS_ID_DE_MAC)
+            | (1 << WifiNanNative.NAN_STATS_ID_DE_TIMING_SYNC)
+            | (1 << WifiNanNative.NAN_STATS_ID_DE_DW);
 
     private static final String MESSAGE_BUNDLE_KEY_SESSION_ID = "session_id";
     private static final String MESSAGE_BUNDLE_KEY_EVENTS = "events";
@@ -88,6 +107,9 @@ public class WifiNanStateManager {
     private static final String MESSAGE_BUNDLE_KEY_MAC_ADDRESS = "mac_address";
     private static final String MESSAGE_BUNDLE_KEY_MESSAGE_DATA = "message_data";
     private static final String MESSAGE_BUNDLE_KEY_MESSAGE_LENGTH = "message_length";
+    private static final String MESSAGE_BUNDLE_KEY_VENDOR_OUI = "vendor_oui";
+    private static final String MESSAGE_BUNDLE_KEY_VSA_DATA = "vsa_data";
+    private static final String MESSAGE_BUNDLE_KEY_FRAME_DATA = "frame_data";
 
     private WifiNanNative.Capabilities mCapabilities;
 
@@ -97,6 +119,9 @@ public class WifiNanStateManager {
     private final SparseArray<WifiNanClientState> mClients = new SparseArray<>();
     private final SparseArray<TransactionInfoBase> mPendingResponses = new SparseArray<>();
     private short mNextTransactionId = 1;
+    private int mClusterSize = -1; // from the last cluster size alert
+    private int mStatsPeriodMs = 0; // 0: not sampling
+    private int mStatsTypes = 0; // bit mask of (1 << WifiNanNative.NAN_STATS_ID_*)
 
     private WifiNanStateManager() {
         // EMPTY: singleton pattern
@@ -266,6 +291,10 @@ public class WifiNanStateManager {
         mHandler.sendMessage(msg);
     }
 
+    public void onFollowupsReady() {
+        mHandler.sendMessage(mHandler.obtainMessage(MESSAGE_ON_FOLLOWUPS_READY));
+    }
+
     public void onUnknownTransaction(int responseType, short transactionId, int status) {
         Message msg = mHandler.obtainMessage(MESSAGE_ON_UNKNOWN_TRANSACTION);
         Bundle data = new Bundle();
@@ -305,6 +334,13 @@ public class WifiNanStateManager {
         mHandler.sendMessage(msg);
     }
 
+    public void onMatchExpired(int pubSubId, int requestorInstanceId) {
+        Message msg = mHandler.obtainMessage(MESSAGE_ON_MATCH_EXPIRED);
+        msg.arg1 = pubSubId;
+        msg.arg2 = requestorInstanceId;
+        mHandler.sendMessage(msg);
+    }
+
     public void onPublishTerminated(int publishId, int status) {
         Message msg = mHandler.obtainMessage(MESSAGE_ON_PUBLISH_TERMINATED);
         msg.arg1 = publishId;
@@ -338,6 +374,24 @@ public class WifiNanStateManager {
         mHandler.sendMessage(msg);
     }
 
+    public void onClusterSizeChange(boolean rising, int clusterSize) {
+        Message msg = mHandler.obtainMessage(MESSAGE_ON_CLUSTER_SIZE_CHANGE);
+        msg.arg1 = rising ? 1 : 0;
+        msg.arg2 = clusterSize;
+        mHandler.sendMessage(msg);
+    }
+
+    public void onBeaconSdfPayload(byte[] peerMac, int vendorOui, byte[] vsa, byte[] frame) {
+        Message msg = mHandler.obtainMessage(MESSAGE_ON_BEACON_SDF_PAYLOAD);
+        Bundle data = new Bundle();
+        data.putByteArray(MESSAGE_BUNDLE_KEY_MAC_ADDRESS, peerMac);
+        data.putInt(MESSAGE_BUNDLE_KEY_VENDOR_OUI, vendorOui);
+        data.putByteArray(MESSAGE_BUNDLE_KEY_VSA_DATA, vsa);
+        data.putByteArray(MESSAGE_BUNDLE_KEY_FRAME_DATA, frame);
+        msg.setData(data);
+        mHandler.sendMessage(msg);
+    }
+
     private class WifiNanStateHandler extends Handler {
         WifiNanStateHandler(android.os.Looper looper) {
             super(looper);
@@ -480,6 +534,12 @@ public class WifiNanStateManager {
                 case MESSAGE_ON_MESSAGE_SEND_FAIL:
                     onMessageSendFailLocal((short) msg.arg1, msg.arg2);
                     break;
+                case MESSAGE_ON_FOLLOWUPS_READY:
+                    onFollowupsReadyLocal();
+                    break;
+                case MESSAGE_SAMPLE_STATS:
+                    sampleStatsLocal();
+                    break;
                 case MESSAGE_ON_UNKNOWN_TRANSACTION:
                     onUnknownTransactionLocal(
                             msg.getData().getInt(MESSAGE_BUNDLE_KEY_RESPONSE_TYPE),
@@ -509,6 +569,20 @@ public class WifiNanStateManager {
                             messageLength);
                     break;
                 }
+                case MESSAGE_ON_MATCH_EXPIRED:
+                    onMatchExpiredLocal(msg.arg1, msg.arg2);
+                    break;
+                case MESSAGE_ON_CLUSTER_SIZE_CHANGE:
+                    onClusterSizeChangeLocal(msg.arg1 != 0, msg.arg2);
+                    break;
+                case MESSAGE_ON_BEACON_SDF_PAYLOAD: {
+                    byte[] peerMac = msg.getData().getByteArray(MESSAGE_BUNDLE_KEY_MAC_ADDRESS);
+                    int vendorOui = msg.getData().getInt(MESSAGE_BUNDLE_KEY_VENDOR_OUI);
+                    byte[] vsa = msg.getData().getByteArray(MESSAGE_BUNDLE_KEY_VSA_DATA);
+                    byte[] frame = msg.getData().getByteArray(MESSAGE_BUNDLE_KEY_FRAME_DATA);
+                    onBeaconSdfPayloadLocal(peerMac, vendorOui, vsa, frame);
+                    break;
+                }
                 default:
                     Log.e(TAG, "Unknown message code: " + msg.what);
             }
@@ -519,10 +593,21 @@ public class WifiNanStateManager {
      * Transaction management classes & operations
      */
 
+    /*
+     * Transaction IDs from here up (as unsigned 16 bit values) are used by the JNI
+     * bridge for its own requests: NAN_TCA_TRANSACTION_ID and the stats requests
+     * from NAN_STATS_TRANSACTION_BASE. Wrap before reaching them.
+     */
+    private static final int RESERVED_TRANSACTION_ID_BASE = 0xEFFF;
+
     // non-synchronized (should be ok as long as only used from NanStateManager,
     // NanClientState, and NanSessionState)
     /* package */ short createNextTransactionId() {
-        return mNextTransactionId++;
+        short id = mNextTransactionId++;
+        if ((mNextTransactionId & 0xffff) >= RESERVED_TRANSACTION_ID_BASE) {
+            mNextTransactionId = 1;
+        }
+        return id;
     }
 
     private static class TransactionInfoBase {
@@ -663,6 +748,7 @@ public class WifiNanStateManager {
         client.destroy();
 
         if (mClients.size() == 0) {
+            stopStatsSamplingLocal();
             WifiNanNative.getInstance().disable(createTransactionInfo().mTransactionId);
             return;
         }
@@ -779,9 +865,12 @@ public class WifiNanStateManager {
             Log.v(TAG, "stopSession(): uid=" + uid + ", sessionId=" + sessionId);
         }
 
-        TransactionInfoSession info = createTransactionInfoSession(uid, sessionId);
+        // the cancel response is consumed by the native session table: nothing
+        // to register as a pending response
+        TransactionInfoSession info = new TransactionInfoSession();
+        fillInTransactionInfoSession(info, uid, sessionId);
 
-        info.mSession.stop(info.mTransactionId);
+        info.mSession.stop(createNextTransactionId());
     }
 
     /*
@@ -803,6 +892,14 @@ public class WifiNanStateManager {
             Log.v(TAG, "onConfigCompleted: transactionId=" + transactionId);
         }
 
+        // the HAL is not called from its own callback: the alert is re-armed from here
+        WifiNanNative.getInstance().rearmClusterSizeAlert();
+        if (mStatsPeriodMs == 0) {
+            startStatsSamplingLocal(
+                    SystemProperties.getInt(STATS_PERIOD_PROPERTY, STATS_DEFAULT_PERIOD_MS),
+                    STATS_TYPES);
+        }
+
         TransactionInfoBase info = getAndRemovePendingResponseTransactionInfo(transactionId);
         if (info == null) {
             Log.e(TAG, "onConfigCompleted: no transaction info for transactionId=" + transactionId);
@@ -857,6 +954,8 @@ public class WifiNanStateManager {
             Log.v(TAG, "onNanDown: reason=" + reason);
         }
 
+        stopStatsSamplingLocal();
+
         int interested = 0;
         for (int i = 0; i < mClients.size(); ++i) {
             WifiNanClientState client = mClients.valueAt(i);
@@ -904,6 +1003,25 @@ public class WifiNanStateManager {
         }
     }
 
+    private void onClusterSizeChangeLocal(boolean rising, int clusterSize) {
+        if (DBG) {
+            Log.d(TAG, "onClusterSizeChange: rising=" + rising + ", clusterSize=" + clusterSize);
+        }
+
+        mClusterSize = clusterSize;
+    }
+
+    private void onBeaconSdfPayloadLocal(byte[] peerMac, int vendorOui, byte[] vsa,
+            byte[] frame) {
+        // no client API for vendor payloads (yet): only logged
+        if (VDBG) {
+            Log.v(TAG, "onBeaconSdfPayload: peerMac="
+                    + String.valueOf(HexEncoding.encode(peerMac)) + ", vendorOui=" + vendorOui
+                    + ", vsa=" + (vsa == null ? "null" : String.valueOf(HexEncoding.encode(vsa)))
+                    + ", frameLength=" + (frame == null ? 0 : frame.length));
+        }
+    }
+
     private void onPublishSuccessLocal(short transactionId, int publishId) {
         if (VDBG) {
             Log.v(TAG, "onPublishSuccess: transactionId=" + transactionId + ", publishId="
@@ -1057,6 +1175,51 @@ public class WifiNanStateManager {
         infoMessage.mSession.onMessageSendFail(infoMessage.mMessageId, status);
     }
 
+    private void onFollowupsReadyLocal() {
+        if (VDBG) {
+            Log.v(TAG, "onFollowupsReady");
+        }
+
+        // the HAL is not called from its own callback: the queue is submitted from here
+        WifiNanNative.getInstance().transmitQueuedMessages();
+    }
+
+    private void startStatsSamplingLocal(int periodMs, int statsTypes) {
+        if (VDBG) {
+            Log.v(TAG, "startStatsSampling: periodMs=" + periodMs + ", statsTypes=" + statsTypes);
+        }
+
+        stopStatsSamplingLocal();
+        if (periodMs <= 0 || statsTypes == 0) {
+            return;
+        }
+
+        mStatsPeriodMs = periodMs;
+        mStatsTypes = statsTypes;
+        sampleStatsLocal();
+    }
+
+    private void stopStatsSamplingLocal() {
+        mHandler.removeMessages(MESSAGE_SAMPLE_STATS);
+        mStatsPeriodMs = 0;
+        mStatsTypes = 0;
+    }
+
+    private void sampleStatsLocal() {
+        if (mStatsPeriodMs == 0) {
+            return;
+        }
+
+        // a failed request means NAN or the HAL went away: sampling ends with it
+        if (!WifiNanNative.getInstance().requestStats(mStatsTypes)) {
+            Log.w(TAG, "sampleStats: request failed - stopping");
+            stopStatsSamplingLocal();
+            return;
+        }
+
+        mHandler.sendMessageDelayed(mHandler.obtainMessage(MESSAGE_SAMPLE_STATS), mStatsPeriodMs);
+    }
+
     private void onUnknownTransactionLocal(int responseType, short transactionId, int status) {
         Log.e(TAG, "onUnknownTransaction: responseType=" + responseType + ", transactionId="
                 + transactionId + ", status=" + status);
@@ -1089,6 +1252,21 @@ public class WifiNanStateManager {
                 serviceSpecificInfoLength, matchFilter, matchFilterLength);
     }
 
+    private void onMatchExpiredLocal(int pubSubId, int requestorInstanceId) {
+        if (VDBG) {
+            Log.v(TAG, "onMatchExpired: pubSubId=" + pubSubId + ", requestorInstanceId="
+                    + requestorInstanceId);
+        }
+
+        WifiNanSessionState session = getNanSessionStateForPubSubId(pubSubId);
+        if (session == null) {
+            Log.e(TAG, "onMatchExpired: no session found for pubSubId=" + pubSubId);
+            return;
+        }
+
+        session.onMatchExpired(requestorInstanceId);
+    }
+
     private void onMessageReceivedLocal(int pubSubId, int requestorInstanceId, byte[] peerMac,
             byte[] message, int messageLength) {
         if (VDBG) {
@@ -1165,8 +1343,11 @@ public class WifiNanStateManager {
         pw.println("  mPendingResponses: [" + mPendingResponses + "]");
         pw.println("  mCapabilities: [" + mCapabilities + "]");
         pw.println("  mNextTransactionId: " + mNextTransactionId);
+        pw.println("  mClusterSize: " + mClusterSize);
+        pw.println("  mStatsPeriodMs: " + mStatsPeriodMs + ", mStatsTypes: " + mStatsTypes);
         for (int i = 0; i < mClients.size(); ++i) {
             mClients.valueAt(i).dump(fd, pw, args);
         }
+        WifiNanNative.getInstance().dump(fd, pw, args);
     }
 }
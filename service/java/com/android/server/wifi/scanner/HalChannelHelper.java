@@ -28,6 +28,9 @@ import com.android.server.wifi.WifiNative;
 public class HalChannelHelper extends KnownBandsChannelHelper {
     private static final String TAG = "HalChannelHelper";
 
+    private static final int[] BANDS = { WifiScanner.WIFI_BAND_24_GHZ,
+            WifiScanner.WIFI_BAND_5_GHZ, WifiScanner.WIFI_BAND_5_GHZ_DFS_ONLY };
+
     private final WifiNative mWifiNative;
 
     public HalChannelHelper(WifiNative wifiNative) {
@@ -39,11 +42,16 @@ public class HalChannelHelper extends KnownBandsChannelHelper {
 
     @Override
     public void updateChannels() {
-        int[] channels24G = mWifiNative.getChannelsForBand(WifiScanner.WIFI_BAND_24_GHZ);
+        int[][] channels = mWifiNative.getChannelsForBands(BANDS);
+        if (channels == null) {
+            Log.e(TAG, "Failed to get channels for band, not updating band channel lists");
+            return;
+        }
+        int[] channels24G = channels[0];
         if (channels24G == null) Log.e(TAG, "Failed to get channels for 2.4GHz band");
-        int[] channels5G = mWifiNative.getChannelsForBand(WifiScanner.WIFI_BAND_5_GHZ);
+        int[] channels5G = channels[1];
         if (channels5G == null) Log.e(TAG, "Failed to get channels for 5GHz band");
-        int[] channelsDfs = mWifiNative.getChannelsForBand(WifiScanner.WIFI_BAND_5_GHZ_DFS_ONLY);
+        int[] channelsDfs = channels[2];
         if (channelsDfs == null) Log.e(TAG, "Failed to get channels for 5GHz DFS only band");
         if (channels24G == null || channels5G == null || channelsDfs == null) {
             Log.e(TAG, "Failed to get all channels for band, not updating band channel lists");
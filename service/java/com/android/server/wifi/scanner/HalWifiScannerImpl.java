@@ -170,4 +170,9 @@ public class HalWifiScannerImpl extends WifiScannerImpl implements Handler.Callb
     public void untrackSignificantWifiChange() {
         mWifiNative.untrackSignificantWifiChange();
     }
+
+    @Override
+    public void setMotionHint(boolean moving) {
+        mWifiNative.setScanMotionHint(moving);
+    }
 }
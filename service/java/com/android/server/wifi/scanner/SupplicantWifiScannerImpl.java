@@ -794,6 +794,10 @@ public class SupplicantWifiScannerImpl extends WifiScannerImpl implements Handle
     @Override
     public void untrackSignificantWifiChange() {}
 
+    /* background scans keep the schedule they were asked for */
+    @Override
+    public void setMotionHint(boolean moving) {}
+
 
     private static class LastScanSettings {
         public long startTime;
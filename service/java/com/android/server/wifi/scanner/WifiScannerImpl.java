@@ -176,4 +176,10 @@ public abstract class WifiScannerImpl {
      * Stop tracking significant wifi changes
      */
     public abstract void untrackSignificantWifiChange();
+
+    /**
+     * Tell the scanner whether the device appears to be moving, so that it does not slow down
+     * background scans meanwhile
+     */
+    public abstract void setMotionHint(boolean moving);
 }
@@ -2167,6 +2167,7 @@ public class WifiScanningServiceImpl extends IWifiScanner.Stub {
             @Override
             public void enter() {
                 if (DBG) localLog("Entering IdleState");
+                setMotionHint(false);
             }
 
             @Override
@@ -2203,6 +2204,7 @@ public class WifiScanningServiceImpl extends IWifiScanner.Stub {
             @Override
             public void enter() {
                 if (DBG) localLog("Entering StationaryState");
+                setMotionHint(false);
                 reportWifiStabilized(mCurrentBssids);
             }
 
@@ -2247,6 +2249,7 @@ public class WifiScanningServiceImpl extends IWifiScanner.Stub {
             @Override
             public void enter() {
                 if (DBG) localLog("Entering MovingState");
+                setMotionHint(true);
                 if (mTimeoutIntent == null) {
                     Intent intent = new Intent(ACTION_TIMEOUT, null);
                     mTimeoutIntent = PendingIntent.getBroadcast(mContext, 0, intent, 0);
@@ -2498,6 +2501,12 @@ public class WifiScanningServiceImpl extends IWifiScanner.Stub {
             }
         }
 
+        private void setMotionHint(boolean moving) {
+            if (mScannerImpl != null) {
+                mScannerImpl.setMotionHint(moving);
+            }
+        }
+
         private boolean addWifiChangeHandler(ClientInfo ci, int handler) {
             if (ci == null) {
                 Log.d(TAG, "Failing wifi change request ClientInfo not found " + handler);
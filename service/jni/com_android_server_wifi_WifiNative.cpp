@@ -23,15 +23,32 @@
 #include <utils/misc.h>
 #include <utils/Log.h>
 #include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Mutex.h>
+#include <utils/Condition.h>
+#include <utils/Timers.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/klog.h>
+#include <unistd.h>
 #include <linux/if.h>
 #include <linux/if_arp.h>
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <unordered_map>
 #include <vector>
 
 #include "wifi.h"
@@ -186,7 +203,392 @@ wifi_interface_handle getIfaceHandle(JNIHelper &helper, jclass cls, jint index)
     return (wifi_interface_handle) helper.getStaticLongArrayField(cls, WifiIfaceHandleVarName, index);
 }
 
-jboolean setSSIDField(JNIHelper helper, jobject scanResult, const char *rawSsid) {
+/*
+ * Native copy of sWifiIfaceHandles, along with the capabilities of each interface that cannot
+ * change while the HAL runs. getInterfaces() fills it in and the cleanup handler clears it; the
+ * fast natives are served from it without any JNI call.
+ */
+#define MAX_IFACES 8
+
+struct iface_info {
+    wifi_interface_handle handle;
+    bool features_valid;
+    feature_set features;
+};
+
+static Mutex sIfaceLock;
+static iface_info sIfaces[MAX_IFACES];
+static int sNumIfaces;
+
+static wifi_interface_handle lookupIfaceHandle(jint index) {
+    Mutex::Autolock lock(sIfaceLock);
+    return index >= 0 && index < sNumIfaces ? sIfaces[index].handle : NULL;
+}
+
+/* never calls the HAL, so it is safe from the fast natives; false until the HAL answered */
+static bool getCachedIfaceFeatureSet(jint index, feature_set *set) {
+    Mutex::Autolock lock(sIfaceLock);
+    if (index < 0 || index >= sNumIfaces || !sIfaces[index].features_valid) {
+        return false;
+    }
+    *set = sIfaces[index].features;
+    return true;
+}
+
+/* queries the HAL only until it answers once */
+static bool getIfaceFeatureSet(jint index, feature_set *set) {
+    wifi_interface_handle handle;
+    {
+        Mutex::Autolock lock(sIfaceLock);
+        if (index < 0 || index >= sNumIfaces) {
+            return false;
+        }
+        if (sIfaces[index].features_valid) {
+            *set = sIfaces[index].features;
+            return true;
+        }
+        handle = sIfaces[index].handle;
+    }
+
+    feature_set features = 0;
+    wifi_error result = hal_fn.wifi_get_supported_feature_set(handle, &features);
+    if (result != WIFI_SUCCESS) {
+        ALOGE("wifi_get_supported_feature_set returned error = 0x%x", result);
+        return false;
+    }
+    Mutex::Autolock lock(sIfaceLock);
+    if (index < sNumIfaces && sIfaces[index].handle == handle) {
+        sIfaces[index].features = features;
+        sIfaces[index].features_valid = true;
+    }
+    *set = features;
+    return true;
+}
+
+static void setIfaces(wifi_interface_handle *handles, int n) {
+    Mutex::Autolock lock(sIfaceLock);
+    memset(sIfaces, 0, sizeof(sIfaces));
+    for (int i = 0; i < n; i++) {
+        sIfaces[i].handle = handles[i];
+    }
+    sNumIfaces = n;
+}
+
+/*
+ * Event ring. Once the framework enables it, the high-rate HAL events (full scan results, RSSI
+ * threshold breaches and logger ring data) are written as records into a ring that the
+ * framework reads through a direct ByteBuffer, rather than each costing an upcall with freshly
+ * allocated arguments. Its single consumer, the framework's event ring thread, blocks in
+ * waitEventRingNative() while the ring is empty; producers only signal it, through an eventfd,
+ * when they find it waiting.
+ *
+ * head and tail count bytes since the ring was enabled. Records are 8-byte aligned and never
+ * wrap: one that does not fit before the end of the ring is preceded by a padding record. A
+ * record is a u32 length (including this 8-byte header, before alignment), a u32 type and the
+ * payload, in native byte order.
+ *
+ * The last EVENT_RING_RESERVE bytes are kept for the events that are never dropped (scan
+ * status), so that a burst of full results does not push them out of the ring; should even those
+ * run out, their producer waits for the consumer rather than overtake what is queued.
+ */
+
+#define EVENT_RING_MIN_SIZE     4096
+#define EVENT_RING_MAX_SIZE     (1 << 20)
+#define EVENT_RING_RESERVE      1024
+#define EVENT_HEADER_SIZE       8
+
+/* record types, as WifiNative.EVENT_* */
+typedef enum {
+    EVENT_PAD = 0,
+    EVENT_FULL_SCAN_RESULT = 1,
+    EVENT_RSSI_THRESHOLD_BREACHED = 2,
+    EVENT_RING_BUFFER_DATA = 3,
+    EVENT_SCAN_STATUS = 4,
+} event_type;
+
+typedef struct {
+    u32 length;
+    u32 type;
+} event_header;
+
+typedef struct {
+    int64_t timestamp;
+    int32_t id;
+    int32_t buckets_scanned;
+    int32_t capability;
+    int32_t rssi;
+    int32_t frequency;
+    int32_t ie_length;                  /* the information elements follow the record */
+    u8 bssid[6];
+    u8 ssid_length;
+    u8 reserved;
+    u8 ssid[32];
+} event_full_scan_result;
+
+typedef struct {
+    int32_t id;
+    int32_t rssi;
+} event_rssi_breach;
+
+/* behind the full results of its scan, like the upcall it replaces */
+typedef struct {
+    int32_t id;
+    int32_t event;
+} event_scan_status;
+
+typedef struct {
+    int32_t flags;
+    int32_t ring_id;
+    int32_t ring_buffer_byte_size;
+    int32_t verbose_level;
+    int32_t written_bytes;
+    int32_t read_bytes;
+    int32_t written_records;
+    int32_t data_length;                /* the ring data follows the record */
+    char name[32];
+} event_ring_buffer_data;
+
+/* the offsets WifiNative.dispatchEvent() reads them at */
+static_assert(sizeof(event_header) == EVENT_HEADER_SIZE, "event header");
+static_assert(sizeof(event_full_scan_result) == 72
+        && offsetof(event_full_scan_result, bssid) == 32, "full scan result event");
+static_assert(sizeof(event_rssi_breach) == 8, "RSSI breach event");
+static_assert(sizeof(event_scan_status) == 8, "scan status event");
+static_assert(sizeof(event_ring_buffer_data) == 64, "ring buffer data event");
+
+static Mutex sEventRingLock;            /* serializes the producers */
+static Condition sEventDrained;         /* the consumer moved tail, or the ring was disabled */
+static u8 *sEventRing = NULL;           /* lives as long as the process once mapped */
+static u32 sEventRingSize;
+static u32 sEventTypes;                 /* 1 << type for each type the ring carries */
+static std::atomic<bool> sEventRingEnabled(false);
+static std::atomic<uint64_t> sEventHead(0);
+static std::atomic<uint64_t> sEventTail(0);
+static std::atomic<bool> sEventConsumerWaiting(false);
+static std::atomic<int> sEventProducersWaiting(0);
+/* from enabling until the consumer is told the ring is disabled: it may still read the ring */
+static std::atomic<bool> sEventConsumerAttached(false);
+static int sEventFd = -1;
+static u32 sEventsDropped;
+
+static void wakeEventConsumer() {
+    uint64_t one = 1;
+    if (TEMP_FAILURE_RETRY(write(sEventFd, &one, sizeof(one))) != sizeof(one)) {
+        ALOGE("Error waking the event ring consumer: %s", strerror(errno));
+    }
+}
+
+/*
+ * Appends a record made of fixed followed by data. False if the ring does not carry events of
+ * this type, in which case the caller reports the event itself. An event that does not fit is
+ * dropped, unless it is not droppable: then it waits for the consumer to make room, and is
+ * false only if the ring is disabled meanwhile.
+ */
+static bool postEvent(event_type type, const void *fixed, u32 fixed_len, const void *data,
+        u32 data_len, bool droppable = true) {
+    if (!sEventRingEnabled.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    Mutex::Autolock lock(sEventRingLock);
+    if (!sEventRingEnabled.load(std::memory_order_relaxed) || !(sEventTypes & (1 << type))) {
+        return false;
+    }
+
+    u32 length = EVENT_HEADER_SIZE + fixed_len + data_len;
+    u32 aligned = (length + 7) & ~7;
+    u32 reserve = droppable ? EVENT_RING_RESERVE : 0;
+    uint64_t head = sEventHead.load(std::memory_order_relaxed);
+    u32 offset = head & (sEventRingSize - 1);
+    u32 pad = sEventRingSize - offset < aligned ? sEventRingSize - offset : 0;
+    if (!droppable && aligned > sEventRingSize) {
+        return false;
+    }
+    for (bool waited = false;; waited = true) {
+        uint64_t tail = sEventTail.load(std::memory_order_seq_cst);
+        /* nothing overtakes a waiting event */
+        bool behind = droppable && sEventProducersWaiting.load() != 0;
+        if (!behind && head + pad + aligned + reserve - tail <= sEventRingSize) {
+            break;
+        }
+        if (droppable) {
+            if (sEventsDropped++ == 0) {
+                ALOGW("Event ring full, dropping events of type %d", type);
+            }
+            return true;
+        }
+        if (!waited) {
+            ALOGW("Event ring full, waiting to post an event of type %d", type);
+        }
+        /* pairs with the consumer moving tail, then checking for waiting producers */
+        sEventProducersWaiting.fetch_add(1, std::memory_order_seq_cst);
+        if (sEventTail.load(std::memory_order_seq_cst) == tail) {
+            sEventDrained.wait(sEventRingLock);
+        }
+        sEventProducersWaiting.fetch_sub(1);
+        if (!sEventRingEnabled.load(std::memory_order_relaxed)) {
+            return false;
+        }
+    }
+
+    if (pad != 0) {
+        event_header padding = { pad, EVENT_PAD };
+        memcpy(sEventRing + offset, &padding, sizeof(padding));
+        head += pad;
+        offset = 0;
+    }
+    event_header header = { length, (u32) type };
+    memcpy(sEventRing + offset, &header, sizeof(header));
+    memcpy(sEventRing + offset + EVENT_HEADER_SIZE, fixed, fixed_len);
+    if (data_len != 0) {
+        memcpy(sEventRing + offset + EVENT_HEADER_SIZE + fixed_len, data, data_len);
+    }
+    sEventHead.store(head + aligned, std::memory_order_seq_cst);
+
+    /* pairs with the consumer publishing that it waits, then checking head again */
+    if (sEventConsumerWaiting.load(std::memory_order_seq_cst)
+            && sEventConsumerWaiting.exchange(false)) {
+        wakeEventConsumer();
+    }
+    return true;
+}
+
+static void disableEventRing() {
+    Mutex::Autolock lock(sEventRingLock);
+    if (sEventRingEnabled.exchange(false)) {
+        if (sEventsDropped != 0) {
+            ALOGW("Event ring dropped %u events", sEventsDropped);
+        }
+        wakeEventConsumer();
+        sEventDrained.broadcast();
+    }
+}
+
+static void android_net_wifi_disable_event_ring(JNIEnv *env, jclass cls) {
+    disableEventRing();
+}
+
+/*
+ * Returns the data of the ring as a direct ByteBuffer, or null. The ring is mapped once, with
+ * the size first asked for; enabling it again restarts it from position 0, and is refused until
+ * the consumer of the previous run has been told the ring was disabled.
+ */
+static jobject android_net_wifi_enable_event_ring(JNIEnv *env, jclass cls, jint size,
+        jint types) {
+    JNIHelper helper(env, __func__);
+    if (size < EVENT_RING_MIN_SIZE || size > EVENT_RING_MAX_SIZE || (size & (size - 1)) != 0) {
+        ALOGE("Invalid event ring size %d", size);
+        return NULL;
+    }
+
+    Mutex::Autolock lock(sEventRingLock);
+    if (sEventRingEnabled.load()) {
+        ALOGE("The event ring is already enabled");
+        return NULL;
+    }
+    if (sEventConsumerAttached.load()) {
+        ALOGE("The consumer of the previous event ring has not exited");
+        return NULL;
+    }
+    if (sEventRing == NULL) {
+        void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            ALOGE("Error mapping the event ring: %s", strerror(errno));
+            return NULL;
+        }
+        sEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (sEventFd < 0) {
+            ALOGE("Error creating the event ring eventfd: %s", strerror(errno));
+            munmap(ring, size);
+            return NULL;
+        }
+        sEventRing = (u8 *) ring;
+        sEventRingSize = size;
+    } else if ((u32) size != sEventRingSize) {
+        ALOGW("Event ring already mapped with %u bytes, not %d", sEventRingSize, size);
+    }
+
+    /* takes any wakeup the consumer of the previous run did not */
+    uint64_t count;
+    TEMP_FAILURE_RETRY(read(sEventFd, &count, sizeof(count)));
+    sEventHead.store(0);
+    sEventTail.store(0);
+    sEventConsumerWaiting.store(false);
+    sEventsDropped = 0;
+    sEventTypes = types;
+    sEventConsumerAttached.store(true);
+    sEventRingEnabled.store(true);
+    return helper.newDirectByteBuffer(sEventRing, sEventRingSize).detach();
+}
+
+static jlong waitEventRing(jlong consumed) {
+    if (sEventRing == NULL || consumed < 0
+            || (uint64_t) consumed > sEventHead.load(std::memory_order_acquire)) {
+        return -1;
+    }
+    sEventTail.store(consumed, std::memory_order_seq_cst);
+    if (sEventProducersWaiting.load(std::memory_order_seq_cst) != 0) {
+        Mutex::Autolock lock(sEventRingLock);
+        sEventDrained.broadcast();
+    }
+
+    for (;;) {
+        /* what was posted before the ring was disabled is still delivered */
+        uint64_t head = sEventHead.load(std::memory_order_acquire);
+        if (head != (uint64_t) consumed) {
+            return head;
+        }
+        if (!sEventRingEnabled.load()) {
+            return -1;
+        }
+
+        sEventConsumerWaiting.store(true, std::memory_order_seq_cst);
+        head = sEventHead.load(std::memory_order_seq_cst);
+        if (head != (uint64_t) consumed || !sEventRingEnabled.load()) {
+            sEventConsumerWaiting.store(false);
+            continue;
+        }
+        struct pollfd fds = { sEventFd, POLLIN, 0 };
+        if (TEMP_FAILURE_RETRY(poll(&fds, 1, -1)) < 0) {
+            ALOGE("Error waiting for events: %s", strerror(errno));
+            return -1;
+        }
+        uint64_t count;
+        TEMP_FAILURE_RETRY(read(sEventFd, &count, sizeof(count)));
+    }
+}
+
+/*
+ * Called by the consumer with the position it read up to; blocks while the ring is empty.
+ * Returns the position the producers wrote up to, or -1 once the ring is disabled and empty:
+ * the consumer then exits without reading the ring again.
+ */
+static jlong android_net_wifi_wait_event_ring(JNIEnv *env, jclass cls, jlong consumed) {
+    jlong head = waitEventRing(consumed);
+    if (head < 0) {
+        sEventConsumerAttached.store(false);
+    }
+    return head;
+}
+
+static bool postFullScanResult(wifi_request_id id, wifi_scan_result *result,
+        unsigned buckets_scanned) {
+    event_full_scan_result event;
+    memset(&event, 0, sizeof(event));
+    event.timestamp = result->ts;
+    event.id = id;
+    event.buckets_scanned = buckets_scanned;
+    event.capability = result->capability;
+    event.rssi = result->rssi;
+    event.frequency = result->channel;
+    event.ie_length = result->ie_length;
+    memcpy(event.bssid, result->bssid, sizeof(event.bssid));
+    event.ssid_length = strnlen(result->ssid, sizeof(event.ssid));
+    memcpy(event.ssid, result->ssid, event.ssid_length);
+    return postEvent(EVENT_FULL_SCAN_RESULT, &event, sizeof(event), result->ie_data,
+            result->ie_length);
+}
+
+jboolean setSSIDField(JNIHelper &helper, jobject scanResult, const char *rawSsid) {
 
     int len = strlen(rawSsid);
 
@@ -294,12 +696,27 @@ int set_iface_flags(const char *ifname, bool dev_up) {
     return 0;
 }
 
+static void invalidateApfPrograms();
+static void resetApfCache();
+static void resetKeepalives();
+static void resetWakeTracking();
+static void invalidateValidChannels(const char *country);
+static void resetTdlsPeers();
+static void resetScanFingerprints();
+static void resetScanControl();
+
+/* orders the gscan starts and stops of the framework and of the scan period controller */
+static Mutex sGscanLock;
+
 static jboolean android_net_wifi_set_interface_up(JNIEnv* env, jclass cls, jboolean up) {
+    invalidateApfPrograms();
+    resetKeepalives();
+    resetTdlsPeers();
     return (set_iface_flags("wlan0", (bool)up) == 0);
 }
 
 static jboolean android_net_wifi_startHal(JNIEnv* env, jclass cls) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_handle halHandle = getWifiHandle(helper, cls);
     if (halHandle == NULL) {
 
@@ -325,7 +742,7 @@ static jboolean android_net_wifi_startHal(JNIEnv* env, jclass cls) {
             ALOGD("Did set static halHandle = %p", halHandle);
         }
         env->GetJavaVM(&mVM);
-        mCls = (jclass) env->NewGlobalRef(cls);
+        mCls = (jclass) helper.newGlobalRef(cls);
         ALOGD("halHandle = %p, mVM = %p, mCls = %p", halHandle, mVM, mCls);
         return res == WIFI_SUCCESS;
     } else {
@@ -336,8 +753,17 @@ static jboolean android_net_wifi_startHal(JNIEnv* env, jclass cls) {
 void android_net_wifi_hal_cleaned_up_handler(wifi_handle handle) {
     ALOGD("In wifi cleaned up handler");
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     helper.setStaticLongField(mCls, WifiHandleVarName, 0);
+    setIfaces(NULL, 0);
+    disableEventRing();
+    resetApfCache();
+    resetKeepalives();
+    resetWakeTracking();
+    invalidateValidChannels("");
+    resetTdlsPeers();
+    resetScanFingerprints();
+    resetScanControl();
 
     helper.deleteGlobalRef(mCls);
     mCls = NULL;
@@ -347,12 +773,17 @@ void android_net_wifi_hal_cleaned_up_handler(wifi_handle handle) {
 static void android_net_wifi_stopHal(JNIEnv* env, jclass cls) {
     ALOGD("In wifi stop Hal");
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_handle halHandle = getWifiHandle(helper, cls);
     if (halHandle == NULL)
         return;
 
     ALOGD("halHandle = %p, mVM = %p, mCls = %p", halHandle, mVM, mCls);
+    {
+        /* no gscan is restarted once the HAL is being cleaned up */
+        AutoMutex lock(sGscanLock);
+        resetScanControl();
+    }
     hal_fn.wifi_cleanup(halHandle, android_net_wifi_hal_cleaned_up_handler);
 }
 
@@ -360,7 +791,7 @@ static void android_net_wifi_waitForHalEvents(JNIEnv* env, jclass cls) {
 
     ALOGD("waitForHalEvents called, vm = %p, obj = %p, env = %p", mVM, mCls, env);
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_handle halHandle = getWifiHandle(helper, cls);
     hal_fn.wifi_event_loop(halHandle);
     set_iface_flags("wlan0", false);
@@ -369,7 +800,7 @@ static void android_net_wifi_waitForHalEvents(JNIEnv* env, jclass cls) {
 static int android_net_wifi_getInterfaces(JNIEnv *env, jclass cls) {
     int n = 0;
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
 
     wifi_handle halHandle = getWifiHandle(helper, cls);
     wifi_interface_handle *ifaceHandles = NULL;
@@ -406,6 +837,12 @@ static int android_net_wifi_getInterfaces(JNIEnv *env, jclass cls) {
 
     helper.setLongArrayRegion(array, 0, n, elems);
     helper.setStaticLongArrayField(cls, WifiIfaceHandleVarName, array);
+    setIfaces(ifaceHandles, n);
+    /* so that the fast getSupportedFeatureSetNative() does not have to wait for the driver */
+    for (int i = 0; i < n; i++) {
+        feature_set set;
+        getIfaceFeatureSet(i, &set);
+    }
 
     return (result < 0) ? result : n;
 }
@@ -414,7 +851,7 @@ static jstring android_net_wifi_getInterfaceName(JNIEnv *env, jclass cls, jint i
 
     char buf[EVENT_BUF_SIZE];
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
 
     jlong value = helper.getStaticLongArrayField(cls, WifiIfaceHandleVarName, i);
     wifi_interface_handle handle = (wifi_interface_handle) value;
@@ -427,10 +864,32 @@ static jstring android_net_wifi_getInterfaceName(JNIEnv *env, jclass cls, jint i
     }
 }
 
+static void addFullScanFingerprint(const wifi_scan_result *result);
+static void completeFullScanFingerprint();
+static void addScanFingerprints(const wifi_cached_scan_results *batches, int num_batches);
+
+static void startScanControl(wifi_interface_handle handle, wifi_request_id id,
+        const wifi_scan_cmd_params *params, const wifi_scan_result_handler *handler);
+static void stopScanControl(wifi_request_id id);
 
 static void onScanEvent(wifi_request_id id, wifi_scan_event event) {
 
-    JNIHelper helper(mVM);
+    if (event != WIFI_SCAN_FAILED) {
+        completeFullScanFingerprint();
+    }
+
+    /*
+     * Through the ring when the framework reads it, so that it sees the full results of
+     * a scan before it is told the scan completed. Never dropped: it uses the space the
+     * ring keeps for it, and waits for room beyond that; once the ring is disabled, the
+     * upcall is made instead.
+     */
+    event_scan_status status = { id, event };
+    if (postEvent(EVENT_SCAN_STATUS, &status, sizeof(status), NULL, 0, false)) {
+        return;
+    }
+
+    JNIHelper helper(mVM, __func__);
 
     // ALOGD("onScanStatus called, vm = %p, obj = %p, env = %p", mVM, mCls, env);
 
@@ -440,7 +899,12 @@ static void onScanEvent(wifi_request_id id, wifi_scan_event event) {
 static void onFullScanResult(wifi_request_id id, wifi_scan_result *result,
         unsigned buckets_scanned) {
 
-    JNIHelper helper(mVM);
+    addFullScanFingerprint(result);
+    if (postFullScanResult(id, result, buckets_scanned)) {
+        return;
+    }
+
+    JNIHelper helper(mVM, __func__);
 
     //ALOGD("onFullScanResult called, vm = %p, obj = %p, env = %p", mVM, mCls, env);
 
@@ -457,7 +921,7 @@ static void onFullScanResult(wifi_request_id id, wifi_scan_result *result,
 static jboolean android_net_wifi_startScan(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject settings) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     // ALOGD("starting scan on interface[%d] = %p", iface, handle);
 
@@ -528,15 +992,22 @@ static jboolean android_net_wifi_startScan(
     handler.on_full_scan_result = &onFullScanResult;
     handler.on_scan_event = &onScanEvent;
 
-    return hal_fn.wifi_start_gscan(id, handle, params, handler) == WIFI_SUCCESS;
+    AutoMutex lock(sGscanLock);
+    if (hal_fn.wifi_start_gscan(id, handle, params, handler) != WIFI_SUCCESS) {
+        return false;
+    }
+    startScanControl(handle, id, &params, &handler);
+    return true;
 }
 
 static jboolean android_net_wifi_stopScan(JNIEnv *env, jclass cls, jint iface, jint id) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     // ALOGD("stopping scan on interface[%d] = %p", iface, handle);
 
+    AutoMutex lock(sGscanLock);
+    stopScanControl(id);
     return hal_fn.wifi_stop_gscan(id, handle)  == WIFI_SUCCESS;
 }
 
@@ -546,10 +1017,12 @@ static int compare_scan_result_timestamp(const void *v1, const void *v2) {
     return result1->ts - result2->ts;
 }
 
+static void appendScanHistory(const wifi_cached_scan_results *batches, int num_batches);
+
 static jobject android_net_wifi_getScanResults(
         JNIEnv *env, jclass cls, jint iface, jboolean flush)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_cached_scan_results scan_data[64];
     int num_scan_data = 64;
 
@@ -559,6 +1032,12 @@ static jobject android_net_wifi_getScanResults(
     byte b = flush ? 0xFF : 0;
     int result = hal_fn.wifi_get_cached_gscan_results(handle, b, num_scan_data, scan_data, &num_scan_data);
     if (result == WIFI_SUCCESS) {
+        /* a read without flush leaves the batches to be returned again */
+        if (flush) {
+            appendScanHistory(scan_data, num_scan_data);
+        }
+        addScanFingerprints(scan_data, num_scan_data);
+
         JNIObject<jobjectArray> scanData = helper.createObjectArray(
                 "android/net/wifi/WifiScanner$ScanData", num_scan_data);
         if (scanData == NULL) {
@@ -618,7 +1097,7 @@ static jobject android_net_wifi_getScanResults(
 static jboolean android_net_wifi_getScanCapabilities(
         JNIEnv *env, jclass cls, jint iface, jobject capabilities) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     // ALOGD("getting scan capabilities on interface[%d] = %p", iface, handle);
 
@@ -692,7 +1171,7 @@ static void parseMacAddress(const char *str, mac_addr addr) {
 }
 
 static bool parseMacAddress(JNIEnv *env, jobject obj, mac_addr addr) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     JNIObject<jstring> macAddrString = helper.getStringField(obj, "bssid");
     if (macAddrString == NULL) {
         ALOGE("Error getting bssid field");
@@ -713,7 +1192,7 @@ static bool parseMacAddress(JNIEnv *env, jobject obj, mac_addr addr) {
 static void onHotlistApFound(wifi_request_id id,
         unsigned num_results, wifi_scan_result *results) {
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     ALOGD("onHotlistApFound called, vm = %p, obj = %p, num_results = %d", mVM, mCls, num_results);
 
     JNIObject<jobjectArray> scanResults = helper.newObjectArray(num_results,
@@ -743,7 +1222,7 @@ static void onHotlistApFound(wifi_request_id id,
 static void onHotlistApLost(wifi_request_id id,
         unsigned num_results, wifi_scan_result *results) {
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     ALOGD("onHotlistApLost called, vm = %p, obj = %p, num_results = %d", mVM, mCls, num_results);
 
     JNIObject<jobjectArray> scanResults = helper.newObjectArray(num_results,
@@ -774,7 +1253,7 @@ static void onHotlistApLost(wifi_request_id id,
 static jboolean android_net_wifi_setHotlist(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject ap)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("setting hotlist on interface[%d] = %p", iface, handle);
 
@@ -839,7 +1318,7 @@ static jboolean android_net_wifi_setHotlist(
 
 static jboolean android_net_wifi_resetHotlist(JNIEnv *env, jclass cls, jint iface, jint id)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("resetting hotlist on interface[%d] = %p", iface, handle);
 
@@ -849,7 +1328,7 @@ static jboolean android_net_wifi_resetHotlist(JNIEnv *env, jclass cls, jint ifac
 void onSignificantWifiChange(wifi_request_id id,
         unsigned num_results, wifi_significant_change_result **results) {
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
 
     ALOGD("onSignificantWifiChange called, vm = %p, obj = %p", mVM, mCls);
 
@@ -894,7 +1373,7 @@ void onSignificantWifiChange(wifi_request_id id,
 static jboolean android_net_wifi_trackSignificantWifiChange(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject settings)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("tracking significant wifi change on interface[%d] = %p", iface, handle);
 
@@ -960,7 +1439,7 @@ static jboolean android_net_wifi_trackSignificantWifiChange(
 static jboolean android_net_wifi_untrackSignificantWifiChange(
         JNIEnv *env, jclass cls, jint iface, jint id)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("resetting significant wifi change on interface[%d] = %p", iface, handle);
 
@@ -984,6 +1463,9 @@ bool isTxLevelStatsPresent(wifi_radio_stat *radio_stats) {
     return false;
 }
 
+static void recordLinkStats(const wifi_iface_stat *iface, const wifi_radio_stat *radio);
+static void noteScanControlRssi(int rssi);
+
 void onLinkStatsResults(wifi_request_id id, wifi_iface_stat *iface_stat,
          int num_radios, wifi_radio_stat *radio_stats)
 {
@@ -1009,10 +1491,15 @@ void onLinkStatsResults(wifi_request_id id, wifi_iface_stat *iface_stat,
     } else {
         memset(&radio_stat, 0, sizeof(wifi_radio_stat));
     }
+
+    if (iface_stat != 0) {
+        recordLinkStats(&link_stat, &radio_stat);
+        noteScanControlRssi(link_stat.rssi_mgmt);
+    }
 }
 
 static void android_net_wifi_setLinkLayerStats (JNIEnv *env, jclass cls, jint iface, int enable)  {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     wifi_link_layer_params params;
@@ -1024,25 +1511,130 @@ static void android_net_wifi_setLinkLayerStats (JNIEnv *env, jclass cls, jint if
     hal_fn.wifi_set_link_stats(handle, params);
 }
 
-static jobject android_net_wifi_getLinkLayerStats (JNIEnv *env, jclass cls, jint iface)  {
+/*
+ * Link layer stats are polled with every RSSI poll. The fields of WifiLinkLayerStats are
+ * resolved once, and fillWifiLinkLayerStatsNative() overwrites a WifiLinkLayerStats the caller
+ * keeps, along with its tx_time_per_level array unless the number of power levels changed, so
+ * polling allocates no Java objects.
+ */
+
+static const char *const kLinkStatsAcFields[][WIFI_AC_MAX] = {
+    /* in wifi_access_category order: VO, VI, BE, BK */
+    { "rxmpdu_vo", "rxmpdu_vi", "rxmpdu_be", "rxmpdu_bk" },
+    { "txmpdu_vo", "txmpdu_vi", "txmpdu_be", "txmpdu_bk" },
+    { "lostmpdu_vo", "lostmpdu_vi", "lostmpdu_be", "lostmpdu_bk" },
+    { "retries_vo", "retries_vi", "retries_be", "retries_bk" },
+};
+
+#define LINK_STATS_AC_COUNTERS  (sizeof(kLinkStatsAcFields) / sizeof(kLinkStatsAcFields[0]))
+
+typedef struct {
+    jfieldID beacon_rx;
+    jfieldID rssi_mgmt;
+    jfieldID ac[LINK_STATS_AC_COUNTERS][WIFI_AC_MAX];
+    jfieldID on_time;
+    jfieldID tx_time;
+    jfieldID rx_time;
+    jfieldID on_time_scan;
+    jfieldID tx_time_per_level;
+} link_stats_fields;
+
+static Mutex sLinkStatsLock;
+static link_stats_fields sLinkStatsFields;
+static bool sLinkStatsFieldsResolved = false;
+
+static bool getLinkStatsFields(JNIHelper &helper, jobject stats, link_stats_fields *fields) {
+    AutoMutex lock(sLinkStatsLock);
+
+    link_stats_fields *f = &sLinkStatsFields;
+    if (!sLinkStatsFieldsResolved) {
+        bool ok = (f->beacon_rx = helper.getFieldID(stats, "beacon_rx", "I")) != 0
+                && (f->rssi_mgmt = helper.getFieldID(stats, "rssi_mgmt", "I")) != 0
+                && (f->on_time = helper.getFieldID(stats, "on_time", "I")) != 0
+                && (f->tx_time = helper.getFieldID(stats, "tx_time", "I")) != 0
+                && (f->rx_time = helper.getFieldID(stats, "rx_time", "I")) != 0
+                && (f->on_time_scan = helper.getFieldID(stats, "on_time_scan", "I")) != 0
+                && (f->tx_time_per_level = helper.getFieldID(stats, "tx_time_per_level", "[I"))
+                        != 0;
+        for (unsigned i = 0; i < LINK_STATS_AC_COUNTERS && ok; i++) {
+            for (int ac = 0; ac < WIFI_AC_MAX && ok; ac++) {
+                ok = (f->ac[i][ac] = helper.getFieldID(stats, kLinkStatsAcFields[i][ac], "J")) != 0;
+            }
+        }
+        if (!ok) {
+            return false;
+        }
+        sLinkStatsFieldsResolved = true;
+    }
+
+    *fields = *f;
+    return true;
+}
 
-    JNIHelper helper(env);
+static bool requestLinkLayerStats(JNIHelper &helper, jclass cls, jint iface) {
     wifi_stats_result_handler handler;
     memset(&handler, 0, sizeof(handler));
     handler.on_link_stats_results = &onLinkStatsResults;
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     int result;
-    // Cache the features supported by the device to determine if tx level stats are present or not
-    if (cached_feature_set == 0) {
-        result = hal_fn.wifi_get_supported_feature_set(handle, &cached_feature_set);
-        if (result != WIFI_SUCCESS) {
-            cached_feature_set = 0;
-        }
-    }
+    // The features supported by the device determine if tx level stats are present or not
+    feature_set set;
+    cached_feature_set = getIfaceFeatureSet(iface, &set) ? set : 0;
 
     result = hal_fn.wifi_get_link_stats(0, handle, handler);
     if (result < 0) {
         ALOGE("android_net_wifi_getLinkLayerStats: failed to get link statistics\n");
+        return false;
+    }
+    return true;
+}
+
+/* overwrites every field of wifiLinkLayerStats with the stats last received */
+static bool fillLinkLayerStats(JNIHelper &helper, jobject wifiLinkLayerStats) {
+    link_stats_fields f;
+    if (!getLinkStatsFields(helper, wifiLinkLayerStats, &f)) {
+        ALOGE("Error in resolving WifiLinkLayerStats fields");
+        return false;
+    }
+
+    /* no per level times: an empty array, so that none are left over from the last poll */
+    int num_tx_levels = radio_stat.tx_time_per_levels != 0 ? radio_stat.num_tx_levels : 0;
+    JNIObject<jintArray> tx_time_per_level = helper.getIntArrayField(wifiLinkLayerStats,
+            f.tx_time_per_level);
+    if (tx_time_per_level == NULL
+            || helper.getArrayLength(tx_time_per_level) != num_tx_levels) {
+        tx_time_per_level = helper.newIntArray(num_tx_levels);
+        if (tx_time_per_level == NULL) {
+            ALOGE("Error in allocating wifiLinkLayerStats");
+            return false;
+        }
+        helper.setObjectField(wifiLinkLayerStats, f.tx_time_per_level, tx_time_per_level);
+    }
+
+    helper.setIntField(wifiLinkLayerStats, f.beacon_rx, link_stat.beacon_rx);
+    helper.setIntField(wifiLinkLayerStats, f.rssi_mgmt, link_stat.rssi_mgmt);
+    for (int ac = 0; ac < WIFI_AC_MAX; ac++) {
+        helper.setLongField(wifiLinkLayerStats, f.ac[0][ac], link_stat.ac[ac].rx_mpdu);
+        helper.setLongField(wifiLinkLayerStats, f.ac[1][ac], link_stat.ac[ac].tx_mpdu);
+        helper.setLongField(wifiLinkLayerStats, f.ac[2][ac], link_stat.ac[ac].mpdu_lost);
+        helper.setLongField(wifiLinkLayerStats, f.ac[3][ac], link_stat.ac[ac].retries);
+    }
+
+    helper.setIntField(wifiLinkLayerStats, f.on_time, radio_stat.on_time);
+    helper.setIntField(wifiLinkLayerStats, f.tx_time, radio_stat.tx_time);
+    helper.setIntField(wifiLinkLayerStats, f.rx_time, radio_stat.rx_time);
+    helper.setIntField(wifiLinkLayerStats, f.on_time_scan, radio_stat.on_time_scan);
+    if (num_tx_levels > 0) {
+        helper.setIntArrayRegion(tx_time_per_level, 0, num_tx_levels,
+                (jint *)radio_stat.tx_time_per_levels);
+    }
+    return true;
+}
+
+static jobject android_net_wifi_getLinkLayerStats (JNIEnv *env, jclass cls, jint iface)  {
+
+    JNIHelper helper(env, __func__);
+    if (!requestLinkLayerStats(helper, cls, iface)) {
         return NULL;
     }
 
@@ -1053,77 +1645,45 @@ static jobject android_net_wifi_getLinkLayerStats (JNIEnv *env, jclass cls, jint
        return NULL;
     }
 
-    JNIObject<jintArray> tx_time_per_level = helper.newIntArray(radio_stat.num_tx_levels);
-    if (tx_time_per_level == NULL) {
-        ALOGE("Error in allocating wifiLinkLayerStats");
+    if (!fillLinkLayerStats(helper, wifiLinkLayerStats)) {
         return NULL;
     }
+    return wifiLinkLayerStats.detach();
+}
 
-    helper.setIntField(wifiLinkLayerStats, "beacon_rx", link_stat.beacon_rx);
-    helper.setIntField(wifiLinkLayerStats, "rssi_mgmt", link_stat.rssi_mgmt);
-    helper.setLongField(wifiLinkLayerStats, "rxmpdu_be", link_stat.ac[WIFI_AC_BE].rx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "rxmpdu_bk", link_stat.ac[WIFI_AC_BK].rx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "rxmpdu_vi", link_stat.ac[WIFI_AC_VI].rx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "rxmpdu_vo", link_stat.ac[WIFI_AC_VO].rx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "txmpdu_be", link_stat.ac[WIFI_AC_BE].tx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "txmpdu_bk", link_stat.ac[WIFI_AC_BK].tx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "txmpdu_vi", link_stat.ac[WIFI_AC_VI].tx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "txmpdu_vo", link_stat.ac[WIFI_AC_VO].tx_mpdu);
-    helper.setLongField(wifiLinkLayerStats, "lostmpdu_be", link_stat.ac[WIFI_AC_BE].mpdu_lost);
-    helper.setLongField(wifiLinkLayerStats, "lostmpdu_bk", link_stat.ac[WIFI_AC_BK].mpdu_lost);
-    helper.setLongField(wifiLinkLayerStats, "lostmpdu_vi",  link_stat.ac[WIFI_AC_VI].mpdu_lost);
-    helper.setLongField(wifiLinkLayerStats, "lostmpdu_vo", link_stat.ac[WIFI_AC_VO].mpdu_lost);
-    helper.setLongField(wifiLinkLayerStats, "retries_be", link_stat.ac[WIFI_AC_BE].retries);
-    helper.setLongField(wifiLinkLayerStats, "retries_bk", link_stat.ac[WIFI_AC_BK].retries);
-    helper.setLongField(wifiLinkLayerStats, "retries_vi", link_stat.ac[WIFI_AC_VI].retries);
-    helper.setLongField(wifiLinkLayerStats, "retries_vo", link_stat.ac[WIFI_AC_VO].retries);
-
-    helper.setIntField(wifiLinkLayerStats, "on_time", radio_stat.on_time);
-    helper.setIntField(wifiLinkLayerStats, "tx_time", radio_stat.tx_time);
-    helper.setIntField(wifiLinkLayerStats, "rx_time", radio_stat.rx_time);
-    helper.setIntField(wifiLinkLayerStats, "on_time_scan", radio_stat.on_time_scan);
-    if (radio_stat.tx_time_per_levels != 0) {
-        helper.setIntArrayRegion(tx_time_per_level, 0, radio_stat.num_tx_levels,
-                (jint *)radio_stat.tx_time_per_levels);
-    }
-    helper.setObjectField(wifiLinkLayerStats, "tx_time_per_level", "[I", tx_time_per_level);
-
+static jboolean android_net_wifi_fillLinkLayerStats(JNIEnv *env, jclass cls, jint iface,
+        jobject stats) {
 
-    return wifiLinkLayerStats.detach();
+    JNIHelper helper(env, __func__);
+    if (stats == NULL || !requestLinkLayerStats(helper, cls, iface)) {
+        return false;
+    }
+    return fillLinkLayerStats(helper, stats);
 }
 
+/*
+ * fast native: served from the capability cache, which getInterfaces() already filled in. It
+ * returns 0 if the HAL did not answer then; querySupportedFeatureSetNative() asks it again.
+ */
 static jint android_net_wifi_getSupportedFeatures(JNIEnv *env, jclass cls, jint iface) {
-
-    JNIHelper helper(env);
-    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     feature_set set = 0;
+    if (!getCachedIfaceFeatureSet(iface, &set)) {
+        return 0;
+    }
+    return set;
+}
 
-    wifi_error result = WIFI_SUCCESS;
-    /*
-    set = WIFI_FEATURE_INFRA
-        | WIFI_FEATURE_INFRA_5G
-        | WIFI_FEATURE_HOTSPOT
-        | WIFI_FEATURE_P2P
-        | WIFI_FEATURE_SOFT_AP
-        | WIFI_FEATURE_GSCAN
-        | WIFI_FEATURE_PNO
-        | WIFI_FEATURE_TDLS
-        | WIFI_FEATURE_EPR;
-    */
-
-    result = hal_fn.wifi_get_supported_feature_set(handle, &set);
-    if (result == WIFI_SUCCESS) {
-        // ALOGD("wifi_get_supported_feature_set returned set = 0x%x", set);
-        return set;
-    } else {
-        ALOGE("wifi_get_supported_feature_set returned error = 0x%x", result);
+static jint android_net_wifi_querySupportedFeatures(JNIEnv *env, jclass cls, jint iface) {
+    feature_set set = 0;
+    if (!getIfaceFeatureSet(iface, &set)) {
         return 0;
     }
+    return set;
 }
 
 static void onRttResults(wifi_request_id id, unsigned num_results, wifi_rtt_result* results[]) {
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
 
     if (DBG) ALOGD("onRttResults called, vm = %p, obj = %p", mVM, mCls);
 
@@ -1187,9 +1747,9 @@ static void onRttResults(wifi_request_id id, unsigned num_results, wifi_rtt_resu
                 "android/net/wifi/RttManager$WifiInformationElement");
         if (result->LCR != NULL && result->LCR->len > 0) {
             helper.setByteField(LCR, "id",           result->LCR->id);
-            JNIObject<jbyteArray> elements = helper.newByteArray(result->LCI->len);
+            JNIObject<jbyteArray> elements = helper.newByteArray(result->LCR->len);
             jbyte *bytes = (jbyte *)&(result->LCR->data[0]);
-            helper.setByteArrayRegion(elements, 0, result->LCI->len, bytes);
+            helper.setByteArrayRegion(elements, 0, result->LCR->len, bytes);
             helper.setObjectField(LCR, "data", "[B", elements);
         } else {
             helper.setByteField(LCR, "id", (byte)(0xff));
@@ -1209,7 +1769,7 @@ const int MaxRttConfigs = 16;
 static jboolean android_net_wifi_requestRange(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject params)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
 
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     if (DBG) ALOGD("sending rtt request [%d] = %p", id, handle);
@@ -1266,7 +1826,7 @@ static jboolean android_net_wifi_requestRange(
 static jboolean android_net_wifi_cancelRange(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject params)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     if (DBG) ALOGD("cancelling rtt request [%d] = %p", id, handle);
 
@@ -1299,7 +1859,7 @@ static jboolean android_net_wifi_cancelRange(
 
 static jobject android_net_wifi_enableResponder(
         JNIEnv *env, jclass cls, jint iface, jint id, jint timeout_seconds, jobject channel_hint) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     if (DBG) ALOGD("enabling responder request [%d] = %p", id, handle);
     wifi_channel_info channel;
@@ -1349,7 +1909,7 @@ static jobject android_net_wifi_enableResponder(
 
 static jboolean android_net_wifi_disableResponder(
         JNIEnv *env, jclass cls, jint iface, jint id)  {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     if (DBG) ALOGD("disabling responder request [%d] = %p", id, handle);
     return hal_fn.wifi_disable_responder(id, handle) == WIFI_SUCCESS;
@@ -1359,7 +1919,7 @@ static jboolean android_net_wifi_disableResponder(
 static jboolean android_net_wifi_setScanningMacOui(JNIEnv *env, jclass cls,
         jint iface, jbyteArray param)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("setting scan oui %p", handle);
 
@@ -1380,59 +1940,250 @@ static jboolean android_net_wifi_setScanningMacOui(JNIEnv *env, jclass cls,
     return hal_fn.wifi_set_scanning_mac_oui(handle, (byte *)bytes) == WIFI_SUCCESS;
 }
 
+/* fast native */
 static jboolean android_net_wifi_is_get_channels_for_band_supported(JNIEnv *env, jclass cls){
     return (hal_fn.wifi_get_valid_channels == wifi_get_valid_channels_stub);
 }
 
-static jintArray android_net_wifi_getValidChannels(JNIEnv *env, jclass cls,
-        jint iface, jint band)  {
+/*
+ * Valid channels. The HAL's channel lists only change with the regulatory domain, so they are
+ * kept per interface, band and country code, and dropped when the country code or DFS flag is
+ * set and when the HAL is cleaned up. Lists are read into a buffer that grows until the HAL
+ * returns fewer channels than it holds, instead of being cut at a fixed size.
+ */
 
-    JNIHelper helper(env);
-    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
-    ALOGV("getting valid channels %p", handle);
+#define CHANNEL_CACHE_SIZE      16      /* bands for two interfaces */
+#define CHANNEL_LIST_INITIAL    64
+#define CHANNEL_LIST_MAX        1024
+
+typedef struct {
+    int band;                   /* wifi_band of the channels, DFS or not */
+    int first_freq;
+    int last_freq;
+    int base_freq;              /* frequency of channel 0 */
+} channel_range;
+
+static constexpr channel_range kChannelRanges[] = {
+    { WIFI_BAND_BG, 2412, 2472, 2407 },
+    { WIFI_BAND_BG, 2484, 2484, 2414 },     /* channel 14 */
+    { WIFI_BAND_A, 4910, 4980, 4000 },      /* channels 182-196 */
+    { WIFI_BAND_A, 5000, 5900, 5000 },
+};
 
-    static const int MaxChannels = 64;
-    wifi_channel channels[64];
-    int num_channels = 0;
-    wifi_error result = hal_fn.wifi_get_valid_channels(handle, band, MaxChannels,
-            channels, &num_channels);
+static constexpr int kNumChannelRanges = sizeof(kChannelRanges) / sizeof(kChannelRanges[0]);
 
-    if (result == WIFI_SUCCESS) {
-        JNIObject<jintArray> channelArray = helper.newIntArray(num_channels);
-        if (channelArray == NULL) {
-            ALOGE("failed to allocate channel list, num_channels=%d", num_channels);
-            return NULL;
+static constexpr int findChannelRange(int freq, int i = 0) {
+    return i == kNumChannelRanges ? -1
+            : freq >= kChannelRanges[i].first_freq && freq <= kChannelRanges[i].last_freq ? i
+            : findChannelRange(freq, i + 1);
+}
+
+/* 0 for a frequency outside the 2.4 and 5 GHz bands */
+static constexpr int frequencyToChannel(int freq) {
+    return findChannelRange(freq) < 0 ? 0
+            : (freq - kChannelRanges[findChannelRange(freq)].base_freq) / 5;
+}
+
+/* WIFI_BAND_BG, WIFI_BAND_A, or WIFI_BAND_UNSPECIFIED */
+static constexpr int frequencyToBand(int freq) {
+    return findChannelRange(freq) < 0 ? WIFI_BAND_UNSPECIFIED
+            : kChannelRanges[findChannelRange(freq)].band;
+}
+
+static_assert(frequencyToChannel(2412) == 1 && frequencyToChannel(2484) == 14
+        && frequencyToChannel(4920) == 184 && frequencyToChannel(5180) == 36
+        && frequencyToChannel(5825) == 165 && frequencyToChannel(60480) == 0,
+        "bad channel table");
+static_assert(frequencyToBand(2437) == WIFI_BAND_BG && frequencyToBand(5500) == WIFI_BAND_A
+        && frequencyToBand(3000) == WIFI_BAND_UNSPECIFIED, "bad channel table");
+
+typedef struct {
+    wifi_interface_handle handle;       /* NULL: free */
+    int band;
+    char country[4];
+    std::vector<wifi_channel> channels;
+} channel_cache_entry;
+
+static Mutex sChannelLock;
+static channel_cache_entry sChannelCache[CHANNEL_CACHE_SIZE];
+static int sChannelCacheNext = 0;       /* entry replaced when the cache is full */
+static char sChannelCountry[4] = "";    /* last country code set through the HAL */
+
+static bool isChannelInBand(wifi_channel freq, int band) {
+    switch (frequencyToBand(freq)) {
+        case WIFI_BAND_BG: return (band & WIFI_BAND_BG) != 0;
+        case WIFI_BAND_A: return (band & WIFI_BAND_A_WITH_DFS) != 0;
+    }
+    return false;
+}
+
+/* called with sChannelLock held */
+static wifi_error loadValidChannels(wifi_interface_handle handle, int band,
+        std::vector<wifi_channel> *channels) {
+    int capacity = CHANNEL_LIST_INITIAL;
+    int num_channels;
+    for (;;) {
+        channels->resize(capacity);
+        num_channels = 0;
+        wifi_error ret = hal_fn.wifi_get_valid_channels(handle, band, capacity,
+                channels->data(), &num_channels);
+        if (ret != WIFI_SUCCESS) {
+            return ret;
         }
+        if (num_channels < capacity || capacity >= CHANNEL_LIST_MAX) {
+            break;
+        }
+        capacity *= 2;              /* the list may have been cut */
+    }
 
-        helper.setIntArrayRegion(channelArray, 0, num_channels, channels);
-        return channelArray.detach();
-    } else {
+    int kept = 0;
+    for (int i = 0; i < std::min(num_channels, capacity); i++) {
+        wifi_channel freq = (*channels)[i];
+        if (isChannelInBand(freq, band)) {
+            (*channels)[kept++] = freq;
+        } else {
+            ALOGD("Ignoring channel %d MHz, not in band %d", freq, band);
+        }
+    }
+    channels->resize(kept);
+    return WIFI_SUCCESS;
+}
+
+static wifi_error getValidChannels(wifi_interface_handle handle, int band,
+        std::vector<wifi_channel> *channels) {
+    AutoMutex lock(sChannelLock);
+    for (int i = 0; i < CHANNEL_CACHE_SIZE; i++) {
+        channel_cache_entry *e = &sChannelCache[i];
+        if (e->handle == handle && e->band == band && strcmp(e->country, sChannelCountry) == 0) {
+            *channels = e->channels;
+            return WIFI_SUCCESS;
+        }
+    }
+
+    wifi_error ret = loadValidChannels(handle, band, channels);
+    if (ret != WIFI_SUCCESS) {
+        return ret;
+    }
+
+    String8 list;
+    for (wifi_channel freq : *channels) {
+        list.appendFormat(" %d", frequencyToChannel(freq));
+    }
+    ALOGD("Valid channels for band %d, country '%s':%s", band, sChannelCountry, list.string());
+
+    channel_cache_entry *e = NULL;
+    for (int i = 0; i < CHANNEL_CACHE_SIZE && e == NULL; i++) {
+        if (sChannelCache[i].handle == NULL) {
+            e = &sChannelCache[i];
+        }
+    }
+    if (e == NULL) {
+        e = &sChannelCache[sChannelCacheNext];
+        sChannelCacheNext = (sChannelCacheNext + 1) % CHANNEL_CACHE_SIZE;
+    }
+    e->handle = handle;
+    e->band = band;
+    snprintf(e->country, sizeof(e->country), "%s", sChannelCountry);
+    e->channels = *channels;
+    return WIFI_SUCCESS;
+}
+
+/* country: the new country code, or NULL if only the lists may have changed */
+static void invalidateValidChannels(const char *country) {
+    AutoMutex lock(sChannelLock);
+    for (int i = 0; i < CHANNEL_CACHE_SIZE; i++) {
+        sChannelCache[i].handle = NULL;
+        sChannelCache[i].channels.clear();
+    }
+    if (country != NULL) {
+        snprintf(sChannelCountry, sizeof(sChannelCountry), "%s", country);
+    }
+}
+
+static JNIObject<jintArray> newChannelArray(JNIHelper &helper, wifi_interface_handle handle,
+        int band) {
+    std::vector<wifi_channel> channels;
+    wifi_error result = getValidChannels(handle, band, &channels);
+    if (result != WIFI_SUCCESS) {
         ALOGE("failed to get channel list : %d", result);
-        return NULL;
+        return JNIObject<jintArray>(helper, NULL);
     }
+
+    JNIObject<jintArray> channelArray = helper.newIntArray(channels.size());
+    if (channelArray == NULL) {
+        ALOGE("failed to allocate channel list, num_channels=%zu", channels.size());
+        return channelArray;
+    }
+    helper.setIntArrayRegion(channelArray, 0, channels.size(), channels.data());
+    return channelArray;
 }
 
-static jboolean android_net_wifi_setDfsFlag(JNIEnv *env, jclass cls, jint iface, jboolean dfs) {
+static jintArray android_net_wifi_getValidChannels(JNIEnv *env, jclass cls,
+        jint iface, jint band)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
-    ALOGD("setting dfs flag to %s, %p", dfs ? "true" : "false", handle);
+    ALOGV("getting valid channels %p", handle);
 
-    u32 nodfs = dfs ? 0 : 1;
-    wifi_error result = hal_fn.wifi_set_nodfs_flag(handle, nodfs);
-    return result == WIFI_SUCCESS;
+    return newChannelArray(helper, handle, band).detach();
 }
 
-static jobject android_net_wifi_get_rtt_capabilities(JNIEnv *env, jclass cls, jint iface) {
+/* one channel list per band, null for a band the HAL failed to list */
+static jobjectArray android_net_wifi_getValidChannelsForBands(JNIEnv *env, jclass cls,
+        jint iface, jintArray bands)  {
 
-    JNIHelper helper(env);
-    wifi_rtt_capabilities rtt_capabilities;
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
-    wifi_error ret = hal_fn.wifi_get_rtt_capabilities(handle, &rtt_capabilities);
+    ALOGV("getting valid channels for bands %p", handle);
 
-    if(WIFI_SUCCESS == ret) {
-         JNIObject<jobject> capabilities = helper.createObject(
-                "android/net/wifi/RttManager$RttCapabilities");
+    if (bands == NULL) {
+        return NULL;
+    }
+    int num_bands = env->GetArrayLength(bands);
+    std::vector<jint> band_list(num_bands);
+    env->GetIntArrayRegion(bands, 0, num_bands, band_list.data());
+
+    JNIObject<jobjectArray> lists = helper.newObjectArray(num_bands, "[I", NULL);
+    if (lists == NULL) {
+        ALOGE("failed to allocate channel lists, num_bands=%d", num_bands);
+        return NULL;
+    }
+    for (int i = 0; i < num_bands; i++) {
+        JNIObject<jintArray> channelArray = newChannelArray(helper, handle, band_list[i]);
+        if (channelArray != NULL) {
+            helper.setObjectArrayElement(lists, i, channelArray);
+        }
+    }
+    return lists.detach();
+}
+
+static jboolean android_net_wifi_setDfsFlag(JNIEnv *env, jclass cls, jint iface, jboolean dfs) {
+
+    wifi_interface_handle handle = lookupIfaceHandle(iface);
+    ALOGD("setting dfs flag to %s, %p", dfs ? "true" : "false", handle);
+
+    u32 nodfs = dfs ? 0 : 1;
+    wifi_error result = hal_fn.wifi_set_nodfs_flag(handle, nodfs);
+    invalidateValidChannels(NULL);
+    return result == WIFI_SUCCESS;
+}
+
+/* the framework set the country through the supplicant, which the HAL does not see */
+static void android_net_wifi_invalidate_valid_channels(JNIEnv *env, jclass cls) {
+    ALOGD("country code set through the supplicant, dropping the valid channels");
+    invalidateValidChannels(NULL);
+}
+
+static jobject android_net_wifi_get_rtt_capabilities(JNIEnv *env, jclass cls, jint iface) {
+
+    JNIHelper helper(env, __func__);
+    wifi_rtt_capabilities rtt_capabilities;
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+    wifi_error ret = hal_fn.wifi_get_rtt_capabilities(handle, &rtt_capabilities);
+
+    if(WIFI_SUCCESS == ret) {
+         JNIObject<jobject> capabilities = helper.createObject(
+                "android/net/wifi/RttManager$RttCapabilities");
          helper.setBooleanField(capabilities, "oneSidedRttSupported",
                  rtt_capabilities.rtt_one_sided_supported == 1);
          helper.setBooleanField(capabilities, "twoSided11McRttSupported",
@@ -1468,7 +2219,7 @@ static jobject android_net_wifi_get_rtt_capabilities(JNIEnv *env, jclass cls, ji
 static jobject android_net_wifi_get_apf_capabilities(JNIEnv *env, jclass cls,
         jint iface) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     u32 version = 0, max_len = 0;
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     wifi_error ret = hal_fn.wifi_get_packet_filter_capabilities(handle, &version, &max_len);
@@ -1500,22 +2251,200 @@ static jobject android_net_wifi_get_apf_capabilities(JNIEnv *env, jclass cls,
     }
 }
 
+/*
+ * The last APF program installed on each interface is kept, so that an identical program is
+ * not pushed to the firmware again: ApfFilter regenerates its program on every RA refresh,
+ * mostly unchanged, and every install wakes the firmware up. Programs are compared by hash,
+ * then byte for byte. The cache is dropped when the HAL is cleaned up or the interface is
+ * brought up or down, since the firmware loses its program then, and after a failed install,
+ * since what the firmware kept is unknown.
+ *
+ * The HAL only installs whole programs; the span of bytes that changed from the previous
+ * program is recorded so the dump shows how much an install could have been cut down.
+ */
+
+#define APF_CACHE_SIZE 8                /* interfaces, as many as getInterfaces() accepts */
+
+typedef struct {
+    wifi_interface_handle handle;       /* NULL: free */
+    u8 *program;                        /* last program installed; NULL: unknown */
+    u32 program_len;
+    u32 hash;
+    u32 installs;
+    u32 skipped;                        /* identical to the installed program */
+    u32 failures;
+    u32 changed_from;                   /* span of bytes the last install changed */
+    u32 changed_len;
+    nsecs_t last_latency;
+    nsecs_t max_latency;
+    nsecs_t total_latency;
+} apf_program_cache;
+
+static Mutex sApfLock;
+static apf_program_cache sApfCache[APF_CACHE_SIZE];
+
+/* FNV-1a */
+static u32 hashApfProgram(const u8 *program, u32 len) {
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < len; i++) {
+        hash = (hash ^ program[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static apf_program_cache *findApfCache(wifi_interface_handle handle, bool create) {
+    if (handle == NULL) {
+        /* no interface: a NULL key would match a free slot */
+        return NULL;
+    }
+
+    apf_program_cache *free_entry = NULL;
+    for (int i = 0; i < APF_CACHE_SIZE; i++) {
+        if (sApfCache[i].handle == handle) {
+            return &sApfCache[i];
+        }
+        if (free_entry == NULL && sApfCache[i].handle == NULL) {
+            free_entry = &sApfCache[i];
+        }
+    }
+    if (create && free_entry != NULL) {
+        free_entry->handle = handle;
+    }
+    return create ? free_entry : NULL;
+}
+
+static bool isApfProgramInstalled(wifi_interface_handle handle, const u8 *program, u32 len,
+        u32 hash) {
+    AutoMutex lock(sApfLock);
+
+    apf_program_cache *entry = findApfCache(handle, false);
+    if (entry == NULL || entry->program == NULL || entry->program_len != len
+            || entry->hash != hash || memcmp(entry->program, program, len) != 0) {
+        return false;
+    }
+    entry->skipped++;
+    return true;
+}
+
+/* takes over program, which was just sent to the firmware */
+static void recordApfInstall(wifi_interface_handle handle, u8 *program, u32 len, u32 hash,
+        bool success, nsecs_t latency) {
+    AutoMutex lock(sApfLock);
+
+    apf_program_cache *entry = findApfCache(handle, true);
+    if (entry == NULL) {
+        free(program);
+        return;
+    }
+
+    entry->last_latency = latency;
+    entry->max_latency = std::max(entry->max_latency, latency);
+    entry->total_latency += latency;
+    if (!success) {
+        entry->failures++;
+        free(entry->program);
+        entry->program = NULL;
+        free(program);
+        return;
+    }
+
+    entry->installs++;
+    entry->changed_from = 0;
+    entry->changed_len = len;
+    if (entry->program != NULL && entry->program_len == len) {
+        u32 first = 0, last = len;
+        while (first < len && entry->program[first] == program[first]) {
+            first++;
+        }
+        while (last > first && entry->program[last - 1] == program[last - 1]) {
+            last--;
+        }
+        entry->changed_from = first;
+        entry->changed_len = last - first;
+    }
+    free(entry->program);
+    entry->program = program;
+    entry->program_len = len;
+    entry->hash = hash;
+}
+
+/* the firmware lost its programs: the next installs go through */
+static void invalidateApfPrograms() {
+    AutoMutex lock(sApfLock);
+    for (int i = 0; i < APF_CACHE_SIZE; i++) {
+        free(sApfCache[i].program);
+        sApfCache[i].program = NULL;
+    }
+}
+
+static void resetApfCache() {
+    AutoMutex lock(sApfLock);
+    for (int i = 0; i < APF_CACHE_SIZE; i++) {
+        free(sApfCache[i].program);
+        memset(&sApfCache[i], 0, sizeof(sApfCache[i]));
+    }
+}
+
 static jboolean android_net_wifi_install_packet_filter(JNIEnv *env, jclass cls, jint iface,
         jbyteArray jfilter) {
 
-    JNIHelper helper(env);
-    const u8* filter = (uint8_t*)env->GetByteArrayElements(jfilter, NULL);
+    JNIHelper helper(env, __func__);
     const u32 filter_len = env->GetArrayLength(jfilter);
+    /* a private copy, which the cache keeps if it gets installed */
+    u8 *filter = (u8 *) malloc(filter_len > 0 ? filter_len : 1);
+    if (filter == NULL) {
+        ALOGE("Error allocating APF program, length=%u", filter_len);
+        return false;
+    }
+    env->GetByteArrayRegion(jfilter, 0, filter_len, (jbyte *) filter);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+
+    u32 hash = hashApfProgram(filter, filter_len);
+    if (isApfProgramInstalled(handle, filter, filter_len, hash)) {
+        free(filter);
+        return true;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
     wifi_error ret = hal_fn.wifi_set_packet_filter(handle, filter, filter_len);
-    env->ReleaseByteArrayElements(jfilter, (jbyte*)filter, JNI_ABORT);
+    recordApfInstall(handle, filter, filter_len, hash, ret == WIFI_SUCCESS,
+            systemTime(SYSTEM_TIME_MONOTONIC) - start);
     return WIFI_SUCCESS == ret;
 }
 
+static jstring android_net_wifi_get_packet_filter_stats(JNIEnv *env, jclass cls, jint iface) {
+
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+    String8 stats;
+    {
+        AutoMutex lock(sApfLock);
+        apf_program_cache *entry = findApfCache(handle, false);
+        if (entry == NULL) {
+            stats.append("none");
+        } else {
+            u32 attempts = entry->installs + entry->failures;
+            stats.appendFormat("installs=%u skipped=%u failures=%u", entry->installs,
+                    entry->skipped, entry->failures);
+            if (entry->program != NULL) {
+                stats.appendFormat(" size=%u hash=%08x changed=%u@%u", entry->program_len,
+                        entry->hash, entry->changed_len, entry->changed_from);
+            }
+            if (attempts != 0) {
+                stats.appendFormat(" latency last=%lldus max=%lldus avg=%lldus",
+                        (long long) ns2us(entry->last_latency),
+                        (long long) ns2us(entry->max_latency),
+                        (long long) ns2us(entry->total_latency / attempts));
+            }
+        }
+    }
+    return helper.newStringUTF(stats.string()).detach();
+}
+
 static jboolean android_net_wifi_set_Country_Code_Hal(JNIEnv *env,jclass cls, jint iface,
         jstring country_code) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     ScopedUtfChars chars(env, country_code);
@@ -1523,52 +2452,297 @@ static jboolean android_net_wifi_set_Country_Code_Hal(JNIEnv *env,jclass cls, ji
 
     ALOGD("set country code: %s", country);
     wifi_error res = hal_fn.wifi_set_country_code(handle, country);
+    /* after a failure the driver's country is not known either */
+    invalidateValidChannels(res == WIFI_SUCCESS ? country : "");
     return res == WIFI_SUCCESS;
 }
 
+/*
+ * TDLS peers. The bridge registers for the HAL's TDLS state events and keeps the last state,
+ * channel and reason of each peer, so that the framework is told about transitions as they
+ * happen and reads the state of one or all peers without asking the firmware. Enabling a new
+ * peer is refused while the firmware's max_concurrent_tdls_session_num peers are active. The HAL
+ * is never called with sTdlsLock held, since its state events take the lock: an enable reserves
+ * the peer's slot first (pending), then commits or releases it once the HAL has answered.
+ */
+
+#define TDLS_MAX_PEERS          16      /* tracked peers, active or not */
+
+typedef struct {
+    wifi_interface_handle handle;       /* NULL: free */
+    mac_addr addr;
+    wifi_tdls_status status;
+    bool reported;                      /* status came from the HAL */
+    bool pending;                       /* reserved by an enable the HAL has not answered */
+    nsecs_t updated;
+} tdls_peer;
+
+static Mutex sTdlsLock;
+static tdls_peer sTdlsPeers[TDLS_MAX_PEERS];
+static wifi_interface_handle sTdlsCapsHandle = NULL;
+static int sTdlsMaxSessions = TDLS_MAX_PEERS;
+
+static void formatMac(const mac_addr addr, char *mac) {
+    sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", addr[0], addr[1], addr[2], addr[3], addr[4],
+            addr[5]);
+}
+
+static bool parseMacString(JNIEnv *env, jstring str, mac_addr addr) {
+    if (str == NULL) {
+        return false;
+    }
+    ScopedUtfChars chars(env, str);
+    if (chars.c_str() == NULL || strlen(chars.c_str()) != 17) {
+        ALOGE("invalid MAC address");
+        return false;
+    }
+    parseMacAddress(chars.c_str(), addr);
+    return true;
+}
+
+static bool isTdlsSessionActive(const tdls_peer *p) {
+    return p->handle != NULL && (p->status.state == WIFI_TDLS_ENABLED
+            || p->status.state == WIFI_TDLS_ESTABLISHED
+            || p->status.state == WIFI_TDLS_ESTABLISHED_OFF_CHANNEL);
+}
+
+/* called with sTdlsLock held */
+static tdls_peer *findTdlsPeer(wifi_interface_handle handle, const mac_addr addr) {
+    for (int i = 0; i < TDLS_MAX_PEERS; i++) {
+        if (sTdlsPeers[i].handle == handle
+                && memcmp(sTdlsPeers[i].addr, addr, sizeof(mac_addr)) == 0) {
+            return &sTdlsPeers[i];
+        }
+    }
+    return NULL;
+}
+
+/* called without sTdlsLock; the session limit is read once per interface */
+static void updateTdlsCapabilities(wifi_interface_handle handle) {
+    {
+        AutoMutex lock(sTdlsLock);
+        if (sTdlsCapsHandle == handle) {
+            return;
+        }
+    }
+
+    wifi_tdls_capabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    int max_sessions = TDLS_MAX_PEERS;
+    if (hal_fn.wifi_get_tdls_capabilities(handle, &caps) == WIFI_SUCCESS
+            && caps.max_concurrent_tdls_session_num > 0) {
+        max_sessions = std::min(caps.max_concurrent_tdls_session_num, TDLS_MAX_PEERS);
+    }
+
+    AutoMutex lock(sTdlsLock);
+    sTdlsCapsHandle = handle;
+    sTdlsMaxSessions = max_sessions;
+}
+
+/* called with sTdlsLock held; peers being enabled count against the limit */
+static bool canStartTdlsSession(wifi_interface_handle handle) {
+    int active = 0;
+    for (int i = 0; i < TDLS_MAX_PEERS; i++) {
+        if (sTdlsPeers[i].handle == handle
+                && (isTdlsSessionActive(&sTdlsPeers[i]) || sTdlsPeers[i].pending)) {
+            active++;
+        }
+    }
+    return active < sTdlsMaxSessions;
+}
+
+/* called with sTdlsLock held; replaces the inactive peer updated longest ago if needed */
+static tdls_peer *addTdlsPeer(wifi_interface_handle handle, const mac_addr addr) {
+    tdls_peer *p = NULL;
+    for (int i = 0; i < TDLS_MAX_PEERS; i++) {
+        tdls_peer *q = &sTdlsPeers[i];
+        if (q->handle == NULL) {
+            p = q;
+            break;
+        } else if (!isTdlsSessionActive(q) && !q->pending
+                && (p == NULL || q->updated < p->updated)) {
+            p = q;
+        }
+    }
+    if (p == NULL) {
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->handle = handle;
+    memcpy(p->addr, addr, sizeof(mac_addr));
+    p->status.state = WIFI_TDLS_DISABLED;
+    p->updated = systemTime(SYSTEM_TIME_MONOTONIC);
+    return p;
+}
+
+static void resetTdlsPeers() {
+    AutoMutex lock(sTdlsLock);
+    for (int i = 0; i < TDLS_MAX_PEERS; i++) {
+        sTdlsPeers[i].handle = NULL;
+    }
+    sTdlsCapsHandle = NULL;
+}
+
+static void on_tdls_state_changed(mac_addr addr, wifi_tdls_status status);
+
 static jboolean android_net_wifi_enable_disable_tdls(JNIEnv *env,jclass cls, jint iface,
         jboolean enable, jstring addr) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     mac_addr address;
-    parseMacAddress(env, addr, address);
-    wifi_tdls_handler tdls_handler;
-    //tdls_handler.on_tdls_state_changed = &on_tdls_state_changed;
+    if (!parseMacString(env, addr, address)) {
+        return false;
+    }
 
-    if(enable) {
-        return (hal_fn.wifi_enable_tdls(handle, address, NULL, tdls_handler) == WIFI_SUCCESS);
-    } else {
-        return (hal_fn.wifi_disable_tdls(handle, address) == WIFI_SUCCESS);
+    if (!enable) {
+        wifi_error ret = hal_fn.wifi_disable_tdls(handle, address);
+        AutoMutex lock(sTdlsLock);
+        tdls_peer *peer = findTdlsPeer(handle, address);
+        if (ret == WIFI_SUCCESS && peer != NULL && !peer->pending) {
+            peer->status.state = WIFI_TDLS_DISABLED;
+            peer->updated = systemTime(SYSTEM_TIME_MONOTONIC);
+        }
+        return ret == WIFI_SUCCESS;
+    }
+
+    updateTdlsCapabilities(handle);
+
+    bool reserved = false;
+    {
+        AutoMutex lock(sTdlsLock);
+        tdls_peer *peer = findTdlsPeer(handle, address);
+        if (peer != NULL && peer->pending) {
+            char mac[32];
+            formatMac(address, mac);
+            ALOGE("Not enabling TDLS with %s: already being enabled", mac);
+            return false;
+        }
+        if (peer == NULL || !isTdlsSessionActive(peer)) {
+            if (!canStartTdlsSession(handle)) {
+                char mac[32];
+                formatMac(address, mac);
+                ALOGE("Not enabling TDLS with %s: %d sessions active", mac, sTdlsMaxSessions);
+                return false;
+            }
+            if (peer == NULL) {
+                peer = addTdlsPeer(handle, address);
+            }
+            if (peer == NULL) {
+                return false;
+            }
+            peer->pending = true;
+            reserved = true;
+        }
+    }
+
+    wifi_tdls_handler tdls_handler;
+    tdls_handler.on_tdls_state_changed = &on_tdls_state_changed;
+    wifi_error ret = hal_fn.wifi_enable_tdls(handle, address, NULL, tdls_handler);
+
+    AutoMutex lock(sTdlsLock);
+    /* looked up again: the table may have been reset while the lock was dropped */
+    tdls_peer *peer = findTdlsPeer(handle, address);
+    if (peer == NULL) {
+        return ret == WIFI_SUCCESS;
+    }
+    if (reserved) {
+        peer->pending = false;
     }
+    if (ret != WIFI_SUCCESS) {
+        if (reserved && !peer->reported) {
+            peer->handle = NULL;
+        }
+        return false;
+    }
+    if (!isTdlsSessionActive(peer)) {
+        peer->status.state = WIFI_TDLS_ENABLED;
+        peer->status.reason = WIFI_TDLS_SUCCESS;
+        peer->updated = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    return true;
 }
 
 static void on_tdls_state_changed(mac_addr addr, wifi_tdls_status status) {
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
 
-    ALOGD("on_tdls_state_changed is called: vm = %p, obj = %p", mVM, mCls);
+    {
+        AutoMutex lock(sTdlsLock);
+        tdls_peer *peer = NULL;
+        for (int i = 0; i < TDLS_MAX_PEERS && peer == NULL; i++) {
+            if (sTdlsPeers[i].handle != NULL
+                    && memcmp(sTdlsPeers[i].addr, addr, sizeof(mac_addr)) == 0) {
+                peer = &sTdlsPeers[i];
+            }
+        }
+        if (peer == NULL && sTdlsCapsHandle != NULL) {
+            /* a peer the framework did not enable, e.g. set up through the supplicant */
+            peer = addTdlsPeer(sTdlsCapsHandle, addr);
+        }
+        if (peer != NULL) {
+            bool changed = !peer->reported || peer->status.state != status.state
+                    || peer->status.reason != status.reason
+                    || peer->status.channel != status.channel;
+            peer->status = status;
+            peer->reported = true;
+            peer->updated = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (!changed) {
+                return;
+            }
+        }
+    }
 
     char mac[32];
-    sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", addr[0], addr[1], addr[2], addr[3], addr[4],
-            addr[5]);
+    formatMac(addr, mac);
+    ALOGD("TDLS %s: state=%d, reason=%d, channel=%d", mac, status.state, status.reason,
+            status.channel);
 
     JNIObject<jstring> mac_address = helper.newStringUTF(mac);
-    helper.reportEvent(mCls, "onTdlsStatus", "(Ljava/lang/StringII;)V",
+    helper.reportEvent(mCls, "onTdlsStatus", "(Ljava/lang/String;II)V",
         mac_address.get(), status.state, status.reason);
 
 }
 
+static JNIObject<jobject> newTdlsStatus(JNIHelper &helper, const mac_addr addr,
+        const wifi_tdls_status &status) {
+    char mac[32];
+    formatMac(addr, mac);
+
+    JNIObject<jobject> tdls_status = helper.createObject(
+            "com/android/server/wifi/WifiNative$TdlsStatus");
+    if (tdls_status == NULL) {
+        return tdls_status;
+    }
+    helper.setStringField(tdls_status, "macAddress", mac);
+    helper.setIntField(tdls_status, "channel", status.channel);
+    helper.setIntField(tdls_status, "global_operating_class", status.global_operating_class);
+    helper.setIntField(tdls_status, "state", status.state);
+    helper.setIntField(tdls_status, "reason", status.reason);
+    return tdls_status;
+}
+
 static jobject android_net_wifi_get_tdls_status(JNIEnv *env,jclass cls, jint iface,jstring addr) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     mac_addr address;
-    parseMacAddress(env, addr, address);
+    if (!parseMacString(env, addr, address)) {
+        return NULL;
+    }
 
     wifi_tdls_status status;
+    {
+        AutoMutex lock(sTdlsLock);
+        tdls_peer *peer = findTdlsPeer(handle, address);
+        if (peer != NULL && peer->reported) {
+            /* kept up to date by on_tdls_state_changed */
+            return newTdlsStatus(helper, address, peer->status).detach();
+        }
+    }
 
     wifi_error ret;
     ret = hal_fn.wifi_get_tdls_status(handle, address, &status );
@@ -1576,19 +2750,44 @@ static jobject android_net_wifi_get_tdls_status(JNIEnv *env,jclass cls, jint ifa
     if (ret != WIFI_SUCCESS) {
         return NULL;
     } else {
-        JNIObject<jobject> tdls_status = helper.createObject(
-                "com/android/server/wifi/WifiNative$TdlsStatus");
-        helper.setIntField(tdls_status, "channel", status.channel);
-        helper.setIntField(tdls_status, "global_operating_class", status.global_operating_class);
-        helper.setIntField(tdls_status, "state", status.state);
-        helper.setIntField(tdls_status, "reason", status.reason);
-        return tdls_status.detach();
+        return newTdlsStatus(helper, address, status).detach();
+    }
+}
+
+static jobjectArray android_net_wifi_get_tdls_peers(JNIEnv *env, jclass cls, jint iface) {
+
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+
+    tdls_peer peers[TDLS_MAX_PEERS];
+    int num_peers = 0;
+    {
+        AutoMutex lock(sTdlsLock);
+        for (int i = 0; i < TDLS_MAX_PEERS; i++) {
+            if (sTdlsPeers[i].handle == handle) {
+                peers[num_peers++] = sTdlsPeers[i];
+            }
+        }
+    }
+
+    JNIObject<jobjectArray> result = helper.createObjectArray(
+            "com/android/server/wifi/WifiNative$TdlsStatus", num_peers);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < num_peers; i++) {
+        JNIObject<jobject> status = newTdlsStatus(helper, peers[i].addr, peers[i].status);
+        if (status == NULL) {
+            return NULL;
+        }
+        helper.setObjectArrayElement(result, i, status);
     }
+    return result.detach();
 }
 
 static jobject android_net_wifi_get_tdls_capabilities(JNIEnv *env, jclass cls, jint iface) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_tdls_capabilities tdls_capabilities;
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     wifi_error ret = hal_fn.wifi_get_tdls_capabilities(handle, &tdls_capabilities);
@@ -1623,6 +2822,7 @@ static jobject android_net_wifi_get_tdls_capabilities(JNIEnv *env, jclass cls, j
 // ----------------------------------------------------------------------------
 // Debug framework
 // ----------------------------------------------------------------------------
+/* fast native */
 static jint android_net_wifi_get_supported_logger_feature(JNIEnv *env, jclass cls, jint iface){
     //Not implemented yet
     return -1;
@@ -1631,7 +2831,7 @@ static jint android_net_wifi_get_supported_logger_feature(JNIEnv *env, jclass cl
 static jobject android_net_wifi_get_driver_version(JNIEnv *env, jclass cls, jint iface) {
      //Need to be fixed. The memory should be allocated from lower layer
     //char *buffer = NULL;
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     int buffer_length =  256;
     char *buffer = (char *)malloc(buffer_length);
     if (!buffer) return NULL;
@@ -1662,7 +2862,7 @@ static jobject android_net_wifi_get_driver_version(JNIEnv *env, jclass cls, jint
 static jobject android_net_wifi_get_firmware_version(JNIEnv *env, jclass cls, jint iface) {
 
     //char *buffer = NULL;
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     int buffer_length = 256;
     char *buffer = (char *)malloc(buffer_length);
     if (!buffer) return NULL;
@@ -1690,66 +2890,71 @@ static jobject android_net_wifi_get_firmware_version(JNIEnv *env, jclass cls, ji
     }
 }
 
-static jobject android_net_wifi_get_ring_buffer_status (JNIEnv *env, jclass cls, jint iface) {
+#define RING_BUFFERS_MAX 10
 
-    JNIHelper helper(env);
+static int getRingBuffersStatus(JNIHelper &helper, jclass cls, jint iface,
+        wifi_ring_buffer_status *status) {
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     ALOGD("android_net_wifi_get_ring_buffer_status = %p", handle);
 
     if (handle == 0) {
-        return NULL;
+        return -1;
     }
 
-    //wifi_ring_buffer_status *status = NULL;
-    u32 num_rings = 10;
-    wifi_ring_buffer_status *status =
-        (wifi_ring_buffer_status *)malloc(sizeof(wifi_ring_buffer_status) * num_rings);
-    if (!status) return NULL;
+    u32 num_rings = RING_BUFFERS_MAX;
     memset(status, 0, sizeof(wifi_ring_buffer_status) * num_rings);
     wifi_error result = hal_fn.wifi_get_ring_buffers_status(handle, &num_rings, status);
-    if (result == WIFI_SUCCESS) {
-        ALOGD("status is %p, number is %d", status, num_rings);
+    if (result != WIFI_SUCCESS) {
+        return -1;
+    }
+    ALOGD("status is %p, number is %d", status, num_rings);
+    return num_rings < RING_BUFFERS_MAX ? num_rings : RING_BUFFERS_MAX;
+}
 
-        JNIObject<jobjectArray> ringBuffersStatus = helper.newObjectArray(
-            num_rings, "com/android/server/wifi/WifiNative$RingBufferStatus", NULL);
+static void setRingBufferStatus(JNIHelper &helper, jobject ringStatus,
+        const wifi_ring_buffer_status *status) {
+    char name[sizeof(status->name) + 1];
+    memcpy(name, status->name, sizeof(status->name));
+    name[sizeof(status->name)] = 0;
 
-        wifi_ring_buffer_status *tmp = status;
+    helper.setStringField(ringStatus, "name", name);
+    helper.setIntField(ringStatus, "flag", status->flags);
+    helper.setIntField(ringStatus, "ringBufferId", status->ring_id);
+    helper.setIntField(ringStatus, "ringBufferByteSize", status->ring_buffer_byte_size);
+    helper.setIntField(ringStatus, "verboseLevel", status->verbose_level);
+    helper.setIntField(ringStatus, "writtenBytes", status->written_bytes);
+    helper.setIntField(ringStatus, "readBytes", status->read_bytes);
+    helper.setIntField(ringStatus, "writtenRecords", status->written_records);
+}
 
-        for(u32 i = 0; i < num_rings; i++, tmp++) {
+static jobject android_net_wifi_get_ring_buffer_status (JNIEnv *env, jclass cls, jint iface) {
 
-            JNIObject<jobject> ringStatus = helper.createObject(
-                    "com/android/server/wifi/WifiNative$RingBufferStatus");
+    JNIHelper helper(env, __func__);
+    wifi_ring_buffer_status status[RING_BUFFERS_MAX];
+    int num_rings = getRingBuffersStatus(helper, cls, iface, status);
+    if (num_rings < 0) {
+        return NULL;
+    }
 
-            if (ringStatus == NULL) {
-                ALOGE("Error in creating ringBufferStatus");
-                free(status);
-                return NULL;
-            }
+    JNIObject<jobjectArray> ringBuffersStatus = helper.newObjectArray(
+        num_rings, "com/android/server/wifi/WifiNative$RingBufferStatus", NULL);
 
-            char name[32];
-            for(int j = 0; j < 32; j++) {
-                name[j] = tmp->name[j];
-            }
+    for (int i = 0; i < num_rings; i++) {
 
-            helper.setStringField(ringStatus, "name", name);
-            helper.setIntField(ringStatus, "flag", tmp->flags);
-            helper.setIntField(ringStatus, "ringBufferId", tmp->ring_id);
-            helper.setIntField(ringStatus, "ringBufferByteSize", tmp->ring_buffer_byte_size);
-            helper.setIntField(ringStatus, "verboseLevel", tmp->verbose_level);
-            helper.setIntField(ringStatus, "writtenBytes", tmp->written_bytes);
-            helper.setIntField(ringStatus, "readBytes", tmp->read_bytes);
-            helper.setIntField(ringStatus, "writtenRecords", tmp->written_records);
+        JNIObject<jobject> ringStatus = helper.createObject(
+                "com/android/server/wifi/WifiNative$RingBufferStatus");
 
-            helper.setObjectArrayElement(ringBuffersStatus, i, ringStatus);
+        if (ringStatus == NULL) {
+            ALOGE("Error in creating ringBufferStatus");
+            return NULL;
         }
 
-        free(status);
-        return ringBuffersStatus.detach();
-    } else {
-        free(status);
-        return NULL;
+        setRingBufferStatus(helper, ringStatus, &status[i]);
+        helper.setObjectArrayElement(ringBuffersStatus, i, ringStatus);
     }
+
+    return ringBuffersStatus.detach();
 }
 
 static void on_ring_buffer_data(char *ring_name, char *buffer, int buffer_size,
@@ -1761,8 +2966,22 @@ static void on_ring_buffer_data(char *ring_name, char *buffer, int buffer_size,
         return;
     }
 
+    event_ring_buffer_data event;
+    memset(&event, 0, sizeof(event));
+    event.flags = status->flags;
+    event.ring_id = status->ring_id;
+    event.ring_buffer_byte_size = status->ring_buffer_byte_size;
+    event.verbose_level = status->verbose_level;
+    event.written_bytes = status->written_bytes;
+    event.read_bytes = status->read_bytes;
+    event.written_records = status->written_records;
+    event.data_length = buffer_size;
+    strncpy(event.name, ring_name, sizeof(event.name) - 1);
+    if (postEvent(EVENT_RING_BUFFER_DATA, &event, sizeof(event), buffer, buffer_size)) {
+        return;
+    }
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     /* ALOGD("on_ring_buffer_data called, vm = %p, obj = %p, env = %p buffer size = %d", mVM,
             mCls, env, buffer_size); */
 
@@ -1792,7 +3011,7 @@ static void on_ring_buffer_data(char *ring_name, char *buffer, int buffer_size,
 
 static void on_alert_data(wifi_request_id id, char *buffer, int buffer_size, int err_code){
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     ALOGD("on_alert_data called, vm = %p, obj = %p, buffer_size = %d, error code = %d"
             , mVM, mCls, buffer_size, err_code);
 
@@ -1810,7 +3029,7 @@ static void on_alert_data(wifi_request_id id, char *buffer, int buffer_size, int
 static jboolean android_net_wifi_start_logging_ring_buffer(JNIEnv *env, jclass cls, jint iface,
         jint verbose_level,jint flags, jint max_interval,jint min_data_size, jstring ring_name) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     ALOGD("android_net_wifi_start_logging_ring_buffer = %p", handle);
@@ -1836,7 +3055,7 @@ static jboolean android_net_wifi_start_logging_ring_buffer(JNIEnv *env, jclass c
 static jboolean android_net_wifi_get_ring_buffer_data(JNIEnv *env, jclass cls, jint iface,
         jstring ring_name) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     // ALOGD("android_net_wifi_get_ring_buffer_data = %p", handle);
 
@@ -1849,7 +3068,7 @@ static jboolean android_net_wifi_get_ring_buffer_data(JNIEnv *env, jclass cls, j
 
 static void on_firmware_memory_dump(char *buffer, int buffer_size) {
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     /* ALOGD("on_firmware_memory_dump called, vm = %p, obj = %p, env = %p buffer_size = %d"
             , mVM, mCls, env, buffer_size); */
 
@@ -1863,7 +3082,7 @@ static void on_firmware_memory_dump(char *buffer, int buffer_size) {
 
 static jboolean android_net_wifi_get_fw_memory_dump(JNIEnv *env, jclass cls, jint iface){
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     // ALOGD("android_net_wifi_get_fw_memory_dump = %p", handle);
 
@@ -1902,7 +3121,7 @@ static void on_driver_state_dump(char *buffer, int buffer_size) {
 // TODO(quiche): Add unit tests. b/28072392
 static jbyteArray android_net_wifi_get_driver_state_dump(JNIEnv *env, jclass cls, jint iface){
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle interface_handle = getIfaceHandle(helper, cls, iface);
 
     if (!interface_handle) {
@@ -1938,7 +3157,7 @@ static jbyteArray android_net_wifi_get_driver_state_dump(JNIEnv *env, jclass cls
 
 static jboolean android_net_wifi_set_log_handler(JNIEnv *env, jclass cls, jint iface, jint id) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("android_net_wifi_set_log_handler = %p", handle);
 
@@ -1965,7 +3184,7 @@ static jboolean android_net_wifi_set_log_handler(JNIEnv *env, jclass cls, jint i
 
 static jboolean android_net_wifi_reset_log_handler(JNIEnv *env, jclass cls, jint iface, jint id) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
 
     //reset alter handler
@@ -1989,7 +3208,7 @@ static jboolean android_net_wifi_reset_log_handler(JNIEnv *env, jclass cls, jint
 
 static jint android_net_wifi_start_pkt_fate_monitoring(JNIEnv *env, jclass cls, jint iface) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     return hal_fn.wifi_start_pkt_fate_monitoring(
         getIfaceHandle(helper, cls, iface));
 }
@@ -2030,7 +3249,7 @@ template<typename FateReportT, typename HalFateFetcherT> wifi_error get_pkt_fate
     HalFateFetcherT fate_fetcher_func, const char *java_fate_type,
     JNIEnv *env, jclass cls, jint iface, jobjectArray reports) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     const size_t n_reports_wanted =
         std::min(helper.getArrayLength(reports), MAX_FATE_LOG_LEN);
 
@@ -2125,7 +3344,7 @@ static jint android_net_wifi_get_rx_pkt_fates(JNIEnv *env, jclass cls, jint ifac
 
 static void onPnoNetworkFound(wifi_request_id id,
                                           unsigned num_results, wifi_scan_result *results) {
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
     ALOGD("onPnoNetworkFound called, vm = %p, obj = %p, num_results %u", mVM, mCls, num_results);
 
     if (results == NULL || num_results == 0) {
@@ -2172,7 +3391,7 @@ static void onPnoNetworkFound(wifi_request_id id,
 static jboolean android_net_wifi_setPnoListNative(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject settings)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_epno_handler handler;
     handler.on_network_found = &onPnoNetworkFound;
 
@@ -2259,7 +3478,7 @@ static jboolean android_net_wifi_setPnoListNative(
 static jboolean android_net_wifi_resetPnoListNative(
         JNIEnv *env, jclass cls, jint iface, jint id)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
 
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("reset ePno list request [%d] = %p", id, handle);
@@ -2273,7 +3492,7 @@ static jboolean android_net_wifi_resetPnoListNative(
 static jboolean android_net_wifi_setBssidBlacklist(
         JNIEnv *env, jclass cls, jint iface, jint id, jobject list)  {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("configure BSSID black list request [%d] = %p", id, handle);
 
@@ -2318,66 +3537,324 @@ static jboolean android_net_wifi_setBssidBlacklist(
     return hal_fn.wifi_set_bssid_blacklist(id, handle, params) == WIFI_SUCCESS;
 }
 
-static jint android_net_wifi_start_sending_offloaded_packet(JNIEnv *env, jclass cls, jint iface,
-                    jint idx, jbyteArray srcMac, jbyteArray dstMac, jbyteArray pkt, jint period)  {
-    JNIHelper helper(env);
-    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
-    ALOGD("Start packet offload [%d] = %p", idx, handle);
-    wifi_error ret;
-    wifi_request_id id = idx;
+/*
+ * Keepalive offload. The packets the firmware sends on its own are tracked per interface and
+ * slot, with their period, so that a slot can be updated or restarted in one step, all slots
+ * stopped when the network goes away, and the active ones dumped. Packets are validated before
+ * they reach the HAL: an IPv4 or IPv6 packet whose lengths (and IPv4 header checksum) are
+ * consistent, and for NAT-T keepalives (UDP to port 4500) the one 0xFF byte payload.
+ */
 
-    ScopedBytesRO pktBytes(env, pkt), srcMacBytes(env, srcMac), dstMacBytes(env, dstMac);
-
-    byte * pkt_data = (byte*) pktBytes.get();
-    unsigned short pkt_len = env->GetArrayLength(pkt);
-    byte* src_mac_addr = (byte*) srcMacBytes.get();
-    byte* dst_mac_addr = (byte*) dstMacBytes.get();
-    int i;
-    char macAddr[32];
-    sprintf(macAddr, "%0x:%0x:%0x:%0x:%0x:%0x", src_mac_addr[0], src_mac_addr[1],
-            src_mac_addr[2], src_mac_addr[3], src_mac_addr[4], src_mac_addr[5]);
-    ALOGD("src_mac_addr %s", macAddr);
-    sprintf(macAddr, "%0x:%0x:%0x:%0x:%0x:%0x", dst_mac_addr[0], dst_mac_addr[1],
-            dst_mac_addr[2], dst_mac_addr[3], dst_mac_addr[4], dst_mac_addr[5]);
-    ALOGD("dst_mac_addr %s", macAddr);
-    ALOGD("pkt_len %d\n", pkt_len);
-    ALOGD("Pkt data : ");
-    for(i = 0; i < pkt_len; i++) {
-        ALOGD(" %x ", pkt_data[i]);
-    }
-    ALOGD("\n");
-    ret =  hal_fn.wifi_start_sending_offloaded_packet(id, handle, pkt_data, pkt_len,
-                src_mac_addr, dst_mac_addr, period);
-    ALOGD("ret= %d\n", ret);
-    return ret;
+#define KEEPALIVE_SLOTS             16
+#define KEEPALIVE_PACKET_MAX        256     /* the firmware's buffer; NAT-T needs 29 bytes */
+#define KEEPALIVE_NAT_T_PORT        4500
+#define KEEPALIVE_LOG_BYTES         64      /* hex dumped per packet */
+
+typedef enum {
+    KEEPALIVE_IPV4,
+    KEEPALIVE_IPV6,
+    KEEPALIVE_NAT_T,
+} keepalive_kind;
+
+typedef struct {
+    wifi_interface_handle handle;           /* NULL: free */
+    int slot;
+    keepalive_kind kind;
+    u32 period_msec;
+    mac_addr src_mac;
+    mac_addr dst_mac;
+    u16 len;
+    u8 packet[KEEPALIVE_PACKET_MAX];
+    nsecs_t started;
+} keepalive_slot;
+
+static Mutex sKeepaliveLock;
+static keepalive_slot sKeepalives[KEEPALIVE_SLOTS];
+
+static const char *keepaliveKindName(keepalive_kind kind) {
+    switch (kind) {
+        case KEEPALIVE_IPV4: return "IPv4";
+        case KEEPALIVE_IPV6: return "IPv6";
+        case KEEPALIVE_NAT_T: return "NAT-T";
+    }
+    return "?";
 }
 
-static jint android_net_wifi_stop_sending_offloaded_packet(JNIEnv *env, jclass cls,
-                    jint iface, jint idx) {
-    int ret;
-    JNIHelper helper(env);
-    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
-    ALOGD("Stop packet offload [%d] = %p", idx, handle);
-    ret =  hal_fn.wifi_stop_sending_offloaded_packet(idx, handle);
-    ALOGD("ret= %d\n", ret);
-    return ret;
+static u16 ipv4HeaderChecksum(const u8 *header, int len) {
+    u32 sum = 0;
+    for (int i = 0; i + 1 < len; i += 2) {
+        sum += (header[i] << 8) | header[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
 }
 
-static void onRssiThresholdbreached(wifi_request_id id, u8 *cur_bssid, s8 cur_rssi) {
+/* returns NULL if the packet can be offloaded, or what is wrong with it */
+static const char *validateKeepalive(const u8 *pkt, int len, keepalive_kind *kind) {
+    if (len < 1) {
+        return "empty packet";
+    }
 
-    ALOGD("RSSI threshold breached, cur RSSI - %d!!\n", cur_rssi);
-    ALOGD("BSSID %02x:%02x:%02x:%02x:%02x:%02x\n",
-            cur_bssid[0], cur_bssid[1], cur_bssid[2],
-            cur_bssid[3], cur_bssid[4], cur_bssid[5]);
-    JNIHelper helper(mVM);
-    //ALOGD("onRssiThresholdbreached called, vm = %p, obj = %p, env = %p", mVM, mCls, env);
-    helper.reportEvent(mCls, "onRssiThresholdBreached", "(IB)V", id, cur_rssi);
+    int header_len, protocol;
+    if ((pkt[0] >> 4) == 4) {
+        header_len = (pkt[0] & 0xf) * 4;
+        if (len < 20 || header_len < 20 || header_len > len) {
+            return "truncated IPv4 header";
+        }
+        if (((pkt[2] << 8) | pkt[3]) != len) {
+            return "IPv4 total length does not match the packet";
+        }
+        if (ipv4HeaderChecksum(pkt, header_len) != 0) {
+            return "bad IPv4 header checksum";
+        }
+        protocol = pkt[9];
+        *kind = KEEPALIVE_IPV4;
+    } else if ((pkt[0] >> 4) == 6) {
+        header_len = 40;
+        if (len < header_len) {
+            return "truncated IPv6 header";
+        }
+        if (((pkt[4] << 8) | pkt[5]) != len - header_len) {
+            return "IPv6 payload length does not match the packet";
+        }
+        protocol = pkt[6];
+        *kind = KEEPALIVE_IPV6;
+    } else {
+        return "not an IP packet";
+    }
+
+    if (protocol == IPPROTO_UDP) {
+        const u8 *udp = pkt + header_len;
+        int udp_len = len - header_len;
+        if (udp_len < 8 || ((udp[4] << 8) | udp[5]) != udp_len) {
+            return "UDP length does not match the packet";
+        }
+        if (*kind == KEEPALIVE_IPV4 && ((udp[2] << 8) | udp[3]) == KEEPALIVE_NAT_T_PORT) {
+            if (udp_len != 9 || udp[8] != 0xff) {
+                return "NAT-T keepalive payload is not a single 0xFF byte";
+            }
+            *kind = KEEPALIVE_NAT_T;
+        }
+    }
+    return NULL;
+}
+
+static keepalive_slot *findKeepalive(wifi_interface_handle handle, int slot) {
+    for (int i = 0; i < KEEPALIVE_SLOTS; i++) {
+        if (sKeepalives[i].handle == handle && sKeepalives[i].slot == slot) {
+            return &sKeepalives[i];
+        }
+    }
+    return NULL;
+}
+
+static bool sameKeepalive(const keepalive_slot *a, const keepalive_slot *b) {
+    return a->period_msec == b->period_msec && a->len == b->len
+            && memcmp(a->src_mac, b->src_mac, sizeof(mac_addr)) == 0
+            && memcmp(a->dst_mac, b->dst_mac, sizeof(mac_addr)) == 0
+            && memcmp(a->packet, b->packet, a->len) == 0;
+}
+
+/* one line per start, instead of one per packet byte */
+static void logKeepalive(const char *what, const keepalive_slot *k, wifi_error ret) {
+    char hex[KEEPALIVE_LOG_BYTES * 2 + 1];
+    int n = std::min((int) k->len, KEEPALIVE_LOG_BYTES);
+    for (int i = 0; i < n; i++) {
+        sprintf(hex + i * 2, "%02x", k->packet[i]);
+    }
+    hex[n * 2] = '\0';
+    ALOGD("%s keepalive [%d] = %p: %s period=%ums src=%02x:%02x:%02x:%02x:%02x:%02x "
+            "dst=%02x:%02x:%02x:%02x:%02x:%02x len=%u %s%s ret=%d", what, k->slot, k->handle,
+            keepaliveKindName(k->kind), k->period_msec,
+            k->src_mac[0], k->src_mac[1], k->src_mac[2],
+            k->src_mac[3], k->src_mac[4], k->src_mac[5],
+            k->dst_mac[0], k->dst_mac[1], k->dst_mac[2],
+            k->dst_mac[3], k->dst_mac[4], k->dst_mac[5],
+            k->len, hex, k->len > KEEPALIVE_LOG_BYTES ? "..." : "", ret);
+}
+
+static wifi_error sendKeepalive(keepalive_slot *k) {
+    return hal_fn.wifi_start_sending_offloaded_packet(k->slot, k->handle, k->packet, k->len,
+            k->src_mac, k->dst_mac, k->period_msec);
+}
+
+/* the firmware dropped every offload, e.g. with the interface or the HAL */
+static void resetKeepalives() {
+    AutoMutex lock(sKeepaliveLock);
+    for (int i = 0; i < KEEPALIVE_SLOTS; i++) {
+        sKeepalives[i].handle = NULL;
+    }
+}
+
+static jint android_net_wifi_start_sending_offloaded_packet(JNIEnv *env, jclass cls, jint iface,
+                    jint idx, jbyteArray srcMac, jbyteArray dstMac, jbyteArray pkt, jint period)  {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+
+    keepalive_slot request;
+    memset(&request, 0, sizeof(request));
+    request.handle = handle;
+    request.slot = idx;
+    request.period_msec = period;
+    int len = pkt != NULL ? env->GetArrayLength(pkt) : 0;
+    const char *error = NULL;
+    if (srcMac == NULL || env->GetArrayLength(srcMac) != sizeof(mac_addr)
+            || dstMac == NULL || env->GetArrayLength(dstMac) != sizeof(mac_addr)) {
+        error = "bad MAC address";
+    } else if (period <= 0) {
+        error = "bad period";
+    } else if (len > KEEPALIVE_PACKET_MAX) {
+        error = "packet too long";
+    } else {
+        env->GetByteArrayRegion(srcMac, 0, sizeof(mac_addr), (jbyte *) request.src_mac);
+        env->GetByteArrayRegion(dstMac, 0, sizeof(mac_addr), (jbyte *) request.dst_mac);
+        env->GetByteArrayRegion(pkt, 0, len, (jbyte *) request.packet);
+        request.len = len;
+        error = validateKeepalive(request.packet, len, &request.kind);
+    }
+    if (error != NULL) {
+        ALOGE("Start packet offload [%d] = %p: %s", idx, handle, error);
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    AutoMutex lock(sKeepaliveLock);
+
+    keepalive_slot *k = findKeepalive(handle, idx);
+    if (k != NULL) {
+        if (sameKeepalive(k, &request)) {
+            ALOGD("Start packet offload [%d] = %p: already sending", idx, handle);
+            return WIFI_SUCCESS;
+        }
+
+        /* update: the firmware takes a new packet or period only through a restart */
+        wifi_error ret = hal_fn.wifi_stop_sending_offloaded_packet(idx, handle);
+        if (ret != WIFI_SUCCESS) {
+            ALOGE("Stop packet offload [%d] = %p for update: ret=%d", idx, handle, ret);
+            return ret;
+        }
+        request.started = systemTime(SYSTEM_TIME_MONOTONIC);
+        ret = sendKeepalive(&request);
+        logKeepalive("Update", &request, ret);
+        if (ret == WIFI_SUCCESS) {
+            *k = request;
+        } else if (sendKeepalive(k) != WIFI_SUCCESS) {
+            /* neither the new nor the old packet is being sent */
+            k->handle = NULL;
+        }
+        return ret;
+    }
+
+    for (int i = 0; i < KEEPALIVE_SLOTS && k == NULL; i++) {
+        if (sKeepalives[i].handle == NULL) {
+            k = &sKeepalives[i];
+        }
+    }
+    if (k == NULL) {
+        ALOGE("Start packet offload [%d] = %p: all %d slots in use", idx, handle,
+                KEEPALIVE_SLOTS);
+        return WIFI_ERROR_TOO_MANY_REQUESTS;
+    }
+
+    request.started = systemTime(SYSTEM_TIME_MONOTONIC);
+    wifi_error ret = sendKeepalive(&request);
+    logKeepalive("Start", &request, ret);
+    if (ret == WIFI_SUCCESS) {
+        *k = request;
+    }
+    return ret;
+}
+
+static jint android_net_wifi_stop_sending_offloaded_packet(JNIEnv *env, jclass cls,
+                    jint iface, jint idx) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+
+    AutoMutex lock(sKeepaliveLock);
+
+    keepalive_slot *k = findKeepalive(handle, idx);
+    if (k == NULL) {
+        /* never started, or already stopped with the others on disconnect */
+        ALOGD("Stop packet offload [%d] = %p: not sending", idx, handle);
+        return WIFI_SUCCESS;
+    }
+    wifi_error ret = hal_fn.wifi_stop_sending_offloaded_packet(idx, handle);
+    ALOGD("Stop packet offload [%d] = %p: ret=%d", idx, handle, ret);
+    if (ret == WIFI_SUCCESS) {
+        k->handle = NULL;
+    }
+    return ret;
+}
+
+/* stops every packet offloaded on the interface; returns how many were */
+static jint android_net_wifi_stop_sending_all_offloaded_packets(JNIEnv *env, jclass cls,
+                    jint iface) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+
+    AutoMutex lock(sKeepaliveLock);
+
+    int stopped = 0;
+    for (int i = 0; i < KEEPALIVE_SLOTS; i++) {
+        keepalive_slot *k = &sKeepalives[i];
+        if (k->handle != handle) {
+            continue;
+        }
+        wifi_error ret = hal_fn.wifi_stop_sending_offloaded_packet(k->slot, handle);
+        if (ret != WIFI_SUCCESS) {
+            ALOGE("Stop packet offload [%d] = %p: ret=%d", k->slot, handle, ret);
+        }
+        /* the network is gone: the slot is not coming back either way */
+        k->handle = NULL;
+        stopped++;
+    }
+    if (stopped > 0) {
+        ALOGD("Stopped %d packet offloads on %p", stopped, handle);
+    }
+    return stopped;
+}
+
+static jstring android_net_wifi_get_offloaded_packets(JNIEnv *env, jclass cls, jint iface) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    String8 dump;
+    {
+        AutoMutex lock(sKeepaliveLock);
+        for (int i = 0; i < KEEPALIVE_SLOTS; i++) {
+            const keepalive_slot *k = &sKeepalives[i];
+            if (k->handle != handle) {
+                continue;
+            }
+            dump.appendFormat("%s[%d] %s len=%u period=%ums age=%llds", dump.length() ? ", " : "",
+                    k->slot, keepaliveKindName(k->kind), k->len, k->period_msec,
+                    (long long) ns2s(now - k->started));
+        }
+    }
+    return helper.newStringUTF(dump.length() ? dump.string() : "none").detach();
+}
+
+static void onRssiThresholdbreached(wifi_request_id id, u8 *cur_bssid, s8 cur_rssi) {
+
+    ALOGD("RSSI threshold breached, cur RSSI - %d!!\n", cur_rssi);
+    ALOGD("BSSID %02x:%02x:%02x:%02x:%02x:%02x\n",
+            cur_bssid[0], cur_bssid[1], cur_bssid[2],
+            cur_bssid[3], cur_bssid[4], cur_bssid[5]);
+    event_rssi_breach event = { id, cur_rssi };
+    if (postEvent(EVENT_RSSI_THRESHOLD_BREACHED, &event, sizeof(event), NULL, 0)) {
+        return;
+    }
+    JNIHelper helper(mVM, __func__);
+    //ALOGD("onRssiThresholdbreached called, vm = %p, obj = %p, env = %p", mVM, mCls, env);
+    helper.reportEvent(mCls, "onRssiThresholdBreached", "(IB)V", id, cur_rssi);
 }
 
 static jint android_net_wifi_start_rssi_monitoring_native(JNIEnv *env, jclass cls, jint iface,
         jint idx, jbyte maxRssi, jbyte minRssi) {
 
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("Start Rssi monitoring = %p", handle);
     ALOGD("MinRssi %d MaxRssi %d", minRssi, maxRssi);
@@ -2391,7 +3868,7 @@ static jint android_net_wifi_start_rssi_monitoring_native(JNIEnv *env, jclass cl
 
 static jint android_net_wifi_stop_rssi_monitoring_native(JNIEnv *env, jclass cls,
         jint iface, jint idx) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
     ALOGD("Stop Rssi monitoring = %p", handle);
     wifi_error ret;
@@ -2400,9 +3877,27 @@ static jint android_net_wifi_stop_rssi_monitoring_native(JNIEnv *env, jclass cls
     return ret;
 }
 
-static jobject android_net_wifi_get_wlan_wake_reason_count(JNIEnv *env, jclass cls, jint iface) {
+/* reuses the int[] in the named field if it has len elements */
+static bool setIntArrayField(JNIHelper &helper, jobject obj, const char *name, const int *values,
+        int len) {
+    jfieldID field = helper.getFieldID(obj, name, "[I");
+    if (field == NULL) {
+        return false;
+    }
+    JNIObject<jintArray> array = helper.getIntArrayField(obj, field);
+    if (array == NULL || helper.getArrayLength(array) != len) {
+        array = helper.newIntArray(len);
+        if (array == NULL) {
+            return false;
+        }
+        helper.setObjectField(obj, field, array);
+    }
+    helper.setIntArrayRegion(array, 0, len, values);
+    return true;
+}
+
+static bool getWakeReasonCount(JNIHelper &helper, jclass cls, jint iface, jobject stats) {
 
-    JNIHelper helper(env);
     WLAN_DRIVER_WAKE_REASON_CNT wake_reason_cnt;
     int cmd_event_wake_cnt_array[WAKE_REASON_TYPE_MAX];
     int driver_fw_local_wake_cnt_array[WAKE_REASON_TYPE_MAX];
@@ -2421,25 +3916,7 @@ static jobject android_net_wifi_get_wlan_wake_reason_count(JNIEnv *env, jclass c
 
     if (ret != WIFI_SUCCESS) {
         ALOGE("android_net_wifi_get_wlan_wake_reason_count: failed to get wake reason count\n");
-        return NULL;
-    }
-
-    JNIObject<jobject> stats = helper.createObject( "android/net/wifi/WifiWakeReasonAndCounts");
-    if (stats == NULL) {
-        ALOGE("android_net_wifi_get_wlan_wake_reason_count: error allocating object\n");
-        return NULL;
-    }
-    JNIObject<jintArray> cmd_wake_arr =
-            helper.newIntArray(wake_reason_cnt.cmd_event_wake_cnt_used);
-    if (cmd_wake_arr == NULL) {
-        ALOGE("android_net_wifi_get_wlan_wake_reason_count: error allocating array object\n");
-        return NULL;
-    }
-    JNIObject<jintArray> local_wake_arr =
-            helper.newIntArray(wake_reason_cnt.driver_fw_local_wake_cnt_used);
-    if (local_wake_arr == NULL) {
-        ALOGE("android_net_wifi_get_wlan_wake_reason_count: error allocating array object\n");
-        return NULL;
+        return false;
     }
 
     helper.setIntField(stats, "totalCmdEventWake", wake_reason_cnt.total_cmd_event_wake);
@@ -2459,17 +3936,1625 @@ static jobject android_net_wifi_get_wlan_wake_reason_count(JNIEnv *env, jclass c
             wake_reason_cnt.rx_multicast_wake_pkt_info.ipv6_rx_multicast_addr_cnt);
     helper.setIntField(stats, "otherRxMulticast",
             wake_reason_cnt.rx_multicast_wake_pkt_info.other_rx_multicast_addr_cnt);
-    helper.setIntArrayRegion(cmd_wake_arr, 0, wake_reason_cnt.cmd_event_wake_cnt_used,
-            wake_reason_cnt.cmd_event_wake_cnt);
-    helper.setIntArrayRegion(local_wake_arr, 0, wake_reason_cnt.driver_fw_local_wake_cnt_used,
-            wake_reason_cnt.driver_fw_local_wake_cnt);
-    helper.setObjectField(stats, "cmdEventWakeCntArray", "[I", cmd_wake_arr);
-    helper.setObjectField(stats, "driverFWLocalWakeCntArray", "[I", local_wake_arr);
+    if (!setIntArrayField(helper, stats, "cmdEventWakeCntArray", wake_reason_cnt.cmd_event_wake_cnt,
+                    wake_reason_cnt.cmd_event_wake_cnt_used)
+            || !setIntArrayField(helper, stats, "driverFWLocalWakeCntArray",
+                    wake_reason_cnt.driver_fw_local_wake_cnt,
+                    wake_reason_cnt.driver_fw_local_wake_cnt_used)) {
+        ALOGE("android_net_wifi_get_wlan_wake_reason_count: error allocating array object\n");
+        return false;
+    }
+    return true;
+}
+
+static jobject android_net_wifi_get_wlan_wake_reason_count(JNIEnv *env, jclass cls, jint iface) {
+
+    JNIHelper helper(env, __func__);
+    JNIObject<jobject> stats = helper.createObject( "android/net/wifi/WifiWakeReasonAndCounts");
+    if (stats == NULL) {
+        ALOGE("android_net_wifi_get_wlan_wake_reason_count: error allocating object\n");
+        return NULL;
+    }
+    if (!getWakeReasonCount(helper, cls, iface, stats)) {
+        return NULL;
+    }
     return stats.detach();
 }
 
+/*
+ * Wake reason tracking. The framework polls the driver's cumulative wake counters with
+ * pollWakeReasonsNative(), under WifiNative.sLock, every period while the HAL runs. The first
+ * poll of an interface is the baseline; after that the difference from the previous poll is
+ * kept as one bucket of history per interval: per command/event reason, per firmware local
+ * reason, and per RX class. Intervals without any wake are merged into one bucket, so a quiet
+ * night does not push the last active hours out of the history. The framework asks for the
+ * reasons that woke the host most over a window with getTopWakeReasonsNative().
+ */
+
+#define WAKE_TRACK_REASONS      32      /* reasons kept per category; the rest are ignored */
+#define WAKE_HISTORY_BUCKETS    96      /* 8 hours at the default 5 minute period */
+
+typedef enum {
+    WAKE_CATEGORY_CMD_EVENT = 0,        /* index: reason code */
+    WAKE_CATEGORY_DRIVER_FW_LOCAL = 1,  /* index: reason code */
+    WAKE_CATEGORY_RX = 2,               /* index: wake_rx_class */
+} wake_category;
+
+typedef enum {
+    WAKE_RX_UNICAST,
+    WAKE_RX_MULTICAST,
+    WAKE_RX_BROADCAST,
+    WAKE_RX_ICMP,
+    WAKE_RX_ICMP6,
+    WAKE_RX_ICMP6_RA,
+    WAKE_RX_ICMP6_NA,
+    WAKE_RX_ICMP6_NS,
+    WAKE_RX_IPV4_MULTICAST,
+    WAKE_RX_IPV6_MULTICAST,
+    WAKE_RX_OTHER_MULTICAST,
+    WAKE_RX_CLASSES,
+} wake_rx_class;
+
+#define WAKE_KEYS               (2 * WAKE_TRACK_REASONS + WAKE_RX_CLASSES)
+#define WAKE_TOP_HEADER         2       /* wakes in the window, milliseconds it covers */
+
+typedef struct {
+    u32 total;
+    u32 counts[WAKE_KEYS];              /* command/event reasons, local reasons, RX classes */
+} wake_counters;
+
+typedef struct {
+    nsecs_t start;                      /* boot time */
+    nsecs_t end;
+    wake_counters delta;
+} wake_bucket;
+
+static Mutex sWakeLock;
+static wifi_interface_handle sWakeHandle;
+static bool sWakeBaseline = false;      /* sWakeLast holds a poll of sWakeHandle */
+static wake_counters sWakeLast;
+static nsecs_t sWakeLastTime;
+static wake_bucket sWakeHistory[WAKE_HISTORY_BUCKETS];
+static int sWakeHistoryHead = 0;        /* oldest bucket */
+static int sWakeHistoryLen = 0;
+static u32 sWakePollFailures = 0;
+
+static void readWakeCounters(const WLAN_DRIVER_WAKE_REASON_CNT *cnt, wake_counters *counters) {
+    memset(counters, 0, sizeof(*counters));
+    counters->total = cnt->total_cmd_event_wake + cnt->total_driver_fw_local_wake
+            + cnt->total_rx_data_wake;
+
+    u32 *cmd = counters->counts;
+    u32 *local = cmd + WAKE_TRACK_REASONS;
+    u32 *rx = local + WAKE_TRACK_REASONS;
+    for (int i = 0; i < std::min(cnt->cmd_event_wake_cnt_used, WAKE_TRACK_REASONS); i++) {
+        cmd[i] = cnt->cmd_event_wake_cnt[i];
+    }
+    for (int i = 0; i < std::min(cnt->driver_fw_local_wake_cnt_used, WAKE_TRACK_REASONS); i++) {
+        local[i] = cnt->driver_fw_local_wake_cnt[i];
+    }
+    rx[WAKE_RX_UNICAST] = cnt->rx_wake_details.rx_unicast_cnt;
+    rx[WAKE_RX_MULTICAST] = cnt->rx_wake_details.rx_multicast_cnt;
+    rx[WAKE_RX_BROADCAST] = cnt->rx_wake_details.rx_broadcast_cnt;
+    rx[WAKE_RX_ICMP] = cnt->rx_wake_pkt_classification_info.icmp_pkt;
+    rx[WAKE_RX_ICMP6] = cnt->rx_wake_pkt_classification_info.icmp6_pkt;
+    rx[WAKE_RX_ICMP6_RA] = cnt->rx_wake_pkt_classification_info.icmp6_ra;
+    rx[WAKE_RX_ICMP6_NA] = cnt->rx_wake_pkt_classification_info.icmp6_na;
+    rx[WAKE_RX_ICMP6_NS] = cnt->rx_wake_pkt_classification_info.icmp6_ns;
+    rx[WAKE_RX_IPV4_MULTICAST] = cnt->rx_multicast_wake_pkt_info.ipv4_rx_multicast_addr_cnt;
+    rx[WAKE_RX_IPV6_MULTICAST] = cnt->rx_multicast_wake_pkt_info.ipv6_rx_multicast_addr_cnt;
+    rx[WAKE_RX_OTHER_MULTICAST] = cnt->rx_multicast_wake_pkt_info.other_rx_multicast_addr_cnt;
+}
+
+/* a counter below its previous value was reset with the driver: all of it is new */
+static u32 wakeDelta(u32 now, u32 last) {
+    return now >= last ? now - last : now;
+}
+
+static wifi_error pollWakeReasons(wifi_interface_handle handle) {
+    int cmd[WAKE_TRACK_REASONS];
+    int local[WAKE_TRACK_REASONS];
+    WLAN_DRIVER_WAKE_REASON_CNT cnt;
+    memset(&cnt, 0, sizeof(cnt));
+    cnt.cmd_event_wake_cnt = cmd;
+    cnt.cmd_event_wake_cnt_sz = WAKE_TRACK_REASONS;
+    cnt.driver_fw_local_wake_cnt = local;
+    cnt.driver_fw_local_wake_cnt_sz = WAKE_TRACK_REASONS;
+
+    wifi_error ret = hal_fn.wifi_get_wake_reason_stats(handle, &cnt);
+    nsecs_t time = systemTime(SYSTEM_TIME_BOOTTIME);
+
+    AutoMutex lock(sWakeLock);
+    if (handle != sWakeHandle) {
+        sWakeHandle = handle;
+        sWakeBaseline = false;
+    }
+    if (ret != WIFI_SUCCESS) {
+        ALOGD("wifi_get_wake_reason_stats failed: ret=%d", ret);
+        if (ret != WIFI_ERROR_NOT_SUPPORTED) {
+            sWakePollFailures++;
+        }
+        return ret;
+    }
+
+    wake_counters now;
+    readWakeCounters(&cnt, &now);
+    if (!sWakeBaseline) {
+        sWakeBaseline = true;
+        sWakeLast = now;
+        sWakeLastTime = time;
+        return WIFI_SUCCESS;
+    }
+
+    wake_counters delta;
+    delta.total = wakeDelta(now.total, sWakeLast.total);
+    for (int i = 0; i < WAKE_KEYS; i++) {
+        delta.counts[i] = wakeDelta(now.counts[i], sWakeLast.counts[i]);
+    }
+
+    wake_bucket *last = sWakeHistoryLen > 0
+            ? &sWakeHistory[(sWakeHistoryHead + sWakeHistoryLen - 1) % WAKE_HISTORY_BUCKETS]
+            : NULL;
+    if (delta.total == 0 && last != NULL && last->delta.total == 0
+            && last->end == sWakeLastTime) {
+        last->end = time;
+    } else {
+        if (sWakeHistoryLen == WAKE_HISTORY_BUCKETS) {
+            sWakeHistoryHead = (sWakeHistoryHead + 1) % WAKE_HISTORY_BUCKETS;
+            sWakeHistoryLen--;
+        }
+        wake_bucket *b = &sWakeHistory[(sWakeHistoryHead + sWakeHistoryLen++)
+                % WAKE_HISTORY_BUCKETS];
+        b->start = sWakeLastTime;
+        b->end = time;
+        b->delta = delta;
+    }
+    sWakeLast = now;
+    sWakeLastTime = time;
+    return WIFI_SUCCESS;
+}
+
+static void resetWakeTracking() {
+    AutoMutex lock(sWakeLock);
+    sWakeHandle = NULL;
+    sWakeBaseline = false;
+    sWakeHistoryHead = 0;
+    sWakeHistoryLen = 0;
+    sWakePollFailures = 0;
+}
+
+static jint android_net_wifi_poll_wake_reasons(JNIEnv *env, jclass cls, jint iface) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, cls, iface);
+    return pollWakeReasons(handle);
+}
+
+/*
+ * Returns the wakes in the buckets that ended within the last windowMs and the milliseconds
+ * those buckets cover, followed by up to n (category, index, count) triples, the reasons that
+ * woke the host most first.
+ */
+static jintArray android_net_wifi_get_top_wake_reasons(JNIEnv *env, jclass cls,
+        jlong windowMs, jint n) {
+    JNIHelper helper(env, __func__);
+
+    wake_counters sum;
+    memset(&sum, 0, sizeof(sum));
+    nsecs_t covered = 0;
+    {
+        AutoMutex lock(sWakeLock);
+        nsecs_t since = systemTime(SYSTEM_TIME_BOOTTIME) - ms2ns(windowMs);
+        for (int i = sWakeHistoryLen - 1; i >= 0; i--) {
+            const wake_bucket *b = &sWakeHistory[(sWakeHistoryHead + i) % WAKE_HISTORY_BUCKETS];
+            if (b->end <= since) {
+                break;
+            }
+            covered += b->end - b->start;
+            sum.total += b->delta.total;
+            for (int k = 0; k < WAKE_KEYS; k++) {
+                sum.counts[k] += b->delta.counts[k];
+            }
+        }
+    }
+
+    int keys[WAKE_KEYS];
+    int numKeys = 0;
+    for (int k = 0; k < WAKE_KEYS; k++) {
+        if (sum.counts[k] != 0) {
+            keys[numKeys++] = k;
+        }
+    }
+    int numTop = std::max(0, std::min((int) n, numKeys));
+    std::partial_sort(keys, keys + numTop, keys + numKeys, [&sum](int a, int b) {
+        return sum.counts[a] > sum.counts[b];
+    });
+
+    jint packed[WAKE_TOP_HEADER + 3 * WAKE_KEYS];
+    packed[0] = sum.total;
+    packed[1] = ns2ms(covered);
+    for (int i = 0; i < numTop; i++) {
+        int k = keys[i];
+        jint *triple = &packed[WAKE_TOP_HEADER + 3 * i];
+        triple[0] = k / WAKE_TRACK_REASONS;
+        triple[1] = k % WAKE_TRACK_REASONS;
+        triple[2] = sum.counts[k];
+    }
+
+    int len = WAKE_TOP_HEADER + 3 * numTop;
+    JNIObject<jintArray> result = helper.newIntArray(len);
+    if (result == NULL) {
+        ALOGE("android_net_wifi_get_top_wake_reasons: error allocating array object");
+        return NULL;
+    }
+    helper.setIntArrayRegion(result, 0, len, packed);
+    return result.detach();
+}
+
+/*
+ * Scan history. Every batch of cached scan results the framework flushes is appended to a log of
+ * segment files that stay mapped, so that questions about past scans are answered from the
+ * mapping instead of from objects kept on the Java heap. A segment is a header followed by batch
+ * records; the header's used count is only advanced once a record is complete. When a batch
+ * might not fit, a new segment is started, and the oldest segments beyond the cap are deleted.
+ *
+ * Records are varint encoded. Each segment has its own BSSID dictionary: a BSSID is written in
+ * full, with its SSID and frequency, the first time the segment sees it and by id after that.
+ * RSSIs are deltas from the BSSID's previous sighting, result times are the age in milliseconds
+ * at the time of the batch, and batch times are deltas from the previous batch.
+ *
+ *   batch:  u8 tag, zigzag time delta (ms), scan id, flags, buckets scanned, count, results
+ *   result: id << 2 | frequency follows (2) | new (1), [mac[6], u8 ssid length, ssid],
+ *           [frequency], zigzag RSSI delta, age (ms)
+ */
+
+#define SCAN_HISTORY_MAGIC          0x53485357  /* "WSHS" */
+#define SCAN_HISTORY_VERSION        1
+#define SCAN_HISTORY_PREFIX         "scan_history."
+#define SCAN_HISTORY_MIN_SEGMENT    (16 * 1024)
+#define SCAN_HISTORY_MAX_SEGMENT    (4 * 1024 * 1024)
+#define SCAN_HISTORY_MAX_SEGMENTS   64
+#define SCAN_HISTORY_BATCH          1
+
+/* the most a batch header and a result can take */
+#define SCAN_HISTORY_MAX_BATCH_HEADER   (1 + 10 + 4 * 5)
+#define SCAN_HISTORY_MAX_RESULT         (5 + 6 + 1 + 32 + 5 + 5 + 5)
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 size;                           /* of the file, header included */
+    u32 used;                           /* bytes of complete records after the header */
+    int64_t sequence;
+    int64_t first_ms;                   /* wall clock time of the oldest sighting */
+    int64_t last_ms;                    /* and of the last batch */
+} scan_history_header;
+
+typedef struct {
+    u8 *base;
+    scan_history_header *header;
+} scan_segment;
+
+typedef struct {
+    u8 mac[6];
+    u8 ssid_length;
+    u8 ssid[32];
+    int frequency;
+    int rssi;
+} scan_history_bssid;
+
+/* a sighting decoded from the history */
+typedef struct {
+    int64_t time_ms;
+    const scan_history_bssid *bssid;
+    int rssi;
+} scan_sighting;
+
+static Mutex sScanHistoryLock;
+static String8 sScanHistoryDir;
+static u32 sScanHistorySegmentSize;
+static int sScanHistoryMaxSegments;
+static std::vector<scan_segment> sScanSegments;     /* oldest first */
+/* the dictionary of the last segment */
+static std::vector<scan_history_bssid> sScanDictionary;
+static std::unordered_map<uint64_t, u32> sScanDictionaryIds;
+static u32 sScanHistoryBatches;
+
+static uint64_t macToKey(const u8 *mac) {
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++) {
+        key = (key << 8) | mac[i];
+    }
+    return key;
+}
+
+static void putVarint(std::vector<u8> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static void putZigzag(std::vector<u8> &out, int64_t value) {
+    putVarint(out, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+class ScanHistoryReader {
+    const u8 *mPos;
+    const u8 *mEnd;
+public:
+    ScanHistoryReader(const u8 *data, u32 len) : mPos(data), mEnd(data + len) {}
+    bool done() const { return mPos >= mEnd; }
+    bool varint(uint64_t *value) {
+        *value = 0;
+        for (int shift = 0; shift < 64 && mPos < mEnd; shift += 7) {
+            u8 b = *mPos++;
+            *value |= (uint64_t) (b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool zigzag(int64_t *value) {
+        uint64_t raw;
+        if (!varint(&raw)) {
+            return false;
+        }
+        *value = (int64_t) (raw >> 1) ^ -(int64_t) (raw & 1);
+        return true;
+    }
+    bool bytes(u8 *out, u32 len) {
+        if ((u32) (mEnd - mPos) < len) {
+            return false;
+        }
+        memcpy(out, mPos, len);
+        mPos += len;
+        return true;
+    }
+};
+
+/*
+ * Decodes the records of a segment into dictionary, calling found for each sighting unless it is
+ * NULL. Returns false if the segment is corrupt; what was decoded until then is kept.
+ */
+template<typename F>
+static bool decodeSegment(const scan_segment &segment, std::vector<scan_history_bssid> *dictionary,
+        F found) {
+    ScanHistoryReader reader(segment.base + sizeof(scan_history_header), segment.header->used);
+    int64_t time_ms = 0;
+    while (!reader.done()) {
+        u8 tag;
+        int64_t delta;
+        uint64_t scan_id, flags, buckets, count;
+        if (!reader.bytes(&tag, 1) || tag != SCAN_HISTORY_BATCH || !reader.zigzag(&delta)
+                || !reader.varint(&scan_id) || !reader.varint(&flags)
+                || !reader.varint(&buckets) || !reader.varint(&count)) {
+            return false;
+        }
+        time_ms += delta;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t ref, frequency, age;
+            int64_t rssi_delta;
+            if (!reader.varint(&ref)) {
+                return false;
+            }
+            uint64_t id = ref >> 2;
+            if (ref & 1) {
+                scan_history_bssid entry;
+                memset(&entry, 0, sizeof(entry));
+                if (id != dictionary->size() || !reader.bytes(entry.mac, sizeof(entry.mac))
+                        || !reader.bytes(&entry.ssid_length, 1)
+                        || entry.ssid_length > sizeof(entry.ssid)
+                        || !reader.bytes(entry.ssid, entry.ssid_length)) {
+                    return false;
+                }
+                dictionary->push_back(entry);
+            } else if (id >= dictionary->size()) {
+                return false;
+            }
+            scan_history_bssid *bssid = &(*dictionary)[id];
+            if (ref & 2) {
+                if (!reader.varint(&frequency)) {
+                    return false;
+                }
+                bssid->frequency = frequency;
+            }
+            if (!reader.zigzag(&rssi_delta) || !reader.varint(&age)) {
+                return false;
+            }
+            bssid->rssi += rssi_delta;
+            scan_sighting sighting = { time_ms - (int64_t) age, bssid, bssid->rssi };
+            found(sighting);
+        }
+    }
+    return true;
+}
+
+static void unmapSegment(const scan_segment &segment) {
+    munmap(segment.base, segment.header->size);
+}
+
+static String8 segmentPath(int64_t sequence) {
+    return String8::format("%s/" SCAN_HISTORY_PREFIX "%lld", sScanHistoryDir.string(),
+            (long long) sequence);
+}
+
+/* maps an existing segment file, or creates one if size is not 0 */
+static bool mapSegment(const char *path, u32 size, int64_t sequence, scan_segment *segment) {
+    int fd = open(path, O_RDWR | O_CLOEXEC | (size != 0 ? O_CREAT | O_TRUNC : 0), 0660);
+    if (fd < 0) {
+        ALOGE("Error opening %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (size != 0) {
+        if (ftruncate(fd, size) != 0) {
+            ALOGE("Error sizing %s: %s", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(scan_history_header)
+                || st.st_size > SCAN_HISTORY_MAX_SEGMENT) {
+            close(fd);
+            return false;
+        }
+        size = st.st_size;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        ALOGE("Error mapping %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    segment->base = (u8 *) base;
+    segment->header = (scan_history_header *) base;
+    scan_history_header *header = segment->header;
+    if (sequence >= 0) {
+        memset(header, 0, sizeof(*header));
+        header->magic = SCAN_HISTORY_MAGIC;
+        header->version = SCAN_HISTORY_VERSION;
+        header->size = size;
+        header->sequence = sequence;
+    } else if (header->magic != SCAN_HISTORY_MAGIC || header->version != SCAN_HISTORY_VERSION
+            || header->size != size || header->used > size - sizeof(scan_history_header)) {
+        munmap(base, size);
+        return false;
+    }
+    return true;
+}
+
+static bool startSegment() {
+    int64_t sequence = sScanSegments.empty() ? 0 : sScanSegments.back().header->sequence + 1;
+    scan_segment segment;
+    if (!mapSegment(segmentPath(sequence).string(), sScanHistorySegmentSize, sequence,
+                &segment)) {
+        return false;
+    }
+    sScanSegments.push_back(segment);
+    sScanDictionary.clear();
+    sScanDictionaryIds.clear();
+
+    while ((int) sScanSegments.size() > sScanHistoryMaxSegments) {
+        const scan_segment &oldest = sScanSegments.front();
+        unlink(segmentPath(oldest.header->sequence).string());
+        unmapSegment(oldest);
+        sScanSegments.erase(sScanSegments.begin());
+    }
+    return true;
+}
+
+/* maps the segments left in dir, and resumes appending to the last one */
+static void loadSegments() {
+    DIR *dir = opendir(sScanHistoryDir.string());
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, SCAN_HISTORY_PREFIX, strlen(SCAN_HISTORY_PREFIX)) != 0) {
+            continue;
+        }
+        String8 path = String8::format("%s/%s", sScanHistoryDir.string(), entry->d_name);
+        scan_segment segment;
+        if (!mapSegment(path.string(), 0, -1, &segment)) {
+            ALOGW("Deleting invalid scan history segment %s", path.string());
+            unlink(path.string());
+            continue;
+        }
+        sScanSegments.push_back(segment);
+    }
+    closedir(dir);
+
+    std::sort(sScanSegments.begin(), sScanSegments.end(),
+            [](const scan_segment &a, const scan_segment &b) {
+                return a.header->sequence < b.header->sequence;
+            });
+    while ((int) sScanSegments.size() > sScanHistoryMaxSegments) {
+        unlink(segmentPath(sScanSegments.front().header->sequence).string());
+        unmapSegment(sScanSegments.front());
+        sScanSegments.erase(sScanSegments.begin());
+    }
+    if (!sScanSegments.empty()) {
+        /* a corrupt tail is not appended to: new records would be unreadable */
+        if (decodeSegment(sScanSegments.back(), &sScanDictionary, [](const scan_sighting &) {})) {
+            for (u32 i = 0; i < sScanDictionary.size(); i++) {
+                sScanDictionaryIds[macToKey(sScanDictionary[i].mac)] = i;
+            }
+        } else {
+            ALOGW("Scan history segment %lld is corrupt; starting a new one",
+                    (long long) sScanSegments.back().header->sequence);
+            startSegment();
+        }
+    }
+}
+
+/* returns the time of the oldest sighting of the batch */
+static int64_t encodeBatch(const wifi_cached_scan_results *batch, int64_t time_ms,
+        int64_t boot_us, std::vector<u8> &out) {
+    int64_t oldest_ms = time_ms;
+    scan_history_header *header = sScanSegments.back().header;
+    out.push_back(SCAN_HISTORY_BATCH);
+    putZigzag(out, time_ms - header->last_ms);
+    putVarint(out, (u32) batch->scan_id);
+    putVarint(out, batch->flags);
+    putVarint(out, (u32) batch->buckets_scanned);
+    putVarint(out, batch->num_results);
+
+    for (int i = 0; i < batch->num_results; i++) {
+        const wifi_scan_result *result = &batch->results[i];
+        uint64_t key = macToKey(result->bssid);
+        auto it = sScanDictionaryIds.find(key);
+        u32 id;
+        bool added = it == sScanDictionaryIds.end();
+        if (added) {
+            id = sScanDictionary.size();
+            scan_history_bssid entry;
+            memset(&entry, 0, sizeof(entry));
+            memcpy(entry.mac, result->bssid, sizeof(entry.mac));
+            entry.ssid_length = strnlen(result->ssid, sizeof(entry.ssid));
+            memcpy(entry.ssid, result->ssid, entry.ssid_length);
+            entry.frequency = -1;
+            sScanDictionary.push_back(entry);
+            sScanDictionaryIds[key] = id;
+        } else {
+            id = it->second;
+        }
+        scan_history_bssid *bssid = &sScanDictionary[id];
+        bool frequency = bssid->frequency != result->channel;
+        putVarint(out, ((uint64_t) id << 2) | (frequency ? 2 : 0) | (added ? 1 : 0));
+        if (added) {
+            out.insert(out.end(), bssid->mac, bssid->mac + sizeof(bssid->mac));
+            out.push_back(bssid->ssid_length);
+            out.insert(out.end(), bssid->ssid, bssid->ssid + bssid->ssid_length);
+        }
+        if (frequency) {
+            putVarint(out, (u32) result->channel);
+            bssid->frequency = result->channel;
+        }
+        putZigzag(out, result->rssi - bssid->rssi);
+        bssid->rssi = result->rssi;
+        int64_t age_ms = (boot_us - (int64_t) result->ts) / 1000;
+        /* bounded so that the age fits in the 5 bytes SCAN_HISTORY_MAX_RESULT allows */
+        age_ms = std::min(std::max((int64_t) 0, age_ms), (int64_t) UINT32_MAX);
+        putVarint(out, age_ms);
+        oldest_ms = std::min(oldest_ms, time_ms - age_ms);
+    }
+    return oldest_ms;
+}
+
+static void appendScanHistory(const wifi_cached_scan_results *batches, int num_batches) {
+    Mutex::Autolock lock(sScanHistoryLock);
+    if (sScanSegments.empty()) {
+        return;
+    }
+    int64_t time_ms = ns2ms(systemTime(SYSTEM_TIME_REALTIME));
+    int64_t boot_us = ns2us(systemTime(SYSTEM_TIME_BOOTTIME));
+    std::vector<u8> record;
+    for (int i = 0; i < num_batches; i++) {
+        const wifi_cached_scan_results *batch = &batches[i];
+        if (batch->num_results < 0 || batch->num_results > MAX_AP_CACHE_PER_SCAN) {
+            continue;
+        }
+        scan_history_header *header = sScanSegments.back().header;
+        u32 room = header->size - sizeof(scan_history_header) - header->used;
+        if (room < SCAN_HISTORY_MAX_BATCH_HEADER
+                + (u32) batch->num_results * SCAN_HISTORY_MAX_RESULT) {
+            if (!startSegment()) {
+                return;
+            }
+            header = sScanSegments.back().header;
+        }
+
+        record.clear();
+        int64_t oldest_ms = encodeBatch(batch, time_ms, boot_us, record);
+        memcpy(sScanSegments.back().base + sizeof(scan_history_header) + header->used,
+                record.data(), record.size());
+        if (header->first_ms == 0 || oldest_ms < header->first_ms) {
+            header->first_ms = oldest_ms;
+        }
+        header->last_ms = time_ms;
+        __atomic_store_n(&header->used, header->used + (u32) record.size(), __ATOMIC_RELEASE);
+        sScanHistoryBatches++;
+    }
+}
+
+static jboolean android_net_wifi_enable_scan_history(JNIEnv *env, jclass cls, jstring jdir,
+        jint segmentBytes, jint maxSegments) {
+    JNIHelper helper(env, __func__);
+    if (jdir == NULL || segmentBytes < SCAN_HISTORY_MIN_SEGMENT
+            || segmentBytes > SCAN_HISTORY_MAX_SEGMENT || maxSegments < 1
+            || maxSegments > SCAN_HISTORY_MAX_SEGMENTS) {
+        return false;
+    }
+    ScopedUtfChars dir(env, jdir);
+    if (dir.c_str() == NULL) {
+        return false;
+    }
+
+    Mutex::Autolock lock(sScanHistoryLock);
+    if (!sScanSegments.empty()) {
+        if (sScanHistoryDir == dir.c_str()) {
+            sScanHistorySegmentSize = segmentBytes;
+            sScanHistoryMaxSegments = maxSegments;
+            return true;
+        }
+        for (const scan_segment &segment : sScanSegments) {
+            unmapSegment(segment);
+        }
+        sScanSegments.clear();
+    }
+    if (mkdir(dir.c_str(), 0770) != 0 && errno != EEXIST) {
+        ALOGE("Error creating %s: %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+    sScanHistoryDir = dir.c_str();
+    sScanHistorySegmentSize = segmentBytes;
+    sScanHistoryMaxSegments = maxSegments;
+    sScanDictionary.clear();
+    sScanDictionaryIds.clear();
+    loadSegments();
+    if (sScanSegments.empty() && !startSegment()) {
+        return false;
+    }
+    ALOGD("Scan history in %s: %zu segments", dir.c_str(), sScanSegments.size());
+    return true;
+}
+
+/* stops recording, and deletes what was recorded in dir: the history is a location history */
+static void android_net_wifi_disable_scan_history(JNIEnv *env, jclass cls, jstring jdir) {
+    JNIHelper helper(env, __func__);
+    if (jdir == NULL) {
+        return;
+    }
+    ScopedUtfChars dir(env, jdir);
+    if (dir.c_str() == NULL) {
+        return;
+    }
+
+    Mutex::Autolock lock(sScanHistoryLock);
+    for (const scan_segment &segment : sScanSegments) {
+        unmapSegment(segment);
+    }
+    sScanSegments.clear();
+    sScanDictionary.clear();
+    sScanDictionaryIds.clear();
+
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, SCAN_HISTORY_PREFIX, strlen(SCAN_HISTORY_PREFIX)) == 0) {
+            unlinkat(dirfd(d), entry->d_name, 0);
+        }
+    }
+    closedir(d);
+}
+
+/*
+ * Returns the sightings between fromMs and toMs (wall clock, inclusive), oldest first, of the
+ * given BSSID or of all of them if it is null; at most max of them, the most recent ones.
+ */
+static jobjectArray android_net_wifi_query_scan_history(JNIEnv *env, jclass cls, jlong fromMs,
+        jlong toMs, jstring jbssid, jint max) {
+    JNIHelper helper(env, __func__);
+    mac_addr mac;
+    bool filter = jbssid != NULL;
+    if ((filter && !parseMacString(env, jbssid, mac)) || max < 0) {
+        return NULL;
+    }
+
+    struct match {
+        int64_t time_ms;
+        scan_history_bssid bssid;
+        int rssi;
+    };
+    std::vector<match> matches;
+    {
+        Mutex::Autolock lock(sScanHistoryLock);
+        for (const scan_segment &segment : sScanSegments) {
+            const scan_history_header *header = segment.header;
+            if (header->used == 0 || header->last_ms < fromMs || header->first_ms > toMs) {
+                continue;
+            }
+            std::vector<scan_history_bssid> dictionary;
+            decodeSegment(segment, &dictionary, [&](const scan_sighting &s) {
+                if (s.time_ms < fromMs || s.time_ms > toMs
+                        || (filter && memcmp(s.bssid->mac, mac, sizeof(mac)) != 0)) {
+                    return;
+                }
+                matches.push_back({ s.time_ms, *s.bssid, s.rssi });
+            });
+        }
+    }
+    std::stable_sort(matches.begin(), matches.end(), [](const match &a, const match &b) {
+        return a.time_ms < b.time_ms;
+    });
+    size_t first = matches.size() > (size_t) max ? matches.size() - max : 0;
+
+    JNIObject<jobjectArray> sightings = helper.createObjectArray(
+            "com/android/server/wifi/WifiNative$ScanSighting", matches.size() - first);
+    if (sightings == NULL) {
+        return NULL;
+    }
+    for (size_t i = first; i < matches.size(); i++) {
+        const match &m = matches[i];
+        JNIObject<jobject> sighting = helper.createObject(
+                "com/android/server/wifi/WifiNative$ScanSighting");
+        if (sighting == NULL) {
+            return NULL;
+        }
+        char bssid[18];
+        formatMac(m.bssid.mac, bssid);
+        JNIObject<jbyteArray> ssid = helper.newByteArray(m.bssid.ssid_length);
+        helper.setByteArrayRegion(ssid, 0, m.bssid.ssid_length, (jbyte *) m.bssid.ssid);
+        helper.setLongField(sighting, "timeMillis", m.time_ms);
+        helper.setStringField(sighting, "bssid", bssid);
+        helper.setObjectField(sighting, "rawSsid", "[B", ssid);
+        helper.setIntField(sighting, "rssi", m.rssi);
+        helper.setIntField(sighting, "frequency", m.bssid.frequency);
+        helper.setObjectArrayElement(sightings, i - first, sighting);
+    }
+    return sightings.detach();
+}
+
+static jstring android_net_wifi_get_scan_history_stats(JNIEnv *env, jclass cls) {
+    JNIHelper helper(env, __func__);
+    Mutex::Autolock lock(sScanHistoryLock);
+    if (sScanSegments.empty()) {
+        return helper.newStringUTF("disabled").detach();
+    }
+    u32 used = 0;
+    u32 size = 0;
+    for (const scan_segment &segment : sScanSegments) {
+        used += segment.header->used;
+        size += segment.header->size;
+    }
+    String8 stats = String8::format(
+            "%zu segments (%u of %u bytes used), %zu BSSIDs in the last, %u batches appended",
+            sScanSegments.size(), used, size, sScanDictionary.size(), sScanHistoryBatches);
+    return helper.newStringUTF(stats.string()).detach();
+}
+
+/*
+ * Link stats history. Every set of link layer stats received from the HAL is recorded as a
+ * sample of LINK_METRICS metrics, so that days of link quality can be looked back at without
+ * the framework keeping the polled WifiLinkLayerStats. The samples go to three tiers, each a
+ * fixed size ring of entries in a file that stays mapped: the raw samples, and min/max/sum
+ * rollups per minute and per hour. A rollup entry is updated in place until a sample falls in a
+ * later period. The RSSI is a gauge; the other metrics are counters, recorded as their increase
+ * since the previous sample, which is why the first sample after enabling is only remembered.
+ */
+
+#define LINK_HISTORY_MAGIC          0x484c5357  /* "WSLH" */
+#define LINK_HISTORY_VERSION        1
+
+enum {
+    LINK_METRIC_RSSI,
+    LINK_METRIC_BEACON_RX,
+    LINK_METRIC_RX_MPDU,
+    LINK_METRIC_TX_MPDU,
+    LINK_METRIC_MPDU_LOST,
+    LINK_METRIC_RETRIES,
+    LINK_METRIC_ON_TIME,
+    LINK_METRIC_TX_TIME,
+    LINK_METRIC_RX_TIME,
+    LINK_METRIC_ON_TIME_SCAN,
+    LINK_METRICS
+};
+
+typedef struct {
+    const char *name;
+    int64_t period_ms;                  /* 0: one entry per sample */
+    u32 capacity;
+} link_tier_config;
+
+static const link_tier_config sLinkTiers[] = {
+    { "raw", 0, 512 },                  /* ~25 minutes of RSSI polls */
+    { "minute", 60 * 1000, 2 * 24 * 60 },
+    { "hour", 60 * 60 * 1000, 30 * 24 },
+};
+
+#define LINK_TIERS (sizeof(sLinkTiers) / sizeof(sLinkTiers[0]))
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 metrics;
+    u32 capacity;
+    int64_t period_ms;
+    u64 head;                           /* entries ever started; the last one is open */
+} link_tier_header;
+
+typedef struct {
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+} link_rollup;
+
+typedef struct {
+    int64_t start_ms;                   /* wall clock */
+    int64_t count;
+    link_rollup metrics[LINK_METRICS];
+} link_tier_entry;
+
+typedef struct {
+    link_tier_header *header;
+    link_tier_entry *entries;
+    size_t size;
+} link_tier;
+
+/* the HAL's own counters, each a u32 that wraps; the per-AC ones add up to one metric */
+enum {
+    LINK_COUNTER_BEACON_RX,
+    LINK_COUNTER_ON_TIME,
+    LINK_COUNTER_TX_TIME,
+    LINK_COUNTER_RX_TIME,
+    LINK_COUNTER_ON_TIME_SCAN,
+    LINK_COUNTER_AC,                    /* rx mpdu, tx mpdu, mpdu lost and retries of each AC */
+    LINK_COUNTERS = LINK_COUNTER_AC + 4 * WIFI_AC_MAX
+};
+
+static const int kLinkCounterMetrics[LINK_COUNTER_AC] = {
+    LINK_METRIC_BEACON_RX, LINK_METRIC_ON_TIME, LINK_METRIC_TX_TIME, LINK_METRIC_RX_TIME,
+    LINK_METRIC_ON_TIME_SCAN,
+};
+static const int kLinkAcMetrics[4] = {
+    LINK_METRIC_RX_MPDU, LINK_METRIC_TX_MPDU, LINK_METRIC_MPDU_LOST, LINK_METRIC_RETRIES,
+};
+
+static Mutex sLinkHistoryLock;
+static link_tier sLinkTierMaps[LINK_TIERS];
+static bool sLinkHistoryEnabled;
+static bool sLinkCountersValid;
+static u32 sLinkCounters[LINK_COUNTERS];    /* the counters of the previous sample */
+
+static void unmapLinkTiers() {
+    for (u32 i = 0; i < LINK_TIERS; i++) {
+        if (sLinkTierMaps[i].header != NULL) {
+            munmap(sLinkTierMaps[i].header, sLinkTierMaps[i].size);
+        }
+    }
+    memset(sLinkTierMaps, 0, sizeof(sLinkTierMaps));
+    sLinkHistoryEnabled = false;
+}
+
+/* maps the file of a tier, starting it over unless it was written with the same layout */
+static bool mapLinkTier(const char *dir, u32 index) {
+    const link_tier_config *config = &sLinkTiers[index];
+    String8 path = String8::format("%s/link_stats.%s", dir, config->name);
+    size_t size = sizeof(link_tier_header) + config->capacity * sizeof(link_tier_entry);
+
+    int fd = open(path.string(), O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        ALOGE("Error opening %s: %s", path.string(), strerror(errno));
+        return false;
+    }
+    link_tier_header existing;
+    bool valid = pread(fd, &existing, sizeof(existing), 0) == sizeof(existing)
+            && existing.magic == LINK_HISTORY_MAGIC && existing.version == LINK_HISTORY_VERSION
+            && existing.metrics == LINK_METRICS && existing.capacity == config->capacity
+            && existing.period_ms == config->period_ms;
+    struct stat st;
+    valid = valid && fstat(fd, &st) == 0 && (size_t) st.st_size == size;
+    if (!valid && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        ALOGE("Error sizing %s: %s", path.string(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        ALOGE("Error mapping %s: %s", path.string(), strerror(errno));
+        return false;
+    }
+
+    link_tier *tier = &sLinkTierMaps[index];
+    tier->header = (link_tier_header *) base;
+    tier->entries = (link_tier_entry *) (tier->header + 1);
+    tier->size = size;
+    if (!valid) {
+        tier->header->magic = LINK_HISTORY_MAGIC;
+        tier->header->version = LINK_HISTORY_VERSION;
+        tier->header->metrics = LINK_METRICS;
+        tier->header->capacity = config->capacity;
+        tier->header->period_ms = config->period_ms;
+        tier->header->head = 0;
+    }
+    return true;
+}
+
+static void addToTier(link_tier *tier, int64_t time_ms, const int64_t *values) {
+    link_tier_header *header = tier->header;
+    int64_t start_ms = header->period_ms == 0 ? time_ms
+            : time_ms - time_ms % header->period_ms;
+    link_tier_entry *entry = header->head == 0 ? NULL
+            : &tier->entries[(header->head - 1) % header->capacity];
+    /* a clock set back adds to the open entry rather than reordering the ring */
+    if (entry == NULL || header->period_ms == 0 || start_ms > entry->start_ms) {
+        entry = &tier->entries[header->head % header->capacity];
+        entry->start_ms = start_ms;
+        entry->count = 0;
+        header->head++;
+    }
+    for (int i = 0; i < LINK_METRICS; i++) {
+        link_rollup *rollup = &entry->metrics[i];
+        if (entry->count == 0) {
+            rollup->min = rollup->max = rollup->sum = values[i];
+        } else {
+            rollup->min = std::min(rollup->min, values[i]);
+            rollup->max = std::max(rollup->max, values[i]);
+            rollup->sum += values[i];
+        }
+    }
+    entry->count++;
+}
+
+static void recordLinkStats(const wifi_iface_stat *iface, const wifi_radio_stat *radio) {
+    Mutex::Autolock lock(sLinkHistoryLock);
+    if (!sLinkHistoryEnabled) {
+        return;
+    }
+    u32 counters[LINK_COUNTERS];
+    counters[LINK_COUNTER_BEACON_RX] = iface->beacon_rx;
+    counters[LINK_COUNTER_ON_TIME] = radio->on_time;
+    counters[LINK_COUNTER_TX_TIME] = radio->tx_time;
+    counters[LINK_COUNTER_RX_TIME] = radio->rx_time;
+    counters[LINK_COUNTER_ON_TIME_SCAN] = radio->on_time_scan;
+    for (int ac = 0; ac < WIFI_AC_MAX; ac++) {
+        u32 *acCounters = &counters[LINK_COUNTER_AC + 4 * ac];
+        acCounters[0] = iface->ac[ac].rx_mpdu;
+        acCounters[1] = iface->ac[ac].tx_mpdu;
+        acCounters[2] = iface->ac[ac].mpdu_lost;
+        acCounters[3] = iface->ac[ac].retries;
+    }
+
+    u64 deltas[LINK_METRICS];
+    memset(deltas, 0, sizeof(deltas));
+    bool increased = false;
+    bool decreased = false;
+    for (int i = 0; i < LINK_COUNTERS; i++) {
+        int metric = i < LINK_COUNTER_AC ? kLinkCounterMetrics[i]
+                : kLinkAcMetrics[(i - LINK_COUNTER_AC) % 4];
+        increased = increased || counters[i] > sLinkCounters[i];
+        decreased = decreased || counters[i] < sLinkCounters[i];
+        /* modulo 2^32, so that a counter that wrapped still adds its increase */
+        deltas[metric] += (u32) (counters[i] - sLinkCounters[i]);
+    }
+    /*
+     * The firmware restarted its counters if the radio on time went back, or if every counter
+     * that moved went back; one counter going back on its own has wrapped.
+     */
+    bool reset = !sLinkCountersValid
+            || counters[LINK_COUNTER_ON_TIME] < sLinkCounters[LINK_COUNTER_ON_TIME]
+            || (decreased && !increased);
+    memcpy(sLinkCounters, counters, sizeof(counters));
+    sLinkCountersValid = true;
+    if (reset) {
+        return;
+    }
+
+    int64_t values[LINK_METRICS];
+    values[LINK_METRIC_RSSI] = iface->rssi_mgmt;
+    for (int i = LINK_METRIC_RSSI + 1; i < LINK_METRICS; i++) {
+        values[i] = (int64_t) deltas[i];
+    }
+    int64_t time_ms = ns2ms(systemTime(SYSTEM_TIME_REALTIME));
+    for (u32 i = 0; i < LINK_TIERS; i++) {
+        addToTier(&sLinkTierMaps[i], time_ms, values);
+    }
+}
+
+static jboolean android_net_wifi_enable_link_stats_history(JNIEnv *env, jclass cls,
+        jstring jdir) {
+    JNIHelper helper(env, __func__);
+    if (jdir == NULL) {
+        return false;
+    }
+    ScopedUtfChars dir(env, jdir);
+    if (dir.c_str() == NULL) {
+        return false;
+    }
+
+    Mutex::Autolock lock(sLinkHistoryLock);
+    unmapLinkTiers();
+    if (mkdir(dir.c_str(), 0770) != 0 && errno != EEXIST) {
+        ALOGE("Error creating %s: %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+    for (u32 i = 0; i < LINK_TIERS; i++) {
+        if (!mapLinkTier(dir.c_str(), i)) {
+            unmapLinkTiers();
+            return false;
+        }
+    }
+    sLinkCountersValid = false;
+    sLinkHistoryEnabled = true;
+    return true;
+}
+
+/* stops recording; with a dir, also deletes the tier files recorded there */
+static void android_net_wifi_disable_link_stats_history(JNIEnv *env, jclass cls, jstring jdir) {
+    JNIHelper helper(env, __func__);
+    {
+        Mutex::Autolock lock(sLinkHistoryLock);
+        unmapLinkTiers();
+    }
+    if (jdir == NULL) {
+        return;
+    }
+    ScopedUtfChars dir(env, jdir);
+    if (dir.c_str() == NULL) {
+        return;
+    }
+    for (u32 i = 0; i < LINK_TIERS; i++) {
+        String8 path = String8::format("%s/link_stats.%s", dir.c_str(), sLinkTiers[i].name);
+        if (unlink(path.string()) != 0 && errno != ENOENT) {
+            ALOGE("Error deleting %s: %s", path.string(), strerror(errno));
+        }
+    }
+}
+
+/*
+ * Returns the entries of a tier that start between fromMs and toMs (wall clock, inclusive),
+ * oldest first, packed as start time, count, min, max and mean of the metric; a raw sample is
+ * an entry with a count of one.
+ */
+static jlongArray android_net_wifi_get_link_stats_series(JNIEnv *env, jclass cls, jint tier,
+        jint metric, jlong fromMs, jlong toMs) {
+    JNIHelper helper(env, __func__);
+    if (tier < 0 || tier >= (jint) LINK_TIERS || metric < 0 || metric >= LINK_METRICS) {
+        return NULL;
+    }
+
+    std::vector<jlong> series;
+    {
+        Mutex::Autolock lock(sLinkHistoryLock);
+        if (!sLinkHistoryEnabled) {
+            return NULL;
+        }
+        const link_tier *t = &sLinkTierMaps[tier];
+        u64 head = t->header->head;
+        u64 first = head > t->header->capacity ? head - t->header->capacity : 0;
+        for (u64 i = first; i < head; i++) {
+            const link_tier_entry *entry = &t->entries[i % t->header->capacity];
+            if (entry->start_ms < fromMs || entry->start_ms > toMs || entry->count <= 0) {
+                continue;
+            }
+            const link_rollup *rollup = &entry->metrics[metric];
+            series.push_back(entry->start_ms);
+            series.push_back(entry->count);
+            series.push_back(rollup->min);
+            series.push_back(rollup->max);
+            series.push_back(rollup->sum / entry->count);
+        }
+    }
+
+    JNIObject<jlongArray> result = helper.newLongArray(series.size());
+    if (result == NULL) {
+        ALOGE("android_net_wifi_get_link_stats_series: error allocating array object");
+        return NULL;
+    }
+    helper.setLongArrayRegion(result, 0, series.size(), series.data());
+    return result.detach();
+}
+
+/*
+ * Scan fingerprints. Each scan is summarized by a MinHash signature over its BSSIDs and, as a
+ * second token per AP, the BSSID with its RSSI in 10dB bins, so that the estimated Jaccard
+ * similarity of two scans drops both when APs come and go and when their signal moves a lot.
+ * The signature is a one permutation MinHash: a token is hashed once, and the hash only competes
+ * for the minimum of the slot its top bits select, which keeps the cost per full scan result
+ * down to one hash. The last SCAN_FINGERPRINTS fingerprints are kept, for
+ * getScanSimilarityNative() to compare the latest one against.
+ *
+ * Drained batches are fingerprinted once each, by scan id. Full scan results are folded into a
+ * pending fingerprint as they arrive, which is complete at the next scan event; it is only kept
+ * if no drain covered that scan by the time the next scan's results start.
+ */
+
+#define SCAN_FINGERPRINT_SLOTS      64     /* a power of 2 */
+#define SCAN_FINGERPRINT_EMPTY      UINT64_MAX
+#define SCAN_FINGERPRINTS           16
+#define SCAN_FINGERPRINT_RSSI_BIN   10
+
+typedef struct {
+    uint64_t minhash[SCAN_FINGERPRINT_SLOTS];
+    int64_t time_ms;                    /* boot time */
+    int aps;
+} scan_fingerprint;
+
+static Mutex sFingerprintLock;
+static scan_fingerprint sFingerprints[SCAN_FINGERPRINTS];
+static u32 sFingerprintCount;           /* ever added; the last one is the latest */
+static scan_fingerprint sPendingFingerprint;
+static bool sPendingStarted;
+static bool sPendingComplete;
+static bool sFingerprintScanIdValid;
+static int sFingerprintScanId;          /* of the last batch fingerprinted */
+
+static uint64_t mixHash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static void startFingerprint(scan_fingerprint *fingerprint) {
+    for (int i = 0; i < SCAN_FINGERPRINT_SLOTS; i++) {
+        fingerprint->minhash[i] = SCAN_FINGERPRINT_EMPTY;
+    }
+    fingerprint->time_ms = ns2ms(systemTime(SYSTEM_TIME_BOOTTIME));
+    fingerprint->aps = 0;
+}
+
+static void addToFingerprint(scan_fingerprint *fingerprint, const wifi_scan_result *result) {
+    int bin = (std::min(0, std::max(-127, (int) result->rssi)) + 127)
+            / SCAN_FINGERPRINT_RSSI_BIN;
+    uint64_t bssid = macToKey(result->bssid);
+    uint64_t tokens[2] = { mixHash(bssid), mixHash(bssid | (uint64_t) (bin + 1) << 48) };
+    for (uint64_t hash : tokens) {
+        uint64_t *slot = &fingerprint->minhash[hash % SCAN_FINGERPRINT_SLOTS];
+        *slot = std::min(*slot, hash / SCAN_FINGERPRINT_SLOTS);
+    }
+    fingerprint->aps++;
+}
+
+/* in thousandths; slots empty in both say nothing, and two empty scans are the same */
+static int fingerprintSimilarity(const scan_fingerprint *a, const scan_fingerprint *b) {
+    int matches = 0;
+    int slots = 0;
+    for (int k = 0; k < SCAN_FINGERPRINT_SLOTS; k++) {
+        if (a->minhash[k] != SCAN_FINGERPRINT_EMPTY || b->minhash[k] != SCAN_FINGERPRINT_EMPTY) {
+            matches += a->minhash[k] == b->minhash[k];
+            slots++;
+        }
+    }
+    return slots == 0 ? 1000 : matches * 1000 / slots;
+}
+
+static void controlScanPeriod(int similarity);
+
+static void addFingerprint(const scan_fingerprint *fingerprint) {
+    int similarity = sFingerprintCount == 0 ? -1 : fingerprintSimilarity(fingerprint,
+            &sFingerprints[(sFingerprintCount - 1) % SCAN_FINGERPRINTS]);
+    sFingerprints[sFingerprintCount % SCAN_FINGERPRINTS] = *fingerprint;
+    sFingerprintCount++;
+    controlScanPeriod(similarity);
+}
+
+static void addFullScanFingerprint(const wifi_scan_result *result) {
+    Mutex::Autolock lock(sFingerprintLock);
+    if (sPendingComplete) {
+        addFingerprint(&sPendingFingerprint);
+        sPendingStarted = sPendingComplete = false;
+    }
+    if (!sPendingStarted) {
+        startFingerprint(&sPendingFingerprint);
+        sPendingStarted = true;
+    }
+    addToFingerprint(&sPendingFingerprint, result);
+}
+
+static void completeFullScanFingerprint() {
+    Mutex::Autolock lock(sFingerprintLock);
+    sPendingComplete = sPendingStarted;
+}
+
+static void addScanFingerprints(const wifi_cached_scan_results *batches, int num_batches) {
+    Mutex::Autolock lock(sFingerprintLock);
+    sPendingStarted = sPendingComplete = false;
+    for (int i = 0; i < num_batches; i++) {
+        const wifi_cached_scan_results *batch = &batches[i];
+        /* batches that were not flushed are drained again */
+        if ((sFingerprintScanIdValid && batch->scan_id <= sFingerprintScanId)
+                || batch->num_results < 0 || batch->num_results > MAX_AP_CACHE_PER_SCAN) {
+            continue;
+        }
+        scan_fingerprint fingerprint;
+        startFingerprint(&fingerprint);
+        for (int j = 0; j < batch->num_results; j++) {
+            addToFingerprint(&fingerprint, &batch->results[j]);
+        }
+        addFingerprint(&fingerprint);
+        sFingerprintScanId = batch->scan_id;
+        sFingerprintScanIdValid = true;
+    }
+}
+
+/* a restarted gscan may number its scans from the start again */
+static void resetFingerprintScanId() {
+    Mutex::Autolock lock(sFingerprintLock);
+    sFingerprintScanIdValid = false;
+}
+
+static void resetScanFingerprints() {
+    Mutex::Autolock lock(sFingerprintLock);
+    sFingerprintCount = 0;
+    sPendingStarted = sPendingComplete = false;
+    sFingerprintScanIdValid = false;
+}
+
+/*
+ * Returns the similarity, in thousandths, of the latest scan fingerprint to each of the n before
+ * it, the most recent first; fewer if there are not as many. Returns null if there is no scan
+ * fingerprint yet.
+ */
+static jintArray android_net_wifi_get_scan_similarity(JNIEnv *env, jclass cls, jint n) {
+    JNIHelper helper(env, __func__);
+    jint similarity[SCAN_FINGERPRINTS];
+    int count;
+    {
+        Mutex::Autolock lock(sFingerprintLock);
+        if (sFingerprintCount == 0 || n < 0) {
+            return NULL;
+        }
+        count = std::min((u32) std::min(n, SCAN_FINGERPRINTS - 1), sFingerprintCount - 1);
+        const scan_fingerprint *latest =
+                &sFingerprints[(sFingerprintCount - 1) % SCAN_FINGERPRINTS];
+        for (int i = 0; i < count; i++) {
+            similarity[i] = fingerprintSimilarity(latest,
+                    &sFingerprints[(sFingerprintCount - 2 - i) % SCAN_FINGERPRINTS]);
+        }
+    }
+
+    JNIObject<jintArray> result = helper.newIntArray(count);
+    if (result == NULL) {
+        ALOGE("android_net_wifi_get_scan_similarity: error allocating array object");
+        return NULL;
+    }
+    helper.setIntArrayRegion(result, 0, count, similarity);
+    return result.detach();
+}
+
+/*
+ * Scan period control. While a gscan runs and control is enabled, every fingerprinted scan is
+ * weighed with the RSSI of the link layer stats polls and the motion hint from the framework,
+ * and the schedule the framework asked for is stretched by a power of 2 while the environment
+ * stays the same, up to the configured maximum period. A stretch takes SCAN_CONTROL_STABLE_SCANS
+ * stable scans in a row and the configured hold time since the last restart; any sign of change
+ * goes back to the requested schedule at once. The decisions are taken in HAL callbacks, which
+ * only set the target level: the gscan is restarted by applyScanPeriodNative(), which the
+ * framework calls under its lock when it reads the scan results and when it changes the motion
+ * hint. Every decision is logged, for the dump.
+ */
+
+#define SCAN_CONTROL_MAX_LEVEL              6
+#define SCAN_CONTROL_STABLE_SIMILARITY      800
+#define SCAN_CONTROL_CHANGED_SIMILARITY     500
+#define SCAN_CONTROL_STABLE_SCANS           3
+#define SCAN_CONTROL_STABLE_RSSI_SD         30      /* in tenths of dB */
+#define SCAN_CONTROL_CHANGED_RSSI_SD        60
+#define SCAN_CONTROL_RSSI_SAMPLES           8
+#define SCAN_CONTROL_RSSI_MAX_AGE_MS        (60 * 1000)
+#define SCAN_CONTROL_LOG                    64
+
+enum {
+    SCAN_CONTROL_HOLD,
+    SCAN_CONTROL_STRETCH,
+    SCAN_CONTROL_DEFER,                 /* stable, but restarted too recently */
+    SCAN_CONTROL_CHANGED,
+    SCAN_CONTROL_RSSI,
+    SCAN_CONTROL_MOVING,
+    SCAN_CONTROL_DISABLED,
+    SCAN_CONTROL_FAILED,                /* the stretched schedule could not be started */
+};
+
+static const char *const sScanControlReasons[] = {
+    "hold", "stretch", "defer", "changed", "rssi", "moving", "disabled", "failed",
+};
+
+typedef struct {
+    int64_t time_ms;                    /* boot time */
+    int similarity;                     /* to the previous scan, -1 if none */
+    int rssi_sd;                        /* tenths of dB, -1 if too few polls */
+    bool moving;
+    int from;
+    int to;
+    int reason;
+} scan_control_decision;
+
+static Mutex sScanControlLock;
+static int sScanControlMaxPeriodMs;     /* 0: disabled */
+static int sScanControlHoldMs;
+static bool sScanControlMoving;
+static bool sScanControlActive;         /* a gscan is running */
+static wifi_interface_handle sScanControlHandle;
+static wifi_request_id sScanControlId;
+static wifi_scan_cmd_params sScanControlParams;     /* as the framework asked */
+static wifi_scan_result_handler sScanControlHandler;
+static int sScanControlLevel;           /* the gscan runs with periods << level */
+static int sScanControlTarget;
+static int sScanControlStable;
+static int64_t sScanControlRestartMs;
+static int sScanControlRssi[SCAN_CONTROL_RSSI_SAMPLES];
+static int64_t sScanControlRssiMs[SCAN_CONTROL_RSSI_SAMPLES];
+static u32 sScanControlRssiCount;
+static scan_control_decision sScanControlLog[SCAN_CONTROL_LOG];
+static u32 sScanControlLogCount;
+
+static int maxScanControlLevel() {
+    int minPeriod = std::numeric_limits<int>::max();
+    for (int i = 0; i < sScanControlParams.num_buckets; i++) {
+        if (sScanControlParams.buckets[i].period > 0) {
+            minPeriod = std::min(minPeriod, sScanControlParams.buckets[i].period);
+        }
+    }
+    int level = 0;
+    while (level < SCAN_CONTROL_MAX_LEVEL
+            && ((int64_t) minPeriod << (level + 1)) <= sScanControlMaxPeriodMs) {
+        level++;
+    }
+    return level;
+}
+
+/* the requested schedule stretched; periods stay multiples of the base period */
+static void stretchScanParams(int level, wifi_scan_cmd_params *params) {
+    *params = sScanControlParams;
+    int64_t base = std::max(1, params->base_period);
+    int64_t cap = sScanControlMaxPeriodMs / base * base;
+    for (int i = 0; i < params->num_buckets; i++) {
+        wifi_scan_bucket_spec *bucket = &params->buckets[i];
+        int64_t period = std::max((int64_t) bucket->period,
+                std::min((int64_t) bucket->period << level, cap));
+        if (bucket->max_period > 0) {
+            bucket->max_period = std::max(period, std::max((int64_t) bucket->max_period,
+                    std::min((int64_t) bucket->max_period << level, cap)));
+        }
+        bucket->period = period;
+    }
+}
+
+static int scanControlRssiSd(int64_t now_ms) {
+    int64_t sum = 0;
+    int64_t squares = 0;
+    int n = 0;
+    for (u32 i = 0; i < std::min(sScanControlRssiCount, (u32) SCAN_CONTROL_RSSI_SAMPLES); i++) {
+        if (now_ms - sScanControlRssiMs[i] <= SCAN_CONTROL_RSSI_MAX_AGE_MS) {
+            sum += sScanControlRssi[i];
+            squares += sScanControlRssi[i] * sScanControlRssi[i];
+            n++;
+        }
+    }
+    if (n < 3) {
+        return -1;
+    }
+    double mean = (double) sum / n;
+    return (int) (sqrt(std::max(0.0, (double) squares / n - mean * mean)) * 10);
+}
+
+static void logScanControl(int64_t now_ms, int similarity, int rssi_sd, int from, int to,
+        int reason) {
+    scan_control_decision *d = &sScanControlLog[sScanControlLogCount % SCAN_CONTROL_LOG];
+    d->time_ms = now_ms;
+    d->similarity = similarity;
+    d->rssi_sd = rssi_sd;
+    d->moving = sScanControlMoving;
+    d->from = from;
+    d->to = to;
+    d->reason = reason;
+    sScanControlLogCount++;
+    if (from != to) {
+        ALOGD("Scan period level %d -> %d (%s, similarity=%d, rssi sd=%d)", from, to,
+                sScanControlReasons[reason], similarity, rssi_sd);
+    }
+}
+
+static void decideScanPeriodLocked(int similarity) {
+    if (!sScanControlActive || sScanControlMaxPeriodMs == 0) {
+        return;
+    }
+    int64_t now_ms = ns2ms(systemTime(SYSTEM_TIME_BOOTTIME));
+    int rssi_sd = scanControlRssiSd(now_ms);
+    int from = sScanControlTarget;
+    int to = from;
+    int reason = SCAN_CONTROL_HOLD;
+    if (sScanControlMoving) {
+        to = 0;
+        reason = SCAN_CONTROL_MOVING;
+    } else if (similarity >= 0 && similarity < SCAN_CONTROL_CHANGED_SIMILARITY) {
+        to = 0;
+        reason = SCAN_CONTROL_CHANGED;
+    } else if (rssi_sd > SCAN_CONTROL_CHANGED_RSSI_SD) {
+        to = 0;
+        reason = SCAN_CONTROL_RSSI;
+    } else if (similarity >= SCAN_CONTROL_STABLE_SIMILARITY
+            && rssi_sd <= SCAN_CONTROL_STABLE_RSSI_SD) {
+        if (++sScanControlStable >= SCAN_CONTROL_STABLE_SCANS && from < maxScanControlLevel()) {
+            if (now_ms - sScanControlRestartMs < sScanControlHoldMs) {
+                reason = SCAN_CONTROL_DEFER;
+            } else {
+                to = from + 1;
+                reason = SCAN_CONTROL_STRETCH;
+            }
+        }
+    } else {
+        sScanControlStable = 0;
+    }
+    if (reason != SCAN_CONTROL_HOLD && reason != SCAN_CONTROL_DEFER) {
+        sScanControlStable = 0;
+    }
+
+    logScanControl(now_ms, similarity, rssi_sd, from, to, reason);
+    sScanControlTarget = to;
+}
+
+static void controlScanPeriod(int similarity) {
+    AutoMutex lock(sScanControlLock);
+    decideScanPeriodLocked(similarity);
+}
+
+static void noteScanControlRssi(int rssi) {
+    AutoMutex lock(sScanControlLock);
+    u32 i = sScanControlRssiCount++ % SCAN_CONTROL_RSSI_SAMPLES;
+    sScanControlRssi[i] = rssi;
+    sScanControlRssiMs[i] = ns2ms(systemTime(SYSTEM_TIME_BOOTTIME));
+}
+
+/* called with sGscanLock held, after the framework started a gscan */
+static void startScanControl(wifi_interface_handle handle, wifi_request_id id,
+        const wifi_scan_cmd_params *params, const wifi_scan_result_handler *handler) {
+    resetFingerprintScanId();
+    AutoMutex lock(sScanControlLock);
+    sScanControlActive = true;
+    sScanControlHandle = handle;
+    sScanControlId = id;
+    sScanControlParams = *params;
+    sScanControlHandler = *handler;
+    sScanControlLevel = sScanControlTarget = 0;
+    sScanControlStable = 0;
+    sScanControlRestartMs = ns2ms(systemTime(SYSTEM_TIME_BOOTTIME));
+}
+
+/* called with sGscanLock held, before the framework stops a gscan */
+static void stopScanControl(wifi_request_id id) {
+    AutoMutex lock(sScanControlLock);
+    if (sScanControlActive && sScanControlId == id) {
+        sScanControlActive = false;
+        sScanControlLevel = sScanControlTarget = 0;
+    }
+}
+
+/*
+ * Restarts the gscan with the schedule of the target level, if it is not the one running;
+ * without holding sScanControlLock over the HAL calls.
+ */
+static void android_net_wifi_apply_scan_period(JNIEnv *env, jclass cls) {
+    AutoMutex gscanLock(sGscanLock);
+    wifi_interface_handle handle;
+    wifi_request_id id;
+    wifi_scan_cmd_params params;
+    wifi_scan_result_handler handler;
+    int level;
+    {
+        AutoMutex lock(sScanControlLock);
+        if (!sScanControlActive || sScanControlTarget == sScanControlLevel) {
+            return;
+        }
+        level = sScanControlTarget;
+        handle = sScanControlHandle;
+        id = sScanControlId;
+        handler = sScanControlHandler;
+        stretchScanParams(level, &params);
+    }
+
+    hal_fn.wifi_stop_gscan(id, handle);
+    bool started = hal_fn.wifi_start_gscan(id, handle, params, handler) == WIFI_SUCCESS;
+    if (!started && level != 0) {
+        stretchScanParams(0, &params);
+        started = hal_fn.wifi_start_gscan(id, handle, params, handler) == WIFI_SUCCESS;
+        level = 0;
+    }
+    resetFingerprintScanId();
+
+    AutoMutex lock(sScanControlLock);
+    int64_t now_ms = ns2ms(systemTime(SYSTEM_TIME_BOOTTIME));
+    sScanControlRestartMs = now_ms;
+    if (!started) {
+        ALOGE("Error restarting gscan %d; scan period control stops", id);
+        sScanControlActive = false;
+        sScanControlLevel = sScanControlTarget = 0;
+    } else if (level != sScanControlTarget) {
+        logScanControl(now_ms, -1, -1, sScanControlTarget, level, SCAN_CONTROL_FAILED);
+        sScanControlLevel = sScanControlTarget = level;
+    } else {
+        sScanControlLevel = level;
+    }
+}
+
+static void resetScanControl() {
+    AutoMutex lock(sScanControlLock);
+    sScanControlActive = false;
+    sScanControlMaxPeriodMs = 0;
+    sScanControlMoving = false;
+    sScanControlLevel = sScanControlTarget = 0;
+    sScanControlRssiCount = 0;
+}
+
+/*
+ * A maxPeriodMs of 0 disables the control, going back to the requested schedule at the next
+ * apply; holdMs is the least time between a restart of the gscan and a stretch.
+ */
+static jboolean android_net_wifi_set_scan_period_control(JNIEnv *env, jclass cls,
+        jint maxPeriodMs, jint holdMs) {
+    if (maxPeriodMs < 0 || holdMs < 0) {
+        return false;
+    }
+    AutoMutex lock(sScanControlLock);
+    sScanControlMaxPeriodMs = maxPeriodMs;
+    sScanControlHoldMs = holdMs;
+    int to = std::min(sScanControlTarget, maxScanControlLevel());
+    if (maxPeriodMs == 0) {
+        to = 0;
+    }
+    if (sScanControlActive && to != sScanControlTarget) {
+        logScanControl(ns2ms(systemTime(SYSTEM_TIME_BOOTTIME)), -1, -1, sScanControlTarget, to,
+                SCAN_CONTROL_DISABLED);
+        sScanControlTarget = to;
+    }
+    return true;
+}
+
+static void android_net_wifi_set_scan_motion_hint(JNIEnv *env, jclass cls, jboolean moving) {
+    AutoMutex lock(sScanControlLock);
+    sScanControlMoving = moving;
+    if (moving) {
+        decideScanPeriodLocked(-1);
+    }
+}
+
+static jstring android_net_wifi_get_scan_period_control_log(JNIEnv *env, jclass cls) {
+    JNIHelper helper(env, __func__);
+    String8 log;
+    {
+        AutoMutex lock(sScanControlLock);
+        int64_t now_ms = ns2ms(systemTime(SYSTEM_TIME_BOOTTIME));
+        log.appendFormat("max period %dms, %s, level %d", sScanControlMaxPeriodMs,
+                sScanControlActive ? "gscan running" : "no gscan", sScanControlLevel);
+        u32 first = sScanControlLogCount > SCAN_CONTROL_LOG
+                ? sScanControlLogCount - SCAN_CONTROL_LOG : 0;
+        for (u32 i = first; i < sScanControlLogCount; i++) {
+            const scan_control_decision *d = &sScanControlLog[i % SCAN_CONTROL_LOG];
+            log.appendFormat("\n  -%llds similarity=%d", (long long) (now_ms - d->time_ms) / 1000,
+                    d->similarity);
+            if (d->rssi_sd >= 0) {
+                log.appendFormat(" rssiSd=%d.%d", d->rssi_sd / 10, d->rssi_sd % 10);
+            }
+            log.appendFormat("%s %d->%d %s", d->moving ? " moving" : "", d->from, d->to,
+                    sScanControlReasons[d->reason]);
+        }
+    }
+    return helper.newStringUTF(log.string()).detach();
+}
+
 static jbyteArray android_net_wifi_readKernelLog(JNIEnv *env, jclass cls) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     ALOGV("Reading kernel logs");
 
     int size = klogctl(/* SYSLOG_ACTION_SIZE_BUFFER */ 10, 0, 0);
@@ -2511,7 +5596,7 @@ static jbyteArray android_net_wifi_readKernelLog(JNIEnv *env, jclass cls) {
 
 static jint android_net_wifi_configure_nd_offload(JNIEnv *env, jclass cls,
         jint iface, jboolean enable) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     return hal_fn.wifi_configure_nd_offload(
             getIfaceHandle(helper, cls, iface),
             static_cast<int>(enable));
@@ -2521,7 +5606,8 @@ static jint android_net_wifi_configure_nd_offload(JNIEnv *env, jclass cls,
 // ----------------------------------------------------------------------------
 
 /*
- * JNI registration.
+ * JNI registration. Signatures starting with '!' are fast natives: they must return quickly and
+ * must not call back into Java; they only reach the HAL while the capability cache is cold.
  */
 static JNINativeMethod gWifiMethods[] = {
     /* name, signature, funcPtr */
@@ -2544,6 +5630,10 @@ static JNINativeMethod gWifiMethods[] = {
     { "stopHalNative", "()V", (void*) android_net_wifi_stopHal },
     { "waitForHalEventNative", "()V", (void*) android_net_wifi_waitForHalEvents },
     { "getInterfacesNative", "()I", (void*) android_net_wifi_getInterfaces},
+    { "enableEventRingNative", "(II)Ljava/nio/ByteBuffer;",
+            (void*) android_net_wifi_enable_event_ring},
+    { "waitEventRingNative", "(J)J", (void*) android_net_wifi_wait_event_ring},
+    { "disableEventRingNative", "()V", (void*) android_net_wifi_disable_event_ring},
     { "getInterfaceNameNative", "(I)Ljava/lang/String;", (void*) android_net_wifi_getInterfaceName},
     { "getScanCapabilitiesNative", "(ILcom/android/server/wifi/WifiNative$ScanCapabilities;)Z",
             (void *) android_net_wifi_getScanCapabilities},
@@ -2561,10 +5651,13 @@ static JNINativeMethod gWifiMethods[] = {
             (void*) android_net_wifi_untrackSignificantWifiChange},
     { "getWifiLinkLayerStatsNative", "(I)Landroid/net/wifi/WifiLinkLayerStats;",
             (void*) android_net_wifi_getLinkLayerStats},
+    { "fillWifiLinkLayerStatsNative", "(ILandroid/net/wifi/WifiLinkLayerStats;)Z",
+            (void*) android_net_wifi_fillLinkLayerStats},
     { "setWifiLinkLayerStatsNative", "(II)V",
             (void*) android_net_wifi_setLinkLayerStats},
-    { "getSupportedFeatureSetNative", "(I)I",
+    { "getSupportedFeatureSetNative", "!(I)I",
             (void*) android_net_wifi_getSupportedFeatures},
+    { "querySupportedFeatureSetNative", "(I)I", (void*) android_net_wifi_querySupportedFeatures},
     { "requestRangeNative", "(II[Landroid/net/wifi/RttManager$RttParams;)Z",
             (void*) android_net_wifi_requestRange},
     { "cancelRangeRequestNative", "(II[Landroid/net/wifi/RttManager$RttParams;)Z",
@@ -2577,13 +5670,18 @@ static JNINativeMethod gWifiMethods[] = {
 
     { "setScanningMacOuiNative", "(I[B)Z",  (void*) android_net_wifi_setScanningMacOui},
     { "getChannelsForBandNative", "(II)[I", (void*) android_net_wifi_getValidChannels},
+    { "getChannelsForBandsNative", "(I[I)[[I", (void*) android_net_wifi_getValidChannelsForBands},
     { "setDfsFlagNative",         "(IZ)Z",  (void*) android_net_wifi_setDfsFlag},
+    { "invalidateValidChannelsNative", "()V",
+            (void*) android_net_wifi_invalidate_valid_channels},
     { "setInterfaceUpNative", "(Z)Z",  (void*) android_net_wifi_set_interface_up},
     { "getRttCapabilitiesNative", "(I)Landroid/net/wifi/RttManager$RttCapabilities;",
             (void*) android_net_wifi_get_rtt_capabilities},
     { "getApfCapabilitiesNative", "(I)Landroid/net/apf/ApfCapabilities;",
             (void*) android_net_wifi_get_apf_capabilities},
     { "installPacketFilterNative", "(I[B)Z", (void*) android_net_wifi_install_packet_filter},
+    { "getPacketFilterStatsNative", "(I)Ljava/lang/String;",
+            (void*) android_net_wifi_get_packet_filter_stats},
     {"setCountryCodeHalNative", "(ILjava/lang/String;)Z",
             (void*) android_net_wifi_set_Country_Code_Hal},
     { "setPnoListNative", "(IILcom/android/server/wifi/WifiNative$PnoSettings;)Z",
@@ -2593,9 +5691,11 @@ static JNINativeMethod gWifiMethods[] = {
             (void*) android_net_wifi_enable_disable_tdls},
     {"getTdlsStatusNative", "(ILjava/lang/String;)Lcom/android/server/wifi/WifiNative$TdlsStatus;",
             (void*) android_net_wifi_get_tdls_status},
+    {"getTdlsPeersNative", "(I)[Lcom/android/server/wifi/WifiNative$TdlsStatus;",
+            (void*) android_net_wifi_get_tdls_peers},
     {"getTdlsCapabilitiesNative", "(I)Lcom/android/server/wifi/WifiNative$TdlsCapabilities;",
             (void*) android_net_wifi_get_tdls_capabilities},
-    {"getSupportedLoggerFeatureSetNative","(I)I",
+    {"getSupportedLoggerFeatureSetNative","!(I)I",
             (void*) android_net_wifi_get_supported_logger_feature},
     {"getDriverVersionNative", "(I)Ljava/lang/String;",
             (void*) android_net_wifi_get_driver_version},
@@ -2622,14 +5722,40 @@ static JNINativeMethod gWifiMethods[] = {
              (void*)android_net_wifi_start_sending_offloaded_packet},
     { "stopSendingOffloadedPacketNative", "(II)I",
              (void*)android_net_wifi_stop_sending_offloaded_packet},
+    { "stopSendingAllOffloadedPacketsNative", "(I)I",
+             (void*)android_net_wifi_stop_sending_all_offloaded_packets},
+    { "getOffloadedPacketsNative", "(I)Ljava/lang/String;",
+             (void*)android_net_wifi_get_offloaded_packets},
     {"startRssiMonitoringNative", "(IIBB)I",
             (void*)android_net_wifi_start_rssi_monitoring_native},
     {"stopRssiMonitoringNative", "(II)I",
             (void*)android_net_wifi_stop_rssi_monitoring_native},
     { "getWlanWakeReasonCountNative", "(I)Landroid/net/wifi/WifiWakeReasonAndCounts;",
             (void*) android_net_wifi_get_wlan_wake_reason_count},
-    {"isGetChannelsForBandSupportedNative", "()Z",
+    { "pollWakeReasonsNative", "(I)I", (void*) android_net_wifi_poll_wake_reasons},
+    { "getTopWakeReasonsNative", "(JI)[I", (void*) android_net_wifi_get_top_wake_reasons},
+    {"isGetChannelsForBandSupportedNative", "!()Z",
             (void*)android_net_wifi_is_get_channels_for_band_supported},
+    {"enableScanHistoryNative", "(Ljava/lang/String;II)Z",
+            (void*)android_net_wifi_enable_scan_history},
+    {"disableScanHistoryNative", "(Ljava/lang/String;)V",
+            (void*)android_net_wifi_disable_scan_history},
+    {"queryScanHistoryNative",
+            "(JJLjava/lang/String;I)[Lcom/android/server/wifi/WifiNative$ScanSighting;",
+            (void*)android_net_wifi_query_scan_history},
+    {"getScanHistoryStatsNative", "()Ljava/lang/String;",
+            (void*)android_net_wifi_get_scan_history_stats},
+    {"enableLinkStatsHistoryNative", "(Ljava/lang/String;)Z",
+            (void*)android_net_wifi_enable_link_stats_history},
+    {"disableLinkStatsHistoryNative", "(Ljava/lang/String;)V",
+            (void*)android_net_wifi_disable_link_stats_history},
+    {"getLinkStatsSeriesNative", "(IIJJ)[J", (void*)android_net_wifi_get_link_stats_series},
+    {"getScanSimilarityNative", "(I)[I", (void*)android_net_wifi_get_scan_similarity},
+    {"setScanPeriodControlNative", "(II)Z", (void*)android_net_wifi_set_scan_period_control},
+    {"setScanMotionHintNative", "(Z)V", (void*)android_net_wifi_set_scan_motion_hint},
+    {"applyScanPeriodNative", "()V", (void*)android_net_wifi_apply_scan_period},
+    {"getScanPeriodControlLogNative", "()Ljava/lang/String;",
+            (void*)android_net_wifi_get_scan_period_control_log},
     {"readKernelLogNative", "()[B", (void*)android_net_wifi_readKernelLog},
     {"configureNeighborDiscoveryOffload", "(IZ)I", (void*)android_net_wifi_configure_nd_offload},
 };
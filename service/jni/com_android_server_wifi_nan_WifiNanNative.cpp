@@ -19,11 +19,16 @@
 #include "jni.h"
 #include "JniConstants.h"
 #include <ScopedUtfChars.h>
-#include <ScopedBytes.h>
 #include <utils/misc.h>
 #include <utils/Log.h>
 #include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Mutex.h>
+#include <utils/Condition.h>
+#include <utils/Timers.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <linux/if.h>
@@ -41,6 +46,1582 @@ wifi_interface_handle getIfaceHandle(JNIHelper &helper, jclass cls, jint index);
 
 extern wifi_hal_fn hal_fn;
 
+// Match table
+
+/*
+ * HALs re-report a peer each time it is seen in a discovery window. Matches are
+ * kept in a table keyed by (publish_subscribe_id, requestor_instance_id, addr)
+ * and only reported to the framework when the peer is new or its service
+ * specific info or match filter changed. New matches are queued and delivered
+ * together in one onMatchEvents() upcall: when the batch is full, when the
+ * batch window expires, or ahead of any other NAN event so that the framework
+ * still sees events in the order the HAL delivered them.
+ */
+
+#define NAN_MATCH_TABLE_SIZE        256
+#define NAN_MATCH_BATCH_SIZE        16
+
+/* per match in the onMatchEvents() info array; must match WifiNanNative.java */
+#define NAN_MATCH_INFO_FIELDS       4
+
+typedef struct {
+    u16 publish_subscribe_id;
+    u32 requestor_instance_id;
+    u8 addr[NAN_MAC_ADDR_LEN];
+    u64 payload_hash;               /* of the SSI and match filter */
+    nsecs_t last_seen;
+    bool reported;                  /* the framework has been told about this peer */
+} nan_match_entry;
+
+typedef struct {
+    u16 publish_subscribe_id;
+    u32 requestor_instance_id;
+    u8 addr[NAN_MAC_ADDR_LEN];
+    u16 service_specific_info_len;
+    u8 service_specific_info[NAN_MAX_SERVICE_SPECIFIC_INFO_LEN];
+    u16 sdf_match_filter_len;
+    u8 sdf_match_filter[NAN_MAX_MATCH_FILTER_LEN];
+} nan_pending_match;
+
+static Mutex sMatchLock;                        /* table and pending batch */
+static Condition *sMatchFlushCond = NULL;       /* signalled when a batch is started */
+static nan_match_entry sMatchTable[NAN_MATCH_TABLE_SIZE];
+static int sNumMatches = 0;
+static nan_pending_match sPendingMatches[NAN_MATCH_BATCH_SIZE];
+static int sNumPendingMatches = 0;
+static nsecs_t sPendingSince;
+static int sMatchBatchWindowMs;                /* 0: each new match is delivered at once */
+
+static Mutex sMatchFlushLock;                   /* serializes batch delivery */
+static nan_pending_match sFlushMatches[NAN_MATCH_BATCH_SIZE];
+static jint sFlushInfo[NAN_MATCH_BATCH_SIZE * NAN_MATCH_INFO_FIELDS];
+static u8 sFlushData[NAN_MATCH_BATCH_SIZE * (NAN_MAC_ADDR_LEN
+        + NAN_MAX_SERVICE_SPECIFIC_INFO_LEN + NAN_MAX_MATCH_FILTER_LEN)];
+
+/* FNV-1a; a collision only costs a suppressed payload update */
+static u64 hashBytes(u64 hash, const u8 *bytes, int len) {
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static u64 hashMatchPayload(const NanMatchInd *event) {
+    u8 lens[4] = {
+        (u8) event->service_specific_info_len,
+        (u8) (event->service_specific_info_len >> 8),
+        (u8) event->sdf_match_filter_len,
+        (u8) (event->sdf_match_filter_len >> 8),
+    };
+    u64 hash = hashBytes(14695981039346656037ULL, lens, sizeof(lens));
+    hash = hashBytes(hash, event->service_specific_info, event->service_specific_info_len);
+    return hashBytes(hash, event->sdf_match_filter, event->sdf_match_filter_len);
+}
+
+/*
+ * Records the match in the table and queues it for delivery. Returns the number
+ * of pending matches, or 0 if the peer was already reported with this payload.
+ * Only the HAL callback thread queues matches and it flushes a full batch
+ * before returning, so there is always room for one more.
+ */
+static int queueMatch(const NanMatchInd *event) {
+    if (event->service_specific_info_len > NAN_MAX_SERVICE_SPECIFIC_INFO_LEN
+            || event->sdf_match_filter_len > NAN_MAX_MATCH_FILTER_LEN) {
+        ALOGE("Dropping match with invalid lengths: ssi=%d, filter=%d",
+              event->service_specific_info_len, event->sdf_match_filter_len);
+        return 0;
+    }
+
+    u64 hash = hashMatchPayload(event);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    AutoMutex lock(sMatchLock);
+
+    nan_match_entry *entry = NULL;
+    nan_match_entry *oldest = NULL;
+    for (int i = 0; i < sNumMatches; i++) {
+        nan_match_entry *e = &sMatchTable[i];
+        if (e->publish_subscribe_id == event->publish_subscribe_id
+                && e->requestor_instance_id == event->requestor_instance_id
+                && memcmp(e->addr, event->addr, NAN_MAC_ADDR_LEN) == 0) {
+            entry = e;
+            break;
+        }
+        if (oldest == NULL || e->last_seen < oldest->last_seen) {
+            oldest = e;
+        }
+    }
+
+    if (entry != NULL) {
+        entry->last_seen = now;
+        if (entry->payload_hash == hash) {
+            return 0;
+        }
+    } else {
+        if (sNumMatches < NAN_MATCH_TABLE_SIZE) {
+            entry = &sMatchTable[sNumMatches++];
+        } else {
+            /* the evicted peer is reported again if the HAL sees it again */
+            entry = oldest;
+        }
+        entry->publish_subscribe_id = event->publish_subscribe_id;
+        entry->requestor_instance_id = event->requestor_instance_id;
+        memcpy(entry->addr, event->addr, NAN_MAC_ADDR_LEN);
+        entry->last_seen = now;
+        entry->reported = false;
+    }
+    entry->payload_hash = hash;
+
+    /* a peer whose payload changed before its batch went out is only reported once */
+    nan_pending_match *pending = NULL;
+    for (int i = 0; i < sNumPendingMatches; i++) {
+        nan_pending_match *p = &sPendingMatches[i];
+        if (p->publish_subscribe_id == event->publish_subscribe_id
+                && p->requestor_instance_id == event->requestor_instance_id
+                && memcmp(p->addr, event->addr, NAN_MAC_ADDR_LEN) == 0) {
+            pending = p;
+            break;
+        }
+    }
+    if (pending == NULL) {
+        if (sNumPendingMatches == 0) {
+            sPendingSince = now;
+            if (sMatchFlushCond != NULL) {
+                sMatchFlushCond->signal();
+            }
+        }
+        pending = &sPendingMatches[sNumPendingMatches++];
+        pending->publish_subscribe_id = event->publish_subscribe_id;
+        pending->requestor_instance_id = event->requestor_instance_id;
+        memcpy(pending->addr, event->addr, NAN_MAC_ADDR_LEN);
+    }
+    pending->service_specific_info_len = event->service_specific_info_len;
+    memcpy(pending->service_specific_info, event->service_specific_info,
+           event->service_specific_info_len);
+    pending->sdf_match_filter_len = event->sdf_match_filter_len;
+    memcpy(pending->sdf_match_filter, event->sdf_match_filter, event->sdf_match_filter_len);
+
+    return sNumPendingMatches;
+}
+
+/* delivers the pending batch, if any, in one onMatchEvents() upcall */
+static void flushMatches(JNIHelper &helper) {
+    AutoMutex flushLock(sMatchFlushLock);
+
+    int count;
+    {
+        AutoMutex lock(sMatchLock);
+        count = sNumPendingMatches;
+        if (count == 0) {
+            return;
+        }
+        memcpy(sFlushMatches, sPendingMatches, count * sizeof(nan_pending_match));
+        sNumPendingMatches = 0;
+
+        /* every peer in the table is now either in this batch or delivered before */
+        for (int i = 0; i < sNumMatches; i++) {
+            sMatchTable[i].reported = true;
+        }
+    }
+
+    int dataLen = 0;
+    for (int i = 0; i < count; i++) {
+        const nan_pending_match *match = &sFlushMatches[i];
+        jint *info = &sFlushInfo[i * NAN_MATCH_INFO_FIELDS];
+        info[0] = match->publish_subscribe_id;
+        info[1] = match->requestor_instance_id;
+        info[2] = match->service_specific_info_len;
+        info[3] = match->sdf_match_filter_len;
+
+        memcpy(&sFlushData[dataLen], match->addr, NAN_MAC_ADDR_LEN);
+        dataLen += NAN_MAC_ADDR_LEN;
+        memcpy(&sFlushData[dataLen], match->service_specific_info,
+               match->service_specific_info_len);
+        dataLen += match->service_specific_info_len;
+        memcpy(&sFlushData[dataLen], match->sdf_match_filter, match->sdf_match_filter_len);
+        dataLen += match->sdf_match_filter_len;
+    }
+
+    JNIObject<jintArray> infoInts = helper.newIntArray(count * NAN_MATCH_INFO_FIELDS);
+    JNIObject<jbyteArray> dataBytes = helper.newByteArray(dataLen);
+    if (infoInts == NULL || dataBytes == NULL) {
+        ALOGE("Error in allocating arrays for %d matches", count);
+        return;
+    }
+    helper.setIntArrayRegion(infoInts, 0, count * NAN_MATCH_INFO_FIELDS, sFlushInfo);
+    helper.setByteArrayRegion(dataBytes, 0, dataLen, (jbyte *) sFlushData);
+
+    helper.reportEvent(mCls, "onMatchEvents", "([I[B)V", infoInts.get(), dataBytes.get());
+}
+
+/*
+ * Drops the table entries and pending matches of a publish/subscribe session,
+ * or of one peer of it if match_instance is set. Returns true if a dropped peer
+ * had been reported to the framework.
+ */
+static bool forgetMatches(u16 publish_subscribe_id, u32 requestor_instance_id,
+                          bool match_instance) {
+    AutoMutex lock(sMatchLock);
+
+    bool reported = false;
+    int kept = 0;
+    for (int i = 0; i < sNumMatches; i++) {
+        nan_match_entry *e = &sMatchTable[i];
+        if (e->publish_subscribe_id == publish_subscribe_id
+                && (!match_instance || e->requestor_instance_id == requestor_instance_id)) {
+            reported |= e->reported;
+        } else {
+            sMatchTable[kept++] = *e;
+        }
+    }
+    sNumMatches = kept;
+
+    kept = 0;
+    for (int i = 0; i < sNumPendingMatches; i++) {
+        nan_pending_match *p = &sPendingMatches[i];
+        if (p->publish_subscribe_id == publish_subscribe_id
+                && (!match_instance || p->requestor_instance_id == requestor_instance_id)) {
+            continue;
+        }
+        if (kept != i) {
+            sPendingMatches[kept] = *p;
+        }
+        kept++;
+    }
+    sNumPendingMatches = kept;
+
+    return reported;
+}
+
+static void clearMatches() {
+    AutoMutex lock(sMatchLock);
+    sNumMatches = 0;
+    sNumPendingMatches = 0;
+}
+
+static void *matchFlusherThread(void *) {
+    for (;;) {
+        {
+            AutoMutex lock(sMatchLock);
+            while (sNumPendingMatches == 0) {
+                sMatchFlushCond->wait(sMatchLock);
+            }
+            nsecs_t due = sPendingSince + ms2ns(sMatchBatchWindowMs);
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (now < due) {
+                sMatchFlushCond->waitRelative(sMatchLock, due - now);
+                continue;
+            }
+        }
+
+        JNIHelper helper(mVM, __func__);
+        flushMatches(helper);
+    }
+    return NULL;
+}
+
+static void startMatchFlusher() {
+    AutoMutex lock(sMatchLock);
+    if (sMatchFlushCond != NULL) {
+        return;
+    }
+
+    /*
+     * The flusher lives as long as the process; its condition is never destroyed
+     * so that exiting does not block on a waiter.
+     */
+    sMatchFlushCond = new Condition();
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, matchFlusherThread, NULL) != 0) {
+        ALOGE("Error starting the match flusher; matches are delivered as batches fill");
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Session table
+
+/*
+ * Publish and subscribe sessions are tracked natively: the bridge records each
+ * outstanding publish, subscribe and cancel transaction, binds the
+ * publish/subscribe id from the HAL response to the session and keeps its
+ * configuration, the peers it has seen and per-session counters. Cancel
+ * responses are consumed here instead of being forwarded to the framework,
+ * duplicate terminations are dropped, and the whole table is available to
+ * dumpsys through dumpSessionsNative(). Terminated sessions stay in the table
+ * until their slot is needed, so a dump shows how recent sessions ended.
+ *
+ * sSessionLock is never held while calling the HAL, the framework or taking
+ * another lock.
+ */
+
+#define NAN_SESSION_TABLE_SIZE      32
+#define NAN_SESSION_MAX_PEERS       32
+#define NAN_SESSION_NAME_LEN        32      /* service name prefix kept for dumps */
+#define NAN_TRANSACTION_TABLE_SIZE  64
+
+typedef enum {
+    NAN_TRANSACTION_FREE = 0,
+    NAN_TRANSACTION_PUBLISH,
+    NAN_TRANSACTION_SUBSCRIBE,
+    NAN_TRANSACTION_PUBLISH_CANCEL,
+    NAN_TRANSACTION_SUBSCRIBE_CANCEL,
+} nan_transaction_type;
+
+typedef enum {
+    NAN_SESSION_FREE = 0,
+    NAN_SESSION_ACTIVE,
+    NAN_SESSION_CANCELLING,
+    NAN_SESSION_TERMINATED,
+} nan_session_state;
+
+typedef struct {
+    bool publish;
+    int type;                       /* NanPublishType or NanSubscribeType */
+    int count;
+    int ttl;
+    char service_name[NAN_SESSION_NAME_LEN];
+} nan_session_config;
+
+typedef struct {
+    nan_transaction_type type;
+    transaction_id id;
+    u16 publish_subscribe_id;       /* 0 for a new publish or subscribe */
+    nan_session_config config;
+} nan_transaction;
+
+typedef struct {
+    nan_session_state state;
+    u16 publish_subscribe_id;
+    nan_session_config config;
+    int terminate_reason;
+    bool terminate_reported;        /* the framework has seen the session end */
+    nsecs_t started;
+    nsecs_t ended;
+    u32 peers[NAN_SESSION_MAX_PEERS];   /* requestor instance ids */
+    int num_peers;
+    u32 matches;
+    u32 matches_expired;
+    u32 followups_sent;
+    u32 followups_failed;
+    u32 followups_received;
+    u32 failures;                   /* failed updates and cancels */
+} nan_session;
+
+static Mutex sSessionLock;
+static nan_transaction sTransactions[NAN_TRANSACTION_TABLE_SIZE];
+static nan_session sSessions[NAN_SESSION_TABLE_SIZE];
+static u32 sUnknownResponses = 0;
+
+static const char *sessionStateName(nan_session_state state) {
+    switch (state) {
+        case NAN_SESSION_ACTIVE: return "active";
+        case NAN_SESSION_CANCELLING: return "cancelling";
+        case NAN_SESSION_TERMINATED: return "terminated";
+        default: return "free";
+    }
+}
+
+/* the service name is kept truncated, for the dump */
+static void setSessionConfig(nan_session_config *config, bool publish, int type, int count,
+                             int ttl, const u8 *serviceName, int serviceNameLen) {
+    config->publish = publish;
+    config->type = type;
+    config->count = count;
+    config->ttl = ttl;
+    int len = serviceNameLen < NAN_SESSION_NAME_LEN ? serviceNameLen : NAN_SESSION_NAME_LEN - 1;
+    memcpy(config->service_name, serviceName, len);
+    config->service_name[len] = 0;
+}
+
+static nan_session *findSession(u16 publish_subscribe_id) {
+    for (int i = 0; i < NAN_SESSION_TABLE_SIZE; i++) {
+        if (sSessions[i].state != NAN_SESSION_FREE
+                && sSessions[i].publish_subscribe_id == publish_subscribe_id) {
+            return &sSessions[i];
+        }
+    }
+    return NULL;
+}
+
+/* a free slot, else the one terminated longest ago; NULL if all are live */
+static nan_session *allocSession() {
+    nan_session *oldest = NULL;
+    for (int i = 0; i < NAN_SESSION_TABLE_SIZE; i++) {
+        nan_session *s = &sSessions[i];
+        if (s->state == NAN_SESSION_FREE) {
+            return s;
+        }
+        if (s->state == NAN_SESSION_TERMINATED && (oldest == NULL || s->ended < oldest->ended)) {
+            oldest = s;
+        }
+    }
+    return oldest;
+}
+
+static void endSession(nan_session *s, int reason, bool reported) {
+    s->state = NAN_SESSION_TERMINATED;
+    s->terminate_reason = reason;
+    s->terminate_reported = reported;
+    s->ended = systemTime(SYSTEM_TIME_MONOTONIC);
+    s->num_peers = 0;
+}
+
+static void addPeer(nan_session *s, u32 requestor_instance_id) {
+    for (int i = 0; i < s->num_peers; i++) {
+        if (s->peers[i] == requestor_instance_id) {
+            return;
+        }
+    }
+    if (s->num_peers < NAN_SESSION_MAX_PEERS) {
+        s->peers[s->num_peers++] = requestor_instance_id;
+    }
+}
+
+static void removePeer(nan_session *s, u32 requestor_instance_id) {
+    for (int i = 0; i < s->num_peers; i++) {
+        if (s->peers[i] == requestor_instance_id) {
+            s->peers[i] = s->peers[--s->num_peers];
+            return;
+        }
+    }
+}
+
+/* records an outstanding request; untracked requests are simply forwarded as before */
+static void trackTransaction(transaction_id id, nan_transaction_type type,
+                             u16 publish_subscribe_id, const nan_session_config *config) {
+    AutoMutex lock(sSessionLock);
+
+    nan_transaction *t = NULL;
+    for (int i = 0; i < NAN_TRANSACTION_TABLE_SIZE; i++) {
+        if (sTransactions[i].type == NAN_TRANSACTION_FREE || sTransactions[i].id == id) {
+            t = &sTransactions[i];
+            break;
+        }
+    }
+    if (t == NULL) {
+        ALOGE("Transaction table full, id=%d not tracked", id);
+        return;
+    }
+
+    t->type = type;
+    t->id = id;
+    t->publish_subscribe_id = publish_subscribe_id;
+    if (config != NULL) {
+        t->config = *config;
+    }
+
+    if (type == NAN_TRANSACTION_PUBLISH_CANCEL || type == NAN_TRANSACTION_SUBSCRIBE_CANCEL) {
+        nan_session *s = findSession(publish_subscribe_id);
+        if (s != NULL && s->state == NAN_SESSION_ACTIVE) {
+            s->state = NAN_SESSION_CANCELLING;
+        }
+    }
+}
+
+/* drops a transaction the HAL refused, so no response will come for it */
+static void untrackTransaction(transaction_id id) {
+    AutoMutex lock(sSessionLock);
+    for (int i = 0; i < NAN_TRANSACTION_TABLE_SIZE; i++) {
+        if (sTransactions[i].type != NAN_TRANSACTION_FREE && sTransactions[i].id == id) {
+            sTransactions[i].type = NAN_TRANSACTION_FREE;
+            return;
+        }
+    }
+}
+
+/*
+ * Correlates a publish, subscribe or cancel response with its request and
+ * updates the session it belongs to. Returns true if the response was consumed
+ * and need not be forwarded to the framework.
+ */
+static bool completeTransaction(transaction_id id, const NanResponseMsg *msg) {
+    nan_transaction_type type;
+    switch (msg->response_type) {
+        case NAN_RESPONSE_PUBLISH: type = NAN_TRANSACTION_PUBLISH; break;
+        case NAN_RESPONSE_SUBSCRIBE: type = NAN_TRANSACTION_SUBSCRIBE; break;
+        case NAN_RESPONSE_PUBLISH_CANCEL: type = NAN_TRANSACTION_PUBLISH_CANCEL; break;
+        case NAN_RESPONSE_SUBSCRIBE_CANCEL: type = NAN_TRANSACTION_SUBSCRIBE_CANCEL; break;
+        default: return false;
+    }
+
+    AutoMutex lock(sSessionLock);
+
+    nan_transaction *t = NULL;
+    for (int i = 0; i < NAN_TRANSACTION_TABLE_SIZE; i++) {
+        if (sTransactions[i].type == type && sTransactions[i].id == id) {
+            t = &sTransactions[i];
+            break;
+        }
+    }
+    if (t == NULL) {
+        sUnknownResponses++;
+        return false;
+    }
+    t->type = NAN_TRANSACTION_FREE;
+
+    if (type == NAN_TRANSACTION_PUBLISH || type == NAN_TRANSACTION_SUBSCRIBE) {
+        u16 publish_subscribe_id = type == NAN_TRANSACTION_PUBLISH
+                ? msg->body.publish_response.publish_id
+                : msg->body.subscribe_response.subscribe_id;
+        nan_session *s = findSession(t->publish_subscribe_id != 0
+                ? t->publish_subscribe_id : publish_subscribe_id);
+        if (msg->status != NAN_STATUS_SUCCESS) {
+            if (s != NULL && t->publish_subscribe_id != 0) {
+                s->failures++;
+            }
+            return false;
+        }
+
+        if (s == NULL || s->state == NAN_SESSION_TERMINATED || t->publish_subscribe_id == 0) {
+            if (s == NULL) {
+                s = allocSession();
+            }
+            if (s == NULL) {
+                ALOGE("Session table full, publish_subscribe_id=%d not tracked",
+                      publish_subscribe_id);
+                return false;
+            }
+            memset(s, 0, sizeof(*s));
+            s->started = systemTime(SYSTEM_TIME_MONOTONIC);
+        }
+        s->state = NAN_SESSION_ACTIVE;
+        s->publish_subscribe_id = publish_subscribe_id;
+        s->config = t->config;
+        return false;
+    }
+
+    /* cancel: the framework has already let go of the session */
+    nan_session *s = findSession(t->publish_subscribe_id);
+    if (msg->status != NAN_STATUS_SUCCESS) {
+        ALOGE("Cancel of publish_subscribe_id=%d failed: status=%d, value=%d",
+              t->publish_subscribe_id, msg->status, msg->value);
+        if (s != NULL) {
+            s->failures++;
+            if (s->state == NAN_SESSION_CANCELLING) {
+                s->state = NAN_SESSION_ACTIVE;
+            }
+        }
+    } else if (s != NULL && s->state != NAN_SESSION_TERMINATED) {
+        /* the terminated indication that may follow is still forwarded */
+        endSession(s, NAN_TERMINATED_REASON_USER_REQUEST, false);
+    }
+    return true;
+}
+
+/*
+ * Ends a session on a terminated indication. Returns false if the framework
+ * has already been told that the session ended, in which case the indication
+ * is a duplicate and is not forwarded.
+ */
+static bool terminateSession(u16 publish_subscribe_id, int reason) {
+    AutoMutex lock(sSessionLock);
+    nan_session *s = findSession(publish_subscribe_id);
+    if (s == NULL) {
+        return true;
+    }
+    if (s->state == NAN_SESSION_TERMINATED) {
+        if (s->terminate_reported) {
+            return false;
+        }
+        s->terminate_reported = true;
+        return true;
+    }
+    endSession(s, reason, true);
+    return true;
+}
+
+static void endAllSessions(int reason) {
+    AutoMutex lock(sSessionLock);
+    for (int i = 0; i < NAN_SESSION_TABLE_SIZE; i++) {
+        if (sSessions[i].state != NAN_SESSION_FREE
+                && sSessions[i].state != NAN_SESSION_TERMINATED) {
+            endSession(&sSessions[i], reason, true);
+        }
+    }
+    for (int i = 0; i < NAN_TRANSACTION_TABLE_SIZE; i++) {
+        sTransactions[i].type = NAN_TRANSACTION_FREE;
+    }
+}
+
+static void resetSessions() {
+    AutoMutex lock(sSessionLock);
+    memset(sSessions, 0, sizeof(sSessions));
+    memset(sTransactions, 0, sizeof(sTransactions));
+    sUnknownResponses = 0;
+}
+
+static void countMatch(u16 publish_subscribe_id, u32 requestor_instance_id) {
+    AutoMutex lock(sSessionLock);
+    nan_session *s = findSession(publish_subscribe_id);
+    if (s != NULL && s->state != NAN_SESSION_TERMINATED) {
+        s->matches++;
+        addPeer(s, requestor_instance_id);
+    }
+}
+
+static void countMatchExpired(u16 publish_subscribe_id, u32 requestor_instance_id) {
+    AutoMutex lock(sSessionLock);
+    nan_session *s = findSession(publish_subscribe_id);
+    if (s != NULL && s->state != NAN_SESSION_TERMINATED) {
+        s->matches_expired++;
+        removePeer(s, requestor_instance_id);
+    }
+}
+
+static void countFollowupReceived(u16 publish_subscribe_id, u32 requestor_instance_id) {
+    AutoMutex lock(sSessionLock);
+    nan_session *s = findSession(publish_subscribe_id);
+    if (s != NULL && s->state != NAN_SESSION_TERMINATED) {
+        s->followups_received++;
+        addPeer(s, requestor_instance_id);
+    }
+}
+
+static void countFollowupResult(u16 publish_subscribe_id, int status) {
+    AutoMutex lock(sSessionLock);
+    nan_session *s = findSession(publish_subscribe_id);
+    if (s != NULL) {
+        if (status == NAN_STATUS_SUCCESS) {
+            s->followups_sent++;
+        } else {
+            s->followups_failed++;
+        }
+    }
+}
+
+// Follow-up queue
+
+/*
+ * Follow-up messages are queued natively and pipelined to the HAL: up to a
+ * window of transmit requests are outstanding at once. A response in
+ * OnNanNotifyResponse only completes its request; if that frees a place for a
+ * queued message, onFollowupsReady() tells the framework, which submits the
+ * queue through transmitQueuedMessagesNative() under WifiNative.sLock, so the
+ * HAL is never re-entered from its own callback. The HAL does
+ * not report how many follow-ups the firmware can buffer, so the window is
+ * learned: it grows by one after a window's worth of successes and halves when
+ * the firmware answers NAN_STATUS_NO_SPACE_AVAILABLE, in which case the
+ * message is queued again instead of failing. Results that complete together
+ * are delivered to the framework in one onMessageSendResults() upcall.
+ */
+
+#define NAN_FOLLOWUP_QUEUE_SIZE         32
+#define NAN_FOLLOWUP_WINDOW_INITIAL     4
+#define NAN_FOLLOWUP_WINDOW_MAX         16
+#define NAN_FOLLOWUP_MAX_RETRIES        3
+
+typedef enum {
+    NAN_FOLLOWUP_FREE = 0,
+    NAN_FOLLOWUP_QUEUED,
+    NAN_FOLLOWUP_IN_FLIGHT,
+} nan_followup_state;
+
+typedef struct {
+    nan_followup_state state;
+    transaction_id id;
+    wifi_interface_handle handle;
+    int retries;
+    NanTransmitFollowupRequest msg;
+} nan_followup;
+
+typedef struct {
+    transaction_id id;
+    u16 publish_subscribe_id;
+    int status;
+} nan_followup_result;
+
+static Mutex sFollowupLock;
+static nan_followup sFollowups[NAN_FOLLOWUP_QUEUE_SIZE];
+static int sFollowupQueue[NAN_FOLLOWUP_QUEUE_SIZE];     /* queued slots, oldest first */
+static int sFollowupQueueHead = 0;
+static int sFollowupQueueLen = 0;
+static int sFollowupsInFlight = 0;
+static int sFollowupWindow = NAN_FOLLOWUP_WINDOW_INITIAL;
+static int sFollowupWindowCredit = 0;                   /* successes since the window grew */
+static bool sFollowupDraining = false;                  /* a thread is submitting the queue */
+static NanTransmitFollowupRequest sDrainMsg;            /* owned by the draining thread */
+
+static nan_followup *findFollowup(transaction_id id, nan_followup_state state) {
+    for (int i = 0; i < NAN_FOLLOWUP_QUEUE_SIZE; i++) {
+        if (sFollowups[i].state == state && sFollowups[i].id == id) {
+            return &sFollowups[i];
+        }
+    }
+    return NULL;
+}
+
+static void pushFollowup(int slot, bool front) {
+    if (front) {
+        sFollowupQueueHead = (sFollowupQueueHead + NAN_FOLLOWUP_QUEUE_SIZE - 1)
+                % NAN_FOLLOWUP_QUEUE_SIZE;
+        sFollowupQueue[sFollowupQueueHead] = slot;
+    } else {
+        sFollowupQueue[(sFollowupQueueHead + sFollowupQueueLen) % NAN_FOLLOWUP_QUEUE_SIZE] = slot;
+    }
+    sFollowupQueueLen++;
+    sFollowups[slot].state = NAN_FOLLOWUP_QUEUED;
+}
+
+/*
+ * Submits queued follow-ups while the window has room; only called from the
+ * natives, under WifiNative.sLock. Only one thread drains at a time, so
+ * messages reach the HAL in the order they were queued; the lock is not held
+ * across the HAL call since the HAL may call back on another thread.
+ * Submissions the HAL rejects are added to results.
+ */
+static void drainFollowups(nan_followup_result *results, int *numResults) {
+    AutoMutex lock(sFollowupLock);
+    if (sFollowupDraining) {
+        return;
+    }
+    sFollowupDraining = true;
+
+    while (sFollowupQueueLen > 0 && sFollowupsInFlight < sFollowupWindow) {
+        nan_followup *f = &sFollowups[sFollowupQueue[sFollowupQueueHead]];
+        sFollowupQueueHead = (sFollowupQueueHead + 1) % NAN_FOLLOWUP_QUEUE_SIZE;
+        sFollowupQueueLen--;
+        f->state = NAN_FOLLOWUP_IN_FLIGHT;
+        sFollowupsInFlight++;
+
+        transaction_id id = f->id;
+        wifi_interface_handle handle = f->handle;
+        memcpy(&sDrainMsg, &f->msg, sizeof(sDrainMsg));
+
+        sFollowupLock.unlock();
+        wifi_error ret = hal_fn.wifi_nan_transmit_followup_request(id, handle, &sDrainMsg);
+        sFollowupLock.lock();
+
+        if (ret != WIFI_SUCCESS) {
+            ALOGE("wifi_nan_transmit_followup_request failed: id=%d, ret=%d", id, ret);
+            /* may already be gone if NAN went down meanwhile */
+            f = findFollowup(id, NAN_FOLLOWUP_IN_FLIGHT);
+            if (f != NULL) {
+                f->state = NAN_FOLLOWUP_FREE;
+                sFollowupsInFlight--;
+                results[*numResults].id = id;
+                results[*numResults].publish_subscribe_id = f->msg.publish_subscribe_id;
+                results[*numResults].status = ret == WIFI_ERROR_BUSY
+                        ? NAN_STATUS_NO_SPACE_AVAILABLE : NAN_STATUS_DE_FAILURE;
+                (*numResults)++;
+            }
+        }
+    }
+
+    sFollowupDraining = false;
+}
+
+/*
+ * Fails the queued follow-ups of a publish/subscribe session, or all queued
+ * and outstanding ones if all is set (NAN is down and they will not complete).
+ */
+static void failFollowups(u16 publish_subscribe_id, bool all,
+                          nan_followup_result *results, int *numResults) {
+    AutoMutex lock(sFollowupLock);
+
+    int queueLen = sFollowupQueueLen;
+    sFollowupQueueLen = 0;
+    for (int i = 0; i < queueLen; i++) {
+        int slot = sFollowupQueue[(sFollowupQueueHead + i) % NAN_FOLLOWUP_QUEUE_SIZE];
+        nan_followup *f = &sFollowups[slot];
+        if (all || f->msg.publish_subscribe_id == publish_subscribe_id) {
+            f->state = NAN_FOLLOWUP_FREE;
+            results[*numResults].id = f->id;
+            results[*numResults].publish_subscribe_id = f->msg.publish_subscribe_id;
+            results[*numResults].status = NAN_STATUS_DE_FAILURE;
+            (*numResults)++;
+        } else {
+            sFollowupQueue[(sFollowupQueueHead + sFollowupQueueLen++) % NAN_FOLLOWUP_QUEUE_SIZE] =
+                    slot;
+        }
+    }
+
+    if (all) {
+        for (int i = 0; i < NAN_FOLLOWUP_QUEUE_SIZE; i++) {
+            nan_followup *f = &sFollowups[i];
+            if (f->state == NAN_FOLLOWUP_IN_FLIGHT) {
+                f->state = NAN_FOLLOWUP_FREE;
+                results[*numResults].id = f->id;
+                results[*numResults].publish_subscribe_id = f->msg.publish_subscribe_id;
+                results[*numResults].status = NAN_STATUS_DE_FAILURE;
+                (*numResults)++;
+            }
+        }
+        sFollowupsInFlight = 0;
+    }
+}
+
+/* true if a queued follow-up could be submitted now */
+static bool followupsReady() {
+    AutoMutex lock(sFollowupLock);
+    return !sFollowupDraining && sFollowupQueueLen > 0 && sFollowupsInFlight < sFollowupWindow;
+}
+
+static void resetFollowups() {
+    AutoMutex lock(sFollowupLock);
+    for (int i = 0; i < NAN_FOLLOWUP_QUEUE_SIZE; i++) {
+        sFollowups[i].state = NAN_FOLLOWUP_FREE;
+    }
+    sFollowupQueueLen = 0;
+    sFollowupsInFlight = 0;
+    sFollowupWindow = NAN_FOLLOWUP_WINDOW_INITIAL;
+    sFollowupWindowCredit = 0;
+}
+
+static void reportFollowupResults(JNIHelper &helper, const nan_followup_result *results,
+                                  int numResults) {
+    if (numResults == 0) {
+        return;
+    }
+
+    for (int i = 0; i < numResults; i++) {
+        countFollowupResult(results[i].publish_subscribe_id, results[i].status);
+    }
+
+    if (numResults == 1) {
+        helper.reportEvent(mCls, "onNanNotifyResponse", "(SIII)V", (short) results[0].id,
+                           (int) NAN_RESPONSE_TRANSMIT_FOLLOWUP, results[0].status, 0);
+        return;
+    }
+
+    jint packed[(NAN_FOLLOWUP_QUEUE_SIZE + 1) * 2];
+    for (int i = 0; i < numResults; i++) {
+        packed[2 * i] = (short) results[i].id;
+        packed[2 * i + 1] = results[i].status;
+    }
+
+    JNIObject<jintArray> resultInts = helper.newIntArray(numResults * 2);
+    if (resultInts == NULL) {
+        ALOGE("Error in allocating array for %d follow-up results", numResults);
+        return;
+    }
+    helper.setIntArrayRegion(resultInts, 0, numResults * 2, packed);
+
+    helper.reportEvent(mCls, "onMessageSendResults", "([I)V", resultInts.get());
+}
+
+/* completes an outstanding follow-up; false if the transaction is not one of ours */
+static bool completeFollowup(transaction_id id, int status,
+                             nan_followup_result *results, int *numResults) {
+    AutoMutex lock(sFollowupLock);
+
+    nan_followup *f = findFollowup(id, NAN_FOLLOWUP_IN_FLIGHT);
+    if (f == NULL) {
+        return false;
+    }
+    sFollowupsInFlight--;
+
+    if (status == NAN_STATUS_NO_SPACE_AVAILABLE && f->retries < NAN_FOLLOWUP_MAX_RETRIES) {
+        f->retries++;
+        sFollowupWindow = sFollowupWindow > 1 ? sFollowupWindow / 2 : 1;
+        sFollowupWindowCredit = 0;
+        ALOGD("Firmware follow-up queue full: id=%d retried, window=%d", id, sFollowupWindow);
+        pushFollowup(f - sFollowups, true);
+        return true;
+    }
+
+    if (status == NAN_STATUS_SUCCESS && sFollowupWindow < NAN_FOLLOWUP_WINDOW_MAX
+            && ++sFollowupWindowCredit >= sFollowupWindow) {
+        sFollowupWindow++;
+        sFollowupWindowCredit = 0;
+    }
+
+    f->state = NAN_FOLLOWUP_FREE;
+    results[*numResults].id = id;
+    results[*numResults].publish_subscribe_id = f->msg.publish_subscribe_id;
+    results[*numResults].status = status;
+    (*numResults)++;
+    return true;
+}
+
+// Stats sampling
+
+/*
+ * While sampling is enabled WifiNanStateManager asks the bridge, every period
+ * and under WifiNative.sLock, to request the discovery engine's publish,
+ * subscribe, MAC, timing sync and DW statistics. The responses are consumed
+ * here rather than forwarded:
+ * each is decoded into a sample of 64-bit values, in the order of the fields
+ * of the HAL's stats struct, and kept in a ring that the framework reads with
+ * getStatsSamplesNative(). Counters are requested without clearing, so rates
+ * are the difference between two samples of the same type. WifiNanStateManager
+ * wraps its own transaction ids before NAN_TCA_TRANSACTION_ID, so the ids from
+ * there up are left to the bridge.
+ */
+
+#define NAN_STATS_RING_SIZE             128
+#define NAN_STATS_MAX_VALUES            40
+#define NAN_STATS_TRANSACTION_BASE      0xF000  /* ids of the bridge's own requests */
+#define NAN_STATS_SAMPLE_HEADER         3       /* timestamp, type, value count */
+
+typedef struct {
+    u16 offset;
+    u8 size;
+} nan_stats_field;
+
+#define NAN_STATS_FIELD(type, field) \
+    { (u16) offsetof(type, field), (u8) sizeof(((type *) 0)->field) }
+
+static const nan_stats_field sPublishStatsFields[] = {
+    NAN_STATS_FIELD(NanPublishStats, validPublishServiceReqMsgs),
+    NAN_STATS_FIELD(NanPublishStats, validPublishServiceRspMsgs),
+    NAN_STATS_FIELD(NanPublishStats, validPublishServiceCancelReqMsgs),
+    NAN_STATS_FIELD(NanPublishStats, validPublishServiceCancelRspMsgs),
+    NAN_STATS_FIELD(NanPublishStats, validPublishRepliedIndMsgs),
+    NAN_STATS_FIELD(NanPublishStats, validPublishTerminatedIndMsgs),
+    NAN_STATS_FIELD(NanPublishStats, validActiveSubscribes),
+    NAN_STATS_FIELD(NanPublishStats, validMatches),
+    NAN_STATS_FIELD(NanPublishStats, validFollowups),
+    NAN_STATS_FIELD(NanPublishStats, invalidPublishServiceReqMsgs),
+    NAN_STATS_FIELD(NanPublishStats, invalidPublishServiceCancelReqMsgs),
+    NAN_STATS_FIELD(NanPublishStats, invalidActiveSubscribes),
+    NAN_STATS_FIELD(NanPublishStats, invalidMatches),
+    NAN_STATS_FIELD(NanPublishStats, invalidFollowups),
+    NAN_STATS_FIELD(NanPublishStats, publishCount),
+    NAN_STATS_FIELD(NanPublishStats, publishNewMatchCount),
+    NAN_STATS_FIELD(NanPublishStats, pubsubGlobalNewMatchCount),
+};
+
+static const nan_stats_field sSubscribeStatsFields[] = {
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeServiceReqMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeServiceRspMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeServiceCancelReqMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeServiceCancelRspMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeTerminatedIndMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeMatchIndMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSubscribeUnmatchIndMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, validSolicitedPublishes),
+    NAN_STATS_FIELD(NanSubscribeStats, validMatches),
+    NAN_STATS_FIELD(NanSubscribeStats, validFollowups),
+    NAN_STATS_FIELD(NanSubscribeStats, invalidSubscribeServiceReqMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, invalidSubscribeServiceCancelReqMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, invalidSubscribeFollowupReqMsgs),
+    NAN_STATS_FIELD(NanSubscribeStats, invalidSolicitedPublishes),
+    NAN_STATS_FIELD(NanSubscribeStats, invalidMatches),
+    NAN_STATS_FIELD(NanSubscribeStats, invalidFollowups),
+    NAN_STATS_FIELD(NanSubscribeStats, subscribeCount),
+    NAN_STATS_FIELD(NanSubscribeStats, bloomFilterIndex),
+    NAN_STATS_FIELD(NanSubscribeStats, subscribeNewMatchCount),
+    NAN_STATS_FIELD(NanSubscribeStats, pubsubGlobalNewMatchCount),
+};
+
+/* NanMacStats and NanDWStats have the same layout */
+#define NAN_FRAME_STATS_FIELDS(type) \
+    NAN_STATS_FIELD(type, validFrames), \
+    NAN_STATS_FIELD(type, validActionFrames), \
+    NAN_STATS_FIELD(type, validBeaconFrames), \
+    NAN_STATS_FIELD(type, ignoredActionFrames), \
+    NAN_STATS_FIELD(type, ignoredBeaconFrames), \
+    NAN_STATS_FIELD(type, invalidFrames), \
+    NAN_STATS_FIELD(type, invalidActionFrames), \
+    NAN_STATS_FIELD(type, invalidBeaconFrames), \
+    NAN_STATS_FIELD(type, invalidMacHeaders), \
+    NAN_STATS_FIELD(type, invalidPafHeaders), \
+    NAN_STATS_FIELD(type, nonNanBeaconFrames), \
+    NAN_STATS_FIELD(type, earlyActionFrames), \
+    NAN_STATS_FIELD(type, inDwActionFrames), \
+    NAN_STATS_FIELD(type, lateActionFrames), \
+    NAN_STATS_FIELD(type, framesQueued), \
+    NAN_STATS_FIELD(type, totalTRSpUpdates), \
+    NAN_STATS_FIELD(type, completeByTRSp), \
+    NAN_STATS_FIELD(type, completeByTp75DW), \
+    NAN_STATS_FIELD(type, completeByTendDW), \
+    NAN_STATS_FIELD(type, lateActionFramesTx)
+
+static const nan_stats_field sMacStatsFields[] = {
+    NAN_FRAME_STATS_FIELDS(NanMacStats),
+};
+
+static const nan_stats_field sDWStatsFields[] = {
+    NAN_FRAME_STATS_FIELDS(NanDWStats),
+};
+
+static const nan_stats_field sSyncStatsFields[] = {
+    NAN_STATS_FIELD(NanSyncStats, currTsf),
+    NAN_STATS_FIELD(NanSyncStats, myRank),
+    NAN_STATS_FIELD(NanSyncStats, currAmRank),
+    NAN_STATS_FIELD(NanSyncStats, lastAmRank),
+    NAN_STATS_FIELD(NanSyncStats, currAmBTT),
+    NAN_STATS_FIELD(NanSyncStats, lastAmBTT),
+    NAN_STATS_FIELD(NanSyncStats, currAmHopCount),
+    NAN_STATS_FIELD(NanSyncStats, currRole),
+    NAN_STATS_FIELD(NanSyncStats, currClusterId),
+    NAN_STATS_FIELD(NanSyncStats, timeSpentInCurrRole),
+    NAN_STATS_FIELD(NanSyncStats, totalTimeSpentAsMaster),
+    NAN_STATS_FIELD(NanSyncStats, totalTimeSpentAsNonMasterSync),
+    NAN_STATS_FIELD(NanSyncStats, totalTimeSpentAsNonMasterNonSync),
+    NAN_STATS_FIELD(NanSyncStats, transitionsToAnchorMaster),
+    NAN_STATS_FIELD(NanSyncStats, transitionsToMaster),
+    NAN_STATS_FIELD(NanSyncStats, transitionsToNonMasterSync),
+    NAN_STATS_FIELD(NanSyncStats, transitionsToNonMasterNonSync),
+    NAN_STATS_FIELD(NanSyncStats, amrUpdateCount),
+    NAN_STATS_FIELD(NanSyncStats, amrUpdateRankChangedCount),
+    NAN_STATS_FIELD(NanSyncStats, amrUpdateBTTChangedCount),
+    NAN_STATS_FIELD(NanSyncStats, amrUpdateHcChangedCount),
+    NAN_STATS_FIELD(NanSyncStats, amrUpdateNewDeviceCount),
+    NAN_STATS_FIELD(NanSyncStats, amrExpireCount),
+    NAN_STATS_FIELD(NanSyncStats, mergeCount),
+    NAN_STATS_FIELD(NanSyncStats, beaconsAboveHcLimit),
+    NAN_STATS_FIELD(NanSyncStats, beaconsBelowRssiThresh),
+    NAN_STATS_FIELD(NanSyncStats, beaconsIgnoredNoSpace),
+    NAN_STATS_FIELD(NanSyncStats, beaconsForOurCluster),
+    NAN_STATS_FIELD(NanSyncStats, beaconsForOtherCluster),
+    NAN_STATS_FIELD(NanSyncStats, beaconCancelRequests),
+    NAN_STATS_FIELD(NanSyncStats, beaconCancelFailures),
+    NAN_STATS_FIELD(NanSyncStats, beaconUpdateRequests),
+    NAN_STATS_FIELD(NanSyncStats, beaconUpdateFailures),
+    NAN_STATS_FIELD(NanSyncStats, syncBeaconTxAttempts),
+    NAN_STATS_FIELD(NanSyncStats, syncBeaconTxFailures),
+    NAN_STATS_FIELD(NanSyncStats, discBeaconTxAttempts),
+    NAN_STATS_FIELD(NanSyncStats, discBeaconTxFailures),
+    NAN_STATS_FIELD(NanSyncStats, amHopCountExpireCount),
+};
+
+typedef struct {
+    nsecs_t timestamp;              /* boot time */
+    int type;                       /* NanStatsType */
+    int num_values;
+    u64 values[NAN_STATS_MAX_VALUES];
+} nan_stats_sample;
+
+static Mutex sStatsLock;
+static int sStatsTypes = 0;                     /* bit per NanStatsType, of the last request */
+static transaction_id sNextStatsId = NAN_STATS_TRANSACTION_BASE;
+static nan_stats_sample sStatsRing[NAN_STATS_RING_SIZE];
+static int sStatsRingHead = 0;                  /* oldest sample */
+static int sStatsRingLen = 0;
+static u32 sStatsRequests = 0;
+static u32 sStatsFailures = 0;                  /* rejected requests and failed responses */
+
+static bool decodeStats(const NanStatsResponse *response, nan_stats_sample *sample) {
+    const nan_stats_field *fields;
+    int numFields;
+    switch (response->stats_type) {
+        case NAN_STATS_ID_DE_PUBLISH:
+            fields = sPublishStatsFields;
+            numFields = NELEM(sPublishStatsFields);
+            break;
+        case NAN_STATS_ID_DE_SUBSCRIBE:
+            fields = sSubscribeStatsFields;
+            numFields = NELEM(sSubscribeStatsFields);
+            break;
+        case NAN_STATS_ID_DE_MAC:
+            fields = sMacStatsFields;
+            numFields = NELEM(sMacStatsFields);
+            break;
+        case NAN_STATS_ID_DE_TIMING_SYNC:
+            fields = sSyncStatsFields;
+            numFields = NELEM(sSyncStatsFields);
+            break;
+        case NAN_STATS_ID_DE_DW:
+            fields = sDWStatsFields;
+            numFields = NELEM(sDWStatsFields);
+            break;
+        default:
+            return false;
+    }
+
+    const u8 *data = (const u8 *) &response->data;
+    for (int i = 0; i < numFields; i++) {
+        const u8 *p = data + fields[i].offset;
+        switch (fields[i].size) {
+            case 1: sample->values[i] = *p; break;
+            case 2: { u16 v; memcpy(&v, p, sizeof(v)); sample->values[i] = v; break; }
+            case 4: { u32 v; memcpy(&v, p, sizeof(v)); sample->values[i] = v; break; }
+            default: { u64 v; memcpy(&v, p, sizeof(v)); sample->values[i] = v; break; }
+        }
+    }
+    sample->type = response->stats_type;
+    sample->num_values = numFields;
+    return true;
+}
+
+static void recordStats(transaction_id id, const NanResponseMsg *msg) {
+    nan_stats_sample sample;
+    bool decoded = msg->status == NAN_STATUS_SUCCESS
+            && decodeStats(&msg->body.stats_response, &sample);
+    sample.timestamp = systemTime(SYSTEM_TIME_BOOTTIME);
+
+    AutoMutex lock(sStatsLock);
+    if (!decoded) {
+        ALOGD("Stats request %d failed: status=%d, stats_type=%d", id, msg->status,
+              msg->body.stats_response.stats_type);
+        sStatsFailures++;
+        return;
+    }
+
+    if (sStatsRingLen == NAN_STATS_RING_SIZE) {
+        sStatsRingHead = (sStatsRingHead + 1) % NAN_STATS_RING_SIZE;
+        sStatsRingLen--;
+    }
+    sStatsRing[(sStatsRingHead + sStatsRingLen++) % NAN_STATS_RING_SIZE] = sample;
+}
+
+/* issues one stats request per selected type; called without sStatsLock held */
+static void requestStats(wifi_interface_handle handle, int types) {
+    for (int type = NAN_STATS_ID_DE_PUBLISH; type <= NAN_STATS_ID_DE_DW; type++) {
+        if ((types & (1 << type)) == 0) {
+            continue;
+        }
+
+        transaction_id id;
+        {
+            AutoMutex lock(sStatsLock);
+            sStatsTypes = types;
+            id = sNextStatsId++;
+            if (sNextStatsId == 0) {
+                sNextStatsId = NAN_STATS_TRANSACTION_BASE;
+            }
+            sStatsRequests++;
+        }
+
+        NanStatsRequest msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.stats_type = (NanStatsType) type;
+        msg.clear = 0;
+
+        wifi_error ret = hal_fn.wifi_nan_stats_request(id, handle, &msg);
+        if (ret != WIFI_SUCCESS) {
+            ALOGD("wifi_nan_stats_request failed: type=%d, ret=%d", type, ret);
+            AutoMutex lock(sStatsLock);
+            sStatsFailures++;
+        }
+    }
+}
+
+static void resetStats() {
+    AutoMutex lock(sStatsLock);
+    sStatsTypes = 0;
+    sStatsRingHead = 0;
+    sStatsRingLen = 0;
+    sStatsRequests = 0;
+    sStatsFailures = 0;
+}
+
+// Configuration
+
+/*
+ * The bridge remembers the NanEnableRequest the firmware is running with. When
+ * the framework asks for a new configuration while NAN is up, only the fields
+ * that changed are sent, through wifi_nan_config_request, which keeps the
+ * cluster and its sessions; a configuration identical to the active one is
+ * completed right away. Fields that NanConfigRequest cannot change (5 GHz
+ * support, cluster id range) still need a full enable request, as does any
+ * request made while an earlier enable or config is outstanding.
+ */
+
+typedef enum {
+    NAN_CONFIG_NONE = 0,
+    NAN_CONFIG_ENABLE,
+    NAN_CONFIG_UPDATE,
+} nan_config_op;
+
+static Mutex sConfigLock;
+static bool sNanEnabled = false;                /* an enable completed, no disable since */
+static NanEnableRequest sActiveEnable;          /* what the firmware runs with */
+static nan_config_op sPendingConfigOp = NAN_CONFIG_NONE;
+static transaction_id sPendingConfigId;
+static NanEnableRequest sPendingEnable;         /* sActiveEnable once the request succeeds */
+
+/* true if newConfig can be applied with a config request; fills in msg */
+static bool diffConfig(const NanEnableRequest *active, const NanEnableRequest *newConfig,
+                       NanConfigRequest *msg) {
+    if (active->config_support_5g != newConfig->config_support_5g
+            || active->support_5g_val != newConfig->support_5g_val
+            || active->cluster_low != newConfig->cluster_low
+            || active->cluster_high != newConfig->cluster_high) {
+        return false;
+    }
+
+    memset(msg, 0, sizeof(*msg));
+    if (active->master_pref != newConfig->master_pref) {
+        msg->config_master_pref = 1;
+        msg->master_pref = newConfig->master_pref;
+    }
+    return true;
+}
+
+static bool isEmptyConfig(const NanConfigRequest *msg) {
+    return !msg->config_master_pref;
+}
+
+/*
+ * Picks how to apply newConfig and records it as pending. Returns
+ * NAN_CONFIG_NONE if it is already active.
+ */
+static nan_config_op startConfig(transaction_id id, const NanEnableRequest *newConfig,
+                                 NanConfigRequest *msg) {
+    AutoMutex lock(sConfigLock);
+
+    nan_config_op op = NAN_CONFIG_ENABLE;
+    if (sNanEnabled && sPendingConfigOp == NAN_CONFIG_NONE
+            && diffConfig(&sActiveEnable, newConfig, msg)) {
+        if (isEmptyConfig(msg)) {
+            return NAN_CONFIG_NONE;
+        }
+        op = NAN_CONFIG_UPDATE;
+    }
+
+    sPendingConfigOp = op;
+    sPendingConfigId = id;
+    sPendingEnable = *newConfig;
+    return op;
+}
+
+/* the HAL refused the request: no response will come */
+static void abortConfig(transaction_id id) {
+    AutoMutex lock(sConfigLock);
+    if (sPendingConfigOp != NAN_CONFIG_NONE && sPendingConfigId == id) {
+        sPendingConfigOp = NAN_CONFIG_NONE;
+    }
+}
+
+/* returns true if the response completes an enable */
+static bool completeConfig(transaction_id id, int responseType, int status) {
+    AutoMutex lock(sConfigLock);
+
+    nan_config_op op = responseType == NAN_RESPONSE_ENABLED ? NAN_CONFIG_ENABLE : NAN_CONFIG_UPDATE;
+    if (sPendingConfigOp != op || sPendingConfigId != id) {
+        return false;
+    }
+    sPendingConfigOp = NAN_CONFIG_NONE;
+
+    if (status == NAN_STATUS_SUCCESS) {
+        sActiveEnable = sPendingEnable;
+        sNanEnabled = true;
+        return op == NAN_CONFIG_ENABLE;
+    }
+    if (op == NAN_CONFIG_ENABLE) {
+        /* the firmware may be left in any state: re-enable next time */
+        sNanEnabled = false;
+    }
+    return false;
+}
+
+static bool isNanEnabled() {
+    AutoMutex lock(sConfigLock);
+    return sNanEnabled;
+}
+
+static void resetConfig() {
+    AutoMutex lock(sConfigLock);
+    sNanEnabled = false;
+    sPendingConfigOp = NAN_CONFIG_NONE;
+}
+
+// Cluster density
+
+/*
+ * The bridge keeps a cluster size threshold crossing alert (TCA) armed while
+ * NAN is up: the firmware forgets it on disable, so it is re-armed whenever an
+ * enable completes. The HAL is not called from its own callback: the enable
+ * response only marks the alert for re-arming, and WifiNanStateManager calls
+ * rearmClusterSizeAlertNative() under WifiNative.sLock once it has processed
+ * the completion. The framework can change the threshold, or turn alerts off
+ * with 0, through setClusterSizeAlertNative(). The cluster size reported by
+ * the last alert paces new publishes and subscribes: at or below the threshold
+ * they transmit every NAN_DISCOVERY_PERIOD_MIN (the old fixed period), above it
+ * the period grows with size / threshold, up to NAN_DISCOVERY_PERIOD_MAX, so
+ * dense clusters are not flooded with discovery frames. Alerts are also
+ * forwarded to the framework.
+ */
+
+#define NAN_TCA_TRANSACTION_ID          0xEFFF  /* just below the stats ids */
+#define NAN_CLUSTER_SIZE_ALERT_DEFAULT  8
+#define NAN_DISCOVERY_PERIOD_MIN        500
+#define NAN_DISCOVERY_PERIOD_MAX        4000
+
+static Mutex sDensityLock;
+static u32 sTcaThreshold = NAN_CLUSTER_SIZE_ALERT_DEFAULT;  /* configured; 0: off */
+static u32 sTcaRequested = 0;           /* threshold of the outstanding request */
+static u32 sTcaArmed = 0;               /* threshold the firmware accepted; 0: none */
+static int sClusterSize = -1;           /* from the last alert; -1: unknown */
+static bool sTcaRearm = false;          /* an enable completed since the alert was last sent */
+static u32 sTcaAlerts = 0;
+static u32 sTcaFailures = 0;
+static u32 sBeaconPayloads = 0;
+
+static u16 discoveryPeriod() {
+    AutoMutex lock(sDensityLock);
+
+    if (sTcaArmed == 0 || sClusterSize <= (int) sTcaArmed) {
+        return NAN_DISCOVERY_PERIOD_MIN;
+    }
+    u32 period = (u32) NAN_DISCOVERY_PERIOD_MIN * sClusterSize / sTcaArmed;
+    return (u16) (period < NAN_DISCOVERY_PERIOD_MAX ? period : NAN_DISCOVERY_PERIOD_MAX);
+}
+
+/* sends the configured threshold to the firmware (clears the alert if 0); no locks held */
+static wifi_error armClusterSizeAlert(wifi_interface_handle handle) {
+    u32 threshold;
+    {
+        AutoMutex lock(sDensityLock);
+        threshold = sTcaThreshold;
+        sTcaRequested = threshold;
+        sTcaRearm = false;
+        sTcaArmed = 0;
+        sClusterSize = -1;
+    }
+
+    NanTCARequest msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.tca_type = NAN_TCA_ID_CLUSTER_SIZE;
+    if (threshold == 0) {
+        msg.clear_trigger = 1;
+    } else {
+        msg.rising_direction_evt_flag = 1;
+        msg.falling_direction_evt_flag = 1;
+        msg.threshold = threshold;
+    }
+
+    wifi_error ret = hal_fn.wifi_nan_tca_request(NAN_TCA_TRANSACTION_ID, handle, &msg);
+    if (ret != WIFI_SUCCESS) {
+        ALOGD("wifi_nan_tca_request failed: threshold=%u, ret=%d", threshold, ret);
+        AutoMutex lock(sDensityLock);
+        sTcaFailures++;
+    }
+    return ret;
+}
+
+static void completeClusterSizeAlert(const NanResponseMsg *msg) {
+    AutoMutex lock(sDensityLock);
+
+    if (msg->status != NAN_STATUS_SUCCESS) {
+        ALOGD("TCA request failed: status=%d", msg->status);
+        sTcaFailures++;
+        return;
+    }
+    /* a later request may have changed the threshold meanwhile */
+    if (sTcaRequested == sTcaThreshold) {
+        sTcaArmed = sTcaRequested;
+    }
+}
+
+/* returns false if the alert is not one the bridge armed */
+static bool recordClusterSize(const NanTCAInd *event) {
+    AutoMutex lock(sDensityLock);
+
+    if (event->tca_type != NAN_TCA_ID_CLUSTER_SIZE || sTcaArmed == 0) {
+        return false;
+    }
+    sClusterSize = event->cluster_size;
+    sTcaAlerts++;
+    return true;
+}
+
+/* an enable completed: the firmware starts without the alert */
+static void markClusterSizeAlertForRearm() {
+    AutoMutex lock(sDensityLock);
+    sTcaArmed = 0;
+    sClusterSize = -1;
+    sTcaRearm = true;
+}
+
+/* returns and clears the re-arm mark */
+static bool takeClusterSizeAlertRearm() {
+    AutoMutex lock(sDensityLock);
+    bool rearm = sTcaRearm;
+    sTcaRearm = false;
+    return rearm;
+}
+
+/* NAN went down: the firmware no longer has the alert */
+static void disarmClusterSizeAlert() {
+    AutoMutex lock(sDensityLock);
+    sTcaArmed = 0;
+    sClusterSize = -1;
+    sTcaRearm = false;
+}
+
+static void resetDensity() {
+    AutoMutex lock(sDensityLock);
+    sTcaThreshold = NAN_CLUSTER_SIZE_ALERT_DEFAULT;
+    sTcaArmed = 0;
+    sClusterSize = -1;
+    sTcaRearm = false;
+    sTcaAlerts = 0;
+    sTcaFailures = 0;
+    sBeaconPayloads = 0;
+}
+
+/*
+ * Beacon and SDF vendor payloads reach the framework as a packed stream, one
+ * record per indication, little endian:
+ *   peer address (6), flags (1: bit 0 vendor attribute, bit 1 frame),
+ *   received on (1), vendor OUI (4), attribute length (2), attribute,
+ *   frame length (2), frame
+ * Absent parts have zero length.
+ */
+
+#define NAN_PAYLOAD_HAS_VSA             0x01
+#define NAN_PAYLOAD_HAS_FRAME           0x02
+#define NAN_PAYLOAD_RECORD_HEADER       (NAN_MAC_ADDR_LEN + 1 + 1 + 4 + 2)
+#define NAN_PAYLOAD_MAX_RECORD          (NAN_PAYLOAD_RECORD_HEADER + NAN_MAX_VSA_DATA_LEN \
+                                         + 2 + NAN_MAX_FRAME_DATA_LEN)
+
+static u8 *putLe(u8 *p, u32 value, int size) {
+    for (int i = 0; i < size; i++) {
+        *p++ = (u8) (value >> (8 * i));
+    }
+    return p;
+}
+
+/* packs event into buf (at least NAN_PAYLOAD_MAX_RECORD bytes); returns its length */
+static int packBeaconSdfPayload(const NanBeaconSdfPayloadInd *event, u8 *buf) {
+    u32 vsaLen = event->is_vsa_received ? event->vsa.attr_len : 0;
+    if (vsaLen > NAN_MAX_VSA_DATA_LEN) {
+        vsaLen = NAN_MAX_VSA_DATA_LEN;
+    }
+    u32 frameLen = event->is_beacon_sdf_payload_received ? event->data.frame_len : 0;
+    if (frameLen > NAN_MAX_FRAME_DATA_LEN) {
+        frameLen = NAN_MAX_FRAME_DATA_LEN;
+    }
+
+    u8 *p = buf;
+    memcpy(p, event->addr, NAN_MAC_ADDR_LEN);
+    p += NAN_MAC_ADDR_LEN;
+    *p++ = (event->is_vsa_received ? NAN_PAYLOAD_HAS_VSA : 0)
+            | (event->is_beacon_sdf_payload_received ? NAN_PAYLOAD_HAS_FRAME : 0);
+    *p++ = event->is_vsa_received ? event->vsa.vsa_received_on : 0;
+    p = putLe(p, event->is_vsa_received ? event->vsa.vendor_oui : 0, 4);
+    p = putLe(p, vsaLen, 2);
+    memcpy(p, event->vsa.vsa, vsaLen);
+    p += vsaLen;
+    p = putLe(p, frameLen, 2);
+    memcpy(p, event->data.frame_data, frameLen);
+    p += frameLen;
+    return p - buf;
+}
+
+// Discovery request fields
+
+/*
+ * The field ids of PublishData/SubscribeData and their settings are resolved
+ * once, and byte arrays are read with GetByteArrayRegion straight into the
+ * publish/subscribe request after their lengths are checked against the
+ * NAN_MAX_* limits.
+ */
+
+typedef struct {
+    jfieldID serviceName;
+    jfieldID serviceSpecificInfoLength;
+    jfieldID serviceSpecificInfo;
+    jfieldID txFilterLength;
+    jfieldID txFilter;
+    jfieldID rxFilterLength;
+    jfieldID rxFilter;
+    jfieldID type;                      /* of the settings */
+    jfieldID count;
+    jfieldID ttl;
+} nan_discovery_fields;
+
+/* the discovery data of a NanPublishRequest or NanSubscribeRequest */
+typedef struct {
+    u16 *service_name_len;
+    u8 *service_name;
+    u16 *service_specific_info_len;
+    u8 *service_specific_info;
+    u16 *tx_match_filter_len;
+    u8 *tx_match_filter;
+    u16 *rx_match_filter_len;
+    u8 *rx_match_filter;
+} nan_discovery_data;
+
+#define NAN_DISCOVERY_DATA(msg) { \
+    &(msg).service_name_len, (msg).service_name, \
+    &(msg).service_specific_info_len, (msg).service_specific_info, \
+    &(msg).tx_match_filter_len, (msg).tx_match_filter, \
+    &(msg).rx_match_filter_len, (msg).rx_match_filter }
+
+static Mutex sDiscoveryFieldsLock;
+static nan_discovery_fields sPublishFields;
+static nan_discovery_fields sSubscribeFields;
+static bool sPublishFieldsResolved = false;
+static bool sSubscribeFieldsResolved = false;
+
+static bool getDiscoveryFields(JNIHelper &helper, jobject data, jobject settings, bool publish,
+                               nan_discovery_fields *fields) {
+    AutoMutex lock(sDiscoveryFieldsLock);
+
+    nan_discovery_fields *f = publish ? &sPublishFields : &sSubscribeFields;
+    bool *resolved = publish ? &sPublishFieldsResolved : &sSubscribeFieldsResolved;
+    if (!*resolved) {
+        f->serviceName = helper.getFieldID(data, "mServiceName", "Ljava/lang/String;");
+        f->serviceSpecificInfoLength = helper.getFieldID(data, "mServiceSpecificInfoLength", "I");
+        f->serviceSpecificInfo = helper.getFieldID(data, "mServiceSpecificInfo", "[B");
+        f->txFilterLength = helper.getFieldID(data, "mTxFilterLength", "I");
+        f->txFilter = helper.getFieldID(data, "mTxFilter", "[B");
+        f->rxFilterLength = helper.getFieldID(data, "mRxFilterLength", "I");
+        f->rxFilter = helper.getFieldID(data, "mRxFilter", "[B");
+        f->type = helper.getFieldID(settings, publish ? "mPublishType" : "mSubscribeType", "I");
+        f->count = helper.getFieldID(settings, publish ? "mPublishCount" : "mSubscribeCount", "I");
+        f->ttl = helper.getFieldID(settings, "mTtlSec", "I");
+        if (f->serviceName == 0 || f->serviceSpecificInfoLength == 0
+                || f->serviceSpecificInfo == 0 || f->txFilterLength == 0 || f->txFilter == 0
+                || f->rxFilterLength == 0 || f->rxFilter == 0 || f->type == 0 || f->count == 0
+                || f->ttl == 0) {
+            return false;
+        }
+        *resolved = true;
+    }
+
+    *fields = *f;
+    return true;
+}
+
+static bool readDiscoveryBytes(JNIHelper &helper, jobject data, jfieldID lengthField,
+                               jfieldID arrayField, int max, u16 *length, u8 *buf) {
+    int len = helper.getIntField(data, lengthField);
+    if (len < 0 || len > max) {
+        return false;
+    }
+    if (len != 0 && !helper.getByteArrayField(data, arrayField, buf, len)) {
+        return false;
+    }
+    *length = len;
+    return true;
+}
+
+/* reads the service name, SSI and filters of data into d; false if any is invalid */
+static bool readDiscoveryData(JNIHelper &helper, JNIEnv *env, jobject data,
+                              const nan_discovery_fields *f, const nan_discovery_data *d) {
+    JNIObject<jstring> objStr = helper.getStringField(data, f->serviceName);
+    if (objStr == NULL) {
+        ALOGE("Error accessing mServiceName field");
+        return false;
+    }
+    ScopedUtfChars chars(env, objStr);
+    const char *serviceName = chars.c_str();
+    if (serviceName == NULL) {
+        ALOGE("Error getting mServiceName");
+        return false;
+    }
+    size_t len = strlen(serviceName);
+    if (len > NAN_MAX_SERVICE_NAME_LEN) {
+        ALOGE("Service name too long: %zu", len);
+        return false;
+    }
+    *d->service_name_len = len;
+    memcpy(d->service_name, serviceName, len);
+
+    if (!readDiscoveryBytes(helper, data, f->serviceSpecificInfoLength, f->serviceSpecificInfo,
+                            NAN_MAX_SERVICE_SPECIFIC_INFO_LEN, d->service_specific_info_len,
+                            d->service_specific_info)
+            || !readDiscoveryBytes(helper, data, f->txFilterLength, f->txFilter,
+                                   NAN_MAX_MATCH_FILTER_LEN, d->tx_match_filter_len,
+                                   d->tx_match_filter)
+            || !readDiscoveryBytes(helper, data, f->rxFilterLength, f->rxFilter,
+                                   NAN_MAX_MATCH_FILTER_LEN, d->rx_match_filter_len,
+                                   d->rx_match_filter)) {
+        ALOGE("Invalid service specific info or match filter");
+        return false;
+    }
+    return true;
+}
+
 // Start NAN functions
 
 static void OnNanNotifyResponse(transaction_id id, NanResponseMsg* msg) {
@@ -48,7 +1629,42 @@ static void OnNanNotifyResponse(transaction_id id, NanResponseMsg* msg) {
       "OnNanNotifyResponse: transaction_id=%d, status=%d, value=%d, response_type=%d",
       id, msg->status, msg->value, msg->response_type);
 
-  JNIHelper helper(mVM);
+  if (msg->response_type == NAN_RESPONSE_STATS) {
+    recordStats(id, msg);
+    return;
+  }
+
+  if (msg->response_type == NAN_RESPONSE_TCA && id == NAN_TCA_TRANSACTION_ID) {
+    completeClusterSizeAlert(msg);
+    return;
+  }
+
+  if (msg->response_type == NAN_RESPONSE_ENABLED
+      || msg->response_type == NAN_RESPONSE_CONFIG) {
+    if (completeConfig(id, msg->response_type, msg->status)) {
+      markClusterSizeAlertForRearm();
+    }
+  }
+
+  JNIHelper helper(mVM, __func__);
+  flushMatches(helper);
+
+  if (msg->response_type == NAN_RESPONSE_TRANSMIT_FOLLOWUP) {
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    if (completeFollowup(id, msg->status, results, &numResults)) {
+      reportFollowupResults(helper, results, numResults);
+      if (followupsReady()) {
+        helper.reportEvent(mCls, "onFollowupsReady", "()V");
+      }
+      return;
+    }
+  }
+
+  if (completeTransaction(id, msg)) {
+    return;
+  }
+
   switch (msg->response_type) {
     case NAN_RESPONSE_PUBLISH:
       helper.reportEvent(mCls, "onNanNotifyResponsePublishSubscribe",
@@ -116,51 +1732,81 @@ static void OnNanNotifyResponse(transaction_id id, NanResponseMsg* msg) {
 static void OnNanEventPublishTerminated(NanPublishTerminatedInd* event) {
     ALOGD("OnNanEventPublishTerminated");
 
-    JNIHelper helper(mVM);
-    helper.reportEvent(mCls, "onPublishTerminated", "(II)V",
-                       event->publish_id, event->reason);
+    forgetMatches(event->publish_id, 0, false);
+
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    failFollowups(event->publish_id, false, results, &numResults);
+
+    JNIHelper helper(mVM, __func__);
+    flushMatches(helper);
+    reportFollowupResults(helper, results, numResults);
+    if (terminateSession(event->publish_id, event->reason)) {
+        helper.reportEvent(mCls, "onPublishTerminated", "(II)V",
+                           event->publish_id, event->reason);
+    }
 }
 
 static void OnNanEventMatch(NanMatchInd* event) {
     ALOGD("OnNanEventMatch");
 
-    JNIHelper helper(mVM);
-
-    JNIObject<jbyteArray> macBytes = helper.newByteArray(6);
-    helper.setByteArrayRegion(macBytes, 0, 6, (jbyte *) event->addr);
-
-    JNIObject<jbyteArray> ssiBytes = helper.newByteArray(event->service_specific_info_len);
-    helper.setByteArrayRegion(ssiBytes, 0, event->service_specific_info_len,
-                              (jbyte *) event->service_specific_info);
+    countMatch(event->publish_subscribe_id, event->requestor_instance_id);
 
-    JNIObject<jbyteArray> mfBytes = helper.newByteArray(event->sdf_match_filter_len);
-    helper.setByteArrayRegion(mfBytes, 0, event->sdf_match_filter_len,
-                              (jbyte *) event->sdf_match_filter);
+    int numPending = queueMatch(event);
+    if (numPending == 0) {
+        return;
+    }
 
-    helper.reportEvent(mCls, "onMatchEvent", "(II[B[BI[BI)V",
-                       (int) event->publish_subscribe_id,
-                       (int) event->requestor_instance_id,
-                       macBytes.get(),
-                       ssiBytes.get(), event->service_specific_info_len,
-                       mfBytes.get(), event->sdf_match_filter_len);
+    if (sMatchBatchWindowMs == 0 || numPending == NAN_MATCH_BATCH_SIZE) {
+        JNIHelper helper(mVM, __func__);
+        flushMatches(helper);
+    } else {
+        startMatchFlusher();
+    }
 }
 
 static void OnNanEventMatchExpired(NanMatchExpiredInd* event) {
-    ALOGD("OnNanEventMatchExpired");
+    ALOGD("OnNanEventMatchExpired: publish_subscribe_id=%d, requestor_instance_id=%d",
+          event->publish_subscribe_id, event->requestor_instance_id);
+
+    countMatchExpired(event->publish_subscribe_id, event->requestor_instance_id);
+    bool reported = forgetMatches(event->publish_subscribe_id,
+                                  event->requestor_instance_id, true);
+
+    JNIHelper helper(mVM, __func__);
+    flushMatches(helper);
+    if (reported) {
+        helper.reportEvent(mCls, "onMatchExpired", "(II)V",
+                           (int) event->publish_subscribe_id,
+                           (int) event->requestor_instance_id);
+    }
 }
 
 static void OnNanEventSubscribeTerminated(NanSubscribeTerminatedInd* event) {
     ALOGD("OnNanEventSubscribeTerminated");
 
-    JNIHelper helper(mVM);
-    helper.reportEvent(mCls, "onSubscribeTerminated", "(II)V",
-                       event->subscribe_id, event->reason);
+    forgetMatches(event->subscribe_id, 0, false);
+
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    failFollowups(event->subscribe_id, false, results, &numResults);
+
+    JNIHelper helper(mVM, __func__);
+    flushMatches(helper);
+    reportFollowupResults(helper, results, numResults);
+    if (terminateSession(event->subscribe_id, event->reason)) {
+        helper.reportEvent(mCls, "onSubscribeTerminated", "(II)V",
+                           event->subscribe_id, event->reason);
+    }
 }
 
 static void OnNanEventFollowup(NanFollowupInd* event) {
     ALOGD("OnNanEventFollowup");
 
-    JNIHelper helper(mVM);
+    countFollowupReceived(event->publish_subscribe_id, event->requestor_instance_id);
+
+    JNIHelper helper(mVM, __func__);
+    flushMatches(helper);
 
     JNIObject<jbyteArray> macBytes = helper.newByteArray(6);
     helper.setByteArrayRegion(macBytes, 0, 6, (jbyte *) event->addr);
@@ -179,7 +1825,8 @@ static void OnNanEventFollowup(NanFollowupInd* event) {
 static void OnNanEventDiscEngEvent(NanDiscEngEventInd* event) {
     ALOGD("OnNanEventDiscEngEvent called: event_type=%d", event->event_type);
 
-    JNIHelper helper(mVM);
+    JNIHelper helper(mVM, __func__);
+    flushMatches(helper);
 
     JNIObject<jbyteArray> macBytes = helper.newByteArray(6);
     if (event->event_type == NAN_EVENT_ID_DISC_MAC_ADDR) {
@@ -195,23 +1842,66 @@ static void OnNanEventDiscEngEvent(NanDiscEngEventInd* event) {
 static void OnNanEventDisabled(NanDisabledInd* event) {
     ALOGD("OnNanEventDisabled called: reason=%d", event->reason);
 
-    JNIHelper helper(mVM);
+    clearMatches();
+    endAllSessions(NAN_TERMINATED_REASON_DISABLE_IN_PROGRESS);
+    resetConfig();
+    disarmClusterSizeAlert();
+
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    failFollowups(0, true, results, &numResults);
+
+    JNIHelper helper(mVM, __func__);
+    reportFollowupResults(helper, results, numResults);
 
     helper.reportEvent(mCls, "onDisabledEvent", "(I)V", (int) event->reason);
 }
 
 static void OnNanEventTca(NanTCAInd* event) {
-    ALOGD("OnNanEventTca");
+    ALOGD("OnNanEventTca: tca_type=%d, rising=%d, falling=%d, cluster_size=%u",
+          event->tca_type, event->rising_direction_evt_flag, event->falling_direction_evt_flag,
+          event->cluster_size);
+
+    if (!recordClusterSize(event)) {
+        return;
+    }
+
+    JNIHelper helper(mVM, __func__);
+    flushMatches(helper);
+
+    helper.reportEvent(mCls, "onClusterSizeAlert", "(ZI)V",
+                       (jboolean) (event->rising_direction_evt_flag != 0),
+                       (int) event->cluster_size);
 }
 
 static void OnNanEventBeaconSdfPayload(NanBeaconSdfPayloadInd* event) {
-    ALOGD("OnNanEventSdfPayload");
+    ALOGD("OnNanEventSdfPayload: vsa=%d, frame=%d", event->is_vsa_received,
+          event->is_beacon_sdf_payload_received);
+
+    /* off the stack: the record can be over 1.5 KB; callbacks come from a single thread */
+    static u8 record[NAN_PAYLOAD_MAX_RECORD];
+    int len = packBeaconSdfPayload(event, record);
+    {
+        AutoMutex lock(sDensityLock);
+        sBeaconPayloads++;
+    }
+
+    JNIHelper helper(mVM, __func__);
+    JNIObject<jbyteArray> stream = helper.newByteArray(len);
+    if (stream.get() == NULL) {
+        ALOGE("OnNanEventSdfPayload: error allocating a %d byte array", len);
+        return;
+    }
+    helper.setByteArrayRegion(stream, 0, len, (jbyte *) record);
+
+    helper.reportEvent(mCls, "onBeaconSdfPayloads", "([B)V", stream.get());
 }
 
 static jint android_net_wifi_nan_register_handler(JNIEnv *env, jclass cls,
                                                   jclass wifi_native_cls,
-                                                  jint iface) {
-    JNIHelper helper(env);
+                                                  jint iface,
+                                                  jint match_batch_window_ms) {
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_register_handler handle=%p", handle);
@@ -230,9 +1920,17 @@ static jint android_net_wifi_nan_register_handler(JNIEnv *env, jclass cls,
 
     if (mVM == NULL) {
         env->GetJavaVM(&mVM);
-        mCls = (jclass) env->NewGlobalRef(cls);
+        mCls = (jclass) helper.newGlobalRef(cls);
     }
 
+    clearMatches();
+    sMatchBatchWindowMs = match_batch_window_ms > 0 ? match_batch_window_ms : 0;
+    resetFollowups();
+    resetSessions();
+    resetStats();
+    resetConfig();
+    resetDensity();
+
     return hal_fn.wifi_nan_register_handler(handle, handlers);
 }
 
@@ -241,7 +1939,7 @@ static jint android_net_wifi_nan_enable_request(JNIEnv *env, jclass cls,
                                                 jclass wifi_native_cls,
                                                 jint iface,
                                                 jobject config_request) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_enable_request handle=%p, id=%d",
@@ -257,14 +1955,32 @@ static jint android_net_wifi_nan_enable_request(JNIEnv *env, jclass cls,
     msg.cluster_low = helper.getIntField(config_request, "mClusterLow");
     msg.cluster_high = helper.getIntField(config_request, "mClusterHigh");
 
-    return hal_fn.wifi_nan_enable_request(transaction_id, handle, &msg);
+    NanConfigRequest configMsg;
+    wifi_error ret;
+    switch (startConfig(transaction_id, &msg, &configMsg)) {
+        case NAN_CONFIG_NONE:
+            ALOGD("Configuration unchanged, id=%d", transaction_id);
+            helper.reportEvent(mCls, "onNanNotifyResponse", "(SIII)V", transaction_id,
+                               (int) NAN_RESPONSE_CONFIG, (int) NAN_STATUS_SUCCESS, 0);
+            return WIFI_SUCCESS;
+        case NAN_CONFIG_UPDATE:
+            ret = hal_fn.wifi_nan_config_request(transaction_id, handle, &configMsg);
+            break;
+        default:
+            ret = hal_fn.wifi_nan_enable_request(transaction_id, handle, &msg);
+            break;
+    }
+    if (ret != WIFI_SUCCESS) {
+        abortConfig(transaction_id);
+    }
+    return ret;
 }
 
 static jint android_net_wifi_nan_get_capabilities(JNIEnv *env, jclass cls,
                                                   jshort transaction_id,
                                                   jclass wifi_native_cls,
                                                   jint iface) {
-  JNIHelper helper(env);
+  JNIHelper helper(env, __func__);
   wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
   ALOGD("android_net_wifi_nan_get_capabilities handle=%p, id=%d", handle,
@@ -277,12 +1993,14 @@ static jint android_net_wifi_nan_disable_request(JNIEnv *env, jclass cls,
                                                  jshort transaction_id,
                                                  jclass wifi_native_cls,
                                                  jint iface) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_disable_request handle=%p, id=%d",
           handle, transaction_id);
 
+    resetConfig();
+    disarmClusterSizeAlert();
     return hal_fn.wifi_nan_disable_request(transaction_id, handle);
 }
 
@@ -293,65 +2011,52 @@ static jint android_net_wifi_nan_publish(JNIEnv *env, jclass cls,
                                          jint iface,
                                          jobject publish_data,
                                          jobject publish_settings) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_publish handle=%p, id=%d", handle, transaction_id);
 
+    nan_discovery_fields fields;
+    if (!getDiscoveryFields(helper, publish_data, publish_settings, true, &fields)) {
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
     NanPublishRequest msg;
     memset(&msg, 0, sizeof(NanPublishRequest));
 
     /* hard-coded settings - TBD: move to configurable */
-    msg.period = 500;
     msg.publish_match_indicator = NAN_MATCH_ALG_MATCH_ONCE;
     msg.rssi_threshold_flag = 0;
     msg.connmap = 0;
+    /* follows cluster density */
+    msg.period = discoveryPeriod();
 
     /* configurable settings */
     msg.publish_id = publish_id;
 
-    JNIObject<jstring> objStr1 = helper.getStringField(publish_data, "mServiceName");
-    if (objStr1 == NULL) {
-        ALOGE("Error accessing mServiceName field");
-        return 0;
-    }
-    ScopedUtfChars chars1(env, objStr1);
-    const char *serviceName = chars1.c_str();
-    if (serviceName == NULL) {
-        ALOGE("Error getting mServiceName");
-        return 0;
-    }
-    msg.service_name_len = strlen(serviceName);
-    strcpy((char*)msg.service_name, serviceName);
-
-    msg.service_specific_info_len = helper.getIntField(publish_data, "mServiceSpecificInfoLength");
-    if (msg.service_specific_info_len != 0) {
-        helper.getByteArrayField(publish_data, "mServiceSpecificInfo",
-                             msg.service_specific_info, msg.service_specific_info_len);
+    nan_discovery_data data = NAN_DISCOVERY_DATA(msg);
+    if (!readDiscoveryData(helper, env, publish_data, &fields, &data)) {
+        return WIFI_ERROR_INVALID_ARGS;
     }
 
-
-    msg.tx_match_filter_len = helper.getIntField(publish_data, "mTxFilterLength");
-    if (msg.tx_match_filter_len != 0) {
-        helper.getByteArrayField(publish_data, "mTxFilter",
-                             msg.tx_match_filter, msg.tx_match_filter_len);
-    }
-
-    msg.rx_match_filter_len = helper.getIntField(publish_data, "mRxFilterLength");
-    if (msg.rx_match_filter_len != 0) {
-        helper.getByteArrayField(publish_data, "mRxFilter",
-                             msg.rx_match_filter, msg.rx_match_filter_len);
-    }
-
-    msg.publish_type = (NanPublishType)helper.getIntField(publish_settings, "mPublishType");
-    msg.publish_count = helper.getIntField(publish_settings, "mPublishCount");
-    msg.ttl = helper.getIntField(publish_settings, "mTtlSec");
+    msg.publish_type = (NanPublishType)helper.getIntField(publish_settings, fields.type);
+    msg.publish_count = helper.getIntField(publish_settings, fields.count);
+    msg.ttl = helper.getIntField(publish_settings, fields.ttl);
 
     msg.tx_type = NAN_TX_TYPE_BROADCAST;
     if (msg.publish_type != NAN_PUBLISH_TYPE_UNSOLICITED)
       msg.tx_type = NAN_TX_TYPE_UNICAST;
 
-    return hal_fn.wifi_nan_publish_request(transaction_id, handle, &msg);
+    nan_session_config config;
+    setSessionConfig(&config, true, msg.publish_type, msg.publish_count, msg.ttl,
+                     msg.service_name, msg.service_name_len);
+    trackTransaction(transaction_id, NAN_TRANSACTION_PUBLISH, publish_id, &config);
+
+    wifi_error ret = hal_fn.wifi_nan_publish_request(transaction_id, handle, &msg);
+    if (ret != WIFI_SUCCESS) {
+        untrackTransaction(transaction_id);
+    }
+    return ret;
 }
 
 static jint android_net_wifi_nan_subscribe(JNIEnv *env, jclass cls,
@@ -361,16 +2066,20 @@ static jint android_net_wifi_nan_subscribe(JNIEnv *env, jclass cls,
                                            jint iface,
                                            jobject subscribe_data,
                                            jobject subscribe_settings) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_subscribe handle=%p, id=%d", handle, transaction_id);
 
+    nan_discovery_fields fields;
+    if (!getDiscoveryFields(helper, subscribe_data, subscribe_settings, false, &fields)) {
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
     NanSubscribeRequest msg;
     memset(&msg, 0, sizeof(NanSubscribeRequest));
 
     /* hard-coded settings - TBD: move to configurable */
-    msg.period = 500;
     msg.serviceResponseFilter = NAN_SRF_ATTR_PARTIAL_MAC_ADDR;
     msg.serviceResponseInclude = NAN_SRF_INCLUDE_RESPOND;
     msg.useServiceResponseFilter = NAN_DO_NOT_USE_SRF;
@@ -379,47 +2088,31 @@ static jint android_net_wifi_nan_subscribe(JNIEnv *env, jclass cls,
     msg.rssi_threshold_flag = 0;
     msg.connmap = 0;
     msg.num_intf_addr_present = 0;
+    /* follows cluster density */
+    msg.period = discoveryPeriod();
 
     /* configurable settings */
     msg.subscribe_id = subscribe_id;
 
-    JNIObject<jstring> objStr1 = helper.getStringField(subscribe_data, "mServiceName");
-    if (objStr1 == NULL) {
-        ALOGE("Error accessing mServiceName field");
-        return 0;
+    nan_discovery_data data = NAN_DISCOVERY_DATA(msg);
+    if (!readDiscoveryData(helper, env, subscribe_data, &fields, &data)) {
+        return WIFI_ERROR_INVALID_ARGS;
     }
-    ScopedUtfChars chars1(env, objStr1);
-    const char *serviceName = chars1.c_str();
-    if (serviceName == NULL) {
-        ALOGE("Error getting mServiceName");
-        return 0;
-    }
-    msg.service_name_len = strlen(serviceName);
-    strcpy((char*)msg.service_name, serviceName);
 
-    msg.service_specific_info_len = helper.getIntField(subscribe_data, "mServiceSpecificInfoLength");
-    if (msg.service_specific_info_len != 0) {
-        helper.getByteArrayField(subscribe_data, "mServiceSpecificInfo",
-                             msg.service_specific_info, msg.service_specific_info_len);
-    }
+    msg.subscribe_type = (NanSubscribeType)helper.getIntField(subscribe_settings, fields.type);
+    msg.subscribe_count = helper.getIntField(subscribe_settings, fields.count);
+    msg.ttl = helper.getIntField(subscribe_settings, fields.ttl);
 
-    msg.tx_match_filter_len = helper.getIntField(subscribe_data, "mTxFilterLength");
-    if (msg.tx_match_filter_len != 0) {
-        helper.getByteArrayField(subscribe_data, "mTxFilter",
-                             msg.tx_match_filter, msg.tx_match_filter_len);
-    }
+    nan_session_config config;
+    setSessionConfig(&config, false, msg.subscribe_type, msg.subscribe_count, msg.ttl,
+                     msg.service_name, msg.service_name_len);
+    trackTransaction(transaction_id, NAN_TRANSACTION_SUBSCRIBE, subscribe_id, &config);
 
-    msg.rx_match_filter_len = helper.getIntField(subscribe_data, "mRxFilterLength");
-    if (msg.rx_match_filter_len != 0) {
-        helper.getByteArrayField(subscribe_data, "mRxFilter",
-                             msg.rx_match_filter, msg.rx_match_filter_len);
+    wifi_error ret = hal_fn.wifi_nan_subscribe_request(transaction_id, handle, &msg);
+    if (ret != WIFI_SUCCESS) {
+        untrackTransaction(transaction_id);
     }
-
-    msg.subscribe_type = (NanSubscribeType)helper.getIntField(subscribe_settings, "mSubscribeType");
-    msg.subscribe_count = helper.getIntField(subscribe_settings, "mSubscribeCount");
-    msg.ttl = helper.getIntField(subscribe_settings, "mTtlSec");
-
-    return hal_fn.wifi_nan_subscribe_request(transaction_id, handle, &msg);
+    return ret;
 }
 
 static jint android_net_wifi_nan_send_message(JNIEnv *env, jclass cls,
@@ -431,30 +2124,75 @@ static jint android_net_wifi_nan_send_message(JNIEnv *env, jclass cls,
                                               jbyteArray dest,
                                               jbyteArray message,
                                               jint message_length) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_send_message handle=%p, id=%d", handle, transaction_id);
 
-    NanTransmitFollowupRequest msg;
-    memset(&msg, 0, sizeof(NanTransmitFollowupRequest));
+    if (message_length < 0 || message_length > NAN_MAX_SERVICE_SPECIFIC_INFO_LEN) {
+        ALOGE("Invalid message length %d", message_length);
+        return WIFI_ERROR_INVALID_ARGS;
+    }
 
-    /* hard-coded settings - TBD: move to configurable */
-    msg.publish_subscribe_id = pub_sub_id;
-    msg.requestor_instance_id = req_instance_id;
-    msg.priority = NAN_TX_PRIORITY_NORMAL;
-    msg.dw_or_faw = NAN_TRANSMIT_IN_DW;
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    {
+        AutoMutex lock(sFollowupLock);
+
+        int slot = 0;
+        while (slot < NAN_FOLLOWUP_QUEUE_SIZE && sFollowups[slot].state != NAN_FOLLOWUP_FREE) {
+            slot++;
+        }
+        if (slot == NAN_FOLLOWUP_QUEUE_SIZE) {
+            ALOGE("Follow-up queue full, id=%d", transaction_id);
+            return WIFI_ERROR_BUSY;
+        }
+
+        nan_followup *f = &sFollowups[slot];
+        f->id = transaction_id;
+        f->handle = handle;
+        f->retries = 0;
+
+        NanTransmitFollowupRequest *msg = &f->msg;
+        memset(msg, 0, offsetof(NanTransmitFollowupRequest, service_specific_info));
+
+        /* hard-coded settings - TBD: move to configurable */
+        msg->publish_subscribe_id = pub_sub_id;
+        msg->requestor_instance_id = req_instance_id;
+        msg->priority = NAN_TX_PRIORITY_NORMAL;
+        msg->dw_or_faw = NAN_TRANSMIT_IN_DW;
+        msg->recv_indication_cfg = 0;
+
+        /* configurable settings; copied straight into the queued request */
+        msg->service_specific_info_len = message_length;
+        env->GetByteArrayRegion(message, 0, message_length,
+                                (jbyte *) msg->service_specific_info);
+        if (!env->ExceptionCheck()) {
+            env->GetByteArrayRegion(dest, 0, NAN_MAC_ADDR_LEN, (jbyte *) msg->addr);
+        }
+        if (env->ExceptionCheck()) {
+            env->ExceptionClear();
+            ALOGE("Invalid message or destination, id=%d", transaction_id);
+            return WIFI_ERROR_INVALID_ARGS;
+        }
+
+        pushFollowup(slot, false);
+    }
 
-    /* configurable settings */
-    msg.service_specific_info_len = message_length;
+    drainFollowups(results, &numResults);
+    reportFollowupResults(helper, results, numResults);
 
-    ScopedBytesRO messageBytes(env, message);
-    memcpy(msg.service_specific_info, (byte*) messageBytes.get(), message_length);
+    return WIFI_SUCCESS;
+}
 
-    ScopedBytesRO destBytes(env, dest);
-    memcpy(msg.addr, (byte*) destBytes.get(), 6);
+/* submits the queued follow-ups that the window has room for, after onFollowupsReady() */
+static void android_net_wifi_nan_transmit_queued_messages(JNIEnv *env, jclass cls) {
+    JNIHelper helper(env, __func__);
 
-    return hal_fn.wifi_nan_transmit_followup_request(transaction_id, handle, &msg);
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    drainFollowups(results, &numResults);
+    reportFollowupResults(helper, results, numResults);
 }
 
 static jint android_net_wifi_nan_stop_publish(JNIEnv *env, jclass cls,
@@ -462,7 +2200,7 @@ static jint android_net_wifi_nan_stop_publish(JNIEnv *env, jclass cls,
                                               jclass wifi_native_cls,
                                               jint iface,
                                               jint pub_sub_id) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_stop_publish handle=%p, id=%d", handle, transaction_id);
@@ -472,7 +2210,20 @@ static jint android_net_wifi_nan_stop_publish(JNIEnv *env, jclass cls,
 
     msg.publish_id = pub_sub_id;
 
-    return hal_fn.wifi_nan_publish_cancel_request(transaction_id, handle, &msg);
+    forgetMatches(pub_sub_id, 0, false);
+
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    failFollowups(pub_sub_id, false, results, &numResults);
+    reportFollowupResults(helper, results, numResults);
+
+    trackTransaction(transaction_id, NAN_TRANSACTION_PUBLISH_CANCEL, pub_sub_id, NULL);
+
+    wifi_error ret = hal_fn.wifi_nan_publish_cancel_request(transaction_id, handle, &msg);
+    if (ret != WIFI_SUCCESS) {
+        untrackTransaction(transaction_id);
+    }
+    return ret;
 }
 
 static jint android_net_wifi_nan_stop_subscribe(JNIEnv *env, jclass cls,
@@ -480,7 +2231,7 @@ static jint android_net_wifi_nan_stop_subscribe(JNIEnv *env, jclass cls,
                                               jclass wifi_native_cls,
                                               jint iface,
                                               jint pub_sub_id) {
-    JNIHelper helper(env);
+    JNIHelper helper(env, __func__);
     wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
 
     ALOGD("android_net_wifi_nan_stop_subscribe handle=%p, id=%d", handle, transaction_id);
@@ -490,7 +2241,172 @@ static jint android_net_wifi_nan_stop_subscribe(JNIEnv *env, jclass cls,
 
     msg.subscribe_id = pub_sub_id;
 
-    return hal_fn.wifi_nan_subscribe_cancel_request(transaction_id, handle, &msg);
+    forgetMatches(pub_sub_id, 0, false);
+
+    nan_followup_result results[NAN_FOLLOWUP_QUEUE_SIZE + 1];
+    int numResults = 0;
+    failFollowups(pub_sub_id, false, results, &numResults);
+    reportFollowupResults(helper, results, numResults);
+
+    trackTransaction(transaction_id, NAN_TRANSACTION_SUBSCRIBE_CANCEL, pub_sub_id, NULL);
+
+    wifi_error ret = hal_fn.wifi_nan_subscribe_cancel_request(transaction_id, handle, &msg);
+    if (ret != WIFI_SUCCESS) {
+        untrackTransaction(transaction_id);
+    }
+    return ret;
+}
+
+static jint android_net_wifi_nan_request_stats(JNIEnv *env, jclass cls,
+                                              jclass wifi_native_cls,
+                                              jint iface,
+                                              jint types) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
+
+    ALOGD("android_net_wifi_nan_request_stats handle=%p, types=0x%x", handle, types);
+
+    if (handle == NULL) {
+        return WIFI_ERROR_UNINITIALIZED;
+    }
+    if (types == 0 || (types & ~((1 << (NAN_STATS_ID_DE_DW + 1)) - 1)) != 0) {
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    requestStats(handle, types);
+    return WIFI_SUCCESS;
+}
+
+static jint android_net_wifi_nan_set_cluster_size_alert(JNIEnv *env, jclass cls,
+                                                       jclass wifi_native_cls,
+                                                       jint iface,
+                                                       jint threshold) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
+
+    ALOGD("android_net_wifi_nan_set_cluster_size_alert handle=%p, threshold=%d",
+          handle, threshold);
+
+    if (threshold < 0) {
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    {
+        AutoMutex lock(sDensityLock);
+        sTcaThreshold = threshold;
+    }
+    /* otherwise armed when NAN is next enabled */
+    return isNanEnabled() ? armClusterSizeAlert(handle) : WIFI_SUCCESS;
+}
+
+static jint android_net_wifi_nan_rearm_cluster_size_alert(JNIEnv *env, jclass cls,
+                                                          jclass wifi_native_cls,
+                                                          jint iface) {
+    JNIHelper helper(env, __func__);
+    wifi_interface_handle handle = getIfaceHandle(helper, wifi_native_cls, iface);
+
+    if (!isNanEnabled() || !takeClusterSizeAlertRearm()) {
+        return WIFI_SUCCESS;
+    }
+
+    ALOGD("android_net_wifi_nan_rearm_cluster_size_alert handle=%p", handle);
+    return armClusterSizeAlert(handle);
+}
+
+static jlongArray android_net_wifi_nan_get_stats_samples(JNIEnv *env, jclass cls,
+                                                         jlong since_ms) {
+    JNIHelper helper(env, __func__);
+
+    jlong *packed;
+    int numPacked = 0;
+    {
+        AutoMutex lock(sStatsLock);
+
+        int first = sStatsRingLen;
+        for (int i = 0; i < sStatsRingLen; i++) {
+            const nan_stats_sample *s = &sStatsRing[(sStatsRingHead + i) % NAN_STATS_RING_SIZE];
+            if (ns2ms(s->timestamp) > since_ms) {
+                if (first == sStatsRingLen) {
+                    first = i;
+                }
+                numPacked += NAN_STATS_SAMPLE_HEADER + s->num_values;
+            }
+        }
+
+        packed = new jlong[numPacked > 0 ? numPacked : 1];
+        int n = 0;
+        for (int i = first; i < sStatsRingLen; i++) {
+            const nan_stats_sample *s = &sStatsRing[(sStatsRingHead + i) % NAN_STATS_RING_SIZE];
+            packed[n++] = ns2ms(s->timestamp);
+            packed[n++] = s->type;
+            packed[n++] = s->num_values;
+            for (int j = 0; j < s->num_values; j++) {
+                packed[n++] = (jlong) s->values[j];
+            }
+        }
+    }
+
+    JNIObject<jlongArray> samples = helper.newLongArray(numPacked);
+    if (samples != NULL && numPacked > 0) {
+        helper.setLongArrayRegion(samples, 0, numPacked, packed);
+    }
+    delete[] packed;
+
+    return samples.detach();
+}
+
+static jstring android_net_wifi_nan_dump_sessions(JNIEnv *env, jclass cls) {
+    JNIHelper helper(env, __func__);
+    String8 dump;
+
+    {
+        AutoMutex lock(sSessionLock);
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        int outstanding = 0;
+        for (int i = 0; i < NAN_TRANSACTION_TABLE_SIZE; i++) {
+            if (sTransactions[i].type != NAN_TRANSACTION_FREE) {
+                outstanding++;
+            }
+        }
+        dump.appendFormat("outstanding transactions: %d, untracked responses: %u\n",
+                          outstanding, sUnknownResponses);
+
+        for (int i = 0; i < NAN_SESSION_TABLE_SIZE; i++) {
+            const nan_session *s = &sSessions[i];
+            if (s->state == NAN_SESSION_FREE) {
+                continue;
+            }
+            dump.appendFormat("%s %d [%s] service=\"%s\" type=%d count=%d ttl=%d age=%llds",
+                              s->config.publish ? "publish" : "subscribe",
+                              s->publish_subscribe_id, sessionStateName(s->state),
+                              s->config.service_name, s->config.type, s->config.count,
+                              s->config.ttl, (long long) ((now - s->started) / 1000000000LL));
+            if (s->state == NAN_SESSION_TERMINATED) {
+                dump.appendFormat(" reason=%d ended=%llds ago", s->terminate_reason,
+                                  (long long) ((now - s->ended) / 1000000000LL));
+            }
+            dump.appendFormat("\n  peers=%d matches=%u expired=%u followups sent=%u failed=%u"
+                              " received=%u failures=%u\n",
+                              s->num_peers, s->matches, s->matches_expired, s->followups_sent,
+                              s->followups_failed, s->followups_received, s->failures);
+        }
+    }
+
+    {
+        AutoMutex lock(sStatsLock);
+        dump.appendFormat("stats sampling: types=0x%x samples=%d requests=%u failures=%u\n",
+                          sStatsTypes, sStatsRingLen, sStatsRequests, sStatsFailures);
+    }
+
+    {
+        AutoMutex lock(sDensityLock);
+        dump.appendFormat("cluster size alert: threshold=%u armed=%u size=%d alerts=%u"
+                          " failures=%u beacon payloads=%u\n", sTcaThreshold, sTcaArmed,
+                          sClusterSize, sTcaAlerts, sTcaFailures, sBeaconPayloads);
+    }
+
+    return helper.newStringUTF(dump.string()).detach();
 }
 
 // ----------------------------------------------------------------------------
@@ -502,15 +2418,21 @@ static jint android_net_wifi_nan_stop_subscribe(JNIEnv *env, jclass cls,
 static JNINativeMethod gWifiNanMethods[] = {
     /* name, signature, funcPtr */
 
-    {"initNanHandlersNative", "(Ljava/lang/Object;I)I", (void*)android_net_wifi_nan_register_handler },
+    {"initNanHandlersNative", "(Ljava/lang/Object;II)I", (void*)android_net_wifi_nan_register_handler },
     {"getCapabilitiesNative", "(SLjava/lang/Object;I)I", (void*)android_net_wifi_nan_get_capabilities },
     {"enableAndConfigureNative", "(SLjava/lang/Object;ILandroid/net/wifi/nan/ConfigRequest;)I", (void*)android_net_wifi_nan_enable_request },
     {"disableNative", "(SLjava/lang/Object;I)I", (void*)android_net_wifi_nan_disable_request },
     {"publishNative", "(SILjava/lang/Object;ILandroid/net/wifi/nan/PublishData;Landroid/net/wifi/nan/PublishSettings;)I", (void*)android_net_wifi_nan_publish },
     {"subscribeNative", "(SILjava/lang/Object;ILandroid/net/wifi/nan/SubscribeData;Landroid/net/wifi/nan/SubscribeSettings;)I", (void*)android_net_wifi_nan_subscribe },
     {"sendMessageNative", "(SLjava/lang/Object;III[B[BI)I", (void*)android_net_wifi_nan_send_message },
+    {"transmitQueuedMessagesNative", "()V", (void*)android_net_wifi_nan_transmit_queued_messages },
     {"stopPublishNative", "(SLjava/lang/Object;II)I", (void*)android_net_wifi_nan_stop_publish },
     {"stopSubscribeNative", "(SLjava/lang/Object;II)I", (void*)android_net_wifi_nan_stop_subscribe },
+    {"requestStatsNative", "(Ljava/lang/Object;II)I", (void*)android_net_wifi_nan_request_stats },
+    {"getStatsSamplesNative", "(J)[J", (void*)android_net_wifi_nan_get_stats_samples },
+    {"setClusterSizeAlertNative", "(Ljava/lang/Object;II)I", (void*)android_net_wifi_nan_set_cluster_size_alert },
+    {"rearmClusterSizeAlertNative", "(Ljava/lang/Object;I)I", (void*)android_net_wifi_nan_rearm_cluster_size_alert },
+    {"dumpSessionsNative", "()Ljava/lang/String;", (void*)android_net_wifi_nan_dump_sessions },
 };
 
 /* User to register native functions */
@@ -17,10 +17,12 @@
 #define LOG_TAG "wifi"
 
 #include "jni.h"
+#include <string.h>
+#include <algorithm>
 #include <ScopedUtfChars.h>
 #include <utils/misc.h>
-#include <android_runtime/AndroidRuntime.h>
 #include <utils/Log.h>
+#include <utils/Mutex.h>
 #include <utils/String16.h>
 
 #include "wifi.h"
@@ -31,13 +33,41 @@ namespace android {
 
 /* JNI Helpers for wifi_hal implementation */
 
-JNIHelper::JNIHelper(JavaVM *vm)
+bool JNIHelper::sRefAccounting = false;
+
+static const int MAX_REF_SCOPES = 256;
+static Mutex sRefStatsLock;
+static JNIRefStats sRefStats[MAX_REF_SCOPES];
+static int sNumRefScopes = 0;
+static int sLiveGlobalRefs = 0;
+
+static JNIRefStats *getRefScope(const char *scope) {
+    if (scope == NULL) {
+        scope = "(unnamed)";
+    }
+    for (int i = 0; i < sNumRefScopes; i++) {
+        if (sRefStats[i].scope == scope || strcmp(sRefStats[i].scope, scope) == 0) {
+            return &sRefStats[i];
+        }
+    }
+    if (sNumRefScopes == MAX_REF_SCOPES) {
+        return NULL;
+    }
+    JNIRefStats *stats = &sRefStats[sNumRefScopes++];
+    memset(stats, 0, sizeof(*stats));
+    stats->scope = scope;
+    return stats;
+}
+
+JNIHelper::JNIHelper(JavaVM *vm, const char *scope)
+    : mScope(scope), mLocalRefs(0), mEscapedRefs(0), mMaxLocalRefs(0), mGlobalRefs(0)
 {
     vm->AttachCurrentThread(&mEnv, NULL);
     mVM = vm;
 }
 
-JNIHelper::JNIHelper(JNIEnv *env)
+JNIHelper::JNIHelper(JNIEnv *env, const char *scope)
+    : mScope(scope), mLocalRefs(0), mEscapedRefs(0), mMaxLocalRefs(0), mGlobalRefs(0)
 {
     mVM  = NULL;
     mEnv = env;
@@ -45,6 +75,23 @@ JNIHelper::JNIHelper(JNIEnv *env)
 
 JNIHelper::~JNIHelper()
 {
+    if (sRefAccounting) {
+        AutoMutex lock(sRefStatsLock);
+        JNIRefStats *stats = getRefScope(mScope);
+        if (stats != NULL) {
+            /* a native may hand one reference back to Java as its return value */
+            int returned = (mVM == NULL && mEscapedRefs > 0) ? 1 : 0;
+            int net = mLocalRefs + mEscapedRefs - returned;
+            stats->calls++;
+            stats->maxLocalRefs = std::max(stats->maxLocalRefs, mMaxLocalRefs);
+            stats->maxNetLocalRefs = std::max(stats->maxNetLocalRefs, net);
+            if (net > 0) {
+                stats->leakingCalls++;
+            }
+            stats->netGlobalRefs += mGlobalRefs;
+        }
+    }
+
     if (mVM != NULL) {
         // mVM->DetachCurrentThread();  /* 'attempting to detach while still running code' */
         mVM = NULL;                     /* not really required; but may help debugging */
@@ -52,19 +99,73 @@ JNIHelper::~JNIHelper()
     }
 }
 
+void JNIHelper::setRefAccounting(bool enabled) {
+    sRefAccounting = enabled;
+}
+
+void JNIHelper::resetRefStats() {
+    AutoMutex lock(sRefStatsLock);
+    sNumRefScopes = 0;
+}
+
+int JNIHelper::getRefStats(JNIRefStats *stats, int max) {
+    AutoMutex lock(sRefStatsLock);
+    for (int i = 0; i < sNumRefScopes && i < max; i++) {
+        stats[i] = sRefStats[i];
+    }
+    return sNumRefScopes;
+}
+
+int JNIHelper::getLiveGlobalRefs() {
+    AutoMutex lock(sRefStatsLock);
+    return sLiveGlobalRefs;
+}
+
+bool JNIHelper::checkRefStats() {
+    AutoMutex lock(sRefStatsLock);
+    bool ok = true;
+    for (int i = 0; i < sNumRefScopes; i++) {
+        const JNIRefStats &stats = sRefStats[i];
+        if (stats.leakingCalls > 0) {
+            ALOGE("%s: %u of %u calls returned with live local refs (max %d)",
+                    stats.scope, stats.leakingCalls, stats.calls, stats.maxNetLocalRefs);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
 jobject JNIHelper::newGlobalRef(jobject obj) {
-    return mEnv->NewGlobalRef(obj);
+    jobject ref = mEnv->NewGlobalRef(obj);
+    if (sRefAccounting && ref != NULL) {
+        AutoMutex lock(sRefStatsLock);
+        sLiveGlobalRefs++;
+        mGlobalRefs++;
+    }
+    return ref;
 }
 
 void JNIHelper::deleteGlobalRef(jobject obj) {
+    if (sRefAccounting && obj != NULL) {
+        AutoMutex lock(sRefStatsLock);
+        sLiveGlobalRefs--;
+        mGlobalRefs--;
+    }
     mEnv->DeleteGlobalRef(obj);
 }
 
 jobject JNIHelper::newLocalRef(jobject obj) {
-    return mEnv->NewLocalRef(obj);
+    jobject ref = mEnv->NewLocalRef(obj);
+    if (ref != NULL) {
+        trackLocalRefs(1);
+    }
+    return ref;
 }
 
 void JNIHelper::deleteLocalRef(jobject obj) {
+    if (obj != NULL) {
+        trackLocalRefs(-1);
+    }
     mEnv->DeleteLocalRef(obj);
 }
 
@@ -74,8 +175,8 @@ void JNIHelper::throwException(const char *message, int line)
 
     const char *className = "java/lang/Exception";
 
-    jclass exClass = mEnv->FindClass(className );
-    if ( exClass == NULL ) {
+    JNIObject<jclass> exClass(*this, mEnv->FindClass(className));
+    if (exClass == NULL) {
         ALOGE("Could not find exception class to throw error");
         ALOGE("error at line %d: %s", line, message);
         return;
@@ -134,13 +235,15 @@ jlong JNIHelper::getLongField(jobject obj, const char *name)
 
 JNIObject<jstring> JNIHelper::getStringField(jobject obj, const char *name)
 {
-    JNIObject<jobject> m = getObjectField(obj, name, "Ljava/lang/String;");
-    if (m == NULL) {
+    JNIObject<jclass> cls(*this, mEnv->GetObjectClass(obj));
+    jfieldID field = mEnv->GetFieldID(cls, name, "Ljava/lang/String;");
+
+    JNIObject<jstring> value(*this,
+            field != 0 ? (jstring)mEnv->GetObjectField(obj, field) : NULL);
+    if (value == NULL) {
         THROW(*this, "Error in accessing field");
-        return JNIObject<jstring>(*this, NULL);
     }
-
-    return JNIObject<jstring>(*this, (jstring)m.detach());
+    return value;
 }
 
 bool JNIHelper::getStringFieldValue(jobject obj, const char *name, char *buf, int size)
@@ -152,9 +255,8 @@ bool JNIHelper::getStringFieldValue(jobject obj, const char *name, char *buf, in
         return 0;
     }
 
-    JNIObject<jobject> value(*this, mEnv->GetObjectField(obj, field));
-    JNIObject<jstring> string(*this, (jstring)value.clone());
-    ScopedUtfChars chars(mEnv, string);
+    JNIObject<jstring> value(*this, (jstring)mEnv->GetObjectField(obj, field));
+    ScopedUtfChars chars(mEnv, value);
 
     const char *utf = chars.c_str();
     if (utf == NULL) {
@@ -265,6 +367,50 @@ void JNIHelper::getByteArrayField(jobject obj, const char *name, byte* buf, int
     mEnv->ReleaseByteArrayElements(array, elem, 0);
 }
 
+jfieldID JNIHelper::getFieldID(jobject obj, const char *name, const char *type) {
+    JNIObject<jclass> cls(*this, mEnv->GetObjectClass(obj));
+    jfieldID field = mEnv->GetFieldID(cls, name, type);
+    if (field == 0) {
+        THROW(*this, "Error in accessing field definition");
+    }
+    return field;
+}
+
+jint JNIHelper::getIntField(jobject obj, jfieldID field) {
+    return mEnv->GetIntField(obj, field);
+}
+
+JNIObject<jstring> JNIHelper::getStringField(jobject obj, jfieldID field) {
+    return JNIObject<jstring>(*this, (jstring)mEnv->GetObjectField(obj, field));
+}
+
+bool JNIHelper::getByteArrayField(jobject obj, jfieldID field, byte* buf, int size) {
+    JNIObject<jbyteArray> array(*this, (jbyteArray)mEnv->GetObjectField(obj, field));
+    if (array == NULL || mEnv->GetArrayLength(array) < size) {
+        return false;
+    }
+
+    /* straight into buf: no pinning or intermediate copy as with GetByteArrayElements */
+    mEnv->GetByteArrayRegion(array, 0, size, (jbyte *) buf);
+    return true;
+}
+
+JNIObject<jintArray> JNIHelper::getIntArrayField(jobject obj, jfieldID field) {
+    return JNIObject<jintArray>(*this, (jintArray) mEnv->GetObjectField(obj, field));
+}
+
+void JNIHelper::setIntField(jobject obj, jfieldID field, jint value) {
+    mEnv->SetIntField(obj, field, value);
+}
+
+void JNIHelper::setLongField(jobject obj, jfieldID field, jlong value) {
+    mEnv->SetLongField(obj, field, value);
+}
+
+void JNIHelper::setObjectField(jobject obj, jfieldID field, jobject value) {
+    mEnv->SetObjectField(obj, field, value);
+}
+
 jlong JNIHelper::getStaticLongArrayField(jobject obj, const char *name, int index)
 {
     JNIObject<jclass> cls(*this, mEnv->GetObjectClass(obj));
@@ -531,7 +677,7 @@ void JNIHelper::callMethod(jobject obj, const char *method, const char *signatur
     va_list params;
     va_start(params, signature);
 
-    jclass cls = mEnv->GetObjectClass(obj);
+    JNIObject<jclass> cls(*this, mEnv->GetObjectClass(obj));
     jmethodID methodID = mEnv->GetMethodID(cls, method, signature);
     if (methodID == 0) {
         ALOGE("Error in getting method ID");
@@ -606,16 +752,14 @@ JNIObject<jobjectArray> JNIHelper::createObjectArray(const char *className, int
     JNIObject<jclass> cls(*this, mEnv->FindClass(className));
     if (cls == NULL) {
         ALOGE("Error in finding class %s", className);
-        return JNIObject<jobjectArray>(*this, NULL);
     }
 
-    JNIObject<jobject> array(*this, mEnv->NewObjectArray(num, cls.get(), NULL));
-    if (array.get() == NULL) {
+    JNIObject<jobjectArray> array(*this,
+            cls != NULL ? mEnv->NewObjectArray(num, cls.get(), NULL) : NULL);
+    if (cls != NULL && array.get() == NULL) {
         ALOGE("Error in creating array of class %s", className);
-        return JNIObject<jobjectArray>(*this, NULL);
     }
-
-    return JNIObject<jobjectArray>(*this, (jobjectArray)array.detach());
+    return array;
 }
 
 JNIObject<jobject> JNIHelper::getObjectArrayElement(jobjectArray array, int index)
@@ -658,6 +802,10 @@ JNIObject<jstring> JNIHelper::newStringUTF(const char *utf) {
     return JNIObject<jstring>(*this, mEnv->NewStringUTF(utf));
 }
 
+JNIObject<jobject> JNIHelper::newDirectByteBuffer(void *address, jlong capacity) {
+    return JNIObject<jobject>(*this, mEnv->NewDirectByteBuffer(address, capacity));
+}
+
 void JNIHelper::setObjectArrayElement(jobjectArray array, int index, jobject obj) {
     mEnv->SetObjectArrayElement(array, index, obj);
 }
@@ -20,6 +20,21 @@ namespace android {
 
 class JNIHelper;
 
+/*
+ * Reference accounting (off by default, see JNIHelper::setRefAccounting).
+ * Every JNIHelper counts the local references created and deleted through it
+ * and through the JNIObjects that hold it, and on destruction folds them into
+ * the stats of its scope - the native method or HAL callback that created it.
+ */
+struct JNIRefStats {
+    const char *scope;
+    unsigned calls;
+    int maxLocalRefs;           /* high-water mark of live local refs in one call */
+    int maxNetLocalRefs;        /* most local refs a call left live when it returned */
+    unsigned leakingCalls;      /* calls that returned with live local refs */
+    int netGlobalRefs;          /* global refs created minus deleted */
+};
+
 template<typename T>
 class JNIObject {
 protected:
@@ -42,11 +57,7 @@ public:
         return mObj == NULL;
     }
     void release();
-    T detach() {
-        T tObj = mObj;
-        mObj = NULL;
-        return tObj;
-    }
+    T detach();
     T clone();
     JNIObject<T>& operator = (const JNIObject<T>& rhs) {
         release();
@@ -67,11 +78,33 @@ class JNIHelper {
     JavaVM *mVM;
     JNIEnv *mEnv;
 
+    /* reference accounting */
+    static bool sRefAccounting;
+    const char *mScope;
+    int mLocalRefs;             /* held by JNIObjects */
+    int mEscapedRefs;           /* handed out by JNIObject::detach() or clone() */
+    int mMaxLocalRefs;
+    int mGlobalRefs;
+
 public :
-    JNIHelper(JavaVM *vm);
-    JNIHelper(JNIEnv *env);
+    /* scope names the native method or callback for reference accounting, usually __func__ */
+    JNIHelper(JavaVM *vm, const char *scope = NULL);
+    JNIHelper(JNIEnv *env, const char *scope = NULL);
     ~JNIHelper();
 
+    /*
+     * Reference accounting; enable it before any native method runs. References
+     * handed out by JNIObject::detach() or clone() stay counted as live, except
+     * for one per native method call: its return value.
+     */
+    static void setRefAccounting(bool enabled);
+    static bool isRefAccounting() { return sRefAccounting; }
+    static void resetRefStats();
+    static int getRefStats(JNIRefStats *stats, int max);   /* returns the number of scopes */
+    static int getLiveGlobalRefs();
+    /* logs every scope that returned with live local refs; true if there were none */
+    static bool checkRefStats();
+
     void throwException(const char *message, int line);
 
     /* helpers to deal with members */
@@ -83,6 +116,16 @@ public :
     JNIObject<jobject> getObjectField(jobject obj, const char *name, const char *type);
     JNIObject<jobjectArray> getArrayField(jobject obj, const char *name, const char *type);
     void getByteArrayField(jobject obj, const char *name, byte* buf, int size);
+    /* the same by field id, for hot paths that resolve their fields once */
+    jfieldID getFieldID(jobject obj, const char *name, const char *type);
+    jint getIntField(jobject obj, jfieldID field);
+    JNIObject<jstring> getStringField(jobject obj, jfieldID field);
+    /* copies the first size bytes; false if the array is null or shorter */
+    bool getByteArrayField(jobject obj, jfieldID field, byte* buf, int size);
+    JNIObject<jintArray> getIntArrayField(jobject obj, jfieldID field);
+    void setIntField(jobject obj, jfieldID field, jint value);
+    void setLongField(jobject obj, jfieldID field, jlong value);
+    void setObjectField(jobject obj, jfieldID field, jobject value);
     jlong getLongArrayField(jobject obj, const char *name, int index);
     JNIObject<jobject> getObjectArrayField(
             jobject obj, const char *name, const char *type, int index);
@@ -120,6 +163,8 @@ public :
     JNIObject<jintArray> newIntArray(int num);
     JNIObject<jlongArray> newLongArray(int num);
     JNIObject<jstring> newStringUTF(const char *utf);
+    /* the memory must outlive every reference to the buffer */
+    JNIObject<jobject> newDirectByteBuffer(void *address, jlong capacity);
     void setObjectArrayElement(jobjectArray array, int index, jobject obj);
     void setByteArrayRegion(jbyteArray array, int from, int to, const jbyte *bytes);
     void setIntArrayRegion(jintArray array, int from, int to, const jint *ints);
@@ -139,12 +184,28 @@ private:
     friend class JNIObject<jintArray>;
     jobject newLocalRef(jobject obj);
     void deleteLocalRef(jobject obj);
+
+    void trackLocalRefs(int delta, bool escaped = false) {
+        if (sRefAccounting) {
+            mLocalRefs += delta;
+            if (escaped) {
+                mEscapedRefs++;
+            }
+            if (mLocalRefs + mEscapedRefs > mMaxLocalRefs) {
+                mMaxLocalRefs = mLocalRefs + mEscapedRefs;
+            }
+        }
+    }
 };
 
 template<typename T>
 JNIObject<T>::JNIObject(JNIHelper &helper, T obj)
     : mHelper(helper), mObj(obj)
-{ }
+{
+    if (obj != NULL) {
+        mHelper.trackLocalRefs(1);
+    }
+}
 
 template<typename T>
 JNIObject<T>::JNIObject(const JNIObject<T>& rhs)
@@ -167,10 +228,25 @@ void JNIObject<T>::release()
     }
 }
 
+template<typename T>
+T JNIObject<T>::detach()
+{
+    T tObj = mObj;
+    if (tObj != NULL) {
+        mHelper.trackLocalRefs(-1, true);
+    }
+    mObj = NULL;
+    return tObj;
+}
+
 template<typename T>
 T JNIObject<T>::clone()
 {
-    return mHelper.newLocalRef(mObj);
+    T tObj = (T)mHelper.newLocalRef(mObj);
+    if (tObj != NULL) {
+        mHelper.trackLocalRefs(-1, true);
+    }
+    return tObj;
 }
 
 }
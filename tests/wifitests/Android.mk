@@ -55,6 +55,243 @@ LOCAL_SHARED_LIBRARIES += \
 
 include $(BUILD_SHARED_LIBRARY)
 
+# Make host JNI bridge library
+# ============================================================
+# Builds the real WifiNative JNI bridge for Linux against an in-process fake
+# JavaVM and a host HAL, so it can be profiled with perf, valgrind or the
+# sanitizers without a device.
+
+# Every executable linking it must also wrap ioctl(): wifi_legacy_host.cpp
+# fakes the netdevice flags that set_iface_flags() reads and sets.
+wifi_host_ldflags := -Wl,--wrap=ioctl
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+LOCAL_C_INCLUDES += \
+	$(JNI_H_INCLUDE) \
+	$(LOCAL_PATH)/host \
+	$(LOCAL_PATH)/../../service/jni \
+	$(call include-path-for, libhardware)/hardware \
+	$(call include-path-for, libhardware_legacy)/hardware_legacy \
+	libcore/include
+
+LOCAL_SRC_FILES := \
+	../../service/jni/com_android_server_wifi_WifiNative.cpp \
+	../../service/jni/jni_helper.cpp \
+	../../service/lib/wifi_hal_stub.cpp \
+	host/fake_jni.cpp \
+	host/wifi_hal_host.cpp \
+	host/wifi_host_env.cpp \
+	host/wifi_legacy_host.cpp \
+	host/wifi_virtual_radio.cpp
+
+ifdef INCLUDE_NAN_FEATURE
+LOCAL_SRC_FILES += \
+	../../service/jni/com_android_server_wifi_nan_WifiNanNative.cpp
+endif
+
+LOCAL_EXPORT_C_INCLUDE_DIRS := \
+	$(LOCAL_PATH)/host \
+	$(LOCAL_PATH)/../../service/jni
+
+LOCAL_MODULE := libwifi-service-host
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+# Make host JNI bridge smoke test
+# ============================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+LOCAL_C_INCLUDES += \
+	$(JNI_H_INCLUDE) \
+	$(call include-path-for, libhardware_legacy)/hardware_legacy
+
+LOCAL_SRC_FILES := \
+	host/wifi_jni_host_main.cpp
+
+LOCAL_STATIC_LIBRARIES += \
+	libwifi-service-host \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_SHARED_LIBRARIES += \
+	libnativehelper
+
+LOCAL_LDLIBS += -lpthread
+LOCAL_LDFLAGS += $(wifi_host_ldflags)
+
+LOCAL_MODULE := wifi-jni-host
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Make host JNI bridge soak test
+# ============================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+LOCAL_C_INCLUDES += \
+	$(JNI_H_INCLUDE) \
+	$(call include-path-for, libhardware_legacy)/hardware_legacy
+
+LOCAL_SRC_FILES := \
+	host/wifi_jni_soak_main.cpp
+
+LOCAL_STATIC_LIBRARIES += \
+	libwifi-service-host \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_SHARED_LIBRARIES += \
+	libnativehelper
+
+LOCAL_LDLIBS += -lpthread
+LOCAL_LDFLAGS += $(wifi_host_ldflags)
+
+LOCAL_MODULE := wifi-jni-soak
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Make host JNI bridge unit tests
+# ============================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+LOCAL_C_INCLUDES += \
+	$(JNI_H_INCLUDE) \
+	$(call include-path-for, libhardware_legacy)/hardware_legacy
+
+LOCAL_SRC_FILES := \
+	host/wifi_host_test.cpp \
+	host/apf_interpreter_test.cpp \
+	host/wifi_apf_cache_test.cpp \
+	host/wifi_channel_cache_test.cpp \
+	host/wifi_event_ring_test.cpp \
+	host/wifi_feature_set_test.cpp \
+	host/wifi_keepalive_test.cpp \
+	host/wifi_link_stats_history_test.cpp \
+	host/wifi_scan_fingerprint_test.cpp \
+	host/wifi_scan_history_test.cpp \
+	host/wifi_scan_period_control_test.cpp \
+	host/wifi_tdls_test.cpp \
+	host/wifi_wake_reason_test.cpp
+
+LOCAL_STATIC_LIBRARIES += \
+	libwifi-service-host \
+	libwifi-apf-host \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_SHARED_LIBRARIES += \
+	libnativehelper
+
+LOCAL_LDLIBS += -lpthread
+LOCAL_LDFLAGS += $(wifi_host_ldflags)
+
+LOCAL_MODULE := wifi-jni-host-tests
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+# Make host JNI marshaller benchmarks
+# ============================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+ifdef INCLUDE_NAN_FEATURE
+LOCAL_CFLAGS += -DINCLUDE_NAN_FEATURE
+endif
+
+LOCAL_C_INCLUDES += \
+	$(JNI_H_INCLUDE) \
+	$(call include-path-for, libhardware_legacy)/hardware_legacy
+
+LOCAL_SRC_FILES := \
+	host/wifi_jni_benchmark.cpp
+
+LOCAL_STATIC_LIBRARIES += \
+	libwifi-service-host \
+	libgoogle-benchmark \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_SHARED_LIBRARIES += \
+	libnativehelper
+
+LOCAL_LDLIBS += -lpthread
+LOCAL_LDFLAGS += $(wifi_host_ldflags)
+
+LOCAL_MODULE := wifi-jni-benchmark
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Make host APF interpreter
+# ============================================================
+# Runs APF programs the way the firmware does, to measure their drop ratio and
+# instruction cost against pcap captures off-device.
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+LOCAL_SRC_FILES := \
+	host/apf_interpreter.cpp
+
+LOCAL_EXPORT_C_INCLUDE_DIRS := \
+	$(LOCAL_PATH)/host
+
+LOCAL_MODULE := libwifi-apf-host
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CFLAGS += -Wall -Werror -Wextra -Wno-unused-parameter -Wno-unused-function \
+                -Wunused-variable -Winit-self -Wwrite-strings -Wshadow
+
+LOCAL_SRC_FILES := \
+	host/wifi_apf_run_main.cpp
+
+LOCAL_STATIC_LIBRARIES += \
+	libwifi-apf-host
+
+LOCAL_MODULE := wifi-apf-run
+
+include $(BUILD_HOST_EXECUTABLE)
+
 # Make test APK
 # ============================================================
 include $(CLEAR_VARS)
@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "apf_interpreter.h"
+
+namespace {
+
+/* opcodes: bits 7..3 of the first byte of an instruction */
+enum {
+    LDB_OPCODE = 1,                 /* register = packet[imm] */
+    LDH_OPCODE = 2,
+    LDW_OPCODE = 3,
+    LDBX_OPCODE = 4,                /* register = packet[imm + R1] */
+    LDHX_OPCODE = 5,
+    LDWX_OPCODE = 6,
+    ADD_OPCODE = 7,                 /* R0 op= (register bit ? R1 : imm) */
+    MUL_OPCODE = 8,
+    DIV_OPCODE = 9,
+    AND_OPCODE = 10,
+    OR_OPCODE = 11,
+    SH_OPCODE = 12,                 /* left if positive, right if negative */
+    LI_OPCODE = 13,                 /* register = sign extended imm */
+    JMP_OPCODE = 14,
+    JEQ_OPCODE = 15,                /* jump by imm if R0 op (register bit ? R1 : imm2) */
+    JNE_OPCODE = 16,
+    JGT_OPCODE = 17,
+    JLT_OPCODE = 18,
+    JSET_OPCODE = 19,
+    JNEBS_OPCODE = 20,              /* jump if imm2 program bytes differ from packet[R0] */
+    EXT_OPCODE = 21,                /* imm selects the operation */
+};
+
+enum {
+    LDM_EXT_OPCODE = 0,             /* register = memory[imm - LDM_EXT_OPCODE] */
+    STM_EXT_OPCODE = 16,            /* memory[imm - STM_EXT_OPCODE] = register */
+    NOT_EXT_OPCODE = 32,
+    NEG_EXT_OPCODE = 33,
+    SWAP_EXT_OPCODE = 34,
+    MOV_EXT_OPCODE = 35,            /* register = other register */
+};
+
+/* memory slots the chip fills in before running the program */
+const int kMemoryIpv4HeaderSize = 13;
+const int kMemoryPacketSize = 14;
+const int kMemoryFilterAge = 15;
+
+const uint32_t kEthHeaderLength = 14;
+
+const uint32_t kPcapMagic = 0xa1b2c3d4;
+const uint32_t kPcapMagicNanos = 0xa1b23c4d;
+const uint32_t kPcapLinkTypeEthernet = 1;
+const uint32_t kPcapMaxPacket = 256 * 1024;
+
+uint32_t swap32(uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+/* reads a pcap file; records are handed out one by one */
+class PcapReader {
+public:
+    PcapReader() : mFile(NULL), mSwapped(false), mNanos(false) {}
+    ~PcapReader() {
+        if (mFile != NULL) {
+            fclose(mFile);
+        }
+    }
+
+    const char *open(const char *path) {
+        mFile = fopen(path, "rb");
+        if (mFile == NULL) {
+            return "cannot open the capture";
+        }
+        uint32_t header[6];
+        if (fread(header, sizeof(header), 1, mFile) != 1) {
+            return "truncated pcap header";
+        }
+        uint32_t magic = header[0];
+        mSwapped = magic == swap32(kPcapMagic) || magic == swap32(kPcapMagicNanos);
+        if (mSwapped) {
+            magic = swap32(magic);
+        }
+        if (magic != kPcapMagic && magic != kPcapMagicNanos) {
+            return "not a pcap capture";
+        }
+        mNanos = magic == kPcapMagicNanos;
+        if (get(header[5]) != kPcapLinkTypeEthernet) {
+            return "not an Ethernet capture";
+        }
+        return NULL;
+    }
+
+    /* false at the end of the capture, or with *error set if a record is bad */
+    bool next(std::vector<uint8_t> *packet, uint32_t *orig_len, uint64_t *time_us,
+            const char **error) {
+        uint32_t header[4];
+        size_t n = fread(header, 1, sizeof(header), mFile);
+        if (n == 0) {
+            return false;
+        }
+        if (n != sizeof(header)) {
+            *error = "truncated pcap record header";
+            return false;
+        }
+        uint32_t incl_len = get(header[2]);
+        if (incl_len > kPcapMaxPacket) {
+            *error = "pcap record too large";
+            return false;
+        }
+        packet->resize(incl_len);
+        if (incl_len != 0 && fread(packet->data(), incl_len, 1, mFile) != 1) {
+            *error = "truncated pcap record";
+            return false;
+        }
+        *orig_len = get(header[3]);
+        *time_us = (uint64_t) get(header[0]) * 1000000
+                + (mNanos ? get(header[1]) / 1000 : get(header[1]));
+        return true;
+    }
+
+private:
+    uint32_t get(uint32_t v) const {
+        return mSwapped ? swap32(v) : v;
+    }
+
+    FILE *mFile;
+    bool mSwapped;
+    bool mNanos;
+};
+
+}  // namespace
+
+const char *apf_check_program(const apf_capabilities *caps, const uint8_t *program,
+        uint32_t len) {
+    if (caps->version < APF_VERSION_MIN) {
+        return "the chip does not support APF";
+    }
+    if (caps->version > APF_VERSION_MAX) {
+        return "unsupported APF version";
+    }
+    if (len > caps->max_len) {
+        return "the program is longer than the chip accepts";
+    }
+    return NULL;
+}
+
+void apf_run(const uint8_t *program, uint32_t program_len, const uint8_t *packet,
+        uint32_t packet_len, uint32_t filter_age, apf_result *result) {
+#define ABORT(reason) do { result->abort = (reason); return; } while (0)
+#define ENFORCE_PROGRAM(p) if ((p) >= program_len) ABORT(APF_ABORT_PROGRAM_BOUNDS)
+#define ENFORCE_PACKET(p) if ((p) >= packet_len) ABORT(APF_ABORT_PACKET_BOUNDS)
+
+    result->drop = false;
+    result->abort = APF_OK;
+    result->instructions = 0;
+
+    uint32_t registers[2] = { 0, 0 };
+    uint32_t memory[APF_MEMORY_SLOTS];
+    memset(memory, 0, sizeof(memory));
+    memory[kMemoryPacketSize] = packet_len;
+    memory[kMemoryFilterAge] = filter_age;
+    /* a runt frame has no IP header; the program still runs, and sees a size of 0 */
+    if (packet_len > kEthHeaderLength && (packet[kEthHeaderLength] & 0xf0) == 0x40) {
+        memory[kMemoryIpv4HeaderSize] = (packet[kEthHeaderLength] & 15) * 4;
+    }
+
+    /* a program cannot run more instructions than it has bytes without looping */
+    uint32_t remaining = program_len;
+    uint32_t pc = 0;
+    for (;;) {
+        if (pc == program_len) {
+            return;
+        }
+        if (pc == program_len + 1) {
+            result->drop = true;
+            return;
+        }
+        if (remaining-- == 0) {
+            ABORT(APF_ABORT_INSTRUCTION_LIMIT);
+        }
+        ENFORCE_PROGRAM(pc);
+        result->instructions++;
+
+        const uint8_t bytecode = program[pc++];
+        const uint32_t opcode = bytecode >> 3;
+        const uint32_t reg = bytecode & 1;
+        const uint32_t len_field = (bytecode >> 1) & 3;
+
+        uint32_t imm = 0;
+        int32_t signed_imm = 0;
+        if (len_field != 0) {
+            const uint32_t imm_len = 1 << (len_field - 1);
+            ENFORCE_PROGRAM(pc + imm_len - 1);
+            for (uint32_t i = 0; i < imm_len; i++) {
+                imm = (imm << 8) | program[pc++];
+            }
+            const uint32_t shift = (4 - imm_len) * 8;
+            signed_imm = (int32_t) (imm << shift) >> shift;
+        }
+
+        switch (opcode) {
+            case LDB_OPCODE:
+            case LDH_OPCODE:
+            case LDW_OPCODE:
+            case LDBX_OPCODE:
+            case LDHX_OPCODE:
+            case LDWX_OPCODE: {
+                uint32_t offset = imm;
+                if (opcode >= LDBX_OPCODE) {
+                    offset += registers[1];
+                }
+                const uint32_t size = 1 << ((opcode - LDB_OPCODE) % 3);
+                const uint32_t end = offset + size - 1;
+                if (end < offset) {
+                    ABORT(APF_ABORT_PACKET_BOUNDS);
+                }
+                ENFORCE_PACKET(end);
+                uint32_t value = 0;
+                for (uint32_t i = 0; i < size; i++) {
+                    value = (value << 8) | packet[offset + i];
+                }
+                registers[reg] = value;
+                break;
+            }
+            case JMP_OPCODE:
+                pc += imm;
+                break;
+            case JEQ_OPCODE:
+            case JNE_OPCODE:
+            case JGT_OPCODE:
+            case JLT_OPCODE:
+            case JSET_OPCODE:
+            case JNEBS_OPCODE: {
+                uint32_t cmp = 0;
+                if (reg == 1) {
+                    cmp = registers[1];
+                } else if (len_field != 0) {
+                    const uint32_t cmp_len = 1 << (len_field - 1);
+                    ENFORCE_PROGRAM(pc + cmp_len - 1);
+                    for (uint32_t i = 0; i < cmp_len; i++) {
+                        cmp = (cmp << 8) | program[pc++];
+                    }
+                }
+                switch (opcode) {
+                    case JEQ_OPCODE:
+                        if (registers[0] == cmp) pc += imm;
+                        break;
+                    case JNE_OPCODE:
+                        if (registers[0] != cmp) pc += imm;
+                        break;
+                    case JGT_OPCODE:
+                        if (registers[0] > cmp) pc += imm;
+                        break;
+                    case JLT_OPCODE:
+                        if (registers[0] < cmp) pc += imm;
+                        break;
+                    case JSET_OPCODE:
+                        if (registers[0] & cmp) pc += imm;
+                        break;
+                    case JNEBS_OPCODE: {
+                        /* cmp bytes following the instruction against packet[R0] */
+                        if (cmp == 0) {
+                            ABORT(APF_ABORT_ILLEGAL_OPCODE);
+                        }
+                        if (pc + cmp - 1 < pc) {
+                            ABORT(APF_ABORT_PROGRAM_BOUNDS);
+                        }
+                        ENFORCE_PROGRAM(pc + cmp - 1);
+                        const uint32_t last = registers[0] + cmp - 1;
+                        if (last < registers[0]) {
+                            ABORT(APF_ABORT_PACKET_BOUNDS);
+                        }
+                        ENFORCE_PACKET(last);
+                        if (memcmp(program + pc, packet + registers[0], cmp) != 0) {
+                            pc += imm;
+                        }
+                        pc += cmp;
+                        break;
+                    }
+                }
+                break;
+            }
+            case ADD_OPCODE:
+                registers[0] += reg ? registers[1] : imm;
+                break;
+            case MUL_OPCODE:
+                registers[0] *= reg ? registers[1] : imm;
+                break;
+            case DIV_OPCODE: {
+                const uint32_t divisor = reg ? registers[1] : imm;
+                if (divisor == 0) {
+                    ABORT(APF_ABORT_DIVIDE_BY_ZERO);
+                }
+                registers[0] /= divisor;
+                break;
+            }
+            case AND_OPCODE:
+                registers[0] &= reg ? registers[1] : imm;
+                break;
+            case OR_OPCODE:
+                registers[0] |= reg ? registers[1] : imm;
+                break;
+            case SH_OPCODE: {
+                const int32_t shift = reg ? (int32_t) registers[1] : signed_imm;
+                if (shift > 0) {
+                    registers[0] = shift < 32 ? registers[0] << shift : 0;
+                } else {
+                    registers[0] = shift > -32 ? registers[0] >> -shift : 0;
+                }
+                break;
+            }
+            case LI_OPCODE:
+                registers[reg] = signed_imm;
+                break;
+            case EXT_OPCODE:
+                if (imm < LDM_EXT_OPCODE + APF_MEMORY_SLOTS) {
+                    registers[reg] = memory[imm - LDM_EXT_OPCODE];
+                } else if (imm >= STM_EXT_OPCODE && imm < STM_EXT_OPCODE + APF_MEMORY_SLOTS) {
+                    memory[imm - STM_EXT_OPCODE] = registers[reg];
+                } else if (imm == NOT_EXT_OPCODE) {
+                    registers[reg] = ~registers[reg];
+                } else if (imm == NEG_EXT_OPCODE) {
+                    registers[reg] = -registers[reg];
+                } else if (imm == SWAP_EXT_OPCODE) {
+                    const uint32_t tmp = registers[0];
+                    registers[0] = registers[1];
+                    registers[1] = tmp;
+                } else if (imm == MOV_EXT_OPCODE) {
+                    registers[reg] = registers[reg ^ 1];
+                } else {
+                    ABORT(APF_ABORT_ILLEGAL_OPCODE);
+                }
+                break;
+            default:
+                ABORT(APF_ABORT_ILLEGAL_OPCODE);
+        }
+    }
+
+#undef ENFORCE_PACKET
+#undef ENFORCE_PROGRAM
+#undef ABORT
+}
+
+const char *apf_abort_reason_name(apf_abort_reason reason) {
+    switch (reason) {
+        case APF_OK: return "ok";
+        case APF_ABORT_PROGRAM_BOUNDS: return "program-bounds";
+        case APF_ABORT_PACKET_BOUNDS: return "packet-bounds";
+        case APF_ABORT_DIVIDE_BY_ZERO: return "divide-by-zero";
+        case APF_ABORT_ILLEGAL_OPCODE: return "illegal-opcode";
+        case APF_ABORT_INSTRUCTION_LIMIT: return "instruction-limit";
+    }
+    return "unknown";
+}
+
+struct apf_capture {
+    struct Packet {
+        std::vector<uint8_t> bytes;
+        uint32_t orig_len;
+        uint32_t age;               /* seconds since the first packet */
+    };
+    std::vector<Packet> packets;
+};
+
+const char *apf_load_pcap(const char *path, apf_capture **capture) {
+    PcapReader reader;
+    const char *error = reader.open(path);
+    if (error != NULL) {
+        return error;
+    }
+
+    apf_capture *loaded = new apf_capture();
+    apf_capture::Packet packet;
+    uint64_t time_us;
+    uint64_t first_us = 0;
+    while (reader.next(&packet.bytes, &packet.orig_len, &time_us, &error)) {
+        if (loaded->packets.empty() || time_us < first_us) {
+            first_us = time_us;
+        }
+        packet.age = (uint32_t) ((time_us - first_us) / 1000000);
+        loaded->packets.push_back(packet);
+    }
+    if (error != NULL) {
+        delete loaded;
+        return error;
+    }
+    *capture = loaded;
+    return NULL;
+}
+
+void apf_free_capture(apf_capture *capture) {
+    delete capture;
+}
+
+void apf_run_capture(const apf_capture *capture, const uint8_t *program, uint32_t program_len,
+        uint32_t filter_age, uint32_t budget, apf_packet_handler handler, void *ctx,
+        apf_corpus_stats *stats) {
+    for (size_t i = 0; i < capture->packets.size(); i++) {
+        const apf_capture::Packet& packet = capture->packets[i];
+        apf_result result;
+        apf_run(program, program_len, packet.bytes.data(), packet.bytes.size(),
+                filter_age + packet.age, &result);
+        if (handler != NULL) {
+            handler(ctx, i, packet.bytes.data(), packet.bytes.size(), &result);
+        }
+
+        stats->packets++;
+        stats->dropped += result.drop;
+        stats->aborted += result.abort != APF_OK;
+        stats->truncated += packet.orig_len > packet.bytes.size();
+        stats->over_budget += budget != 0 && result.instructions > budget;
+        stats->instructions += result.instructions;
+        if (result.instructions > stats->max_instructions) {
+            stats->max_instructions = result.instructions;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __APF_INTERPRETER_H__
+#define __APF_INTERPRETER_H__
+
+#include <stdint.h>
+
+/*
+ * Host APF interpreter: runs the programs ApfFilter installs through
+ * installPacketFilterNative() the way the firmware does, so that their
+ * filtering efficiency and instruction cost can be measured off-device,
+ * against single packets or whole pcap captures.
+ *
+ * It implements the APF v2 instruction set, which v3 chips run unchanged,
+ * with the reference interpreter's semantics: a program that reads out of
+ * bounds, divides by zero or hits an illegal opcode passes the packet. A
+ * JNEBS that compares 0 bytes counts as an illegal opcode: ApfGenerator never
+ * emits one, and there is no byte of the packet it could be checked against.
+ * (v2 has no JEQBS; JNEBS is its only byte sequence comparison.)
+ */
+
+#define APF_VERSION_MIN 2
+#define APF_VERSION_MAX 3
+#define APF_MEMORY_SLOTS 16
+
+/* what getApfCapabilitiesNative() reports for the chip */
+typedef struct {
+    uint32_t version;
+    uint32_t max_len;
+} apf_capabilities;
+
+typedef enum {
+    APF_OK = 0,                     /* reached the pass or drop label */
+    APF_ABORT_PROGRAM_BOUNDS,
+    APF_ABORT_PACKET_BOUNDS,
+    APF_ABORT_DIVIDE_BY_ZERO,
+    APF_ABORT_ILLEGAL_OPCODE,
+    APF_ABORT_INSTRUCTION_LIMIT,    /* ran more instructions than the program has bytes */
+} apf_abort_reason;
+
+typedef struct {
+    bool drop;
+    apf_abort_reason abort;         /* the packet passes unless this is APF_OK */
+    uint32_t instructions;          /* executed, including the one that aborted */
+} apf_result;
+
+typedef struct {
+    uint64_t packets;
+    uint64_t dropped;
+    uint64_t aborted;
+    uint64_t truncated;             /* captured shorter than they were on the air */
+    uint64_t over_budget;           /* ran more instructions than the budget */
+    uint64_t instructions;
+    uint32_t max_instructions;
+} apf_corpus_stats;
+
+/* called for each packet of a capture; index counts from 0 */
+typedef void (*apf_packet_handler)(void *ctx, uint64_t index, const uint8_t *packet,
+        uint32_t len, const apf_result *result);
+
+/* why a chip with these capabilities would refuse the program; NULL if it would not */
+const char *apf_check_program(const apf_capabilities *caps, const uint8_t *program,
+        uint32_t len);
+
+/* filter_age: seconds since the program was installed, as the chip reports it to the program */
+void apf_run(const uint8_t *program, uint32_t program_len, const uint8_t *packet,
+        uint32_t packet_len, uint32_t filter_age, apf_result *result);
+
+const char *apf_abort_reason_name(apf_abort_reason reason);
+
+/* the packets of a pcap capture, loaded in memory */
+typedef struct apf_capture apf_capture;
+
+/* reads an Ethernet pcap capture; returns NULL, or why it could not be read */
+const char *apf_load_pcap(const char *path, apf_capture **capture);
+void apf_free_capture(apf_capture *capture);
+
+/*
+ * Runs the program over every packet of the capture and adds up the verdicts in stats. Each
+ * packet is filtered at filter_age plus its capture time since the first packet. Packets that
+ * run more than budget instructions count as over budget (0: no budget).
+ */
+void apf_run_capture(const apf_capture *capture, const uint8_t *program, uint32_t program_len,
+        uint32_t filter_age, uint32_t budget, apf_packet_handler handler, void *ctx,
+        apf_corpus_stats *stats);
+
+#endif //__APF_INTERPRETER_H__
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "apf_interpreter.h"
+
+/*
+ * The host APF interpreter on frames too short to carry an IP header, and on
+ * a byte sequence comparison of no bytes.
+ */
+
+namespace android {
+
+/* first byte of an instruction: opcode, length of its immediates, register */
+static uint8_t op(int opcode, int lenField, int reg = 0) {
+    return (uint8_t) ((opcode << 3) | (lenField << 1) | reg);
+}
+
+static const int kLdb = 1;
+static const int kJmp = 14;
+static const int kJeq = 15;
+static const int kJnebs = 20;
+static const int kExt = 21;
+/* as the chip fills it in */
+static const int kIpv4HeaderSizeSlot = 13;
+
+static apf_result run(const std::vector<uint8_t>& program, const std::vector<uint8_t>& packet) {
+    apf_result result;
+    apf_run(program.data(), program.size(), packet.data(), packet.size(), 0, &result);
+    return result;
+}
+
+/* drops the packet if the IPv4 header size the chip filled in is 0 */
+static const std::vector<uint8_t> kDropWithoutIpv4 = {
+    op(kExt, 1), kIpv4HeaderSizeSlot,
+    op(kJeq, 1), 1, 0,
+};
+
+TEST(ApfInterpreterTest, RuntFrameRunsProgram) {
+    /* jump straight to the drop label */
+    const std::vector<uint8_t> drop = { op(kJmp, 1), 1 };
+    for (size_t len : { 0, 10, 14 }) {
+        apf_result result = run(drop, std::vector<uint8_t>(len, 0x45));
+        EXPECT_EQ(APF_OK, result.abort) << len << " bytes";
+        EXPECT_TRUE(result.drop) << len << " bytes";
+        EXPECT_EQ(1U, result.instructions) << len << " bytes";
+    }
+}
+
+TEST(ApfInterpreterTest, RuntFrameHasNoIpv4HeaderSize) {
+    apf_result result = run(kDropWithoutIpv4, std::vector<uint8_t>(14, 0x45));
+    EXPECT_EQ(APF_OK, result.abort);
+    EXPECT_TRUE(result.drop);
+
+    /* one byte more is the first byte of the IPv4 header: 5 words */
+    result = run(kDropWithoutIpv4, std::vector<uint8_t>(15, 0x45));
+    EXPECT_EQ(APF_OK, result.abort);
+    EXPECT_FALSE(result.drop);
+}
+
+TEST(ApfInterpreterTest, RuntFrameReadPastEndAborts) {
+    const std::vector<uint8_t> load = { op(kLdb, 1), 20 };
+    apf_result result = run(load, std::vector<uint8_t>(10, 0));
+    EXPECT_EQ(APF_ABORT_PACKET_BOUNDS, result.abort);
+    EXPECT_FALSE(result.drop);
+}
+
+TEST(ApfInterpreterTest, EmptyByteSequenceIsIllegal) {
+    const std::vector<uint8_t> compare = { op(kJnebs, 1), 1, 0 };
+    apf_result result = run(compare, std::vector<uint8_t>(60, 0));
+    EXPECT_EQ(APF_ABORT_ILLEGAL_OPCODE, result.abort);
+    EXPECT_FALSE(result.drop);
+}
+
+}  // namespace android
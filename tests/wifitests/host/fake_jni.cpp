@@ -0,0 +1,1143 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-fakejni"
+
+#include "jni.h"
+#include <utils/Log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "fake_jni.h"
+
+namespace android {
+
+/* Objects */
+
+static FakeField *findFieldByName(const std::vector<FakeField *>& slots, const char *name) {
+    for (FakeField *f : slots) {
+        if (f->name == name) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+bool FakeObject::hasField(const char *name) const {
+    FakeField *f = findFieldByName(mClass->mInstanceSlots, name);
+    return f != NULL && f->slot < mFields.size();
+}
+
+jvalue FakeObject::getField(const char *name) const {
+    jvalue value;
+    value.j = 0;
+    FakeField *f = findFieldByName(mClass->mInstanceSlots, name);
+    if (f != NULL && f->slot < mFields.size()) {
+        value = mFields[f->slot];
+    }
+    return value;
+}
+
+FakeClass::~FakeClass() {
+    for (auto& it : mFieldsByKey) {
+        delete it.second;
+    }
+    for (auto& it : mMethods) {
+        delete it.second;
+    }
+}
+
+FakeField *FakeClass::field(const char *name, const char *sig, bool isStatic) {
+    std::string key = std::string(isStatic ? "static " : "") + name + ":" + sig;
+    auto it = mFieldsByKey.find(key);
+    if (it != mFieldsByKey.end()) {
+        return it->second;
+    }
+
+    std::vector<FakeField *>& slots = isStatic ? mStaticSlots : mInstanceSlots;
+    FakeField *f = new FakeField { this, name, sig, isStatic, slots.size() };
+    slots.push_back(f);
+    if (isStatic) {
+        jvalue zero;
+        zero.j = 0;
+        mStaticValues.push_back(zero);
+    }
+    mFieldsByKey[key] = f;
+    return f;
+}
+
+jvalue FakeClass::getStaticField(const char *name) const {
+    jvalue value;
+    value.j = 0;
+    FakeField *f = findFieldByName(mStaticSlots, name);
+    if (f != NULL) {
+        value = mStaticValues[f->slot];
+    }
+    return value;
+}
+
+FakeMethod *FakeClass::method(const char *name, const char *sig, bool isStatic) {
+    std::string key = std::string(isStatic ? "static " : "") + name + sig;
+    auto it = mMethods.find(key);
+    if (it != mMethods.end()) {
+        return it->second;
+    }
+
+    FakeMethod *m = new FakeMethod { this, name, sig, isStatic, FakeMethodImpl(), NULL, 0 };
+    mMethods[key] = m;
+    return m;
+}
+
+FakeMethod *FakeClass::findMethod(const char *name, const char *sig, bool isStatic) const {
+    std::string key = std::string(isStatic ? "static " : "") + name + sig;
+    auto it = mMethods.find(key);
+    return it == mMethods.end() ? NULL : it->second;
+}
+
+/* Signature parsing */
+
+/* advance past one type in a method signature; returns the type character */
+static char nextType(const char *&sig) {
+    char type = *sig;
+    if (type == '[') {
+        while (*sig == '[') {
+            sig++;
+        }
+        type = '[';
+    }
+    if (*sig == 'L') {
+        while (*sig != ';' && *sig != 0) {
+            sig++;
+        }
+        if (type != '[') {
+            type = 'L';
+        }
+    }
+    if (*sig != 0) {
+        sig++;
+    }
+    return type;
+}
+
+static std::vector<jvalue> parseArgs(const char *sig, va_list args) {
+    std::vector<jvalue> values;
+    const char *p = strchr(sig, '(');
+    if (p == NULL) {
+        return values;
+    }
+
+    p++;
+    while (*p != ')' && *p != 0) {
+        jvalue v;
+        v.j = 0;
+        switch (nextType(p)) {
+            case 'Z': v.z = (jboolean) va_arg(args, jint); break;
+            case 'B': v.b = (jbyte) va_arg(args, jint); break;
+            case 'C': v.c = (jchar) va_arg(args, jint); break;
+            case 'S': v.s = (jshort) va_arg(args, jint); break;
+            case 'I': v.i = va_arg(args, jint); break;
+            case 'J': v.j = va_arg(args, jlong); break;
+            case 'F': v.f = (jfloat) va_arg(args, jdouble); break;
+            case 'D': v.d = va_arg(args, jdouble); break;
+            default:  v.l = va_arg(args, jobject); break;
+        }
+        values.push_back(v);
+    }
+    return values;
+}
+
+static bool isReferenceType(const std::string& sig) {
+    return !sig.empty() && (sig[0] == 'L' || sig[0] == '[');
+}
+
+/* JNIEnv function table */
+
+struct FakeJniFunctions {
+
+    static FakeJniEnv *fenv(JNIEnv *env) {
+        FakeJniEnv *e = static_cast<FakeJniEnv *>(env);
+        e->mStats.calls++;
+        return e;
+    }
+
+    static FakeObject *obj(jobject o) {
+        return FakeJavaVM::unwrap(o);
+    }
+
+    static FakeClass *cls(jclass c) {
+        return static_cast<FakeClass *>(FakeJavaVM::unwrap(c));
+    }
+
+    static FakeField *fid(jfieldID f) {
+        return reinterpret_cast<FakeField *>(f);
+    }
+
+    static FakeMethod *mid(jmethodID m) {
+        return reinterpret_cast<FakeMethod *>(m);
+    }
+
+    /* every reference handed back to native code counts as a new local ref */
+    template<typename T>
+    static T local(FakeJniEnv *e, FakeObject *o) {
+        if (o != NULL) {
+            e->mStats.liveLocalRefs++;
+            if (e->mStats.liveLocalRefs > e->mStats.peakLocalRefs) {
+                e->mStats.peakLocalRefs = e->mStats.liveLocalRefs;
+            }
+        }
+        return reinterpret_cast<T>(o);
+    }
+
+    static void unimplemented() {
+        LOG_ALWAYS_FATAL("fake JNIEnv: unimplemented JNI function called");
+    }
+
+    static jint GetVersion(JNIEnv *env) {
+        fenv(env);
+        return JNI_VERSION_1_6;
+    }
+
+    static jclass FindClass(JNIEnv *env, const char *name) {
+        FakeJniEnv *e = fenv(env);
+        return local<jclass>(e, e->mVM->findClass(name));
+    }
+
+    static jclass GetSuperclass(JNIEnv *env, jclass c) {
+        fenv(env);
+        return NULL;
+    }
+
+    static jint Throw(JNIEnv *env, jthrowable t) {
+        FakeJniEnv *e = fenv(env);
+        e->mException = obj(t);
+        return JNI_OK;
+    }
+
+    static jint ThrowNew(JNIEnv *env, jclass c, const char *message) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        FakeObject *ex = e->mVM->allocObject(e, cls(c));
+        ex->mString = message != NULL ? message : "";
+        e->mException = ex;
+        return JNI_OK;
+    }
+
+    static jthrowable ExceptionOccurred(JNIEnv *env) {
+        FakeJniEnv *e = fenv(env);
+        return local<jthrowable>(e, e->mException);
+    }
+
+    static void ExceptionDescribe(JNIEnv *env) {
+        FakeJniEnv *e = fenv(env);
+        if (e->mException != NULL) {
+            ALOGE("pending %s: %s", e->mException->getClass()->name().c_str(),
+                    e->mException->str().c_str());
+        }
+    }
+
+    static void ExceptionClear(JNIEnv *env) {
+        fenv(env)->mException = NULL;
+    }
+
+    static jboolean ExceptionCheck(JNIEnv *env) {
+        return fenv(env)->mException != NULL;
+    }
+
+    static void FatalError(JNIEnv *env, const char *msg) {
+        LOG_ALWAYS_FATAL("JNI FatalError: %s", msg);
+    }
+
+    static jint PushLocalFrame(JNIEnv *env, jint capacity) {
+        fenv(env);
+        return JNI_OK;
+    }
+
+    static jobject PopLocalFrame(JNIEnv *env, jobject result) {
+        fenv(env);
+        return result;
+    }
+
+    static jint EnsureLocalCapacity(JNIEnv *env, jint capacity) {
+        fenv(env);
+        return JNI_OK;
+    }
+
+    static jobject NewGlobalRef(JNIEnv *env, jobject o) {
+        FakeJniEnv *e = fenv(env);
+        if (o == NULL) {
+            return NULL;
+        }
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        e->mVM->mGlobalRefs[obj(o)]++;
+        e->mStats.liveGlobalRefs++;
+        return o;
+    }
+
+    static void DeleteGlobalRef(JNIEnv *env, jobject o) {
+        FakeJniEnv *e = fenv(env);
+        if (o == NULL) {
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        auto it = e->mVM->mGlobalRefs.find(obj(o));
+        if (it == e->mVM->mGlobalRefs.end()) {
+            LOG_ALWAYS_FATAL("DeleteGlobalRef on %p which is not a global ref", o);
+        }
+        if (--it->second == 0) {
+            e->mVM->mGlobalRefs.erase(it);
+        }
+        e->mStats.liveGlobalRefs--;
+    }
+
+    static jobject NewLocalRef(JNIEnv *env, jobject o) {
+        return local<jobject>(fenv(env), obj(o));
+    }
+
+    static void DeleteLocalRef(JNIEnv *env, jobject o) {
+        FakeJniEnv *e = fenv(env);
+        if (o != NULL) {
+            e->mStats.liveLocalRefs--;
+        }
+    }
+
+    static jboolean IsSameObject(JNIEnv *env, jobject a, jobject b) {
+        fenv(env);
+        return a == b;
+    }
+
+    static jobjectRefType GetObjectRefType(JNIEnv *env, jobject o) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return e->mVM->mGlobalRefs.count(obj(o)) ? JNIGlobalRefType : JNILocalRefType;
+    }
+
+    static jclass GetObjectClass(JNIEnv *env, jobject o) {
+        FakeJniEnv *e = fenv(env);
+        return local<jclass>(e, obj(o)->getClass());
+    }
+
+    static jboolean IsInstanceOf(JNIEnv *env, jobject o, jclass c) {
+        fenv(env);
+        if (o == NULL) {
+            return JNI_TRUE;
+        }
+        return obj(o)->getClass() == cls(c) || cls(c)->name() == "java/lang/Object";
+    }
+
+    /* methods */
+
+    static jmethodID GetMethodID(JNIEnv *env, jclass c, const char *name, const char *sig) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return reinterpret_cast<jmethodID>(cls(c)->method(name, sig, false));
+    }
+
+    static jmethodID GetStaticMethodID(JNIEnv *env, jclass c, const char *name, const char *sig) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return reinterpret_cast<jmethodID>(cls(c)->method(name, sig, true));
+    }
+
+    static jvalue invoke(FakeJniEnv *e, FakeObject *thiz, FakeMethod *m, const jvalue *args) {
+        jvalue result;
+        result.j = 0;
+        e->mStats.upcalls++;
+        {
+            std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+            m->calls++;
+        }
+        if (m->impl) {
+            result = m->impl(e, thiz, args);
+        }
+        return result;
+    }
+
+    static jvalue invokeV(FakeJniEnv *e, FakeObject *thiz, jmethodID m, va_list args) {
+        std::vector<jvalue> values = parseArgs(mid(m)->sig.c_str(), args);
+        return invoke(e, thiz, mid(m), values.data());
+    }
+
+    static jobject NewObjectA(JNIEnv *env, jclass c, jmethodID m, const jvalue *args) {
+        FakeJniEnv *e = fenv(env);
+        FakeObject *o;
+        {
+            std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+            o = e->mVM->allocObject(e, cls(c));
+        }
+        invoke(e, o, mid(m), args);
+        return local<jobject>(e, o);
+    }
+
+    static jobject NewObjectV(JNIEnv *env, jclass c, jmethodID m, va_list args) {
+        std::vector<jvalue> values = parseArgs(mid(m)->sig.c_str(), args);
+        return NewObjectA(env, c, m, values.data());
+    }
+
+    static jobject NewObject(JNIEnv *env, jclass c, jmethodID m, ...) {
+        va_list args;
+        va_start(args, m);
+        jobject o = NewObjectV(env, c, m, args);
+        va_end(args);
+        return o;
+    }
+
+    static jobject AllocObject(JNIEnv *env, jclass c) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return local<jobject>(e, e->mVM->allocObject(e, cls(c)));
+    }
+
+#define FAKE_CALL_METHODS(_jtype, _jname, _member)                                              \
+    static _jtype Call##_jname##MethodA(JNIEnv *env, jobject o, jmethodID m,                    \
+            const jvalue *args) {                                                               \
+        return (_jtype) invoke(fenv(env), obj(o), mid(m), args)._member;                        \
+    }                                                                                           \
+    static _jtype Call##_jname##MethodV(JNIEnv *env, jobject o, jmethodID m, va_list args) {    \
+        return (_jtype) invokeV(fenv(env), obj(o), m, args)._member;                            \
+    }                                                                                           \
+    static _jtype Call##_jname##Method(JNIEnv *env, jobject o, jmethodID m, ...) {              \
+        va_list args;                                                                           \
+        va_start(args, m);                                                                      \
+        _jtype result = Call##_jname##MethodV(env, o, m, args);                                 \
+        va_end(args);                                                                           \
+        return result;                                                                          \
+    }                                                                                           \
+    static _jtype CallStatic##_jname##MethodA(JNIEnv *env, jclass c, jmethodID m,               \
+            const jvalue *args) {                                                               \
+        return (_jtype) invoke(fenv(env), NULL, mid(m), args)._member;                          \
+    }                                                                                           \
+    static _jtype CallStatic##_jname##MethodV(JNIEnv *env, jclass c, jmethodID m,               \
+            va_list args) {                                                                     \
+        return (_jtype) invokeV(fenv(env), NULL, m, args)._member;                              \
+    }                                                                                           \
+    static _jtype CallStatic##_jname##Method(JNIEnv *env, jclass c, jmethodID m, ...) {         \
+        va_list args;                                                                           \
+        va_start(args, m);                                                                      \
+        _jtype result = CallStatic##_jname##MethodV(env, c, m, args);                           \
+        va_end(args);                                                                           \
+        return result;                                                                          \
+    }
+
+    FAKE_CALL_METHODS(jboolean, Boolean, z)
+    FAKE_CALL_METHODS(jbyte, Byte, b)
+    FAKE_CALL_METHODS(jchar, Char, c)
+    FAKE_CALL_METHODS(jshort, Short, s)
+    FAKE_CALL_METHODS(jint, Int, i)
+    FAKE_CALL_METHODS(jlong, Long, j)
+    FAKE_CALL_METHODS(jfloat, Float, f)
+    FAKE_CALL_METHODS(jdouble, Double, d)
+#undef FAKE_CALL_METHODS
+
+    static jobject CallObjectMethodA(JNIEnv *env, jobject o, jmethodID m, const jvalue *args) {
+        FakeJniEnv *e = fenv(env);
+        return local<jobject>(e, obj(invoke(e, obj(o), mid(m), args).l));
+    }
+
+    static jobject CallObjectMethodV(JNIEnv *env, jobject o, jmethodID m, va_list args) {
+        std::vector<jvalue> values = parseArgs(mid(m)->sig.c_str(), args);
+        return CallObjectMethodA(env, o, m, values.data());
+    }
+
+    static jobject CallObjectMethod(JNIEnv *env, jobject o, jmethodID m, ...) {
+        va_list args;
+        va_start(args, m);
+        jobject result = CallObjectMethodV(env, o, m, args);
+        va_end(args);
+        return result;
+    }
+
+    static jobject CallStaticObjectMethodA(JNIEnv *env, jclass c, jmethodID m,
+            const jvalue *args) {
+        FakeJniEnv *e = fenv(env);
+        return local<jobject>(e, obj(invoke(e, NULL, mid(m), args).l));
+    }
+
+    static jobject CallStaticObjectMethodV(JNIEnv *env, jclass c, jmethodID m, va_list args) {
+        std::vector<jvalue> values = parseArgs(mid(m)->sig.c_str(), args);
+        return CallStaticObjectMethodA(env, c, m, values.data());
+    }
+
+    static jobject CallStaticObjectMethod(JNIEnv *env, jclass c, jmethodID m, ...) {
+        va_list args;
+        va_start(args, m);
+        jobject result = CallStaticObjectMethodV(env, c, m, args);
+        va_end(args);
+        return result;
+    }
+
+    static void CallVoidMethodA(JNIEnv *env, jobject o, jmethodID m, const jvalue *args) {
+        invoke(fenv(env), obj(o), mid(m), args);
+    }
+
+    static void CallVoidMethodV(JNIEnv *env, jobject o, jmethodID m, va_list args) {
+        invokeV(fenv(env), obj(o), m, args);
+    }
+
+    static void CallVoidMethod(JNIEnv *env, jobject o, jmethodID m, ...) {
+        va_list args;
+        va_start(args, m);
+        CallVoidMethodV(env, o, m, args);
+        va_end(args);
+    }
+
+    static void CallStaticVoidMethodA(JNIEnv *env, jclass c, jmethodID m, const jvalue *args) {
+        invoke(fenv(env), NULL, mid(m), args);
+    }
+
+    static void CallStaticVoidMethodV(JNIEnv *env, jclass c, jmethodID m, va_list args) {
+        invokeV(fenv(env), NULL, m, args);
+    }
+
+    static void CallStaticVoidMethod(JNIEnv *env, jclass c, jmethodID m, ...) {
+        va_list args;
+        va_start(args, m);
+        CallStaticVoidMethodV(env, c, m, args);
+        va_end(args);
+    }
+
+    /* fields */
+
+    static jfieldID GetFieldID(JNIEnv *env, jclass c, const char *name, const char *sig) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return reinterpret_cast<jfieldID>(cls(c)->field(name, sig, false));
+    }
+
+    static jfieldID GetStaticFieldID(JNIEnv *env, jclass c, const char *name, const char *sig) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return reinterpret_cast<jfieldID>(cls(c)->field(name, sig, true));
+    }
+
+    static jvalue& slot(FakeObject *o, FakeField *f) {
+        if (o->mFields.size() <= f->slot) {
+            jvalue zero;
+            zero.j = 0;
+            o->mFields.resize(f->cls->mInstanceSlots.size(), zero);
+        }
+        return o->mFields[f->slot];
+    }
+
+#define FAKE_FIELD_ACCESSORS(_jtype, _jname, _member)                                           \
+    static _jtype Get##_jname##Field(JNIEnv *env, jobject o, jfieldID f) {                      \
+        FakeJniEnv *e = fenv(env);                                                              \
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);                              \
+        return slot(obj(o), fid(f))._member;                                                    \
+    }                                                                                           \
+    static void Set##_jname##Field(JNIEnv *env, jobject o, jfieldID f, _jtype value) {          \
+        FakeJniEnv *e = fenv(env);                                                              \
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);                              \
+        slot(obj(o), fid(f))._member = value;                                                   \
+    }                                                                                           \
+    static _jtype GetStatic##_jname##Field(JNIEnv *env, jclass c, jfieldID f) {                 \
+        FakeJniEnv *e = fenv(env);                                                              \
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);                              \
+        return cls(c)->mStaticValues[fid(f)->slot]._member;                                     \
+    }                                                                                           \
+    static void SetStatic##_jname##Field(JNIEnv *env, jclass c, jfieldID f, _jtype value) {     \
+        FakeJniEnv *e = fenv(env);                                                              \
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);                              \
+        cls(c)->mStaticValues[fid(f)->slot]._member = value;                                    \
+    }
+
+    FAKE_FIELD_ACCESSORS(jboolean, Boolean, z)
+    FAKE_FIELD_ACCESSORS(jbyte, Byte, b)
+    FAKE_FIELD_ACCESSORS(jchar, Char, c)
+    FAKE_FIELD_ACCESSORS(jshort, Short, s)
+    FAKE_FIELD_ACCESSORS(jint, Int, i)
+    FAKE_FIELD_ACCESSORS(jlong, Long, j)
+    FAKE_FIELD_ACCESSORS(jfloat, Float, f)
+    FAKE_FIELD_ACCESSORS(jdouble, Double, d)
+#undef FAKE_FIELD_ACCESSORS
+
+    static jobject GetObjectField(JNIEnv *env, jobject o, jfieldID f) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return local<jobject>(e, obj(slot(obj(o), fid(f)).l));
+    }
+
+    static void SetObjectField(JNIEnv *env, jobject o, jfieldID f, jobject value) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        slot(obj(o), fid(f)).l = value;
+    }
+
+    static jobject GetStaticObjectField(JNIEnv *env, jclass c, jfieldID f) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return local<jobject>(e, obj(cls(c)->mStaticValues[fid(f)->slot].l));
+    }
+
+    static void SetStaticObjectField(JNIEnv *env, jclass c, jfieldID f, jobject value) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        cls(c)->mStaticValues[fid(f)->slot].l = value;
+    }
+
+    /* strings */
+
+    static jstring NewStringUTF(JNIEnv *env, const char *utf) {
+        FakeJniEnv *e = fenv(env);
+        if (utf == NULL) {
+            return NULL;
+        }
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        return local<jstring>(e, e->mVM->allocString(e, utf));
+    }
+
+    static jsize GetStringLength(JNIEnv *env, jstring s) {
+        fenv(env);
+        return obj(s)->mString.size();
+    }
+
+    static jsize GetStringUTFLength(JNIEnv *env, jstring s) {
+        fenv(env);
+        return obj(s)->mString.size();
+    }
+
+    static const char *GetStringUTFChars(JNIEnv *env, jstring s, jboolean *isCopy) {
+        fenv(env);
+        if (isCopy != NULL) {
+            *isCopy = JNI_FALSE;
+        }
+        return obj(s)->mString.c_str();
+    }
+
+    static void ReleaseStringUTFChars(JNIEnv *env, jstring s, const char *chars) {
+        fenv(env);
+    }
+
+    static void GetStringUTFRegion(JNIEnv *env, jstring s, jsize start, jsize len, char *buf) {
+        fenv(env);
+        memcpy(buf, obj(s)->mString.data() + start, len);
+        buf[len] = 0;
+    }
+
+    /* arrays */
+
+    static jsize GetArrayLength(JNIEnv *env, jarray a) {
+        fenv(env);
+        return obj(a)->mLength;
+    }
+
+    static jobjectArray NewObjectArray(JNIEnv *env, jsize length, jclass c, jobject initial) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        std::string name = "[L" + cls(c)->name() + ";";
+        FakeObject *a = e->mVM->allocArray(e, name.c_str(), 'L', length, 0);
+        a->mElements.assign(length, obj(initial));
+        return local<jobjectArray>(e, a);
+    }
+
+    static jobject GetObjectArrayElement(JNIEnv *env, jobjectArray a, jsize index) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        if (index < 0 || index >= obj(a)->mLength) {
+            LOG_ALWAYS_FATAL("GetObjectArrayElement index %d out of bounds (%d)",
+                    index, obj(a)->mLength);
+        }
+        return local<jobject>(e, obj(a)->mElements[index]);
+    }
+
+    static void SetObjectArrayElement(JNIEnv *env, jobjectArray a, jsize index, jobject value) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        if (index < 0 || index >= obj(a)->mLength) {
+            LOG_ALWAYS_FATAL("SetObjectArrayElement index %d out of bounds (%d)",
+                    index, obj(a)->mLength);
+        }
+        obj(a)->mElements[index] = obj(value);
+    }
+
+    static void checkRegion(FakeObject *a, jsize start, jsize len) {
+        if (start < 0 || len < 0 || start + len > a->mLength) {
+            LOG_ALWAYS_FATAL("array region [%d, %d) out of bounds (%d)",
+                    start, start + len, a->mLength);
+        }
+    }
+
+#define FAKE_ARRAY_FUNCTIONS(_jtype, _jname, _jarray, _sig, _cls)                              \
+    static _jarray New##_jname##Array(JNIEnv *env, jsize length) {                              \
+        FakeJniEnv *e = fenv(env);                                                              \
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);                              \
+        return local<_jarray>(e, e->mVM->allocArray(e, _cls, _sig, length, sizeof(_jtype)));    \
+    }                                                                                           \
+    static _jtype *Get##_jname##ArrayElements(JNIEnv *env, _jarray a, jboolean *isCopy) {       \
+        fenv(env);                                                                              \
+        if (isCopy != NULL) {                                                                   \
+            *isCopy = JNI_FALSE;                                                                \
+        }                                                                                       \
+        return reinterpret_cast<_jtype *>(obj(a)->mData.data());                                \
+    }                                                                                           \
+    static void Release##_jname##ArrayElements(JNIEnv *env, _jarray a, _jtype *elems,           \
+            jint mode) {                                                                        \
+        fenv(env);                                                                              \
+    }                                                                                           \
+    static void Get##_jname##ArrayRegion(JNIEnv *env, _jarray a, jsize start, jsize len,        \
+            _jtype *buf) {                                                                      \
+        fenv(env);                                                                              \
+        checkRegion(obj(a), start, len);                                                        \
+        if (len > 0) {                                                                          \
+            memcpy(buf, obj(a)->mData.data() + start * sizeof(_jtype), len * sizeof(_jtype));   \
+        }                                                                                       \
+    }                                                                                           \
+    static void Set##_jname##ArrayRegion(JNIEnv *env, _jarray a, jsize start, jsize len,        \
+            const _jtype *buf) {                                                                \
+        fenv(env);                                                                              \
+        checkRegion(obj(a), start, len);                                                        \
+        if (len > 0) {                                                                          \
+            memcpy(obj(a)->mData.data() + start * sizeof(_jtype), buf, len * sizeof(_jtype));   \
+        }                                                                                       \
+    }
+
+    FAKE_ARRAY_FUNCTIONS(jboolean, Boolean, jbooleanArray, 'Z', "[Z")
+    FAKE_ARRAY_FUNCTIONS(jbyte, Byte, jbyteArray, 'B', "[B")
+    FAKE_ARRAY_FUNCTIONS(jchar, Char, jcharArray, 'C', "[C")
+    FAKE_ARRAY_FUNCTIONS(jshort, Short, jshortArray, 'S', "[S")
+    FAKE_ARRAY_FUNCTIONS(jint, Int, jintArray, 'I', "[I")
+    FAKE_ARRAY_FUNCTIONS(jlong, Long, jlongArray, 'J', "[J")
+    FAKE_ARRAY_FUNCTIONS(jfloat, Float, jfloatArray, 'F', "[F")
+    FAKE_ARRAY_FUNCTIONS(jdouble, Double, jdoubleArray, 'D', "[D")
+#undef FAKE_ARRAY_FUNCTIONS
+
+    static void *GetPrimitiveArrayCritical(JNIEnv *env, jarray a, jboolean *isCopy) {
+        fenv(env);
+        if (isCopy != NULL) {
+            *isCopy = JNI_FALSE;
+        }
+        return obj(a)->mData.data();
+    }
+
+    static void ReleasePrimitiveArrayCritical(JNIEnv *env, jarray a, void *elems, jint mode) {
+        fenv(env);
+    }
+
+    /* direct buffers */
+
+    static jobject NewDirectByteBuffer(JNIEnv *env, void *address, jlong capacity) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        FakeObject *b = e->mVM->allocObject(e, e->mVM->findClass("java/nio/DirectByteBuffer"));
+        b->mDirectAddress = address;
+        b->mLength = (int) capacity;
+        return local<jobject>(e, b);
+    }
+
+    static void *GetDirectBufferAddress(JNIEnv *env, jobject b) {
+        fenv(env);
+        return b == NULL ? NULL : obj(b)->mDirectAddress;
+    }
+
+    static jlong GetDirectBufferCapacity(JNIEnv *env, jobject b) {
+        fenv(env);
+        return (b == NULL || obj(b)->mDirectAddress == NULL) ? -1 : obj(b)->mLength;
+    }
+
+    /* registration */
+
+    static jint RegisterNatives(JNIEnv *env, jclass c, const JNINativeMethod *methods,
+            jint count) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        for (int i = 0; i < count; i++) {
+            /* fast natives are registered with a '!' prefix */
+            const char *sig = methods[i].signature;
+            if (*sig == '!') {
+                sig++;
+            }
+            FakeMethod *m = cls(c)->method(methods[i].name, sig, true);
+            m->nativeFn = methods[i].fnPtr;
+        }
+        return JNI_OK;
+    }
+
+    static jint UnregisterNatives(JNIEnv *env, jclass c) {
+        FakeJniEnv *e = fenv(env);
+        std::lock_guard<std::recursive_mutex> lock(e->mVM->mLock);
+        for (auto& it : cls(c)->mMethods) {
+            it.second->nativeFn = NULL;
+        }
+        return JNI_OK;
+    }
+
+    static jint GetJavaVM(JNIEnv *env, JavaVM **vm) {
+        *vm = fenv(env)->mVM;
+        return JNI_OK;
+    }
+
+    static jint MonitorEnter(JNIEnv *env, jobject o) {
+        fenv(env)->mVM->mLock.lock();
+        return JNI_OK;
+    }
+
+    static jint MonitorExit(JNIEnv *env, jobject o) {
+        fenv(env)->mVM->mLock.unlock();
+        return JNI_OK;
+    }
+
+    static JNINativeInterface *table() {
+        static JNINativeInterface sTable;
+        static std::once_flag sOnce;
+        std::call_once(sOnce, []() {
+            /* anything the bridge doesn't use aborts loudly instead of crashing */
+            void **slots = reinterpret_cast<void **>(&sTable);
+            for (size_t i = 0; i < sizeof(sTable) / sizeof(void *); i++) {
+                slots[i] = reinterpret_cast<void *>(&unimplemented);
+            }
+
+#define FAKE_SET(_name) sTable._name = &_name
+            FAKE_SET(GetVersion);
+            FAKE_SET(FindClass);
+            FAKE_SET(GetSuperclass);
+            FAKE_SET(Throw);
+            FAKE_SET(ThrowNew);
+            FAKE_SET(ExceptionOccurred);
+            FAKE_SET(ExceptionDescribe);
+            FAKE_SET(ExceptionClear);
+            FAKE_SET(ExceptionCheck);
+            FAKE_SET(FatalError);
+            FAKE_SET(PushLocalFrame);
+            FAKE_SET(PopLocalFrame);
+            FAKE_SET(EnsureLocalCapacity);
+            FAKE_SET(NewGlobalRef);
+            FAKE_SET(DeleteGlobalRef);
+            FAKE_SET(NewLocalRef);
+            FAKE_SET(DeleteLocalRef);
+            FAKE_SET(IsSameObject);
+            FAKE_SET(GetObjectRefType);
+            FAKE_SET(GetObjectClass);
+            FAKE_SET(IsInstanceOf);
+            FAKE_SET(AllocObject);
+            FAKE_SET(NewObject);
+            FAKE_SET(NewObjectV);
+            FAKE_SET(NewObjectA);
+            FAKE_SET(GetMethodID);
+            FAKE_SET(GetStaticMethodID);
+            FAKE_SET(GetFieldID);
+            FAKE_SET(GetStaticFieldID);
+
+#define FAKE_SET_TYPED(_jname)                                                                  \
+            FAKE_SET(Call##_jname##Method);                                                     \
+            FAKE_SET(Call##_jname##MethodV);                                                    \
+            FAKE_SET(Call##_jname##MethodA);                                                    \
+            FAKE_SET(CallStatic##_jname##Method);                                               \
+            FAKE_SET(CallStatic##_jname##MethodV);                                              \
+            FAKE_SET(CallStatic##_jname##MethodA);                                              \
+            FAKE_SET(Get##_jname##Field);                                                       \
+            FAKE_SET(Set##_jname##Field);                                                       \
+            FAKE_SET(GetStatic##_jname##Field);                                                 \
+            FAKE_SET(SetStatic##_jname##Field)
+            FAKE_SET_TYPED(Object);
+            FAKE_SET_TYPED(Boolean);
+            FAKE_SET_TYPED(Byte);
+            FAKE_SET_TYPED(Char);
+            FAKE_SET_TYPED(Short);
+            FAKE_SET_TYPED(Int);
+            FAKE_SET_TYPED(Long);
+            FAKE_SET_TYPED(Float);
+            FAKE_SET_TYPED(Double);
+#undef FAKE_SET_TYPED
+
+            FAKE_SET(CallVoidMethod);
+            FAKE_SET(CallVoidMethodV);
+            FAKE_SET(CallVoidMethodA);
+            FAKE_SET(CallStaticVoidMethod);
+            FAKE_SET(CallStaticVoidMethodV);
+            FAKE_SET(CallStaticVoidMethodA);
+
+            FAKE_SET(NewStringUTF);
+            FAKE_SET(GetStringLength);
+            FAKE_SET(GetStringUTFLength);
+            FAKE_SET(GetStringUTFChars);
+            FAKE_SET(ReleaseStringUTFChars);
+            FAKE_SET(GetStringUTFRegion);
+
+            FAKE_SET(GetArrayLength);
+            FAKE_SET(NewObjectArray);
+            FAKE_SET(GetObjectArrayElement);
+            FAKE_SET(SetObjectArrayElement);
+
+#define FAKE_SET_ARRAY(_jname)                                                                  \
+            FAKE_SET(New##_jname##Array);                                                       \
+            FAKE_SET(Get##_jname##ArrayElements);                                               \
+            FAKE_SET(Release##_jname##ArrayElements);                                           \
+            FAKE_SET(Get##_jname##ArrayRegion);                                                 \
+            FAKE_SET(Set##_jname##ArrayRegion)
+            FAKE_SET_ARRAY(Boolean);
+            FAKE_SET_ARRAY(Byte);
+            FAKE_SET_ARRAY(Char);
+            FAKE_SET_ARRAY(Short);
+            FAKE_SET_ARRAY(Int);
+            FAKE_SET_ARRAY(Long);
+            FAKE_SET_ARRAY(Float);
+            FAKE_SET_ARRAY(Double);
+#undef FAKE_SET_ARRAY
+
+            FAKE_SET(GetPrimitiveArrayCritical);
+            FAKE_SET(ReleasePrimitiveArrayCritical);
+            FAKE_SET(NewDirectByteBuffer);
+            FAKE_SET(GetDirectBufferAddress);
+            FAKE_SET(GetDirectBufferCapacity);
+            FAKE_SET(RegisterNatives);
+            FAKE_SET(UnregisterNatives);
+            FAKE_SET(GetJavaVM);
+            FAKE_SET(MonitorEnter);
+            FAKE_SET(MonitorExit);
+#undef FAKE_SET
+        });
+        return &sTable;
+    }
+
+    /* JavaVM invocation interface */
+
+    static jint DestroyJavaVM(JavaVM *vm) {
+        return JNI_ERR;
+    }
+
+    static jint AttachCurrentThread(JavaVM *vm, JNIEnv **env, void *args) {
+        *env = static_cast<FakeJavaVM *>(vm)->getEnv();
+        return JNI_OK;
+    }
+
+    static jint DetachCurrentThread(JavaVM *vm) {
+        return JNI_OK;
+    }
+
+    static jint GetEnv(JavaVM *vm, void **env, jint version) {
+        FakeJavaVM *fvm = static_cast<FakeJavaVM *>(vm);
+        std::lock_guard<std::recursive_mutex> lock(fvm->mLock);
+        auto it = fvm->mEnvs.find(std::this_thread::get_id());
+        if (it == fvm->mEnvs.end()) {
+            *env = NULL;
+            return JNI_EDETACHED;
+        }
+        *env = static_cast<JNIEnv *>(it->second);
+        return JNI_OK;
+    }
+
+    static JNIInvokeInterface *invokeTable() {
+        static JNIInvokeInterface sTable = {
+            NULL, NULL, NULL,
+            &DestroyJavaVM,
+            &AttachCurrentThread,
+            &DetachCurrentThread,
+            &GetEnv,
+            &AttachCurrentThread,
+        };
+        return &sTable;
+    }
+};
+
+/* Env and VM */
+
+FakeJniEnv::FakeJniEnv(FakeJavaVM *vm)
+    : mVM(vm), mStats(), mException(NULL)
+{
+    functions = FakeJniFunctions::table();
+}
+
+FakeJavaVM::FakeJavaVM()
+{
+    functions = FakeJniFunctions::invokeTable();
+    mClassClass = new FakeClass(NULL, "java/lang/Class");
+    mClassClass->mClass = mClassClass;
+    mClasses[mClassClass->name()] = mClassClass;
+}
+
+FakeJavaVM::~FakeJavaVM()
+{
+    for (FakeObject *o : mHeap) {
+        delete o;
+    }
+    for (auto& it : mClasses) {
+        delete it.second;
+    }
+    for (auto& it : mEnvs) {
+        delete it.second;
+    }
+}
+
+JNIEnv *FakeJavaVM::getEnv()
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    FakeJniEnv *&env = mEnvs[std::this_thread::get_id()];
+    if (env == NULL) {
+        env = new FakeJniEnv(this);
+    }
+    return env;
+}
+
+FakeClass *FakeJavaVM::findClass(const char *name)
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    FakeClass *&cls = mClasses[name];
+    if (cls == NULL) {
+        cls = new FakeClass(mClassClass, name);
+    }
+    return cls;
+}
+
+void FakeJavaVM::defineMethod(const char *cls, const char *name, const char *sig, bool isStatic,
+        FakeMethodImpl impl)
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    findClass(cls)->method(name, sig, isStatic)->impl = impl;
+}
+
+void *FakeJavaVM::findNative(const char *cls, const char *name) const
+{
+    auto it = mClasses.find(cls);
+    if (it == mClasses.end()) {
+        return NULL;
+    }
+    for (auto& m : it->second->mMethods) {
+        if (m.second->name == name && m.second->nativeFn != NULL) {
+            return m.second->nativeFn;
+        }
+    }
+    return NULL;
+}
+
+FakeJniStats FakeJavaVM::getStats()
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    FakeJniStats total = FakeJniStats();
+    for (auto& it : mEnvs) {
+        const FakeJniStats& s = it.second->mStats;
+        total.calls += s.calls;
+        total.upcalls += s.upcalls;
+        total.objectsAllocated += s.objectsAllocated;
+        total.bytesAllocated += s.bytesAllocated;
+        total.liveLocalRefs += s.liveLocalRefs;
+        total.peakLocalRefs = std::max(total.peakLocalRefs, s.peakLocalRefs);
+        total.liveGlobalRefs += s.liveGlobalRefs;
+    }
+    return total;
+}
+
+void FakeJavaVM::resetStats()
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    for (auto& it : mEnvs) {
+        FakeJniStats& s = it.second->mStats;
+        s.calls = 0;
+        s.upcalls = 0;
+        s.objectsAllocated = 0;
+        s.bytesAllocated = 0;
+        s.peakLocalRefs = s.liveLocalRefs;
+    }
+}
+
+FakeObject *FakeJavaVM::allocObject(FakeJniEnv *env, FakeClass *cls)
+{
+    FakeObject *o = new FakeObject(cls);
+    mHeap.push_back(o);
+    env->mStats.objectsAllocated++;
+    return o;
+}
+
+FakeObject *FakeJavaVM::allocArray(FakeJniEnv *env, const char *className, char type, int length,
+        size_t elemSize)
+{
+    if (length < 0) {
+        LOG_ALWAYS_FATAL("negative array size %d", length);
+    }
+    FakeObject *a = allocObject(env, findClass(className));
+    a->mArrayType = type;
+    a->mLength = length;
+    a->mData.assign(length * elemSize, 0);
+    env->mStats.bytesAllocated += length * (elemSize ? elemSize : sizeof(void *));
+    return a;
+}
+
+FakeObject *FakeJavaVM::allocString(FakeJniEnv *env, const char *utf)
+{
+    FakeObject *s = allocObject(env, findClass("java/lang/String"));
+    s->mString = utf;
+    env->mStats.bytesAllocated += s->mString.size();
+    return s;
+}
+
+void FakeJavaVM::mark(FakeObject *obj)
+{
+    std::vector<FakeObject *> stack;
+    stack.push_back(obj);
+    while (!stack.empty()) {
+        FakeObject *o = stack.back();
+        stack.pop_back();
+        if (o == NULL || o->mMarked) {
+            continue;
+        }
+        o->mMarked = true;
+        for (FakeObject *e : o->mElements) {
+            stack.push_back(e);
+        }
+        const std::vector<FakeField *>& slots = o->mClass->mInstanceSlots;
+        for (size_t i = 0; i < o->mFields.size() && i < slots.size(); i++) {
+            if (isReferenceType(slots[i]->sig)) {
+                stack.push_back(unwrap(o->mFields[i].l));
+            }
+        }
+    }
+}
+
+size_t FakeJavaVM::collect()
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+
+    for (auto& it : mClasses) {
+        FakeClass *cls = it.second;
+        for (size_t i = 0; i < cls->mStaticSlots.size(); i++) {
+            if (isReferenceType(cls->mStaticSlots[i]->sig)) {
+                mark(unwrap(cls->mStaticValues[i].l));
+            }
+        }
+    }
+    for (auto& it : mGlobalRefs) {
+        mark(it.first);
+    }
+    for (auto& it : mEnvs) {
+        mark(it.second->mException);
+    }
+
+    size_t freed = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < mHeap.size(); i++) {
+        FakeObject *o = mHeap[i];
+        if (o->mMarked) {
+            o->mMarked = false;
+            mHeap[kept++] = o;
+        } else {
+            delete o;
+            freed++;
+        }
+    }
+    mHeap.resize(kept);
+    for (auto& it : mClasses) {
+        it.second->mMarked = false;
+    }
+    return freed;
+}
+
+size_t FakeJavaVM::heapSize()
+{
+    std::lock_guard<std::recursive_mutex> lock(mLock);
+    return mHeap.size();
+}
+
+}  // namespace android
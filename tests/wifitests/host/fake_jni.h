@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WIFI_FAKE_JNI_H__
+#define __WIFI_FAKE_JNI_H__
+
+#include "jni.h"
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+/*
+ * In-process JavaVM/JNIEnv for running the wifi JNI bridge on a Linux host.
+ *
+ * Classes, fields and methods are created on first lookup, so the bridge can
+ * run against any Java class name without a class path. Objects live on a
+ * simple heap owned by the FakeJavaVM; collect() frees everything that is not
+ * reachable from a global ref or a static field. Java methods default to
+ * no-ops returning zero; tests and benchmarks can install C++ handlers for the
+ * upcalls they care about.
+ */
+
+class FakeJavaVM;
+class FakeJniEnv;
+class FakeClass;
+struct FakeJniFunctions;
+
+struct FakeField {
+    FakeClass *cls;
+    std::string name;
+    std::string sig;
+    bool isStatic;
+    size_t slot;
+};
+
+class FakeObject {
+public:
+    FakeObject(FakeClass *cls)
+        : mClass(cls), mArrayType(0), mLength(0), mDirectAddress(NULL), mMarked(false) {}
+    virtual ~FakeObject() {}
+
+    FakeClass *getClass() const { return mClass; }
+
+    /* instance fields, looked up by name regardless of signature */
+    bool hasField(const char *name) const;
+    jvalue getField(const char *name) const;
+    int getIntField(const char *name) const { return getField(name).i; }
+    int64_t getLongField(const char *name) const { return getField(name).j; }
+    FakeObject *getObjectField(const char *name) const {
+        return reinterpret_cast<FakeObject *>(getField(name).l);
+    }
+
+    /* java/lang/String */
+    const std::string& str() const { return mString; }
+
+    /* arrays; mArrayType is the element signature character */
+    bool isArray() const { return mArrayType != 0; }
+    char arrayType() const { return mArrayType; }
+    int length() const { return mLength; }
+    void *data() { return mData.data(); }
+    FakeObject *element(int index) const { return mElements[index]; }
+
+    /* direct java/nio/ByteBuffer */
+    void *directAddress() const { return mDirectAddress; }
+
+private:
+    friend class FakeJavaVM;
+    friend class FakeJniEnv;
+    friend struct FakeJniFunctions;
+
+    FakeClass *mClass;
+    std::vector<jvalue> mFields;
+    std::string mString;
+    char mArrayType;
+    int mLength;
+    std::vector<uint8_t> mData;
+    std::vector<FakeObject *> mElements;
+    void *mDirectAddress;
+    bool mMarked;
+};
+
+typedef std::function<jvalue(JNIEnv *env, FakeObject *thiz, const jvalue *args)> FakeMethodImpl;
+
+struct FakeMethod {
+    FakeClass *cls;
+    std::string name;
+    std::string sig;
+    bool isStatic;
+    FakeMethodImpl impl;
+    void *nativeFn;                 /* set by RegisterNatives */
+    uint64_t calls;
+};
+
+class FakeClass : public FakeObject {
+public:
+    FakeClass(FakeClass *classClass, const char *name)
+        : FakeObject(classClass), mName(name) {}
+    virtual ~FakeClass();
+
+    const std::string& name() const { return mName; }
+    FakeMethod *findMethod(const char *name, const char *sig, bool isStatic) const;
+    jvalue getStaticField(const char *name) const;
+
+private:
+    friend class FakeObject;
+    friend class FakeJavaVM;
+    friend class FakeJniEnv;
+    friend struct FakeJniFunctions;
+
+    FakeField *field(const char *name, const char *sig, bool isStatic);
+    FakeMethod *method(const char *name, const char *sig, bool isStatic);
+
+    std::string mName;
+    std::map<std::string, FakeField *> mFieldsByKey;
+    std::vector<FakeField *> mInstanceSlots;
+    std::vector<FakeField *> mStaticSlots;
+    std::vector<jvalue> mStaticValues;
+    std::map<std::string, FakeMethod *> mMethods;
+};
+
+/* counters for everything that crossed the fake JNI boundary */
+struct FakeJniStats {
+    uint64_t calls;                 /* JNIEnv function invocations */
+    uint64_t upcalls;               /* Java methods invoked from native code */
+    uint64_t objectsAllocated;      /* objects, arrays and strings */
+    uint64_t bytesAllocated;        /* array and string payload bytes */
+    int64_t liveLocalRefs;
+    int64_t peakLocalRefs;
+    int64_t liveGlobalRefs;
+};
+
+class FakeJniEnv : public JNIEnv {
+public:
+    FakeJniEnv(FakeJavaVM *vm);
+
+    FakeJavaVM *vm() const { return mVM; }
+    FakeJniStats& stats() { return mStats; }
+    FakeObject *pendingException() const { return mException; }
+
+private:
+    friend class FakeJavaVM;
+    friend struct FakeJniFunctions;
+
+    FakeJavaVM *mVM;
+    FakeJniStats mStats;
+    FakeObject *mException;
+};
+
+class FakeJavaVM : public JavaVM {
+public:
+    FakeJavaVM();
+    ~FakeJavaVM();
+
+    /* the env for the calling thread, attaching it if needed */
+    JNIEnv *getEnv();
+
+    FakeClass *findClass(const char *name);
+    void defineMethod(const char *cls, const char *name, const char *sig, bool isStatic,
+            FakeMethodImpl impl);
+    /* returns the function registered through RegisterNatives, or NULL */
+    void *findNative(const char *cls, const char *name) const;
+
+    /* stats summed over all attached threads; other threads must be quiescent */
+    FakeJniStats getStats();
+    void resetStats();
+
+    /*
+     * Frees every object not reachable from a global ref or a static field.
+     * Only call this between native calls; local refs are not roots.
+     */
+    size_t collect();
+    size_t heapSize();
+
+    static FakeObject *unwrap(jobject obj) {
+        return reinterpret_cast<FakeObject *>(obj);
+    }
+    static jobject wrap(FakeObject *obj) {
+        return reinterpret_cast<jobject>(obj);
+    }
+
+private:
+    friend struct FakeJniFunctions;
+
+    FakeObject *allocObject(FakeJniEnv *env, FakeClass *cls);
+    FakeObject *allocArray(FakeJniEnv *env, const char *className, char type, int length,
+            size_t elemSize);
+    FakeObject *allocString(FakeJniEnv *env, const char *utf);
+    void mark(FakeObject *obj);
+
+    std::recursive_mutex mLock;
+    FakeClass *mClassClass;
+    std::map<std::string, FakeClass *> mClasses;
+    std::vector<FakeObject *> mHeap;
+    std::map<FakeObject *, int> mGlobalRefs;
+    std::map<std::thread::id, FakeJniEnv *> mEnvs;
+};
+
+}  // namespace android
+
+#endif //__WIFI_FAKE_JNI_H__
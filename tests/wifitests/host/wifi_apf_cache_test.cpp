@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-apf-cache-test"
+
+#include "jni.h"
+
+#include <string>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The APF program cache of installPacketFilterNative: a program identical to
+ * the installed one does not reach the HAL, a changed one does, and the cache
+ * is forgotten after a failed install and when the HAL is cleaned up.
+ */
+
+namespace android {
+
+typedef jboolean (*InstallPacketFilterFn)(JNIEnv *, jclass, jint, jbyteArray);
+typedef jstring (*GetPacketFilterStatsFn)(JNIEnv *, jclass, jint);
+
+static int sInstalls;
+static std::vector<u8> sLastProgram;
+static wifi_error sInstallResult;
+
+static wifi_error test_set_packet_filter(wifi_interface_handle iface, const u8 *program,
+        u32 len) {
+    sInstalls++;
+    sLastProgram.assign(program, program + len);
+    return sInstallResult;
+}
+
+class WifiApfCacheTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        resetBridgeState();
+        sInstalls = 0;
+        sLastProgram.clear();
+        sInstallResult = WIFI_SUCCESS;
+    }
+
+    void installHal() override {
+        hal_fn.wifi_set_packet_filter = test_set_packet_filter;
+    }
+
+    bool install(const std::vector<u8>& program) {
+        jbyteArray bytes = newByteArray(program);
+        jboolean ret = native<InstallPacketFilterFn>("installPacketFilterNative")(env(), cls(),
+                iface(), bytes);
+        env()->DeleteLocalRef(bytes);
+        return ret;
+    }
+
+    std::string stats() {
+        return takeString(native<GetPacketFilterStatsFn>("getPacketFilterStatsNative")(env(),
+                cls(), iface()));
+    }
+};
+
+TEST_F(WifiApfCacheTest, SkipsUnchangedProgram) {
+    const std::vector<u8> program = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(1, sInstalls);
+    EXPECT_EQ(program, sLastProgram);
+
+    EXPECT_TRUE(install(program));
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(1, sInstalls);
+    EXPECT_EQ(0U, stats().find("installs=1 skipped=2 failures=0"));
+}
+
+TEST_F(WifiApfCacheTest, InstallsChangedProgram) {
+    std::vector<u8> program = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    EXPECT_TRUE(install(program));
+    program[3] = 0x40;
+    program[4] = 0x50;
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(2, sInstalls);
+    EXPECT_EQ(program, sLastProgram);
+    EXPECT_NE(std::string::npos, stats().find("changed=2@3"));
+
+    /* same length and bytes as the first one except one: still a new program */
+    program[4] = 5;
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(3, sInstalls);
+
+    program.push_back(9);
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(4, sInstalls);
+    EXPECT_NE(std::string::npos, stats().find("size=9"));
+}
+
+TEST_F(WifiApfCacheTest, FailedInstallIsRetried) {
+    const std::vector<u8> program = { 1, 2, 3, 4 };
+
+    EXPECT_TRUE(install(program));
+    sInstallResult = WIFI_ERROR_UNKNOWN;
+    const std::vector<u8> other = { 4, 3, 2, 1 };
+    EXPECT_FALSE(install(other));
+    EXPECT_EQ(2, sInstalls);
+
+    /* what the firmware kept is unknown: even the first program goes through again */
+    sInstallResult = WIFI_SUCCESS;
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(3, sInstalls);
+    EXPECT_EQ(0U, stats().find("installs=2 skipped=0 failures=1"));
+}
+
+TEST_F(WifiApfCacheTest, CleanupInvalidates) {
+    const std::vector<u8> program = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    EXPECT_TRUE(install(program));
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(1, sInstalls);
+
+    restartHal();
+    EXPECT_EQ("none", stats());
+
+    /* the firmware lost its program with the HAL */
+    EXPECT_TRUE(install(program));
+    EXPECT_EQ(2, sInstalls);
+    EXPECT_EQ(0U, stats().find("installs=1 skipped=0 failures=0"));
+}
+
+}  // namespace android
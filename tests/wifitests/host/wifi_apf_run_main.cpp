@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "apf_interpreter.h"
+
+/*
+ * Runs an APF program over a pcap capture and reports how many packets it
+ * drops and what it costs the firmware per packet:
+ *
+ *   wifi-apf-run [options] <program> <capture.pcap>
+ *
+ * The program is a file holding the bytes ApfFilter installs, raw or as hex
+ * (as ApfFilter dumps it). --version and --max-len are the chip's APF
+ * capabilities, as getApfCapabilitiesNative() reports them; a program the
+ * chip would refuse is not run. With --budget, the run fails if any packet
+ * costs more instructions than the firmware's budget.
+ */
+
+static const uint32_t kDefaultVersion = 2;
+static const uint32_t kDefaultMaxLength = 1024;
+
+typedef std::chrono::steady_clock Clock;
+
+static void usage() {
+    fprintf(stderr,
+            "usage: wifi-apf-run [--version N] [--max-len N] [--budget N] [--age S]\n"
+            "                    [--repeat N] [-v] <program> <capture.pcap>\n"
+            "  --version, --max-len  APF capabilities of the chip (default %u, %u)\n"
+            "  --budget              instructions per packet the firmware allows (default none)\n"
+            "  --age                 filter age of the first packet, in seconds (default 0)\n"
+            "  --repeat              runs over the capture, to time the interpreter (default 1)\n"
+            "  -v                    prints the verdict of every packet\n",
+            kDefaultVersion, kDefaultMaxLength);
+}
+
+/* hex digits, with any whitespace or ':' in between, or else raw bytes */
+static bool readProgram(const char *path, std::vector<uint8_t> *program) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        bytes.push_back(c);
+    }
+    fclose(file);
+
+    std::vector<uint8_t> decoded;
+    int high = -1;
+    for (uint8_t b : bytes) {
+        if (isspace(b) || b == ':') {
+            continue;
+        }
+        if (!isxdigit(b)) {
+            *program = bytes;
+            return true;
+        }
+        int value = isdigit(b) ? b - '0' : tolower(b) - 'a' + 10;
+        if (high < 0) {
+            high = value;
+        } else {
+            decoded.push_back((high << 4) | value);
+            high = -1;
+        }
+    }
+    if (high >= 0) {
+        *program = bytes;
+        return true;
+    }
+    *program = decoded;
+    return true;
+}
+
+static void printVerdict(void *ctx, uint64_t index, const uint8_t *packet, uint32_t len,
+        const apf_result *result) {
+    uint32_t ethertype = len >= 14 ? (packet[12] << 8) | packet[13] : 0;
+    printf("%6llu len=%-5u ethertype=%04x %s instructions=%u",
+            (unsigned long long) index, len, ethertype, result->drop ? "DROP" : "PASS",
+            result->instructions);
+    if (result->abort != APF_OK) {
+        printf(" aborted=%s", apf_abort_reason_name(result->abort));
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    apf_capabilities caps = { kDefaultVersion, kDefaultMaxLength };
+    uint32_t budget = 0;
+    uint32_t age = 0;
+    int repeat = 1;
+    bool verbose = false;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-v") == 0) {
+            verbose = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        uint32_t value = strtoul(argv[++i], NULL, 0);
+        if (strcmp(arg, "--version") == 0) {
+            caps.version = value;
+        } else if (strcmp(arg, "--max-len") == 0) {
+            caps.max_len = value;
+        } else if (strcmp(arg, "--budget") == 0) {
+            budget = value;
+        } else if (strcmp(arg, "--age") == 0) {
+            age = value;
+        } else if (strcmp(arg, "--repeat") == 0 && value > 0) {
+            repeat = value;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (argc - i != 2) {
+        usage();
+        return 2;
+    }
+
+    std::vector<uint8_t> program;
+    if (!readProgram(argv[i], &program)) {
+        fprintf(stderr, "cannot read program %s\n", argv[i]);
+        return 1;
+    }
+    const char *error = apf_check_program(&caps, program.data(), program.size());
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s (%zu bytes, version %u, max %u)\n", argv[i], error,
+                program.size(), caps.version, caps.max_len);
+        return 1;
+    }
+
+    apf_capture *capture;
+    error = apf_load_pcap(argv[i + 1], &capture);
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", argv[i + 1], error);
+        return 1;
+    }
+
+    apf_corpus_stats stats;
+    Clock::time_point start = Clock::now();
+    for (int run = 0; run < repeat; run++) {
+        memset(&stats, 0, sizeof(stats));
+        apf_run_capture(capture, program.data(), program.size(), age, budget,
+                verbose && run == 0 ? printVerdict : NULL, NULL, &stats);
+    }
+    double elapsed_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    apf_free_capture(capture);
+
+    double packets = stats.packets > 0 ? (double) stats.packets : 1.0;
+    printf("program: %zu bytes, APF v%u, max %u\n", program.size(), caps.version, caps.max_len);
+    printf("packets: %llu, dropped: %llu (%.1f%%), aborted: %llu, truncated: %llu\n",
+            (unsigned long long) stats.packets, (unsigned long long) stats.dropped,
+            100.0 * stats.dropped / packets, (unsigned long long) stats.aborted,
+            (unsigned long long) stats.truncated);
+    printf("instructions per packet: avg %.1f, max %u", stats.instructions / packets,
+            stats.max_instructions);
+    if (budget != 0) {
+        printf(", over the budget of %u: %llu", budget, (unsigned long long) stats.over_budget);
+    }
+    printf("\n");
+    printf("interpreter: %.0f ns per packet over %d runs\n", elapsed_ns / repeat / packets,
+            repeat);
+
+    return stats.over_budget != 0 ? 1 : 0;
+}
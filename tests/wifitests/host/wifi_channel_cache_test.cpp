@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-channel-cache-test"
+
+#include "jni.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The valid channel cache of getChannelsForBandNative() and getChannelsForBandsNative(): one
+ * list per interface and band, asked from the HAL once, and dropped when the country code is set,
+ * through the HAL or the supplicant, and when the HAL is cleaned up.
+ */
+
+namespace android {
+
+typedef jintArray (*GetChannelsForBandFn)(JNIEnv *, jclass, jint, jint);
+typedef jobjectArray (*GetChannelsForBandsFn)(JNIEnv *, jclass, jint, jintArray);
+typedef jboolean (*SetCountryCodeFn)(JNIEnv *, jclass, jint, jstring);
+typedef void (*InvalidateValidChannelsFn)(JNIEnv *, jclass);
+
+/* any value the HAL would not hand out */
+static const jlong kOtherIface = 0x5a5a0000;
+
+static std::vector<std::pair<wifi_interface_handle, int>> sRequests;
+static wifi_error sChannelsResult;
+
+static wifi_error test_get_valid_channels(wifi_interface_handle iface, int band,
+        int max_channels, wifi_channel *channels, int *num_channels) {
+    sRequests.push_back(std::make_pair(iface, band));
+    if (sChannelsResult != WIFI_SUCCESS) {
+        return sChannelsResult;
+    }
+
+    std::vector<wifi_channel> list;
+    if (band & WIFI_BAND_BG) {
+        list.insert(list.end(), { 2412, 2437, 2462 });
+    }
+    if (band & WIFI_BAND_A) {
+        list.insert(list.end(), { 5180, 5200 });
+    }
+    if ((band & WIFI_BAND_A_WITH_DFS) == WIFI_BAND_A_WITH_DFS) {
+        list.push_back(5260);
+    }
+    /* not a 2.4 or 5 GHz channel: dropped by the bridge */
+    list.push_back(58320);
+
+    *num_channels = std::min((int) list.size(), max_channels);
+    std::copy(list.begin(), list.begin() + *num_channels, channels);
+    return WIFI_SUCCESS;
+}
+
+static wifi_error test_set_country_code(wifi_interface_handle iface, const char *code) {
+    return WIFI_SUCCESS;
+}
+
+class WifiChannelCacheTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        resetBridgeState();
+        sRequests.clear();
+        sChannelsResult = WIFI_SUCCESS;
+        mSavedIfaces = (jlongArray) env()->GetStaticObjectField(cls(), ifacesField());
+    }
+
+    void TearDown() override {
+        env()->SetStaticObjectField(cls(), ifacesField(), mSavedIfaces);
+        env()->DeleteLocalRef(mSavedIfaces);
+        WifiHostTest::TearDown();
+    }
+
+    void installHal() override {
+        hal_fn.wifi_get_valid_channels = test_get_valid_channels;
+        hal_fn.wifi_set_country_code = test_set_country_code;
+    }
+
+    jfieldID ifacesField() {
+        return env()->GetStaticFieldID(cls(), "sWifiIfaceHandles", "[J");
+    }
+
+    /* adds an interface, at index 1, next to the HAL's own */
+    wifi_interface_handle addIface() {
+        jlong handles[2];
+        env()->GetLongArrayRegion(mSavedIfaces, iface(), 1, &handles[0]);
+        handles[1] = kOtherIface;
+        jlongArray array = env()->NewLongArray(2);
+        env()->SetLongArrayRegion(array, 0, 2, handles);
+        env()->SetStaticObjectField(cls(), ifacesField(), array);
+        env()->DeleteLocalRef(array);
+        return (wifi_interface_handle) kOtherIface;
+    }
+
+    std::vector<jint> channels(int band, jint index = -1) {
+        jintArray array = native<GetChannelsForBandFn>("getChannelsForBandNative")(env(), cls(),
+                index < 0 ? iface() : index, band);
+        return takeInts(array);
+    }
+
+    std::vector<jint> takeInts(jintArray array) {
+        std::vector<jint> values;
+        if (array == NULL) {
+            return values;
+        }
+        values.resize(env()->GetArrayLength(array));
+        env()->GetIntArrayRegion(array, 0, values.size(), values.data());
+        env()->DeleteLocalRef(array);
+        return values;
+    }
+
+    jlongArray mSavedIfaces;
+};
+
+TEST_F(WifiChannelCacheTest, CachedPerBand) {
+    const std::vector<jint> band24 = { 2412, 2437, 2462 };
+    const std::vector<jint> band5 = { 5180, 5200 };
+
+    EXPECT_EQ(band24, channels(WIFI_BAND_BG));
+    EXPECT_EQ(band24, channels(WIFI_BAND_BG));
+    ASSERT_EQ(1U, sRequests.size());
+    EXPECT_EQ(WIFI_BAND_BG, sRequests[0].second);
+
+    EXPECT_EQ(band5, channels(WIFI_BAND_A));
+    EXPECT_EQ(std::vector<jint>({ 5180, 5200, 5260 }), channels(WIFI_BAND_A_WITH_DFS));
+    ASSERT_EQ(3U, sRequests.size());
+    EXPECT_EQ(WIFI_BAND_A, sRequests[1].second);
+    EXPECT_EQ(WIFI_BAND_A_WITH_DFS, sRequests[2].second);
+
+    EXPECT_EQ(band24, channels(WIFI_BAND_BG));
+    EXPECT_EQ(band5, channels(WIFI_BAND_A));
+    EXPECT_EQ(3U, sRequests.size());
+}
+
+TEST_F(WifiChannelCacheTest, BandsShareCache) {
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+
+    jintArray bands = env()->NewIntArray(2);
+    const jint bandList[] = { WIFI_BAND_BG, WIFI_BAND_A };
+    env()->SetIntArrayRegion(bands, 0, 2, bandList);
+    jobjectArray lists = native<GetChannelsForBandsFn>("getChannelsForBandsNative")(env(), cls(),
+            iface(), bands);
+    env()->DeleteLocalRef(bands);
+    ASSERT_TRUE(lists != NULL);
+    ASSERT_EQ(2, env()->GetArrayLength(lists));
+    EXPECT_EQ(3U, takeInts((jintArray) env()->GetObjectArrayElement(lists, 0)).size());
+    EXPECT_EQ(2U, takeInts((jintArray) env()->GetObjectArrayElement(lists, 1)).size());
+    env()->DeleteLocalRef(lists);
+
+    /* only the 5 GHz list was new */
+    ASSERT_EQ(2U, sRequests.size());
+    EXPECT_EQ(WIFI_BAND_A, sRequests[1].second);
+}
+
+TEST_F(WifiChannelCacheTest, KeyedByInterface) {
+    wifi_interface_handle other = addIface();
+
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG, iface()).size());
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG, 1).size());
+    ASSERT_EQ(2U, sRequests.size());
+    EXPECT_NE(other, sRequests[0].first);
+    EXPECT_EQ(other, sRequests[1].first);
+
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG, iface()).size());
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG, 1).size());
+    EXPECT_EQ(2U, sRequests.size());
+}
+
+TEST_F(WifiChannelCacheTest, CountryCodeInvalidates) {
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+
+    jstring country = newString("US");
+    EXPECT_TRUE(native<SetCountryCodeFn>("setCountryCodeHalNative")(env(), cls(), iface(),
+            country));
+    env()->DeleteLocalRef(country);
+
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, sRequests.size());
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, sRequests.size());
+}
+
+TEST_F(WifiChannelCacheTest, StationCountryCodeInvalidates) {
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, channels(WIFI_BAND_A).size());
+    ASSERT_EQ(2U, sRequests.size());
+
+    /* what WifiNative.setCountryCode() calls after the supplicant took the country */
+    native<InvalidateValidChannelsFn>("invalidateValidChannelsNative")(env(), cls());
+
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, channels(WIFI_BAND_A).size());
+    EXPECT_EQ(4U, sRequests.size());
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(4U, sRequests.size());
+}
+
+TEST_F(WifiChannelCacheTest, FailureNotCached) {
+    sChannelsResult = WIFI_ERROR_UNKNOWN;
+    EXPECT_TRUE(native<GetChannelsForBandFn>("getChannelsForBandNative")(env(), cls(), iface(),
+            WIFI_BAND_BG) == NULL);
+
+    sChannelsResult = WIFI_SUCCESS;
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, sRequests.size());
+}
+
+TEST_F(WifiChannelCacheTest, CleanupInvalidates) {
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, channels(WIFI_BAND_A).size());
+    ASSERT_EQ(2U, sRequests.size());
+
+    restartHal();
+    env()->DeleteLocalRef(mSavedIfaces);
+    mSavedIfaces = (jlongArray) env()->GetStaticObjectField(cls(), ifacesField());
+
+    EXPECT_EQ(3U, channels(WIFI_BAND_BG).size());
+    EXPECT_EQ(2U, channels(WIFI_BAND_A).size());
+    EXPECT_EQ(4U, sRequests.size());
+}
+
+}  // namespace android
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-event-ring-test"
+
+#include "jni.h"
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "fake_jni.h"
+#include "wifi_host_test.h"
+
+/*
+ * Ordering of the events delivered through the event ring: a scan status event
+ * must reach the framework after the full scan results reported before it, even
+ * when the ring is full, and the ring is not restarted under a consumer that is
+ * still reading it.
+ */
+
+namespace android {
+
+typedef jboolean (*StartScanFn)(JNIEnv *, jclass, jint, jint, jobject);
+typedef jboolean (*StopScanFn)(JNIEnv *, jclass, jint, jint);
+typedef jobject (*EnableEventRingFn)(JNIEnv *, jclass, jint, jint);
+typedef jlong (*WaitEventRingFn)(JNIEnv *, jclass, jlong);
+typedef void (*DisableEventRingFn)(JNIEnv *, jclass);
+
+/* as WifiNative.EVENT_* */
+static const int kEventPad = 0;
+static const int kEventFullScanResult = 1;
+static const int kEventScanStatus = 4;
+
+static const int kRingSize = 4096;
+/* as EVENT_RING_RESERVE */
+static const int kRingReserve = 1024;
+static const int kStatusRecordSize = 16;
+static const int kScanId = 7;
+/* long enough for a blocked producer to have posted, had it not been blocked */
+static const int kBlockedUs = 50 * 1000;
+
+static wifi_scan_result_handler sHandler;
+static int sStatusUpcalls;
+
+static wifi_error test_start_gscan(wifi_request_id id, wifi_interface_handle iface,
+        wifi_scan_cmd_params params, wifi_scan_result_handler handler) {
+    sHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error test_stop_gscan(wifi_request_id id, wifi_interface_handle iface) {
+    return WIFI_SUCCESS;
+}
+
+struct ring_record {
+    int type;
+    std::vector<u8> payload;
+};
+
+class WifiEventRingTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        hal_fn.wifi_start_gscan = test_start_gscan;
+        hal_fn.wifi_stop_gscan = test_stop_gscan;
+        memset(&sHandler, 0, sizeof(sHandler));
+        sStatusUpcalls = 0;
+        mRing = NULL;
+        mConsumed = 0;
+
+        host().vm().defineMethod(WifiHostEnv::kWifiNativeClass, "onScanStatus", "(II)V", true,
+                [](JNIEnv *, FakeObject *, const jvalue *) {
+                    sStatusUpcalls++;
+                    jvalue result;
+                    result.j = 0;
+                    return result;
+                });
+
+        jclass settingsCls = env()->FindClass("com/android/server/wifi/WifiNative$ScanSettings");
+        jobject settings = env()->AllocObject(settingsCls);
+        ASSERT_TRUE(native<StartScanFn>("startScanNative")(env(), cls(), iface(), kScanId,
+                settings));
+        env()->DeleteLocalRef(settings);
+        env()->DeleteLocalRef(settingsCls);
+        ASSERT_TRUE(sHandler.on_scan_event != NULL);
+
+        memset(&mResult, 0, sizeof(mResult));
+        memcpy(mResult.ssid, "ring", 4);
+        mResult.bssid[0] = 0x02;
+        mResult.rssi = -60;
+        mResult.channel = 2412;
+    }
+
+    void TearDown() override {
+        disableRing();
+        native<StopScanFn>("stopScanNative")(env(), cls(), iface(), kScanId);
+        WifiHostTest::TearDown();
+    }
+
+    jobject tryEnableRing(int types) {
+        return native<EnableEventRingFn>("enableEventRingNative")(env(), cls(), kRingSize, types);
+    }
+
+    void enableRing(int types) {
+        jobject ring = tryEnableRing(types);
+        ASSERT_TRUE(ring != NULL);
+        mRing = static_cast<const u8 *>(env()->GetDirectBufferAddress(ring));
+        env()->DeleteLocalRef(ring);
+        mConsumed = 0;
+    }
+
+    jlong waitRing(jlong consumed) {
+        return native<WaitEventRingFn>("waitEventRingNative")(env(), cls(), consumed);
+    }
+
+    /* disables the ring and, like the framework's consumer, reads it until told to exit */
+    void disableRing() {
+        native<DisableEventRingFn>("disableEventRingNative")(env(), cls());
+        jlong head;
+        while ((head = waitRing(mConsumed)) >= 0) {
+            mConsumed = head;
+        }
+    }
+
+    /* the status records posted since the last call, as their scan ids, consuming them */
+    std::vector<int> consumeStatuses() {
+        std::vector<int> ids;
+        jlong head = waitRing(mConsumed);
+        for (; mConsumed < head; ) {
+            u32 header[2];
+            const u8 *record = mRing + (mConsumed & (kRingSize - 1));
+            memcpy(header, record, sizeof(header));
+            if (header[1] == kEventScanStatus) {
+                int32_t status[2];
+                memcpy(status, record + sizeof(header), sizeof(status));
+                ids.push_back(status[0]);
+            }
+            mConsumed += (header[0] + 7) & ~7;
+        }
+        return ids;
+    }
+
+    /* the records posted so far, without consuming them */
+    std::vector<ring_record> records() {
+        std::vector<ring_record> found;
+        jlong head = native<WaitEventRingFn>("waitEventRingNative")(env(), cls(), 0);
+        for (jlong consumed = 0; consumed < head; ) {
+            u32 header[2];
+            memcpy(header, mRing + (consumed & (kRingSize - 1)), sizeof(header));
+            if (header[1] != kEventPad) {
+                const u8 *payload = mRing + (consumed & (kRingSize - 1)) + sizeof(header);
+                found.push_back({ (int) header[1],
+                        std::vector<u8>(payload, payload + header[0] - sizeof(header)) });
+            }
+            consumed += (header[0] + 7) & ~7;
+        }
+        return found;
+    }
+
+    void scanStatus(int id) {
+        sHandler.on_scan_event(id, WIFI_SCAN_RESULTS_AVAILABLE);
+    }
+
+    void fullScanResult() {
+        sHandler.on_full_scan_result(kScanId, &mResult, 0x1);
+    }
+
+    const u8 *mRing;
+    jlong mConsumed;
+    wifi_scan_result mResult;
+};
+
+TEST_F(WifiEventRingTest, ScanStatusFollowsFullResults) {
+    enableRing((1 << kEventFullScanResult) | (1 << kEventScanStatus));
+    fullScanResult();
+    fullScanResult();
+    sHandler.on_scan_event(kScanId, WIFI_SCAN_RESULTS_AVAILABLE);
+    fullScanResult();
+
+    std::vector<ring_record> found = records();
+    ASSERT_EQ(4U, found.size());
+    EXPECT_EQ(kEventFullScanResult, found[0].type);
+    EXPECT_EQ(kEventFullScanResult, found[1].type);
+    EXPECT_EQ(kEventScanStatus, found[2].type);
+    EXPECT_EQ(kEventFullScanResult, found[3].type);
+
+    ASSERT_EQ(8U, found[2].payload.size());
+    int32_t status[2];
+    memcpy(status, found[2].payload.data(), sizeof(status));
+    EXPECT_EQ(kScanId, status[0]);
+    EXPECT_EQ(WIFI_SCAN_RESULTS_AVAILABLE, status[1]);
+    EXPECT_EQ(0, sStatusUpcalls);
+}
+
+TEST_F(WifiEventRingTest, ScanStatusUsesReserve) {
+    enableRing((1 << kEventFullScanResult) | (1 << kEventScanStatus));
+    for (int i = 0; i < kRingSize / 64; i++) {
+        fullScanResult();
+    }
+    size_t posted = records().size();
+    ASSERT_LT(posted, (size_t) kRingSize / 64);
+
+    /* the full results stopped short of the reserve, which takes the status records */
+    const int statuses = kRingReserve / kStatusRecordSize;
+    for (int i = 0; i < statuses; i++) {
+        scanStatus(kScanId);
+    }
+    fullScanResult();
+
+    std::vector<ring_record> found = records();
+    ASSERT_EQ(posted + statuses, found.size());
+    for (size_t i = posted; i < found.size(); i++) {
+        EXPECT_EQ(kEventScanStatus, found[i].type);
+    }
+    EXPECT_EQ(0, sStatusUpcalls);
+}
+
+TEST_F(WifiEventRingTest, ScanStatusWaitsForConsumer) {
+    enableRing(1 << kEventScanStatus);
+    const int fit = kRingSize / kStatusRecordSize;
+    const int total = fit + 8;
+    for (int i = 0; i < fit; i++) {
+        scanStatus(i);
+    }
+
+    /* the ring is full: the next status waits for room rather than overtake the others */
+    std::atomic<int> late(0);
+    std::thread producer([&]() {
+        for (int i = fit; i < total; i++) {
+            scanStatus(i);
+            late++;
+        }
+    });
+    usleep(kBlockedUs);
+    EXPECT_EQ(0, late.load());
+
+    std::vector<int> ids;
+    while (ids.size() < (size_t) total) {
+        std::vector<int> more = consumeStatuses();
+        ids.insert(ids.end(), more.begin(), more.end());
+    }
+    producer.join();
+
+    for (int i = 0; i < total; i++) {
+        EXPECT_EQ(i, ids[i]);
+    }
+    EXPECT_EQ(0, sStatusUpcalls);
+}
+
+TEST_F(WifiEventRingTest, DisableReleasesWaitingProducer) {
+    enableRing(1 << kEventScanStatus);
+    for (int i = 0; i < kRingSize / kStatusRecordSize; i++) {
+        scanStatus(kScanId);
+    }
+
+    std::thread producer([&]() {
+        scanStatus(kScanId);
+    });
+    usleep(kBlockedUs);
+    EXPECT_EQ(0, sStatusUpcalls);
+
+    /* the ring is going away: the status is upcalled instead */
+    native<DisableEventRingFn>("disableEventRingNative")(env(), cls());
+    producer.join();
+    EXPECT_EQ(1, sStatusUpcalls);
+}
+
+TEST_F(WifiEventRingTest, EnableWaitsForConsumerExit) {
+    enableRing(1 << kEventScanStatus);
+    scanStatus(kScanId);
+    native<DisableEventRingFn>("disableEventRingNative")(env(), cls());
+
+    /* the consumer has not read the ring to its end yet */
+    EXPECT_TRUE(tryEnableRing(1 << kEventScanStatus) == NULL);
+
+    jlong head = waitRing(0);
+    ASSERT_GT(head, 0);
+    EXPECT_TRUE(tryEnableRing(1 << kEventScanStatus) == NULL);
+    EXPECT_EQ(-1, waitRing(head));
+
+    enableRing(1 << kEventScanStatus);
+    EXPECT_EQ(0, sStatusUpcalls);
+}
+
+TEST_F(WifiEventRingTest, ScanStatusUpcallWithoutRing) {
+    sHandler.on_scan_event(kScanId, WIFI_SCAN_RESULTS_AVAILABLE);
+    EXPECT_EQ(1, sStatusUpcalls);
+
+    /* a ring that carries the full results only */
+    enableRing(1 << kEventFullScanResult);
+    fullScanResult();
+    sHandler.on_scan_event(kScanId, WIFI_SCAN_RESULTS_AVAILABLE);
+    EXPECT_EQ(2, sStatusUpcalls);
+    EXPECT_EQ(1U, records().size());
+}
+
+}  // namespace android
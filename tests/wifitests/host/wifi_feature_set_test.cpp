@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-feature-set-test"
+
+#include "jni.h"
+
+#include "wifi_host_test.h"
+
+/*
+ * getSupportedFeatureSetNative is a fast native: it must be served from the
+ * capability cache and never wait for the HAL, even when the cache is empty.
+ */
+
+namespace android {
+
+typedef jint (*GetInterfacesFn)(JNIEnv *, jclass);
+typedef jint (*GetFeatureSetFn)(JNIEnv *, jclass, jint);
+
+static const feature_set kFeatures = WIFI_FEATURE_INFRA | WIFI_FEATURE_TDLS;
+
+static int sQueries;
+static wifi_error sResult;
+
+static wifi_error test_get_supported_feature_set(wifi_interface_handle iface,
+        feature_set *set) {
+    sQueries++;
+    *set = kFeatures;
+    return sResult;
+}
+
+class WifiFeatureSetTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        hal_fn.wifi_get_supported_feature_set = test_get_supported_feature_set;
+        sQueries = 0;
+        sResult = WIFI_SUCCESS;
+    }
+
+    /* enumerating the interfaces again clears the cache and fills it in from the HAL */
+    void TearDown() override {
+        WifiHostTest::TearDown();
+        enumerate();
+    }
+
+    void enumerate() {
+        native<GetInterfacesFn>("getInterfacesNative")(env(), cls());
+    }
+
+    jint fast() {
+        return native<GetFeatureSetFn>("getSupportedFeatureSetNative")(env(), cls(), iface());
+    }
+
+    jint query() {
+        return native<GetFeatureSetFn>("querySupportedFeatureSetNative")(env(), cls(), iface());
+    }
+};
+
+TEST_F(WifiFeatureSetTest, CachedWhenInterfacesEnumerated) {
+    enumerate();
+    EXPECT_EQ(1, sQueries);
+    EXPECT_EQ((jint) kFeatures, fast());
+    EXPECT_EQ((jint) kFeatures, query());
+    EXPECT_EQ(1, sQueries);
+}
+
+TEST_F(WifiFeatureSetTest, FastNativeNeverCallsHal) {
+    sResult = WIFI_ERROR_UNKNOWN;
+    enumerate();
+    EXPECT_EQ(1, sQueries);
+
+    EXPECT_EQ(0, fast());
+    EXPECT_EQ(1, sQueries);
+
+    sResult = WIFI_SUCCESS;
+    EXPECT_EQ((jint) kFeatures, query());
+    EXPECT_EQ(2, sQueries);
+
+    EXPECT_EQ((jint) kFeatures, fast());
+    EXPECT_EQ((jint) kFeatures, query());
+    EXPECT_EQ(2, sQueries);
+}
+
+}  // namespace android
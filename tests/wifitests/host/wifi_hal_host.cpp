@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-hal-host"
+
+#include <stdint.h>
+#include <string.h>
+#include <net/if.h>
+#include <utils/Log.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "wifi_hal.h"
+#include "wifi_hal_host.h"
+
+struct wifi_interface_info {
+    wifi_handle handle;
+    char name[IFNAMSIZ + 1];
+};
+
+struct host_hal_work {
+    host_hal_task task;
+    void *arg;
+};
+
+struct wifi_info {
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<host_hal_work> work;
+    bool cleaning_up;
+    wifi_cleaned_up_handler cleaned_up_handler;
+    wifi_interface_info iface;
+    wifi_interface_handle ifaces[1];
+};
+
+static wifi_error host_initialize(wifi_handle *handle) {
+    wifi_info *info = new wifi_info();
+    info->cleaning_up = false;
+    info->cleaned_up_handler = NULL;
+    info->iface.handle = info;
+    strncpy(info->iface.name, HOST_HAL_IFACE_NAME, sizeof(info->iface.name) - 1);
+    info->ifaces[0] = &info->iface;
+    *handle = info;
+    ALOGD("host HAL initialized, handle = %p", info);
+    return WIFI_SUCCESS;
+}
+
+static void host_cleanup(wifi_handle handle, wifi_cleaned_up_handler handler) {
+    std::lock_guard<std::mutex> lock(handle->lock);
+    handle->cleaning_up = true;
+    handle->cleaned_up_handler = handler;
+    handle->cond.notify_all();
+}
+
+static void host_event_loop(wifi_handle handle) {
+    std::unique_lock<std::mutex> lock(handle->lock);
+    while (true) {
+        handle->cond.wait(lock, [handle] {
+            return handle->cleaning_up || !handle->work.empty();
+        });
+        if (handle->work.empty()) {
+            break;
+        }
+        host_hal_work w = handle->work.front();
+        handle->work.pop_front();
+        lock.unlock();
+        w.task(handle, w.arg);
+        lock.lock();
+    }
+
+    wifi_cleaned_up_handler handler = handle->cleaned_up_handler;
+    lock.unlock();
+
+    ALOGD("host HAL event loop exiting");
+    if (handler != NULL) {
+        handler(handle);
+    }
+    delete handle;
+}
+
+wifi_error host_hal_post(wifi_handle handle, host_hal_task task, void *arg) {
+    std::lock_guard<std::mutex> lock(handle->lock);
+    if (handle->cleaning_up) {
+        return WIFI_ERROR_NOT_AVAILABLE;
+    }
+    handle->work.push_back({ task, arg });
+    handle->cond.notify_all();
+    return WIFI_SUCCESS;
+}
+
+static wifi_error host_get_ifaces(wifi_handle handle, int *num_ifaces,
+        wifi_interface_handle **ifaces) {
+    *num_ifaces = 1;
+    *ifaces = handle->ifaces;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error host_get_iface_name(wifi_interface_handle iface, char *name, size_t size) {
+    strncpy(name, iface->name, size);
+    if (size > 0) {
+        name[size - 1] = 0;
+    }
+    return WIFI_SUCCESS;
+}
+
+static wifi_error host_get_supported_feature_set(wifi_interface_handle iface, feature_set *set) {
+    *set = WIFI_FEATURE_INFRA | WIFI_FEATURE_INFRA_5G;
+    return WIFI_SUCCESS;
+}
+
+/* entry point used by android_net_wifi_startHal in place of the vendor library */
+wifi_error init_wifi_vendor_hal_func_table(wifi_hal_fn *fn) {
+    if (fn == NULL) {
+        return WIFI_ERROR_UNKNOWN;
+    }
+
+    fn->wifi_initialize = host_initialize;
+    fn->wifi_cleanup = host_cleanup;
+    fn->wifi_event_loop = host_event_loop;
+    fn->wifi_get_ifaces = host_get_ifaces;
+    fn->wifi_get_iface_name = host_get_iface_name;
+    fn->wifi_get_supported_feature_set = host_get_supported_feature_set;
+    return WIFI_SUCCESS;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WIFI_HAL_HOST_H__
+#define __WIFI_HAL_HOST_H__
+
+#include "wifi_hal.h"
+
+/*
+ * Host (Linux) HAL used in place of the vendor library when the JNI bridge is
+ * built for the host. It provides a single "wlan0" interface and an event loop
+ * that runs until wifi_cleanup(); everything else is left to the stub table.
+ */
+
+#define HOST_HAL_IFACE_NAME "wlan0"
+
+/* post a task to run on the HAL event loop thread */
+typedef void (*host_hal_task)(wifi_handle handle, void *arg);
+wifi_error host_hal_post(wifi_handle handle, host_hal_task task, void *arg);
+
+#endif //__WIFI_HAL_HOST_H__
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-host"
+
+#include "jni.h"
+#include <utils/Log.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "wifi_hal.h"
+#include "fake_jni.h"
+#include "jni_helper.h"
+#include "wifi_host_env.h"
+
+extern "C" jint Java_com_android_server_wifi_WifiNative_registerNatives(
+        JNIEnv* env, jclass clazz);
+
+namespace android {
+
+typedef jboolean (*StartHalFn)(JNIEnv *, jclass);
+typedef void (*StopHalFn)(JNIEnv *, jclass);
+typedef void (*WaitForHalEventsFn)(JNIEnv *, jclass);
+typedef jint (*GetInterfacesFn)(JNIEnv *, jclass);
+
+WifiHostEnv::WifiHostEnv()
+    : mCls(NULL), mStarted(false)
+{
+    mCls = reinterpret_cast<jclass>(FakeJavaVM::wrap(mVM.findClass(kWifiNativeClass)));
+    defineJavaMethods();
+}
+
+WifiHostEnv::~WifiHostEnv()
+{
+    stop();
+}
+
+/* the few Java methods whose return value the bridge depends on */
+void WifiHostEnv::defineJavaMethods()
+{
+    mVM.defineMethod(kWifiNativeClass, "setSsid", "([BLandroid/net/wifi/ScanResult;)Z", true,
+            [](JNIEnv *env, FakeObject *thiz, const jvalue *args) {
+                FakeObject *bytes = FakeJavaVM::unwrap(args[0].l);
+                jclass cls = env->GetObjectClass(args[1].l);
+                jfieldID field = env->GetFieldID(cls, "SSID", "Ljava/lang/String;");
+                std::string ssid(static_cast<const char *>(bytes->data()), bytes->length());
+                jstring str = env->NewStringUTF(ssid.c_str());
+                env->SetObjectField(args[1].l, field, str);
+                env->DeleteLocalRef(str);
+                env->DeleteLocalRef(cls);
+                jvalue result;
+                result.z = JNI_TRUE;
+                return result;
+            });
+}
+
+bool WifiHostEnv::start()
+{
+    if (mStarted) {
+        return true;
+    }
+
+    JNIEnv *env = mVM.getEnv();
+    if (Java_com_android_server_wifi_WifiNative_registerNatives(env, mCls) != 0) {
+        ALOGE("Could not register WifiNative natives");
+        return false;
+    }
+
+    if (!native<StartHalFn>("startHalNative")(env, mCls)) {
+        ALOGE("startHalNative failed");
+        return false;
+    }
+
+    mEventThread = std::thread([this]() {
+        native<WaitForHalEventsFn>("waitForHalEventNative")(mVM.getEnv(), mCls);
+    });
+
+    if (native<GetInterfacesFn>("getInterfacesNative")(env, mCls) <= 0) {
+        ALOGE("getInterfacesNative found no interfaces");
+        native<StopHalFn>("stopHalNative")(env, mCls);
+        mEventThread.join();
+        return false;
+    }
+
+    mStarted = true;
+    return true;
+}
+
+void WifiHostEnv::stop()
+{
+    if (!mStarted) {
+        return;
+    }
+
+    native<StopHalFn>("stopHalNative")(mVM.getEnv(), mCls);
+    mEventThread.join();
+    mStarted = false;
+}
+
+bool WifiHostEnv::printRefStats(FILE *out, int maxScopes)
+{
+    JNIRefStats stats[256];
+    int num = std::min(JNIHelper::getRefStats(stats, 256), 256);
+    std::sort(stats, stats + num, [](const JNIRefStats &a, const JNIRefStats &b) {
+        return a.maxLocalRefs > b.maxLocalRefs;
+    });
+
+    fprintf(out, "%-50s %8s %8s %8s %8s %8s\n", "JNI refs by scope", "calls", "max", "net",
+            "leaking", "globals");
+    for (int i = 0; i < num && i < maxScopes; i++) {
+        fprintf(out, "%-50s %8u %8d %8d %8u %8d\n", stats[i].scope, stats[i].calls,
+                stats[i].maxLocalRefs, stats[i].maxNetLocalRefs, stats[i].leakingCalls,
+                stats[i].netGlobalRefs);
+    }
+    fprintf(out, "%d scopes, %d live global refs\n", num, JNIHelper::getLiveGlobalRefs());
+
+    return JNIHelper::checkRefStats();
+}
+
+}  // namespace android
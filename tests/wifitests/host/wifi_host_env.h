@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WIFI_HOST_ENV_H__
+#define __WIFI_HOST_ENV_H__
+
+#include "jni.h"
+#include <stdio.h>
+
+#include <thread>
+
+#include "fake_jni.h"
+
+namespace android {
+
+/*
+ * Boots the real JNI bridge against the fake VM and the host HAL: registers
+ * the WifiNative natives, runs startHal/getInterfaces exactly like
+ * WifiNative.startHal() does and services the HAL event loop on its own
+ * thread, the same way WifiNative's MonitorThread does on the device.
+ */
+class WifiHostEnv {
+public:
+    static constexpr const char *kWifiNativeClass = "com/android/server/wifi/WifiNative";
+
+    WifiHostEnv();
+    ~WifiHostEnv();
+
+    bool start();
+    void stop();
+
+    /*
+     * Prints JNIHelper's reference accounting for every native and callback
+     * that ran, highest local ref high-water mark first. Returns false if any
+     * of them returned with live local refs. Enable the accounting with
+     * JNIHelper::setRefAccounting() before start() so that the global refs
+     * taken by startHal are counted too.
+     */
+    static bool printRefStats(FILE *out, int maxScopes);
+
+    FakeJavaVM& vm() { return mVM; }
+    JNIEnv *env() { return mVM.getEnv(); }
+    jclass wifiNativeClass() { return mCls; }
+    jint ifaceIndex() const { return 0; }
+
+    /* registered native function for WifiNative.<name>, cast to its JNI signature */
+    template<typename F>
+    F native(const char *name) {
+        return reinterpret_cast<F>(mVM.findNative(kWifiNativeClass, name));
+    }
+
+private:
+    void defineJavaMethods();
+
+    FakeJavaVM mVM;
+    jclass mCls;
+    std::thread mEventThread;
+    bool mStarted;
+};
+
+}  // namespace android
+
+#endif //__WIFI_HOST_ENV_H__
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-host-test"
+
+#include "jni.h"
+#include <stdio.h>
+
+#include "wifi_hal.h"
+#include "fake_jni.h"
+#include "jni_helper.h"
+#include "wifi_host_test.h"
+
+namespace android {
+
+static WifiHostEnv *sHost;
+
+/* brings the bridge up once for all tests and checks the ref accounting at the end */
+class WifiHostTestEnvironment : public ::testing::Environment {
+public:
+    void SetUp() override {
+        JNIHelper::setRefAccounting(true);
+        sHost = new WifiHostEnv();
+        ASSERT_TRUE(sHost->start()) << "could not start the host HAL";
+    }
+
+    void TearDown() override {
+        sHost->stop();
+        EXPECT_TRUE(WifiHostEnv::printRefStats(stdout, 10))
+                << "a native returned with live local refs";
+        delete sHost;
+        sHost = NULL;
+    }
+};
+
+static ::testing::Environment *const sEnvironment =
+        ::testing::AddGlobalTestEnvironment(new WifiHostTestEnvironment());
+
+WifiHostEnv& WifiHostTest::host() {
+    return *sHost;
+}
+
+void WifiHostTest::SetUp() {
+    ASSERT_TRUE(sHost != NULL);
+    mSavedFn = hal_fn;
+}
+
+void WifiHostTest::TearDown() {
+    hal_fn = mSavedFn;
+    host().vm().collect();
+}
+
+jbyteArray WifiHostTest::newByteArray(const std::vector<u8>& bytes) {
+    jbyteArray array = env()->NewByteArray(bytes.size());
+    env()->SetByteArrayRegion(array, 0, bytes.size(), (const jbyte *) bytes.data());
+    return array;
+}
+
+std::string WifiHostTest::takeString(jstring str) {
+    if (str == NULL) {
+        return "(null)";
+    }
+    std::string value = FakeJavaVM::unwrap(str)->str();
+    env()->DeleteLocalRef(str);
+    return value;
+}
+
+void WifiHostTest::restartHal() {
+    host().stop();
+    ASSERT_TRUE(host().start()) << "could not restart the host HAL";
+    installHal();
+}
+
+}  // namespace android
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WIFI_HOST_TEST_H__
+#define __WIFI_HOST_TEST_H__
+
+#include "jni.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "wifi_hal.h"
+#include "wifi_host_env.h"
+
+namespace android {
+
+extern wifi_hal_fn hal_fn;
+
+/*
+ * Base fixture of the bridge's host unit tests. The bridge keeps its state in
+ * statics, so a single WifiHostEnv is started for the whole run. A test may
+ * replace entries of hal_fn; the table is put back after each test.
+ */
+class WifiHostTest : public ::testing::Test {
+protected:
+    void SetUp() override;
+    void TearDown() override;
+
+    static WifiHostEnv& host();
+    JNIEnv *env() { return host().env(); }
+    jclass cls() { return host().wifiNativeClass(); }
+    jint iface() { return host().ifaceIndex(); }
+
+    template<typename F>
+    F native(const char *name) {
+        F fn = host().native<F>(name);
+        EXPECT_TRUE(fn != NULL) << "no native " << name;
+        return fn;
+    }
+
+    /* local refs, deleted by the caller */
+    jbyteArray newByteArray(const std::vector<u8>& bytes);
+    jstring newString(const char *utf) { return env()->NewStringUTF(utf); }
+
+    /* the string's contents, deleting the local ref; "(null)" for NULL */
+    std::string takeString(jstring str);
+
+    /* replaces the fixture's entries of hal_fn; called again by restartHal() */
+    virtual void installHal() {}
+
+    /*
+     * Stops and starts the HAL again, which runs the bridge's cleanup handler.
+     * startHal reloads hal_fn, so installHal() is called afterwards.
+     */
+    void restartHal();
+
+    /*
+     * The bridge's caches and histories are statics and outlive a test; a
+     * fixture that checks them calls this from SetUp() to start from the state
+     * a freshly started HAL leaves them in.
+     */
+    void resetBridgeState() { restartHal(); }
+
+private:
+    wifi_hal_fn mSavedFn;
+};
+
+}  // namespace android
+
+#endif //__WIFI_HOST_TEST_H__
@@ -0,0 +1,929 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-jni-benchmark"
+
+#include "jni.h"
+#include <utils/Log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "wifi_hal.h"
+#include "fake_jni.h"
+#include "wifi_host_env.h"
+
+/*
+ * Microbenchmarks for the WifiNative marshallers, run against the fake JNIEnv
+ * and synthetic HAL payloads sized like a busy deployment. Besides ns/op each
+ * benchmark reports, in its label, the JNI calls, Java upcalls, objects and
+ * payload bytes allocated per op. Those counts are deterministic, so any change
+ * to them shows up as a diff against wifi_jni_benchmark_baseline.txt.
+ */
+
+#ifdef INCLUDE_NAN_FEATURE
+extern "C" jint Java_com_android_server_wifi_nan_WifiNanNative_registerNanNatives(
+        JNIEnv* env, jclass clazz);
+#endif
+
+namespace android {
+
+extern wifi_hal_fn hal_fn;
+
+static const int kScanBuckets = 64;                 /* cached scans returned by getScanResults */
+static const int kApsPerScan = MAX_AP_CACHE_PER_SCAN;
+static const int kIeLength = 256;                   /* IEs carried by a full scan result */
+static const int kRttPeers = 16;
+static const int kLciLength = 16;
+static const int kLcrLength = 8;
+static const int kFateReports = MAX_FATE_LOG_LEN;
+static const int kFateFrameLength = 128;
+static const int kTxPowerLevels = 16;
+static const int kApfProgramLength = 1024;          /* a typical ApfFilter program */
+static const int kNanSsiLength = 128;
+static const int kNanMatchFilterLength = 32;
+static const int kNanMatchPeers = 128;              /* distinct peers in BM_NanMatchBatch */
+static const int kNanMatchBatchSize = 16;           /* NAN_MATCH_BATCH_SIZE in the bridge */
+
+/* heap size at which the fake VM is collected, outside of the timed region */
+static const size_t kCollectThreshold = 1 << 16;
+
+static WifiHostEnv *gHost;
+
+/* ------------------------------------------------------------------------- */
+/* synthetic HAL payloads */
+
+static void fillScanResult(wifi_scan_result *result, int scan, int ap) {
+    snprintf(result->ssid, sizeof(result->ssid), "bench-network-%02d", ap);
+    result->bssid[0] = 0x02;
+    result->bssid[1] = 0x1a;
+    result->bssid[2] = 0x11;
+    result->bssid[3] = (byte) scan;
+    result->bssid[4] = (byte) (ap >> 8);
+    result->bssid[5] = (byte) ap;
+    result->channel = (ap % 2) ? 5180 + 20 * (ap % 8) : 2412 + 5 * (ap % 11);
+    result->rssi = -40 - (ap % 50);
+    result->ts = 1000000LL * scan + (kApsPerScan - ap);
+    result->beacon_period = 100;
+    result->capability = 0x0411;
+}
+
+static wifi_cached_scan_results sCachedScans[kScanBuckets];
+static wifi_scan_result *sFullScanResult;
+static wifi_scan_result sPnoResults[kApsPerScan];
+
+static wifi_rtt_result sRttResults[kRttPeers];
+static wifi_rtt_result *sRttResultPtrs[kRttPeers];
+static std::vector<uint8_t> sRttElements;
+
+static wifi_iface_stat sIfaceStat;
+static wifi_radio_stat sRadioStat;
+static u32 sTxTimePerLevel[kTxPowerLevels];
+
+static void buildPayloads() {
+    for (int i = 0; i < kScanBuckets; i++) {
+        sCachedScans[i].scan_id = i;
+        sCachedScans[i].flags = 0;
+        sCachedScans[i].buckets_scanned = 0x1;
+        sCachedScans[i].num_results = kApsPerScan;
+        for (int j = 0; j < kApsPerScan; j++) {
+            fillScanResult(&sCachedScans[i].results[j], i, j);
+        }
+    }
+
+    sFullScanResult = (wifi_scan_result *) calloc(1, sizeof(wifi_scan_result) + kIeLength);
+    fillScanResult(sFullScanResult, 0, 0);
+    sFullScanResult->ie_length = kIeLength;
+    for (int i = 0; i < kIeLength; i++) {
+        sFullScanResult->ie_data[i] = (char) i;
+    }
+
+    for (int i = 0; i < kApsPerScan; i++) {
+        fillScanResult(&sPnoResults[i], 0, i);
+    }
+
+    size_t elementSize = sizeof(wifi_information_element) + kLciLength
+            + sizeof(wifi_information_element) + kLcrLength;
+    sRttElements.assign(elementSize * kRttPeers, 0xa5);
+    for (int i = 0; i < kRttPeers; i++) {
+        wifi_rtt_result *r = &sRttResults[i];
+        memset(r, 0, sizeof(*r));
+        r->addr[0] = 0x02;
+        r->addr[5] = (byte) i;
+        r->burst_num = 1;
+        r->measurement_number = 8;
+        r->success_number = 8;
+        r->number_per_burst_peer = 8;
+        r->status = RTT_STATUS_SUCCESS;
+        r->type = RTT_TYPE_2_SIDED;
+        r->rssi = -50;
+        r->tx_rate.bitrate = 65000;
+        r->rx_rate.bitrate = 65000;
+        r->rtt = 20000 + i;
+        r->distance_mm = 3000 + 100 * i;
+        r->ts = 123456789LL + i;
+
+        uint8_t *base = sRttElements.data() + i * elementSize;
+        r->LCI = (wifi_information_element *) base;
+        r->LCI->id = 0x08;
+        r->LCI->len = kLciLength;
+        r->LCR = (wifi_information_element *) (base + sizeof(wifi_information_element)
+                + kLciLength);
+        r->LCR->id = 0x0b;
+        r->LCR->len = kLcrLength;
+        sRttResultPtrs[i] = r;
+    }
+
+    memset(&sIfaceStat, 0, sizeof(sIfaceStat));
+    sIfaceStat.beacon_rx = 1000;
+    sIfaceStat.rssi_mgmt = -55;
+    for (int ac = 0; ac < WIFI_AC_MAX; ac++) {
+        sIfaceStat.ac[ac].rx_mpdu = 1000 * ac;
+        sIfaceStat.ac[ac].tx_mpdu = 2000 * ac;
+        sIfaceStat.ac[ac].mpdu_lost = ac;
+        sIfaceStat.ac[ac].retries = 10 * ac;
+    }
+    memset(&sRadioStat, 0, sizeof(sRadioStat));
+    sRadioStat.on_time = 10000;
+    sRadioStat.tx_time = 2000;
+    sRadioStat.rx_time = 3000;
+    sRadioStat.on_time_scan = 500;
+    for (int i = 0; i < kTxPowerLevels; i++) {
+        sTxTimePerLevel[i] = 100 + i;
+    }
+    sRadioStat.num_tx_levels = kTxPowerLevels;
+    sRadioStat.tx_time_per_levels = sTxTimePerLevel;
+}
+
+/* ------------------------------------------------------------------------- */
+/* HAL entry points feeding the payloads */
+
+static wifi_scan_result_handler sScanHandler;
+static wifi_rtt_event_handler sRttHandler;
+static wifi_epno_handler sEpnoHandler;
+
+static wifi_error bench_get_supported_feature_set(wifi_interface_handle iface,
+        feature_set *set) {
+    *set = WIFI_FEATURE_INFRA | WIFI_FEATURE_INFRA_5G | WIFI_FEATURE_GSCAN
+            | WIFI_FEATURE_LINK_LAYER_STATS | WIFI_FEATURE_D2AP_RTT | WIFI_FEATURE_HAL_EPNO
+            | WIFI_FEATURE_TX_TRANSMIT_POWER;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error bench_start_gscan(wifi_request_id id, wifi_interface_handle iface,
+        wifi_scan_cmd_params params, wifi_scan_result_handler handler) {
+    sScanHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error bench_get_cached_gscan_results(wifi_interface_handle iface, byte flush,
+        int max, wifi_cached_scan_results *results, int *num) {
+    int n = max < kScanBuckets ? max : kScanBuckets;
+    memcpy(results, sCachedScans, n * sizeof(wifi_cached_scan_results));
+    *num = n;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error bench_get_link_stats(wifi_request_id id, wifi_interface_handle iface,
+        wifi_stats_result_handler handler) {
+    handler.on_link_stats_results(id, &sIfaceStat, 1, &sRadioStat);
+    return WIFI_SUCCESS;
+}
+
+static wifi_error bench_rtt_range_request(wifi_request_id id, wifi_interface_handle iface,
+        unsigned num_rtt_config, wifi_rtt_config rtt_config[], wifi_rtt_event_handler handler) {
+    sRttHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error bench_set_epno_list(wifi_request_id id, wifi_interface_handle iface,
+        const wifi_epno_params *params, wifi_epno_handler handler) {
+    sEpnoHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+template<typename ReportT>
+static wifi_error bench_get_pkt_fates(wifi_interface_handle iface, ReportT *reports,
+        size_t n_requested, size_t *n_provided) {
+    for (size_t i = 0; i < n_requested; i++) {
+        reports[i].fate = (decltype(reports[i].fate)) 0;
+        reports[i].frame_inf.payload_type = FRAME_TYPE_ETHERNET_II;
+        reports[i].frame_inf.frame_len = kFateFrameLength;
+        reports[i].frame_inf.driver_timestamp_usec = 1000 * i;
+        memset(reports[i].frame_inf.frame_content.ethernet_ii_bytes, (int) i,
+                kFateFrameLength);
+    }
+    *n_provided = n_requested;
+    return WIFI_SUCCESS;
+}
+
+/* copies the program as the driver would; the firmware wakeup itself is not modeled */
+static u8 sApfProgram[kApfProgramLength];
+
+static wifi_error bench_set_packet_filter(wifi_interface_handle iface, const u8 *program,
+        u32 len) {
+    memcpy(sApfProgram, program, std::min(len, (u32) sizeof(sApfProgram)));
+    return WIFI_SUCCESS;
+}
+
+#ifdef INCLUDE_NAN_FEATURE
+static NanCallbackHandler sNanHandlers;
+
+static wifi_error bench_nan_register_handler(wifi_interface_handle iface,
+        NanCallbackHandler handlers) {
+    sNanHandlers = handlers;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error bench_nan_publish_request(transaction_id id, wifi_interface_handle iface,
+        NanPublishRequest *msg) {
+    return WIFI_SUCCESS;
+}
+#endif
+
+static void installBenchHal() {
+    hal_fn.wifi_get_supported_feature_set = bench_get_supported_feature_set;
+    hal_fn.wifi_start_gscan = bench_start_gscan;
+    hal_fn.wifi_get_cached_gscan_results = bench_get_cached_gscan_results;
+    hal_fn.wifi_get_link_stats = bench_get_link_stats;
+    hal_fn.wifi_rtt_range_request = bench_rtt_range_request;
+    hal_fn.wifi_set_epno_list = bench_set_epno_list;
+    hal_fn.wifi_get_tx_pkt_fates = bench_get_pkt_fates<wifi_tx_report>;
+    hal_fn.wifi_get_rx_pkt_fates = bench_get_pkt_fates<wifi_rx_report>;
+    hal_fn.wifi_set_packet_filter = bench_set_packet_filter;
+#ifdef INCLUDE_NAN_FEATURE
+    hal_fn.wifi_nan_register_handler = bench_nan_register_handler;
+    hal_fn.wifi_nan_publish_request = bench_nan_publish_request;
+#endif
+
+    /* capabilities are cached as the interfaces are enumerated: enumerate them again */
+    typedef jint (*GetInterfacesFn)(JNIEnv *, jclass);
+    gHost->native<GetInterfacesFn>("getInterfacesNative")(gHost->env(), gHost->wifiNativeClass());
+}
+
+/* ------------------------------------------------------------------------- */
+/* helpers */
+
+static jobject newObject(JNIEnv *env, const char *className) {
+    jclass cls = env->FindClass(className);
+    jobject obj = env->AllocObject(cls);
+    env->DeleteLocalRef(cls);
+    return obj;
+}
+
+static jobjectArray newObjectArray(JNIEnv *env, const char *className, int length) {
+    jclass cls = env->FindClass(className);
+    jobjectArray array = env->NewObjectArray(length, cls, NULL);
+    env->DeleteLocalRef(cls);
+    return array;
+}
+
+static void setStringField(JNIEnv *env, jobject obj, const char *name, const char *value) {
+    jclass cls = env->GetObjectClass(obj);
+    jfieldID field = env->GetFieldID(cls, name, "Ljava/lang/String;");
+    jstring str = env->NewStringUTF(value);
+    env->SetObjectField(obj, field, str);
+    env->DeleteLocalRef(str);
+    env->DeleteLocalRef(cls);
+}
+
+#ifdef INCLUDE_NAN_FEATURE
+/* (re)registers the NAN callbacks, which also starts the bridge's NAN state over */
+static void initNanHandlers(int matchBatchWindowMs) {
+    typedef jint (*InitNanHandlersFn)(JNIEnv *, jclass, jclass, jint, jint);
+    jclass nanCls = reinterpret_cast<jclass>(FakeJavaVM::wrap(
+            gHost->vm().findClass("com/android/server/wifi/nan/WifiNanNative")));
+    InitNanHandlersFn initNan = reinterpret_cast<InitNanHandlersFn>(
+            gHost->vm().findNative("com/android/server/wifi/nan/WifiNanNative",
+                    "initNanHandlersNative"));
+    initNan(gHost->env(), nanCls, gHost->wifiNativeClass(), gHost->ifaceIndex(),
+            matchBatchWindowMs);
+}
+#endif
+
+/* registers the bridge's HAL callbacks the same way the framework does */
+static void registerCallbacks() {
+    JNIEnv *env = gHost->env();
+    jclass cls = gHost->wifiNativeClass();
+
+    typedef jboolean (*StartScanFn)(JNIEnv *, jclass, jint, jint, jobject);
+    jobject settings = newObject(env, "com/android/server/wifi/WifiNative$ScanSettings");
+    gHost->native<StartScanFn>("startScanNative")(env, cls, gHost->ifaceIndex(), 1, settings);
+    env->DeleteLocalRef(settings);
+
+    typedef jboolean (*RequestRangeFn)(JNIEnv *, jclass, jint, jint, jobject);
+    jobjectArray params = newObjectArray(env, "android/net/wifi/RttManager$RttParams", 1);
+    jobject param = newObject(env, "android/net/wifi/RttManager$RttParams");
+    setStringField(env, param, "bssid", "02:00:00:00:00:01");
+    env->SetObjectArrayElement(params, 0, param);
+    gHost->native<RequestRangeFn>("requestRangeNative")(env, cls, gHost->ifaceIndex(), 2,
+            params);
+    env->DeleteLocalRef(param);
+    env->DeleteLocalRef(params);
+
+    typedef jboolean (*SetPnoListFn)(JNIEnv *, jclass, jint, jint, jobject);
+    jobject pno = newObject(env, "com/android/server/wifi/WifiNative$PnoSettings");
+    jobjectArray networks = newObjectArray(env,
+            "com/android/server/wifi/WifiNative$PnoNetwork", 1);
+    jobject network = newObject(env, "com/android/server/wifi/WifiNative$PnoNetwork");
+    setStringField(env, network, "ssid", "\"bench-network-00\"");
+    env->SetObjectArrayElement(networks, 0, network);
+    jclass pnoCls = env->GetObjectClass(pno);
+    env->SetObjectField(pno, env->GetFieldID(pnoCls, "networkList",
+            "[Lcom/android/server/wifi/WifiNative$PnoNetwork;"), networks);
+    gHost->native<SetPnoListFn>("setPnoListNative")(env, cls, gHost->ifaceIndex(), 3, pno);
+    env->DeleteLocalRef(pnoCls);
+    env->DeleteLocalRef(network);
+    env->DeleteLocalRef(networks);
+    env->DeleteLocalRef(pno);
+
+#ifdef INCLUDE_NAN_FEATURE
+    jclass nanCls = reinterpret_cast<jclass>(FakeJavaVM::wrap(
+            gHost->vm().findClass("com/android/server/wifi/nan/WifiNanNative")));
+    Java_com_android_server_wifi_nan_WifiNanNative_registerNanNatives(env, nanCls);
+    initNanHandlers(0);
+#endif
+}
+
+/*
+ * Tracks what crossed the fake JNI boundary during the timed loop and
+ * reports it per op. The fake VM is collected outside of the timed region
+ * whenever its heap grows past kCollectThreshold.
+ */
+class JniCounters {
+public:
+    JniCounters(benchmark::State& state) : mState(state) {
+        gHost->vm().collect();
+        gHost->vm().resetStats();
+        mStart = gHost->vm().getStats();
+    }
+
+    void maybeCollect() {
+        if (gHost->vm().heapSize() > kCollectThreshold) {
+            mState.PauseTiming();
+            gHost->vm().collect();
+            mState.ResumeTiming();
+        }
+    }
+
+    ~JniCounters() {
+        FakeJniStats end = gHost->vm().getStats();
+        double ops = mState.iterations() > 0 ? (double) mState.iterations() : 1.0;
+        char label[160];
+        snprintf(label, sizeof(label),
+                "jni/op=%.0f upcalls/op=%.0f allocs/op=%.0f bytes/op=%.0f",
+                (end.calls - mStart.calls) / ops, (end.upcalls - mStart.upcalls) / ops,
+                (end.objectsAllocated - mStart.objectsAllocated) / ops,
+                (end.bytesAllocated - mStart.bytesAllocated) / ops);
+        mState.SetLabel(label);
+        gHost->vm().collect();
+    }
+
+private:
+    benchmark::State& mState;
+    FakeJniStats mStart;
+};
+
+/* ------------------------------------------------------------------------- */
+/* benchmarks */
+
+static void BM_FullScanResult(benchmark::State& state) {
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        sScanHandler.on_full_scan_result(1, sFullScanResult, 0x1);
+        counters.maybeCollect();
+    }
+}
+BENCHMARK(BM_FullScanResult);
+
+/* full scan results through the event ring, to a consumer thread walking the records */
+static void BM_FullScanResultRing(benchmark::State& state) {
+    typedef jobject (*EnableEventRingFn)(JNIEnv *, jclass, jint, jint);
+    typedef jlong (*WaitEventRingFn)(JNIEnv *, jclass, jlong);
+    typedef void (*DisableEventRingFn)(JNIEnv *, jclass);
+    JNIEnv *env = gHost->env();
+    jclass cls = gHost->wifiNativeClass();
+    WaitEventRingFn waitEventRing = gHost->native<WaitEventRingFn>("waitEventRingNative");
+    jobject ring = gHost->native<EnableEventRingFn>("enableEventRingNative")(env, cls, 1 << 18,
+            1 << 1 /* EVENT_FULL_SCAN_RESULT */);
+    if (ring == NULL) {
+        state.SkipWithError("could not enable the event ring");
+        return;
+    }
+    const uint8_t *data = static_cast<const uint8_t *>(env->GetDirectBufferAddress(ring));
+    jlong size = env->GetDirectBufferCapacity(ring);
+    env->DeleteLocalRef(ring);
+
+    std::atomic<uint64_t> records(0);
+    std::thread consumer([&]() {
+        jlong consumed = 0;
+        jlong head;
+        /* like the framework's event ring thread; the native does not use its JNIEnv */
+        while ((head = waitEventRing(NULL, NULL, consumed)) >= 0) {
+            while (consumed < head) {
+                uint32_t header[2];
+                memcpy(header, data + (consumed & (size - 1)), sizeof(header));
+                if (header[1] != 0) {
+                    records++;
+                }
+                consumed += (header[0] + 7) & ~7;
+            }
+        }
+    });
+
+    /* a scan's worth of results at a time, until the consumer has them all */
+    {
+        JniCounters counters(state);
+        uint64_t posted = 0;
+        while (state.KeepRunning()) {
+            for (int i = 0; i < kApsPerScan; i++) {
+                sScanHandler.on_full_scan_result(1, sFullScanResult, 0x1);
+            }
+            posted += kApsPerScan;
+            while (records.load() < posted) {
+                std::this_thread::yield();
+            }
+            counters.maybeCollect();
+        }
+    }
+    gHost->native<DisableEventRingFn>("disableEventRingNative")(env, cls);
+    consumer.join();
+    state.SetItemsProcessed(state.iterations() * kApsPerScan);
+}
+BENCHMARK(BM_FullScanResultRing);
+
+static void BM_GetScanResults(benchmark::State& state) {
+    typedef jobject (*GetScanResultsFn)(JNIEnv *, jclass, jint, jboolean);
+    GetScanResultsFn getScanResults = gHost->native<GetScanResultsFn>("getScanResultsNative");
+    JNIEnv *env = gHost->env();
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(getScanResults(env, gHost->wifiNativeClass(),
+                gHost->ifaceIndex(), JNI_TRUE));
+        counters.maybeCollect();
+    }
+    state.SetItemsProcessed(state.iterations() * kScanBuckets * kApsPerScan);
+}
+BENCHMARK(BM_GetScanResults);
+
+/*
+ * Looks one BSSID up in a scan history holding 4 drains of the cached scans, decoded from the
+ * segment mappings; items are the sightings decoded. The history is kept in a temporary
+ * directory, removed afterwards.
+ */
+static void BM_QueryScanHistory(benchmark::State& state) {
+    typedef jobject (*GetScanResultsFn)(JNIEnv *, jclass, jint, jboolean);
+    typedef jboolean (*EnableScanHistoryFn)(JNIEnv *, jclass, jstring, jint, jint);
+    typedef jobjectArray (*QueryScanHistoryFn)(JNIEnv *, jclass, jlong, jlong, jstring, jint);
+    JNIEnv *env = gHost->env();
+    jclass cls = gHost->wifiNativeClass();
+    char dir[] = "/tmp/wifi-jni-benchmark-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        state.SkipWithError("cannot create the scan history directory");
+        return;
+    }
+    if (!gHost->native<EnableScanHistoryFn>("enableScanHistoryNative")(env, cls,
+            env->NewStringUTF(dir), 256 * 1024, 8)) {
+        state.SkipWithError("cannot enable the scan history");
+        return;
+    }
+    GetScanResultsFn getScanResults = gHost->native<GetScanResultsFn>("getScanResultsNative");
+    for (int i = 0; i < 4; i++) {
+        getScanResults(env, cls, gHost->ifaceIndex(), JNI_TRUE);
+    }
+
+    QueryScanHistoryFn query = gHost->native<QueryScanHistoryFn>("queryScanHistoryNative");
+    jstring bssid = static_cast<jstring>(
+            env->NewGlobalRef(env->NewStringUTF("02:1a:11:05:00:07")));
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(query(env, cls, 0, std::numeric_limits<jlong>::max(), bssid,
+                16));
+        counters.maybeCollect();
+    }
+    state.SetItemsProcessed(state.iterations() * 4 * kScanBuckets * kApsPerScan);
+    env->DeleteGlobalRef(bssid);
+
+    std::string rm = std::string("rm -rf ") + dir;
+    if (system(rm.c_str()) != 0) {
+        fprintf(stderr, "cannot remove %s\n", dir);
+    }
+}
+BENCHMARK(BM_QueryScanHistory);
+
+static void BM_GetLinkLayerStats(benchmark::State& state) {
+    typedef jobject (*GetLinkLayerStatsFn)(JNIEnv *, jclass, jint);
+    GetLinkLayerStatsFn getLinkLayerStats =
+            gHost->native<GetLinkLayerStatsFn>("getWifiLinkLayerStatsNative");
+    JNIEnv *env = gHost->env();
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(getLinkLayerStats(env, gHost->wifiNativeClass(),
+                gHost->ifaceIndex()));
+        counters.maybeCollect();
+    }
+}
+BENCHMARK(BM_GetLinkLayerStats);
+
+/* the RSSI poll refreshing the stats object it keeps */
+static void BM_FillLinkLayerStats(benchmark::State& state) {
+    typedef jboolean (*FillLinkLayerStatsFn)(JNIEnv *, jclass, jint, jobject);
+    FillLinkLayerStatsFn fillLinkLayerStats =
+            gHost->native<FillLinkLayerStatsFn>("fillWifiLinkLayerStatsNative");
+    JNIEnv *env = gHost->env();
+    jobject stats = newObject(env, "android/net/wifi/WifiLinkLayerStats");
+    jobject statsRef = env->NewGlobalRef(stats);
+    env->DeleteLocalRef(stats);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            fillLinkLayerStats(env, gHost->wifiNativeClass(), gHost->ifaceIndex(), statsRef);
+            counters.maybeCollect();
+        }
+    }
+    env->DeleteGlobalRef(statsRef);
+}
+BENCHMARK(BM_FillLinkLayerStats);
+
+/*
+ * BM_FillLinkLayerStats with the link stats history recording every poll, into a temporary
+ * directory removed afterwards. Its counts match BM_FillLinkLayerStats: the history is native.
+ */
+static void BM_FillLinkLayerStatsHistory(benchmark::State& state) {
+    typedef jboolean (*FillLinkLayerStatsFn)(JNIEnv *, jclass, jint, jobject);
+    typedef jboolean (*EnableLinkStatsHistoryFn)(JNIEnv *, jclass, jstring);
+    JNIEnv *env = gHost->env();
+    char dir[] = "/tmp/wifi-jni-benchmark-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        state.SkipWithError("cannot create the link stats history directory");
+        return;
+    }
+    if (!gHost->native<EnableLinkStatsHistoryFn>("enableLinkStatsHistoryNative")(env,
+            gHost->wifiNativeClass(), env->NewStringUTF(dir))) {
+        state.SkipWithError("cannot enable the link stats history");
+        return;
+    }
+    FillLinkLayerStatsFn fillLinkLayerStats =
+            gHost->native<FillLinkLayerStatsFn>("fillWifiLinkLayerStatsNative");
+    jobject stats = newObject(env, "android/net/wifi/WifiLinkLayerStats");
+    jobject statsRef = env->NewGlobalRef(stats);
+    env->DeleteLocalRef(stats);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            fillLinkLayerStats(env, gHost->wifiNativeClass(), gHost->ifaceIndex(), statsRef);
+            counters.maybeCollect();
+        }
+    }
+    env->DeleteGlobalRef(statsRef);
+
+    std::string rm = std::string("rm -rf ") + dir;
+    if (system(rm.c_str()) != 0) {
+        fprintf(stderr, "cannot remove %s\n", dir);
+    }
+}
+BENCHMARK(BM_FillLinkLayerStatsHistory);
+
+/* the cost of the JNI transition itself, for getters that do next to no work */
+static void BM_GetSupportedFeatureSet(benchmark::State& state) {
+    typedef jint (*GetSupportedFeatureSetFn)(JNIEnv *, jclass, jint);
+    GetSupportedFeatureSetFn getSupportedFeatureSet =
+            gHost->native<GetSupportedFeatureSetFn>("getSupportedFeatureSetNative");
+    JNIEnv *env = gHost->env();
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(getSupportedFeatureSet(env, gHost->wifiNativeClass(),
+                gHost->ifaceIndex()));
+        counters.maybeCollect();
+    }
+}
+BENCHMARK(BM_GetSupportedFeatureSet);
+
+static void BM_SetDfsFlag(benchmark::State& state) {
+    typedef jboolean (*SetDfsFlagFn)(JNIEnv *, jclass, jint, jboolean);
+    SetDfsFlagFn setDfsFlag = gHost->native<SetDfsFlagFn>("setDfsFlagNative");
+    JNIEnv *env = gHost->env();
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(setDfsFlag(env, gHost->wifiNativeClass(), gHost->ifaceIndex(),
+                true));
+        counters.maybeCollect();
+    }
+}
+BENCHMARK(BM_SetDfsFlag);
+
+static void BM_RttResults(benchmark::State& state) {
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        sRttHandler.on_rtt_results(2, kRttPeers, sRttResultPtrs);
+        counters.maybeCollect();
+    }
+    state.SetItemsProcessed(state.iterations() * kRttPeers);
+}
+BENCHMARK(BM_RttResults);
+
+static void BM_PnoNetworkFound(benchmark::State& state) {
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        sEpnoHandler.on_network_found(3, kApsPerScan, sPnoResults);
+        counters.maybeCollect();
+    }
+    state.SetItemsProcessed(state.iterations() * kApsPerScan);
+}
+BENCHMARK(BM_PnoNetworkFound);
+
+template<bool tx>
+static void BM_GetPktFates(benchmark::State& state) {
+    typedef jint (*GetPktFatesFn)(JNIEnv *, jclass, jint, jobjectArray);
+    GetPktFatesFn getPktFates = gHost->native<GetPktFatesFn>(
+            tx ? "getTxPktFatesNative" : "getRxPktFatesNative");
+    JNIEnv *env = gHost->env();
+    jobjectArray reports = newObjectArray(env, tx
+            ? "com/android/server/wifi/WifiNative$TxFateReport"
+            : "com/android/server/wifi/WifiNative$RxFateReport", kFateReports);
+    jobject reportsRef = env->NewGlobalRef(reports);
+    env->DeleteLocalRef(reports);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            getPktFates(env, gHost->wifiNativeClass(), gHost->ifaceIndex(),
+                    static_cast<jobjectArray>(reportsRef));
+            counters.maybeCollect();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kFateReports);
+    env->DeleteGlobalRef(reportsRef);
+}
+BENCHMARK_TEMPLATE(BM_GetPktFates, true);
+BENCHMARK_TEMPLATE(BM_GetPktFates, false);
+
+/* an RA refresh regenerating the program: unchanged, or with one lifetime rewritten */
+template<bool changed>
+static void BM_InstallPacketFilter(benchmark::State& state) {
+    typedef jboolean (*InstallPacketFilterFn)(JNIEnv *, jclass, jint, jbyteArray);
+    InstallPacketFilterFn installPacketFilter =
+            gHost->native<InstallPacketFilterFn>("installPacketFilterNative");
+    JNIEnv *env = gHost->env();
+    jbyteArray programs[2];
+    for (int i = 0; i < 2; i++) {
+        jbyteArray program = env->NewByteArray(kApfProgramLength);
+        jbyte bytes[kApfProgramLength];
+        memset(bytes, 0x5a, sizeof(bytes));
+        bytes[kApfProgramLength - 16] = changed ? i : 0;
+        env->SetByteArrayRegion(program, 0, kApfProgramLength, bytes);
+        programs[i] = static_cast<jbyteArray>(env->NewGlobalRef(program));
+        env->DeleteLocalRef(program);
+    }
+
+    {
+        JniCounters counters(state);
+        int i = 0;
+        while (state.KeepRunning()) {
+            benchmark::DoNotOptimize(installPacketFilter(env, gHost->wifiNativeClass(),
+                    gHost->ifaceIndex(), programs[i++ & 1]));
+            counters.maybeCollect();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * kApfProgramLength);
+    env->DeleteGlobalRef(programs[0]);
+    env->DeleteGlobalRef(programs[1]);
+}
+BENCHMARK_TEMPLATE(BM_InstallPacketFilter, false);
+BENCHMARK_TEMPLATE(BM_InstallPacketFilter, true);
+
+#ifdef INCLUDE_NAN_FEATURE
+static void BM_NanNotifyResponseCapabilities(benchmark::State& state) {
+    NanResponseMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.status = NAN_STATUS_SUCCESS;
+    msg.response_type = NAN_GET_CAPABILITIES;
+    msg.body.nan_capabilities.max_publishes = 8;
+    msg.body.nan_capabilities.max_subscribes = 8;
+    msg.body.nan_capabilities.max_service_specific_info_len = NAN_MAX_SERVICE_SPECIFIC_INFO_LEN;
+
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        sNanHandlers.NotifyResponse(1, &msg);
+        counters.maybeCollect();
+    }
+}
+BENCHMARK(BM_NanNotifyResponseCapabilities);
+
+static NanMatchInd *newNanMatch() {
+    NanMatchInd *event = new NanMatchInd();
+    event->publish_subscribe_id = 1;
+    event->requestor_instance_id = 7;
+    memset(event->addr, 0x5a, sizeof(event->addr));
+    event->service_specific_info_len = kNanSsiLength;
+    memset(event->service_specific_info, 0x11, kNanSsiLength);
+    event->sdf_match_filter_len = kNanMatchFilterLength;
+    memset(event->sdf_match_filter, 0x22, kNanMatchFilterLength);
+    return event;
+}
+
+/* drops the bridge's match table so that the next benchmark starts clean */
+static void resetNanMatches() {
+    NanDisabledInd disabled;
+    disabled.reason = NAN_STATUS_SUCCESS;
+    sNanHandlers.EventDisabled(&disabled);
+    initNanHandlers(0);
+    gHost->vm().collect();
+}
+
+/* a peer whose payload changes every time, so that each match is delivered */
+static void BM_NanMatch(benchmark::State& state) {
+    NanMatchInd *event = newNanMatch();
+    initNanHandlers(0);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            event->service_specific_info[0]++;
+            sNanHandlers.EventMatch(event);
+            counters.maybeCollect();
+        }
+    }
+    delete event;
+    resetNanMatches();
+}
+BENCHMARK(BM_NanMatch);
+
+/* a peer re-reported unchanged every discovery window */
+static void BM_NanMatchDuplicate(benchmark::State& state) {
+    NanMatchInd *event = newNanMatch();
+    initNanHandlers(0);
+    sNanHandlers.EventMatch(event);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            sNanHandlers.EventMatch(event);
+            counters.maybeCollect();
+        }
+    }
+    delete event;
+    resetNanMatches();
+}
+BENCHMARK(BM_NanMatchDuplicate);
+
+/* a crowd of new peers; each op is one full batch */
+static void BM_NanMatchBatch(benchmark::State& state) {
+    NanMatchInd *event = newNanMatch();
+    initNanHandlers(60 * 60 * 1000);
+
+    {
+        JniCounters counters(state);
+        int i = 0;
+        while (state.KeepRunning()) {
+            for (int j = 0; j < kNanMatchBatchSize; j++, i++) {
+                event->requestor_instance_id = i % kNanMatchPeers;
+                event->service_specific_info[0] = (byte) (i / kNanMatchPeers);
+                sNanHandlers.EventMatch(event);
+            }
+            counters.maybeCollect();
+        }
+        state.SetItemsProcessed(state.iterations() * kNanMatchBatchSize);
+    }
+    delete event;
+    resetNanMatches();
+}
+BENCHMARK(BM_NanMatchBatch);
+
+static void BM_NanFollowup(benchmark::State& state) {
+    NanFollowupInd *event = new NanFollowupInd();
+    event->publish_subscribe_id = 1;
+    event->requestor_instance_id = 7;
+    memset(event->addr, 0x5a, sizeof(event->addr));
+    event->service_specific_info_len = kNanSsiLength;
+    memset(event->service_specific_info, 0x33, kNanSsiLength);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            sNanHandlers.EventFollowup(event);
+            counters.maybeCollect();
+        }
+    }
+    delete event;
+}
+BENCHMARK(BM_NanFollowup);
+
+static void BM_NanDiscEngEvent(benchmark::State& state) {
+    NanDiscEngEventInd event;
+    memset(&event, 0, sizeof(event));
+    event.event_type = NAN_EVENT_ID_JOINED_CLUSTER;
+    memset(event.data.cluster.addr, 0x44, sizeof(event.data.cluster.addr));
+
+    JniCounters counters(state);
+    while (state.KeepRunning()) {
+        sNanHandlers.EventDiscEngEvent(&event);
+        counters.maybeCollect();
+    }
+}
+BENCHMARK(BM_NanDiscEngEvent);
+
+static void setNanBytes(JNIEnv *env, jobject data, const char *name, int length, int value) {
+    jclass cls = env->GetObjectClass(data);
+    jbyteArray array = env->NewByteArray(length);
+    jbyte *bytes = env->GetByteArrayElements(array, NULL);
+    memset(bytes, value, length);
+    env->ReleaseByteArrayElements(array, bytes, 0);
+    env->SetObjectField(data, env->GetFieldID(cls, name, "[B"), array);
+    env->SetIntField(data, env->GetFieldID(cls, (std::string(name) + "Length").c_str(), "I"),
+            length);
+    env->DeleteLocalRef(array);
+    env->DeleteLocalRef(cls);
+}
+
+/* an app updating the SSI of its publish: every call after the first is an update */
+static void BM_NanPublishUpdate(benchmark::State& state) {
+    typedef jint (*PublishFn)(JNIEnv *, jclass, jshort, jint, jclass, jint, jobject, jobject);
+    PublishFn publish = reinterpret_cast<PublishFn>(gHost->vm().findNative(
+            "com/android/server/wifi/nan/WifiNanNative", "publishNative"));
+    JNIEnv *env = gHost->env();
+    jclass nanCls = reinterpret_cast<jclass>(FakeJavaVM::wrap(
+            gHost->vm().findClass("com/android/server/wifi/nan/WifiNanNative")));
+
+    jobject data = newObject(env, "android/net/wifi/nan/PublishData");
+    setStringField(env, data, "mServiceName", "benchmark-service");
+    setNanBytes(env, data, "mServiceSpecificInfo", kNanSsiLength, 0x21);
+    setNanBytes(env, data, "mTxFilter", 64, 0x22);
+    setNanBytes(env, data, "mRxFilter", 64, 0x23);
+    jobject settings = newObject(env, "android/net/wifi/nan/PublishSettings");
+    jobject dataRef = env->NewGlobalRef(data);
+    jobject settingsRef = env->NewGlobalRef(settings);
+    env->DeleteLocalRef(data);
+    env->DeleteLocalRef(settings);
+
+    const u16 publishId = 1;
+    publish(env, nanCls, 1, 0, gHost->wifiNativeClass(), gHost->ifaceIndex(), dataRef,
+            settingsRef);
+    NanResponseMsg response;
+    memset(&response, 0, sizeof(response));
+    response.response_type = NAN_RESPONSE_PUBLISH;
+    response.body.publish_response.publish_id = publishId;
+    sNanHandlers.NotifyResponse(1, &response);
+
+    {
+        JniCounters counters(state);
+        while (state.KeepRunning()) {
+            publish(env, nanCls, 2, publishId, gHost->wifiNativeClass(), gHost->ifaceIndex(),
+                    dataRef, settingsRef);
+            counters.maybeCollect();
+        }
+    }
+    env->DeleteGlobalRef(dataRef);
+    env->DeleteGlobalRef(settingsRef);
+}
+BENCHMARK(BM_NanPublishUpdate);
+#endif
+
+}  // namespace android
+
+using namespace android;
+
+int main(int argc, char **argv) {
+    WifiHostEnv host;
+    if (!host.start()) {
+        fprintf(stderr, "could not start the host HAL\n");
+        return 1;
+    }
+    gHost = &host;
+
+    buildPayloads();
+    installBenchHal();
+    registerCallbacks();
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+
+    gHost = NULL;
+    host.stop();
+    free(sFullScanResult);
+    return 0;
+}
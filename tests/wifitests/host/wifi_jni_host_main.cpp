@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "jni.h"
+
+#include "wifi_hal.h"
+#include "fake_jni.h"
+#include "jni_helper.h"
+#include "wifi_host_env.h"
+
+using namespace android;
+
+typedef jstring (*GetInterfaceNameFn)(JNIEnv *, jclass, jint);
+typedef jint (*GetSupportedFeatureSetFn)(JNIEnv *, jclass, jint);
+
+/*
+ * Smoke test for the host build: brings the HAL up and down through the real
+ * bridge and prints what crossed the fake JNI boundary. Run it under valgrind
+ * or a sanitizer build to check the bridge itself.
+ */
+int main(int argc, char **argv) {
+    JNIHelper::setRefAccounting(true);
+
+    WifiHostEnv host;
+    if (!host.start()) {
+        fprintf(stderr, "could not start the host HAL\n");
+        return 1;
+    }
+
+    JNIEnv *env = host.env();
+    jstring name = host.native<GetInterfaceNameFn>("getInterfaceNameNative")(
+            env, host.wifiNativeClass(), host.ifaceIndex());
+    jint features = host.native<GetSupportedFeatureSetFn>("getSupportedFeatureSetNative")(
+            env, host.wifiNativeClass(), host.ifaceIndex());
+    printf("interface %s, features 0x%x\n",
+            name != NULL ? FakeJavaVM::unwrap(name)->str().c_str() : "(null)", features);
+    env->DeleteLocalRef(name);
+
+    host.stop();
+
+    FakeJniStats stats = host.vm().getStats();
+    printf("%llu JNI calls, %llu upcalls, %llu objects, %lld live local refs, "
+            "%lld live global refs\n",
+            (unsigned long long) stats.calls, (unsigned long long) stats.upcalls,
+            (unsigned long long) stats.objectsAllocated, (long long) stats.liveLocalRefs,
+            (long long) stats.liveGlobalRefs);
+
+    if (!WifiHostEnv::printRefStats(stdout, 10)) {
+        fprintf(stderr, "FAIL: a native returned with live local refs\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+
+#include "jni.h"
+
+#include "wifi_hal.h"
+#include "fake_jni.h"
+#include "jni_helper.h"
+#include "wifi_host_env.h"
+#include "wifi_virtual_radio.h"
+
+namespace android {
+extern wifi_hal_fn hal_fn;
+}
+
+using namespace android;
+
+/*
+ * Soak test for the JNI bridge: runs every event source of the virtual radio
+ * through the real natives for a while, polling the way the framework does,
+ * and fails if the bridge leaked global refs or heap objects by the end.
+ *
+ *   wifi-jni-soak [seconds] ["key=value ..." scenario overrides]
+ */
+
+static const char *kRingName = "wifi_connectivity_events";
+static const int kTrackedAps = 16;
+static const int kRttPeers = 16;
+static const int kLinkStatsPollMs = 100;
+static const int kScanResultsPollMs = 1000;
+
+typedef jboolean (*StartScanFn)(JNIEnv *, jclass, jint, jint, jobject);
+typedef jboolean (*StopScanFn)(JNIEnv *, jclass, jint, jint);
+typedef jobject (*GetScanResultsFn)(JNIEnv *, jclass, jint, jboolean);
+typedef jboolean (*SetSettingsFn)(JNIEnv *, jclass, jint, jint, jobject);
+typedef jboolean (*ResetFn)(JNIEnv *, jclass, jint, jint);
+typedef jobject (*GetLinkLayerStatsFn)(JNIEnv *, jclass, jint);
+typedef jint (*StartRssiMonitoringFn)(JNIEnv *, jclass, jint, jint, jbyte, jbyte);
+typedef jint (*StopRssiMonitoringFn)(JNIEnv *, jclass, jint, jint);
+typedef jboolean (*StartLoggingFn)(JNIEnv *, jclass, jint, jint, jint, jint, jint, jstring);
+typedef jboolean (*GetRingBufferDataFn)(JNIEnv *, jclass, jint, jstring);
+
+enum {
+    ID_SCAN = 1,
+    ID_HOTLIST,
+    ID_SIGNIFICANT_CHANGE,
+    ID_PNO,
+    ID_RTT,
+    ID_RSSI,
+    ID_LOG,
+};
+
+static jobject newObject(JNIEnv *env, const char *className) {
+    jclass cls = env->FindClass(className);
+    jobject obj = env->AllocObject(cls);
+    env->DeleteLocalRef(cls);
+    return obj;
+}
+
+static jobjectArray newObjectArray(JNIEnv *env, const char *className, int length) {
+    jclass cls = env->FindClass(className);
+    jobjectArray array = env->NewObjectArray(length, cls, NULL);
+    env->DeleteLocalRef(cls);
+    return array;
+}
+
+static void setIntField(JNIEnv *env, jobject obj, const char *name, jint value) {
+    jclass cls = env->GetObjectClass(obj);
+    env->SetIntField(obj, env->GetFieldID(cls, name, "I"), value);
+    env->DeleteLocalRef(cls);
+}
+
+static void setBooleanField(JNIEnv *env, jobject obj, const char *name, jboolean value) {
+    jclass cls = env->GetObjectClass(obj);
+    env->SetBooleanField(obj, env->GetFieldID(cls, name, "Z"), value);
+    env->DeleteLocalRef(cls);
+}
+
+static void setObjectField(JNIEnv *env, jobject obj, const char *name, const char *sig,
+        jobject value) {
+    jclass cls = env->GetObjectClass(obj);
+    env->SetObjectField(obj, env->GetFieldID(cls, name, sig), value);
+    env->DeleteLocalRef(cls);
+}
+
+static void setStringField(JNIEnv *env, jobject obj, const char *name, const char *value) {
+    jstring str = env->NewStringUTF(value);
+    setObjectField(env, obj, name, "Ljava/lang/String;", str);
+    env->DeleteLocalRef(str);
+}
+
+static void formatBssid(int index, char *buf, size_t len) {
+    mac_addr bssid;
+    virtual_radio_get_ap_bssid(index, bssid);
+    snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x",
+            bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+}
+
+/* one bucket over all bands, full results and an event every scan */
+static jobject newScanSettings(JNIEnv *env) {
+    jobject settings = newObject(env, "com/android/server/wifi/WifiNative$ScanSettings");
+    setIntField(env, settings, "base_period_ms", 10000);
+    setIntField(env, settings, "max_ap_per_scan", MAX_AP_CACHE_PER_SCAN);
+    setIntField(env, settings, "report_threshold_percent", 80);
+    setIntField(env, settings, "report_threshold_num_scans", 4);
+    setIntField(env, settings, "num_buckets", 1);
+
+    const char *bucketClass = "com/android/server/wifi/WifiNative$BucketSettings";
+    jobjectArray buckets = newObjectArray(env, bucketClass, 1);
+    jobject bucket = newObject(env, bucketClass);
+    setIntField(env, bucket, "bucket", 0);
+    setIntField(env, bucket, "band", WIFI_BAND_ABG_WITH_DFS);
+    setIntField(env, bucket, "period_ms", 10000);
+    setIntField(env, bucket, "report_events",
+            REPORT_EVENTS_EACH_SCAN | REPORT_EVENTS_FULL_RESULTS);
+    env->SetObjectArrayElement(buckets, 0, bucket);
+    setObjectField(env, settings, "buckets",
+            "[Lcom/android/server/wifi/WifiNative$BucketSettings;", buckets);
+    env->DeleteLocalRef(bucket);
+    env->DeleteLocalRef(buckets);
+    return settings;
+}
+
+static jobjectArray newBssidInfos(JNIEnv *env, int low, int high) {
+    const char *infoClass = "android/net/wifi/WifiScanner$BssidInfo";
+    jobjectArray infos = newObjectArray(env, infoClass, kTrackedAps);
+    for (int i = 0; i < kTrackedAps; i++) {
+        char bssid[32];
+        formatBssid(i, bssid, sizeof(bssid));
+        jobject info = newObject(env, infoClass);
+        setStringField(env, info, "bssid", bssid);
+        setIntField(env, info, "low", low);
+        setIntField(env, info, "high", high);
+        env->SetObjectArrayElement(infos, i, info);
+        env->DeleteLocalRef(info);
+    }
+    return infos;
+}
+
+static jobject newHotlistSettings(JNIEnv *env) {
+    jobject settings = newObject(env, "android/net/wifi/WifiScanner$HotlistSettings");
+    setIntField(env, settings, "apLostThreshold", 3);
+    jobjectArray infos = newBssidInfos(env, -80, 0);
+    setObjectField(env, settings, "bssidInfos", "[Landroid/net/wifi/WifiScanner$BssidInfo;",
+            infos);
+    env->DeleteLocalRef(infos);
+    return settings;
+}
+
+static jobject newWifiChangeSettings(JNIEnv *env) {
+    jobject settings = newObject(env, "android/net/wifi/WifiScanner$WifiChangeSettings");
+    setIntField(env, settings, "rssiSampleSize", 3);
+    setIntField(env, settings, "lostApSampleSize", 3);
+    setIntField(env, settings, "minApsBreachingThreshold", 2);
+    jobjectArray infos = newBssidInfos(env, -75, -55);
+    setObjectField(env, settings, "bssidInfos", "[Landroid/net/wifi/WifiScanner$BssidInfo;",
+            infos);
+    env->DeleteLocalRef(infos);
+    return settings;
+}
+
+static jobject newPnoSettings(JNIEnv *env, int numSsids) {
+    const char *networkClass = "com/android/server/wifi/WifiNative$PnoNetwork";
+    jobject settings = newObject(env, "com/android/server/wifi/WifiNative$PnoSettings");
+    setIntField(env, settings, "min5GHzRssi", -80);
+    setIntField(env, settings, "min24GHzRssi", -85);
+    jobjectArray networks = newObjectArray(env, networkClass, numSsids);
+    for (int i = 0; i < numSsids; i++) {
+        char ssid[40];
+        snprintf(ssid, sizeof(ssid), "\"" VIRTUAL_RADIO_SSID_FORMAT "\"", i);
+        jobject network = newObject(env, networkClass);
+        setStringField(env, network, "ssid", ssid);
+        env->SetObjectArrayElement(networks, i, network);
+        env->DeleteLocalRef(network);
+    }
+    setObjectField(env, settings, "networkList",
+            "[Lcom/android/server/wifi/WifiNative$PnoNetwork;", networks);
+    env->DeleteLocalRef(networks);
+    return settings;
+}
+
+static jobjectArray newRttParams(JNIEnv *env) {
+    const char *paramsClass = "android/net/wifi/RttManager$RttParams";
+    jobjectArray params = newObjectArray(env, paramsClass, kRttPeers);
+    for (int i = 0; i < kRttPeers; i++) {
+        char bssid[32];
+        formatBssid(i, bssid, sizeof(bssid));
+        jobject param = newObject(env, paramsClass);
+        setStringField(env, param, "bssid", bssid);
+        setIntField(env, param, "requestType", RTT_TYPE_2_SIDED);
+        setIntField(env, param, "numSamplesPerBurst", 8);
+        setBooleanField(env, param, "LCIRequest", JNI_TRUE);
+        setBooleanField(env, param, "LCRRequest", JNI_TRUE);
+        env->SetObjectArrayElement(params, i, param);
+        env->DeleteLocalRef(param);
+    }
+    return params;
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    virtual_radio_scenario scenario;
+    virtual_radio_default_scenario(&scenario);
+    scenario.rate_multiplier = 10;
+    if (argc > 2 && !virtual_radio_parse_scenario(argv[2], &scenario)) {
+        fprintf(stderr, "bad scenario '%s'\n", argv[2]);
+        return 1;
+    }
+
+    JNIHelper::setRefAccounting(true);
+
+    WifiHostEnv host;
+    if (!host.start()) {
+        fprintf(stderr, "could not start the host HAL\n");
+        return 1;
+    }
+    if (virtual_radio_start(&hal_fn, &scenario) != WIFI_SUCCESS) {
+        fprintf(stderr, "could not start the virtual radio\n");
+        host.stop();
+        return 1;
+    }
+
+    JNIEnv *env = host.env();
+    jclass cls = host.wifiNativeClass();
+    jint iface = host.ifaceIndex();
+    /* the per-thread JNI counters are only stable while the radio is paused */
+    virtual_radio_pause();
+    host.vm().collect();
+    FakeJniStats before = host.vm().getStats();
+    size_t heapBefore = host.vm().heapSize();
+    virtual_radio_resume();
+
+    jobject settings = newScanSettings(env);
+    host.native<StartScanFn>("startScanNative")(env, cls, iface, ID_SCAN, settings);
+    env->DeleteLocalRef(settings);
+    settings = newHotlistSettings(env);
+    host.native<SetSettingsFn>("setHotlistNative")(env, cls, iface, ID_HOTLIST, settings);
+    env->DeleteLocalRef(settings);
+    settings = newWifiChangeSettings(env);
+    host.native<SetSettingsFn>("trackSignificantWifiChangeNative")(env, cls, iface,
+            ID_SIGNIFICANT_CHANGE, settings);
+    env->DeleteLocalRef(settings);
+    settings = newPnoSettings(env, scenario.num_ssids);
+    host.native<SetSettingsFn>("setPnoListNative")(env, cls, iface, ID_PNO, settings);
+    env->DeleteLocalRef(settings);
+    host.native<StartRssiMonitoringFn>("startRssiMonitoringNative")(env, cls, iface, ID_RSSI,
+            -50, -75);
+    host.native<ResetFn>("setLoggingEventHandlerNative")(env, cls, iface, ID_LOG);
+    /* held across collect(), which only keeps globals */
+    jstring localName = env->NewStringUTF(kRingName);
+    jstring ringName = static_cast<jstring>(env->NewGlobalRef(localName));
+    env->DeleteLocalRef(localName);
+    host.native<StartLoggingFn>("startLoggingRingBufferNative")(env, cls, iface, 1, 0, 0, 0,
+            ringName);
+
+    GetLinkLayerStatsFn getLinkLayerStats =
+            host.native<GetLinkLayerStatsFn>("getWifiLinkLayerStatsNative");
+    GetScanResultsFn getScanResults = host.native<GetScanResultsFn>("getScanResultsNative");
+    SetSettingsFn requestRange = host.native<SetSettingsFn>("requestRangeNative");
+    GetRingBufferDataFn getRingBufferData =
+            host.native<GetRingBufferDataFn>("getRingBufferDataNative");
+
+    /* the framework polls link stats and cached results on its own timers */
+    size_t peakHeap = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    for (int ms = 0; std::chrono::steady_clock::now() < end; ms += kLinkStatsPollMs) {
+        env->DeleteLocalRef(getLinkLayerStats(env, cls, iface));
+        if (ms % kScanResultsPollMs == 0) {
+            env->DeleteLocalRef(getScanResults(env, cls, iface, JNI_TRUE));
+            jobjectArray params = newRttParams(env);
+            requestRange(env, cls, iface, ID_RTT, params);
+            env->DeleteLocalRef(params);
+            getRingBufferData(env, cls, iface, ringName);
+
+            virtual_radio_pause();
+            peakHeap = std::max(peakHeap, host.vm().heapSize());
+            host.vm().collect();
+            virtual_radio_resume();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kLinkStatsPollMs));
+    }
+
+    host.native<StopScanFn>("stopScanNative")(env, cls, iface, ID_SCAN);
+    host.native<ResetFn>("resetHotlistNative")(env, cls, iface, ID_HOTLIST);
+    host.native<ResetFn>("untrackSignificantWifiChangeNative")(env, cls, iface,
+            ID_SIGNIFICANT_CHANGE);
+    host.native<ResetFn>("resetPnoListNative")(env, cls, iface, ID_PNO);
+    host.native<StopRssiMonitoringFn>("stopRssiMonitoringNative")(env, cls, iface, ID_RSSI);
+    host.native<StartLoggingFn>("startLoggingRingBufferNative")(env, cls, iface, 0, 0, 0, 0,
+            ringName);
+    host.native<ResetFn>("resetLogHandlerNative")(env, cls, iface, ID_LOG);
+    env->DeleteGlobalRef(ringName);
+
+    virtual_radio_stats radio;
+    virtual_radio_get_stats(&radio);
+    virtual_radio_stop();
+
+    host.vm().collect();
+    FakeJniStats after = host.vm().getStats();
+    size_t heapAfter = host.vm().heapSize();
+    host.stop();
+
+    printf("%d s at x%.1f: %llu scans, %llu full results, %llu scan events, %llu hotlist, "
+            "%llu significant change, %llu ePNO, %llu RTT results, %llu RSSI breaches, "
+            "%llu ring buffer events (%llu bytes), %llu link stats polls\n",
+            seconds, scenario.rate_multiplier,
+            (unsigned long long) radio.scans, (unsigned long long) radio.full_scan_results,
+            (unsigned long long) radio.scan_events, (unsigned long long) radio.hotlist_events,
+            (unsigned long long) radio.significant_change_events,
+            (unsigned long long) radio.epno_events, (unsigned long long) radio.rtt_results,
+            (unsigned long long) radio.rssi_breaches,
+            (unsigned long long) radio.ring_buffer_events,
+            (unsigned long long) radio.ring_buffer_bytes,
+            (unsigned long long) radio.link_stats_requests);
+    printf("max delivery lag %lld us; %llu JNI calls, %llu upcalls, %llu objects; "
+            "peak heap %zu, heap %zu -> %zu, global refs %lld -> %lld\n",
+            (long long) radio.max_delivery_lag_us,
+            (unsigned long long) (after.calls - before.calls),
+            (unsigned long long) (after.upcalls - before.upcalls),
+            (unsigned long long) (after.objectsAllocated - before.objectsAllocated),
+            peakHeap, heapBefore, heapAfter,
+            (long long) before.liveGlobalRefs, (long long) after.liveGlobalRefs);
+
+    bool refsBalanced = WifiHostEnv::printRefStats(stdout, 10);
+
+    if (after.liveGlobalRefs != before.liveGlobalRefs || heapAfter > heapBefore) {
+        fprintf(stderr, "FAIL: the bridge leaked across the soak\n");
+        return 1;
+    }
+    if (!refsBalanced) {
+        fprintf(stderr, "FAIL: a native or callback returned with live local refs\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
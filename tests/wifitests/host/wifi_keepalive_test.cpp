@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-keepalive-test"
+
+#include "jni.h"
+#include <netinet/in.h>
+
+#include <string>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * Validation of offloaded keepalive packets in startSendingOffloadedPacketNative:
+ * only packets whose IP and UDP lengths, IPv4 header checksum and, for NAT-T,
+ * payload are consistent reach the HAL.
+ */
+
+namespace android {
+
+typedef jint (*StartOffloadFn)(JNIEnv *, jclass, jint, jint, jbyteArray, jbyteArray,
+        jbyteArray, jint);
+typedef jint (*StopAllOffloadsFn)(JNIEnv *, jclass, jint);
+typedef jstring (*GetOffloadsFn)(JNIEnv *, jclass, jint);
+
+static const int kSlot = 1;
+static const int kPeriodMs = 20000;
+static const u16 kNatTPort = 4500;
+
+static int sStarts;
+static std::vector<u8> sLastPacket;
+
+static wifi_error test_start_sending_offloaded_packet(wifi_request_id id,
+        wifi_interface_handle iface, u8 *ip_packet, u16 ip_packet_len,
+        u8 *src_mac_addr, u8 *dst_mac_addr, u32 period_msec) {
+    sStarts++;
+    sLastPacket.assign(ip_packet, ip_packet + ip_packet_len);
+    return WIFI_SUCCESS;
+}
+
+static wifi_error test_stop_sending_offloaded_packet(wifi_request_id id,
+        wifi_interface_handle iface) {
+    return WIFI_SUCCESS;
+}
+
+static void put16(std::vector<u8>& pkt, int offset, int value) {
+    pkt[offset] = (value >> 8) & 0xff;
+    pkt[offset + 1] = value & 0xff;
+}
+
+static void setIpv4Checksum(std::vector<u8>& pkt) {
+    int header_len = (pkt[0] & 0xf) * 4;
+    put16(pkt, 10, 0);
+    u32 sum = 0;
+    for (int i = 0; i < header_len; i += 2) {
+        sum += (pkt[i] << 8) | pkt[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    put16(pkt, 10, ~sum & 0xffff);
+}
+
+static void putUdp(std::vector<u8>& pkt, int offset, u16 port, const std::vector<u8>& payload) {
+    put16(pkt, offset, port);
+    put16(pkt, offset + 2, port);
+    put16(pkt, offset + 4, 8 + payload.size());
+    std::copy(payload.begin(), payload.end(), pkt.begin() + offset + 8);
+}
+
+static std::vector<u8> ipv4Udp(u16 port, const std::vector<u8>& payload) {
+    std::vector<u8> pkt(20 + 8 + payload.size());
+    pkt[0] = 0x45;
+    put16(pkt, 2, pkt.size());
+    pkt[8] = 64;
+    pkt[9] = IPPROTO_UDP;
+    const u8 addrs[] = { 192, 168, 1, 2, 203, 0, 113, 7 };
+    std::copy(addrs, addrs + sizeof(addrs), pkt.begin() + 12);
+    putUdp(pkt, 20, port, payload);
+    setIpv4Checksum(pkt);
+    return pkt;
+}
+
+static std::vector<u8> ipv6Udp(u16 port, const std::vector<u8>& payload) {
+    std::vector<u8> pkt(40 + 8 + payload.size());
+    pkt[0] = 0x60;
+    put16(pkt, 4, pkt.size() - 40);
+    pkt[6] = IPPROTO_UDP;
+    pkt[7] = 64;
+    pkt[8] = 0x20;
+    pkt[9] = 0x01;
+    pkt[24] = 0x20;
+    pkt[25] = 0x01;
+    pkt[39] = 1;
+    putUdp(pkt, 40, port, payload);
+    return pkt;
+}
+
+class WifiKeepaliveTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        hal_fn.wifi_start_sending_offloaded_packet = test_start_sending_offloaded_packet;
+        hal_fn.wifi_stop_sending_offloaded_packet = test_stop_sending_offloaded_packet;
+        sStarts = 0;
+        sLastPacket.clear();
+    }
+
+    void TearDown() override {
+        native<StopAllOffloadsFn>("stopSendingAllOffloadedPacketsNative")(env(), cls(), iface());
+        WifiHostTest::TearDown();
+    }
+
+    jint start(const std::vector<u8>& pkt, int macLength = 6, int periodMs = kPeriodMs) {
+        jbyteArray src = newByteArray(std::vector<u8>(macLength, 0x02));
+        jbyteArray dst = newByteArray(std::vector<u8>(macLength, 0x04));
+        jbyteArray bytes = newByteArray(pkt);
+        jint ret = native<StartOffloadFn>("startSendingOffloadedPacketNative")(env(), cls(),
+                iface(), kSlot, src, dst, bytes, periodMs);
+        env()->DeleteLocalRef(src);
+        env()->DeleteLocalRef(dst);
+        env()->DeleteLocalRef(bytes);
+        return ret;
+    }
+
+    std::string dump() {
+        return takeString(native<GetOffloadsFn>("getOffloadedPacketsNative")(env(), cls(),
+                iface()));
+    }
+
+    void expectRejected(const std::vector<u8>& pkt, const char *what) {
+        EXPECT_EQ(WIFI_ERROR_INVALID_ARGS, start(pkt)) << what;
+        EXPECT_EQ(0, sStarts) << what;
+        EXPECT_EQ("none", dump()) << what;
+    }
+};
+
+TEST_F(WifiKeepaliveTest, AcceptsIpv4Udp) {
+    std::vector<u8> pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    EXPECT_EQ(WIFI_SUCCESS, start(pkt));
+    EXPECT_EQ(1, sStarts);
+    EXPECT_EQ(pkt, sLastPacket);
+    EXPECT_NE(std::string::npos, dump().find("IPv4 len=32"));
+}
+
+TEST_F(WifiKeepaliveTest, AcceptsIpv6Udp) {
+    std::vector<u8> pkt = ipv6Udp(53, { 1, 2, 3, 4 });
+    EXPECT_EQ(WIFI_SUCCESS, start(pkt));
+    EXPECT_EQ(1, sStarts);
+    EXPECT_NE(std::string::npos, dump().find("IPv6 len=52"));
+}
+
+TEST_F(WifiKeepaliveTest, AcceptsNatTKeepalive) {
+    std::vector<u8> pkt = ipv4Udp(kNatTPort, { 0xff });
+    ASSERT_EQ(29U, pkt.size());
+    EXPECT_EQ(WIFI_SUCCESS, start(pkt));
+    EXPECT_EQ(1, sStarts);
+    EXPECT_NE(std::string::npos, dump().find("NAT-T len=29"));
+}
+
+TEST_F(WifiKeepaliveTest, RejectsNatTWithOtherPayload) {
+    expectRejected(ipv4Udp(kNatTPort, { 0x00 }), "payload not 0xFF");
+    expectRejected(ipv4Udp(kNatTPort, { 0xff, 0xff }), "two byte payload");
+    expectRejected(ipv4Udp(kNatTPort, {}), "no payload");
+}
+
+TEST_F(WifiKeepaliveTest, RejectsBadIpv4Checksum) {
+    std::vector<u8> pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    pkt[11] ^= 0x01;
+    expectRejected(pkt, "checksum");
+
+    /* a header field changed after the checksum was computed */
+    pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    pkt[8]--;
+    expectRejected(pkt, "TTL");
+}
+
+TEST_F(WifiKeepaliveTest, RejectsWrongLengths) {
+    std::vector<u8> pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    put16(pkt, 2, pkt.size() + 1);
+    setIpv4Checksum(pkt);
+    expectRejected(pkt, "IPv4 total length");
+
+    pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    pkt.pop_back();
+    expectRejected(pkt, "packet shorter than its IPv4 total length");
+
+    pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    put16(pkt, 24, 8 + 3);
+    expectRejected(pkt, "UDP length");
+
+    pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    pkt[0] = 0x44;
+    setIpv4Checksum(pkt);
+    expectRejected(pkt, "IPv4 header length below 20");
+
+    pkt = ipv6Udp(53, { 1, 2, 3, 4 });
+    put16(pkt, 4, pkt.size() - 40 - 1);
+    expectRejected(pkt, "IPv6 payload length");
+
+    pkt = ipv6Udp(53, { 1, 2, 3, 4 });
+    pkt.resize(39);
+    expectRejected(pkt, "truncated IPv6 header");
+}
+
+TEST_F(WifiKeepaliveTest, RejectsOtherInput) {
+    expectRejected({}, "empty");
+    expectRejected({ 0x15, 0, 0, 1 }, "not IP");
+
+    std::vector<u8> pkt = ipv4Udp(53, std::vector<u8>(300 - 28, 0));
+    EXPECT_EQ(WIFI_ERROR_INVALID_ARGS, start(pkt)) << "too long";
+
+    pkt = ipv4Udp(53, { 1, 2, 3, 4 });
+    EXPECT_EQ(WIFI_ERROR_INVALID_ARGS, start(pkt, 5)) << "short MAC";
+    EXPECT_EQ(WIFI_ERROR_INVALID_ARGS, start(pkt, 6, 0)) << "no period";
+    EXPECT_EQ(0, sStarts);
+}
+
+TEST_F(WifiKeepaliveTest, SamePacketStartsOnce) {
+    std::vector<u8> pkt = ipv4Udp(kNatTPort, { 0xff });
+    EXPECT_EQ(WIFI_SUCCESS, start(pkt));
+    EXPECT_EQ(WIFI_SUCCESS, start(pkt));
+    EXPECT_EQ(1, sStarts);
+
+    EXPECT_EQ(WIFI_SUCCESS, start(pkt, 6, kPeriodMs * 2));
+    EXPECT_EQ(2, sStarts);
+}
+
+}  // namespace android
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <net/if.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+
+#include "wifi.h"
+
+/*
+ * libhardware_legacy is not built for the host; there is no driver or
+ * wpa_supplicant to talk to, so every supplicant entry point fails.
+ */
+
+int wifi_load_driver() {
+    return -1;
+}
+
+int wifi_unload_driver() {
+    return -1;
+}
+
+int is_wifi_driver_loaded() {
+    return 0;
+}
+
+int wifi_start_supplicant(int p2pSupported) {
+    return -1;
+}
+
+int wifi_stop_supplicant(int p2pSupported) {
+    return -1;
+}
+
+int wifi_connect_to_supplicant() {
+    return -1;
+}
+
+void wifi_close_supplicant_connection() {
+}
+
+int wifi_wait_for_event(char *buf, size_t len) {
+    return -1;
+}
+
+int wifi_command(const char *command, char *reply, size_t *reply_len) {
+    return -1;
+}
+
+int wifi_set_mode(int mode) {
+    return -1;
+}
+
+/*
+ * Nor is there a wlan0 netdevice: ioctl() is wrapped (wifi_host_ldflags in Android.mk) and the
+ * interface flags set_iface_flags() reads and sets are kept here.
+ */
+
+extern "C" int __real_ioctl(int fd, unsigned long request, ...);
+
+static short sIfaceFlags;
+
+extern "C" int __wrap_ioctl(int fd, unsigned long request, ...) {
+    va_list args;
+    va_start(args, request);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+
+    switch (request) {
+        case SIOCGIFFLAGS:
+            static_cast<struct ifreq *>(arg)->ifr_flags = sIfaceFlags;
+            return 0;
+        case SIOCSIFFLAGS:
+            sIfaceFlags = static_cast<struct ifreq *>(arg)->ifr_flags;
+            return 0;
+        default:
+            return __real_ioctl(fd, request, arg);
+    }
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-link-stats-history-test"
+
+#include "jni.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The link stats history: how the samples of the link layer stats polls are
+ * aggregated into the raw, minute and hour tiers, how the tier rings wrap, and
+ * what disabling the history keeps.
+ */
+
+namespace android {
+
+typedef jobject (*GetLinkLayerStatsFn)(JNIEnv *, jclass, jint);
+typedef jboolean (*EnableLinkStatsHistoryFn)(JNIEnv *, jclass, jstring);
+typedef void (*DisableLinkStatsHistoryFn)(JNIEnv *, jclass, jstring);
+typedef jlongArray (*GetLinkStatsSeriesFn)(JNIEnv *, jclass, jint, jint, jlong, jlong);
+
+/* as WifiNative.LINK_TIER_*, LINK_METRIC_* and LINK_SERIES_* */
+static const int kTierRaw = 0;
+static const int kTierMinute = 1;
+static const int kTierHour = 2;
+static const int kMetricRssi = 0;
+static const int kMetricBeaconRx = 1;
+static const int kMetricRxMpdu = 2;
+static const int kMetricOnTime = 6;
+static const int kSeriesEntrySize = 5;
+
+static const int kRawCapacity = 512;
+static const int kHourCapacity = 30 * 24;
+static const int64_t kHourMs = 60 * 60 * 1000;
+
+/* the layout of a tier file, as the bridge writes it */
+static const u32 kTierMagic = 0x484c5357;
+static const u32 kTierVersion = 1;
+static const int kTierMetrics = 10;
+
+struct tier_header {
+    u32 magic;
+    u32 version;
+    u32 metrics;
+    u32 capacity;
+    int64_t period_ms;
+    u64 head;
+};
+
+struct tier_entry {
+    int64_t start_ms;
+    int64_t count;
+    int64_t rollup[kTierMetrics][3];
+};
+
+static union {
+    wifi_iface_stat stat;
+    u8 storage[sizeof(wifi_iface_stat) + sizeof(wifi_peer_info)];
+} sIface;
+static wifi_radio_stat sRadio;
+
+static wifi_error test_get_link_stats(wifi_request_id id, wifi_interface_handle iface,
+        wifi_stats_result_handler handler) {
+    handler.on_link_stats_results(id, &sIface.stat, 1, &sRadio);
+    return WIFI_SUCCESS;
+}
+
+static int64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct series_entry {
+    int64_t startMs;
+    int64_t count;
+    int64_t min;
+    int64_t max;
+    int64_t mean;
+};
+
+class WifiLinkStatsHistoryTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        hal_fn.wifi_get_link_stats = test_get_link_stats;
+        memset(&sIface, 0, sizeof(sIface));
+        memset(&sRadio, 0, sizeof(sRadio));
+        strcpy(mDir, "/tmp/wifi-link-stats-history-test-XXXXXX");
+        ASSERT_TRUE(mkdtemp(mDir) != NULL);
+    }
+
+    void TearDown() override {
+        std::string rm = std::string("rm -rf ") + mDir;
+        EXPECT_EQ(0, system(rm.c_str()));
+        WifiHostTest::TearDown();
+    }
+
+    bool enable() {
+        jstring dir = newString(mDir);
+        bool enabled = native<EnableLinkStatsHistoryFn>("enableLinkStatsHistoryNative")(env(),
+                cls(), dir);
+        env()->DeleteLocalRef(dir);
+        return enabled;
+    }
+
+    /* disables the history, deleting its files if deleteFiles */
+    void disable(bool deleteFiles) {
+        jstring dir = deleteFiles ? newString(mDir) : NULL;
+        native<DisableLinkStatsHistoryFn>("disableLinkStatsHistoryNative")(env(), cls(), dir);
+        if (dir != NULL) {
+            env()->DeleteLocalRef(dir);
+        }
+    }
+
+    bool tierFileExists(const char *tier) {
+        std::string path = std::string(mDir) + "/link_stats." + tier;
+        return access(path.c_str(), F_OK) == 0;
+    }
+
+    /* polls the stats, with the beacon counter advanced by beacons */
+    void sample(int rssi, u32 beacons) {
+        sIface.stat.rssi_mgmt = rssi;
+        sIface.stat.beacon_rx += beacons;
+        jobject stats = native<GetLinkLayerStatsFn>("getWifiLinkLayerStatsNative")(env(), cls(),
+                iface());
+        env()->DeleteLocalRef(stats);
+    }
+
+    std::vector<series_entry> series(int tier, int metric) {
+        jlongArray array = native<GetLinkStatsSeriesFn>("getLinkStatsSeriesNative")(env(),
+                cls(), tier, metric, 0, std::numeric_limits<jlong>::max());
+        std::vector<series_entry> entries;
+        if (array == NULL) {
+            return entries;
+        }
+        std::vector<jlong> values(env()->GetArrayLength(array));
+        env()->GetLongArrayRegion(array, 0, values.size(), values.data());
+        env()->DeleteLocalRef(array);
+        EXPECT_EQ(0U, values.size() % kSeriesEntrySize);
+        for (size_t i = 0; i + kSeriesEntrySize <= values.size(); i += kSeriesEntrySize) {
+            entries.push_back({ values[i], values[i + 1], values[i + 2], values[i + 3],
+                    values[i + 4] });
+        }
+        return entries;
+    }
+
+    char mDir[64];
+};
+
+TEST_F(WifiLinkStatsHistoryTest, RollupsAggregate) {
+    const int rssis[] = { -50, -70, -60, -40, -80 };
+    const u32 beacons[] = { 10, 30, 20, 5, 35 };
+    const int samples = sizeof(rssis) / sizeof(rssis[0]);
+
+    /* the rollups are asserted on one period: start over if a minute starts in between */
+    int64_t startMs = 0;
+    int64_t endMs = 0;
+    for (int attempt = 0; attempt < 3; attempt++) {
+        ASSERT_TRUE(enable());
+        startMs = nowMs();
+        /* the first sample only sets the counters the next ones are deltas of */
+        sample(-20, 1000);
+        for (int i = 0; i < samples; i++) {
+            sample(rssis[i], beacons[i]);
+        }
+        endMs = nowMs();
+        if (startMs / 60000 == endMs / 60000) {
+            break;
+        }
+        std::string rm = std::string("rm -f ") + mDir + "/link_stats.*";
+        ASSERT_EQ(0, system(rm.c_str()));
+    }
+    ASSERT_EQ(startMs / 60000, endMs / 60000);
+
+    std::vector<series_entry> raw = series(kTierRaw, kMetricRssi);
+    ASSERT_EQ((size_t) samples, raw.size());
+    for (int i = 0; i < samples; i++) {
+        EXPECT_EQ(1, raw[i].count);
+        EXPECT_EQ(rssis[i], raw[i].min);
+        EXPECT_EQ(rssis[i], raw[i].max);
+        EXPECT_EQ(rssis[i], raw[i].mean);
+        EXPECT_GE(raw[i].startMs, startMs);
+        EXPECT_LE(raw[i].startMs, endMs);
+    }
+    std::vector<series_entry> rawBeacons = series(kTierRaw, kMetricBeaconRx);
+    ASSERT_EQ((size_t) samples, rawBeacons.size());
+    EXPECT_EQ(10, rawBeacons[0].mean);
+    EXPECT_EQ(35, rawBeacons[4].mean);
+
+    std::vector<series_entry> minute = series(kTierMinute, kMetricRssi);
+    ASSERT_EQ(1U, minute.size());
+    EXPECT_EQ(startMs - startMs % 60000, minute[0].startMs);
+    EXPECT_EQ(samples, minute[0].count);
+    EXPECT_EQ(-80, minute[0].min);
+    EXPECT_EQ(-40, minute[0].max);
+    EXPECT_EQ(-60, minute[0].mean);
+    std::vector<series_entry> minuteBeacons = series(kTierMinute, kMetricBeaconRx);
+    ASSERT_EQ(1U, minuteBeacons.size());
+    EXPECT_EQ(5, minuteBeacons[0].min);
+    EXPECT_EQ(35, minuteBeacons[0].max);
+    EXPECT_EQ(20, minuteBeacons[0].mean);
+
+    std::vector<series_entry> hour = series(kTierHour, kMetricRssi);
+    ASSERT_EQ(1U, hour.size());
+    EXPECT_EQ(startMs - startMs % kHourMs, hour[0].startMs);
+    EXPECT_EQ(samples, hour[0].count);
+    EXPECT_EQ(-80, hour[0].min);
+    EXPECT_EQ(-40, hour[0].max);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, CounterResetSkipsSample) {
+    ASSERT_TRUE(enable());
+    sample(-50, 100);
+    sample(-55, 10);
+    /* the only counter that moved went back: the firmware restarted its counters */
+    sIface.stat.beacon_rx = 0;
+    sample(-60, 3);
+    sample(-65, 7);
+
+    std::vector<series_entry> raw = series(kTierRaw, kMetricBeaconRx);
+    ASSERT_EQ(2U, raw.size());
+    EXPECT_EQ(10, raw[0].mean);
+    EXPECT_EQ(7, raw[1].mean);
+    EXPECT_EQ(-65, series(kTierRaw, kMetricRssi)[1].mean);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, OnTimeBackSkipsSample) {
+    ASSERT_TRUE(enable());
+    sRadio.on_time = 5000;
+    sample(-50, 100);
+    sRadio.on_time += 1000;
+    sample(-55, 10);
+    /* the beacons went on, but the radio on time restarted */
+    sRadio.on_time = 200;
+    sample(-60, 3);
+    sRadio.on_time += 1000;
+    sample(-65, 7);
+
+    std::vector<series_entry> raw = series(kTierRaw, kMetricOnTime);
+    ASSERT_EQ(2U, raw.size());
+    EXPECT_EQ(1000, raw[0].mean);
+    EXPECT_EQ(1000, raw[1].mean);
+    EXPECT_EQ(7, series(kTierRaw, kMetricBeaconRx)[1].mean);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, CounterWrapKeepsSample) {
+    ASSERT_TRUE(enable());
+    sRadio.on_time = 5000;
+    sIface.stat.beacon_rx = 0xfffffff0;
+    sample(-50, 0);
+    sRadio.on_time += 1000;
+    sample(-55, 0x20);
+
+    std::vector<series_entry> raw = series(kTierRaw, kMetricBeaconRx);
+    ASSERT_EQ(1U, raw.size());
+    EXPECT_EQ(0x20, raw[0].mean);
+    EXPECT_EQ(0x10U, sIface.stat.beacon_rx);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, AcSumBeyond32Bits) {
+    ASSERT_TRUE(enable());
+    for (int ac = 0; ac < WIFI_AC_MAX; ac++) {
+        sIface.stat.ac[ac].rx_mpdu = 0x10000000;
+    }
+    sample(-50, 1);
+    for (int ac = 0; ac < WIFI_AC_MAX; ac++) {
+        sIface.stat.ac[ac].rx_mpdu += 0xc0000000;
+    }
+    sample(-55, 1);
+
+    /* the increase of all four together does not fit a u32 */
+    std::vector<series_entry> raw = series(kTierRaw, kMetricRxMpdu);
+    ASSERT_EQ(1U, raw.size());
+    EXPECT_EQ(WIFI_AC_MAX * 0xc0000000LL, raw[0].mean);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, RawTierWraps) {
+    const int samples = kRawCapacity + 88;
+    ASSERT_TRUE(enable());
+    sample(-20, 0);
+    for (int i = 0; i < samples; i++) {
+        sample(-(i % 100), i);
+    }
+
+    /* the oldest samples are overwritten, and the rest come back oldest first */
+    std::vector<series_entry> raw = series(kTierRaw, kMetricBeaconRx);
+    ASSERT_EQ((size_t) kRawCapacity, raw.size());
+    for (int i = 0; i < kRawCapacity; i++) {
+        EXPECT_EQ(samples - kRawCapacity + i, raw[i].mean);
+    }
+    EXPECT_EQ(-((samples - kRawCapacity) % 100), series(kTierRaw, kMetricRssi)[0].mean);
+
+    /* while every sample is still in the minute rollups */
+    int64_t count = 0;
+    for (const series_entry& entry : series(kTierMinute, kMetricBeaconRx)) {
+        count += entry.count;
+    }
+    EXPECT_EQ(samples, count);
+
+    /* the ring is kept across enables */
+    ASSERT_TRUE(enable());
+    sample(-20, 0);
+    sample(-30, 1234);
+    raw = series(kTierRaw, kMetricBeaconRx);
+    ASSERT_EQ((size_t) kRawCapacity, raw.size());
+    EXPECT_EQ(samples - kRawCapacity + 1, raw[0].mean);
+    EXPECT_EQ(1234, raw.back().mean);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, HourTierWraps) {
+    /* an hour tier that has wrapped twice already, its last period an hour ago */
+    const u64 head = 2 * kHourCapacity + 3;
+    int64_t hourMs = nowMs() / kHourMs * kHourMs;
+    std::string path = std::string(mDir) + "/link_stats.hour";
+    FILE *file = fopen(path.c_str(), "w");
+    ASSERT_TRUE(file != NULL);
+    tier_header header = { kTierMagic, kTierVersion, kTierMetrics, kHourCapacity, kHourMs, head };
+    fwrite(&header, sizeof(header), 1, file);
+    std::vector<tier_entry> entries(kHourCapacity);
+    for (u64 seq = head - kHourCapacity; seq < head; seq++) {
+        tier_entry *entry = &entries[seq % kHourCapacity];
+        memset(entry, 0, sizeof(*entry));
+        entry->start_ms = hourMs - (int64_t) (head - seq) * kHourMs;
+        entry->count = 1;
+        entry->rollup[kMetricRssi][0] = entry->rollup[kMetricRssi][1] =
+                entry->rollup[kMetricRssi][2] = -(int64_t) (seq % 90);
+    }
+    ASSERT_EQ((size_t) kHourCapacity,
+            fwrite(entries.data(), sizeof(tier_entry), kHourCapacity, file));
+    ASSERT_EQ(0, fclose(file));
+
+    ASSERT_TRUE(enable());
+    sample(-20, 0);
+    sample(-45, 1);
+    sample(-55, 1);
+
+    /* the new period overwrites the oldest, and the series starts at the next oldest */
+    std::vector<series_entry> hour = series(kTierHour, kMetricRssi);
+    ASSERT_EQ((size_t) kHourCapacity, hour.size());
+    EXPECT_EQ(hourMs - (int64_t) (kHourCapacity - 1) * kHourMs, hour[0].startMs);
+    EXPECT_EQ(-(int64_t) ((head - kHourCapacity + 1) % 90), hour[0].mean);
+    for (int i = 1; i < kHourCapacity; i++) {
+        EXPECT_LT(hour[i - 1].startMs, hour[i].startMs);
+    }
+    const series_entry& last = hour.back();
+    EXPECT_GE(last.startMs, hourMs);
+    EXPECT_EQ(2, last.count);
+    EXPECT_EQ(-55, last.min);
+    EXPECT_EQ(-45, last.max);
+    EXPECT_EQ(-50, last.mean);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, DisableKeepsFiles) {
+    ASSERT_TRUE(enable());
+    sample(-20, 0);
+    sample(-40, 5);
+    ASSERT_EQ(1U, series(kTierRaw, kMetricRssi).size());
+
+    /* as when the HAL stops: nothing is recorded or returned, but the files stay */
+    disable(false);
+    sample(-50, 5);
+    jlongArray none = native<GetLinkStatsSeriesFn>("getLinkStatsSeriesNative")(env(), cls(),
+            kTierRaw, kMetricRssi, 0, std::numeric_limits<jlong>::max());
+    EXPECT_TRUE(none == NULL);
+    EXPECT_TRUE(tierFileExists("raw"));
+    EXPECT_TRUE(tierFileExists("hour"));
+
+    ASSERT_TRUE(enable());
+    std::vector<series_entry> raw = series(kTierRaw, kMetricRssi);
+    ASSERT_EQ(1U, raw.size());
+    EXPECT_EQ(-40, raw[0].mean);
+}
+
+TEST_F(WifiLinkStatsHistoryTest, DisableDeletesFiles) {
+    ASSERT_TRUE(enable());
+    sample(-20, 0);
+    sample(-40, 5);
+
+    /* as when the property is not set */
+    disable(true);
+    EXPECT_FALSE(tierFileExists("raw"));
+    EXPECT_FALSE(tierFileExists("minute"));
+    EXPECT_FALSE(tierFileExists("hour"));
+
+    ASSERT_TRUE(enable());
+    EXPECT_EQ(0U, series(kTierRaw, kMetricRssi).size());
+}
+
+}  // namespace android
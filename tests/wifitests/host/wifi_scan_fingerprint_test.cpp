@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-scan-fingerprint-test"
+
+#include "jni.h"
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The scan fingerprints: the MinHash similarity getScanSimilarityNative()
+ * reports between drained scans with identical, disjoint and overlapping sets
+ * of BSSIDs, and the fingerprints being dropped when the HAL is cleaned up.
+ */
+
+namespace android {
+
+typedef jobject (*GetScanResultsFn)(JNIEnv *, jclass, jint, jboolean);
+typedef jintArray (*GetScanSimilarityFn)(JNIEnv *, jclass, jint);
+
+static const int kRssi = -50;
+
+static std::vector<wifi_cached_scan_results> sBatches;
+
+static wifi_error test_get_cached_gscan_results(wifi_interface_handle iface, byte flush,
+        int max, wifi_cached_scan_results *results, int *num) {
+    int n = std::min(max, (int) sBatches.size());
+    memcpy(results, sBatches.data(), n * sizeof(wifi_cached_scan_results));
+    *num = n;
+    if (flush) {
+        sBatches.clear();
+    }
+    return WIFI_SUCCESS;
+}
+
+class WifiScanFingerprintTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        resetBridgeState();
+        sBatches.clear();
+        mScanId = 0;
+    }
+
+    void installHal() override {
+        hal_fn.wifi_get_cached_gscan_results = test_get_cached_gscan_results;
+    }
+
+    /* queues a scan of the BSSIDs ending in first..last, for the next drain */
+    void addScan(u8 first, u8 last, int rssi = kRssi) {
+        sBatches.emplace_back();
+        wifi_cached_scan_results *batch = &sBatches.back();
+        memset(batch, 0, sizeof(*batch));
+        batch->scan_id = ++mScanId;
+        for (int i = first; i <= last; i++) {
+            wifi_scan_result *result = &batch->results[batch->num_results++];
+            u8 bssid[6] = { 0x02, 0x1a, 0x11, 0x00, 0x00, (u8) i };
+            memcpy(result->bssid, bssid, sizeof(bssid));
+            result->rssi = rssi;
+            result->channel = 2412;
+        }
+    }
+
+    void drain(bool flush = true) {
+        jobject scanData = native<GetScanResultsFn>("getScanResultsNative")(env(), cls(),
+                iface(), flush);
+        env()->DeleteLocalRef(scanData);
+    }
+
+    /* the similarity of the latest scan to the n before it, or -1 if there is no scan yet */
+    std::vector<jint> similarity(int n) {
+        jintArray array = native<GetScanSimilarityFn>("getScanSimilarityNative")(env(), cls(),
+                n);
+        if (array == NULL) {
+            return std::vector<jint>(1, -1);
+        }
+        std::vector<jint> values(env()->GetArrayLength(array));
+        env()->GetIntArrayRegion(array, 0, values.size(), values.data());
+        env()->DeleteLocalRef(array);
+        return values;
+    }
+
+    int mScanId;
+};
+
+TEST_F(WifiScanFingerprintTest, NoScanYet) {
+    EXPECT_EQ(std::vector<jint>(1, -1), similarity(4));
+
+    addScan(1, 20);
+    drain();
+    EXPECT_TRUE(similarity(4).empty());
+}
+
+TEST_F(WifiScanFingerprintTest, IdenticalScans) {
+    addScan(1, 20);
+    addScan(1, 20);
+    drain();
+    EXPECT_EQ(std::vector<jint>({ 1000 }), similarity(4));
+
+    /* the order the APs were seen in does not matter */
+    addScan(1, 10);
+    std::reverse(sBatches.back().results, sBatches.back().results + 10);
+    addScan(1, 10);
+    drain();
+    EXPECT_EQ(1000, similarity(1)[0]);
+}
+
+TEST_F(WifiScanFingerprintTest, DisjointScans) {
+    addScan(1, 20);
+    addScan(101, 120);
+    drain();
+    EXPECT_EQ(std::vector<jint>({ 0 }), similarity(4));
+}
+
+TEST_F(WifiScanFingerprintTest, OverlappingScans) {
+    /* half the APs in common: a third of the tokens of the two scans */
+    addScan(1, 20);
+    addScan(11, 30);
+    drain();
+    std::vector<jint> values = similarity(4);
+    ASSERT_EQ(1U, values.size());
+    EXPECT_GT(values[0], 200);
+    EXPECT_LT(values[0], 500);
+
+    /* the same APs, with their signal moved by more than a bin: their RSSI tokens differ */
+    addScan(11, 30, kRssi - 30);
+    drain();
+    values = similarity(4);
+    ASSERT_EQ(2U, values.size());
+    EXPECT_GT(values[0], 200);
+    EXPECT_LT(values[0], 500);
+    EXPECT_LT(values[1], values[0]);
+}
+
+TEST_F(WifiScanFingerprintTest, ComparedWithEachPrevious) {
+    addScan(101, 120);
+    addScan(11, 30);
+    addScan(1, 20);
+    addScan(1, 20);
+    drain();
+
+    /* the most recent first, and no more than there are */
+    std::vector<jint> values = similarity(8);
+    ASSERT_EQ(3U, values.size());
+    EXPECT_EQ(1000, values[0]);
+    EXPECT_GT(values[1], 200);
+    EXPECT_LT(values[1], 500);
+    EXPECT_EQ(0, values[2]);
+    EXPECT_EQ(2U, similarity(2).size());
+}
+
+TEST_F(WifiScanFingerprintTest, RedrainedBatchCountedOnce) {
+    addScan(1, 20);
+    drain(false);
+    addScan(101, 120);
+    /* the first batch is returned again, with the new one */
+    drain(false);
+    drain(true);
+
+    EXPECT_EQ(std::vector<jint>({ 0 }), similarity(4));
+}
+
+TEST_F(WifiScanFingerprintTest, CleanupResets) {
+    addScan(1, 20);
+    addScan(1, 20);
+    drain();
+    ASSERT_EQ(1U, similarity(4).size());
+
+    restartHal();
+    EXPECT_EQ(std::vector<jint>(1, -1), similarity(4));
+
+    /* the restarted HAL numbers its scans from the start again */
+    mScanId = 0;
+    addScan(1, 20);
+    drain();
+    EXPECT_TRUE(similarity(4).empty());
+    addScan(101, 120);
+    drain();
+    EXPECT_EQ(std::vector<jint>({ 0 }), similarity(4));
+}
+
+}  // namespace android
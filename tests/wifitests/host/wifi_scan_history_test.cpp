@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-scan-history-test"
+
+#include "jni.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The scan history's segment encoding: what getScanResultsNative() appends must
+ * come back unchanged from queryScanHistoryNative(), through the RSSI deltas,
+ * frequency changes and ages of the varint/zigzag records, including after the
+ * segments are mapped again.
+ */
+
+namespace android {
+
+typedef jobject (*GetScanResultsFn)(JNIEnv *, jclass, jint, jboolean);
+typedef jboolean (*EnableScanHistoryFn)(JNIEnv *, jclass, jstring, jint, jint);
+typedef void (*DisableScanHistoryFn)(JNIEnv *, jclass, jstring);
+typedef jobjectArray (*QueryScanHistoryFn)(JNIEnv *, jclass, jlong, jlong, jstring, jint);
+
+static const int kSegmentBytes = 16 * 1024;
+static const int kMaxSegments = 4;
+/* between the batch times taken by the test and by the bridge */
+static const int64_t kSlackMs = 2000;
+
+static std::vector<wifi_cached_scan_results> sBatches;
+static int sFlushes;
+
+static wifi_error test_get_cached_gscan_results(wifi_interface_handle iface, byte flush,
+        int max, wifi_cached_scan_results *results, int *num) {
+    int n = std::min(max, (int) sBatches.size());
+    memcpy(results, sBatches.data(), n * sizeof(wifi_cached_scan_results));
+    *num = n;
+    if (flush) {
+        sFlushes++;
+        sBatches.clear();
+    }
+    return WIFI_SUCCESS;
+}
+
+static int64_t nowMs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct sighting {
+    int64_t timeMs;
+    std::string bssid;
+    std::string ssid;
+    int rssi;
+    int frequency;
+};
+
+class WifiScanHistoryTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        hal_fn.wifi_get_cached_gscan_results = test_get_cached_gscan_results;
+        sBatches.clear();
+        sFlushes = 0;
+        strcpy(mDir, "/tmp/wifi-scan-history-test-XXXXXX");
+        ASSERT_TRUE(mkdtemp(mDir) != NULL);
+        ASSERT_TRUE(enable(mDir));
+    }
+
+    void TearDown() override {
+        jstring dir = newString(mDir);
+        native<DisableScanHistoryFn>("disableScanHistoryNative")(env(), cls(), dir);
+        env()->DeleteLocalRef(dir);
+        EXPECT_EQ(0, rmdir(mDir)) << "segments left in " << mDir;
+        WifiHostTest::TearDown();
+    }
+
+    bool enable(const char *path) {
+        jstring dir = newString(path);
+        bool enabled = native<EnableScanHistoryFn>("enableScanHistoryNative")(env(), cls(),
+                dir, kSegmentBytes, kMaxSegments);
+        env()->DeleteLocalRef(dir);
+        return enabled;
+    }
+
+    /* adds a result aged ageMs at the time of the drain to the next batch */
+    void addResult(const char *ssid, u8 last, int rssi, int frequency, int64_t ageMs) {
+        if (sBatches.empty() || mNewBatch) {
+            sBatches.emplace_back();
+            memset(&sBatches.back(), 0, sizeof(wifi_cached_scan_results));
+            sBatches.back().scan_id = ++mScanId;
+            mNewBatch = false;
+        }
+        wifi_cached_scan_results *batch = &sBatches.back();
+        wifi_scan_result *result = &batch->results[batch->num_results++];
+        memcpy(result->ssid, ssid, std::min(strlen(ssid), sizeof(result->ssid) - 1));
+        u8 bssid[6] = { 0x02, 0x1a, 0x11, 0x00, 0x00, last };
+        memcpy(result->bssid, bssid, sizeof(bssid));
+        result->rssi = rssi;
+        result->channel = frequency;
+        result->ts = (nowMs(CLOCK_BOOTTIME) - ageMs) * 1000;
+    }
+
+    void endBatch() {
+        mNewBatch = true;
+    }
+
+    void drain(bool flush) {
+        jobject scanData = native<GetScanResultsFn>("getScanResultsNative")(env(), cls(),
+                iface(), flush);
+        env()->DeleteLocalRef(scanData);
+    }
+
+    std::vector<sighting> query(const char *bssid, int max) {
+        jstring jbssid = bssid != NULL ? newString(bssid) : NULL;
+        jobjectArray array = native<QueryScanHistoryFn>("queryScanHistoryNative")(env(), cls(),
+                0, std::numeric_limits<jlong>::max(), jbssid, max);
+        if (jbssid != NULL) {
+            env()->DeleteLocalRef(jbssid);
+        }
+        std::vector<sighting> found;
+        for (int i = 0; array != NULL && i < env()->GetArrayLength(array); i++) {
+            jobject obj = env()->GetObjectArrayElement(array, i);
+            jclass objCls = env()->GetObjectClass(obj);
+            sighting s;
+            s.timeMs = env()->GetLongField(obj, env()->GetFieldID(objCls, "timeMillis", "J"));
+            s.bssid = takeString((jstring) env()->GetObjectField(obj,
+                    env()->GetFieldID(objCls, "bssid", "Ljava/lang/String;")));
+            jbyteArray ssid = (jbyteArray) env()->GetObjectField(obj,
+                    env()->GetFieldID(objCls, "rawSsid", "[B"));
+            s.ssid.resize(env()->GetArrayLength(ssid));
+            env()->GetByteArrayRegion(ssid, 0, s.ssid.size(), (jbyte *) &s.ssid[0]);
+            s.rssi = env()->GetIntField(obj, env()->GetFieldID(objCls, "rssi", "I"));
+            s.frequency = env()->GetIntField(obj, env()->GetFieldID(objCls, "frequency", "I"));
+            env()->DeleteLocalRef(ssid);
+            env()->DeleteLocalRef(objCls);
+            env()->DeleteLocalRef(obj);
+            found.push_back(s);
+        }
+        if (array != NULL) {
+            env()->DeleteLocalRef(array);
+        }
+        return found;
+    }
+
+    char mDir[64];
+    int mScanId = 0;
+    bool mNewBatch = false;
+};
+
+TEST_F(WifiScanHistoryTest, RoundTrip) {
+    const char *longSsid = "0123456789abcdef0123456789abcdef";
+    addResult("alpha", 1, -40, 2412, 100);
+    addResult(longSsid, 2, -127, 5180, 200);
+    addResult("", 3, 0, 5745, 300);
+    endBatch();
+    /* RSSI deltas of both signs, a changed frequency, a repeated one */
+    addResult("alpha", 1, -90, 2437, 50);
+    addResult(longSsid, 2, -30, 5180, 60);
+    endBatch();
+    int64_t drainMs = nowMs(CLOCK_REALTIME);
+    drain(true);
+
+    std::vector<sighting> found = query(NULL, 100);
+    ASSERT_EQ(5U, found.size());
+    /* oldest first */
+    EXPECT_EQ("02:1a:11:00:00:03", found[0].bssid);
+    EXPECT_EQ("", found[0].ssid);
+    EXPECT_EQ(0, found[0].rssi);
+    EXPECT_EQ(5745, found[0].frequency);
+    EXPECT_EQ("02:1a:11:00:00:02", found[1].bssid);
+    EXPECT_EQ(longSsid, found[1].ssid);
+    EXPECT_EQ(-127, found[1].rssi);
+    EXPECT_EQ("02:1a:11:00:00:01", found[2].bssid);
+    EXPECT_EQ("alpha", found[2].ssid);
+    EXPECT_EQ(-40, found[2].rssi);
+    EXPECT_EQ(2412, found[2].frequency);
+    EXPECT_EQ("02:1a:11:00:00:02", found[3].bssid);
+    EXPECT_EQ(-30, found[3].rssi);
+    EXPECT_EQ(5180, found[3].frequency);
+    EXPECT_EQ("02:1a:11:00:00:01", found[4].bssid);
+    EXPECT_EQ(-90, found[4].rssi);
+    EXPECT_EQ(2437, found[4].frequency);
+
+    EXPECT_NEAR(drainMs - 300, found[0].timeMs, kSlackMs);
+    EXPECT_NEAR(drainMs - 50, found[4].timeMs, kSlackMs);
+    EXPECT_LT(found[3].timeMs, found[4].timeMs);
+}
+
+TEST_F(WifiScanHistoryTest, Ages) {
+    /* a multi-byte age, and a result stamped after the drain, which counts as age 0 */
+    int64_t ageMs = nowMs(CLOCK_BOOTTIME) - 1;
+    addResult("old", 1, -50, 2412, ageMs);
+    addResult("future", 2, -50, 2412, -60 * 1000);
+    endBatch();
+    int64_t drainMs = nowMs(CLOCK_REALTIME);
+    drain(true);
+
+    std::vector<sighting> found = query(NULL, 100);
+    ASSERT_EQ(2U, found.size());
+    EXPECT_EQ("old", found[0].ssid);
+    EXPECT_NEAR(drainMs - ageMs, found[0].timeMs, kSlackMs);
+    EXPECT_EQ("future", found[1].ssid);
+    EXPECT_NEAR(drainMs, found[1].timeMs, kSlackMs);
+}
+
+TEST_F(WifiScanHistoryTest, OnlyFlushedBatchesAppended) {
+    addResult("alpha", 1, -40, 2412, 100);
+    endBatch();
+    drain(false);
+    drain(false);
+    EXPECT_EQ(0U, query(NULL, 100).size());
+
+    drain(true);
+    EXPECT_EQ(1, sFlushes);
+    EXPECT_EQ(1U, query(NULL, 100).size());
+    drain(true);
+    EXPECT_EQ(1U, query(NULL, 100).size());
+}
+
+TEST_F(WifiScanHistoryTest, FilterAndMax) {
+    for (int i = 0; i < 4; i++) {
+        addResult("alpha", 1, -40 - i, 2412, 0);
+        addResult("beta", 2, -60 - i, 5180, 0);
+        endBatch();
+    }
+    drain(true);
+
+    std::vector<sighting> found = query("02:1a:11:00:00:02", 2);
+    ASSERT_EQ(2U, found.size());
+    EXPECT_EQ("beta", found[0].ssid);
+    EXPECT_EQ(-62, found[0].rssi);
+    EXPECT_EQ(-63, found[1].rssi);
+    EXPECT_EQ(8U, query(NULL, 100).size());
+}
+
+TEST_F(WifiScanHistoryTest, ReloadedSegmentsDecodeAndAppend) {
+    addResult("alpha", 1, -40, 2412, 0);
+    addResult("beta", 2, -60, 5180, 0);
+    endBatch();
+    drain(true);
+
+    /* enabling another directory unmaps the segments; enabling this one maps them again */
+    char other[] = "/tmp/wifi-scan-history-test-XXXXXX";
+    ASSERT_TRUE(mkdtemp(other) != NULL);
+    ASSERT_TRUE(enable(other));
+    EXPECT_EQ(0U, query(NULL, 100).size());
+    jstring dir = newString(other);
+    native<DisableScanHistoryFn>("disableScanHistoryNative")(env(), cls(), dir);
+    env()->DeleteLocalRef(dir);
+    EXPECT_EQ(0, rmdir(other));
+    ASSERT_TRUE(enable(mDir));
+
+    /* the reloaded dictionary is appended to: by id, with deltas from the reloaded RSSIs */
+    addResult("alpha", 1, -45, 2412, 0);
+    endBatch();
+    drain(true);
+
+    std::vector<sighting> found = query("02:1a:11:00:00:01", 100);
+    ASSERT_EQ(2U, found.size());
+    EXPECT_EQ(-40, found[0].rssi);
+    EXPECT_EQ(-45, found[1].rssi);
+    EXPECT_EQ("alpha", found[1].ssid);
+    EXPECT_EQ(2412, found[1].frequency);
+    EXPECT_EQ(3U, query(NULL, 100).size());
+}
+
+TEST_F(WifiScanHistoryTest, NewSegmentsDropOldest) {
+    /* a full batch of known BSSIDs takes about 150 bytes: some 100 fit in a 16KB segment */
+    const int batches = 100 * (kMaxSegments + 2);
+    for (int batch = 0; batch < batches; batch++) {
+        for (int i = 0; i < MAX_AP_CACHE_PER_SCAN; i++) {
+            addResult("gamma", i, -50 - batch % 20, 2412 + 5 * (i % 13), 0);
+        }
+        endBatch();
+        drain(true);
+    }
+    std::vector<sighting> found = query(NULL, std::numeric_limits<jint>::max());
+    EXPECT_GT(found.size(), 0U);
+    EXPECT_LT(found.size(), (size_t) batches * MAX_AP_CACHE_PER_SCAN);
+    EXPECT_EQ(0U, found.size() % MAX_AP_CACHE_PER_SCAN);
+    EXPECT_EQ(-50 - (batches - 1) % 20, found.back().rssi);
+
+    int segments = 0;
+    DIR *d = opendir(mDir);
+    ASSERT_TRUE(d != NULL);
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        segments += strncmp(entry->d_name, "scan_history.", 13) == 0;
+    }
+    closedir(d);
+    EXPECT_EQ(kMaxSegments, segments);
+}
+
+}  // namespace android
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-scan-period-control-test"
+
+#include "jni.h"
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The scan period controller: the periods it stretches the gscan to while the
+ * drained scans stay the same, and back, and that the gscan is only restarted
+ * when the framework applies the decisions.
+ */
+
+namespace android {
+
+typedef jboolean (*StartScanFn)(JNIEnv *, jclass, jint, jint, jobject);
+typedef jboolean (*StopScanFn)(JNIEnv *, jclass, jint, jint);
+typedef jobject (*GetScanResultsFn)(JNIEnv *, jclass, jint, jboolean);
+typedef jboolean (*SetScanPeriodControlFn)(JNIEnv *, jclass, jint, jint);
+typedef void (*SetScanMotionHintFn)(JNIEnv *, jclass, jboolean);
+typedef void (*ApplyScanPeriodFn)(JNIEnv *, jclass);
+typedef jstring (*GetScanPeriodControlLogFn)(JNIEnv *, jclass);
+
+static const int kScanId = 9;
+static const int kPeriodMs = 10000;
+/* two stretches: 20s, then 40s */
+static const int kMaxPeriodMs = 40000;
+/* as SCAN_CONTROL_STABLE_SCANS */
+static const int kStableScans = 3;
+
+static std::vector<int> sStartedPeriods;
+static int sStops;
+static wifi_error sStartResult;
+static std::vector<wifi_cached_scan_results> sBatches;
+
+static wifi_error test_start_gscan(wifi_request_id id, wifi_interface_handle iface,
+        wifi_scan_cmd_params params, wifi_scan_result_handler handler) {
+    sStartedPeriods.push_back(params.num_buckets > 0 ? params.buckets[0].period : 0);
+    return sStartedPeriods.back() == kPeriodMs ? WIFI_SUCCESS : sStartResult;
+}
+
+static wifi_error test_stop_gscan(wifi_request_id id, wifi_interface_handle iface) {
+    sStops++;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error test_get_cached_gscan_results(wifi_interface_handle iface, byte flush,
+        int max, wifi_cached_scan_results *results, int *num) {
+    int n = std::min(max, (int) sBatches.size());
+    memcpy(results, sBatches.data(), n * sizeof(wifi_cached_scan_results));
+    *num = n;
+    if (flush) {
+        sBatches.clear();
+    }
+    return WIFI_SUCCESS;
+}
+
+class WifiScanPeriodControlTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        resetBridgeState();
+        sStartedPeriods.clear();
+        sStops = 0;
+        sStartResult = WIFI_SUCCESS;
+        sBatches.clear();
+        mScanId = 0;
+
+        /* no hold, so that a stretch follows the stable scans */
+        ASSERT_TRUE(native<SetScanPeriodControlFn>("setScanPeriodControlNative")(env(), cls(),
+                kMaxPeriodMs, 0));
+        ASSERT_TRUE(startScan());
+        ASSERT_EQ(std::vector<int>({ kPeriodMs }), sStartedPeriods);
+    }
+
+    void TearDown() override {
+        native<StopScanFn>("stopScanNative")(env(), cls(), iface(), kScanId);
+        WifiHostTest::TearDown();
+    }
+
+    void installHal() override {
+        hal_fn.wifi_start_gscan = test_start_gscan;
+        hal_fn.wifi_stop_gscan = test_stop_gscan;
+        hal_fn.wifi_get_cached_gscan_results = test_get_cached_gscan_results;
+    }
+
+    jobject newObject(const char *className) {
+        jclass objCls = env()->FindClass(className);
+        jobject obj = env()->AllocObject(objCls);
+        env()->DeleteLocalRef(objCls);
+        return obj;
+    }
+
+    void setIntField(jobject obj, const char *name, jint value) {
+        jclass objCls = env()->GetObjectClass(obj);
+        env()->SetIntField(obj, env()->GetFieldID(objCls, name, "I"), value);
+        env()->DeleteLocalRef(objCls);
+    }
+
+    /* one bucket of kPeriodMs */
+    bool startScan() {
+        const char *bucketClass = "com/android/server/wifi/WifiNative$BucketSettings";
+        const char *bucketArray = "[Lcom/android/server/wifi/WifiNative$BucketSettings;";
+        jobject settings = newObject("com/android/server/wifi/WifiNative$ScanSettings");
+        setIntField(settings, "base_period_ms", kPeriodMs);
+        setIntField(settings, "num_buckets", 1);
+        jclass bucketCls = env()->FindClass(bucketClass);
+        jobjectArray buckets = env()->NewObjectArray(1, bucketCls, NULL);
+        env()->DeleteLocalRef(bucketCls);
+        jobject bucket = newObject(bucketClass);
+        setIntField(bucket, "band", WIFI_BAND_BG);
+        setIntField(bucket, "period_ms", kPeriodMs);
+        env()->SetObjectArrayElement(buckets, 0, bucket);
+        jclass settingsCls = env()->GetObjectClass(settings);
+        env()->SetObjectField(settings, env()->GetFieldID(settingsCls, "buckets", bucketArray),
+                buckets);
+        env()->DeleteLocalRef(settingsCls);
+        env()->DeleteLocalRef(bucket);
+        env()->DeleteLocalRef(buckets);
+
+        jboolean started = native<StartScanFn>("startScanNative")(env(), cls(), iface(),
+                kScanId, settings);
+        env()->DeleteLocalRef(settings);
+        return started;
+    }
+
+    /* drains a scan of the BSSIDs ending in first..last */
+    void scan(u8 first, u8 last) {
+        sBatches.emplace_back();
+        wifi_cached_scan_results *batch = &sBatches.back();
+        memset(batch, 0, sizeof(*batch));
+        batch->scan_id = ++mScanId;
+        for (int i = first; i <= last; i++) {
+            wifi_scan_result *result = &batch->results[batch->num_results++];
+            u8 bssid[6] = { 0x02, 0x1a, 0x11, 0x00, 0x00, (u8) i };
+            memcpy(result->bssid, bssid, sizeof(bssid));
+            result->rssi = -50;
+            result->channel = 2412;
+        }
+        jobject scanData = native<GetScanResultsFn>("getScanResultsNative")(env(), cls(),
+                iface(), true);
+        env()->DeleteLocalRef(scanData);
+    }
+
+    /* the scans that make the controller take the next stretch */
+    void stableScans(int n = kStableScans, u8 first = 1, u8 last = 20) {
+        for (int i = 0; i < n; i++) {
+            scan(first, last);
+        }
+    }
+
+    void apply() {
+        native<ApplyScanPeriodFn>("applyScanPeriodNative")(env(), cls());
+    }
+
+    void motionHint(bool moving) {
+        native<SetScanMotionHintFn>("setScanMotionHintNative")(env(), cls(), moving);
+    }
+
+    std::string log() {
+        return takeString(native<GetScanPeriodControlLogFn>("getScanPeriodControlLogNative")(
+                env(), cls()));
+    }
+
+    int mScanId;
+};
+
+TEST_F(WifiScanPeriodControlTest, StretchesWhileStable) {
+    /* the first scan has nothing to be compared with */
+    scan(1, 20);
+    stableScans();
+    EXPECT_EQ(1U, sStartedPeriods.size());
+    EXPECT_EQ(0, sStops);
+
+    /* the decision is only carried out when the framework applies it */
+    apply();
+    EXPECT_EQ(std::vector<int>({ kPeriodMs, 2 * kPeriodMs }), sStartedPeriods);
+    EXPECT_EQ(1, sStops);
+    EXPECT_NE(std::string::npos, log().find("0->1 stretch"));
+
+    stableScans();
+    apply();
+    EXPECT_EQ(4 * kPeriodMs, sStartedPeriods.back());
+
+    /* no further than the maximum period */
+    stableScans(2 * kStableScans);
+    apply();
+    EXPECT_EQ(3U, sStartedPeriods.size());
+    EXPECT_EQ(2, sStops);
+}
+
+TEST_F(WifiScanPeriodControlTest, UnchangedTargetNotRestarted) {
+    scan(1, 20);
+    scan(1, 20);
+    apply();
+    apply();
+    EXPECT_EQ(1U, sStartedPeriods.size());
+    EXPECT_EQ(0, sStops);
+}
+
+TEST_F(WifiScanPeriodControlTest, ChangeGoesBack) {
+    scan(1, 20);
+    stableScans();
+    apply();
+    ASSERT_EQ(2 * kPeriodMs, sStartedPeriods.back());
+
+    scan(101, 120);
+    apply();
+    EXPECT_EQ(kPeriodMs, sStartedPeriods.back());
+    EXPECT_NE(std::string::npos, log().find("1->0 changed"));
+
+    /* stable again: stretches again from the requested schedule */
+    stableScans(kStableScans, 101, 120);
+    apply();
+    EXPECT_EQ(2 * kPeriodMs, sStartedPeriods.back());
+}
+
+TEST_F(WifiScanPeriodControlTest, MotionHintGoesBack) {
+    scan(1, 20);
+    stableScans();
+    apply();
+    ASSERT_EQ(2 * kPeriodMs, sStartedPeriods.back());
+
+    motionHint(true);
+    apply();
+    EXPECT_EQ(kPeriodMs, sStartedPeriods.back());
+    EXPECT_NE(std::string::npos, log().find("moving 1->0 moving"));
+
+    /* no stretch while moving */
+    stableScans();
+    apply();
+    EXPECT_EQ(3U, sStartedPeriods.size());
+
+    motionHint(false);
+    stableScans();
+    apply();
+    EXPECT_EQ(2 * kPeriodMs, sStartedPeriods.back());
+}
+
+TEST_F(WifiScanPeriodControlTest, DisableGoesBack) {
+    scan(1, 20);
+    stableScans(2 * kStableScans);
+    apply();
+    ASSERT_EQ(4 * kPeriodMs, sStartedPeriods.back());
+
+    ASSERT_TRUE(native<SetScanPeriodControlFn>("setScanPeriodControlNative")(env(), cls(), 0,
+            0));
+    apply();
+    EXPECT_EQ(kPeriodMs, sStartedPeriods.back());
+
+    stableScans();
+    apply();
+    EXPECT_EQ(kPeriodMs, sStartedPeriods.back());
+}
+
+TEST_F(WifiScanPeriodControlTest, FailedStretchRestartsRequested) {
+    sStartResult = WIFI_ERROR_UNKNOWN;
+    scan(1, 20);
+    stableScans();
+    apply();
+    EXPECT_EQ(std::vector<int>({ kPeriodMs, 2 * kPeriodMs, kPeriodMs }), sStartedPeriods);
+    EXPECT_NE(std::string::npos, log().find("1->0 failed"));
+
+    /* the controller goes on from the requested schedule */
+    sStartResult = WIFI_SUCCESS;
+    stableScans();
+    apply();
+    EXPECT_EQ(2 * kPeriodMs, sStartedPeriods.back());
+}
+
+TEST_F(WifiScanPeriodControlTest, NoRestartAfterStop) {
+    scan(1, 20);
+    stableScans();
+    native<StopScanFn>("stopScanNative")(env(), cls(), iface(), kScanId);
+    int stops = sStops;
+    apply();
+    EXPECT_EQ(1U, sStartedPeriods.size());
+    EXPECT_EQ(stops, sStops);
+}
+
+TEST_F(WifiScanPeriodControlTest, NoRestartAfterCleanup) {
+    scan(1, 20);
+    stableScans();
+
+    restartHal();
+    apply();
+    EXPECT_EQ(1U, sStartedPeriods.size());
+    EXPECT_EQ(0, sStops);
+    EXPECT_NE(std::string::npos, log().find("max period 0ms, no gscan, level 0"));
+}
+
+}  // namespace android
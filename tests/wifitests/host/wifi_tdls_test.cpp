@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-tdls-test"
+
+#include "jni.h"
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "fake_jni.h"
+#include "wifi_host_test.h"
+
+/*
+ * The bridge's TDLS peer table: state events deduplicated before they reach the
+ * framework, peers read back without asking the HAL, and the firmware's session
+ * limit enforced when enabling.
+ */
+
+namespace android {
+
+typedef jboolean (*EnableDisableTdlsFn)(JNIEnv *, jclass, jint, jboolean, jstring);
+typedef jobject (*GetTdlsStatusFn)(JNIEnv *, jclass, jint, jstring);
+typedef jobjectArray (*GetTdlsPeersFn)(JNIEnv *, jclass, jint);
+
+static const int kMaxSessions = 2;
+
+static int sEnables;
+static int sDisables;
+static int sStatusQueries;
+static wifi_error sEnableResult;
+static bool sEstablishOnEnable;
+static wifi_tdls_handler sHandler;
+static std::vector<std::string> sReported;
+
+static wifi_error test_get_tdls_capabilities(wifi_interface_handle iface,
+        wifi_tdls_capabilities *caps) {
+    caps->max_concurrent_tdls_session_num = kMaxSessions;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error test_enable_tdls(wifi_interface_handle iface, mac_addr addr,
+        wifi_tdls_params *params, wifi_tdls_handler handler) {
+    sEnables++;
+    sHandler = handler;
+    if (sEstablishOnEnable && sEnableResult == WIFI_SUCCESS) {
+        /* some HALs report the new state before returning */
+        wifi_tdls_status status = { 36, 0, WIFI_TDLS_ESTABLISHED, WIFI_TDLS_SUCCESS };
+        handler.on_tdls_state_changed(addr, status);
+    }
+    return sEnableResult;
+}
+
+static wifi_error test_disable_tdls(wifi_interface_handle iface, mac_addr addr) {
+    sDisables++;
+    return WIFI_SUCCESS;
+}
+
+static wifi_error test_get_tdls_status(wifi_interface_handle iface, mac_addr addr,
+        wifi_tdls_status *status) {
+    sStatusQueries++;
+    status->state = WIFI_TDLS_DISABLED;
+    return WIFI_SUCCESS;
+}
+
+class WifiTdlsTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        hal_fn.wifi_get_tdls_capabilities = test_get_tdls_capabilities;
+        hal_fn.wifi_enable_tdls = test_enable_tdls;
+        hal_fn.wifi_disable_tdls = test_disable_tdls;
+        hal_fn.wifi_get_tdls_status = test_get_tdls_status;
+        sEnables = 0;
+        sDisables = 0;
+        sStatusQueries = 0;
+        sEnableResult = WIFI_SUCCESS;
+        sEstablishOnEnable = false;
+        sHandler.on_tdls_state_changed = NULL;
+        sReported.clear();
+
+        host().vm().defineMethod(WifiHostEnv::kWifiNativeClass, "onTdlsStatus",
+                "(Ljava/lang/String;II)V", true,
+                [](JNIEnv *, FakeObject *, const jvalue *args) {
+                    char event[64];
+                    snprintf(event, sizeof(event), "%s %d %d",
+                            FakeJavaVM::unwrap(args[0].l)->str().c_str(), args[1].i, args[2].i);
+                    sReported.push_back(event);
+                    jvalue result;
+                    result.j = 0;
+                    return result;
+                });
+    }
+
+    /* every test uses its own peers: the table outlives the test */
+    void TearDown() override {
+        for (const std::string& mac : mPeers) {
+            enable(mac.c_str(), false);
+        }
+        WifiHostTest::TearDown();
+    }
+
+    bool enable(const char *mac, bool on = true) {
+        if (on) {
+            mPeers.push_back(mac);
+        }
+        jstring str = newString(mac);
+        jboolean ret = native<EnableDisableTdlsFn>("enableDisableTdlsNative")(env(), cls(),
+                iface(), on, str);
+        env()->DeleteLocalRef(str);
+        return ret;
+    }
+
+    void report(const char *mac, wifi_tdls_state state, int channel = 36) {
+        ASSERT_TRUE(sHandler.on_tdls_state_changed != NULL);
+        mac_addr addr;
+        ASSERT_EQ(6, sscanf(mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                &addr[0], &addr[1], &addr[2], &addr[3], &addr[4], &addr[5]));
+        wifi_tdls_status status = { channel, 0, state, WIFI_TDLS_SUCCESS };
+        sHandler.on_tdls_state_changed(addr, status);
+    }
+
+    /* state of the peer in getTdlsPeersNative(), or -1 if it is not in the table */
+    int peerState(const char *mac) {
+        jobjectArray peers = native<GetTdlsPeersFn>("getTdlsPeersNative")(env(), cls(),
+                iface());
+        int state = -1;
+        for (int i = 0; peers != NULL && i < env()->GetArrayLength(peers); i++) {
+            jobject peer = env()->GetObjectArrayElement(peers, i);
+            if (stringField(peer, "macAddress") == mac) {
+                state = intField(peer, "state");
+            }
+            env()->DeleteLocalRef(peer);
+        }
+        env()->DeleteLocalRef(peers);
+        return state;
+    }
+
+    std::string stringField(jobject obj, const char *name) {
+        jclass objCls = env()->GetObjectClass(obj);
+        jfieldID field = env()->GetFieldID(objCls, name, "Ljava/lang/String;");
+        env()->DeleteLocalRef(objCls);
+        return takeString((jstring) env()->GetObjectField(obj, field));
+    }
+
+    int intField(jobject obj, const char *name) {
+        jclass objCls = env()->GetObjectClass(obj);
+        jfieldID field = env()->GetFieldID(objCls, name, "I");
+        env()->DeleteLocalRef(objCls);
+        return env()->GetIntField(obj, field);
+    }
+
+private:
+    std::vector<std::string> mPeers;
+};
+
+TEST_F(WifiTdlsTest, EnableAddsPeer) {
+    EXPECT_EQ(-1, peerState("02:00:00:00:01:01"));
+    EXPECT_TRUE(enable("02:00:00:00:01:01"));
+    EXPECT_EQ(1, sEnables);
+    EXPECT_EQ(WIFI_TDLS_ENABLED, peerState("02:00:00:00:01:01"));
+
+    EXPECT_TRUE(enable("02:00:00:00:01:01", false));
+    EXPECT_EQ(WIFI_TDLS_DISABLED, peerState("02:00:00:00:01:01"));
+}
+
+TEST_F(WifiTdlsTest, FailedEnableReleasesPeer) {
+    sEnableResult = WIFI_ERROR_UNKNOWN;
+    EXPECT_FALSE(enable("02:00:00:00:02:01"));
+    EXPECT_EQ(-1, peerState("02:00:00:00:02:01"));
+}
+
+TEST_F(WifiTdlsTest, StatusReadFromTable) {
+    EXPECT_TRUE(enable("02:00:00:00:03:01"));
+    report("02:00:00:00:03:01", WIFI_TDLS_ESTABLISHED, 149);
+
+    jstring mac = newString("02:00:00:00:03:01");
+    jobject status = native<GetTdlsStatusFn>("getTdlsStatusNative")(env(), cls(), iface(), mac);
+    ASSERT_TRUE(status != NULL);
+    EXPECT_EQ(WIFI_TDLS_ESTABLISHED, intField(status, "state"));
+    EXPECT_EQ(149, intField(status, "channel"));
+    EXPECT_EQ(0, sStatusQueries);
+    env()->DeleteLocalRef(status);
+    env()->DeleteLocalRef(mac);
+}
+
+TEST_F(WifiTdlsTest, UnchangedStateReportedOnce) {
+    EXPECT_TRUE(enable("02:00:00:00:04:01"));
+    report("02:00:00:00:04:01", WIFI_TDLS_ESTABLISHED);
+    report("02:00:00:00:04:01", WIFI_TDLS_ESTABLISHED);
+    report("02:00:00:00:04:01", WIFI_TDLS_ESTABLISHED, 149);
+    report("02:00:00:00:04:01", WIFI_TDLS_DROPPED, 149);
+
+    std::vector<std::string> expected = {
+        "02:00:00:00:04:01 3 0",
+        "02:00:00:00:04:01 3 0",
+        "02:00:00:00:04:01 5 0",
+    };
+    EXPECT_EQ(expected, sReported);
+    EXPECT_EQ(WIFI_TDLS_DROPPED, peerState("02:00:00:00:04:01"));
+}
+
+TEST_F(WifiTdlsTest, UnknownPeerTracked) {
+    /* the handler is registered by the first enable */
+    EXPECT_TRUE(enable("02:00:00:00:05:01"));
+    report("02:00:00:00:05:02", WIFI_TDLS_ESTABLISHED);
+    EXPECT_EQ(WIFI_TDLS_ESTABLISHED, peerState("02:00:00:00:05:02"));
+    EXPECT_EQ(1U, sReported.size());
+    enable("02:00:00:00:05:02", false);
+}
+
+TEST_F(WifiTdlsTest, SessionLimit) {
+    EXPECT_TRUE(enable("02:00:00:00:06:01"));
+    EXPECT_TRUE(enable("02:00:00:00:06:02"));
+    EXPECT_FALSE(enable("02:00:00:00:06:03"));
+    EXPECT_EQ(2, sEnables);
+    EXPECT_EQ(-1, peerState("02:00:00:00:06:03"));
+
+    /* an active peer can always be enabled again */
+    EXPECT_TRUE(enable("02:00:00:00:06:02"));
+    EXPECT_EQ(3, sEnables);
+
+    /* a session the firmware dropped frees its place */
+    report("02:00:00:00:06:01", WIFI_TDLS_DROPPED);
+    EXPECT_TRUE(enable("02:00:00:00:06:03"));
+    EXPECT_FALSE(enable("02:00:00:00:06:01"));
+
+    EXPECT_TRUE(enable("02:00:00:00:06:02", false));
+    EXPECT_TRUE(enable("02:00:00:00:06:01"));
+}
+
+TEST_F(WifiTdlsTest, StateEventDuringEnable) {
+    /* would deadlock if the table lock were held across wifi_enable_tdls() */
+    sEstablishOnEnable = true;
+    EXPECT_TRUE(enable("02:00:00:00:07:01"));
+    EXPECT_EQ(WIFI_TDLS_ESTABLISHED, peerState("02:00:00:00:07:01"));
+    EXPECT_EQ(1U, sReported.size());
+}
+
+}  // namespace android
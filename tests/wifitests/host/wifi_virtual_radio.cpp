@@ -0,0 +1,1618 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-virtual-radio"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wifi_hal.h"
+#include "wifi_virtual_radio.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef std::function<void()> Delivery;
+
+const wifi_channel kChannels24[] = { 2412, 2437, 2462 };
+const wifi_channel kChannels5[] = { 5180, 5200, 5220, 5240, 5745, 5765, 5785, 5805 };
+const wifi_channel kChannelsDfs[] = { 5260, 5280, 5300, 5500, 5520 };
+
+const int kMaxCachedScans = 64;
+const int kMaxRssiSamples = 16;
+const int kMaxRings = 4;
+const int kIeLength = 160;
+const int kRingBufferSize = 32 * 1024;
+const int kTxPowerLevels = 8;
+const int kRoamHysteresisDb = 6;
+const double kSpeedOfLight = 299792458.0;
+
+const byte kBssidPrefix[] = { 0x02, 0x56, 0x52, 0x00 };   /* locally administered "VR" */
+
+enum EventType {
+    EVENT_TICK,
+    EVENT_SCAN,
+    EVENT_RTT,
+    EVENT_RING_RECORD,
+    EVENT_RING_FLUSH,
+};
+
+struct Event {
+    int64_t due_us;                 /* simulated time */
+    uint64_t seq;                   /* keeps events due at the same time in FIFO order */
+    EventType type;
+    uint64_t generation;            /* drops events of a request that was reset since */
+    int arg;
+
+    bool operator>(const Event& other) const {
+        return due_us != other.due_us ? due_us > other.due_us : seq > other.seq;
+    }
+};
+
+struct SimAp {
+    mac_addr bssid;
+    char ssid[32 + 1];
+    wifi_channel channel;
+    double x, y;
+    double vx, vy;
+    double shadow_db;
+    wifi_rssi rssi;
+    wifi_rssi samples[kMaxRssiSamples];    /* as seen by scans, most recent first */
+    int num_samples;
+};
+
+struct HotlistEntry {
+    int ap;                         /* index into mAps, or -1 if the BSSID is not simulated */
+    wifi_rssi low;
+    bool found;
+    int misses;
+};
+
+struct ChangeEntry {
+    int ap;
+    wifi_rssi low;
+    wifi_rssi high;
+    bool breached;
+};
+
+struct RttRequest {
+    std::vector<wifi_rtt_config> configs;
+    wifi_rtt_event_handler handler;
+    size_t next;
+    uint64_t generation;
+};
+
+struct RttBurst {
+    std::vector<wifi_rtt_result> results;
+    std::vector<wifi_rtt_result *> ptrs;
+    std::vector<std::vector<byte> > elements;
+};
+
+struct Ring {
+    wifi_ring_buffer_status status;
+    u32 max_interval_sec;
+    u32 min_data_size;
+    int64_t last_flush_us;
+    std::vector<char> pending;
+    uint64_t generation;
+};
+
+class VirtualRadio {
+public:
+    VirtualRadio(const virtual_radio_scenario& scenario);
+
+    void start();
+    void stop();
+    void pause();
+    void resume();
+    void getStats(virtual_radio_stats *stats);
+
+    wifi_error getSupportedFeatureSet(feature_set *set);
+    wifi_error getGscanCapabilities(wifi_gscan_capabilities *capabilities);
+    wifi_error startGscan(wifi_request_id id, const wifi_scan_cmd_params& params,
+            wifi_scan_result_handler handler);
+    wifi_error stopGscan(wifi_request_id id);
+    wifi_error getCachedGscanResults(byte flush, int max, wifi_cached_scan_results *results,
+            int *num);
+    wifi_error setBssidHotlist(wifi_request_id id, const wifi_bssid_hotlist_params& params,
+            wifi_hotlist_ap_found_handler handler);
+    wifi_error resetBssidHotlist(wifi_request_id id);
+    wifi_error setSignificantChange(wifi_request_id id,
+            const wifi_significant_change_params& params,
+            wifi_significant_change_handler handler);
+    wifi_error resetSignificantChange(wifi_request_id id);
+    wifi_error setEpnoList(wifi_request_id id, const wifi_epno_params *params,
+            wifi_epno_handler handler);
+    wifi_error resetEpnoList(wifi_request_id id);
+    wifi_error getLinkStats(wifi_request_id id, wifi_stats_result_handler handler);
+    wifi_error rttRangeRequest(wifi_request_id id, unsigned num_rtt_config,
+            wifi_rtt_config rtt_config[], wifi_rtt_event_handler handler);
+    wifi_error rttRangeCancel(wifi_request_id id);
+    wifi_error getRttCapabilities(wifi_rtt_capabilities *capabilities);
+    wifi_error startRssiMonitoring(wifi_request_id id, s8 max_rssi, s8 min_rssi,
+            wifi_rssi_event_handler handler);
+    wifi_error stopRssiMonitoring(wifi_request_id id);
+    wifi_error setLogHandler(wifi_request_id id, wifi_ring_buffer_data_handler handler);
+    wifi_error resetLogHandler(wifi_request_id id);
+    wifi_error startLogging(u32 verbose_level, u32 flags, u32 max_interval_sec,
+            u32 min_data_size, const char *ring_name);
+    wifi_error getRingBuffersStatus(u32 *num_rings, wifi_ring_buffer_status *status);
+    wifi_error getLoggerSupportedFeatureSet(unsigned int *support);
+    wifi_error getRingData(const char *ring_name);
+
+private:
+    void run();
+    void dispatch(const Event& event);
+
+    int64_t simNow() const;
+    Clock::time_point wallTime(int64_t sim_us) const;
+    void schedule(EventType type, int64_t delay_us, uint64_t generation, int arg);
+
+    void tick();
+    void scan(const Event& event);
+    void reportHotlist(const std::vector<bool>& visible);
+    void reportSignificantChange(const std::vector<bool>& visible);
+    void reportEpno(const std::vector<int>& visible);
+    void rtt(const Event& event);
+    void ringRecord(const Event& event);
+    void ringFlush(int index);
+
+    bool channelScanned(wifi_channel channel, int band, const std::vector<wifi_channel>& list);
+    void fillScanResult(const SimAp& ap, wifi_scan_result *result);
+    int apForBssid(const mac_addr bssid) const;
+    int findRing(const char *name) const;
+    double distance(const SimAp& ap) const;
+
+    virtual_radio_scenario mScenario;
+    std::mt19937 mRandom;
+    std::normal_distribution<double> mNormal;
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::thread mThread;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > mEvents;
+    std::vector<Delivery> mDeliveries;
+    uint64_t mSeq;
+    bool mStopping;
+    bool mPaused;
+    bool mDelivering;
+    Clock::time_point mStartWall;
+    Clock::time_point mPauseWall;
+    virtual_radio_stats mStats;
+
+    /* world */
+    std::vector<SimAp> mAps;
+    double mDeviceX, mDeviceY;
+    double mWaypointX, mWaypointY;
+    int mConnectedAp;
+    double mTxMpdu, mRxMpdu, mLostMpdu, mRetries;
+
+    /* gscan */
+    bool mScanning;
+    uint64_t mScanGeneration;
+    wifi_request_id mScanId;
+    wifi_scan_cmd_params mScanParams;
+    wifi_scan_result_handler mScanHandler;
+    int mScanCount;
+    int mScansSinceReport;
+    std::vector<wifi_cached_scan_results> mCachedScans;
+
+    /* hotlist */
+    bool mHotlistActive;
+    wifi_request_id mHotlistId;
+    int mHotlistLostSamples;
+    std::vector<HotlistEntry> mHotlist;
+    wifi_hotlist_ap_found_handler mHotlistHandler;
+
+    /* significant change */
+    bool mChangeActive;
+    wifi_request_id mChangeId;
+    int mChangeSamples;
+    int mChangeMinBreaching;
+    std::vector<ChangeEntry> mChange;
+    wifi_significant_change_handler mChangeHandler;
+
+    /* ePNO */
+    bool mEpnoActive;
+    wifi_request_id mEpnoId;
+    int mEpnoMin24Rssi;
+    int mEpnoMin5Rssi;
+    std::vector<bool> mEpnoMatch;
+    std::vector<bool> mEpnoReported;
+    wifi_epno_handler mEpnoHandler;
+
+    /* RTT */
+    uint64_t mRttGeneration;
+    std::map<wifi_request_id, RttRequest> mRttRequests;
+
+    /* RSSI monitoring */
+    bool mRssiActive;
+    wifi_request_id mRssiId;
+    s8 mRssiMax;
+    s8 mRssiMin;
+    bool mRssiInRange;
+    wifi_rssi_event_handler mRssiHandler;
+
+    /* ring buffer logging */
+    bool mLogHandlerSet;
+    wifi_ring_buffer_data_handler mLogHandler;
+    std::vector<Ring> mRings;
+    u32 mTxTimePerLevel[kTxPowerLevels];
+};
+
+VirtualRadio::VirtualRadio(const virtual_radio_scenario& scenario)
+    : mScenario(scenario), mRandom(scenario.seed), mNormal(0.0, 1.0), mSeq(0),
+      mStopping(false), mPaused(false), mDelivering(false), mConnectedAp(-1),
+      mTxMpdu(0), mRxMpdu(0), mLostMpdu(0), mRetries(0),
+      mScanning(false), mScanGeneration(0), mScanId(0), mScanCount(0), mScansSinceReport(0),
+      mHotlistActive(false), mHotlistId(0), mHotlistLostSamples(0),
+      mChangeActive(false), mChangeId(0), mChangeSamples(0), mChangeMinBreaching(0),
+      mEpnoActive(false), mEpnoId(0), mEpnoMin24Rssi(0), mEpnoMin5Rssi(0),
+      mRttGeneration(0), mRssiActive(false), mRssiId(0), mRssiMax(0), mRssiMin(0),
+      mRssiInRange(true), mLogHandlerSet(false) {
+    memset(&mStats, 0, sizeof(mStats));
+    memset(&mScanParams, 0, sizeof(mScanParams));
+    memset(&mScanHandler, 0, sizeof(mScanHandler));
+    memset(&mHotlistHandler, 0, sizeof(mHotlistHandler));
+    memset(&mChangeHandler, 0, sizeof(mChangeHandler));
+    memset(&mEpnoHandler, 0, sizeof(mEpnoHandler));
+    memset(&mRssiHandler, 0, sizeof(mRssiHandler));
+    memset(&mLogHandler, 0, sizeof(mLogHandler));
+    memset(mTxTimePerLevel, 0, sizeof(mTxTimePerLevel));
+
+    if (mScenario.num_ssids < 1) {
+        mScenario.num_ssids = 1;
+    }
+    if (mScenario.rate_multiplier <= 0) {
+        mScenario.rate_multiplier = 1;
+    }
+    if (mScenario.tick_ms < 1) {
+        mScenario.tick_ms = 1;
+    }
+    if (mScenario.rtt_burst_size < 1) {
+        mScenario.rtt_burst_size = 1;
+    }
+
+    std::uniform_real_distribution<double> position(0.0, mScenario.area_m);
+    std::uniform_real_distribution<double> heading(0.0, 2 * M_PI);
+    std::uniform_real_distribution<double> speed(0.0, mScenario.ap_speed_mps);
+    const size_t num24 = sizeof(kChannels24) / sizeof(kChannels24[0]);
+    const size_t num5 = sizeof(kChannels5) / sizeof(kChannels5[0]);
+    const size_t numDfs = sizeof(kChannelsDfs) / sizeof(kChannelsDfs[0]);
+    std::uniform_int_distribution<size_t> channel(0, num24 + num5 + numDfs - 1);
+
+    mAps.resize(mScenario.num_aps);
+    for (int i = 0; i < mScenario.num_aps; i++) {
+        SimAp& ap = mAps[i];
+        memset(&ap, 0, sizeof(ap));
+        virtual_radio_get_ap_bssid(i, ap.bssid);
+        snprintf(ap.ssid, sizeof(ap.ssid), VIRTUAL_RADIO_SSID_FORMAT, i % mScenario.num_ssids);
+        size_t c = channel(mRandom);
+        ap.channel = c < num24 ? kChannels24[c]
+                : c < num24 + num5 ? kChannels5[c - num24] : kChannelsDfs[c - num24 - num5];
+        ap.x = position(mRandom);
+        ap.y = position(mRandom);
+        double h = heading(mRandom);
+        double v = mScenario.ap_speed_mps > 0 ? speed(mRandom) : 0;
+        ap.vx = v * cos(h);
+        ap.vy = v * sin(h);
+        ap.shadow_db = mScenario.fading_sigma_db * mNormal(mRandom);
+    }
+
+    mDeviceX = mWaypointX = mScenario.area_m / 2;
+    mDeviceY = mWaypointY = mScenario.area_m / 2;
+}
+
+void VirtualRadio::start() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mStartWall = Clock::now();
+    tick();
+    mThread = std::thread(&VirtualRadio::run, this);
+    ALOGD("virtual radio started: %d APs, rate x%.1f", mScenario.num_aps,
+            mScenario.rate_multiplier);
+}
+
+void VirtualRadio::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
+        mCond.notify_all();
+    }
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void VirtualRadio::pause() {
+    std::unique_lock<std::mutex> lock(mLock);
+    if (mPaused) {
+        return;
+    }
+    mPaused = true;
+    mPauseWall = Clock::now();
+    mCond.wait(lock, [this] { return !mDelivering; });
+}
+
+void VirtualRadio::resume() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mPaused) {
+        return;
+    }
+    mStartWall += Clock::now() - mPauseWall;
+    mPaused = false;
+    mCond.notify_all();
+}
+
+void VirtualRadio::getStats(virtual_radio_stats *stats) {
+    std::lock_guard<std::mutex> lock(mLock);
+    *stats = mStats;
+}
+
+int64_t VirtualRadio::simNow() const {
+    Clock::time_point now = mPaused ? mPauseWall : Clock::now();
+    int64_t wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - mStartWall).count();
+    return (int64_t) (wall_us * mScenario.rate_multiplier);
+}
+
+Clock::time_point VirtualRadio::wallTime(int64_t sim_us) const {
+    return mStartWall + std::chrono::microseconds(
+            (int64_t) (sim_us / mScenario.rate_multiplier));
+}
+
+void VirtualRadio::schedule(EventType type, int64_t delay_us, uint64_t generation, int arg) {
+    Event event;
+    event.due_us = simNow() + delay_us;
+    event.seq = mSeq++;
+    event.type = type;
+    event.generation = generation;
+    event.arg = arg;
+    mEvents.push(event);
+    mCond.notify_all();
+}
+
+void VirtualRadio::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (!mStopping) {
+        if (mPaused || mEvents.empty()) {
+            mCond.wait(lock);
+            continue;
+        }
+
+        Event event = mEvents.top();
+        Clock::time_point due = wallTime(event.due_us);
+        Clock::time_point now = Clock::now();
+        if (now < due) {
+            mCond.wait_until(lock, due);
+            continue;
+        }
+        mEvents.pop();
+
+        int64_t lag_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                now - due).count();
+        mStats.max_delivery_lag_us = std::max(mStats.max_delivery_lag_us, lag_us);
+
+        dispatch(event);
+        if (mDeliveries.empty()) {
+            continue;
+        }
+
+        /* callbacks run unlocked, the bridge may call back into the HAL */
+        std::vector<Delivery> deliveries;
+        deliveries.swap(mDeliveries);
+        mDelivering = true;
+        lock.unlock();
+        for (size_t i = 0; i < deliveries.size(); i++) {
+            deliveries[i]();
+        }
+        lock.lock();
+        mDelivering = false;
+        mCond.notify_all();
+    }
+    ALOGD("virtual radio event loop exiting");
+}
+
+void VirtualRadio::dispatch(const Event& event) {
+    switch (event.type) {
+        case EVENT_TICK:
+            tick();
+            break;
+        case EVENT_SCAN:
+            scan(event);
+            break;
+        case EVENT_RTT:
+            rtt(event);
+            break;
+        case EVENT_RING_RECORD:
+            ringRecord(event);
+            break;
+        case EVENT_RING_FLUSH:
+            ringFlush(event.arg);
+            break;
+    }
+}
+
+double VirtualRadio::distance(const SimAp& ap) const {
+    double dx = ap.x - mDeviceX;
+    double dy = ap.y - mDeviceY;
+    return sqrt(dx * dx + dy * dy);
+}
+
+/* moves the device and the APs, fades the shadowing and re-evaluates the connection */
+void VirtualRadio::tick() {
+    double dt = mScenario.tick_ms / 1000.0;
+    double area = mScenario.area_m;
+
+    double step = mScenario.device_speed_mps * dt;
+    double dx = mWaypointX - mDeviceX;
+    double dy = mWaypointY - mDeviceY;
+    double remaining = sqrt(dx * dx + dy * dy);
+    if (remaining <= step) {
+        mDeviceX = mWaypointX;
+        mDeviceY = mWaypointY;
+        std::uniform_real_distribution<double> position(0.0, area);
+        mWaypointX = position(mRandom);
+        mWaypointY = position(mRandom);
+    } else {
+        mDeviceX += dx * step / remaining;
+        mDeviceY += dy * step / remaining;
+    }
+
+    double coherence = mScenario.fading_coherence;
+    double innovation = mScenario.fading_sigma_db * sqrt(1 - coherence * coherence);
+    for (size_t i = 0; i < mAps.size(); i++) {
+        SimAp& ap = mAps[i];
+        ap.x += ap.vx * dt;
+        ap.y += ap.vy * dt;
+        if (ap.x < 0 || ap.x > area) {
+            ap.vx = -ap.vx;
+            ap.x = std::min(std::max(ap.x, 0.0), area);
+        }
+        if (ap.y < 0 || ap.y > area) {
+            ap.vy = -ap.vy;
+            ap.y = std::min(std::max(ap.y, 0.0), area);
+        }
+        ap.shadow_db = coherence * ap.shadow_db + innovation * mNormal(mRandom);
+
+        double d = std::max(distance(ap), 1.0);
+        double rssi = mScenario.tx_power_dbm - 10 * mScenario.path_loss_exponent * log10(d)
+                + ap.shadow_db;
+        ap.rssi = (wifi_rssi) std::min(std::max(rssi, -127.0), -1.0);
+    }
+
+    int best = -1;
+    for (size_t i = 0; i < mAps.size(); i++) {
+        if (best < 0 || mAps[i].rssi > mAps[best].rssi) {
+            best = i;
+        }
+    }
+    if (best >= 0 && mAps[best].rssi >= mScenario.sensitivity_dbm) {
+        if (mConnectedAp < 0 || mAps[mConnectedAp].rssi < mScenario.sensitivity_dbm
+                || mAps[best].rssi >= mAps[mConnectedAp].rssi + kRoamHysteresisDb) {
+            mConnectedAp = best;
+        }
+    } else if (mConnectedAp >= 0 && mAps[mConnectedAp].rssi < mScenario.sensitivity_dbm) {
+        mConnectedAp = -1;
+    }
+
+    if (mConnectedAp >= 0) {
+        /* traffic on the link; loss and retries grow as the signal drops */
+        wifi_rssi rssi = mAps[mConnectedAp].rssi;
+        double loss = std::min(std::max((-60.0 - rssi) / 30.0, 0.0), 1.0) * 0.3;
+        double tx = 200 * dt;
+        mTxMpdu += tx;
+        mRxMpdu += 300 * dt;
+        mLostMpdu += tx * loss;
+        mRetries += tx * loss * 2;
+        int level = std::min(std::max((-rssi - 40) / 8, 0), kTxPowerLevels - 1);
+        mTxTimePerLevel[level] += mScenario.tick_ms;
+
+        if (mRssiActive) {
+            bool inRange = rssi >= mRssiMin && rssi <= mRssiMax;
+            if (!inRange && mRssiInRange) {
+                mStats.rssi_breaches++;
+                wifi_rssi_event_handler handler = mRssiHandler;
+                wifi_request_id id = mRssiId;
+                std::shared_ptr<std::vector<u8> > bssid = std::make_shared<std::vector<u8> >(
+                        mAps[mConnectedAp].bssid, mAps[mConnectedAp].bssid + sizeof(mac_addr));
+                mDeliveries.push_back([handler, id, bssid, rssi] {
+                    handler.on_rssi_threshold_breached(id, bssid->data(), (s8) rssi);
+                });
+            }
+            mRssiInRange = inRange;
+        }
+    }
+
+    schedule(EVENT_TICK, mScenario.tick_ms * 1000LL, 0, 0);
+}
+
+bool VirtualRadio::channelScanned(wifi_channel channel, int band,
+        const std::vector<wifi_channel>& list) {
+    if (std::find(list.begin(), list.end(), channel) != list.end()) {
+        return true;
+    }
+    const wifi_channel *dfsEnd = kChannelsDfs + sizeof(kChannelsDfs) / sizeof(kChannelsDfs[0]);
+    bool dfs = std::find(kChannelsDfs, dfsEnd, channel) != dfsEnd;
+    if (channel < 3000) {
+        return (band & WIFI_BAND_BG) != 0;
+    }
+    return (band & (dfs ? WIFI_BAND_A_DFS : WIFI_BAND_A)) != 0;
+}
+
+void VirtualRadio::fillScanResult(const SimAp& ap, wifi_scan_result *result) {
+    memcpy(result->ssid, ap.ssid, sizeof(result->ssid));
+    memcpy(result->bssid, ap.bssid, sizeof(mac_addr));
+    result->ts = simNow();
+    result->channel = ap.channel;
+    result->rssi = ap.rssi;
+    result->rtt = 0;
+    result->rtt_sd = 0;
+    result->beacon_period = 100;
+    result->capability = 0x0411;    /* ESS, privacy, short slot */
+}
+
+void VirtualRadio::scan(const Event& event) {
+    if (!mScanning || event.generation != mScanGeneration) {
+        return;
+    }
+    schedule(EVENT_SCAN, std::max(mScanParams.base_period, 1) * 1000LL, mScanGeneration, 0);
+
+    /* buckets are due every period / base_period scans; no exponential back off */
+    unsigned buckets_scanned = 0;
+    int band = 0;
+    bool full_results = false;
+    bool each_scan = false;
+    std::vector<wifi_channel> channels;
+    for (int i = 0; i < mScanParams.num_buckets; i++) {
+        const wifi_scan_bucket_spec& bucket = mScanParams.buckets[i];
+        int every = std::max(1, bucket.period / std::max(mScanParams.base_period, 1));
+        if (mScanCount % every != 0) {
+            continue;
+        }
+        buckets_scanned |= 1 << i;
+        band |= bucket.band;
+        full_results |= (bucket.report_events & REPORT_EVENTS_FULL_RESULTS) != 0;
+        each_scan |= (bucket.report_events & REPORT_EVENTS_EACH_SCAN) != 0;
+        for (int j = 0; j < bucket.num_channels; j++) {
+            channels.push_back(bucket.channels[j].channel);
+        }
+    }
+    if (mScanParams.num_buckets == 0) {
+        band = WIFI_BAND_ABG_WITH_DFS;
+    }
+    mScanCount++;
+    if (mScanParams.num_buckets != 0 && buckets_scanned == 0) {
+        return;
+    }
+    mStats.scans++;
+
+    std::vector<int> visible;
+    std::vector<bool> seen(mAps.size(), false);
+    for (size_t i = 0; i < mAps.size(); i++) {
+        SimAp& ap = mAps[i];
+        if (ap.rssi < mScenario.sensitivity_dbm || !channelScanned(ap.channel, band, channels)) {
+            continue;
+        }
+        memmove(ap.samples + 1, ap.samples, sizeof(ap.samples) - sizeof(ap.samples[0]));
+        ap.samples[0] = ap.rssi;
+        ap.num_samples = std::min(ap.num_samples + 1, kMaxRssiSamples);
+        visible.push_back(i);
+        seen[i] = true;
+    }
+    std::sort(visible.begin(), visible.end(), [this](int a, int b) {
+        return mAps[a].rssi > mAps[b].rssi;
+    });
+    if (mScanParams.max_ap_per_scan > 0 && (int) visible.size() > mScanParams.max_ap_per_scan) {
+        visible.resize(mScanParams.max_ap_per_scan);
+    }
+
+    if (full_results && mScanHandler.on_full_scan_result != NULL && !visible.empty()) {
+        size_t size = sizeof(wifi_scan_result) + kIeLength;
+        std::shared_ptr<std::vector<byte> > buffer =
+                std::make_shared<std::vector<byte> >(size * visible.size(), 0);
+        for (size_t i = 0; i < visible.size(); i++) {
+            const SimAp& ap = mAps[visible[i]];
+            wifi_scan_result *result = (wifi_scan_result *) (buffer->data() + i * size);
+            fillScanResult(ap, result);
+
+            /* SSID, DS parameter set, then a vendor element up to kIeLength */
+            byte *ie = (byte *) result->ie_data;
+            int ssid_len = strlen(ap.ssid);
+            ie[0] = 0;
+            ie[1] = ssid_len;
+            memcpy(ie + 2, ap.ssid, ssid_len);
+            byte *ds = ie + 2 + ssid_len;
+            ds[0] = 3;
+            ds[1] = 1;
+            ds[2] = (ap.channel < 3000 ? ap.channel - 2407 : ap.channel - 5000) / 5;
+            byte *vendor = ds + 3;
+            int vendor_len = kIeLength - (vendor - ie) - 2;
+            vendor[0] = 221;
+            vendor[1] = vendor_len;
+            memset(vendor + 2, visible[i], vendor_len);
+            result->ie_length = kIeLength;
+        }
+        mStats.full_scan_results += visible.size();
+
+        wifi_scan_result_handler handler = mScanHandler;
+        wifi_request_id id = mScanId;
+        size_t count = visible.size();
+        mDeliveries.push_back([handler, id, buffer, size, count, buckets_scanned] {
+            for (size_t i = 0; i < count; i++) {
+                handler.on_full_scan_result(id,
+                        (wifi_scan_result *) (buffer->data() + i * size), buckets_scanned);
+            }
+        });
+    }
+
+    wifi_cached_scan_results cached;
+    memset(&cached, 0, sizeof(cached));
+    cached.scan_id = mScanCount;
+    cached.buckets_scanned = buckets_scanned;
+    cached.num_results = std::min((int) visible.size(), MAX_AP_CACHE_PER_SCAN);
+    for (int i = 0; i < cached.num_results; i++) {
+        fillScanResult(mAps[visible[i]], &cached.results[i]);
+    }
+    if ((int) mCachedScans.size() == kMaxCachedScans) {
+        mCachedScans.erase(mCachedScans.begin());
+    }
+    mCachedScans.push_back(cached);
+    mScansSinceReport++;
+
+    bool report = each_scan
+            || (mScanParams.report_threshold_num_scans > 0
+                    && mScansSinceReport >= mScanParams.report_threshold_num_scans)
+            || (mScanParams.report_threshold_percent > 0
+                    && (int) mCachedScans.size() * 100 / kMaxCachedScans
+                            >= mScanParams.report_threshold_percent);
+    if (report && mScanHandler.on_scan_event != NULL) {
+        mScansSinceReport = 0;
+        mStats.scan_events++;
+        wifi_scan_result_handler handler = mScanHandler;
+        wifi_request_id id = mScanId;
+        mDeliveries.push_back([handler, id] {
+            handler.on_scan_event(id, WIFI_SCAN_RESULTS_AVAILABLE);
+        });
+    }
+
+    reportHotlist(seen);
+    reportSignificantChange(seen);
+    reportEpno(visible);
+}
+
+void VirtualRadio::reportHotlist(const std::vector<bool>& visible) {
+    if (!mHotlistActive) {
+        return;
+    }
+
+    std::shared_ptr<std::vector<wifi_scan_result> > found =
+            std::make_shared<std::vector<wifi_scan_result> >();
+    std::shared_ptr<std::vector<wifi_scan_result> > lost =
+            std::make_shared<std::vector<wifi_scan_result> >();
+    for (size_t i = 0; i < mHotlist.size(); i++) {
+        HotlistEntry& entry = mHotlist[i];
+        if (entry.ap < 0) {
+            continue;
+        }
+        const SimAp& ap = mAps[entry.ap];
+        wifi_scan_result result;
+        memset(&result, 0, sizeof(result));
+        fillScanResult(ap, &result);
+        if (visible[entry.ap] && ap.rssi >= entry.low) {
+            entry.misses = 0;
+            if (!entry.found) {
+                entry.found = true;
+                found->push_back(result);
+            }
+        } else if (entry.found && ++entry.misses >= std::max(mHotlistLostSamples, 1)) {
+            entry.found = false;
+            lost->push_back(result);
+        }
+    }
+
+    wifi_hotlist_ap_found_handler handler = mHotlistHandler;
+    wifi_request_id id = mHotlistId;
+    if (!found->empty() && handler.on_hotlist_ap_found != NULL) {
+        mStats.hotlist_events++;
+        mDeliveries.push_back([handler, id, found] {
+            handler.on_hotlist_ap_found(id, found->size(), found->data());
+        });
+    }
+    if (!lost->empty() && handler.on_hotlist_ap_lost != NULL) {
+        mStats.hotlist_events++;
+        mDeliveries.push_back([handler, id, lost] {
+            handler.on_hotlist_ap_lost(id, lost->size(), lost->data());
+        });
+    }
+}
+
+/* reports APs whose averaged RSSI left their band, once at least min_breaching did */
+void VirtualRadio::reportSignificantChange(const std::vector<bool>& visible) {
+    if (!mChangeActive) {
+        return;
+    }
+
+    std::vector<ChangeEntry *> breaching;
+    for (size_t i = 0; i < mChange.size(); i++) {
+        ChangeEntry& entry = mChange[i];
+        if (entry.ap < 0 || !visible[entry.ap]) {
+            continue;
+        }
+        const SimAp& ap = mAps[entry.ap];
+        int n = std::min(ap.num_samples, std::max(mChangeSamples, 1));
+        int sum = 0;
+        for (int j = 0; j < n; j++) {
+            sum += ap.samples[j];
+        }
+        int average = sum / n;
+        bool out = average < entry.low || average > entry.high;
+        if (!out) {
+            entry.breached = false;
+        } else if (!entry.breached) {
+            breaching.push_back(&entry);
+        }
+    }
+    if (breaching.empty() || (int) breaching.size() < mChangeMinBreaching) {
+        return;
+    }
+
+    int num_rssi = std::min(std::max(mChangeSamples, 1), kMaxRssiSamples);
+    size_t size = sizeof(wifi_significant_change_result) + num_rssi * sizeof(wifi_rssi);
+    std::shared_ptr<std::vector<byte> > buffer =
+            std::make_shared<std::vector<byte> >(size * breaching.size(), 0);
+    std::shared_ptr<std::vector<wifi_significant_change_result *> > results =
+            std::make_shared<std::vector<wifi_significant_change_result *> >();
+    for (size_t i = 0; i < breaching.size(); i++) {
+        breaching[i]->breached = true;
+        const SimAp& ap = mAps[breaching[i]->ap];
+        wifi_significant_change_result *result =
+                (wifi_significant_change_result *) (buffer->data() + i * size);
+        memcpy(result->bssid, ap.bssid, sizeof(mac_addr));
+        result->channel = ap.channel;
+        result->num_rssi = std::min(num_rssi, ap.num_samples);
+        memcpy(result->rssi, ap.samples, result->num_rssi * sizeof(wifi_rssi));
+        results->push_back(result);
+    }
+
+    mStats.significant_change_events++;
+    wifi_significant_change_handler handler = mChangeHandler;
+    wifi_request_id id = mChangeId;
+    mDeliveries.push_back([handler, id, buffer, results] {
+        handler.on_significant_change(id, results->size(), results->data());
+    });
+}
+
+/* reports each matching network once per sighting */
+void VirtualRadio::reportEpno(const std::vector<int>& visible) {
+    if (!mEpnoActive) {
+        return;
+    }
+
+    std::vector<bool> seen(mAps.size(), false);
+    std::shared_ptr<std::vector<wifi_scan_result> > found =
+            std::make_shared<std::vector<wifi_scan_result> >();
+    for (size_t i = 0; i < visible.size(); i++) {
+        int index = visible[i];
+        const SimAp& ap = mAps[index];
+        int min_rssi = ap.channel < 3000 ? mEpnoMin24Rssi : mEpnoMin5Rssi;
+        if (!mEpnoMatch[index] || ap.rssi < min_rssi) {
+            continue;
+        }
+        seen[index] = true;
+        if (!mEpnoReported[index]) {
+            wifi_scan_result result;
+            memset(&result, 0, sizeof(result));
+            fillScanResult(ap, &result);
+            found->push_back(result);
+        }
+    }
+    mEpnoReported = seen;
+
+    if (!found->empty() && mEpnoHandler.on_network_found != NULL) {
+        mStats.epno_events++;
+        wifi_epno_handler handler = mEpnoHandler;
+        wifi_request_id id = mEpnoId;
+        mDeliveries.push_back([handler, id, found] {
+            handler.on_network_found(id, found->size(), found->data());
+        });
+    }
+}
+
+int VirtualRadio::apForBssid(const mac_addr bssid) const {
+    if (memcmp(bssid, kBssidPrefix, sizeof(kBssidPrefix)) != 0) {
+        return -1;
+    }
+    int index = (bssid[4] << 8) | bssid[5];
+    return index < (int) mAps.size() ? index : -1;
+}
+
+void VirtualRadio::rtt(const Event& event) {
+    std::map<wifi_request_id, RttRequest>::iterator it = mRttRequests.find(event.arg);
+    if (it == mRttRequests.end() || it->second.generation != event.generation) {
+        return;
+    }
+    RttRequest& request = it->second;
+
+    size_t end = std::min(request.next + mScenario.rtt_burst_size, request.configs.size());
+    std::shared_ptr<RttBurst> burst = std::make_shared<RttBurst>();
+    burst->results.resize(end - request.next);
+    burst->elements.resize(2 * burst->results.size());
+    for (size_t i = 0; i < burst->results.size(); i++) {
+        const wifi_rtt_config& config = request.configs[request.next + i];
+        wifi_rtt_result& result = burst->results[i];
+        memset(&result, 0, sizeof(result));
+        memcpy(result.addr, config.addr, sizeof(mac_addr));
+        result.burst_num = 1;
+        result.type = config.type;
+        result.ts = simNow();
+        result.burst_duration = config.burst_duration;
+        result.negotiated_burst_num = std::max(config.num_burst, 1u);
+
+        int index = apForBssid(config.addr);
+        if (index < 0 || mAps[index].rssi < mScenario.sensitivity_dbm) {
+            result.status = RTT_STATUS_FAIL_NO_RSP;
+            continue;
+        }
+
+        const SimAp& ap = mAps[index];
+        double distance_m = std::max(distance(ap) + 0.5 * mNormal(mRandom), 0.0);
+        unsigned frames = std::max(config.num_frames_per_burst, 1u);
+        result.status = RTT_STATUS_SUCCESS;
+        result.measurement_number = frames;
+        result.success_number = frames;
+        result.number_per_burst_peer = frames;
+        result.rssi = ap.rssi;
+        result.rssi_spread = 2;
+        result.tx_rate.bitrate = 65000;
+        result.rx_rate.bitrate = 65000;
+        result.rtt = (wifi_timespan) (2 * distance_m / kSpeedOfLight * 1e12);
+        result.rtt_sd = 1000;
+        result.rtt_spread = 2000;
+        result.distance_mm = (int) (distance_m * 1000);
+        result.distance_sd_mm = 500;
+        result.distance_spread_mm = 1000;
+
+        if (config.LCI_request) {
+            std::vector<byte>& lci = burst->elements[2 * i];
+            lci.assign(sizeof(wifi_information_element) + 16, 0);
+            result.LCI = (wifi_information_element *) lci.data();
+            result.LCI->id = 8;
+            result.LCI->len = 16;
+        }
+        if (config.LCR_request) {
+            std::vector<byte>& lcr = burst->elements[2 * i + 1];
+            lcr.assign(sizeof(wifi_information_element) + 8, 0);
+            result.LCR = (wifi_information_element *) lcr.data();
+            result.LCR->id = 11;
+            result.LCR->len = 8;
+        }
+    }
+    for (size_t i = 0; i < burst->results.size(); i++) {
+        burst->ptrs.push_back(&burst->results[i]);
+    }
+    mStats.rtt_results += burst->results.size();
+
+    wifi_rtt_event_handler handler = request.handler;
+    wifi_request_id id = event.arg;
+    mDeliveries.push_back([handler, id, burst] {
+        handler.on_rtt_results(id, burst->ptrs.size(), burst->ptrs.data());
+    });
+
+    request.next = end;
+    if (request.next < request.configs.size()) {
+        schedule(EVENT_RTT, mScenario.rtt_latency_ms * 1000LL, request.generation, event.arg);
+    } else {
+        mRttRequests.erase(it);
+    }
+}
+
+int VirtualRadio::findRing(const char *name) const {
+    for (size_t i = 0; i < mRings.size(); i++) {
+        if (strncmp((const char *) mRings[i].status.name, name,
+                sizeof(mRings[i].status.name)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void VirtualRadio::ringRecord(const Event& event) {
+    Ring& ring = mRings[event.arg];
+    if (event.generation != ring.generation || ring.status.verbose_level == 0) {
+        return;
+    }
+    schedule(EVENT_RING_RECORD, (int64_t) (1e6 / mScenario.ring_records_per_sec),
+            ring.generation, event.arg);
+    if (!mLogHandlerSet) {
+        return;
+    }
+
+    size_t record_size = sizeof(wifi_ring_buffer_entry) + mScenario.ring_record_size;
+    if (ring.pending.size() + record_size > ring.status.ring_buffer_byte_size) {
+        ringFlush(event.arg);
+    }
+
+    wifi_ring_buffer_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.entry_size = mScenario.ring_record_size;
+    entry.type = 1;
+    entry.timestamp = simNow();
+    const char *header = (const char *) &entry;
+    ring.pending.insert(ring.pending.end(), header, header + sizeof(entry));
+    ring.pending.insert(ring.pending.end(), mScenario.ring_record_size,
+            (char) ring.status.written_records);
+    ring.status.written_bytes += record_size;
+    ring.status.written_records++;
+
+    u32 threshold = ring.min_data_size > 0 ? ring.min_data_size
+            : (u32) mScenario.ring_flush_bytes;
+    bool interval_elapsed = ring.max_interval_sec > 0
+            && simNow() - ring.last_flush_us >= ring.max_interval_sec * 1000000LL;
+    if (ring.pending.size() >= threshold || interval_elapsed) {
+        ringFlush(event.arg);
+    }
+}
+
+void VirtualRadio::ringFlush(int index) {
+    Ring& ring = mRings[index];
+    ring.last_flush_us = simNow();
+    if (!mLogHandlerSet || ring.pending.size() <= sizeof(wifi_ring_buffer_entry)) {
+        return;
+    }
+
+    ring.status.read_bytes += ring.pending.size();
+    mStats.ring_buffer_events++;
+    mStats.ring_buffer_bytes += ring.pending.size();
+
+    std::shared_ptr<std::vector<char> > data = std::make_shared<std::vector<char> >();
+    data->swap(ring.pending);
+    std::shared_ptr<std::vector<char> > name = std::make_shared<std::vector<char> >(
+            ring.status.name, ring.status.name + sizeof(ring.status.name));
+    wifi_ring_buffer_status status = ring.status;
+    wifi_ring_buffer_data_handler handler = mLogHandler;
+    mDeliveries.push_back([handler, name, data, status]() mutable {
+        handler.on_ring_buffer_data(name->data(), data->data(), data->size(), &status);
+    });
+}
+
+/* ------------------------------------------------------------------------- */
+/* HAL entry points */
+
+wifi_error VirtualRadio::getSupportedFeatureSet(feature_set *set) {
+    *set = WIFI_FEATURE_INFRA | WIFI_FEATURE_INFRA_5G | WIFI_FEATURE_GSCAN
+            | WIFI_FEATURE_D2AP_RTT | WIFI_FEATURE_LINK_LAYER_STATS | WIFI_FEATURE_LOGGER
+            | WIFI_FEATURE_HAL_EPNO | WIFI_FEATURE_RSSI_MONITOR;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::getGscanCapabilities(wifi_gscan_capabilities *capabilities) {
+    memset(capabilities, 0, sizeof(*capabilities));
+    capabilities->max_scan_cache_size = kMaxCachedScans * MAX_AP_CACHE_PER_SCAN;
+    capabilities->max_scan_buckets = MAX_BUCKETS;
+    capabilities->max_ap_cache_per_scan = MAX_AP_CACHE_PER_SCAN;
+    capabilities->max_rssi_sample_size = kMaxRssiSamples;
+    capabilities->max_scan_reporting_threshold = 100;
+    capabilities->max_hotlist_bssids = MAX_HOTLIST_APS;
+    capabilities->max_hotlist_ssids = MAX_HOTLIST_SSID;
+    capabilities->max_significant_wifi_change_aps = MAX_SIGNIFICANT_CHANGE_APS;
+    capabilities->max_bssid_history_entries = kMaxCachedScans * MAX_AP_CACHE_PER_SCAN;
+    capabilities->max_number_epno_networks = MAX_EPNO_NETWORKS;
+    capabilities->max_number_epno_networks_by_ssid = MAX_EPNO_NETWORKS;
+    capabilities->max_number_of_white_listed_ssid = MAX_WHITELIST_SSID;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::startGscan(wifi_request_id id, const wifi_scan_cmd_params& params,
+        wifi_scan_result_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mScanning = true;
+    mScanGeneration++;
+    mScanId = id;
+    mScanParams = params;
+    mScanHandler = handler;
+    mScanCount = 0;
+    mScansSinceReport = 0;
+    schedule(EVENT_SCAN, 0, mScanGeneration, 0);
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::stopGscan(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mScanning = false;
+    mScanGeneration++;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::getCachedGscanResults(byte flush, int max,
+        wifi_cached_scan_results *results, int *num) {
+    std::lock_guard<std::mutex> lock(mLock);
+    int n = std::min(max, (int) mCachedScans.size());
+    size_t first = mCachedScans.size() - n;
+    for (int i = 0; i < n; i++) {
+        results[i] = mCachedScans[first + i];
+    }
+    *num = n;
+    if (flush) {
+        mCachedScans.clear();
+    }
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::setBssidHotlist(wifi_request_id id,
+        const wifi_bssid_hotlist_params& params, wifi_hotlist_ap_found_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mHotlist.clear();
+    for (int i = 0; i < params.num_bssid && i < MAX_HOTLIST_APS; i++) {
+        HotlistEntry entry;
+        entry.ap = apForBssid(params.ap[i].bssid);
+        entry.low = params.ap[i].low;
+        entry.found = false;
+        entry.misses = 0;
+        mHotlist.push_back(entry);
+    }
+    mHotlistActive = true;
+    mHotlistId = id;
+    mHotlistLostSamples = params.lost_ap_sample_size;
+    mHotlistHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::resetBssidHotlist(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mHotlistActive = false;
+    mHotlist.clear();
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::setSignificantChange(wifi_request_id id,
+        const wifi_significant_change_params& params, wifi_significant_change_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mChange.clear();
+    for (int i = 0; i < params.num_bssid && i < MAX_SIGNIFICANT_CHANGE_APS; i++) {
+        ChangeEntry entry;
+        entry.ap = apForBssid(params.ap[i].bssid);
+        entry.low = params.ap[i].low;
+        entry.high = params.ap[i].high;
+        entry.breached = false;
+        mChange.push_back(entry);
+    }
+    mChangeActive = true;
+    mChangeId = id;
+    mChangeSamples = params.rssi_sample_size;
+    mChangeMinBreaching = params.min_breaching;
+    mChangeHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::resetSignificantChange(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mChangeActive = false;
+    mChange.clear();
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::setEpnoList(wifi_request_id id, const wifi_epno_params *params,
+        wifi_epno_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEpnoMatch.assign(mAps.size(), false);
+    mEpnoReported.assign(mAps.size(), false);
+    for (size_t i = 0; i < mAps.size(); i++) {
+        for (int j = 0; j < params->num_networks && j < MAX_EPNO_NETWORKS; j++) {
+            if (strncmp(mAps[i].ssid, params->networks[j].ssid, sizeof(mAps[i].ssid)) == 0) {
+                mEpnoMatch[i] = true;
+                break;
+            }
+        }
+    }
+    mEpnoActive = true;
+    mEpnoId = id;
+    mEpnoMin24Rssi = params->min24GHz_rssi;
+    mEpnoMin5Rssi = params->min5GHz_rssi;
+    mEpnoHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::resetEpnoList(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEpnoActive = false;
+    return WIFI_SUCCESS;
+}
+
+/* delivered synchronously on the caller's thread, like most vendor HALs do */
+wifi_error VirtualRadio::getLinkStats(wifi_request_id id, wifi_stats_result_handler handler) {
+    wifi_iface_stat iface_stat;
+    wifi_radio_stat radio_stat;
+    u32 tx_time_per_levels[kTxPowerLevels];
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStats.link_stats_requests++;
+        int64_t now_ms = simNow() / 1000;
+
+        memset(&iface_stat, 0, sizeof(iface_stat));
+        if (mConnectedAp >= 0) {
+            const SimAp& ap = mAps[mConnectedAp];
+            iface_stat.info.state = 2;              /* WIFI_ASSOCIATED */
+            memcpy(iface_stat.info.ssid, ap.ssid, sizeof(iface_stat.info.ssid));
+            memcpy(iface_stat.info.bssid, ap.bssid, sizeof(iface_stat.info.bssid));
+            iface_stat.rssi_mgmt = ap.rssi;
+            iface_stat.rssi_data = ap.rssi;
+            iface_stat.rssi_ack = ap.rssi;
+        }
+        iface_stat.beacon_rx = now_ms / 100;
+        iface_stat.ac[WIFI_AC_BE].ac = WIFI_AC_BE;
+        iface_stat.ac[WIFI_AC_BE].tx_mpdu = (u32) mTxMpdu;
+        iface_stat.ac[WIFI_AC_BE].rx_mpdu = (u32) mRxMpdu;
+        iface_stat.ac[WIFI_AC_BE].mpdu_lost = (u32) mLostMpdu;
+        iface_stat.ac[WIFI_AC_BE].retries = (u32) mRetries;
+
+        memset(&radio_stat, 0, sizeof(radio_stat));
+        radio_stat.on_time = now_ms;
+        radio_stat.tx_time = now_ms / 20;
+        radio_stat.rx_time = now_ms / 10;
+        radio_stat.on_time_scan = mStats.scans * 120;
+        memcpy(tx_time_per_levels, mTxTimePerLevel, sizeof(tx_time_per_levels));
+        radio_stat.num_tx_levels = kTxPowerLevels;
+        radio_stat.tx_time_per_levels = tx_time_per_levels;
+    }
+    handler.on_link_stats_results(id, &iface_stat, 1, &radio_stat);
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::rttRangeRequest(wifi_request_id id, unsigned num_rtt_config,
+        wifi_rtt_config rtt_config[], wifi_rtt_event_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    RttRequest& request = mRttRequests[id];
+    request.configs.assign(rtt_config, rtt_config + num_rtt_config);
+    request.handler = handler;
+    request.next = 0;
+    request.generation = ++mRttGeneration;
+    schedule(EVENT_RTT, mScenario.rtt_latency_ms * 1000LL, request.generation, id);
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::rttRangeCancel(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mRttRequests.erase(id);
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::getRttCapabilities(wifi_rtt_capabilities *capabilities) {
+    memset(capabilities, 0, sizeof(*capabilities));
+    capabilities->rtt_one_sided_supported = 1;
+    capabilities->rtt_ftm_supported = 1;
+    capabilities->lci_support = 1;
+    capabilities->lcr_support = 1;
+    capabilities->preamble_support = WIFI_RTT_PREAMBLE_HT | WIFI_RTT_PREAMBLE_VHT;
+    capabilities->bw_support = WIFI_RTT_BW_20 | WIFI_RTT_BW_40 | WIFI_RTT_BW_80;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::startRssiMonitoring(wifi_request_id id, s8 max_rssi, s8 min_rssi,
+        wifi_rssi_event_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mRssiActive = true;
+    mRssiId = id;
+    mRssiMax = max_rssi;
+    mRssiMin = min_rssi;
+    mRssiInRange = true;
+    mRssiHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::stopRssiMonitoring(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mRssiActive = false;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::setLogHandler(wifi_request_id id,
+        wifi_ring_buffer_data_handler handler) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mLogHandlerSet = true;
+    mLogHandler = handler;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::resetLogHandler(wifi_request_id id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mLogHandlerSet = false;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::startLogging(u32 verbose_level, u32 flags, u32 max_interval_sec,
+        u32 min_data_size, const char *ring_name) {
+    std::lock_guard<std::mutex> lock(mLock);
+    int index = findRing(ring_name);
+    if (index < 0) {
+        if ((int) mRings.size() == kMaxRings) {
+            return WIFI_ERROR_TOO_MANY_REQUESTS;
+        }
+        Ring ring;
+        memset(&ring.status, 0, sizeof(ring.status));
+        strncpy((char *) ring.status.name, ring_name, sizeof(ring.status.name) - 1);
+        ring.status.ring_id = mRings.size();
+        ring.status.ring_buffer_byte_size = kRingBufferSize;
+        ring.max_interval_sec = 0;
+        ring.min_data_size = 0;
+        ring.last_flush_us = simNow();
+        ring.generation = 0;
+        mRings.push_back(ring);
+        index = mRings.size() - 1;
+    }
+
+    Ring& ring = mRings[index];
+    bool was_active = ring.status.verbose_level != 0;
+    ring.status.flags = flags;
+    ring.status.verbose_level = verbose_level;
+    ring.max_interval_sec = max_interval_sec;
+    ring.min_data_size = min_data_size;
+    if (verbose_level == 0) {
+        ring.generation++;
+        ring.pending.clear();
+    } else if (!was_active && mScenario.ring_records_per_sec > 0) {
+        ring.generation++;
+        schedule(EVENT_RING_RECORD, 0, ring.generation, index);
+    }
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::getRingBuffersStatus(u32 *num_rings,
+        wifi_ring_buffer_status *status) {
+    std::lock_guard<std::mutex> lock(mLock);
+    u32 n = std::min(*num_rings, (u32) mRings.size());
+    for (u32 i = 0; i < n; i++) {
+        status[i] = mRings[i].status;
+    }
+    *num_rings = n;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::getLoggerSupportedFeatureSet(unsigned int *support) {
+    *support = WIFI_LOGGER_CONNECT_EVENT_SUPPORTED | WIFI_LOGGER_POWER_EVENT_SUPPORTED
+            | WIFI_LOGGER_WAKE_LOCK_SUPPORTED | WIFI_LOGGER_VERBOSE_SUPPORTED;
+    return WIFI_SUCCESS;
+}
+
+wifi_error VirtualRadio::getRingData(const char *ring_name) {
+    std::lock_guard<std::mutex> lock(mLock);
+    int index = findRing(ring_name);
+    if (index < 0) {
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+    schedule(EVENT_RING_FLUSH, 0, 0, index);
+    return WIFI_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/* HAL function table */
+
+VirtualRadio *sRadio;
+wifi_hal_fn *sFn;
+wifi_hal_fn sSavedFn;
+
+wifi_error vr_get_supported_feature_set(wifi_interface_handle iface, feature_set *set) {
+    return sRadio->getSupportedFeatureSet(set);
+}
+
+wifi_error vr_get_gscan_capabilities(wifi_interface_handle iface,
+        wifi_gscan_capabilities *capabilities) {
+    return sRadio->getGscanCapabilities(capabilities);
+}
+
+wifi_error vr_start_gscan(wifi_request_id id, wifi_interface_handle iface,
+        wifi_scan_cmd_params params, wifi_scan_result_handler handler) {
+    return sRadio->startGscan(id, params, handler);
+}
+
+wifi_error vr_stop_gscan(wifi_request_id id, wifi_interface_handle iface) {
+    return sRadio->stopGscan(id);
+}
+
+wifi_error vr_get_cached_gscan_results(wifi_interface_handle iface, byte flush, int max,
+        wifi_cached_scan_results *results, int *num) {
+    return sRadio->getCachedGscanResults(flush, max, results, num);
+}
+
+wifi_error vr_set_bssid_hotlist(wifi_request_id id, wifi_interface_handle iface,
+        wifi_bssid_hotlist_params params, wifi_hotlist_ap_found_handler handler) {
+    return sRadio->setBssidHotlist(id, params, handler);
+}
+
+wifi_error vr_reset_bssid_hotlist(wifi_request_id id, wifi_interface_handle iface) {
+    return sRadio->resetBssidHotlist(id);
+}
+
+wifi_error vr_set_significant_change_handler(wifi_request_id id, wifi_interface_handle iface,
+        wifi_significant_change_params params, wifi_significant_change_handler handler) {
+    return sRadio->setSignificantChange(id, params, handler);
+}
+
+wifi_error vr_reset_significant_change_handler(wifi_request_id id,
+        wifi_interface_handle iface) {
+    return sRadio->resetSignificantChange(id);
+}
+
+wifi_error vr_set_epno_list(wifi_request_id id, wifi_interface_handle iface,
+        const wifi_epno_params *params, wifi_epno_handler handler) {
+    return sRadio->setEpnoList(id, params, handler);
+}
+
+wifi_error vr_reset_epno_list(wifi_request_id id, wifi_interface_handle iface) {
+    return sRadio->resetEpnoList(id);
+}
+
+wifi_error vr_get_link_stats(wifi_request_id id, wifi_interface_handle iface,
+        wifi_stats_result_handler handler) {
+    return sRadio->getLinkStats(id, handler);
+}
+
+wifi_error vr_rtt_range_request(wifi_request_id id, wifi_interface_handle iface,
+        unsigned num_rtt_config, wifi_rtt_config rtt_config[], wifi_rtt_event_handler handler) {
+    return sRadio->rttRangeRequest(id, num_rtt_config, rtt_config, handler);
+}
+
+wifi_error vr_rtt_range_cancel(wifi_request_id id, wifi_interface_handle iface,
+        unsigned num_devices, mac_addr addr[]) {
+    return sRadio->rttRangeCancel(id);
+}
+
+wifi_error vr_get_rtt_capabilities(wifi_interface_handle iface,
+        wifi_rtt_capabilities *capabilities) {
+    return sRadio->getRttCapabilities(capabilities);
+}
+
+wifi_error vr_start_rssi_monitoring(wifi_request_id id, wifi_interface_handle iface,
+        s8 max_rssi, s8 min_rssi, wifi_rssi_event_handler handler) {
+    return sRadio->startRssiMonitoring(id, max_rssi, min_rssi, handler);
+}
+
+wifi_error vr_stop_rssi_monitoring(wifi_request_id id, wifi_interface_handle iface) {
+    return sRadio->stopRssiMonitoring(id);
+}
+
+wifi_error vr_set_log_handler(wifi_request_id id, wifi_interface_handle iface,
+        wifi_ring_buffer_data_handler handler) {
+    return sRadio->setLogHandler(id, handler);
+}
+
+wifi_error vr_reset_log_handler(wifi_request_id id, wifi_interface_handle iface) {
+    return sRadio->resetLogHandler(id);
+}
+
+wifi_error vr_start_logging(wifi_interface_handle iface, u32 verbose_level, u32 flags,
+        u32 max_interval_sec, u32 min_data_size, char *ring_name) {
+    return sRadio->startLogging(verbose_level, flags, max_interval_sec, min_data_size,
+            ring_name);
+}
+
+wifi_error vr_get_ring_buffers_status(wifi_interface_handle iface, u32 *num_rings,
+        wifi_ring_buffer_status *status) {
+    return sRadio->getRingBuffersStatus(num_rings, status);
+}
+
+wifi_error vr_get_logger_supported_feature_set(wifi_interface_handle iface,
+        unsigned int *support) {
+    return sRadio->getLoggerSupportedFeatureSet(support);
+}
+
+wifi_error vr_get_ring_data(wifi_interface_handle iface, char *ring_name) {
+    return sRadio->getRingData(ring_name);
+}
+
+/* entry points overlaid on the HAL table by virtual_radio_start */
+#define VIRTUAL_RADIO_ENTRY_POINTS(X) \
+    X(wifi_get_supported_feature_set, vr_get_supported_feature_set) \
+    X(wifi_get_gscan_capabilities, vr_get_gscan_capabilities) \
+    X(wifi_start_gscan, vr_start_gscan) \
+    X(wifi_stop_gscan, vr_stop_gscan) \
+    X(wifi_get_cached_gscan_results, vr_get_cached_gscan_results) \
+    X(wifi_set_bssid_hotlist, vr_set_bssid_hotlist) \
+    X(wifi_reset_bssid_hotlist, vr_reset_bssid_hotlist) \
+    X(wifi_set_significant_change_handler, vr_set_significant_change_handler) \
+    X(wifi_reset_significant_change_handler, vr_reset_significant_change_handler) \
+    X(wifi_set_epno_list, vr_set_epno_list) \
+    X(wifi_reset_epno_list, vr_reset_epno_list) \
+    X(wifi_get_link_stats, vr_get_link_stats) \
+    X(wifi_rtt_range_request, vr_rtt_range_request) \
+    X(wifi_rtt_range_cancel, vr_rtt_range_cancel) \
+    X(wifi_get_rtt_capabilities, vr_get_rtt_capabilities) \
+    X(wifi_start_rssi_monitoring, vr_start_rssi_monitoring) \
+    X(wifi_stop_rssi_monitoring, vr_stop_rssi_monitoring) \
+    X(wifi_set_log_handler, vr_set_log_handler) \
+    X(wifi_reset_log_handler, vr_reset_log_handler) \
+    X(wifi_start_logging, vr_start_logging) \
+    X(wifi_get_ring_buffers_status, vr_get_ring_buffers_status) \
+    X(wifi_get_logger_supported_feature_set, vr_get_logger_supported_feature_set) \
+    X(wifi_get_ring_data, vr_get_ring_data)
+
+/* scenario keys are the field names of virtual_radio_scenario */
+enum ScenarioKeyType { KEY_INT, KEY_UNSIGNED, KEY_DOUBLE };
+
+struct ScenarioKey {
+    const char *name;
+    ScenarioKeyType type;
+    size_t offset;
+};
+
+#define SCENARIO_KEY(type, field) { #field, type, offsetof(virtual_radio_scenario, field) }
+
+const ScenarioKey kScenarioKeys[] = {
+    SCENARIO_KEY(KEY_UNSIGNED, seed),
+    SCENARIO_KEY(KEY_INT, num_aps),
+    SCENARIO_KEY(KEY_INT, num_ssids),
+    SCENARIO_KEY(KEY_DOUBLE, area_m),
+    SCENARIO_KEY(KEY_DOUBLE, ap_speed_mps),
+    SCENARIO_KEY(KEY_DOUBLE, device_speed_mps),
+    SCENARIO_KEY(KEY_DOUBLE, tx_power_dbm),
+    SCENARIO_KEY(KEY_DOUBLE, path_loss_exponent),
+    SCENARIO_KEY(KEY_DOUBLE, fading_sigma_db),
+    SCENARIO_KEY(KEY_DOUBLE, fading_coherence),
+    SCENARIO_KEY(KEY_INT, sensitivity_dbm),
+    SCENARIO_KEY(KEY_INT, tick_ms),
+    SCENARIO_KEY(KEY_DOUBLE, rate_multiplier),
+    SCENARIO_KEY(KEY_INT, rtt_latency_ms),
+    SCENARIO_KEY(KEY_INT, rtt_burst_size),
+    SCENARIO_KEY(KEY_DOUBLE, ring_records_per_sec),
+    SCENARIO_KEY(KEY_INT, ring_record_size),
+    SCENARIO_KEY(KEY_INT, ring_flush_bytes),
+};
+
+#undef SCENARIO_KEY
+
+bool parseScenarioPair(const char *pair, virtual_radio_scenario *scenario) {
+    const char *equals = strchr(pair, '=');
+    if (equals == NULL) {
+        return false;
+    }
+    std::string key(pair, equals - pair);
+    const char *value = equals + 1;
+    char *end = NULL;
+
+    for (size_t i = 0; i < sizeof(kScenarioKeys) / sizeof(kScenarioKeys[0]); i++) {
+        if (key != kScenarioKeys[i].name) {
+            continue;
+        }
+        char *field = (char *) scenario + kScenarioKeys[i].offset;
+        switch (kScenarioKeys[i].type) {
+            case KEY_INT:
+                *(int *) field = (int) strtol(value, &end, 0);
+                break;
+            case KEY_UNSIGNED:
+                *(unsigned *) field = (unsigned) strtoul(value, &end, 0);
+                break;
+            case KEY_DOUBLE:
+                *(double *) field = strtod(value, &end);
+                break;
+        }
+        return end != value && *end == 0;
+    }
+    return false;
+}
+
+}  // namespace
+
+void virtual_radio_default_scenario(virtual_radio_scenario *scenario) {
+    memset(scenario, 0, sizeof(*scenario));
+    scenario->seed = 1;
+    scenario->num_aps = 64;
+    scenario->num_ssids = 8;
+    scenario->area_m = 200;
+    scenario->ap_speed_mps = 0;
+    scenario->device_speed_mps = 1.4;
+    scenario->tx_power_dbm = -35;
+    scenario->path_loss_exponent = 3.0;
+    scenario->fading_sigma_db = 4;
+    scenario->fading_coherence = 0.9;
+    scenario->sensitivity_dbm = -90;
+    scenario->tick_ms = 100;
+    scenario->rate_multiplier = 1;
+    scenario->rtt_latency_ms = 50;
+    scenario->rtt_burst_size = 8;
+    scenario->ring_records_per_sec = 20;
+    scenario->ring_record_size = 64;
+    scenario->ring_flush_bytes = 1024;
+}
+
+bool virtual_radio_parse_scenario(const char *spec, virtual_radio_scenario *scenario) {
+    std::string copy(spec);
+    char *saveptr = NULL;
+    for (char *pair = strtok_r(&copy[0], " ,\t\n", &saveptr); pair != NULL;
+            pair = strtok_r(NULL, " ,\t\n", &saveptr)) {
+        if (!parseScenarioPair(pair, scenario)) {
+            ALOGE("bad scenario entry '%s'", pair);
+            return false;
+        }
+    }
+    return true;
+}
+
+wifi_error virtual_radio_start(wifi_hal_fn *fn, const virtual_radio_scenario *scenario) {
+    if (sRadio != NULL) {
+        return WIFI_ERROR_BUSY;
+    }
+    if (scenario->num_aps < 0 || scenario->num_aps > 0x10000) {
+        return WIFI_ERROR_INVALID_ARGS;
+    }
+
+    sRadio = new VirtualRadio(*scenario);
+    sFn = fn;
+#define OVERLAY_ENTRY_POINT(field, impl) \
+    sSavedFn.field = fn->field; \
+    fn->field = impl;
+    VIRTUAL_RADIO_ENTRY_POINTS(OVERLAY_ENTRY_POINT)
+#undef OVERLAY_ENTRY_POINT
+
+    sRadio->start();
+    return WIFI_SUCCESS;
+}
+
+/* restores the overlaid entry points; the bridge must not be mid-call */
+void virtual_radio_stop() {
+    if (sRadio == NULL) {
+        return;
+    }
+    sRadio->stop();
+#define RESTORE_ENTRY_POINT(field, impl) \
+    sFn->field = sSavedFn.field;
+    VIRTUAL_RADIO_ENTRY_POINTS(RESTORE_ENTRY_POINT)
+#undef RESTORE_ENTRY_POINT
+    delete sRadio;
+    sRadio = NULL;
+    sFn = NULL;
+}
+
+void virtual_radio_pause() {
+    if (sRadio != NULL) {
+        sRadio->pause();
+    }
+}
+
+void virtual_radio_resume() {
+    if (sRadio != NULL) {
+        sRadio->resume();
+    }
+}
+
+void virtual_radio_get_stats(virtual_radio_stats *stats) {
+    if (sRadio != NULL) {
+        sRadio->getStats(stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+void virtual_radio_get_ap_bssid(int index, mac_addr bssid) {
+    memcpy(bssid, kBssidPrefix, sizeof(kBssidPrefix));
+    bssid[4] = (byte) (index >> 8);
+    bssid[5] = (byte) index;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WIFI_VIRTUAL_RADIO_H__
+#define __WIFI_VIRTUAL_RADIO_H__
+
+#include <stdint.h>
+
+#include "wifi_hal.h"
+
+/*
+ * Virtual radio: a simulated HAL for load and soak testing the JNI bridge on
+ * the host. A scenario places APs around the device, moves the device (and
+ * optionally the APs) and fades their RSSI. Gscan, full scan results, hotlist,
+ * significant change, ePNO, link layer stats, RTT, RSSI monitoring and ring
+ * buffer logging are all derived from that world and delivered from the
+ * radio's own event loop thread, the way a vendor HAL delivers them from its
+ * netlink thread.
+ *
+ * Simulated time runs rate_multiplier times faster than the wall clock, so a
+ * multiplier of 10 replays a scenario at 10x its production event rates.
+ */
+
+#define VIRTUAL_RADIO_SSID_FORMAT "virtual-radio-%d"    /* SSID of AP i is i % num_ssids */
+
+typedef struct {
+    unsigned seed;
+
+    /* world */
+    int num_aps;
+    int num_ssids;
+    double area_m;                  /* APs are placed in an area_m x area_m square */
+    double ap_speed_mps;            /* 0 keeps the APs fixed */
+    double device_speed_mps;        /* the device walks between random waypoints */
+    double tx_power_dbm;            /* RSSI at 1 m */
+    double path_loss_exponent;
+    double fading_sigma_db;         /* std dev of the log-normal shadowing */
+    double fading_coherence;        /* correlation of the shadowing between ticks, 0..1 */
+    int sensitivity_dbm;            /* scans do not see APs below this RSSI */
+    int tick_ms;                    /* mobility and fading update period */
+
+    /* event sources */
+    double rate_multiplier;
+    int rtt_latency_ms;             /* delay before each burst of RTT results */
+    int rtt_burst_size;             /* results per on_rtt_results callback */
+    double ring_records_per_sec;    /* per active ring */
+    int ring_record_size;           /* payload bytes per ring buffer record */
+    int ring_flush_bytes;           /* buffered bytes that trigger on_ring_buffer_data */
+} virtual_radio_scenario;
+
+typedef struct {
+    uint64_t scans;
+    uint64_t full_scan_results;
+    uint64_t scan_events;
+    uint64_t hotlist_events;
+    uint64_t significant_change_events;
+    uint64_t epno_events;
+    uint64_t rtt_results;
+    uint64_t rssi_breaches;
+    uint64_t ring_buffer_events;
+    uint64_t ring_buffer_bytes;
+    uint64_t link_stats_requests;
+    int64_t max_delivery_lag_us;    /* worst delay between an event's due time and delivery */
+} virtual_radio_stats;
+
+void virtual_radio_default_scenario(virtual_radio_scenario *scenario);
+
+/* applies "key=value" pairs separated by spaces or commas; returns false on a bad pair */
+bool virtual_radio_parse_scenario(const char *spec, virtual_radio_scenario *scenario);
+
+/* overlays the virtual radio's entry points on fn and starts its event loop thread */
+wifi_error virtual_radio_start(wifi_hal_fn *fn, const virtual_radio_scenario *scenario);
+void virtual_radio_stop();
+
+/*
+ * Holds the event loop between deliveries, e.g. while the fake VM is collected.
+ * Simulated time does not advance while the radio is paused.
+ */
+void virtual_radio_pause();
+void virtual_radio_resume();
+
+void virtual_radio_get_stats(virtual_radio_stats *stats);
+void virtual_radio_get_ap_bssid(int index, mac_addr bssid);
+
+#endif //__WIFI_VIRTUAL_RADIO_H__
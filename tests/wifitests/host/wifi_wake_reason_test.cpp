@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "wifi-wake-reason-test"
+
+#include "jni.h"
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "wifi_host_test.h"
+
+/*
+ * The wake reason history: pollWakeReasonsNative() turns the driver's cumulative counters into
+ * per interval deltas, and getTopWakeReasonsNative() sums them over a window, with the time the
+ * window covers, and ranks the reasons.
+ */
+
+namespace android {
+
+typedef jint (*PollWakeReasonsFn)(JNIEnv *, jclass, jint);
+typedef jintArray (*GetTopWakeReasonsFn)(JNIEnv *, jclass, jlong, jint);
+
+/* as in WifiNative.java */
+static const int kTopTotal = 0;
+static const int kTopCoveredMs = 1;
+static const int kTopHeaderSize = 2;
+static const int kCategoryCmdEvent = 0;
+static const int kCategoryDriverFwLocal = 1;
+static const int kCategoryRx = 2;
+static const int kRxUnicast = 0;
+static const int kRxIcmp6Ra = 5;
+
+static const int kReasons = 8;
+static const jlong kWindowMs = 60 * 60 * 1000;
+/* more than the history keeps */
+static const int kQuietPolls = 200;
+
+static int sCmd[kReasons];
+static int sLocal[kReasons];
+static u32 sRxUnicast;
+static u32 sIcmp6Ra;
+static wifi_error sPollResult;
+static int sPolls;
+
+static wifi_error test_get_wake_reason_stats(wifi_interface_handle iface,
+        WLAN_DRIVER_WAKE_REASON_CNT *cnt) {
+    sPolls++;
+    if (sPollResult != WIFI_SUCCESS) {
+        return sPollResult;
+    }
+
+    cnt->total_cmd_event_wake = 0;
+    for (int i = 0; i < kReasons && i < cnt->cmd_event_wake_cnt_sz; i++) {
+        cnt->cmd_event_wake_cnt[i] = sCmd[i];
+        cnt->total_cmd_event_wake += sCmd[i];
+    }
+    cnt->cmd_event_wake_cnt_used = kReasons;
+    cnt->total_driver_fw_local_wake = 0;
+    for (int i = 0; i < kReasons && i < cnt->driver_fw_local_wake_cnt_sz; i++) {
+        cnt->driver_fw_local_wake_cnt[i] = sLocal[i];
+        cnt->total_driver_fw_local_wake += sLocal[i];
+    }
+    cnt->driver_fw_local_wake_cnt_used = kReasons;
+    cnt->rx_wake_details.rx_unicast_cnt = sRxUnicast;
+    cnt->rx_wake_pkt_classification_info.icmp6_ra = sIcmp6Ra;
+    cnt->total_rx_data_wake = sRxUnicast;
+    return WIFI_SUCCESS;
+}
+
+struct wake_entry {
+    int category;
+    int index;
+    int count;
+};
+
+class WifiWakeReasonTest : public WifiHostTest {
+protected:
+    void SetUp() override {
+        WifiHostTest::SetUp();
+        resetBridgeState();
+        memset(sCmd, 0, sizeof(sCmd));
+        memset(sLocal, 0, sizeof(sLocal));
+        sRxUnicast = 0;
+        sIcmp6Ra = 0;
+        sPollResult = WIFI_SUCCESS;
+        sPolls = 0;
+    }
+
+    void installHal() override {
+        hal_fn.wifi_get_wake_reason_stats = test_get_wake_reason_stats;
+    }
+
+    jint poll() {
+        return native<PollWakeReasonsFn>("pollWakeReasonsNative")(env(), cls(), iface());
+    }
+
+    std::vector<jint> top(int n) {
+        jintArray array = native<GetTopWakeReasonsFn>("getTopWakeReasonsNative")(env(), cls(),
+                kWindowMs, n);
+        std::vector<jint> values;
+        if (array == NULL) {
+            return values;
+        }
+        values.resize(env()->GetArrayLength(array));
+        env()->GetIntArrayRegion(array, 0, values.size(), values.data());
+        env()->DeleteLocalRef(array);
+        return values;
+    }
+
+    std::vector<wake_entry> entries(const std::vector<jint>& top) {
+        std::vector<wake_entry> result;
+        EXPECT_EQ(0U, (top.size() - kTopHeaderSize) % 3);
+        for (size_t i = kTopHeaderSize; i + 3 <= top.size(); i += 3) {
+            result.push_back({ top[i], top[i + 1], top[i + 2] });
+        }
+        return result;
+    }
+};
+
+TEST_F(WifiWakeReasonTest, FirstPollIsBaseline) {
+    sCmd[3] = 100;
+    sRxUnicast = 40;
+    EXPECT_EQ(WIFI_SUCCESS, poll());
+    EXPECT_EQ(1, sPolls);
+
+    std::vector<jint> values = top(10);
+    ASSERT_EQ((size_t) kTopHeaderSize, values.size());
+    EXPECT_EQ(0, values[kTopTotal]);
+    EXPECT_EQ(0, values[kTopCoveredMs]);
+}
+
+TEST_F(WifiWakeReasonTest, DeltasRanked) {
+    sCmd[3] = 100;
+    sLocal[1] = 10;
+    sRxUnicast = 40;
+    sIcmp6Ra = 3;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+
+    usleep(20 * 1000);
+    sCmd[3] += 5;
+    sLocal[1] += 2;
+    sRxUnicast += 7;
+    sIcmp6Ra += 1;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+
+    std::vector<jint> values = top(10);
+    ASSERT_GE(values.size(), (size_t) kTopHeaderSize);
+    EXPECT_EQ(5 + 2 + 7, values[kTopTotal]);
+    EXPECT_GE(values[kTopCoveredMs], 20);
+    EXPECT_LT(values[kTopCoveredMs], kWindowMs);
+
+    std::vector<wake_entry> ranked = entries(values);
+    ASSERT_EQ(4U, ranked.size());
+    EXPECT_EQ(kCategoryRx, ranked[0].category);
+    EXPECT_EQ(kRxUnicast, ranked[0].index);
+    EXPECT_EQ(7, ranked[0].count);
+    EXPECT_EQ(kCategoryCmdEvent, ranked[1].category);
+    EXPECT_EQ(3, ranked[1].index);
+    EXPECT_EQ(5, ranked[1].count);
+    EXPECT_EQ(kCategoryDriverFwLocal, ranked[2].category);
+    EXPECT_EQ(1, ranked[2].index);
+    EXPECT_EQ(2, ranked[2].count);
+    EXPECT_EQ(kCategoryRx, ranked[3].category);
+    EXPECT_EQ(kRxIcmp6Ra, ranked[3].index);
+    EXPECT_EQ(1, ranked[3].count);
+
+    /* only the top n, but the total of every reason */
+    values = top(2);
+    ASSERT_EQ((size_t) kTopHeaderSize + 2 * 3, values.size());
+    EXPECT_EQ(5 + 2 + 7, values[kTopTotal]);
+    EXPECT_EQ(7, entries(values)[0].count);
+    EXPECT_EQ(5, entries(values)[1].count);
+}
+
+TEST_F(WifiWakeReasonTest, DeltasSumAcrossPolls) {
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    for (int i = 1; i <= 4; i++) {
+        sCmd[0] += i;
+        ASSERT_EQ(WIFI_SUCCESS, poll());
+    }
+
+    std::vector<jint> values = top(10);
+    EXPECT_EQ(1 + 2 + 3 + 4, values[kTopTotal]);
+    std::vector<wake_entry> ranked = entries(values);
+    ASSERT_EQ(1U, ranked.size());
+    EXPECT_EQ(kCategoryCmdEvent, ranked[0].category);
+    EXPECT_EQ(0, ranked[0].index);
+    EXPECT_EQ(1 + 2 + 3 + 4, ranked[0].count);
+}
+
+TEST_F(WifiWakeReasonTest, CounterResetCountsAll) {
+    sCmd[2] = 50;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+
+    /* the driver was reloaded: its counters started over */
+    sCmd[2] = 4;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+
+    std::vector<wake_entry> ranked = entries(top(10));
+    ASSERT_EQ(1U, ranked.size());
+    EXPECT_EQ(2, ranked[0].index);
+    EXPECT_EQ(4, ranked[0].count);
+}
+
+TEST_F(WifiWakeReasonTest, QuietIntervalsMerge) {
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    sLocal[5] = 1;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+
+    /* one bucket each, these would push the wake out of the history */
+    for (int i = 0; i < kQuietPolls; i++) {
+        ASSERT_EQ(WIFI_SUCCESS, poll());
+    }
+
+    std::vector<jint> values = top(10);
+    EXPECT_EQ(1, values[kTopTotal]);
+    std::vector<wake_entry> ranked = entries(values);
+    ASSERT_EQ(1U, ranked.size());
+    EXPECT_EQ(kCategoryDriverFwLocal, ranked[0].category);
+    EXPECT_EQ(5, ranked[0].index);
+}
+
+TEST_F(WifiWakeReasonTest, FailedPollKeepsBaseline) {
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    sCmd[1] = 3;
+    sPollResult = WIFI_ERROR_UNKNOWN;
+    EXPECT_EQ(WIFI_ERROR_UNKNOWN, poll());
+    sPollResult = WIFI_ERROR_NOT_SUPPORTED;
+    EXPECT_EQ(WIFI_ERROR_NOT_SUPPORTED, poll());
+    EXPECT_EQ(0, top(10)[kTopTotal]);
+
+    /* the wakes are counted by the next successful poll */
+    sPollResult = WIFI_SUCCESS;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    EXPECT_EQ(3, top(10)[kTopTotal]);
+}
+
+TEST_F(WifiWakeReasonTest, CleanupResetsHistory) {
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    sCmd[0] = 6;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    EXPECT_EQ(6, top(10)[kTopTotal]);
+
+    restartHal();
+    EXPECT_EQ(0, top(10)[kTopTotal]);
+
+    /* the first poll after a restart is a new baseline */
+    sCmd[0] = 9;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    EXPECT_EQ(0, top(10)[kTopTotal]);
+    sCmd[0] = 10;
+    ASSERT_EQ(WIFI_SUCCESS, poll());
+    EXPECT_EQ(1, top(10)[kTopTotal]);
+}
+
+}  // namespace android
@@ -15,6 +15,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "JniConstants.h"
 #include <ScopedUtfChars.h>
 #include <ScopedBytes.h>
@@ -36,7 +37,7 @@
 
 namespace android {
 
-jobject mock_mObj; /* saved HalMock object (not class!) */
+jobject mock_mObj = NULL; /* saved HalMock object (not class!) */
 JavaVM* mock_mVM = NULL; /* saved JVM pointer */
 
 /* Variable and function declared and defined in:
@@ -169,6 +170,225 @@ void HalMockJsonReader::get_byte_array(const char* key, bool* error, u8* array,
   }
 }
 
+namespace hal_binary_tags {
+static constexpr const u8 magic[] = { 'H', 'M', 'B' };
+static constexpr const u8 version = 1;
+static constexpr const size_t header_len = sizeof(magic) + 1;
+
+static constexpr const u8 type_int = 1;
+static constexpr const u8 type_byte_array = 2;
+}
+
+HalMockBinaryWriter::HalMockBinaryWriter() {
+  buf.reserve(256);
+  buf.insert(buf.end(), hal_binary_tags::magic,
+             hal_binary_tags::magic + sizeof(hal_binary_tags::magic));
+  buf.push_back(hal_binary_tags::version);
+}
+
+void HalMockBinaryWriter::put_name(u8 type, const char* name) {
+  size_t name_len = strlen(name);
+  if (name_len > UINT8_MAX) {
+    ALOGE("put_name: name %s is too long", name);
+    name_len = UINT8_MAX;
+  }
+  buf.push_back(type);
+  buf.push_back((u8) name_len);
+  buf.insert(buf.end(), name, name + name_len);
+}
+
+void HalMockBinaryWriter::put_int(const char* name, int x) {
+  put_name(hal_binary_tags::type_int, name);
+  u32 v = (u32) x;
+  for (int i = 0; i < 4; ++i) {
+    buf.push_back((u8) (v >> (8 * i)));
+  }
+}
+
+void HalMockBinaryWriter::put_byte_array(const char* name, u8* byte_array,
+                                         int array_length) {
+  if (array_length < 0 || array_length > UINT16_MAX) {
+    ALOGE("put_byte_array: invalid length %d for %s", array_length, name);
+    array_length = 0;
+  }
+  put_name(hal_binary_tags::type_byte_array, name);
+  buf.push_back((u8) array_length);
+  buf.push_back((u8) (array_length >> 8));
+  buf.insert(buf.end(), byte_array, byte_array + array_length);
+}
+
+HalMockBinaryReader::HalMockBinaryReader(const u8* data, size_t len)
+    : next(0), valid(false) {
+  if (len < hal_binary_tags::header_len
+      || memcmp(data, hal_binary_tags::magic, sizeof(hal_binary_tags::magic))
+      || data[sizeof(hal_binary_tags::magic)] != hal_binary_tags::version) {
+    ALOGE("HalMockBinaryReader: bad header");
+    return;
+  }
+
+  size_t pos = hal_binary_tags::header_len;
+  while (pos < len) {
+    Field field;
+    if (len - pos < 2) {
+      ALOGE("HalMockBinaryReader: truncated field at %zu", pos);
+      return;
+    }
+    field.type = data[pos];
+    field.name_len = data[pos + 1];
+    pos += 2;
+    if (len - pos < field.name_len) {
+      ALOGE("HalMockBinaryReader: truncated name at %zu", pos);
+      return;
+    }
+    field.name = (const char*) data + pos;
+    pos += field.name_len;
+
+    if (field.type == hal_binary_tags::type_int) {
+      field.len = 4;
+    } else if (field.type == hal_binary_tags::type_byte_array) {
+      if (len - pos < 2) {
+        ALOGE("HalMockBinaryReader: truncated length at %zu", pos);
+        return;
+      }
+      field.len = data[pos] | (data[pos + 1] << 8);
+      pos += 2;
+    } else {
+      ALOGE("HalMockBinaryReader: unexpected type %d at %zu", field.type, pos);
+      return;
+    }
+    if (len - pos < field.len) {
+      ALOGE("HalMockBinaryReader: truncated value at %zu", pos);
+      return;
+    }
+    field.value = data + pos;
+    pos += field.len;
+    fields.push_back(field);
+  }
+  valid = true;
+}
+
+const HalMockBinaryReader::Field* HalMockBinaryReader::find(const char* key,
+                                                            u8 type,
+                                                            bool* error) {
+  if (!valid) {
+    *error = true;
+    return NULL;
+  }
+
+  size_t key_len = strlen(key);
+  for (size_t i = 0; i < fields.size(); ++i) {
+    size_t index = (next + i) % fields.size();
+    const Field& field = fields[index];
+    if (field.name_len == key_len && !memcmp(field.name, key, key_len)) {
+      if (field.type != type) {
+        *error = true;
+        ALOGE("find: unexpected type %d for the %s key", field.type, key);
+        return NULL;
+      }
+      next = index + 1;
+      return &field;
+    }
+  }
+
+  *error = true;
+  ALOGE("find: can't find %s key", key);
+  return NULL;
+}
+
+int HalMockBinaryReader::get_int(const char* key, bool* error) {
+  const Field* field = find(key, hal_binary_tags::type_int, error);
+  if (field == NULL) {
+    return 0;
+  }
+  const u8* v = field->value;
+  return (int) (v[0] | (v[1] << 8) | (v[2] << 16) | ((u32) v[3] << 24));
+}
+
+void HalMockBinaryReader::get_byte_array(const char* key, bool* error,
+                                         u8* array,
+                                         unsigned int max_array_size) {
+  const Field* field = find(key, hal_binary_tags::type_byte_array, error);
+  if (field == NULL) {
+    return;
+  }
+  if (field->len > max_array_size) {
+    *error = true;
+    ALOGE("get_byte_array: size of array (%zu) is larger than maximum "
+          "allocated (%d)",
+          field->len, max_array_size);
+    return;
+  }
+  memcpy(array, field->value, field->len);
+}
+
+bool hal_mock_args_json = false;
+
+HalMockWriter::HalMockWriter()
+    : json(hal_mock_args_json ? new HalMockJsonWriter() : NULL) {
+}
+
+void HalMockWriter::put_int(const char* name, int x) {
+  if (json) {
+    json->put_int(name, x);
+  } else {
+    binary.put_int(name, x);
+  }
+}
+
+void HalMockWriter::put_byte_array(const char* name, u8* byte_array,
+                                   int array_length) {
+  if (json) {
+    json->put_byte_array(name, byte_array, array_length);
+  } else {
+    binary.put_byte_array(name, byte_array, array_length);
+  }
+}
+
+JNIObject<jbyteArray> HalMockWriter::to_java(JNIHelper& helper) {
+  if (json) {
+    std::string str = json->to_string();
+    JNIObject<jbyteArray> array = helper.newByteArray(str.size());
+    helper.setByteArrayRegion(array, 0, str.size(), (const jbyte*) str.data());
+    return array;
+  }
+
+  JNIObject<jbyteArray> array = helper.newByteArray(binary.size());
+  helper.setByteArrayRegion(array, 0, binary.size(),
+                            (const jbyte*) binary.data());
+  return array;
+}
+
+HalMockReader::HalMockReader(JNIEnv* env, jbyteArray args) {
+  jsize len = env->GetArrayLength(args);
+  buf.resize(len);
+  env->GetByteArrayRegion(args, 0, len, (jbyte*) buf.data());
+
+  /* JSON args are an object, so always start with a '{' */
+  if (len > 0 && buf[0] == '{') {
+    buf.push_back('\0');
+    json.reset(new HalMockJsonReader((const char*) buf.data()));
+  } else {
+    binary.reset(new HalMockBinaryReader(buf.data(), buf.size()));
+  }
+}
+
+int HalMockReader::get_int(const char* key, bool* error) {
+  return json ? json->get_int(key, error) : binary->get_int(key, error);
+}
+
+void HalMockReader::get_byte_array(const char* key, bool* error, u8* array,
+                                   unsigned int max_array_size) {
+  if (json) {
+    json->get_byte_array(key, error, array, max_array_size);
+  } else {
+    binary->get_byte_array(key, error, array, max_array_size);
+  }
+}
+
+const char* HalMockReader::c_str() const {
+  return json ? (const char*) buf.data() : "";
+}
+
 
 int init_wifi_hal_func_table_mock(wifi_hal_fn *fn) {
   if (fn == NULL) {
@@ -190,7 +410,29 @@ extern "C" jint Java_com_android_server_wifi_HalMockUtils_initHalMock(
 
 extern "C" void Java_com_android_server_wifi_HalMockUtils_setHalMockObject(
     JNIEnv* env, jclass clazz, jobject hal_mock_object) {
-  mock_mObj = (jobject) env->NewGlobalRef(hal_mock_object);
+  JNIHelper helper(env, __func__);
+
+  /* called by every test's setup: release the previous test's mock */
+  if (mock_mObj != NULL) {
+    helper.deleteGlobalRef(mock_mObj);
+  }
+  mock_mObj = helper.newGlobalRef(hal_mock_object);
+}
+
+extern "C" void Java_com_android_server_wifi_HalMockUtils_setHalMockArgsJson(
+    JNIEnv* env, jclass clazz, jboolean json) {
+  hal_mock_args_json = json;
+}
+
+extern "C" void Java_com_android_server_wifi_HalMockUtils_setRefAccounting(
+    JNIEnv* env, jclass clazz, jboolean enabled) {
+  JNIHelper::resetRefStats();
+  JNIHelper::setRefAccounting(enabled);
+}
+
+extern "C" jboolean Java_com_android_server_wifi_HalMockUtils_checkRefAccounting(
+    JNIEnv* env, jclass clazz) {
+  return JNIHelper::checkRefStats();
 }
 
 }  // namespace android
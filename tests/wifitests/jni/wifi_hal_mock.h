@@ -19,6 +19,9 @@
 
 #include "wifi_hal.h"
 
+#include <memory>
+#include <vector>
+
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
@@ -52,6 +55,97 @@ class HalMockJsonReader {
   rapidjson::Document doc;
 };
 
+/*
+ * Binary data-model for passing arguments between mock host (java) and mock
+ * HAL (C). Carries the same name -> int | byte_array fields as the JSON one
+ * (see HalMockUtils.java) without building or parsing a DOM. Little-endian:
+ *
+ *   header:     'H' 'M' 'B' version
+ *   int:        0x01 name_len(u8) name s32
+ *   byte_array: 0x02 name_len(u8) name len(u16) bytes
+ */
+class HalMockBinaryWriter {
+ public:
+  HalMockBinaryWriter();
+
+  void put_int(const char* name, int x);
+
+  void put_byte_array(const char* name, u8* byte_array, int array_length);
+
+  const u8* data() const { return buf.data(); }
+  size_t size() const { return buf.size(); }
+
+ private:
+  void put_name(u8 type, const char* name);
+
+  std::vector<u8> buf;
+};
+
+class HalMockBinaryReader {
+ public:
+  HalMockBinaryReader(const u8* data, size_t len);
+
+  int get_int(const char* key, bool* error);
+
+  void get_byte_array(const char* key, bool* error, u8* array,
+                      unsigned int max_array_size);
+
+ private:
+  struct Field {
+    const char* name;
+    size_t name_len;
+    u8 type;
+    const u8* value;
+    size_t len;
+  };
+
+  const Field* find(const char* key, u8 type, bool* error);
+
+  std::vector<Field> fields;
+  size_t next;  /* fields are usually read in the order they were written */
+  bool valid;
+};
+
+/*
+ * Writer and reader used by the mocks: binary by default, JSON when the test
+ * harness selects it with HalMockUtils.setArgsFormat() for debugging.
+ */
+extern bool hal_mock_args_json;
+
+class HalMockWriter {
+ public:
+  HalMockWriter();
+
+  void put_int(const char* name, int x);
+
+  void put_byte_array(const char* name, u8* byte_array, int array_length);
+
+  JNIObject<jbyteArray> to_java(JNIHelper& helper);
+
+ private:
+  std::unique_ptr<HalMockJsonWriter> json;
+  HalMockBinaryWriter binary;
+};
+
+class HalMockReader {
+ public:
+  HalMockReader(JNIEnv* env, jbyteArray args);
+
+  int get_int(const char* key, bool* error);
+
+  void get_byte_array(const char* key, bool* error, u8* array,
+                      unsigned int max_array_size);
+
+  bool is_json() const { return json != nullptr; }
+  size_t size() const { return buf.size(); }
+  const char* c_str() const;  /* JSON text, or "" for binary args */
+
+ private:
+  std::vector<u8> buf;
+  std::unique_ptr<HalMockJsonReader> json;
+  std::unique_ptr<HalMockBinaryReader> binary;
+};
+
 /* declare all HAL mock APIs here*/
 wifi_error wifi_nan_enable_request_mock(transaction_id id,
                                         wifi_interface_handle iface,
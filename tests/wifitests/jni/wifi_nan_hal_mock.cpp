@@ -51,82 +51,80 @@ static NanCallbackHandler mCallbackHandlers;
 wifi_error wifi_nan_enable_request_mock(transaction_id id,
                                         wifi_interface_handle iface,
                                         NanEnableRequest* msg) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_enable_request_mock");
-  HalMockJsonWriter jsonW;
-  jsonW.put_int("master_pref", msg->master_pref);
-  jsonW.put_int("cluster_low", msg->cluster_low);
-  jsonW.put_int("cluster_high", msg->cluster_high);
-  jsonW.put_int("config_support_5g", msg->config_support_5g);
-  jsonW.put_int("support_5g_val", msg->support_5g_val);
-  jsonW.put_int("config_sid_beacon", msg->config_sid_beacon);
-  jsonW.put_int("sid_beacon_val", msg->sid_beacon_val);
-  jsonW.put_int("config_2dot4g_rssi_close", msg->config_2dot4g_rssi_close);
-  jsonW.put_int("rssi_close_2dot4g_val", msg->rssi_close_2dot4g_val);
-  jsonW.put_int("config_2dot4g_rssi_middle", msg->config_2dot4g_rssi_middle);
-  jsonW.put_int("rssi_middle_2dot4g_val", msg->rssi_middle_2dot4g_val);
-  jsonW.put_int("config_2dot4g_rssi_proximity",
+  HalMockWriter argsW;
+  argsW.put_int("master_pref", msg->master_pref);
+  argsW.put_int("cluster_low", msg->cluster_low);
+  argsW.put_int("cluster_high", msg->cluster_high);
+  argsW.put_int("config_support_5g", msg->config_support_5g);
+  argsW.put_int("support_5g_val", msg->support_5g_val);
+  argsW.put_int("config_sid_beacon", msg->config_sid_beacon);
+  argsW.put_int("sid_beacon_val", msg->sid_beacon_val);
+  argsW.put_int("config_2dot4g_rssi_close", msg->config_2dot4g_rssi_close);
+  argsW.put_int("rssi_close_2dot4g_val", msg->rssi_close_2dot4g_val);
+  argsW.put_int("config_2dot4g_rssi_middle", msg->config_2dot4g_rssi_middle);
+  argsW.put_int("rssi_middle_2dot4g_val", msg->rssi_middle_2dot4g_val);
+  argsW.put_int("config_2dot4g_rssi_proximity",
                 msg->config_2dot4g_rssi_proximity);
-  jsonW.put_int("rssi_proximity_2dot4g_val", msg->rssi_proximity_2dot4g_val);
-  jsonW.put_int("config_hop_count_limit", msg->config_hop_count_limit);
-  jsonW.put_int("hop_count_limit_val", msg->hop_count_limit_val);
-  jsonW.put_int("config_2dot4g_support", msg->config_2dot4g_support);
-  jsonW.put_int("support_2dot4g_val", msg->support_2dot4g_val);
-  jsonW.put_int("config_2dot4g_beacons", msg->config_2dot4g_beacons);
-  jsonW.put_int("beacon_2dot4g_val", msg->beacon_2dot4g_val);
-  jsonW.put_int("config_2dot4g_sdf", msg->config_2dot4g_sdf);
-  jsonW.put_int("sdf_2dot4g_val", msg->sdf_2dot4g_val);
-  jsonW.put_int("config_5g_beacons", msg->config_5g_beacons);
-  jsonW.put_int("beacon_5g_val", msg->beacon_5g_val);
-  jsonW.put_int("config_5g_sdf", msg->config_5g_sdf);
-  jsonW.put_int("sdf_5g_val", msg->sdf_5g_val);
-  jsonW.put_int("config_5g_rssi_close", msg->config_5g_rssi_close);
-  jsonW.put_int("rssi_close_5g_val", msg->rssi_close_5g_val);
-  jsonW.put_int("config_5g_rssi_middle", msg->config_5g_rssi_middle);
-  jsonW.put_int("rssi_middle_5g_val", msg->rssi_middle_5g_val);
-  jsonW.put_int("config_5g_rssi_close_proximity",
+  argsW.put_int("rssi_proximity_2dot4g_val", msg->rssi_proximity_2dot4g_val);
+  argsW.put_int("config_hop_count_limit", msg->config_hop_count_limit);
+  argsW.put_int("hop_count_limit_val", msg->hop_count_limit_val);
+  argsW.put_int("config_2dot4g_support", msg->config_2dot4g_support);
+  argsW.put_int("support_2dot4g_val", msg->support_2dot4g_val);
+  argsW.put_int("config_2dot4g_beacons", msg->config_2dot4g_beacons);
+  argsW.put_int("beacon_2dot4g_val", msg->beacon_2dot4g_val);
+  argsW.put_int("config_2dot4g_sdf", msg->config_2dot4g_sdf);
+  argsW.put_int("sdf_2dot4g_val", msg->sdf_2dot4g_val);
+  argsW.put_int("config_5g_beacons", msg->config_5g_beacons);
+  argsW.put_int("beacon_5g_val", msg->beacon_5g_val);
+  argsW.put_int("config_5g_sdf", msg->config_5g_sdf);
+  argsW.put_int("sdf_5g_val", msg->sdf_5g_val);
+  argsW.put_int("config_5g_rssi_close", msg->config_5g_rssi_close);
+  argsW.put_int("rssi_close_5g_val", msg->rssi_close_5g_val);
+  argsW.put_int("config_5g_rssi_middle", msg->config_5g_rssi_middle);
+  argsW.put_int("rssi_middle_5g_val", msg->rssi_middle_5g_val);
+  argsW.put_int("config_5g_rssi_close_proximity",
                 msg->config_5g_rssi_close_proximity);
-  jsonW.put_int("rssi_close_proximity_5g_val",
+  argsW.put_int("rssi_close_proximity_5g_val",
                 msg->rssi_close_proximity_5g_val);
-  jsonW.put_int("config_rssi_window_size", msg->config_rssi_window_size);
-  jsonW.put_int("rssi_window_size_val", msg->rssi_window_size_val);
-  jsonW.put_int("config_oui", msg->config_oui);
-  jsonW.put_int("oui_val", msg->oui_val);
-  jsonW.put_int("config_intf_addr", msg->config_intf_addr);
-  jsonW.put_byte_array("intf_addr_val", msg->intf_addr_val, 6);
-  jsonW.put_int("config_cluster_attribute_val",
+  argsW.put_int("config_rssi_window_size", msg->config_rssi_window_size);
+  argsW.put_int("rssi_window_size_val", msg->rssi_window_size_val);
+  argsW.put_int("config_oui", msg->config_oui);
+  argsW.put_int("oui_val", msg->oui_val);
+  argsW.put_int("config_intf_addr", msg->config_intf_addr);
+  argsW.put_byte_array("intf_addr_val", msg->intf_addr_val, 6);
+  argsW.put_int("config_cluster_attribute_val",
                 msg->config_cluster_attribute_val);
-  jsonW.put_int("config_scan_params", msg->config_scan_params);
-  jsonW.put_int("scan_params_val.dwell_time.0",
+  argsW.put_int("config_scan_params", msg->config_scan_params);
+  argsW.put_int("scan_params_val.dwell_time.0",
                 msg->scan_params_val.dwell_time[NAN_CHANNEL_24G_BAND]);
-  jsonW.put_int("scan_params_val.dwell_time.1",
+  argsW.put_int("scan_params_val.dwell_time.1",
                 msg->scan_params_val.dwell_time[NAN_CHANNEL_5G_BAND_LOW]);
-  jsonW.put_int("scan_params_val.dwell_time.2",
+  argsW.put_int("scan_params_val.dwell_time.2",
                 msg->scan_params_val.dwell_time[NAN_CHANNEL_5G_BAND_HIGH]);
-  jsonW.put_int("scan_params_val.scan_period.0",
+  argsW.put_int("scan_params_val.scan_period.0",
                 msg->scan_params_val.scan_period[NAN_CHANNEL_24G_BAND]);
-  jsonW.put_int("scan_params_val.scan_period.0",
+  argsW.put_int("scan_params_val.scan_period.0",
                 msg->scan_params_val.scan_period[NAN_CHANNEL_5G_BAND_LOW]);
-  jsonW.put_int("scan_params_val.scan_period.0",
+  argsW.put_int("scan_params_val.scan_period.0",
                 msg->scan_params_val.scan_period[NAN_CHANNEL_5G_BAND_HIGH]);
-  jsonW.put_int("config_random_factor_force", msg->config_random_factor_force);
-  jsonW.put_int("random_factor_force_val", msg->random_factor_force_val);
-  jsonW.put_int("config_hop_count_force", msg->config_hop_count_force);
-  jsonW.put_int("hop_count_force_val", msg->hop_count_force_val);
-  std::string str = jsonW.to_string();
+  argsW.put_int("config_random_factor_force", msg->config_random_factor_force);
+  argsW.put_int("random_factor_force_val", msg->random_factor_force_val);
+  argsW.put_int("config_hop_count_force", msg->config_hop_count_force);
+  argsW.put_int("hop_count_force_val", msg->hop_count_force_val);
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
 
-  JNIObject < jstring > json_write_string = helper.newStringUTF(str.c_str());
-
-  helper.callMethod(mock_mObj, "enableHalMockNative", "(SLjava/lang/String;)V",
-                    (short) id, json_write_string.get());
+  helper.callMethod(mock_mObj, "enableHalMockNative", "(S[B)V",
+                    (short) id, args.get());
 
   return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_disable_request_mock(transaction_id id,
                                          wifi_interface_handle iface) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_disable_request_mock");
   helper.callMethod(mock_mObj, "disableHalMockNative", "(S)V", (short) id);
@@ -137,164 +135,187 @@ wifi_error wifi_nan_disable_request_mock(transaction_id id,
 wifi_error wifi_nan_publish_request_mock(transaction_id id,
                                          wifi_interface_handle iface,
                                          NanPublishRequest* msg) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_publish_request_mock");
-  HalMockJsonWriter jsonW;
-  jsonW.put_int("publish_id", msg->publish_id);
-  jsonW.put_int("ttl", msg->ttl);
-  jsonW.put_int("publish_type", msg->publish_type);
-  jsonW.put_int("tx_type", msg->tx_type);
-  jsonW.put_int("publish_count", msg->publish_count);
-  jsonW.put_int("service_name_len", msg->service_name_len);
-  jsonW.put_byte_array("service_name", msg->service_name,
+  HalMockWriter argsW;
+  argsW.put_int("publish_id", msg->publish_id);
+  argsW.put_int("ttl", msg->ttl);
+  argsW.put_int("publish_type", msg->publish_type);
+  argsW.put_int("tx_type", msg->tx_type);
+  argsW.put_int("publish_count", msg->publish_count);
+  argsW.put_int("service_name_len", msg->service_name_len);
+  argsW.put_byte_array("service_name", msg->service_name,
                        msg->service_name_len);
-  jsonW.put_int("publish_match_indicator", msg->publish_match_indicator);
-  jsonW.put_int("service_specific_info_len", msg->service_specific_info_len);
-  jsonW.put_byte_array("service_specific_info", msg->service_specific_info,
+  argsW.put_int("publish_match_indicator", msg->publish_match_indicator);
+  argsW.put_int("service_specific_info_len", msg->service_specific_info_len);
+  argsW.put_byte_array("service_specific_info", msg->service_specific_info,
                        msg->service_specific_info_len);
-  jsonW.put_int("rx_match_filter_len", msg->rx_match_filter_len);
-  jsonW.put_byte_array("rx_match_filter", msg->rx_match_filter,
+  argsW.put_int("rx_match_filter_len", msg->rx_match_filter_len);
+  argsW.put_byte_array("rx_match_filter", msg->rx_match_filter,
                        msg->rx_match_filter_len);
-  jsonW.put_int("tx_match_filter_len", msg->tx_match_filter_len);
-  jsonW.put_byte_array("tx_match_filter", msg->tx_match_filter,
+  argsW.put_int("tx_match_filter_len", msg->tx_match_filter_len);
+  argsW.put_byte_array("tx_match_filter", msg->tx_match_filter,
                        msg->tx_match_filter_len);
-  jsonW.put_int("rssi_threshold_flag", msg->rssi_threshold_flag);
-  jsonW.put_int("connmap", msg->connmap);
-  std::string str = jsonW.to_string();
-
-  JNIObject < jstring > json_write_string = helper.newStringUTF(str.c_str());
+  argsW.put_int("rssi_threshold_flag", msg->rssi_threshold_flag);
+  argsW.put_int("connmap", msg->connmap);
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
 
-  helper.callMethod(mock_mObj, "publishHalMockNative", "(SLjava/lang/String;)V",
-                    (short) id, json_write_string.get());
+  helper.callMethod(mock_mObj, "publishHalMockNative", "(S[B)V",
+                    (short) id, args.get());
   return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_publish_cancel_request_mock(transaction_id id,
                                                 wifi_interface_handle iface,
                                                 NanPublishCancelRequest* msg) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_publish_cancel_request_mock");
-  HalMockJsonWriter jsonW;
-  jsonW.put_int("publish_id", msg->publish_id);
-  std::string str = jsonW.to_string();
-
-  JNIObject < jstring > json_write_string = helper.newStringUTF(str.c_str());
+  HalMockWriter argsW;
+  argsW.put_int("publish_id", msg->publish_id);
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
 
   helper.callMethod(mock_mObj, "publishCancelHalMockNative",
-                    "(SLjava/lang/String;)V", (short) id,
-                    json_write_string.get());
+                    "(S[B)V", (short) id,
+                    args.get());
   return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_subscribe_request_mock(transaction_id id,
                                            wifi_interface_handle iface,
                                            NanSubscribeRequest* msg) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_subscribe_request_mock");
-  HalMockJsonWriter jsonW;
-  jsonW.put_int("subscribe_id", msg->subscribe_id);
-  jsonW.put_int("ttl", msg->ttl);
-  jsonW.put_int("period", msg->period);
-  jsonW.put_int("subscribe_type", msg->subscribe_type);
-  jsonW.put_int("serviceResponseFilter", msg->serviceResponseFilter);
-  jsonW.put_int("serviceResponseInclude", msg->serviceResponseInclude);
-  jsonW.put_int("useServiceResponseFilter", msg->useServiceResponseFilter);
-  jsonW.put_int("ssiRequiredForMatchIndication",
+  HalMockWriter argsW;
+  argsW.put_int("subscribe_id", msg->subscribe_id);
+  argsW.put_int("ttl", msg->ttl);
+  argsW.put_int("period", msg->period);
+  argsW.put_int("subscribe_type", msg->subscribe_type);
+  argsW.put_int("serviceResponseFilter", msg->serviceResponseFilter);
+  argsW.put_int("serviceResponseInclude", msg->serviceResponseInclude);
+  argsW.put_int("useServiceResponseFilter", msg->useServiceResponseFilter);
+  argsW.put_int("ssiRequiredForMatchIndication",
                 msg->ssiRequiredForMatchIndication);
-  jsonW.put_int("subscribe_match_indicator", msg->subscribe_match_indicator);
-  jsonW.put_int("subscribe_count", msg->subscribe_count);
-  jsonW.put_int("service_name_len", msg->service_name_len);
-  jsonW.put_byte_array("service_name", msg->service_name,
+  argsW.put_int("subscribe_match_indicator", msg->subscribe_match_indicator);
+  argsW.put_int("subscribe_count", msg->subscribe_count);
+  argsW.put_int("service_name_len", msg->service_name_len);
+  argsW.put_byte_array("service_name", msg->service_name,
                        msg->service_name_len);
-  jsonW.put_int("service_specific_info_len", msg->service_name_len);
-  jsonW.put_byte_array("service_specific_info", msg->service_specific_info,
+  argsW.put_int("service_specific_info_len", msg->service_name_len);
+  argsW.put_byte_array("service_specific_info", msg->service_specific_info,
                        msg->service_specific_info_len);
-  jsonW.put_int("rx_match_filter_len", msg->rx_match_filter_len);
-  jsonW.put_byte_array("rx_match_filter", msg->rx_match_filter,
+  argsW.put_int("rx_match_filter_len", msg->rx_match_filter_len);
+  argsW.put_byte_array("rx_match_filter", msg->rx_match_filter,
                        msg->rx_match_filter_len);
-  jsonW.put_int("tx_match_filter_len", msg->tx_match_filter_len);
-  jsonW.put_byte_array("tx_match_filter", msg->tx_match_filter,
+  argsW.put_int("tx_match_filter_len", msg->tx_match_filter_len);
+  argsW.put_byte_array("tx_match_filter", msg->tx_match_filter,
                        msg->tx_match_filter_len);
-  jsonW.put_int("rssi_threshold_flag", msg->rssi_threshold_flag);
-  jsonW.put_int("connmap", msg->connmap);
-  jsonW.put_int("num_intf_addr_present", msg->num_intf_addr_present);
-  // TODO: jsonW.put_byte_array("intf_addr", msg->intf_addr, NAN_MAX_SUBSCRIBE_MAX_ADDRESS * NAN_MAC_ADDR_LEN);
-  std::string str = jsonW.to_string();
-
-  JNIObject < jstring > json_write_string = helper.newStringUTF(str.c_str());
+  argsW.put_int("rssi_threshold_flag", msg->rssi_threshold_flag);
+  argsW.put_int("connmap", msg->connmap);
+  argsW.put_int("num_intf_addr_present", msg->num_intf_addr_present);
+  // TODO: argsW.put_byte_array("intf_addr", msg->intf_addr, NAN_MAX_SUBSCRIBE_MAX_ADDRESS * NAN_MAC_ADDR_LEN);
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
 
   helper.callMethod(mock_mObj, "subscribeHalMockNative",
-                    "(SLjava/lang/String;)V", (short) id,
-                    json_write_string.get());
+                    "(S[B)V", (short) id,
+                    args.get());
   return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_subscribe_cancel_request_mock(
     transaction_id id, wifi_interface_handle iface,
     NanSubscribeCancelRequest* msg) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_subscribe_cancel_request_mock");
-  HalMockJsonWriter jsonW;
-  jsonW.put_int("subscribe_id", msg->subscribe_id);
-  std::string str = jsonW.to_string();
-
-  JNIObject < jstring > json_write_string = helper.newStringUTF(str.c_str());
+  HalMockWriter argsW;
+  argsW.put_int("subscribe_id", msg->subscribe_id);
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
 
   helper.callMethod(mock_mObj, "subscribeCancelHalMockNative",
-                    "(SLjava/lang/String;)V", (short) id,
-                    json_write_string.get());
+                    "(S[B)V", (short) id,
+                    args.get());
   return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_transmit_followup_request_mock(
     transaction_id id, wifi_interface_handle iface,
     NanTransmitFollowupRequest* msg) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_transmit_followup_request_mock");
-  HalMockJsonWriter jsonW;
-  jsonW.put_int("publish_subscribe_id", msg->publish_subscribe_id);
-  jsonW.put_int("requestor_instance_id", msg->requestor_instance_id);
-  jsonW.put_byte_array("addr", msg->addr, 6);
-  jsonW.put_int("priority", msg->priority);
-  jsonW.put_int("dw_or_faw", msg->dw_or_faw);
-  jsonW.put_int("service_specific_info_len", msg->service_specific_info_len);
-  jsonW.put_byte_array("service_specific_info", msg->service_specific_info,
+  HalMockWriter argsW;
+  argsW.put_int("publish_subscribe_id", msg->publish_subscribe_id);
+  argsW.put_int("requestor_instance_id", msg->requestor_instance_id);
+  argsW.put_byte_array("addr", msg->addr, 6);
+  argsW.put_int("priority", msg->priority);
+  argsW.put_int("dw_or_faw", msg->dw_or_faw);
+  argsW.put_int("service_specific_info_len", msg->service_specific_info_len);
+  argsW.put_byte_array("service_specific_info", msg->service_specific_info,
                        msg->service_specific_info_len);
 
-  std::string str = jsonW.to_string();
-
-  JNIObject < jstring > json_write_string = helper.newStringUTF(str.c_str());
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
 
   helper.callMethod(mock_mObj, "transmitFollowupHalMockNative",
-                    "(SLjava/lang/String;)V", (short) id,
-                    json_write_string.get());
+                    "(S[B)V", (short) id,
+                    args.get());
   return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_stats_request_mock(transaction_id id,
                                        wifi_interface_handle iface,
                                        NanStatsRequest* msg) {
+  JNIHelper helper(mock_mVM, __func__);
+
   ALOGD("wifi_nan_stats_request_mock");
-  return WIFI_ERROR_UNINITIALIZED;
+  HalMockWriter argsW;
+  argsW.put_int("stats_type", msg->stats_type);
+  argsW.put_int("clear", msg->clear);
+
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
+
+  helper.callMethod(mock_mObj, "statsHalMockNative", "(S[B)V", (short) id,
+                    args.get());
+  return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_config_request_mock(transaction_id id,
                                         wifi_interface_handle iface,
                                         NanConfigRequest* msg) {
+  JNIHelper helper(mock_mVM, __func__);
+
   ALOGD("wifi_nan_config_request_mock");
-  return WIFI_ERROR_UNINITIALIZED;
+  HalMockWriter argsW;
+  argsW.put_int("config_master_pref", msg->config_master_pref);
+  argsW.put_int("master_pref", msg->master_pref);
+
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
+
+  helper.callMethod(mock_mObj, "configHalMockNative", "(S[B)V", (short) id,
+                    args.get());
+  return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_tca_request_mock(transaction_id id,
                                      wifi_interface_handle iface,
                                      NanTCARequest* msg) {
+  JNIHelper helper(mock_mVM, __func__);
+
   ALOGD("wifi_nan_tca_request_mock");
-  return WIFI_ERROR_UNINITIALIZED;
+  HalMockWriter argsW;
+  argsW.put_int("tca_type", msg->tca_type);
+  argsW.put_int("rising_direction_evt_flag", msg->rising_direction_evt_flag);
+  argsW.put_int("falling_direction_evt_flag", msg->falling_direction_evt_flag);
+  argsW.put_int("clear_trigger", msg->clear_trigger);
+  argsW.put_int("threshold", msg->threshold);
+
+  JNIObject<jbyteArray> args = argsW.to_java(helper);
+
+  helper.callMethod(mock_mObj, "tcaHalMockNative", "(S[B)V", (short) id,
+                    args.get());
+  return WIFI_SUCCESS;
 }
 
 wifi_error wifi_nan_beacon_sdf_payload_request_mock(
@@ -318,7 +339,7 @@ wifi_error wifi_nan_get_version_mock(wifi_handle handle, NanVersion* version) {
 
 wifi_error wifi_nan_get_capabilities_mock(transaction_id id,
                                           wifi_interface_handle iface) {
-  JNIHelper helper(mock_mVM);
+  JNIHelper helper(mock_mVM, __func__);
 
   ALOGD("wifi_nan_get_capabilities_mock");
 
@@ -331,48 +352,54 @@ wifi_error wifi_nan_get_capabilities_mock(transaction_id id,
 
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callNotifyResponse(
     JNIEnv* env, jclass clazz, jshort transaction_id,
-    jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callNotifyResponse: '%s'",
-        chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callNotifyResponse: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanResponseMsg msg;
-  msg.status = (NanStatusType) jsonR.get_int("status", &error);
-  msg.value = jsonR.get_int("value", &error);
-  msg.response_type = (NanResponseType) jsonR.get_int("response_type", &error);
+  msg.status = (NanStatusType) argsR.get_int("status", &error);
+  msg.value = argsR.get_int("value", &error);
+  msg.response_type = (NanResponseType) argsR.get_int("response_type", &error);
   if (msg.response_type == NAN_RESPONSE_PUBLISH) {
-    msg.body.publish_response.publish_id = jsonR.get_int(
+    msg.body.publish_response.publish_id = argsR.get_int(
         "body.publish_response.publish_id", &error);
   } else if (msg.response_type == NAN_RESPONSE_SUBSCRIBE) {
-    msg.body.subscribe_response.subscribe_id = jsonR.get_int(
+    msg.body.subscribe_response.subscribe_id = argsR.get_int(
         "body.subscribe_response.subscribe_id", &error);
+  } else if (msg.response_type == NAN_RESPONSE_STATS) {
+    /* the stats struct is passed as its raw bytes */
+    msg.body.stats_response.stats_type = (NanStatsType) argsR.get_int(
+        "body.stats_response.stats_type", &error);
+    argsR.get_byte_array("body.stats_response.data", &error,
+                         (u8*) &msg.body.stats_response.data,
+                         sizeof(msg.body.stats_response.data));
   } else if (msg.response_type == NAN_GET_CAPABILITIES) {
-    msg.body.nan_capabilities.max_concurrent_nan_clusters = jsonR.get_int(
+    msg.body.nan_capabilities.max_concurrent_nan_clusters = argsR.get_int(
         "body.nan_capabilities.max_concurrent_nan_clusters", &error);
-    msg.body.nan_capabilities.max_publishes = jsonR.get_int(
+    msg.body.nan_capabilities.max_publishes = argsR.get_int(
         "body.nan_capabilities.max_publishes", &error);
-    msg.body.nan_capabilities.max_subscribes = jsonR.get_int(
+    msg.body.nan_capabilities.max_subscribes = argsR.get_int(
         "body.nan_capabilities.max_subscribes", &error);
-    msg.body.nan_capabilities.max_service_name_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_service_name_len = argsR.get_int(
         "body.nan_capabilities.max_service_name_len", &error);
-    msg.body.nan_capabilities.max_match_filter_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_match_filter_len = argsR.get_int(
         "body.nan_capabilities.max_match_filter_len", &error);
-    msg.body.nan_capabilities.max_total_match_filter_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_total_match_filter_len = argsR.get_int(
         "body.nan_capabilities.max_total_match_filter_len", &error);
-    msg.body.nan_capabilities.max_service_specific_info_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_service_specific_info_len = argsR.get_int(
         "body.nan_capabilities.max_service_specific_info_len", &error);
-    msg.body.nan_capabilities.max_vsa_data_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_vsa_data_len = argsR.get_int(
         "body.nan_capabilities.max_vsa_data_len", &error);
-    msg.body.nan_capabilities.max_mesh_data_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_mesh_data_len = argsR.get_int(
         "body.nan_capabilities.max_mesh_data_len", &error);
-    msg.body.nan_capabilities.max_ndi_interfaces = jsonR.get_int(
+    msg.body.nan_capabilities.max_ndi_interfaces = argsR.get_int(
         "body.nan_capabilities.max_ndi_interfaces", &error);
-    msg.body.nan_capabilities.max_ndp_sessions = jsonR.get_int(
+    msg.body.nan_capabilities.max_ndp_sessions = argsR.get_int(
         "body.nan_capabilities.max_ndp_sessions", &error);
-    msg.body.nan_capabilities.max_app_info_len = jsonR.get_int(
+    msg.body.nan_capabilities.max_app_info_len = argsR.get_int(
         "body.nan_capabilities.max_app_info_len", &error);
   }
 
@@ -386,18 +413,16 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callNotifyRespon
 }
 
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callPublishTerminated(
-    JNIEnv* env, jclass clazz, jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD(
-      "Java_com_android_server_wifi_nan_WifiNanHalMock_callPublishTerminated: '%s'",
-      chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callPublishTerminated: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanPublishTerminatedInd msg;
-  msg.publish_id = jsonR.get_int("publish_id", &error);
-  msg.reason = (NanStatusType) jsonR.get_int("reason", &error);
+  msg.publish_id = argsR.get_int("publish_id", &error);
+  msg.reason = (NanStatusType) argsR.get_int("reason", &error);
 
   if (error) {
     ALOGE("Java_com_android_server_wifi_nan_WifiNanHalMock_callPublishTerminated: "
@@ -409,18 +434,16 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callPublishTermi
 }
 
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callSubscribeTerminated(
-    JNIEnv* env, jclass clazz, jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD(
-      "Java_com_android_server_wifi_nan_WifiNanHalMock_callSubscribeTerminated: '%s'",
-      chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callSubscribeTerminated: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanSubscribeTerminatedInd msg;
-  msg.subscribe_id = jsonR.get_int("subscribe_id", &error);
-  msg.reason = (NanStatusType) jsonR.get_int("reason", &error);
+  msg.subscribe_id = argsR.get_int("subscribe_id", &error);
+  msg.reason = (NanStatusType) argsR.get_int("reason", &error);
 
   if (error) {
     ALOGE("Java_com_android_server_wifi_nan_WifiNanHalMock_callSubscribeTerminated:"
@@ -432,22 +455,21 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callSubscribeTer
 }
 
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callFollowup(
-    JNIEnv* env, jclass clazz, jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callFollowup: '%s'",
-        chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callFollowup: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanFollowupInd msg;
-  msg.publish_subscribe_id = jsonR.get_int("publish_subscribe_id", &error);
-  msg.requestor_instance_id = jsonR.get_int("requestor_instance_id", &error);
-  jsonR.get_byte_array("addr", &error, msg.addr, NAN_MAC_ADDR_LEN);
-  msg.dw_or_faw = jsonR.get_int("dw_or_faw", &error);
-  msg.service_specific_info_len = jsonR.get_int("service_specific_info_len",
+  msg.publish_subscribe_id = argsR.get_int("publish_subscribe_id", &error);
+  msg.requestor_instance_id = argsR.get_int("requestor_instance_id", &error);
+  argsR.get_byte_array("addr", &error, msg.addr, NAN_MAC_ADDR_LEN);
+  msg.dw_or_faw = argsR.get_int("dw_or_faw", &error);
+  msg.service_specific_info_len = argsR.get_int("service_specific_info_len",
                                                 &error);
-  jsonR.get_byte_array("service_specific_info", &error,
+  argsR.get_byte_array("service_specific_info", &error,
                        msg.service_specific_info,
                        NAN_MAX_SERVICE_SPECIFIC_INFO_LEN);
 
@@ -461,25 +483,24 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callFollowup(
 }
 
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callMatch(
-    JNIEnv* env, jclass clazz, jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callMatch: '%s'",
-        chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callMatch: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanMatchInd msg;
-  msg.publish_subscribe_id = jsonR.get_int("publish_subscribe_id", &error);
-  msg.requestor_instance_id = jsonR.get_int("requestor_instance_id", &error);
-  jsonR.get_byte_array("addr", &error, msg.addr, NAN_MAC_ADDR_LEN);
-  msg.service_specific_info_len = jsonR.get_int("service_specific_info_len",
+  msg.publish_subscribe_id = argsR.get_int("publish_subscribe_id", &error);
+  msg.requestor_instance_id = argsR.get_int("requestor_instance_id", &error);
+  argsR.get_byte_array("addr", &error, msg.addr, NAN_MAC_ADDR_LEN);
+  msg.service_specific_info_len = argsR.get_int("service_specific_info_len",
                                                 &error);
-  jsonR.get_byte_array("service_specific_info", &error,
+  argsR.get_byte_array("service_specific_info", &error,
                        msg.service_specific_info,
                        NAN_MAX_SERVICE_SPECIFIC_INFO_LEN);
-  msg.sdf_match_filter_len = jsonR.get_int("sdf_match_filter_len", &error);
-  jsonR.get_byte_array("sdf_match_filter", &error, msg.sdf_match_filter,
+  msg.sdf_match_filter_len = argsR.get_int("sdf_match_filter_len", &error);
+  argsR.get_byte_array("sdf_match_filter", &error, msg.sdf_match_filter,
                        NAN_MAX_MATCH_FILTER_LEN);
   /* a few more fields here - but not used (yet/never?) */
 
@@ -492,22 +513,42 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callMatch(
   mCallbackHandlers.EventMatch(&msg);
 }
 
+extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callMatchExpired(
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
+  bool error = false;
+
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callMatchExpired: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
+
+  NanMatchExpiredInd msg;
+  msg.publish_subscribe_id = argsR.get_int("publish_subscribe_id", &error);
+  msg.requestor_instance_id = argsR.get_int("requestor_instance_id", &error);
+
+  if (error) {
+    ALOGE("Java_com_android_server_wifi_nan_WifiNanHalMock_callMatchExpired: "
+          "error parsing args");
+    return;
+  }
+
+  mCallbackHandlers.EventMatchExpired(&msg);
+}
+
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callDiscEngEvent(
-    JNIEnv* env, jclass clazz, jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callDiscEngEvent: '%s'",
-        chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callDiscEngEvent: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanDiscEngEventInd msg;
-  msg.event_type = (NanDiscEngEventType) jsonR.get_int("event_type", &error);
+  msg.event_type = (NanDiscEngEventType) argsR.get_int("event_type", &error);
   if (msg.event_type == NAN_EVENT_ID_DISC_MAC_ADDR) {
-    jsonR.get_byte_array("data", &error, msg.data.mac_addr.addr,
+    argsR.get_byte_array("data", &error, msg.data.mac_addr.addr,
                          NAN_MAC_ADDR_LEN);
   } else {
-    jsonR.get_byte_array("data", &error, msg.data.cluster.addr,
+    argsR.get_byte_array("data", &error, msg.data.cluster.addr,
                          NAN_MAC_ADDR_LEN);
   }
 
@@ -521,16 +562,15 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callDiscEngEvent
 }
 
 extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callDisabled(
-    JNIEnv* env, jclass clazz, jstring json_args_jstring) {
-  ScopedUtfChars chars(env, json_args_jstring);
-  HalMockJsonReader jsonR(chars.c_str());
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
   bool error = false;
 
-  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callDisabled: '%s'",
-        chars.c_str());
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callDisabled: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
 
   NanDisabledInd msg;
-  msg.reason = (NanStatusType) jsonR.get_int("reason", &error);
+  msg.reason = (NanStatusType) argsR.get_int("reason", &error);
 
   if (error) {
     ALOGE("Java_com_android_server_wifi_nan_WifiNanHalMock_callDisabled: "
@@ -541,10 +581,64 @@ extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callDisabled(
   mCallbackHandlers.EventDisabled(&msg);
 }
 
+extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callTca(
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
+  bool error = false;
+
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callTca: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
+
+  NanTCAInd msg;
+  msg.tca_type = (NanTcaType) argsR.get_int("tca_type", &error);
+  msg.rising_direction_evt_flag = argsR.get_int("rising_direction_evt_flag",
+                                                &error);
+  msg.falling_direction_evt_flag = argsR.get_int("falling_direction_evt_flag",
+                                                 &error);
+  msg.cluster_size = argsR.get_int("cluster_size", &error);
+
+  if (error) {
+    ALOGE("Java_com_android_server_wifi_nan_WifiNanHalMock_callTca: "
+          "error parsing args");
+    return;
+  }
+
+  mCallbackHandlers.EventTca(&msg);
+}
+
+extern "C" void Java_com_android_server_wifi_nan_WifiNanHalMock_callBeaconSdfPayload(
+    JNIEnv* env, jclass clazz, jbyteArray args) {
+  HalMockReader argsR(env, args);
+  bool error = false;
+
+  ALOGD("Java_com_android_server_wifi_nan_WifiNanHalMock_callBeaconSdfPayload: "
+        "(%zu bytes) '%s'", argsR.size(), argsR.c_str());
+
+  NanBeaconSdfPayloadInd msg;
+  memset(&msg, 0, sizeof(msg));
+  argsR.get_byte_array("addr", &error, msg.addr, NAN_MAC_ADDR_LEN);
+  msg.is_vsa_received = argsR.get_int("is_vsa_received", &error);
+  msg.vsa.vsa_received_on = argsR.get_int("vsa.vsa_received_on", &error);
+  msg.vsa.vendor_oui = argsR.get_int("vsa.vendor_oui", &error);
+  msg.vsa.attr_len = argsR.get_int("vsa.attr_len", &error);
+  argsR.get_byte_array("vsa.vsa", &error, msg.vsa.vsa, NAN_MAX_VSA_DATA_LEN);
+  msg.is_beacon_sdf_payload_received =
+      argsR.get_int("is_beacon_sdf_payload_received", &error);
+  msg.data.frame_len = argsR.get_int("data.frame_len", &error);
+  argsR.get_byte_array("data.frame_data", &error, msg.data.frame_data,
+                       NAN_MAX_FRAME_DATA_LEN);
+
+  if (error) {
+    ALOGE("Java_com_android_server_wifi_nan_WifiNanHalMock_callBeaconSdfPayload: "
+          "error parsing args");
+    return;
+  }
+
+  mCallbackHandlers.EventBeaconSdfPayload(&msg);
+}
+
 // TODO: Not currently used: add as needed
 //void (*EventUnMatch) (NanUnmatchInd* event);
-//void (*EventTca) (NanTCAInd* event);
-//void (*EventBeaconSdfPayload) (NanBeaconSdfPayloadInd* event);
 
 int init_wifi_nan_hal_func_table_mock(wifi_hal_fn *fn) {
   if (fn == NULL) {
@@ -25,7 +25,13 @@ import org.json.JSONArray;
 import org.json.JSONException;
 import org.json.JSONObject;
 
+import java.io.ByteArrayOutputStream;
 import java.lang.reflect.Field;
+import java.nio.BufferUnderflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.Arrays;
 import java.util.Iterator;
 
 public class HalMockUtils {
@@ -37,6 +43,20 @@ public class HalMockUtils {
 
     public static native void setHalMockObject(Object obj);
 
+    private static native void setHalMockArgsJson(boolean json);
+
+    /**
+     * Enable (and reset) the JNI reference accounting of the native bridge; see
+     * JNIHelper::setRefAccounting().
+     */
+    public static native void setRefAccounting(boolean enabled);
+
+    /**
+     * Returns false (and logs the offenders) if any native method or HAL callback that ran since
+     * setRefAccounting(true) returned with live JNI local references.
+     */
+    public static native boolean checkRefAccounting();
+
     static {
         System.loadLibrary("wifi-hal-mock");
     }
@@ -67,6 +87,137 @@ public class HalMockUtils {
         initHalMock();
     }
 
+    /*
+     * Arguments are passed between mock host (java) and mock HAL (C) as a
+     * byte[] holding either of the encodings below. Binary is the default;
+     * JSON is human readable in the logs and is kept for debugging a test.
+     */
+
+    public static final int ARGS_FORMAT_BINARY = 0;
+    public static final int ARGS_FORMAT_JSON = 1;
+
+    private static int sArgsFormat = ARGS_FORMAT_BINARY;
+
+    /**
+     * Select the encoding used for arguments in both directions: by
+     * convertBundleToArgs() and by the mock HAL. Either encoding is accepted by
+     * convertArgsToBundle() and by the mock HAL regardless of this setting.
+     */
+    public static void setArgsFormat(int format) {
+        sArgsFormat = format;
+        setHalMockArgsJson(format == ARGS_FORMAT_JSON);
+    }
+
+    public static Bundle convertArgsToBundle(byte[] args) throws JSONException {
+        if (args.length > 0 && args[0] == '{') {
+            return convertJsonToBundle(new String(args, StandardCharsets.UTF_8));
+        }
+        return convertBinaryToBundle(args);
+    }
+
+    public static byte[] convertBundleToArgs(Bundle bundle) throws JSONException {
+        if (sArgsFormat == ARGS_FORMAT_JSON) {
+            return convertBundleToJson(bundle).toString().getBytes(StandardCharsets.UTF_8);
+        }
+        return convertBundleToBinary(bundle);
+    }
+
+    /*
+     * Binary data-model (see wifi_hal_mock.h), little-endian:
+     *      header:     'H' 'M' 'B' version
+     *      int:        0x01 name_len(u8) name s32
+     *      byte_array: 0x02 name_len(u8) name len(u16) bytes
+     */
+
+    private static final byte[] BINARY_MAGIC = { 'H', 'M', 'B' };
+    private static final byte BINARY_VERSION = 1;
+
+    private static final byte BINARY_TYPE_INT = 1;
+    private static final byte BINARY_TYPE_BYTE_ARRAY = 2;
+
+    public static Bundle convertBinaryToBundle(byte[] args) {
+        if (VDBG) Log.v(TAG, "convertBinaryToBundle: args.length=" + args.length);
+
+        Bundle bundle = new Bundle();
+
+        ByteBuffer buf = ByteBuffer.wrap(args).order(ByteOrder.LITTLE_ENDIAN);
+        try {
+            byte[] magic = new byte[BINARY_MAGIC.length];
+            buf.get(magic);
+            byte version = buf.get();
+            if (!Arrays.equals(magic, BINARY_MAGIC) || version != BINARY_VERSION) {
+                throw new IllegalArgumentException("Unexpected header read from mock HAL");
+            }
+
+            while (buf.hasRemaining()) {
+                byte type = buf.get();
+                int nameLen = buf.get() & 0xFF;
+                if (nameLen > buf.remaining()) {
+                    throw new BufferUnderflowException();
+                }
+                String key = new String(args, buf.position(), nameLen,
+                        StandardCharsets.US_ASCII);
+                buf.position(buf.position() + nameLen);
+
+                if (type == BINARY_TYPE_INT) {
+                    bundle.putInt(key, buf.getInt());
+                } else if (type == BINARY_TYPE_BYTE_ARRAY) {
+                    byte[] bArray = new byte[buf.getShort() & 0xFFFF];
+                    buf.get(bArray);
+                    bundle.putByteArray(key, bArray);
+                } else {
+                    throw new IllegalArgumentException(
+                            "Unexpected TYPE read from mock HAL -- " + type);
+                }
+            }
+        } catch (BufferUnderflowException e) {
+            throw new IllegalArgumentException("Truncated args read from mock HAL", e);
+        }
+
+        if (DBG) Log.d(TAG, "convertBinaryToBundle: returning bundle=" + bundle);
+        return bundle;
+    }
+
+    public static byte[] convertBundleToBinary(Bundle bundle) {
+        if (VDBG) Log.v(TAG, "convertBundleToBinary: bundle=" + bundle.toString());
+
+        ByteArrayOutputStream out = new ByteArrayOutputStream(256);
+        out.write(BINARY_MAGIC, 0, BINARY_MAGIC.length);
+        out.write(BINARY_VERSION);
+        for (String key : bundle.keySet()) {
+            Object value = bundle.get(key);
+            byte[] name = key.getBytes(StandardCharsets.US_ASCII);
+            if (name.length > 0xFF) {
+                throw new IllegalArgumentException("Key is too long: " + key);
+            }
+            if (value instanceof Integer) {
+                out.write(BINARY_TYPE_INT);
+                out.write(name.length);
+                out.write(name, 0, name.length);
+                int x = (Integer) value;
+                for (int i = 0; i < 4; ++i) {
+                    out.write(x >> (8 * i));
+                }
+            } else if (value instanceof byte[]) {
+                byte[] array = (byte[]) value;
+                if (array.length > 0xFFFF) {
+                    throw new IllegalArgumentException("Array is too long: " + key);
+                }
+                out.write(BINARY_TYPE_BYTE_ARRAY);
+                out.write(name.length);
+                out.write(name, 0, name.length);
+                out.write(array.length);
+                out.write(array.length >> 8);
+                out.write(array, 0, array.length);
+            } else {
+                throw new IllegalArgumentException("Unexpected type of bundle value (not an "
+                        + "Integer or byte[]): " + value);
+            }
+        }
+
+        return out.toByteArray();
+    }
+
     /*
      * JSON data-model for passing arguments between mock host (java) and mock
      * HAL (C):
@@ -46,6 +46,9 @@ public class ScanTestUtil {
                 .thenReturn(channels5);
         when(wifiNative.getChannelsForBand(WifiScanner.WIFI_BAND_5_GHZ_DFS_ONLY))
                 .thenReturn(channelsDfs);
+        when(wifiNative.getChannelsForBands(aryEq(new int[] {WifiScanner.WIFI_BAND_24_GHZ,
+                WifiScanner.WIFI_BAND_5_GHZ, WifiScanner.WIFI_BAND_5_GHZ_DFS_ONLY})))
+                .thenReturn(new int[][] {channels24, channels5, channelsDfs});
     }
 
     public static WifiScanner.ScanSettings createRequest(WifiScanner.ChannelSpec[] channels,
@@ -24,7 +24,8 @@ import java.lang.reflect.Field;
  * <ul>
  * <li>HAL API: create a {@code public void} method which takes any fixed
  * arguments (e.g. a {@code short transactionId} and a second argument to
- * provide the rest of the argument as a JSON string: {@code String jsonArgs}.
+ * provide the rest of the argument as an encoded byte array: {@code byte[] args}
+ * (see {@link com.android.server.wifi.HalMockUtils#convertArgsToBundle(byte[])}).
  * <li>Callbacks from HAL: create a {@code public static native} function which
  * is used to trigger the callback from the test harness. The arguments are
  * similar to the HAL API arguments.
@@ -35,7 +36,7 @@ public class WifiNanHalMock {
         throw new IllegalStateException("Please mock this class!");
     }
 
-    public void enableHalMockNative(short transactionId, String jsonArgs) {
+    public void enableHalMockNative(short transactionId, byte[] args) {
         throw new IllegalStateException("Please mock this class!");
     }
 
@@ -43,44 +44,62 @@ public class WifiNanHalMock {
         throw new IllegalStateException("Please mock this class!");
     }
 
-    public void publishHalMockNative(short transactionId, String jsonArgs) {
+    public void publishHalMockNative(short transactionId, byte[] args) {
         throw new IllegalStateException("Please mock this class!");
     }
 
-    public void publishCancelHalMockNative(short transactionId, String jsonArgs) {
+    public void publishCancelHalMockNative(short transactionId, byte[] args) {
         throw new IllegalStateException("Please mock this class!");
     }
 
-    public void subscribeHalMockNative(short transactionId, String jsonArgs) {
+    public void subscribeHalMockNative(short transactionId, byte[] args) {
         throw new IllegalStateException("Please mock this class!");
     }
 
-    public void subscribeCancelHalMockNative(short transactionId, String jsonArgs) {
+    public void subscribeCancelHalMockNative(short transactionId, byte[] args) {
         throw new IllegalStateException("Please mock this class!");
     }
 
-    public void transmitFollowupHalMockNative(short transactionId, String jsonArgs) {
+    public void transmitFollowupHalMockNative(short transactionId, byte[] args) {
+        throw new IllegalStateException("Please mock this class!");
+    }
+
+    public void statsHalMockNative(short transactionId, byte[] args) {
+        throw new IllegalStateException("Please mock this class!");
+    }
+
+    public void configHalMockNative(short transactionId, byte[] args) {
+        throw new IllegalStateException("Please mock this class!");
+    }
+
+    public void tcaHalMockNative(short transactionId, byte[] args) {
         throw new IllegalStateException("Please mock this class!");
     }
 
     /*
-     * trigger callbacks - called by test harness with arguments passed by JSON
-     * string.
+     * trigger callbacks - called by test harness with arguments encoded by
+     * HalMockUtils.convertBundleToArgs().
      */
 
-    public static native void callNotifyResponse(short transactionId, String jsonArgs);
+    public static native void callNotifyResponse(short transactionId, byte[] args);
+
+    public static native void callPublishTerminated(byte[] args);
+
+    public static native void callSubscribeTerminated(byte[] args);
+
+    public static native void callFollowup(byte[] args);
 
-    public static native void callPublishTerminated(String jsonArgs);
+    public static native void callMatch(byte[] args);
 
-    public static native void callSubscribeTerminated(String jsonArgs);
+    public static native void callMatchExpired(byte[] args);
 
-    public static native void callFollowup(String jsonArgs);
+    public static native void callDiscEngEvent(byte[] args);
 
-    public static native void callMatch(String jsonArgs);
+    public static native void callDisabled(byte[] args);
 
-    public static native void callDiscEngEvent(String jsonArgs);
+    public static native void callTca(byte[] args);
 
-    public static native void callDisabled(String jsonArgs);
+    public static native void callBeaconSdfPayload(byte[] args);
 
     /**
      * initialize NAN mock
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.android.server.wifi.nan;
+
+import static org.junit.Assert.assertEquals;
+
+import android.net.wifi.nan.ConfigRequest;
+import android.os.Bundle;
+import android.test.suitebuilder.annotation.LargeTest;
+import android.util.Log;
+
+import com.android.server.wifi.HalMockUtils;
+import com.android.server.wifi.WifiNative;
+
+import libcore.util.HexEncoding;
+
+import org.json.JSONException;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.mockito.Mock;
+import org.mockito.MockitoAnnotations;
+
+import java.lang.reflect.Field;
+
+/**
+ * Measures the cost of the NAN HAL mock round trip - JNI bridge, mock HAL and
+ * argument encoding - for each argument format supported by HalMockUtils.
+ * Results are logged with the tag WifiNanHalMockBenchmark (see README.md).
+ */
+@LargeTest
+public class WifiNanHalMockBenchmark {
+    private static final String TAG = "WifiNanHalMockBenchmark";
+
+    private static final int WARMUP_ITERATIONS = 100;
+    private static final int ITERATIONS = 2000;
+
+    private WifiNanNative mDut = WifiNanNative.getInstance();
+    private CountingNanHalMock mNanHalMock = new CountingNanHalMock();
+    @Mock private WifiNanStateManager mNanStateManager;
+
+    /**
+     * Decodes every request, as a test verifying the arguments would.
+     */
+    private static class CountingNanHalMock extends WifiNanHalMock {
+        public int requests;
+
+        @Override
+        public void enableHalMockNative(short transactionId, byte[] args) {
+            try {
+                HalMockUtils.convertArgsToBundle(args);
+            } catch (JSONException e) {
+                throw new IllegalStateException(e);
+            }
+            requests++;
+        }
+    }
+
+    @Before
+    public void setup() throws Exception {
+        MockitoAnnotations.initMocks(this);
+
+        HalMockUtils.initHalMockLibrary();
+        WifiNanHalMock.initNanHalMockLibrary();
+        WifiNanNative.initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index, 0);
+        HalMockUtils.setHalMockObject(mNanHalMock);
+
+        Field field = WifiNanStateManager.class.getDeclaredField("sNanStateManagerSingleton");
+        field.setAccessible(true);
+        field.set(null, mNanStateManager);
+    }
+
+    @After
+    public void tearDown() {
+        HalMockUtils.setArgsFormat(HalMockUtils.ARGS_FORMAT_BINARY);
+    }
+
+    @Test
+    public void benchmarkEnableRequest() throws Exception {
+        long jsonNs = runEnableRequests(HalMockUtils.ARGS_FORMAT_JSON);
+        long binaryNs = runEnableRequests(HalMockUtils.ARGS_FORMAT_BINARY);
+
+        report("enable request", jsonNs, binaryNs);
+    }
+
+    @Test
+    public void benchmarkMatchCallback() throws Exception {
+        long jsonNs = runMatchCallbacks(HalMockUtils.ARGS_FORMAT_JSON);
+        long binaryNs = runMatchCallbacks(HalMockUtils.ARGS_FORMAT_BINARY);
+
+        report("match callback", jsonNs, binaryNs);
+    }
+
+    /*
+     * Utilities
+     */
+
+    private long runEnableRequests(int format) {
+        ConfigRequest configRequest = new ConfigRequest.Builder().setClusterLow(5)
+                .setClusterHigh(100).setMasterPreference(111).setSupport5gBand(true).build();
+
+        HalMockUtils.setArgsFormat(format);
+        for (int i = 0; i < WARMUP_ITERATIONS; ++i) {
+            mDut.enableAndConfigure((short) i, configRequest);
+        }
+
+        mNanHalMock.requests = 0;
+        long start = System.nanoTime();
+        for (int i = 0; i < ITERATIONS; ++i) {
+            mDut.enableAndConfigure((short) i, configRequest);
+        }
+        long elapsed = System.nanoTime() - start;
+
+        assertEquals(ITERATIONS, mNanHalMock.requests);
+        return elapsed / ITERATIONS;
+    }
+
+    private long runMatchCallbacks(int format) throws JSONException {
+        final String filter = "most likely binary - but faking here with some string data";
+
+        /* alternate the SSI so the bridge reports every match instead of suppressing repeats */
+        Bundle[] args = new Bundle[2];
+        for (int i = 0; i < args.length; ++i) {
+            String ssi = "some service specific info - really arbitrary #" + i;
+            args[i] = new Bundle();
+            args[i].putInt("publish_subscribe_id", 287);
+            args[i].putInt("requestor_instance_id", 98);
+            args[i].putByteArray("addr", HexEncoding.decode("010203040506".toCharArray(), false));
+            args[i].putInt("service_specific_info_len", ssi.length());
+            args[i].putByteArray("service_specific_info", ssi.getBytes());
+            args[i].putInt("sdf_match_filter_len", filter.length());
+            args[i].putByteArray("sdf_match_filter", filter.getBytes());
+        }
+
+        HalMockUtils.setArgsFormat(format);
+        for (int i = 0; i < WARMUP_ITERATIONS; ++i) {
+            WifiNanHalMock.callMatch(HalMockUtils.convertBundleToArgs(args[i % 2]));
+        }
+
+        long start = System.nanoTime();
+        for (int i = 0; i < ITERATIONS; ++i) {
+            WifiNanHalMock.callMatch(HalMockUtils.convertBundleToArgs(args[i % 2]));
+        }
+        return (System.nanoTime() - start) / ITERATIONS;
+    }
+
+    private static void report(String name, long jsonNs, long binaryNs) {
+        Log.i(TAG, name + ": json=" + jsonNs + " ns/op binary=" + binaryNs + " ns/op speedup="
+                + String.format("%.1fx", (double) jsonNs / Math.max(binaryNs, 1)));
+    }
+}
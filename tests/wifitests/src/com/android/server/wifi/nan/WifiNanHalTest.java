@@ -17,8 +17,17 @@
 package com.android.server.wifi.nan;
 
 import static org.hamcrest.core.IsEqual.equalTo;
+import static org.hamcrest.core.StringContains.containsString;
+import static org.junit.Assert.assertTrue;
+import static org.mockito.Matchers.any;
+import static org.mockito.Matchers.anyInt;
+import static org.mockito.Matchers.anyShort;
 import static org.mockito.Matchers.eq;
+import static org.mockito.Mockito.inOrder;
+import static org.mockito.Mockito.never;
+import static org.mockito.Mockito.times;
 import static org.mockito.Mockito.verify;
+import static org.mockito.Mockito.verifyNoMoreInteractions;
 import static org.mockito.Mockito.verifyZeroInteractions;
 
 import android.net.wifi.nan.ConfigRequest;
@@ -37,15 +46,20 @@ import com.android.server.wifi.WifiNative;
 import libcore.util.HexEncoding;
 
 import org.json.JSONException;
+import org.junit.After;
 import org.junit.Before;
 import org.junit.Rule;
 import org.junit.Test;
 import org.junit.rules.ErrorCollector;
 import org.mockito.ArgumentCaptor;
+import org.mockito.InOrder;
 import org.mockito.Mock;
 import org.mockito.MockitoAnnotations;
 
 import java.lang.reflect.Field;
+import java.lang.reflect.Method;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.Arrays;
 
 /**
@@ -53,8 +67,11 @@ import java.util.Arrays;
  */
 @SmallTest
 public class WifiNanHalTest {
+    // transaction id of the JNI bridge's own cluster size alert requests
+    private static final short TCA_TRANSACTION_ID = (short) 0xEFFF;
+
     private WifiNanNative mDut = WifiNanNative.getInstance();
-    private ArgumentCaptor<String> mArgs = ArgumentCaptor.forClass(String.class);
+    private ArgumentCaptor<byte[]> mArgs = ArgumentCaptor.forClass(byte[].class);
 
     @Mock
     private WifiNanHalMock mNanHalMock;
@@ -69,11 +86,18 @@ public class WifiNanHalTest {
 
         HalMockUtils.initHalMockLibrary();
         WifiNanHalMock.initNanHalMockLibrary();
-        WifiNanNative.initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index);
+        HalMockUtils.setRefAccounting(true);
+        WifiNanNative.initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index, 0);
         HalMockUtils.setHalMockObject(mNanHalMock);
         installMockNanStateManager(mNanStateManager);
     }
 
+    @After
+    public void tearDown() {
+        assertTrue("JNI local references leaked (see logcat)", HalMockUtils.checkRefAccounting());
+        HalMockUtils.setRefAccounting(false);
+    }
+
     @Test
     public void testEnableWith5g() throws JSONException {
         final short transactionId = 2346;
@@ -96,6 +120,199 @@ public class WifiNanHalTest {
         testEnable(transactionId, clusterLow, clusterHigh, masterPref, enable5g);
     }
 
+    @Test
+    public void testEnableWithJsonArgs() throws JSONException {
+        final short transactionId = 7765;
+        final int clusterLow = 11;
+        final int clusterHigh = 98;
+        final int masterPref = 45;
+        final boolean enable5g = true;
+
+        HalMockUtils.setArgsFormat(HalMockUtils.ARGS_FORMAT_JSON);
+        try {
+            testEnable(transactionId, clusterLow, clusterHigh, masterPref, enable5g);
+        } finally {
+            HalMockUtils.setArgsFormat(HalMockUtils.ARGS_FORMAT_BINARY);
+        }
+    }
+
+    @Test
+    public void testReconfigureMasterPreference() throws JSONException {
+        final short enableTransactionId = 13;
+        final short configTransactionId = 14;
+        final int masterPref = 120;
+
+        enableNan(enableTransactionId, new ConfigRequest.Builder().setMasterPreference(34)
+                .build());
+
+        mDut.enableAndConfigure(configTransactionId,
+                new ConfigRequest.Builder().setMasterPreference(masterPref).build());
+
+        verify(mNanHalMock).configHalMockNative(eq(configTransactionId), mArgs.capture());
+        verify(mNanHalMock, never()).enableHalMockNative(eq(configTransactionId),
+                any(byte[].class));
+
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
+
+        collector.checkThat("config_master_pref", argsData.getInt("config_master_pref"),
+                equalTo(1));
+        collector.checkThat("master_pref", argsData.getInt("master_pref"), equalTo(masterPref));
+    }
+
+    @Test
+    public void testReconfigure5gRequiresEnable() throws JSONException {
+        final short enableTransactionId = 15;
+        final short configTransactionId = 16;
+
+        enableNan(enableTransactionId, new ConfigRequest.Builder().setSupport5gBand(false)
+                .build());
+
+        mDut.enableAndConfigure(configTransactionId,
+                new ConfigRequest.Builder().setSupport5gBand(true).build());
+
+        verify(mNanHalMock).enableHalMockNative(eq(configTransactionId), any(byte[].class));
+        verify(mNanHalMock, never()).configHalMockNative(anyShort(), any(byte[].class));
+    }
+
+    @Test
+    public void testReconfigureUnchangedCompletes() throws JSONException {
+        final short enableTransactionId = 17;
+        final short configTransactionId = 18;
+        final ConfigRequest configRequest = new ConfigRequest.Builder().setClusterLow(5)
+                .setClusterHigh(100).setMasterPreference(60).build();
+
+        enableNan(enableTransactionId, configRequest);
+
+        mDut.enableAndConfigure(configTransactionId, configRequest);
+
+        verify(mNanStateManager).onConfigCompleted(configTransactionId);
+        verify(mNanHalMock, never()).enableHalMockNative(eq(configTransactionId),
+                any(byte[].class));
+        verify(mNanHalMock, never()).configHalMockNative(anyShort(), any(byte[].class));
+    }
+
+    @Test
+    public void testClusterSizeAlertArmedOnEnable() throws JSONException {
+        enableNan((short) 19, new ConfigRequest.Builder().build());
+
+        verify(mNanHalMock).tcaHalMockNative(eq(TCA_TRANSACTION_ID), mArgs.capture());
+
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
+
+        collector.checkThat("tca_type", argsData.getInt("tca_type"), equalTo(0));
+        collector.checkThat("rising_direction_evt_flag",
+                argsData.getInt("rising_direction_evt_flag"), equalTo(1));
+        collector.checkThat("falling_direction_evt_flag",
+                argsData.getInt("falling_direction_evt_flag"), equalTo(1));
+        collector.checkThat("threshold", argsData.getInt("threshold"), equalTo(8));
+    }
+
+    @Test
+    public void testClusterSizeAlertNotArmedFromCallback() throws JSONException {
+        final short transactionId = 23;
+
+        mDut.enableAndConfigure(transactionId, new ConfigRequest.Builder().build());
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_SUCCESS);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_ENABLED);
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanHalMock, never()).tcaHalMockNative(anyShort(), any(byte[].class));
+
+        mDut.rearmClusterSizeAlert();
+        mDut.rearmClusterSizeAlert();
+
+        verify(mNanHalMock, times(1)).tcaHalMockNative(eq(TCA_TRANSACTION_ID),
+                any(byte[].class));
+    }
+
+    @Test
+    public void testClusterSizeAlertScalesDiscoveryPeriod() throws JSONException {
+        final short publishTransactionId = 21;
+        final int clusterSize = 20;
+
+        enableNan((short) 20, new ConfigRequest.Builder().build());
+        callNotifyResponseTca(WifiNanNative.NAN_STATUS_SUCCESS);
+        callTca(true, clusterSize);
+
+        verify(mNanStateManager).onClusterSizeChange(true, clusterSize);
+
+        mDut.publish(publishTransactionId, 0,
+                new PublishData.Builder().setServiceName("dense").build(),
+                new PublishSettings.Builder()
+                        .setPublishType(PublishSettings.PUBLISH_TYPE_UNSOLICITED).build());
+
+        verify(mNanHalMock).publishHalMockNative(eq(publishTransactionId), mArgs.capture());
+
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
+
+        // 500 ms scaled by cluster size / threshold (8)
+        collector.checkThat("period", argsData.getInt("period"), equalTo(1250));
+    }
+
+    @Test
+    public void testClusterSizeAlertDroppedWhenNotArmed() throws JSONException {
+        enableNan((short) 22, new ConfigRequest.Builder().build());
+        callNotifyResponseTca(WifiNanNative.NAN_STATUS_DE_FAILURE);
+        callTca(true, 12);
+
+        verify(mNanStateManager, never()).onClusterSizeChange(true, 12);
+    }
+
+    @Test
+    public void testBeaconSdfPayload() throws JSONException {
+        final byte[] peer = HexEncoding.decode("0A0B0C0D0E0F".toCharArray(), false);
+        final int vendorOui = 0x506F9A;
+        final byte[] vsa = HexEncoding.decode("DD0102".toCharArray(), false);
+        final byte[] frame = HexEncoding.decode("0405060708".toCharArray(), false);
+
+        Bundle args = new Bundle();
+        args.putByteArray("addr", peer);
+        args.putInt("is_vsa_received", 1);
+        args.putInt("vsa.vsa_received_on", 1);
+        args.putInt("vsa.vendor_oui", vendorOui);
+        args.putInt("vsa.attr_len", vsa.length);
+        args.putByteArray("vsa.vsa", vsa);
+        args.putInt("is_beacon_sdf_payload_received", 1);
+        args.putInt("data.frame_len", frame.length);
+        args.putByteArray("data.frame_data", frame);
+
+        WifiNanHalMock.callBeaconSdfPayload(HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager).onBeaconSdfPayload(peer, vendorOui, vsa, frame);
+    }
+
+    @Test
+    public void testBeaconSdfPayloadsTruncated() throws Exception {
+        final byte[] peer = HexEncoding.decode("0A0B0C0D0E0F".toCharArray(), false);
+        final int vendorOui = 0x506F9A;
+        final byte[] vsa = HexEncoding.decode("DD0102".toCharArray(), false);
+        final byte[] frame = HexEncoding.decode("0405060708".toCharArray(), false);
+
+        ByteBuffer record = ByteBuffer.allocate(6 + 1 + 1 + 4 + 2 + vsa.length + 2 + frame.length)
+                .order(ByteOrder.LITTLE_ENDIAN);
+        record.put(peer).put((byte) 0x03).put((byte) 1).putInt(vendorOui);
+        record.putShort((short) vsa.length).put(vsa).putShort((short) frame.length).put(frame);
+        byte[] one = record.array();
+
+        Method parse = WifiNanNative.class.getDeclaredMethod("onBeaconSdfPayloads",
+                byte[].class);
+        parse.setAccessible(true);
+
+        // a whole record followed by every possible truncation of a second one
+        for (int length = 1; length < one.length; ++length) {
+            byte[] stream = Arrays.copyOf(one, one.length + length);
+            System.arraycopy(one, 0, stream, one.length, length);
+            parse.invoke(null, stream);
+        }
+
+        verify(mNanStateManager, times(one.length - 1)).onBeaconSdfPayload(peer, vendorOui,
+                vsa, frame);
+        verifyNoMoreInteractions(mNanStateManager);
+    }
+
     @Test
     public void testDisable() {
         final short transactionId = 5478;
@@ -156,11 +373,78 @@ public class WifiNanHalTest {
 
         verify(mNanHalMock).publishCancelHalMockNative(eq(transactionId), mArgs.capture());
 
-        Bundle argsData = HalMockUtils.convertJsonToBundle(mArgs.getValue());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
 
         collector.checkThat("publish_id", argsData.getInt("publish_id"), equalTo(publishId));
     }
 
+    @Test
+    public void testPublishUpdate() throws JSONException {
+        final short transactionId = 31;
+        final short updateTransactionId = 32;
+        final int publishId = 19;
+        final String serviceName = "some-service-name";
+        final String ssi = "some arbitrary data";
+        final String updatedSsi = "some other and longer arbitrary data";
+        final int publishCount = 4;
+        final int publishTtl = 25;
+
+        TlvBufferUtils.TlvConstructor tlvTx = new TlvBufferUtils.TlvConstructor(0, 1);
+        tlvTx.allocate(150).putByte(0, (byte) 10).putInt(0, 100);
+
+        TlvBufferUtils.TlvConstructor tlvRx = new TlvBufferUtils.TlvConstructor(0, 1);
+        tlvRx.allocate(150).putByte(0, (byte) 66).putString(0, "some other string");
+
+        testPublish(transactionId, 0, PublishSettings.PUBLISH_TYPE_UNSOLICITED, serviceName,
+                ssi, tlvTx, tlvRx, publishCount, publishTtl);
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_SUCCESS);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_PUBLISH);
+        args.putInt("body.publish_response.publish_id", publishId);
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+
+        // the update drops the tx filter: it must not linger from the previous request
+        PublishData publishData = new PublishData.Builder().setServiceName(serviceName)
+                .setServiceSpecificInfo(updatedSsi)
+                .setRxFilter(tlvRx.getArray(), tlvRx.getActualLength()).build();
+        PublishSettings publishSettings = new PublishSettings.Builder()
+                .setPublishType(PublishSettings.PUBLISH_TYPE_UNSOLICITED)
+                .setPublishCount(publishCount).setTtlSec(publishTtl).build();
+
+        mDut.publish(updateTransactionId, publishId, publishData, publishSettings);
+
+        verify(mNanHalMock).publishHalMockNative(eq(updateTransactionId), mArgs.capture());
+
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
+
+        collector.checkThat("publish_id", argsData.getInt("publish_id"), equalTo(publishId));
+        collector.checkThat("service_specific_info", argsData.getByteArray("service_specific_info"),
+                equalTo(updatedSsi.getBytes()));
+        collector.checkThat("tx_match_filter_len", argsData.getInt("tx_match_filter_len"),
+                equalTo(0));
+        collector.checkThat("rx_match_filter_len", argsData.getInt("rx_match_filter_len"),
+                equalTo(tlvRx.getActualLength()));
+        collector.checkThat("publish_count", argsData.getInt("publish_count"),
+                equalTo(publishCount));
+    }
+
+    @Test
+    public void testPublishFilterTooLong() throws JSONException {
+        final short transactionId = 33;
+        final int filterLength = 256;   // NAN_MAX_MATCH_FILTER_LEN is 255
+
+        PublishData publishData = new PublishData.Builder().setServiceName("some-service-name")
+                .setTxFilter(new byte[filterLength], filterLength).build();
+        PublishSettings publishSettings = new PublishSettings.Builder()
+                .setPublishType(PublishSettings.PUBLISH_TYPE_UNSOLICITED).build();
+
+        mDut.publish(transactionId, 0, publishData, publishSettings);
+
+        verify(mNanHalMock, never()).publishHalMockNative(anyShort(), any(byte[].class));
+    }
+
     @Test
     public void testSubscribePassive() throws JSONException {
         final short transactionId = 45;
@@ -212,7 +496,7 @@ public class WifiNanHalTest {
 
         verify(mNanHalMock).subscribeCancelHalMockNative(eq(transactionId), mArgs.capture());
 
-        Bundle argsData = HalMockUtils.convertJsonToBundle(mArgs.getValue());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
 
         collector.checkThat("subscribe_id", argsData.getInt("subscribe_id"), equalTo(subscribeId));
     }
@@ -230,7 +514,7 @@ public class WifiNanHalTest {
 
         verify(mNanHalMock).transmitFollowupHalMockNative(eq(transactionId), mArgs.capture());
 
-        Bundle argsData = HalMockUtils.convertJsonToBundle(mArgs.getValue());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
 
         collector.checkThat("publish_subscribe_id", argsData.getInt("publish_subscribe_id"),
                 equalTo(pubSubId));
@@ -245,6 +529,233 @@ public class WifiNanHalTest {
                 equalTo(msg.getBytes()));
     }
 
+    @Test
+    public void testSendMessagePipelinedUpToWindow() throws JSONException {
+        final int initialWindow = 4;
+        final int numMessages = initialWindow + 2;
+
+        for (int i = 0; i < numMessages; ++i) {
+            sendMessage((short) (100 + i));
+        }
+        for (int i = 0; i < initialWindow; ++i) {
+            verify(mNanHalMock).transmitFollowupHalMockNative(eq((short) (100 + i)),
+                    (byte[]) any());
+        }
+        verify(mNanHalMock, never()).transmitFollowupHalMockNative(
+                eq((short) (100 + initialWindow)), (byte[]) any());
+
+        callNotifyResponseTransmitFollowup((short) 100, WifiNanNative.NAN_STATUS_SUCCESS);
+
+        // the next message is not submitted from the HAL callback
+        verify(mNanStateManager).onMessageSendSuccess((short) 100);
+        verify(mNanStateManager).onFollowupsReady();
+        verify(mNanHalMock, never()).transmitFollowupHalMockNative(
+                eq((short) (100 + initialWindow)), (byte[]) any());
+
+        mDut.transmitQueuedMessages();
+
+        verify(mNanHalMock).transmitFollowupHalMockNative(eq((short) (100 + initialWindow)),
+                (byte[]) any());
+        verify(mNanHalMock, never()).transmitFollowupHalMockNative(
+                eq((short) (100 + initialWindow + 1)), (byte[]) any());
+    }
+
+    @Test
+    public void testSendMessageRetriedWhenFirmwareQueueFull() throws JSONException {
+        final short transactionId = 77;
+
+        sendMessage(transactionId);
+        callNotifyResponseTransmitFollowup(transactionId,
+                WifiNanNative.NAN_STATUS_NO_SPACE_AVAILABLE);
+        verify(mNanStateManager).onFollowupsReady();
+        mDut.transmitQueuedMessages();
+
+        verify(mNanHalMock, times(2)).transmitFollowupHalMockNative(eq(transactionId),
+                (byte[]) any());
+        verify(mNanStateManager, never()).onMessageSendFail(anyShort(), anyInt());
+
+        callNotifyResponseTransmitFollowup(transactionId, WifiNanNative.NAN_STATUS_SUCCESS);
+
+        verify(mNanStateManager).onMessageSendSuccess(transactionId);
+    }
+
+    @Test
+    public void testSendMessageQueueFull() throws JSONException {
+        final int queueSize = 32;
+
+        for (int i = 0; i <= queueSize; ++i) {
+            sendMessage((short) (200 + i));
+        }
+
+        verify(mNanStateManager).onMessageSendFail((short) (200 + queueSize),
+                WifiNanSessionListener.FAIL_REASON_NO_RESOURCES);
+        verify(mNanStateManager, times(1)).onMessageSendFail(anyShort(), anyInt());
+    }
+
+    @Test
+    public void testSendMessageFailedWhenNanDown() throws JSONException {
+        final int numMessages = 6;
+
+        for (int i = 0; i < numMessages; ++i) {
+            sendMessage((short) (300 + i));
+        }
+
+        Bundle args = new Bundle();
+        args.putInt("reason", WifiNanNative.NAN_STATUS_DE_FAILURE);
+        WifiNanHalMock.callDisabled(HalMockUtils.convertBundleToArgs(args));
+
+        for (int i = 0; i < numMessages; ++i) {
+            verify(mNanStateManager).onMessageSendFail((short) (300 + i),
+                    WifiNanSessionListener.FAIL_REASON_OTHER);
+        }
+        verify(mNanStateManager).onNanDown(WifiNanSessionListener.FAIL_REASON_OTHER);
+    }
+
+    @Test
+    public void testSessionTracked() throws JSONException {
+        final short transactionId = 71;
+        final int publishId = 42;
+        final byte[] peer = HexEncoding.decode("0A0B0C0D0E0F".toCharArray(), false);
+
+        startPublish(transactionId, publishId, "tracked-service");
+        callMatch(publishId, 3, peer, "ssi", "filter");
+        callMatch(publishId, 5, peer, "ssi", "filter");
+        callMatchExpired(publishId, 3);
+
+        String dump = WifiNanNative.dumpSessionsNative();
+
+        collector.checkThat("session", dump,
+                containsString("publish 42 [active] service=\"tracked-service\""));
+        collector.checkThat("counters", dump, containsString("peers=1 matches=2 expired=1"));
+    }
+
+    @Test
+    public void testDuplicateTerminationDropped() throws JSONException {
+        final short transactionId = 72;
+        final int publishId = 43;
+
+        startPublish(transactionId, publishId, "some-service");
+
+        Bundle args = new Bundle();
+        args.putInt("publish_id", publishId);
+        args.putInt("reason", WifiNanNative.NAN_TERMINATED_REASON_COUNT_REACHED);
+        WifiNanHalMock.callPublishTerminated(HalMockUtils.convertBundleToArgs(args));
+        WifiNanHalMock.callPublishTerminated(HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager, times(1)).onPublishTerminated(publishId,
+                WifiNanSessionListener.TERMINATE_REASON_DONE);
+        collector.checkThat("session", WifiNanNative.dumpSessionsNative(),
+                containsString("publish 43 [terminated]"));
+    }
+
+    @Test
+    public void testCancelResponseConsumed() throws JSONException {
+        final short transactionId = 73;
+        final short cancelTransactionId = 74;
+        final int publishId = 44;
+
+        startPublish(transactionId, publishId, "some-service");
+        mDut.stopPublish(cancelTransactionId, publishId);
+
+        collector.checkThat("cancelling", WifiNanNative.dumpSessionsNative(),
+                containsString("publish 44 [cancelling]"));
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_INVALID_HANDLE);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_PUBLISH_CANCEL);
+        WifiNanHalMock.callNotifyResponse(cancelTransactionId,
+                HalMockUtils.convertBundleToArgs(args));
+
+        String dump = WifiNanNative.dumpSessionsNative();
+        collector.checkThat("session", dump, containsString("publish 44 [active]"));
+        collector.checkThat("failures", dump, containsString("failures=1"));
+        verify(mNanStateManager, never()).onUnknownTransaction(anyInt(),
+                eq(cancelTransactionId), anyInt());
+    }
+
+    @Test
+    public void testTerminationAfterCancelForwarded() throws JSONException {
+        final short transactionId = 75;
+        final short cancelTransactionId = 76;
+        final int subscribeId = 45;
+
+        startSubscribe(transactionId, subscribeId, "some-service");
+        mDut.stopSubscribe(cancelTransactionId, subscribeId);
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_SUCCESS);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_SUBSCRIBE_CANCEL);
+        WifiNanHalMock.callNotifyResponse(cancelTransactionId,
+                HalMockUtils.convertBundleToArgs(args));
+
+        collector.checkThat("session", WifiNanNative.dumpSessionsNative(),
+                containsString("subscribe 45 [terminated]"));
+
+        args = new Bundle();
+        args.putInt("subscribe_id", subscribeId);
+        args.putInt("reason", WifiNanNative.NAN_TERMINATED_REASON_USER_REQUEST);
+        WifiNanHalMock.callSubscribeTerminated(HalMockUtils.convertBundleToArgs(args));
+        WifiNanHalMock.callSubscribeTerminated(HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager, times(1)).onSubscribeTerminated(subscribeId,
+                WifiNanSessionListener.TERMINATE_REASON_DONE);
+    }
+
+    @Test
+    public void testStatsSampled() throws JSONException {
+        final int numDwStats = 20;
+        ArgumentCaptor<Short> transactionId = ArgumentCaptor.forClass(Short.class);
+
+        assertTrue(mDut.requestStats(1 << WifiNanNative.NAN_STATS_ID_DE_DW));
+
+        verify(mNanHalMock).statsHalMockNative(transactionId.capture(), mArgs.capture());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
+        collector.checkThat("stats_type", argsData.getInt("stats_type"),
+                equalTo(WifiNanNative.NAN_STATS_ID_DE_DW));
+        collector.checkThat("clear", argsData.getInt("clear"), equalTo(0));
+
+        ByteBuffer data = ByteBuffer.allocate(numDwStats * 4).order(ByteOrder.nativeOrder());
+        for (int i = 0; i < numDwStats; ++i) {
+            data.putInt(i + 1);
+        }
+        callNotifyResponseStats(transactionId.getValue(), WifiNanNative.NAN_STATUS_SUCCESS,
+                WifiNanNative.NAN_STATS_ID_DE_DW, data.array());
+
+        long[] samples = mDut.getStatsSamples(0);
+
+        collector.checkThat("length", samples.length,
+                equalTo(WifiNanNative.STATS_SAMPLE_HEADER_SIZE + numDwStats));
+        collector.checkThat("type", samples[WifiNanNative.STATS_SAMPLE_TYPE],
+                equalTo((long) WifiNanNative.NAN_STATS_ID_DE_DW));
+        collector.checkThat("num values", samples[WifiNanNative.STATS_SAMPLE_NUM_VALUES],
+                equalTo((long) numDwStats));
+        for (int i = 0; i < numDwStats; ++i) {
+            collector.checkThat("value " + i,
+                    samples[WifiNanNative.STATS_SAMPLE_HEADER_SIZE + i], equalTo((long) i + 1));
+        }
+        verifyZeroInteractions(mNanStateManager);
+    }
+
+    @Test
+    public void testStatsFailureNotSampled() throws JSONException {
+        ArgumentCaptor<Short> transactionId = ArgumentCaptor.forClass(Short.class);
+
+        assertTrue(mDut.requestStats((1 << WifiNanNative.NAN_STATS_ID_DE_MAC)
+                | (1 << WifiNanNative.NAN_STATS_ID_DE_TIMING_SYNC)));
+
+        verify(mNanHalMock, times(2)).statsHalMockNative(transactionId.capture(),
+                (byte[]) any());
+        for (Short id : transactionId.getAllValues()) {
+            callNotifyResponseStats(id, WifiNanNative.NAN_STATUS_TIMEOUT,
+                    WifiNanNative.NAN_STATS_ID_DE_MAC, new byte[0]);
+        }
+
+        collector.checkThat("samples", mDut.getStatsSamples(0).length, equalTo(0));
+        verifyZeroInteractions(mNanStateManager);
+    }
+
     @Test
     public void testNotifyCapabilities() throws JSONException {
         final short transactionId = 23;
@@ -285,7 +796,7 @@ public class WifiNanHalTest {
         args.putInt("body.nan_capabilities.max_app_info_len", max_app_info_len);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onCapabilitiesUpdate(eq(transactionId),
                 capabilitiesCapture.capture());
@@ -324,7 +835,7 @@ public class WifiNanHalTest {
         args.putInt("response_type", WifiNanNative.NAN_RESPONSE_ENABLED);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onConfigCompleted(transactionId);
     }
@@ -339,7 +850,7 @@ public class WifiNanHalTest {
         args.putInt("response_type", WifiNanNative.NAN_RESPONSE_ENABLED);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onConfigFailed(transactionId,
                 WifiNanSessionListener.FAIL_REASON_INVALID_ARGS);
@@ -357,7 +868,7 @@ public class WifiNanHalTest {
         args.putInt("body.publish_response.publish_id", publishId);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onPublishSuccess(transactionId, publishId);
     }
@@ -374,7 +885,7 @@ public class WifiNanHalTest {
         args.putInt("body.publish_response.publish_id", publishId);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onPublishFail(transactionId,
                 WifiNanSessionListener.FAIL_REASON_NO_RESOURCES);
@@ -391,7 +902,7 @@ public class WifiNanHalTest {
         args.putInt("response_type", WifiNanNative.NAN_RESPONSE_PUBLISH_CANCEL);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verifyZeroInteractions(mNanStateManager);
     }
@@ -408,7 +919,7 @@ public class WifiNanHalTest {
         args.putInt("body.subscribe_response.subscribe_id", subscribeId);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onSubscribeSuccess(transactionId, subscribeId);
     }
@@ -425,7 +936,7 @@ public class WifiNanHalTest {
         args.putInt("body.subscribe_response.subscribe_id", subscribeId);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onSubscribeFail(transactionId,
                 WifiNanSessionListener.FAIL_REASON_OTHER);
@@ -442,7 +953,7 @@ public class WifiNanHalTest {
         args.putInt("response_type", WifiNanNative.NAN_RESPONSE_SUBSCRIBE_CANCEL);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verifyZeroInteractions(mNanStateManager);
     }
@@ -457,7 +968,7 @@ public class WifiNanHalTest {
         args.putInt("response_type", WifiNanNative.NAN_RESPONSE_TRANSMIT_FOLLOWUP);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onMessageSendSuccess(transactionId);
     }
@@ -472,7 +983,7 @@ public class WifiNanHalTest {
         args.putInt("response_type", WifiNanNative.NAN_RESPONSE_TRANSMIT_FOLLOWUP);
 
         WifiNanHalMock.callNotifyResponse(transactionId,
-                HalMockUtils.convertBundleToJson(args).toString());
+                HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onMessageSendFail(transactionId,
                 WifiNanSessionListener.FAIL_REASON_OTHER);
@@ -486,7 +997,7 @@ public class WifiNanHalTest {
         args.putInt("publish_id", publishId);
         args.putInt("reason", WifiNanNative.NAN_TERMINATED_REASON_COUNT_REACHED);
 
-        WifiNanHalMock.callPublishTerminated(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callPublishTerminated(HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onPublishTerminated(publishId,
                 WifiNanSessionListener.TERMINATE_REASON_DONE);
@@ -500,7 +1011,7 @@ public class WifiNanHalTest {
         args.putInt("subscribe_id", subscribeId);
         args.putInt("reason", WifiNanNative.NAN_TERMINATED_REASON_FAILURE);
 
-        WifiNanHalMock.callSubscribeTerminated(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callSubscribeTerminated(HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onSubscribeTerminated(subscribeId,
                 WifiNanSessionListener.TERMINATE_REASON_FAIL);
@@ -521,7 +1032,7 @@ public class WifiNanHalTest {
         args.putInt("service_specific_info_len", message.length());
         args.putByteArray("service_specific_info", message.getBytes());
 
-        WifiNanHalMock.callFollowup(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callFollowup(HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onMessageReceived(pubSubId, reqInstanceId, peer,
                 message.getBytes(), message.length());
@@ -544,12 +1055,102 @@ public class WifiNanHalTest {
         args.putInt("sdf_match_filter_len", filter.length());
         args.putByteArray("sdf_match_filter", filter.getBytes());
 
-        WifiNanHalMock.callMatch(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callMatch(HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onMatch(pubSubId, reqInstanceId, peer, ssi.getBytes(),
                 ssi.length(), filter.getBytes(), filter.length());
     }
 
+    @Test
+    public void testMatchDuplicateSuppressed() throws JSONException {
+        final int pubSubId = 287;
+        final int reqInstanceId = 98;
+        final byte[] peer = HexEncoding.decode("010203040506".toCharArray(), false);
+        final String ssi = "some service specific info";
+        final String updatedSsi = "some updated service specific info";
+        final String filter = "a match filter";
+
+        callMatch(pubSubId, reqInstanceId, peer, ssi, filter);
+        callMatch(pubSubId, reqInstanceId, peer, ssi, filter);
+        callMatch(pubSubId, reqInstanceId, peer, updatedSsi, filter);
+
+        InOrder inOrder = inOrder(mNanStateManager);
+        inOrder.verify(mNanStateManager).onMatch(pubSubId, reqInstanceId, peer, ssi.getBytes(),
+                ssi.length(), filter.getBytes(), filter.length());
+        inOrder.verify(mNanStateManager).onMatch(pubSubId, reqInstanceId, peer,
+                updatedSsi.getBytes(), updatedSsi.length(), filter.getBytes(), filter.length());
+        verifyNoMoreInteractions(mNanStateManager);
+    }
+
+    @Test
+    public void testMatchBatchFlushedBeforeFollowup() throws JSONException {
+        final int pubSubId = 287;
+        final byte[] peer1 = HexEncoding.decode("010203040506".toCharArray(), false);
+        final byte[] peer2 = HexEncoding.decode("0a0b0c0d0e0f".toCharArray(), false);
+        final String ssi = "some service specific info";
+        final String filter = "a match filter";
+        final String message = "hey there - are you there?";
+
+        WifiNanNative.initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index, 60000);
+
+        callMatch(pubSubId, 1, peer1, ssi, filter);
+        callMatch(pubSubId, 2, peer2, ssi, "");
+        verifyZeroInteractions(mNanStateManager);
+
+        Bundle args = new Bundle();
+        args.putInt("publish_subscribe_id", pubSubId);
+        args.putInt("requestor_instance_id", 2);
+        args.putByteArray("addr", peer2);
+        args.putInt("dw_or_faw", 0);
+        args.putInt("service_specific_info_len", message.length());
+        args.putByteArray("service_specific_info", message.getBytes());
+        WifiNanHalMock.callFollowup(HalMockUtils.convertBundleToArgs(args));
+
+        InOrder inOrder = inOrder(mNanStateManager);
+        inOrder.verify(mNanStateManager).onMatch(pubSubId, 1, peer1, ssi.getBytes(),
+                ssi.length(), filter.getBytes(), filter.length());
+        inOrder.verify(mNanStateManager).onMatch(pubSubId, 2, peer2, ssi.getBytes(),
+                ssi.length(), new byte[0], 0);
+        inOrder.verify(mNanStateManager).onMessageReceived(pubSubId, 2, peer2,
+                message.getBytes(), message.length());
+    }
+
+    @Test
+    public void testMatchExpired() throws JSONException {
+        final int pubSubId = 287;
+        final int reqInstanceId = 98;
+        final byte[] peer = HexEncoding.decode("010203040506".toCharArray(), false);
+        final String ssi = "some service specific info";
+        final String filter = "a match filter";
+
+        callMatch(pubSubId, reqInstanceId, peer, ssi, filter);
+        callMatchExpired(pubSubId, reqInstanceId);
+        callMatch(pubSubId, reqInstanceId, peer, ssi, filter);
+
+        InOrder inOrder = inOrder(mNanStateManager);
+        inOrder.verify(mNanStateManager).onMatch(pubSubId, reqInstanceId, peer, ssi.getBytes(),
+                ssi.length(), filter.getBytes(), filter.length());
+        inOrder.verify(mNanStateManager).onMatchExpired(pubSubId, reqInstanceId);
+        inOrder.verify(mNanStateManager).onMatch(pubSubId, reqInstanceId, peer, ssi.getBytes(),
+                ssi.length(), filter.getBytes(), filter.length());
+    }
+
+    @Test
+    public void testMatchExpiredBeforeDelivery() throws JSONException {
+        final int pubSubId = 287;
+        final int reqInstanceId = 98;
+        final byte[] peer = HexEncoding.decode("010203040506".toCharArray(), false);
+
+        WifiNanNative.initNanHandlersNative(WifiNative.class, WifiNative.sWlan0Index, 60000);
+
+        callMatch(pubSubId, reqInstanceId, peer, "some service specific info", "");
+        callMatchExpired(pubSubId, reqInstanceId);
+
+        verify(mNanStateManager, never()).onMatch(anyInt(), anyInt(), (byte[]) any(),
+                (byte[]) any(), anyInt(), (byte[]) any(), anyInt());
+        verify(mNanStateManager, never()).onMatchExpired(anyInt(), anyInt());
+    }
+
     @Test
     public void testDiscoveryInterfaceChange() throws JSONException {
         final byte[] mac = HexEncoding.decode("060504030201".toCharArray(), false);
@@ -558,7 +1159,7 @@ public class WifiNanHalTest {
         args.putInt("event_type", WifiNanNative.NAN_EVENT_ID_DISC_MAC_ADDR);
         args.putByteArray("data", mac);
 
-        WifiNanHalMock.callDiscEngEvent(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callDiscEngEvent(HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onInterfaceAddressChange(mac);
     }
@@ -571,7 +1172,7 @@ public class WifiNanHalTest {
         args.putInt("event_type", WifiNanNative.NAN_EVENT_ID_JOINED_CLUSTER);
         args.putByteArray("data", mac);
 
-        WifiNanHalMock.callDiscEngEvent(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callDiscEngEvent(HalMockUtils.convertBundleToArgs(args));
 
         verify(mNanStateManager).onClusterChange(WifiNanClientState.CLUSTER_CHANGE_EVENT_JOINED,
                 mac);
@@ -582,7 +1183,22 @@ public class WifiNanHalTest {
         Bundle args = new Bundle();
         args.putInt("reason", WifiNanNative.NAN_STATUS_DE_FAILURE);
 
-        WifiNanHalMock.callDisabled(HalMockUtils.convertBundleToJson(args).toString());
+        WifiNanHalMock.callDisabled(HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager).onNanDown(WifiNanSessionListener.FAIL_REASON_OTHER);
+    }
+
+    @Test
+    public void testDisabledWithJsonArgs() throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("reason", WifiNanNative.NAN_STATUS_DE_FAILURE);
+
+        HalMockUtils.setArgsFormat(HalMockUtils.ARGS_FORMAT_JSON);
+        try {
+            WifiNanHalMock.callDisabled(HalMockUtils.convertBundleToArgs(args));
+        } finally {
+            HalMockUtils.setArgsFormat(HalMockUtils.ARGS_FORMAT_BINARY);
+        }
 
         verify(mNanStateManager).onNanDown(WifiNanSessionListener.FAIL_REASON_OTHER);
     }
@@ -591,6 +1207,45 @@ public class WifiNanHalTest {
      * Utilities
      */
 
+    private void callNotifyResponseTca(int status) throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("status", status);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_TCA);
+
+        WifiNanHalMock.callNotifyResponse(TCA_TRANSACTION_ID,
+                HalMockUtils.convertBundleToArgs(args));
+    }
+
+    private void callTca(boolean rising, int clusterSize) throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("tca_type", 0);
+        args.putInt("rising_direction_evt_flag", rising ? 1 : 0);
+        args.putInt("falling_direction_evt_flag", rising ? 0 : 1);
+        args.putInt("cluster_size", clusterSize);
+
+        WifiNanHalMock.callTca(HalMockUtils.convertBundleToArgs(args));
+    }
+
+    private void enableNan(short transactionId, ConfigRequest configRequest)
+            throws JSONException {
+        mDut.enableAndConfigure(transactionId, configRequest);
+
+        verify(mNanHalMock).enableHalMockNative(eq(transactionId), any(byte[].class));
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_SUCCESS);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_ENABLED);
+
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager).onConfigCompleted(transactionId);
+
+        // as WifiNanStateManager does once it processes the completion
+        mDut.rearmClusterSizeAlert();
+    }
+
     private void testEnable(short transactionId, int clusterLow, int clusterHigh, int masterPref,
             boolean enable5g) throws JSONException {
         ConfigRequest configRequest = new ConfigRequest.Builder().setClusterLow(clusterLow)
@@ -601,7 +1256,7 @@ public class WifiNanHalTest {
 
         verify(mNanHalMock).enableHalMockNative(eq(transactionId), mArgs.capture());
 
-        Bundle argsData = HalMockUtils.convertJsonToBundle(mArgs.getValue());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
 
         collector.checkThat("master_pref", argsData.getInt("master_pref"), equalTo(masterPref));
         collector.checkThat("cluster_low", argsData.getInt("cluster_low"), equalTo(clusterLow));
@@ -662,7 +1317,7 @@ public class WifiNanHalTest {
 
         verify(mNanHalMock).publishHalMockNative(eq(transactionId), mArgs.capture());
 
-        Bundle argsData = HalMockUtils.convertJsonToBundle(mArgs.getValue());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
 
         collector.checkThat("publish_id", argsData.getInt("publish_id"), equalTo(publishId));
         collector.checkThat("ttl", argsData.getInt("ttl"), equalTo(publishTtl));
@@ -711,7 +1366,7 @@ public class WifiNanHalTest {
 
         verify(mNanHalMock).subscribeHalMockNative(eq(transactionId), mArgs.capture());
 
-        Bundle argsData = HalMockUtils.convertJsonToBundle(mArgs.getValue());
+        Bundle argsData = HalMockUtils.convertArgsToBundle(mArgs.getValue());
 
         collector.checkThat("subscribe_id", argsData.getInt("subscribe_id"), equalTo(subscribeId));
         collector.checkThat("ttl", argsData.getInt("ttl"), equalTo(subscribeTtl));
@@ -753,6 +1408,92 @@ public class WifiNanHalTest {
                 equalTo(0));
     }
 
+    private void sendMessage(short transactionId) {
+        final byte[] peer = HexEncoding.decode("000102030405".toCharArray(), false);
+        final String msg = "Hello there - how are you doing?";
+
+        mDut.sendMessage(transactionId, 22, 11, peer, msg.getBytes(), msg.length());
+    }
+
+    private void callNotifyResponseTransmitFollowup(short transactionId, int status)
+            throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("status", status);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_TRANSMIT_FOLLOWUP);
+
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+    }
+
+    private void startPublish(short transactionId, int publishId, String serviceName)
+            throws JSONException {
+        PublishData publishData = new PublishData.Builder().setServiceName(serviceName).build();
+        PublishSettings publishSettings = new PublishSettings.Builder()
+                .setPublishType(PublishSettings.PUBLISH_TYPE_UNSOLICITED).build();
+        mDut.publish(transactionId, 0, publishData, publishSettings);
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_SUCCESS);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_PUBLISH);
+        args.putInt("body.publish_response.publish_id", publishId);
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager).onPublishSuccess(transactionId, publishId);
+    }
+
+    private void startSubscribe(short transactionId, int subscribeId, String serviceName)
+            throws JSONException {
+        SubscribeData subscribeData = new SubscribeData.Builder().setServiceName(serviceName)
+                .build();
+        SubscribeSettings subscribeSettings = new SubscribeSettings.Builder()
+                .setSubscribeType(SubscribeSettings.SUBSCRIBE_TYPE_PASSIVE).build();
+        mDut.subscribe(transactionId, 0, subscribeData, subscribeSettings);
+
+        Bundle args = new Bundle();
+        args.putInt("status", WifiNanNative.NAN_STATUS_SUCCESS);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_SUBSCRIBE);
+        args.putInt("body.subscribe_response.subscribe_id", subscribeId);
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+
+        verify(mNanStateManager).onSubscribeSuccess(transactionId, subscribeId);
+    }
+
+    private void callNotifyResponseStats(short transactionId, int status, int statsType,
+            byte[] data) throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("status", status);
+        args.putInt("value", 0);
+        args.putInt("response_type", WifiNanNative.NAN_RESPONSE_STATS);
+        args.putInt("body.stats_response.stats_type", statsType);
+        args.putByteArray("body.stats_response.data", data);
+
+        WifiNanHalMock.callNotifyResponse(transactionId, HalMockUtils.convertBundleToArgs(args));
+    }
+
+    private void callMatch(int pubSubId, int reqInstanceId, byte[] peer, String ssi,
+            String filter) throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("publish_subscribe_id", pubSubId);
+        args.putInt("requestor_instance_id", reqInstanceId);
+        args.putByteArray("addr", peer);
+        args.putInt("service_specific_info_len", ssi.length());
+        args.putByteArray("service_specific_info", ssi.getBytes());
+        args.putInt("sdf_match_filter_len", filter.length());
+        args.putByteArray("sdf_match_filter", filter.getBytes());
+
+        WifiNanHalMock.callMatch(HalMockUtils.convertBundleToArgs(args));
+    }
+
+    private void callMatchExpired(int pubSubId, int reqInstanceId) throws JSONException {
+        Bundle args = new Bundle();
+        args.putInt("publish_subscribe_id", pubSubId);
+        args.putInt("requestor_instance_id", reqInstanceId);
+
+        WifiNanHalMock.callMatchExpired(HalMockUtils.convertBundleToArgs(args));
+    }
+
     private static void installMockNanStateManager(WifiNanStateManager nanStateManager)
             throws Exception {
         Field field = WifiNanStateManager.class.getDeclaredField("sNanStateManagerSingleton");
@@ -18,13 +18,18 @@ package com.android.server.wifi.nan;
 
 import static org.hamcrest.core.IsEqual.equalTo;
 import static org.hamcrest.core.IsNull.nullValue;
+import static org.junit.Assert.assertEquals;
 import static org.junit.Assert.assertTrue;
 import static org.mockito.Matchers.anyShort;
 import static org.mockito.Matchers.eq;
 import static org.mockito.Mockito.inOrder;
 import static org.mockito.Mockito.mock;
+import static org.mockito.Mockito.never;
+import static org.mockito.Mockito.times;
+import static org.mockito.Mockito.verify;
 import static org.mockito.Mockito.verifyNoMoreInteractions;
 import static org.mockito.Mockito.verifyZeroInteractions;
+import static org.mockito.Mockito.when;
 
 import android.net.wifi.nan.ConfigRequest;
 import android.net.wifi.nan.IWifiNanEventListener;
@@ -638,6 +643,8 @@ public class WifiNanStateManagerTest {
 
         validateInternalTransactionInfoCleanedUp(transactionIdConfig);
         validateInternalTransactionInfoCleanedUp(transactionIdPublish);
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener).onConfigCompleted(configRequest);
         inOrder.verify(mockSessionListener).onMessageReceived(peerId1, msgFromPeer1.getBytes(),
                 msgFromPeer1.length());
@@ -733,6 +740,8 @@ public class WifiNanStateManagerTest {
 
         validateInternalTransactionInfoCleanedUp(transactionIdConfig);
         validateInternalTransactionInfoCleanedUp(transactionIdPublish);
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener).onConfigCompleted(configRequest);
         inOrder.verify(mockSessionListener).onMessageReceived(peerId, msgFromPeer1.getBytes(),
                 msgFromPeer1.length());
@@ -807,6 +816,8 @@ public class WifiNanStateManagerTest {
         mMockLooper.dispatchAll();
 
         validateInternalTransactionInfoCleanedUp(transactionId.getValue());
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener1).onConfigCompleted(configRequest1);
 
         mDut.connect(uid2, mockListener2, WifiNanEventListener.LISTEN_CONFIG_COMPLETED);
@@ -828,6 +839,8 @@ public class WifiNanStateManagerTest {
         mMockLooper.dispatchAll();
 
         validateInternalTransactionInfoCleanedUp(transactionId.getValue());
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener1).onConfigCompleted(crCapture.getValue());
 
         mDut.connect(uid3, mockListener3, WifiNanEventListener.LISTEN_CONFIG_COMPLETED);
@@ -849,6 +862,8 @@ public class WifiNanStateManagerTest {
         mMockLooper.dispatchAll();
 
         validateInternalTransactionInfoCleanedUp(transactionId.getValue());
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener1).onConfigCompleted(crCapture.getValue());
 
         mDut.disconnect(uid2);
@@ -863,6 +878,8 @@ public class WifiNanStateManagerTest {
         mMockLooper.dispatchAll();
 
         validateInternalTransactionInfoCleanedUp(transactionId.getValue());
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener1).onConfigCompleted(crCapture.getValue());
 
         mDut.disconnect(uid1);
@@ -877,6 +894,8 @@ public class WifiNanStateManagerTest {
         mMockLooper.dispatchAll();
 
         validateInternalTransactionInfoCleanedUp(transactionId.getValue());
+        inOrder.verify(mMockNative).rearmClusterSizeAlert();
+        inOrder.verify(mMockNative).requestStats(WifiNanStateManager.STATS_TYPES);
         inOrder.verify(mockListener3).onConfigCompleted(crCapture.getValue());
 
         mDut.disconnect(uid3);
@@ -1070,6 +1089,96 @@ public class WifiNanStateManagerTest {
         }
     }
 
+    /**
+     * Validate that the transaction IDs wrap before the range the JNI bridge
+     * uses for its own TCA and stats requests (0xEFFF and up).
+     */
+    @Test
+    public void testTransactionIdSkipsReservedRange() {
+        int lastId = 0;
+        for (int i = 0; i < 0x10000; ++i) {
+            int id = mDut.createNextTransactionId() & 0xffff;
+            assertTrue("Transaction ID " + id + " in the reserved range", id < 0xEFFF);
+            assertTrue("Transaction ID 0 is never used", id != 0);
+            if (id < lastId) {
+                assertEquals("Transaction ID wrapped from " + lastId, 0xEFFE, lastId);
+                assertEquals("Transaction ID wrapped to " + id, 1, id);
+            }
+            lastId = id;
+        }
+    }
+
+    @Test
+    public void testFollowupsReadySubmitsQueue() {
+        mDut.onFollowupsReady();
+        verify(mMockNative, never()).transmitQueuedMessages();
+
+        mMockLooper.dispatchAll();
+
+        verify(mMockNative).transmitQueuedMessages();
+    }
+
+    /**
+     * Validate that the stats are sampled every period once NAN is enabled,
+     * and that a reconfiguration does not restart the sampling.
+     */
+    @Test
+    public void testStatsSampledEveryPeriod() {
+        final int periodMs = WifiNanStateManager.STATS_DEFAULT_PERIOD_MS;
+        final int statsTypes = WifiNanStateManager.STATS_TYPES;
+
+        when(mMockNative.requestStats(statsTypes)).thenReturn(true);
+
+        mDut.onConfigCompleted((short) 1);
+        mMockLooper.dispatchAll();
+        verify(mMockNative).requestStats(statsTypes);
+
+        mMockLooper.moveTimeForward(periodMs - 1);
+        mDut.onConfigCompleted((short) 2);
+        mMockLooper.dispatchAll();
+        verify(mMockNative).requestStats(statsTypes);
+
+        mMockLooper.moveTimeForward(1);
+        mMockLooper.dispatchAll();
+        verify(mMockNative, times(2)).requestStats(statsTypes);
+    }
+
+    @Test
+    public void testStatsSamplingStopsOnFailure() {
+        final int periodMs = WifiNanStateManager.STATS_DEFAULT_PERIOD_MS;
+        final int statsTypes = WifiNanStateManager.STATS_TYPES;
+
+        when(mMockNative.requestStats(statsTypes)).thenReturn(true, false);
+
+        mDut.onConfigCompleted((short) 1);
+        mMockLooper.dispatchAll();
+        mMockLooper.moveTimeForward(periodMs);
+        mMockLooper.dispatchAll();
+        verify(mMockNative, times(2)).requestStats(statsTypes);
+
+        mMockLooper.moveTimeForward(periodMs);
+        mMockLooper.dispatchAll();
+        verify(mMockNative, times(2)).requestStats(statsTypes);
+    }
+
+    @Test
+    public void testStatsSamplingStopsOnNanDown() {
+        final int periodMs = WifiNanStateManager.STATS_DEFAULT_PERIOD_MS;
+        final int statsTypes = WifiNanStateManager.STATS_TYPES;
+
+        when(mMockNative.requestStats(statsTypes)).thenReturn(true);
+
+        mDut.onConfigCompleted((short) 1);
+        mMockLooper.dispatchAll();
+        verify(mMockNative).requestStats(statsTypes);
+
+        mDut.onNanDown(WifiNanSessionListener.FAIL_REASON_NO_RESOURCES);
+        mMockLooper.dispatchAll();
+        mMockLooper.moveTimeForward(periodMs);
+        mMockLooper.dispatchAll();
+        verify(mMockNative).requestStats(statsTypes);
+    }
+
     /*
      * Tests of internal state of WifiNanStateManager: very limited (not usually
      * a good idea). However, these test that the internal state is cleaned-up